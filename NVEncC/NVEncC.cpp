@@ -32,11 +32,20 @@
 #include <locale.h>
 #include <signal.h>
 #include <fcntl.h>
+#if !(defined(_WIN32) || defined(_WIN64))
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 #include <filesystem>
 #include <algorithm>
 #include <numeric>
 #include <vector>
 #include <set>
+#include <list>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <functional>
 #include <cstdio>
 #include "rgy_version.h"
 #include "rgy_util.h"
@@ -44,6 +53,8 @@
 #include "rgy_codepage.h"
 #include "rgy_resource.h"
 #include "rgy_env.h"
+#include "rgy_socket.h"
+#include "rgy_frame_stats.h"
 #include "NVEncDevice.h"
 #include "NVEncParam.h"
 #include "NVEncUtil.h"
@@ -161,6 +172,13 @@ int parse_print_options(const TCHAR *option_name, const TCHAR *arg1, const RGYPa
         show_environment_info();
         return 1;
     }
+    if (IS_OPTION("frame-stats-summary")) {
+        if (arg1 == nullptr || arg1[0] == _T('\0')) {
+            _ftprintf(stderr, _T("frame stats file is not specified.\n"));
+            return -1;
+        }
+        return rgy_frame_stats_summary(arg1, stdout) == 0 ? 1 : -1;
+    }
     if (IS_OPTION("check-features")) {
         int deviceid = 0;
         if (arg1 && arg1[0] != '-') {
@@ -368,6 +386,304 @@ static int set_signal_handler() {
     return ret;
 }
 
+//パラメータの解析・チェックを行い、エンコードを実行する
+//onStartedはエンコーダの初期化完了時に、初期化に要した時間(ms)とともに呼ばれる
+static int run_encode(std::vector<const TCHAR *>& args, bool allowPipe, bool *abortFlag, std::function<void(double)> onStarted) {
+    const auto timeStart = std::chrono::system_clock::now();
+    InEncodeVideoParam encPrm;
+    NV_ENC_CODEC_CONFIG codecPrm[RGY_CODEC_NUM] = { 0 };
+    codecPrm[RGY_CODEC_H264] = DefaultParamH264();
+    codecPrm[RGY_CODEC_HEVC] = DefaultParamHEVC();
+    codecPrm[RGY_CODEC_AV1]  = DefaultParamAV1();
+
+    if (parse_cmd(&encPrm, codecPrm, (int)args.size()-1, args.data())) {
+        return 1;
+    }
+    //オプションチェック
+    if (0 == encPrm.common.inputFilename.length()) {
+        _ftprintf(stderr, _T("Input file is not specified.\n"));
+        return -1;
+    }
+    if (0 == encPrm.common.outputFilename.length()) {
+        _ftprintf(stderr, _T("Output file is not specified.\n"));
+        return -1;
+    }
+    if (!allowPipe
+        && (encPrm.common.inputFilename == _T("-") || encPrm.common.outputFilename == _T("-"))) {
+        _ftprintf(stderr, _T("pipe input/output is not supported in server mode.\n"));
+        return 1;
+    }
+
+    if (encPrm.common.inputFilename != _T("-")
+        && encPrm.common.outputFilename != _T("-")
+        && rgy_path_is_same(encPrm.common.inputFilename, encPrm.common.outputFilename)) {
+        _ftprintf(stderr, _T("destination file is equal to source file!\n"));
+        return 1;
+    }
+
+#if defined(_WIN32) || defined(_WIN64)
+    //set stdin to binary mode when using pipe input
+    if (_tcscmp(encPrm.common.inputFilename.c_str(), _T("-")) == NULL) {
+        if (_setmode(_fileno(stdin), _O_BINARY) == 1) {
+            _ftprintf(stderr, _T("Error: failed to switch stdin to binary mode.\n"));
+            return 1;
+        }
+    }
+
+    //set stdout to binary mode when using pipe output
+    if (_tcscmp(encPrm.common.outputFilename.c_str(), _T("-")) == NULL) {
+        if (_setmode(_fileno(stdout), _O_BINARY) == 1) {
+            _ftprintf(stderr, _T("Error: failed to switch stdout to binary mode.\n"));
+            return 1;
+        }
+    }
+#endif //#if defined(_WIN32) || defined(_WIN64)
+
+    encPrm.encConfig.encodeCodecConfig = codecPrm[encPrm.codec_rgy];
+
+    int ret = 1;
+
+    NVEncCore nvEnc;
+    if (   NV_ENC_SUCCESS == nvEnc.Initialize(&encPrm)
+        && NV_ENC_SUCCESS == nvEnc.InitEncode(&encPrm)) {
+        nvEnc.SetAbortFlagPointer(abortFlag);
+        set_signal_handler();
+        if (onStarted) {
+            onStarted(std::chrono::duration<double, std::milli>(std::chrono::system_clock::now() - timeStart).count());
+        }
+        nvEnc.PrintEncodingParamsInfo(RGY_LOG_INFO);
+        ret = (NV_ENC_SUCCESS == nvEnc.Encode()) ? 0 : 1;
+    }
+    return ret;
+}
+
+//サーバーモード
+//  ソケットに接続したクライアントから、1行に1つずつ引数を受け取り(UTF-8)、空行を受け取ったらジョブを開始する
+//  CUDA Contextやデバイス情報はジョブ間で共有し、起動時の初期化処理を省略する
+//  ジョブの開始後にクライアントが切断するか"abort"を送信すると、そのジョブのみ中断する
+//  応答:
+//    accepted <id>
+//    rejected <id>   (引数を読み取れなかった場合)
+//    started <id> startup=<ms>
+//    finished <id> ret=<n> startup=<ms> total=<ms>
+static const int NVENCC_SERVER_SESSIONS_DEFAULT = 3;
+
+//他のユーザーから接続・削除されないよう、ユーザーごとのフォルダに作成する
+//作成できない場合は空文字列を返す
+static tstring server_default_path() {
+#if defined(_WIN32) || defined(_WIN64)
+    //一時フォルダはユーザーごとに分かれている
+    TCHAR tmpdir[MAX_PATH + 1] = { 0 };
+    GetTempPath(_countof(tmpdir), tmpdir);
+    return PathCombineS(tmpdir, _T("nvencc.sock"));
+#else
+    const char *runtimeDir = getenv("XDG_RUNTIME_DIR");
+    if (runtimeDir && runtimeDir[0] != '\0') {
+        return std::string(runtimeDir) + "/nvencc.sock";
+    }
+    //XDG_RUNTIME_DIRがなければ、/tmpに所有者のみアクセス可能(0700)なフォルダを作る
+    const auto dir = strsprintf("/tmp/nvencc-%u", (uint32_t)getuid());
+    if (mkdir(dir.c_str(), S_IRWXU) != 0 && errno != EEXIST) {
+        return tstring();
+    }
+    //既存のものが他のユーザーのフォルダやシンボリックリンクなら使用しない
+    struct stat st;
+    if (lstat(dir.c_str(), &st) != 0
+        || !S_ISDIR(st.st_mode)
+        || st.st_uid != getuid()
+        || (st.st_mode & (S_IRWXG | S_IRWXO)) != 0) {
+        return tstring();
+    }
+    return dir + "/nvencc.sock";
+#endif
+}
+
+struct NVEncCServerJob {
+    std::thread th;
+    std::atomic<bool> finished;
+    bool abort; // ジョブごとの中断フラグ
+    NVEncCServerJob() : th(), finished(false), abort(false) {};
+};
+
+static void server_run_job(RGYLocalSocket *client, int jobId, bool *abort) {
+    std::vector<tstring> args;
+    args.push_back(_T("NVEncC"));
+    std::string line;
+    RGY_ERR err = RGY_ERR_NONE;
+    while ((err = client->readLine(line)) == RGY_ERR_NONE && line.length() > 0) {
+        args.push_back(char_to_tstring(line, CP_UTF8));
+    }
+    if (err != RGY_ERR_NONE) {
+        //空行を受け取る前に切断された、あるいは1行が長すぎる
+        client->write(strsprintf("rejected %d\n", jobId));
+        _ftprintf(stderr, _T("job %d: rejected, failed to read job: %s.\n"), jobId, get_err_mes(err));
+        return;
+    }
+    client->write(strsprintf("accepted %d\n", jobId));
+    _ftprintf(stderr, _T("job %d: accepted.\n"), jobId);
+
+    std::vector<const TCHAR *> argvJob;
+    for (const auto& arg : args) {
+        argvJob.push_back(arg.c_str());
+    }
+    argvJob.push_back(_T(""));
+
+    //クライアントの切断・"abort"を監視し、このジョブのみ中断する
+    std::atomic<bool> jobFinished(false);
+    std::thread watcher([client, abort, &jobFinished]() {
+        std::string request;
+        while (!jobFinished && !*abort) {
+            if (!client->waitReadable(100)) {
+                continue;
+            }
+            if (client->readLine(request) != RGY_ERR_NONE || request == "abort") {
+                *abort = true;
+            }
+        }
+    });
+
+    const auto timeStart = std::chrono::system_clock::now();
+    double startupMs = -1.0;
+    const int ret = run_encode(argvJob, false, abort, [&](double startup) {
+        startupMs = startup;
+        client->write(strsprintf("started %d startup=%.1f\n", jobId, startupMs));
+        _ftprintf(stderr, _T("job %d: started, startup %.1f ms.\n"), jobId, startupMs);
+    });
+    jobFinished = true;
+    watcher.join();
+    const double totalMs = std::chrono::duration<double, std::milli>(std::chrono::system_clock::now() - timeStart).count();
+    client->write(strsprintf("finished %d ret=%d startup=%.1f total=%.1f\n", jobId, ret, startupMs, totalMs));
+    _ftprintf(stderr, _T("job %d: finished (ret=%d), startup %.1f ms, total %.1f ms.\n"), jobId, ret, startupMs, totalMs);
+}
+
+static int run_server(const TCHAR *prmstr, const RGYParamLogLevel& loglevelPrint) {
+    tstring path = server_default_path();
+    int sessions = NVENCC_SERVER_SESSIONS_DEFAULT;
+    if (prmstr && prmstr[0] != _T('\0') && prmstr[0] != _T('-')) {
+        for (const auto& param : split(prmstr, _T(","))) {
+            auto pos = param.find_first_of(_T("="));
+            if (pos == std::string::npos) {
+                _ftprintf(stderr, _T("Invalid parameter for --server: %s\n"), param.c_str());
+                return 1;
+            }
+            auto param_arg = tolowercase(param.substr(0, pos));
+            auto param_val = param.substr(pos + 1);
+            if (param_arg == _T("path")) {
+                path = param_val;
+            } else if (param_arg == _T("sessions")) {
+                try {
+                    sessions = std::stoi(param_val);
+                } catch (...) {
+                    _ftprintf(stderr, _T("Invalid value for --server sessions: %s\n"), param_val.c_str());
+                    return 1;
+                }
+            } else {
+                _ftprintf(stderr, _T("Unknown parameter for --server: %s\n"), param_arg.c_str());
+                return 1;
+            }
+        }
+    }
+
+    if (path.length() == 0) {
+        _ftprintf(stderr, _T("Failed to create a per-user directory for the server socket, please specify path=<string>.\n"));
+        return 1;
+    }
+
+    auto& pool = NVEncDevicePool::instance();
+    pool.enable(sessions);
+    {
+        NVEncCtrl nvEnc;
+        if (NV_ENC_SUCCESS != nvEnc.Initialize(-1, loglevelPrint.get(RGY_LOGT_APP))
+            || NV_ENC_SUCCESS != nvEnc.WarmupDevices((DEFAULT_CUDA_SCHEDULE & CU_CTX_SCHED_MASK), false)) {
+            _ftprintf(stderr, _T("Failed to initialize devices.\n"));
+            pool.clear();
+            return 1;
+        }
+    }
+
+    RGYLocalSocket server;
+    const auto listenErr = server.listen(path);
+    if (listenErr == RGY_ERR_ALREADY_INITIALIZED) {
+        _ftprintf(stderr, _T("Another server is already listening on %s.\n"), path.c_str());
+        pool.clear();
+        return 1;
+    } else if (listenErr != RGY_ERR_NONE) {
+        _ftprintf(stderr, _T("Failed to listen on %s.\n"), path.c_str());
+        pool.clear();
+        return 1;
+    }
+    set_signal_handler();
+    _ftprintf(stderr, _T("NVEncC server listening on %s (sessions per device: %d).\n"), path.c_str(), sessions);
+
+    std::list<std::unique_ptr<NVEncCServerJob>> jobs;
+    int jobId = 0;
+    while (!g_signal_abort) {
+        //終了したジョブを回収
+        for (auto it = jobs.begin(); it != jobs.end();) {
+            if ((*it)->finished) {
+                (*it)->th.join();
+                it = jobs.erase(it);
+            } else {
+                it++;
+            }
+        }
+        if (!server.waitReadable(100)) {
+            continue;
+        }
+        auto client = server.accept();
+        if (!client) {
+            continue;
+        }
+        auto job = std::make_unique<NVEncCServerJob>();
+        auto jobPtr = job.get();
+        const int id = jobId++;
+        job->th = std::thread([jobPtr, id](std::unique_ptr<RGYLocalSocket> socket) {
+            server_run_job(socket.get(), id, &jobPtr->abort);
+            jobPtr->finished = true;
+        }, std::move(client));
+        jobs.push_back(std::move(job));
+    }
+    //サーバーの終了時は実行中のジョブをすべて中断する
+    for (auto& job : jobs) {
+        job->abort = true;
+    }
+    for (auto& job : jobs) {
+        job->th.join();
+    }
+    server.close();
+    pool.clear();
+    return 0;
+}
+
+//サーバーにジョブを送信し、終了するまで待機する
+static int run_submit(const TCHAR *path, int argc, TCHAR **argv) {
+    RGYLocalSocket client;
+    if (client.connect(path) != RGY_ERR_NONE) {
+        _ftprintf(stderr, _T("Failed to connect to server %s.\n"), path);
+        return 1;
+    }
+    std::string request;
+    for (int i = 0; i < argc; i++) {
+        request += tchar_to_string(argv[i], CP_UTF8) + "\n";
+    }
+    request += "\n";
+    if (client.write(request) != RGY_ERR_NONE) {
+        _ftprintf(stderr, _T("Failed to send job to server %s.\n"), path);
+        return 1;
+    }
+    int ret = 1;
+    std::string line;
+    while (client.readLine(line) == RGY_ERR_NONE) {
+        _ftprintf(stdout, _T("%s\n"), char_to_tstring(line, CP_UTF8).c_str());
+        int id = 0, jobret = 0;
+        if (sscanf_s(line.c_str(), "finished %d ret=%d", &id, &jobret) == 2) {
+            ret = jobret;
+            break;
+        }
+    }
+    return ret;
+}
+
 int _tmain(int argc, TCHAR **argv) {
 #if defined(_WIN32) || defined(_WIN64)
     if (check_locale_is_ja()) {
@@ -415,6 +731,18 @@ int _tmain(int argc, TCHAR **argv) {
         }
     }
 
+    //サーバーモード
+    if (_tcscmp(argv[1], _T("--server")) == 0) {
+        return run_server((argc > 2) ? argv[2] : nullptr, loglevelPrint);
+    }
+    if (_tcscmp(argv[1], _T("--submit")) == 0) {
+        if (argc < 3) {
+            _ftprintf(stderr, _T("server socket is not specified.\n"));
+            return 1;
+        }
+        return run_submit(argv[2], argc - 3, argv + 3);
+    }
+
     for (int iarg = 1; iarg < argc; iarg++) {
         const TCHAR *option_name = nullptr;
         if (argv[iarg][0] == _T('-')) {
@@ -436,12 +764,6 @@ int _tmain(int argc, TCHAR **argv) {
         }
     }
 
-    InEncodeVideoParam encPrm;
-    NV_ENC_CODEC_CONFIG codecPrm[RGY_CODEC_NUM] = { 0 };
-    codecPrm[RGY_CODEC_H264] = DefaultParamH264();
-    codecPrm[RGY_CODEC_HEVC] = DefaultParamHEVC();
-    codecPrm[RGY_CODEC_AV1]  = DefaultParamAV1();
-
     //optionファイルの読み取り
     std::vector<tstring> argvCnfFile;
     for (int iarg = 1; iarg < argc; iarg++) {
@@ -473,55 +795,5 @@ int _tmain(int argc, TCHAR **argv) {
     }
     argvCopy.push_back(_T(""));
 
-    if (parse_cmd(&encPrm, codecPrm, (int)argvCopy.size()-1, argvCopy.data())) {
-        return 1;
-    }
-    //オプションチェック
-    if (0 == encPrm.common.inputFilename.length()) {
-        _ftprintf(stderr, _T("Input file is not specified.\n"));
-        return -1;
-    }
-    if (0 == encPrm.common.outputFilename.length()) {
-        _ftprintf(stderr, _T("Output file is not specified.\n"));
-        return -1;
-    }
-
-    if (encPrm.common.inputFilename != _T("-")
-        && encPrm.common.outputFilename != _T("-")
-        && rgy_path_is_same(encPrm.common.inputFilename, encPrm.common.outputFilename)) {
-        _ftprintf(stderr, _T("destination file is equal to source file!\n"));
-        return 1;
-    }
-
-#if defined(_WIN32) || defined(_WIN64)
-    //set stdin to binary mode when using pipe input
-    if (_tcscmp(encPrm.common.inputFilename.c_str(), _T("-")) == NULL) {
-        if (_setmode(_fileno(stdin), _O_BINARY) == 1) {
-            _ftprintf(stderr, _T("Error: failed to switch stdin to binary mode.\n"));
-            return 1;
-        }
-    }
-
-    //set stdout to binary mode when using pipe output
-    if (_tcscmp(encPrm.common.outputFilename.c_str(), _T("-")) == NULL) {
-        if (_setmode(_fileno(stdout), _O_BINARY) == 1) {
-            _ftprintf(stderr, _T("Error: failed to switch stdout to binary mode.\n"));
-            return 1;
-        }
-    }
-#endif //#if defined(_WIN32) || defined(_WIN64)
-
-    encPrm.encConfig.encodeCodecConfig = codecPrm[encPrm.codec_rgy];
-
-    int ret = 1;
-
-    NVEncCore nvEnc;
-    if (   NV_ENC_SUCCESS == nvEnc.Initialize(&encPrm)
-        && NV_ENC_SUCCESS == nvEnc.InitEncode(&encPrm)) {
-        nvEnc.SetAbortFlagPointer(&g_signal_abort);
-        set_signal_handler();
-        nvEnc.PrintEncodingParamsInfo(RGY_LOG_INFO);
-        ret = (NV_ENC_SUCCESS == nvEnc.Encode()) ? 0 : 1;
-    }
-    return ret;
+    return run_encode(argvCopy, true, &g_signal_abort, nullptr);
 }
@@ -130,6 +130,7 @@ tstring encoder_help() {
         _T("   --check-features [<int>]     check for NVEnc Features for specified DeviceId\n")
         _T("                                  if unset, will check DeviceId #0\n")
         _T("   --check-environment          check for Environment Info\n")
+        _T("   --frame-stats-summary <string> show summary of file written by --frame-stats\n")
 #if ENABLE_AVSW_READER
         _T("   --check-avversion            show dll version\n")
         _T("   --check-codecs               show codecs available\n")
@@ -199,6 +200,29 @@ tstring encoder_help() {
         _T("      qvbr=<float>\n")
         _T("      max-bitrate=<int>\n")
         _T("      vbr-quality=<float>\n")
+        _T("      qp-min=<int> or <int>:<int>:<int>\n")
+        _T("      qp-max=<int> or <int>:<int>:<int>\n")
+        _T("      aq-strength=<int>\n")
+        _T("\n")
+        _T("   --dynamic-rc-auto [<param1>=<value>][,<param2>=<value>][...]\n")
+        _T("     analyze the input on the cpu and set --dynamic-rc ranges per scene\n")
+        _T("    params\n")
+        _T("      stats=<string>            analysis result file, used instead of\n")
+        _T("                                  the analysis if it exists, otherwise created.\n")
+        _T("      scenecut=<int>            scene change threshold (0-100, default: 40)\n")
+        _T("      min-len=<int>             minimum frames of a range (default: 2 sec)\n")
+        _T("      qcomp=<float>             strength of bitrate change (0.0-1.0, default: 0.6)\n")
+        _T("      max-scale=<float>         max ratio of bitrate change (default: 2.0)\n")
+        _T("      threads=<int>             analysis threads (default: auto)\n")
+        _T("\n")
+        _T("   --scene-detect [<param1>=<value>][,<param2>=<value>][...]\n")
+        _T("     detect scene changes and fades on the cpu, used for keyframes,\n")
+        _T("     --dynamic-rc-auto and --vpp-decimate\n")
+        _T("    params\n")
+        _T("      threshold=<float>         scene change threshold (0-100, default: 10.0)\n")
+        _T("      fade=<bool>               detect fades (default: on)\n")
+        _T("      keyframe=<bool>           insert keyframes on scene changes (default: on)\n")
+        _T("      log=<string>              output per-frame results to file\n")
         _T("\n")
         _T("   --qp-init <int> or           set initial QP\n")
         _T("             <int>:<int>:<int>    default: auto\n")
@@ -332,7 +356,9 @@ tstring encoder_help() {
         _T("                drop slightly, while CPU utilization will be lower,\n")
         _T("                especially on HW decode mode.\n"));
     str += _T("")
-        _T("   --disable-nvml <int>        disable NVML GPU monitoring (default 0, 0-2)\n");
+        _T("   --disable-nvml <int>        disable NVML GPU monitoring (default 0, 0-2)\n")
+        _T("   --device-cache <string>     cache gpu/encoder capabilities to cut startup time.\n")
+        _T("                                 auto (default), off, or path to cache file.\n");
     str += gen_cmd_help_ctrl();
     return str;
 }
@@ -793,7 +819,7 @@ int parse_one_option(const TCHAR *option_name, const TCHAR* strInput[], int& i,
         }
         i++;
         bool rc_mode_defined = false;
-        auto paramList = std::vector<std::string>{ "start", "end", "cqp", "max-bitrate", "vbr-quality", "multipass" };
+        auto paramList = std::vector<std::string>{ "start", "end", "cqp", "max-bitrate", "vbr-quality", "multipass", "qp-min", "qp-max", "aq-strength" };
         for (int j = 0; list_nvenc_rc_method_en[j].desc; j++) {
             paramList.push_back(tolowercase(tchar_to_string(list_nvenc_rc_method_en[j].desc)));
         }
@@ -893,6 +919,23 @@ int parse_one_option(const TCHAR *option_name, const TCHAR* strInput[], int& i,
                     }
                     continue;
                 }
+                if (param_arg == _T("qp-min") || param_arg == _T("qp-max")) {
+                    auto& qpset = (param_arg == _T("qp-min")) ? rcPrm.qpMin : rcPrm.qpMax;
+                    if (qpset.parse(param_val.c_str()) != 0) {
+                        print_cmd_error_invalid_value(tstring(option_name) + _T(" ") + param_arg + _T("="), param_val);
+                        return 1;
+                    }
+                    continue;
+                }
+                if (param_arg == _T("aq-strength")) {
+                    try {
+                        rcPrm.aqStrength = clamp(std::stoi(param_val), 0, 15);
+                    } catch (...) {
+                        print_cmd_error_invalid_value(tstring(option_name) + _T(" ") + param_arg + _T("="), param_val);
+                        return 1;
+                    }
+                    continue;
+                }
                 print_cmd_error_unknown_opt_param(option_name, param_arg, paramList);
                 return 1;
             } else {
@@ -928,6 +971,152 @@ int parse_one_option(const TCHAR *option_name, const TCHAR* strInput[], int& i,
         pParams->dynamicRC.push_back(rcPrm);
         return 0;
     }
+    if (IS_OPTION("dynamic-rc-auto")) {
+        pParams->dynamicRCAuto.enable = true;
+        if (i+1 >= nArgNum || strInput[i+1][0] == _T('-')) {
+            return 0;
+        }
+        i++;
+        const auto paramList = std::vector<std::string>{ "stats", "scenecut", "min-len", "qcomp", "max-scale", "threads" };
+        for (const auto &param : split(strInput[i], _T(","))) {
+            auto pos = param.find_first_of(_T("="));
+            if (pos != std::string::npos) {
+                auto param_arg = param.substr(0, pos);
+                auto param_val = param.substr(pos+1);
+                param_arg = tolowercase(param_arg);
+                if (param_arg == _T("enable")) {
+                    bool b = false;
+                    if (!cmd_string_to_bool(&b, param_val)) {
+                        pParams->dynamicRCAuto.enable = b;
+                    } else {
+                        print_cmd_error_invalid_value(tstring(option_name) + _T(" ") + param_arg + _T("="), param_val);
+                        return 1;
+                    }
+                    continue;
+                }
+                if (param_arg == _T("stats")) {
+                    pParams->dynamicRCAuto.stats = trim(param_val, _T("\""));
+                    continue;
+                }
+                if (param_arg == _T("scenecut")) {
+                    try {
+                        pParams->dynamicRCAuto.scenecut = clamp(std::stoi(param_val), 0, 100);
+                    } catch (...) {
+                        print_cmd_error_invalid_value(tstring(option_name) + _T(" ") + param_arg + _T("="), param_val);
+                        return 1;
+                    }
+                    continue;
+                }
+                if (param_arg == _T("min-len")) {
+                    try {
+                        pParams->dynamicRCAuto.minLength = std::max(std::stoi(param_val), 0);
+                    } catch (...) {
+                        print_cmd_error_invalid_value(tstring(option_name) + _T(" ") + param_arg + _T("="), param_val);
+                        return 1;
+                    }
+                    continue;
+                }
+                if (param_arg == _T("qcomp")) {
+                    try {
+                        pParams->dynamicRCAuto.qcomp = clamp(std::stof(param_val), 0.0f, 1.0f);
+                    } catch (...) {
+                        print_cmd_error_invalid_value(tstring(option_name) + _T(" ") + param_arg + _T("="), param_val);
+                        return 1;
+                    }
+                    continue;
+                }
+                if (param_arg == _T("max-scale")) {
+                    try {
+                        pParams->dynamicRCAuto.maxScale = std::max(std::stof(param_val), 1.0f);
+                    } catch (...) {
+                        print_cmd_error_invalid_value(tstring(option_name) + _T(" ") + param_arg + _T("="), param_val);
+                        return 1;
+                    }
+                    continue;
+                }
+                if (param_arg == _T("threads")) {
+                    try {
+                        pParams->dynamicRCAuto.threads = std::max(std::stoi(param_val), 0);
+                    } catch (...) {
+                        print_cmd_error_invalid_value(tstring(option_name) + _T(" ") + param_arg + _T("="), param_val);
+                        return 1;
+                    }
+                    continue;
+                }
+                print_cmd_error_unknown_opt_param(option_name, param_arg, paramList);
+                return 1;
+            } else {
+                print_cmd_error_unknown_opt_param(option_name, param, paramList);
+                return 1;
+            }
+        }
+        return 0;
+    }
+    if (IS_OPTION("scene-detect")) {
+        pParams->sceneDetect.enable = true;
+        if (i+1 >= nArgNum || strInput[i+1][0] == _T('-')) {
+            return 0;
+        }
+        i++;
+        const auto paramList = std::vector<std::string>{ "threshold", "fade", "keyframe", "log" };
+        for (const auto &param : split(strInput[i], _T(","))) {
+            auto pos = param.find_first_of(_T("="));
+            if (pos != std::string::npos) {
+                auto param_arg = param.substr(0, pos);
+                auto param_val = param.substr(pos+1);
+                param_arg = tolowercase(param_arg);
+                if (param_arg == _T("enable")) {
+                    bool b = false;
+                    if (!cmd_string_to_bool(&b, param_val)) {
+                        pParams->sceneDetect.enable = b;
+                    } else {
+                        print_cmd_error_invalid_value(tstring(option_name) + _T(" ") + param_arg + _T("="), param_val);
+                        return 1;
+                    }
+                    continue;
+                }
+                if (param_arg == _T("threshold")) {
+                    try {
+                        pParams->sceneDetect.threshold = clamp(std::stof(param_val), 0.0f, 100.0f);
+                    } catch (...) {
+                        print_cmd_error_invalid_value(tstring(option_name) + _T(" ") + param_arg + _T("="), param_val);
+                        return 1;
+                    }
+                    continue;
+                }
+                if (param_arg == _T("fade")) {
+                    bool b = false;
+                    if (!cmd_string_to_bool(&b, param_val)) {
+                        pParams->sceneDetect.fade = b;
+                    } else {
+                        print_cmd_error_invalid_value(tstring(option_name) + _T(" ") + param_arg + _T("="), param_val);
+                        return 1;
+                    }
+                    continue;
+                }
+                if (param_arg == _T("keyframe")) {
+                    bool b = false;
+                    if (!cmd_string_to_bool(&b, param_val)) {
+                        pParams->sceneDetect.keyframe = b;
+                    } else {
+                        print_cmd_error_invalid_value(tstring(option_name) + _T(" ") + param_arg + _T("="), param_val);
+                        return 1;
+                    }
+                    continue;
+                }
+                if (param_arg == _T("log")) {
+                    pParams->sceneDetect.log = trim(param_val, _T("\""));
+                    continue;
+                }
+                print_cmd_error_unknown_opt_param(option_name, param_arg, paramList);
+                return 1;
+            } else {
+                print_cmd_error_unknown_opt_param(option_name, param, paramList);
+                return 1;
+            }
+        }
+        return 0;
+    }
     if (IS_OPTION("qp-init")) {
         i++;
         int ret = pParams->qpInit.parse(strInput[i]);
@@ -1676,6 +1865,11 @@ int parse_one_option(const TCHAR *option_name, const TCHAR* strInput[], int& i,
         pParams->disableNVML = value;
         return 0;
     }
+    if (IS_OPTION("device-cache")) {
+        i++;
+        pParams->deviceCache = strInput[i];
+        return 0;
+    }
 
     auto ret = parse_one_input_option(option_name, strInput, i, nArgNum, &pParams->input, &pParams->inprm, argData);
     if (ret >= 0) return ret;
@@ -2107,9 +2301,54 @@ tstring gen_cmd(const InEncodeVideoParam *pParams, const NV_ENC_CODEC_CONFIG cod
 
     cmd << gen_cmd(&pParams->vpp, &encPrmDefault.vpp, save_disabled_prm);
 
+    if (pParams->dynamicRCAuto != encPrmDefault.dynamicRCAuto) {
+        tmp.str(tstring());
+        if (!pParams->dynamicRCAuto.enable && save_disabled_prm) {
+            tmp << _T(",enable=false");
+        }
+        if (pParams->dynamicRCAuto.enable || save_disabled_prm) {
+            if (pParams->dynamicRCAuto.stats.length() > 0) {
+                tmp << _T(",stats=\"") << pParams->dynamicRCAuto.stats << _T("\"");
+            }
+            ADD_NUM(_T("scenecut"), dynamicRCAuto.scenecut);
+            ADD_NUM(_T("min-len"), dynamicRCAuto.minLength);
+            ADD_FLOAT(_T("qcomp"), dynamicRCAuto.qcomp, 3);
+            ADD_FLOAT(_T("max-scale"), dynamicRCAuto.maxScale, 3);
+            ADD_NUM(_T("threads"), dynamicRCAuto.threads);
+        }
+        if (!tmp.str().empty()) {
+            cmd << _T(" --dynamic-rc-auto ") << tmp.str().substr(1);
+        } else if (pParams->dynamicRCAuto.enable) {
+            cmd << _T(" --dynamic-rc-auto");
+        }
+    }
+
+    if (pParams->sceneDetect != encPrmDefault.sceneDetect) {
+        tmp.str(tstring());
+        if (!pParams->sceneDetect.enable && save_disabled_prm) {
+            tmp << _T(",enable=false");
+        }
+        if (pParams->sceneDetect.enable || save_disabled_prm) {
+            ADD_FLOAT(_T("threshold"), sceneDetect.threshold, 3);
+            ADD_BOOL(_T("fade"), sceneDetect.fade);
+            ADD_BOOL(_T("keyframe"), sceneDetect.keyframe);
+            if (pParams->sceneDetect.log.length() > 0) {
+                tmp << _T(",log=\"") << pParams->sceneDetect.log << _T("\"");
+            }
+        }
+        if (!tmp.str().empty()) {
+            cmd << _T(" --scene-detect ") << tmp.str().substr(1);
+        } else if (pParams->sceneDetect.enable) {
+            cmd << _T(" --scene-detect");
+        }
+    }
+
     OPT_LST(_T("--cuda-schedule"), cudaSchedule, list_cuda_schedule);
     OPT_NUM(_T("--session-retry"), sessionRetry);
     OPT_NUM(_T("--disable-nvml"), disableNVML);
+    if (pParams->deviceCache != encPrmDefault.deviceCache) {
+        cmd << _T(" --device-cache \"") << pParams->deviceCache << _T("\"");
+    }
 
     cmd << gen_cmd(&pParams->ctrl, &encPrmDefault.ctrl, save_disabled_prm);
 
@@ -63,6 +63,7 @@
 #include "rgy_output_avcodec.h"
 #include "rgy_chapter.h"
 #include "rgy_timecode.h"
+#include "rgy_keyframe_plan.h"
 #include "rgy_aspect_ratio.h"
 #include "rgy_level_h264.h"
 #include "rgy_level_hevc.h"
@@ -100,23 +101,7 @@
 #include "NVEncFilterNVOFFRUC.h"
 #include "helper_cuda.h"
 #include "helper_nvenc.h"
-
-#pragma warning(push)
-#pragma warning(disable: 4244)
-#pragma warning(disable: 4834)
-RGY_DISABLE_WARNING_PUSH
-RGY_DISABLE_WARNING_STR("-Wunused-result")
-RGY_DISABLE_WARNING_STR("-Wtautological-compare")
-#define TTMATH_NOASM
-#include "ttmath/ttmath.h"
-#if _M_IX86
-typedef ttmath::Int<4> ttint128;
-#else
-typedef ttmath::Int<2> ttint128;
-#endif
-RGY_DISABLE_WARNING_POP
-#pragma warning(pop)
-
+#include "rgy_timestamp.h"
 
 using std::deque;
 
@@ -221,6 +206,9 @@ public:
     bool inputIsHost() const {
         return m_bInputHost;
     }
+    shared_ptr<void> getTransferFin() const {
+        return m_heTransferFin;
+    }
     RGYFrameInfo getFrameInfo() const {
         return m_frameInfo;
     }
@@ -275,6 +263,8 @@ NVEncCore::NVEncCore() :
     m_stCreateEncodeParams(),
     m_dynamicRC(),
     m_appliedDynamicRC(DYNAMIC_PARAM_NOT_SELECTED),
+    m_complexity(),
+    m_sceneDetect(),
     m_pipelineDepth(PIPELINE_DEPTH),
     m_inputHostBuffer(),
     m_outputFrameHostRaw(),
@@ -291,7 +281,7 @@ NVEncCore::NVEncCore() :
     m_stEncConfig(),
 #if ENABLE_AVSW_READER
     m_keyOnChapter(false),
-    m_keyFile(),
+    m_keyframePlan(),
     m_Chapters(),
     m_hdr10plusMetadataCopy(false),
 #endif //#if ENABLE_AVSW_READER
@@ -304,15 +294,20 @@ NVEncCore::NVEncCore() :
     m_videoIgnoreTimestampError(DEFAULT_VIDEO_IGNORE_TIMESTAMP_ERROR),
     m_vpFilters(),
     m_pLastFilterParam(),
+    m_frameCache(),
 #if ENABLE_SSIM
     m_ssim(),
 #endif //#if ENABLE_SSIM
+    m_frameStats(),
     m_stCodecGUID(),
     m_uEncWidth(0),
     m_uEncHeight(0),
     m_sar(),
     m_encVUI(),
     m_nProcSpeedLimit(0),
+    m_realtime(),
+    m_realtimeBaseConfig(),
+    m_realtimeBasePreset(),
     m_nAVSyncMode(RGY_AVSYNC_AUTO),
     m_timestampPassThrough(false),
     m_inputFps(),
@@ -324,7 +319,6 @@ NVEncCore::NVEncCore() :
     m_stEncodeBuffer() {
     m_trimParam.offset = 0;
 #if ENABLE_AVSW_READER
-    m_keyFile.clear();
     m_keyOnChapter = false;
 #endif //#if ENABLE_AVSW_READER
     memset(&m_stCreateEncodeParams, 0, sizeof(m_stCreateEncodeParams));
@@ -372,6 +366,9 @@ RGY_CSP NVEncCore::GetRawOutCSP(const InEncodeVideoParam *inputParam) {
 NVENCSTATUS NVEncCore::InitLog(const InEncodeVideoParam *inputParam) {
     //ログの初期化
     m_pNVLog.reset(new RGYLog(inputParam->ctrl.logfile.c_str(), inputParam->ctrl.loglevel, inputParam->ctrl.logAddTime));
+    if (!m_pNVLog->setOutputOptions(inputParam->ctrl.logJson, inputParam->ctrl.logRepeatLimit)) {
+        PrintMes(RGY_LOG_WARN, _T("--log-opt json is ignored, as the log file %s is html.\n"), inputParam->ctrl.logfile.c_str());
+    }
     if ((inputParam->ctrl.logfile.length() > 0 || inputParam->common.outputFilename.length() > 0) && inputParam->input.type != RGY_INPUT_FMT_SM) {
         m_pNVLog->writeFileHeader(inputParam->common.outputFilename.c_str());
     }
@@ -447,6 +444,165 @@ NVENCSTATUS NVEncCore::InitChapters(const InEncodeVideoParam *inputParam) {
     return NV_ENC_SUCCESS;
 }
 
+NVENCSTATUS NVEncCore::InitSceneDetector(const InEncodeVideoParam *inputParam) {
+    m_sceneDetect.reset();
+    if (!inputParam->sceneDetect.enable) {
+        return NV_ENC_SUCCESS;
+    }
+    bool hwdec = false;
+#if ENABLE_AVSW_READER
+    hwdec = m_cuvidDec != nullptr;
+#endif //#if ENABLE_AVSW_READER
+    if (hwdec) {
+        //HWデコードではフレームがGPU上にあるので使用できない
+        PrintMes(RGY_LOG_WARN, _T("--scene-detect could not be used with hw decoder, disabled.\n"));
+        return NV_ENC_SUCCESS;
+    }
+    const int width  = inputParam->input.srcWidth  - inputParam->input.crop.e.left   - inputParam->input.crop.e.right;
+    const int height = inputParam->input.srcHeight - inputParam->input.crop.e.bottom - inputParam->input.crop.e.up;
+    auto sceneDetect = std::make_unique<RGYSceneChangeDetector>();
+    auto err = sceneDetect->init(inputParam->sceneDetect, width, height, inputParam->input.csp, m_pNVLog);
+    if (err == RGY_ERR_UNSUPPORTED) {
+        PrintMes(RGY_LOG_WARN, _T("--scene-detect not supported for this input, disabled.\n"));
+        return NV_ENC_SUCCESS;
+    } else if (err != RGY_ERR_NONE) {
+        PrintMes(RGY_LOG_ERROR, _T("Failed to initialize --scene-detect: %s.\n"), get_err_mes(err));
+        return err_to_nv(err);
+    }
+    m_sceneDetect = std::move(sceneDetect);
+    return NV_ENC_SUCCESS;
+}
+
+NVENCSTATUS NVEncCore::InitKeyframePlan(const InEncodeVideoParam *inputParam) {
+#if ENABLE_AVSW_READER
+    m_keyframePlan.reset();
+    auto keyframePlan = std::make_unique<RGYKeyframePlan>();
+    if (m_keyOnChapter) {
+        //チャプターの開始時刻を出力のtimebaseに変換しておく
+        //フレームのtimestampは整数なので、切り上げておけば「チャプター開始時刻 <= フレームの時刻」を厳密に判定できる
+        vector<std::pair<int64_t, int>> chapterPts;
+        for (const auto& chap : m_Chapters) {
+            const auto pts = rgy_muldiv(chap->start,
+                (int64_t)chap->time_base.num * m_outputTimebase.d(), (int64_t)chap->time_base.den * m_outputTimebase.n(), RGYRescaleRound::Ceil);
+            chapterPts.push_back(std::make_pair(pts, (int)chap->id));
+        }
+        keyframePlan->addTimestamps(RGYKeyframeSource::Chapter, chapterPts, m_outputTimebase);
+    }
+    if (inputParam->common.keyFile.length() > 0) {
+        if (m_trimParam.list.size() > 0) {
+            PrintMes(RGY_LOG_WARN, _T("--keyfile could not be used with --trim, disabled.\n"));
+        } else {
+            const auto keyFile = read_keyfile(inputParam->common.keyFile);
+            if (keyFile.size() == 0) {
+                PrintMes(RGY_LOG_ERROR, _T("Failed to read keyFile \"%s\".\n"), inputParam->common.keyFile.c_str());
+                return NV_ENC_ERR_GENERIC;
+            }
+            keyframePlan->addFrames(RGYKeyframeSource::KeyFile, keyFile);
+        }
+    }
+    //シーンチェンジはエンコード中にm_sceneDetectの判定結果から追加する
+    const bool sceneKeyframe = m_sceneDetect && m_sceneDetect->keyframe();
+    if (keyframePlan->empty() && !sceneKeyframe && inputParam->common.keyFileOut.length() == 0) {
+        return NV_ENC_SUCCESS;
+    }
+    if (keyframePlan->init(inputParam->common.keyTolerance, inputParam->common.keyFileOut, m_pNVLog) != RGY_ERR_NONE) {
+        PrintMes(RGY_LOG_ERROR, _T("Failed to open \"%s\".\n"), inputParam->common.keyFileOut.c_str());
+        return NV_ENC_ERR_GENERIC;
+    }
+    m_keyframePlan = std::move(keyframePlan);
+#endif //#if ENABLE_AVSW_READER
+    return NV_ENC_SUCCESS;
+}
+
+NVENCSTATUS NVEncCore::InitComplexityAnalyzer(const InEncodeVideoParam *inputParam) {
+    m_complexity.reset();
+    if (!inputParam->dynamicRCAuto.enable || !m_dev->encoder()) {
+        return NV_ENC_SUCCESS;
+    }
+    if (m_dynamicRC.size() > 0) {
+        PrintMes(RGY_LOG_WARN, _T("--dynamic-rc-auto could not be used with --dynamic-rc, disabled.\n"));
+        return NV_ENC_SUCCESS;
+    }
+    const bool statsExists = inputParam->dynamicRCAuto.stats.length() > 0 && rgy_file_exists(inputParam->dynamicRCAuto.stats);
+    bool hwdec = false;
+#if ENABLE_AVSW_READER
+    hwdec = m_cuvidDec != nullptr;
+#endif //#if ENABLE_AVSW_READER
+    if (hwdec && !statsExists) {
+        //HWデコードではフレームがGPU上にあるので、解析結果ファイルがある場合のみ使用できる
+        PrintMes(RGY_LOG_WARN, _T("--dynamic-rc-auto requires stats file when using hw decoder, disabled.\n"));
+        return NV_ENC_SUCCESS;
+    }
+    const int width  = inputParam->input.srcWidth  - inputParam->input.crop.e.left   - inputParam->input.crop.e.right;
+    const int height = inputParam->input.srcHeight - inputParam->input.crop.e.bottom - inputParam->input.crop.e.up;
+    auto complexity = std::make_unique<RGYComplexityAnalyzer>();
+    auto err = complexity->init(inputParam->dynamicRCAuto, width, height, (hwdec) ? RGY_CSP_NA : inputParam->input.csp, m_encFps, m_pNVLog);
+    if (err == RGY_ERR_UNSUPPORTED) {
+        PrintMes(RGY_LOG_WARN, _T("--dynamic-rc-auto not supported for this input, disabled.\n"));
+        return NV_ENC_SUCCESS;
+    } else if (err != RGY_ERR_NONE) {
+        PrintMes(RGY_LOG_ERROR, _T("Failed to initialize --dynamic-rc-auto: %s.\n"), get_err_mes(err));
+        return err_to_nv(err);
+    }
+    m_complexity = std::move(complexity);
+    m_appliedDynamicRC = DYNAMIC_PARAM_NOT_SELECTED;
+    return NV_ENC_SUCCESS;
+}
+
+void NVEncCore::AddAutoDynamicRC(const int id, const RGYComplexitySegment& seg) {
+    const auto& rc = m_stEncConfig.rcParams;
+    const auto rgy_codec = codec_guid_enc_to_rgy(m_stCodecGUID);
+    const int bitDepth = get_bitDepth(m_stEncConfig.encodeCodecConfig, rgy_codec, m_dev->encoder()->getAPIver());
+    const int qpMaxCodec = (rgy_codec == RGY_CODEC_AV1) ? 255 : ((bitDepth > 8) ? 63 : 51);
+    auto shiftQP = [qpMaxCodec](const NV_ENC_QP& qp, const int offset) {
+        return RGYQPSet(clamp((int)qp.qpIntra  + offset, 0, qpMaxCodec),
+                        clamp((int)qp.qpInterP + offset, 0, qpMaxCodec),
+                        clamp((int)qp.qpInterB + offset, 0, qpMaxCodec), true);
+    };
+    NVEncRCParam prm;
+    prm.start = id;
+    prm.end = TRIM_MAX;
+    prm.rc_mode = rc.rateControlMode;
+    //ビットレート系のモードではビットレートを、固定品質系のモードではQPを変更する
+    int qpOffset = seg.qpOffset;
+    if (rc.rateControlMode == NV_ENC_PARAMS_RC_CONSTQP) {
+        prm.qp = shiftQP(rc.constQP, seg.qpOffset);
+    } else if (rc.averageBitRate == 0 && rc.targetQuality > 0) {
+        const double quality = clamp(rc.targetQuality + rc.targetQualityLSB / 256.0 + seg.qpOffset, 1.0, 51.0);
+        prm.targetQuality = (int)quality;
+        prm.targetQualityLSB = clamp((int)((quality - (int)quality) * 256.0), 0, 255);
+        prm.max_bitrate = rc.maxBitRate;
+    } else {
+        prm.avg_bitrate = (int)(rc.averageBitRate * seg.bitrateScale + 0.5);
+        prm.max_bitrate = (rc.maxBitRate > 0) ? (int)(rc.maxBitRate * seg.bitrateScale + 0.5) : 0;
+        if (rc.targetQuality > 0) {
+            prm.targetQuality = rc.targetQuality;
+            prm.targetQualityLSB = rc.targetQualityLSB;
+        }
+        qpOffset = (int)std::lround(-6.0 * std::log2(seg.bitrateScale));
+    }
+    if (rc.enableMinQP) {
+        prm.qpMin = shiftQP(rc.minQP, qpOffset);
+    }
+    if (rc.enableMaxQP) {
+        prm.qpMax = shiftQP(rc.maxQP, qpOffset);
+    }
+    if (rc.enableAQ && seg.aqOffset != 0) {
+        prm.aqStrength = clamp(((rc.aqStrength == 0) ? 8 : (int)rc.aqStrength) + seg.aqOffset, 1, 15);
+    }
+    if (m_dynamicRC.size() > 0) {
+        //同じ設定が続く場合は、区間を延長してエンコーダの再設定(IDR)を避ける
+        auto prev = m_dynamicRC.back();
+        prev.start = prm.start;
+        if (prev == prm) {
+            return;
+        }
+        m_dynamicRC.back().end = id - 1;
+    }
+    PrintMes(RGY_LOG_DEBUG, _T("dynamic-rc-auto: %s\n"), prm.print().c_str());
+    m_dynamicRC.push_back(prm);
+}
+
 NVENCSTATUS NVEncCore::InitInput(InEncodeVideoParam *inputParam, const std::vector<std::unique_ptr<NVGPUInfo>> &gpuList) {
 #if ENABLE_RAW_READER
 #if ENABLE_AVSW_READER
@@ -969,25 +1125,40 @@ NVENCSTATUS NVEncCore::GPUAutoSelect(std::vector<std::unique_ptr<NVGPUInfo>> &gp
     return NV_ENC_SUCCESS;
 }
 
-NVENCSTATUS NVEncCore::InitDevice(std::vector<std::unique_ptr<NVGPUInfo>> &gpuList, const InEncodeVideoParam *inputParam) {
-    auto gpu = std::find_if(gpuList.begin(), gpuList.end(), [device_id = m_nDeviceId](const std::unique_ptr<NVGPUInfo> &gpuinfo) {
-        return gpuinfo->id() == device_id;
-    });
-    if (gpu == gpuList.end()) {
-        PrintMes(RGY_LOG_ERROR, _T("Selected device #%d not found\n"), m_nDeviceId);
-        return NV_ENC_ERR_GENERIC;
-    }
-    PrintMes(RGY_LOG_DEBUG, _T("InitDevice: device #%d (%s) selected.\n"), (*gpu)->id(), (*gpu)->name().c_str());
-    m_dev = std::move(*gpu);
-    if (inputParam->codec_rgy == RGY_CODEC_RAW) {
-        PrintMes(RGY_LOG_DEBUG, _T("raw output selected, skip initializing encoder.\n"));
-        return NV_ENC_SUCCESS;
-    }
-    if (auto err = m_dev->initEncoder(); err != RGY_ERR_NONE) {
-        PrintMes(RGY_LOG_ERROR, _T("Failed to init Encoder error: %s\n"), get_err_mes(err));
-        return NV_ENC_ERR_UNSUPPORTED_DEVICE;
+//deviceFixed: デバイスが指定されている(あるいはHWデコードで使用している)ため、他のGPUに切り替えられない
+NVENCSTATUS NVEncCore::InitDevice(std::vector<std::unique_ptr<NVGPUInfo>> &gpuList, const InEncodeVideoParam *inputParam, bool deviceFixed) {
+    for (;;) {
+        auto gpu = std::find_if(gpuList.begin(), gpuList.end(), [device_id = m_nDeviceId](const std::unique_ptr<NVGPUInfo> &gpuinfo) {
+            return gpuinfo->id() == device_id;
+        });
+        if (gpu == gpuList.end()) {
+            PrintMes(RGY_LOG_ERROR, _T("Selected device #%d not found\n"), m_nDeviceId);
+            return NV_ENC_ERR_GENERIC;
+        }
+        PrintMes(RGY_LOG_DEBUG, _T("InitDevice: device #%d (%s) selected.\n"), (*gpu)->id(), (*gpu)->name().c_str());
+        m_dev = std::move(*gpu);
+        gpuList.erase(gpu);
+        auto err = m_dev->initContext();
+        if (err != RGY_ERR_NONE) {
+            PrintMes(RGY_LOG_ERROR, _T("Failed to create context: %s\n"), get_err_mes(err));
+        } else if (inputParam->codec_rgy == RGY_CODEC_RAW) {
+            PrintMes(RGY_LOG_DEBUG, _T("raw output selected, skip initializing encoder.\n"));
+            return NV_ENC_SUCCESS;
+        } else if ((err = m_dev->initEncoder()) != RGY_ERR_NONE) {
+            PrintMes(RGY_LOG_ERROR, _T("Failed to init Encoder error: %s\n"), get_err_mes(err));
+        } else {
+            return NV_ENC_SUCCESS;
+        }
+        //デバイス情報をキャッシュから読み込んだGPUは、エンコーダのセッションを作成できるか確認していない
+        //(セッション数の上限に達しているなど) 自動選択の場合は、リストから除いて次の候補で再試行する
+        if (deviceFixed || gpuList.size() == 0) {
+            return NV_ENC_ERR_UNSUPPORTED_DEVICE;
+        }
+        PrintMes(RGY_LOG_WARN, _T("device #%d (%s) is not available, retry with device #%d (%s).\n"),
+            m_dev->id(), m_dev->name().c_str(), gpuList.front()->id(), gpuList.front()->name().c_str());
+        m_dev.reset();
+        m_nDeviceId = gpuList.front()->id();
     }
-    return NV_ENC_SUCCESS;
 }
 
 NVENCSTATUS NVEncCore::ProcessOutput(const EncodeBuffer *pEncodeBuffer) {
@@ -1023,6 +1194,9 @@ NVENCSTATUS NVEncCore::ProcessOutput(const EncodeBuffer *pEncodeBuffer) {
             m_ssim->addBitstream(&bitstream);
         }
         PrintMes(RGY_LOG_TRACE, _T("Output frame %d: size %zu, pts %lld, dts %lld\n"), m_pStatus->m_sData.frameOut, bitstream.size(), bitstream.pts(), bitstream.dts());
+        if (m_frameStats) {
+            m_frameStats->frameOut(bitstream.pts(), bitstream.dts(), bitstream.frametype(), (uint32_t)bitstream.size(), bitstream.avgQP());
+        }
         auto outErr = m_pFileWriter->WriteNextFrame(&bitstream);
         nvStatus = m_dev->encoder()->NvEncUnlockBitstream(pEncodeBuffer->stOutputBfr.hBitstreamBuffer);
         if (nvStatus == NV_ENC_SUCCESS && outErr != RGY_ERR_NONE) {
@@ -1062,7 +1236,17 @@ NVENCSTATUS NVEncCore::FlushEncoder() {
 NVENCSTATUS NVEncCore::Deinitialize() {
     NVENCSTATUS nvStatus = NV_ENC_SUCCESS;
 
+    //解析待ちのフレームは入力バッファを参照しているので、先に終了させる
+    if (m_complexity) {
+        m_complexity->close();
+        m_complexity.reset();
+    }
+    if (m_sceneDetect) {
+        m_sceneDetect->close();
+        m_sceneDetect.reset();
+    }
     m_ssim.reset();
+    m_frameStats.reset(); //m_ssimのスレッドから呼ばれるので、m_ssimの後に破棄する
     m_dovirpu.reset();
     m_hdr10plus.reset();
     m_hdrsei.reset();
@@ -1070,13 +1254,17 @@ NVENCSTATUS NVEncCore::Deinitialize() {
     m_pFileReader.reset();
     m_pFileWriter.reset();
     m_pFileWriterListAudio.clear();
-    m_outputFrameHostRaw.reset();
+    m_outputFrameHostRaw.clear();
 
     if (m_dev) {
         if (m_vpFilters.size()) {
             NVEncCtxAutoLock(ctxlock(m_dev->vidCtxLock()));
             m_vpFilters.clear();
         }
+        if (m_frameCache) {
+            NVEncCtxAutoLock(ctxlock(m_dev->vidCtxLock()));
+            m_frameCache.reset();
+        }
         if (m_qpTable) {
             NVEncCtxAutoLock(ctxlock(m_dev->vidCtxLock()));
             m_qpTable.reset();
@@ -1091,7 +1279,7 @@ NVENCSTATUS NVEncCore::Deinitialize() {
 
     m_timecode.reset();
 #if ENABLE_AVSW_READER
-    m_keyFile.clear();
+    m_keyframePlan.reset();
     m_Chapters.clear();
 #endif //#if ENABLE_AVSW_READER
 
@@ -1259,11 +1447,16 @@ RGY_ERR NVEncCore::AllocateBufferRawOutput(const uint32_t uInputWidth, const uin
     outFrame.width = uInputWidth;
     outFrame.height = uInputHeight;
     outFrame.mem_type = RGY_MEM_TYPE_CPU;
-    m_outputFrameHostRaw = std::make_unique<CUFrameBuf>(outFrame);
-    if (auto sts = m_outputFrameHostRaw->allocHost(); sts != RGY_ERR_NONE) {
-        PrintMes(RGY_LOG_ERROR, _T("Failed to allocate raw output buffer: %s\n"), get_err_mes(sts));
-        return sts;
+    m_outputFrameHostRaw.clear();
+    for (int i = 0; i < RAW_OUTPUT_HOST_BUFFERS; i++) {
+        auto frame = std::make_unique<CUFrameBuf>(outFrame);
+        if (auto sts = frame->allocHost(); sts != RGY_ERR_NONE) {
+            PrintMes(RGY_LOG_ERROR, _T("Failed to allocate raw output buffer: %s\n"), get_err_mes(sts));
+            return sts;
+        }
+        m_outputFrameHostRaw.push_back(std::move(frame));
     }
+    PrintMes(RGY_LOG_DEBUG, _T("Allocated %d raw output buffers.\n"), RAW_OUTPUT_HOST_BUFFERS);
     return RGY_ERR_NONE;
 }
 
@@ -1811,6 +2004,10 @@ NVENCSTATUS NVEncCore::SetInputParam(InEncodeVideoParam *inputParam) {
         error_feature_unsupported(RGY_LOG_ERROR, _T("dynamic RC Change"));
         return NV_ENC_ERR_UNSUPPORTED_PARAM;
     }
+    if (inputParam->dynamicRCAuto.enable && !codecFeature->getCapLimit(NV_ENC_CAPS_SUPPORT_DYN_BITRATE_CHANGE)) {
+        error_feature_unsupported(RGY_LOG_WARN, _T("dynamic RC Change"));
+        inputParam->dynamicRCAuto.enable = false;
+    }
     //自動決定パラメータ
     if (0 == m_stEncConfig.gopLength) {
         m_stEncConfig.gopLength = (int)(m_encFps.n() / (double)m_encFps.d() + 0.5) * 10;
@@ -2223,6 +2420,7 @@ RGY_ERR NVEncCore::InitFilters(const InEncodeVideoParam *inputParam) {
     if (inputParam->vppnv.deinterlace == cudaVideoDeinterlaceMode_Bob) {
         m_encFps *= 2;
     }
+    m_frameCache = std::make_shared<NVEncFilterFrameCache>();
 
     //リサイザの出力すべきサイズ
     int resizeWidth  = croppedWidth;
@@ -2469,6 +2667,7 @@ RGY_ERR NVEncCore::InitFilters(const InEncodeVideoParam *inputParam) {
         //afs
         if (inputParam->vpp.afs.enable) {
             unique_ptr<NVEncFilter> filter(new NVEncFilterAfs());
+            filter->setFrameCache(m_frameCache);
             shared_ptr<NVEncFilterParamAfs> param(new NVEncFilterParamAfs());
             param->afs = inputParam->vpp.afs;
             param->afs.tb_order = (inputParam->input.picstruct & RGY_PICSTRUCT_TFF) != 0;
@@ -2569,6 +2768,7 @@ RGY_ERR NVEncCore::InitFilters(const InEncodeVideoParam *inputParam) {
         //decimate
         if (inputParam->vpp.decimate.enable) {
             unique_ptr<NVEncFilter> filter(new NVEncFilterDecimate());
+            filter->setFrameCache(m_frameCache);
             shared_ptr<NVEncFilterParamDecimate> param(new NVEncFilterParamDecimate());
             param->frameIn = inputFrame;
             param->frameOut = inputFrame;
@@ -2592,6 +2792,7 @@ RGY_ERR NVEncCore::InitFilters(const InEncodeVideoParam *inputParam) {
         //mpdecimate
         if (inputParam->vpp.mpdecimate.enable) {
             unique_ptr<NVEncFilter> filter(new NVEncFilterMpdecimate());
+            filter->setFrameCache(m_frameCache);
             shared_ptr<NVEncFilterParamMpdecimate> param(new NVEncFilterParamMpdecimate());
             param->frameIn = inputFrame;
             param->frameOut = inputFrame;
@@ -2659,6 +2860,7 @@ RGY_ERR NVEncCore::InitFilters(const InEncodeVideoParam *inputParam) {
         //ノイズ除去 (convolution3d)
         if (inputParam->vpp.convolution3d.enable) {
             unique_ptr<NVEncFilter> filter(new NVEncFilterConvolution3d());
+            filter->setFrameCache(m_frameCache);
             shared_ptr<NVEncFilterParamConvolution3d> param(new NVEncFilterParamConvolution3d());
             param->convolution3d = inputParam->vpp.convolution3d;
             param->frameIn = inputFrame;
@@ -3374,6 +3576,7 @@ NVENCSTATUS NVEncCore::InitEncode(InEncodeVideoParam *inputParam) {
     inputParam->applyDOVIProfile();
     m_nAVSyncMode = inputParam->common.AVSyncMode;
     m_nProcSpeedLimit = inputParam->ctrl.procSpeedLimit;
+    m_realtime = inputParam->ctrl.realtime;
     m_videoIgnoreTimestampError = inputParam->common.videoIgnoreTimestampError;
     if (inputParam->ctrl.lowLatency) {
         m_pipelineDepth = 1;
@@ -3385,6 +3588,7 @@ NVENCSTATUS NVEncCore::InitEncode(InEncodeVideoParam *inputParam) {
     }
 
     //デコーダが使用できるか確認する必要があるので、先にGPU関係の情報を取得しておく必要がある
+    NVEncDeviceCache::instance().init(inputParam->deviceCache);
     std::vector<std::unique_ptr<NVGPUInfo>> gpuList;
     if (NV_ENC_SUCCESS != (nvStatus = InitDeviceList(gpuList, m_cudaSchedule, inputParam->ctrl.skipHWDecodeCheck, inputParam->disableNVML))) {
         PrintMes(RGY_LOG_ERROR, FOR_AUO ? _T("Cudaの初期化に失敗しました。\n") : _T("Failed to initialize CUDA.\n"));
@@ -3442,11 +3646,13 @@ NVENCSTATUS NVEncCore::InitEncode(InEncodeVideoParam *inputParam) {
         }
     }
 
+    bool deviceFixed = inputParam->deviceID >= 0;
     if (gpuList.size() > 1 && m_nDeviceId < 0) {
 #if ENABLE_AVSW_READER
         RGYInputAvcodec *pReader = dynamic_cast<RGYInputAvcodec *>(m_pFileReader.get());
         if (pReader != nullptr) {
             m_nDeviceId = pReader->GetHWDecDeviceID();
+            deviceFixed = m_nDeviceId >= 0;
             if (m_nDeviceId >= 0) {
                 const auto gpu = std::find_if(gpuList.begin(), gpuList.end(), [device_id = m_nDeviceId](const std::unique_ptr<NVGPUInfo> & gpuinfo) {
                     return gpuinfo->id() == device_id;
@@ -3463,7 +3669,7 @@ NVENCSTATUS NVEncCore::InitEncode(InEncodeVideoParam *inputParam) {
         }
     }
 
-    if (NV_ENC_SUCCESS != (nvStatus = InitDevice(gpuList, inputParam))) {
+    if (NV_ENC_SUCCESS != (nvStatus = InitDevice(gpuList, inputParam, deviceFixed))) {
         PrintMes(RGY_LOG_ERROR, FOR_AUO ? _T("NVENCのインスタンス作成に失敗しました。\n") : _T("Failed to create NVENC instance.\n"));
         return nvStatus;
     }
@@ -3550,19 +3756,20 @@ NVENCSTATUS NVEncCore::InitEncode(InEncodeVideoParam *inputParam) {
     }
     PrintMes(RGY_LOG_DEBUG, _T("InitChapters: Success.\n"));
 
-#if ENABLE_AVSW_READER
-    if (inputParam->common.keyFile.length() > 0) {
-        if (m_trimParam.list.size() > 0) {
-            PrintMes(RGY_LOG_WARN, _T("--keyfile could not be used with --trim, disabled.\n"));
-        } else {
-            m_keyFile = read_keyfile(inputParam->common.keyFile);
-            if (m_keyFile.size() == 0) {
-                PrintMes(RGY_LOG_ERROR, _T("Failed to read keyFile \"%s\".\n"), inputParam->common.keyFile.c_str());
-                return NV_ENC_ERR_GENERIC;
-            }
-        }
+    if (NV_ENC_SUCCESS != (nvStatus = InitSceneDetector(inputParam))) {
+        return nvStatus;
     }
-#endif //#if ENABLE_AVSW_READER
+    PrintMes(RGY_LOG_DEBUG, _T("InitSceneDetector: Success.\n"));
+
+    if (NV_ENC_SUCCESS != (nvStatus = InitKeyframePlan(inputParam))) {
+        return nvStatus;
+    }
+    PrintMes(RGY_LOG_DEBUG, _T("InitKeyframePlan: Success.\n"));
+
+    if (NV_ENC_SUCCESS != (nvStatus = InitComplexityAnalyzer(inputParam))) {
+        return nvStatus;
+    }
+    PrintMes(RGY_LOG_DEBUG, _T("InitComplexityAnalyzer: Success.\n"));
 
     if (NV_ENC_SUCCESS != (nvStatus = InitPerfMonitor(inputParam))) {
         PrintMes(RGY_LOG_ERROR, _T("Faield to initialize performance monitor.\n"));
@@ -3578,21 +3785,24 @@ NVENCSTATUS NVEncCore::InitEncode(InEncodeVideoParam *inputParam) {
     PrintMes(RGY_LOG_DEBUG, _T("InitOutput: Success.\n"), inputParam->common.outputFilename.c_str());
 
     if (inputParam->common.metric.enabled() && m_dev->encoder()) {
-        //デコードのほうもチェックしてあげないといけない
-        const auto& cuvid_csp = m_dev->cuvid_csp();
-        if (cuvid_csp.count(inputParam->codec_rgy) == 0) {
-            PrintMes(RGY_LOG_ERROR, _T("GPU #%d (%s) does not support %s decoding required for ssim/psnr/vmaf calculation.\n"), m_dev->id(), m_dev->name().c_str(), CodecToStr(inputParam->codec_rgy).c_str());
-            return NV_ENC_ERR_UNSUPPORTED_DEVICE;
-        }
         const auto targetInfo = videooutputinfo(m_stCodecGUID, encBufferFormat,
             m_uEncWidth, m_uEncHeight,
             &m_stEncConfig, m_stPicStruct,
             std::make_pair(m_sar.n(), m_sar.d()),
             m_encFps);
-        const auto& cuvid_codec_csp = cuvid_csp.at(inputParam->codec_rgy);
-        if (std::find(cuvid_codec_csp.begin(), cuvid_codec_csp.end(), targetInfo.csp) == cuvid_codec_csp.end()) {
-            PrintMes(RGY_LOG_ERROR, _T("GPU #%d (%s) does not support %s %s decoding required for ssim/psnr/vmaf calculation.\n"), m_dev->id(), m_dev->name().c_str(), CodecToStr(inputParam->codec_rgy).c_str(), RGY_CSP_NAMES[targetInfo.csp]);
-            return NV_ENC_ERR_UNSUPPORTED_DEVICE;
+        //デコードのほうもチェックしてあげないといけない
+        //GPUでデコードできない場合は、ソフトウェアデコードで計算する
+        bool swDecode = false;
+        const auto& cuvid_csp = m_dev->cuvid_csp();
+        if (cuvid_csp.count(inputParam->codec_rgy) == 0) {
+            PrintMes(RGY_LOG_WARN, _T("GPU #%d (%s) does not support %s decoding, ssim/psnr/vmaf will be calculated using sw decoder.\n"), m_dev->id(), m_dev->name().c_str(), CodecToStr(inputParam->codec_rgy).c_str());
+            swDecode = true;
+        } else {
+            const auto& cuvid_codec_csp = cuvid_csp.at(inputParam->codec_rgy);
+            if (std::find(cuvid_codec_csp.begin(), cuvid_codec_csp.end(), targetInfo.csp) == cuvid_codec_csp.end()) {
+                PrintMes(RGY_LOG_WARN, _T("GPU #%d (%s) does not support %s %s decoding, ssim/psnr/vmaf will be calculated using sw decoder.\n"), m_dev->id(), m_dev->name().c_str(), CodecToStr(inputParam->codec_rgy).c_str(), RGY_CSP_NAMES[targetInfo.csp]);
+                swDecode = true;
+            }
         }
 
         unique_ptr<NVEncFilterSsim> filterSsim(new NVEncFilterSsim());
@@ -3613,6 +3823,8 @@ NVENCSTATUS NVEncCore::InitEncode(InEncodeVideoParam *inputParam) {
         param->psnr = inputParam->common.metric.psnr;
         param->vmaf = inputParam->common.metric.vmaf;
         param->deviceId = m_nDeviceId;
+        param->swDecode = swDecode;
+        param->bitDepth = clamp(inputParam->outputDepth, 8, 10);
         auto sts = filterSsim->init(param, m_pNVLog);
         if (sts != RGY_ERR_NONE) {
             return NV_ENC_ERR_UNSUPPORTED_PARAM;
@@ -3620,6 +3832,25 @@ NVENCSTATUS NVEncCore::InitEncode(InEncodeVideoParam *inputParam) {
         m_ssim = std::move(filterSsim);
     }
 
+    if (inputParam->ctrl.frameStats.enable) {
+        const auto filename = inputParam->ctrl.frameStats.getFilename(inputParam->common.outputFilename, RGY_FRAME_STATS_EXT);
+        m_frameStats = std::make_unique<RGYFrameStatsWriter>();
+        auto sts = m_frameStats->init(filename, m_outputTimebase, m_encFps, m_pNVLog);
+        if (sts != RGY_ERR_NONE) {
+            PrintMes(RGY_LOG_ERROR, _T("Failed to open frame stats file \"%s\": %s.\n"), filename.c_str(), get_err_mes(sts));
+            return err_to_nv(sts);
+        }
+#if ENABLE_SSIM
+        if (m_ssim) {
+            auto frameStats = m_frameStats.get();
+            m_ssim->setFrameMetricsCallback([frameStats](int index, double ssim, double psnr) {
+                frameStats->frameQuality(index, ssim, psnr);
+            });
+        }
+#endif //#if ENABLE_SSIM
+        PrintMes(RGY_LOG_DEBUG, _T("Opened frame stats file \"%s\".\n"), filename.c_str());
+    }
+
     {
         const auto& threadParam = inputParam->ctrl.threadParams.get(RGYThreadType::MAIN);
         threadParam.apply(GetCurrentThread());
@@ -3633,6 +3864,12 @@ NVENCSTATUS NVEncCore::NvEncEncodeFrame(EncodeBuffer *pEncodeBuffer, const int i
     NV_ENC_PIC_PARAMS encPicParams = { 0 };
     m_dev->encoder()->setStructVer(encPicParams);
 
+    if (m_complexity) {
+        RGYComplexitySegment seg;
+        if (m_complexity->checkSegment(id, inputFrameId, &seg)) {
+            AddAutoDynamicRC(id, seg);
+        }
+    }
     if (m_dynamicRC.size() > 0) {
         int selectedIdx = DYNAMIC_PARAM_NOT_SELECTED;
         for (int i = 0; i < (int)m_dynamicRC.size(); i++) {
@@ -3687,6 +3924,17 @@ NVENCSTATUS NVEncCore::NvEncEncodeFrame(EncodeBuffer *pEncodeBuffer, const int i
                 if (selectedPrms.max_bitrate > 0) {
                     encConfig.rcParams.maxBitRate = std::max(selectedPrms.max_bitrate, averageBitRateUsed);
                 }
+                if (selectedPrms.qpMin.enable) {
+                    encConfig.rcParams.enableMinQP = 1;
+                    setQP(encConfig.rcParams.minQP, selectedPrms.qpMin);
+                }
+                if (selectedPrms.qpMax.enable) {
+                    encConfig.rcParams.enableMaxQP = 1;
+                    setQP(encConfig.rcParams.maxQP, selectedPrms.qpMax);
+                }
+                if (selectedPrms.aqStrength >= 0 && encConfig.rcParams.enableAQ) {
+                    encConfig.rcParams.aqStrength = selectedPrms.aqStrength;
+                }
             }
             NVENCSTATUS nvStatus = m_dev->encoder()->NvEncReconfigureEncoder(&reconf_params);
             if (nvStatus != NV_ENC_SUCCESS) {
@@ -3699,34 +3947,12 @@ NVENCSTATUS NVEncCore::NvEncEncodeFrame(EncodeBuffer *pEncodeBuffer, const int i
     }
 
 #if ENABLE_AVSW_READER
-    if (m_Chapters.size() > 0 && m_keyOnChapter) {
-        for (const auto& chap : m_Chapters) {
-            //av_cmopare_tsを使うと、timebaseが粗く端数が出る場合に厳密に比較できないことがある
-            //そこで、ここでは、最小公倍数をとって厳密な比較を行う
-            const auto timebase_lcm = std::lcm<int64_t, int64_t>(chap->time_base.den, m_outputTimebase.d());
-            ttint128 ts_frame = timestamp;
-            ts_frame *= m_outputTimebase.n();
-            ts_frame *= timebase_lcm / m_outputTimebase.d();
-
-            ttint128 ts_chap = chap->start;
-            ts_chap *= chap->time_base.num;
-            ts_chap *= timebase_lcm / chap->time_base.den;
-
-            if (chap->id >= 0 && ts_chap <= ts_frame) {
-                PrintMes(RGY_LOG_DEBUG, _T("Insert Keyframe on chapter %d: %s at frame #%d: %s (timebase: %lld).\n"),
-                    chap->id,
-                    wstring_to_tstring(ts_chap.ToWString()).c_str(),
-                    id,
-                    wstring_to_tstring(ts_frame.ToWString()).c_str(),
-                    timebase_lcm);
-                chap->id = -1;
-                encPicParams.encodePicFlags |= NV_ENC_PIC_FLAG_FORCEIDR;
-                break;
-            }
-        }
+    //シーンチェンジは前のフレームからの間の入力フレームを見る (フィルタで間引かれたフレームのシーンチェンジも拾う)
+    if (m_keyframePlan && m_sceneDetect && m_sceneDetect->checkSceneChange(inputFrameId)) {
+        m_keyframePlan->addFrames(RGYKeyframeSource::SceneChange, { id });
     }
-    if (std::find(m_keyFile.begin(), m_keyFile.end(), id) != m_keyFile.end()) {
-        PrintMes(RGY_LOG_DEBUG, _T("Insert Keyframe on frame #%d.\n"), id);
+    //チャプター/--keyfileはInitKeyframePlanでまとめてソート済み
+    if (m_keyframePlan && m_keyframePlan->check(id, timestamp, duration) != RGYKeyframeSource::None) {
         encPicParams.encodePicFlags |= NV_ENC_PIC_FLAG_FORCEIDR;
     }
 #endif //#if ENABLE_AVSW_READER
@@ -3805,6 +4031,106 @@ NVENCSTATUS NVEncCore::NvEncEncodeFrame(EncodeBuffer *pEncodeBuffer, const int i
     return NV_ENC_SUCCESS;
 }
 
+NVENCSTATUS NVEncCore::ReconfigureRealtime(const RGYRealtimeScheduler& realtimeCtrl) {
+    if (!m_dev->encoder()) {
+        return NV_ENC_SUCCESS;
+    }
+    if (!m_realtimeBaseConfig) {
+        //元の設定を保存しておき、劣化段階が戻ったときに復元する
+        m_realtimeBaseConfig = std::make_unique<NV_ENC_CONFIG>(m_stEncConfig);
+        m_realtimeBasePreset = m_stCreateEncodeParams.presetGUID;
+    }
+    const auto level = realtimeCtrl.level();
+    //レート制御(m_dynamicRCで変更される)以外は元の設定から作り直す
+    NV_ENC_CONFIG encConfig = m_stEncConfig;
+    GUID presetGUID = m_realtimeBasePreset;
+    encConfig.mvPrecision       = m_realtimeBaseConfig->mvPrecision;
+    encConfig.encodeCodecConfig = m_realtimeBaseConfig->encodeCodecConfig;
+    encConfig.rcParams.enableLookahead = m_realtimeBaseConfig->rcParams.enableLookahead;
+    encConfig.rcParams.lookaheadDepth  = m_realtimeBaseConfig->rcParams.lookaheadDepth;
+    encConfig.rcParams.multiPass       = m_realtimeBaseConfig->rcParams.multiPass;
+    if (level >= RGYRealtimeLevel::ReduceLookahead && realtimeCtrl.available(RGYRealtimeLevel::ReduceLookahead)) {
+        encConfig.rcParams.enableLookahead = 0;
+        encConfig.rcParams.lookaheadDepth = 0;
+    }
+    if (level >= RGYRealtimeLevel::FastPreset && realtimeCtrl.available(RGYRealtimeLevel::FastPreset)) {
+        presetGUID = (m_dev->encoder()->checkAPIver(10, 0)) ? NV_ENC_PRESET_P1_GUID : NV_ENC_PRESET_LOW_LATENCY_HP_GUID;
+        //encodeConfigを指定するとプリセットの設定は使われないので、プリセットの設定を取得して反映する
+        //ストリームの構成(プロファイル、GOP、色情報など)とレート制御は変えず、速度に関わる設定のみ反映する
+        NV_ENC_PRESET_CONFIG presetConfig;
+        NVENCSTATUS nvStatus = m_dev->encoder()->NvEncGetEncodePresetConfig(m_stCodecGUID, presetGUID, m_stCreateEncodeParams.tuningInfo, &presetConfig);
+        if (nvStatus != NV_ENC_SUCCESS) {
+            PrintMes(RGY_LOG_WARN, _T("realtime: failed to get preset config: %s.\n"), char_to_tstring(_nvencGetErrorEnum(nvStatus)).c_str());
+            return nvStatus;
+        }
+        const auto& preset = presetConfig.presetCfg;
+        encConfig.mvPrecision = preset.mvPrecision;
+        encConfig.rcParams.multiPass = preset.rcParams.multiPass;
+        if (preset.rcParams.enableLookahead == 0) {
+            encConfig.rcParams.enableLookahead = 0;
+            encConfig.rcParams.lookaheadDepth = 0;
+        }
+        //参照フレーム数はプリセットのほうが少ない場合のみ減らす
+        const auto rgy_codec = codec_guid_enc_to_rgy(m_stCodecGUID);
+        if (rgy_codec == RGY_CODEC_H264) {
+            auto& refs = encConfig.encodeCodecConfig.h264Config.maxNumRefFrames;
+            const auto presetRefs = preset.encodeCodecConfig.h264Config.maxNumRefFrames;
+            if (presetRefs > 0 && (refs == 0 || presetRefs < refs)) refs = presetRefs;
+        } else if (rgy_codec == RGY_CODEC_HEVC) {
+            auto& refs = encConfig.encodeCodecConfig.hevcConfig.maxNumRefFramesInDPB;
+            const auto presetRefs = preset.encodeCodecConfig.hevcConfig.maxNumRefFramesInDPB;
+            if (presetRefs > 0 && (refs == 0 || presetRefs < refs)) refs = presetRefs;
+        } else if (rgy_codec == RGY_CODEC_AV1) {
+            auto& refs = encConfig.encodeCodecConfig.av1Config.maxNumRefFramesInDPB;
+            const auto presetRefs = preset.encodeCodecConfig.av1Config.maxNumRefFramesInDPB;
+            if (presetRefs > 0 && (refs == 0 || presetRefs < refs)) refs = presetRefs;
+        }
+    }
+    if (memcmp(&presetGUID, &m_stCreateEncodeParams.presetGUID, sizeof(presetGUID)) == 0
+        && memcmp(&encConfig, &m_stEncConfig, sizeof(encConfig)) == 0) {
+        return NV_ENC_SUCCESS; //エンコーダの設定は変わらない
+    }
+    NV_ENC_RECONFIGURE_PARAMS reconf_params = { 0 };
+    m_dev->encoder()->setStructVer(reconf_params);
+    reconf_params.resetEncoder = 1;
+    reconf_params.forceIDR = 1;
+    reconf_params.reInitEncodeParams = m_stCreateEncodeParams;
+    reconf_params.reInitEncodeParams.presetGUID = presetGUID;
+    reconf_params.reInitEncodeParams.encodeConfig = &encConfig;
+    NVENCSTATUS nvStatus = m_dev->encoder()->NvEncReconfigureEncoder(&reconf_params);
+    if (nvStatus != NV_ENC_SUCCESS) {
+        //呼び出し元で段階を戻し、エンコードは継続する
+        PrintMes(RGY_LOG_WARN, _T("realtime: failed to reconfigure the encoder: %s.\n"), char_to_tstring(_nvencGetErrorEnum(nvStatus)).c_str());
+        return nvStatus;
+    }
+    m_stEncConfig = encConfig;
+    m_stCreateEncodeParams.presetGUID = presetGUID;
+    //m_dynamicRCはm_stEncConfigを基準にしているので、次のフレームで再適用させる
+    m_appliedDynamicRC = DYNAMIC_PARAM_NOT_SELECTED;
+    PrintMes(RGY_LOG_DEBUG, _T("realtime: reconfigured encoder: lookahead %d, preset %s.\n"),
+        m_stEncConfig.rcParams.enableLookahead ? m_stEncConfig.rcParams.lookaheadDepth : 0,
+        get_name_from_guid(presetGUID, (m_dev->encoder()->checkAPIver(10, 0)) ? list_nvenc_preset_names_ver10 : list_nvenc_preset_names_ver9_2));
+    return NV_ENC_SUCCESS;
+}
+
+//リアルタイムモードで遅延が大きいときにスキップしてよいフィルタか
+//時間方向の参照を持たず、解像度・色空間を変更しないフィルタのみ対象とする
+static bool realtime_filter_skippable(const NVEncFilter *filter) {
+    static const TCHAR *skippable[] = {
+        _T("knn"), _T("pmd"), _T("smooth"), _T("denoise-dct"), _T("nlmeans"), _T("gauss"),
+        _T("unsharp"), _T("edgelevel"), _T("warpsharp"), _T("deband"),
+        _T("nvvfx-denoise"), _T("nvvfx-artifact-reduction")
+    };
+    if (std::find_if(std::begin(skippable), std::end(skippable), [filter](const TCHAR *name) { return filter->name() == name; }) == std::end(skippable)) {
+        return false;
+    }
+    const auto prm = filter->GetFilterParam();
+    return prm != nullptr
+        && prm->frameIn.width  == prm->frameOut.width
+        && prm->frameIn.height == prm->frameOut.height
+        && prm->frameIn.csp    == prm->frameOut.csp;
+}
+
 #if 1
 NVENCSTATUS NVEncCore::Encode() {
     NVENCSTATUS nvStatus = NV_ENC_SUCCESS;
@@ -3883,9 +4209,15 @@ NVENCSTATUS NVEncCore::Encode() {
 #if ENABLE_AVSW_READER
     const AVStream *streamIn = nullptr;
     RGYInputAvcodec *pReader = dynamic_cast<RGYInputAvcodec *>(m_pFileReader.get());
+    int framePosConsumer = -1;
     if (pReader != nullptr) {
         streamIn = pReader->GetInputVideoStream();
         interlaceAutoDetect = pReader->GetInputFrameInfo().picstruct == RGY_PICSTRUCT_AUTO;
+        //check_ptsでフレーム情報を参照する場合は登録しておき、参照の済んだフレーム情報は破棄できるようにする
+        if (streamIn && ((m_nAVSyncMode & RGY_AVSYNC_VFR) || vpp_rff || vpp_afs_rff_aware)) {
+            framePosConsumer = pReader->GetFramePosList()->addConsumer();
+        }
+        pReader->EnableFramePosEvict();
     }
     //cuvidデコード時は、timebaseの分子はかならず1
     const auto srcTimebase = (streamIn) ? rgy_rational<int>((m_cuvidDec) ? 1 : streamIn->time_base.num, streamIn->time_base.den) : m_pFileReader->getInputTimebase();
@@ -4052,6 +4384,13 @@ NVENCSTATUS NVEncCore::Encode() {
     int64_t lastTrimFramePts = AV_NOPTS_VALUE; //直前のtrimで落とされたフレームのpts, trimで落とされてない場合はAV_NOPTS_VALUE (スケール: m_outputTimebase)
     int64_t nOutEstimatedPts = 0; //固定fpsを仮定した時のfps (スケール: m_outputTimebase)
     const int64_t nOutFrameDuration = std::max<int64_t>(1, rational_rescale(1, m_inputFps.inv(), m_outputTimebase)); //固定fpsを仮定した時の1フレームのduration (スケール: m_outputTimebase)
+    //毎フレーム使用するtimebaseの組み合わせは、あらかじめ約分しておく
+    const RGYRescaler rescaleSrcToOut(srcTimebase, m_outputTimebase);
+    const RGYRescaler rescaleOutToSrc(m_outputTimebase, srcTimebase);
+#if ENABLE_AVSW_READER
+    const RGYRescaler rescaleSrcToStream = (streamIn) ? RGYRescaler(srcTimebase, to_rgy(streamIn->time_base)) : RGYRescaler();
+    const RGYRescaler rescaleStreamToOut = (streamIn) ? RGYRescaler(to_rgy(streamIn->time_base), m_outputTimebase) : RGYRescaler();
+#endif //#if ENABLE_AVSW_READER
     int64_t nLastPts = AV_NOPTS_VALUE;
 
     auto add_dec_vpp_param = [&](FrameBufferDataIn *pInputFrame, vector<unique_ptr<FrameBufferDataIn>>& vppParams, int64_t outPts, int64_t outDuration) {
@@ -4122,17 +4461,17 @@ NVENCSTATUS NVEncCore::Encode() {
             if (pInputFrame->getTimeStamp() < 0) {
                 // timestampを修正
                 outPtsSource = nOutEstimatedPts;
-                pInputFrame->setTimeStamp(rational_rescale(nOutEstimatedPts, m_outputTimebase, srcTimebase));
-                pInputFrame->setDuration(rational_rescale(nOutFrameDuration, m_outputTimebase, srcTimebase));
+                pInputFrame->setTimeStamp(rescaleOutToSrc(nOutEstimatedPts));
+                pInputFrame->setDuration(rescaleOutToSrc(nOutFrameDuration));
                 PrintMes(RGY_LOG_WARN, _T("check_pts: Invalid timestamp from input frame #%d: timestamp %lld, timebase %d/%d, duration %lld.\n"),
                          pInputFrame->getFrameInfo().inputFrameId, pInputFrame->getTimeStamp(), srcTimebase.n(), srcTimebase.d(), pInputFrame->getDuration());
                 PrintMes(RGY_LOG_WARN, _T("           use estimated timestamp: timestamp %lld, timebase %d/%d, duration %lld.\n"),
                     outPtsSource, m_outputTimebase.n(), m_outputTimebase.d(), nOutFrameDuration);
             } else {
                 //CFR仮定ではなく、オリジナルの時間を見る
-                outPtsSource = rational_rescale(pInputFrame->getTimeStamp(), srcTimebase, m_outputTimebase);
+                outPtsSource = rescaleSrcToOut(pInputFrame->getTimeStamp());
                 if (pInputFrame->getDuration() > 0) {
-                    pInputFrame->setDuration(rational_rescale(pInputFrame->getDuration(), srcTimebase, m_outputTimebase));
+                    pInputFrame->setDuration(rescaleSrcToOut(pInputFrame->getDuration()));
                 }
             }
         }
@@ -4170,13 +4509,13 @@ NVENCSTATUS NVEncCore::Encode() {
             }
             if (streamIn) {
                 //cuvidデコード時は、timebaseの分子はかならず1なので、streamIn->time_baseとズレているかもしれないのでオリジナルを計算
-                const auto orig_pts = rational_rescale(pInputFrame->getTimeStamp(), srcTimebase, to_rgy(streamIn->time_base));
+                const auto orig_pts = rescaleSrcToStream(pInputFrame->getTimeStamp());
                 //ptsからフレーム情報を取得する
-                const auto framePos = pReader->GetFramePosList()->findpts(orig_pts, &nInputFramePosIdx);
+                const auto framePos = pReader->GetFramePosList()->findpts(orig_pts, &nInputFramePosIdx, framePosConsumer);
                 PrintMes(RGY_LOG_TRACE, _T("check_pts(%d):   estimetaed orig_pts %lld, framePos %d\n"), pInputFrame->getFrameInfo().inputFrameId, orig_pts, framePos.poc);
                 if (framePos.poc != FRAMEPOS_POC_INVALID && framePos.duration > 0) {
                     //有効な値ならオリジナルのdurationを使用する
-                    outDuration = rational_rescale(framePos.duration, to_rgy(streamIn->time_base), m_outputTimebase);
+                    outDuration = rescaleStreamToOut(framePos.duration);
                     PrintMes(RGY_LOG_TRACE, _T("check_pts(%d):   changing duration to original: %d\n"), pInputFrame->getFrameInfo().inputFrameId, outDuration);
                 }
             }
@@ -4260,6 +4599,50 @@ NVENCSTATUS NVEncCore::Encode() {
         return NV_ENC_SUCCESS;
     };
 
+    RGYRealtimeScheduler realtimeCtrl;
+    std::vector<bool> realtimeSkipFilter(m_vpFilters.size(), false);
+    if (m_realtime.enable) {
+        realtimeCtrl.init(m_realtime.latency, m_realtime.maxLevel, m_outputTimebase, m_pNVLog);
+        //最初(転送)と最後(エンコーダへの変換)のフィルタはスキップできない
+        for (size_t ifilter = 1; ifilter + 1 < m_vpFilters.size(); ifilter++) {
+            realtimeSkipFilter[ifilter] = realtime_filter_skippable(m_vpFilters[ifilter].get());
+            if (realtimeSkipFilter[ifilter]) {
+                PrintMes(RGY_LOG_DEBUG, _T("realtime: filter \"%s\" might be skipped when falling behind.\n"), m_vpFilters[ifilter]->name().c_str());
+            }
+        }
+    }
+    //エンコードしたフレームの遅延を記録し、必要ならエンコーダを再設定する
+    auto realtime_frame_out = [&](const int64_t timestamp) {
+        if (realtimeCtrl.frameOut(timestamp) && ReconfigureRealtime(realtimeCtrl) != NV_ENC_SUCCESS) {
+            //エンコーダに適用できなかったので、段階を戻す (以降その段階は使用しない)
+            realtimeCtrl.levelFailed();
+        }
+        return NV_ENC_SUCCESS;
+    };
+
+    //raw出力: GPU→CPUの転送が終了したフレームを書き出す
+    //転送中のフレームを保持しておき、次のフレームの転送と前のフレームの書き出しを並列に行う
+    deque<std::pair<RGYFrameInfo, cudaEvent_t *>> dqRawOutFrames;
+    int nRawOutFrame = 0;
+    auto write_raw_frame = [&](const size_t remaining) {
+        while (dqRawOutFrames.size() > remaining) {
+            auto& rawframe = dqRawOutFrames.front();
+            cudaEventSynchronize(*rawframe.second);
+            RGYFrameRef outFrame(rawframe.first);
+            auto err = m_pFileWriter->WriteNextFrame(&outFrame);
+            const auto timestamp = rawframe.first.timestamp;
+            dqRawOutFrames.pop_front();
+            if (err != RGY_ERR_NONE) {
+                PrintMes(RGY_LOG_ERROR, _T("Failed to write frame: %s.\n"), get_err_mes(err));
+                return NV_ENC_ERR_GENERIC;
+            }
+            if (auto nvsts = realtime_frame_out(timestamp); nvsts != NV_ENC_SUCCESS) {
+                return nvsts;
+            }
+        }
+        return NV_ENC_SUCCESS;
+    };
+
     auto filter_frame = [&](int& nFilterFrame, unique_ptr<FrameBufferDataIn>& inframe, deque<unique_ptr<FrameBufferDataEnc>>& dqEncFrames, bool& bDrain) {
         cudaMemcpyKind memcpyKind = cudaMemcpyDeviceToDevice;
         RGYFrameInfo frameInfo;
@@ -4316,6 +4699,9 @@ NVENCSTATUS NVEncCore::Encode() {
                 // コピーを作ってそれをfilter関数に渡す
                 // vpp-rffなどoverwirteするフィルタのときに、filterframes.pop_front -> push がうまく動作しない
                 RGYFrameInfo input = filterframes.front().first;
+                if (realtimeSkipFilter[ifilter] && realtimeCtrl.level() >= RGYRealtimeLevel::SkipFilter) {
+                    continue; //リアルタイムモードで遅れているので、このフィルタをスキップ
+                }
 
                 NVEncCtxAutoLock(ctxlock(m_dev->vidCtxLock()));
                 int nOutFrames = 0;
@@ -4391,7 +4777,11 @@ NVENCSTATUS NVEncCore::Encode() {
                 RGYFrameInfo encFrameInfo;
                 RGYFrameInfo ssimTarget;
                 if (!m_dev->encoder()) {
-                    encFrameInfo = m_outputFrameHostRaw->frame;
+                    //使用するバッファの書き出しが終わっていることを保証する
+                    if (auto nvsts = write_raw_frame(m_outputFrameHostRaw.size() - 1); nvsts != NV_ENC_SUCCESS) {
+                        return nvsts;
+                    }
+                    encFrameInfo = m_outputFrameHostRaw[nRawOutFrame++ % m_outputFrameHostRaw.size()]->frame;
                 } else if (pEncodeBuffer->stInputBfr.pNV12devPtr) {
                     encFrameInfo.ptr[0] = (uint8_t *)pEncodeBuffer->stInputBfr.pNV12devPtr;
                     encFrameInfo.pitch[0] = pEncodeBuffer->stInputBfr.uNV12Stride;
@@ -4442,9 +4832,11 @@ NVENCSTATUS NVEncCore::Encode() {
                     unique_ptr<FrameBufferDataEnc> frameEnc(new FrameBufferDataEnc(RGY_CSP_NV12, encFrameInfo.timestamp, encFrameInfo.duration, encFrameInfo.inputFrameId, pEncodeBuffer, pCudaEvent, encFrameInfo.dataList));
                     dqEncFrames.push_back(std::move(frameEnc));
                 } else {
-                    cudaEventSynchronize(*pCudaEvent);
-                    RGYFrameRef outFrame(encFrameInfo);
-                    m_pFileWriter->WriteNextFrame(&outFrame);
+                    dqRawOutFrames.push_back(std::make_pair(encFrameInfo, pCudaEvent));
+                    //ひとつ前のフレームを書き出す間に、このフレームの転送を進める
+                    if (auto nvsts = write_raw_frame(1); nvsts != NV_ENC_SUCCESS) {
+                        return nvsts;
+                    }
                 }
             }
         }
@@ -4467,7 +4859,14 @@ NVENCSTATUS NVEncCore::Encode() {
         } else {
             m_dev->encoder()->NvEncUnlockInputBuffer(pEncodeBuffer->stInputBfr.hInputSurface);
         }
-        return NvEncEncodeFrame(pEncodeBuffer, nEncodeFrame++, encFrame->m_timestamp, encFrame->m_duration, encFrame->m_inputFrameId, encFrame->m_frameDataList);
+        if (m_frameStats) {
+            m_frameStats->frameSubmit(encFrame->m_timestamp);
+        }
+        auto nvStatus = NvEncEncodeFrame(pEncodeBuffer, nEncodeFrame++, encFrame->m_timestamp, encFrame->m_duration, encFrame->m_inputFrameId, encFrame->m_frameDataList);
+        if (nvStatus != NV_ENC_SUCCESS) {
+            return nvStatus;
+        }
+        return realtime_frame_out(encFrame->m_timestamp);
     };
 
 #define NV_ENC_ERR_ABORT ((NVENCSTATUS)-1)
@@ -4538,7 +4937,7 @@ NVENCSTATUS NVEncCore::Encode() {
                             return NV_ENC_ERR_GENERIC;
                         }
                         //cuvidのtimestampはかならず分子が1になっているのでもとに戻す
-                        const auto orig_pts = rational_rescale(dispInfo.timestamp, srcTimebase, to_rgy(streamIn->time_base));
+                        const auto orig_pts = rescaleSrcToStream(dispInfo.timestamp);
                         inputFrame.addFrameData(getHDR10plusMetadata(orig_pts));
                     }
                 }
@@ -4567,7 +4966,18 @@ NVENCSTATUS NVEncCore::Encode() {
                 }
                 bInputEmpty = true;
             }
-            auto heTransferFin = shared_ptr<void>(inputFrameBuf.heTransferFin.get(), [&](void *ptr) {
+            //入力モジュールのバッファを直接参照している場合は、そこから転送する
+            std::shared_ptr<RGYFrameDataHostRef> hostRef;
+            for (auto it = frame.dataList().begin(); it != frame.dataList().end(); it++) {
+                if ((*it)->dataType() == RGY_FRAME_DATA_HOSTREF) {
+                    hostRef = std::dynamic_pointer_cast<RGYFrameDataHostRef>(*it);
+                    frame.dataList().erase(it);
+                    break;
+                }
+            }
+            //入力モジュールのバッファは、転送が終了するまで保持する
+            auto hostRefBuf = (hostRef) ? hostRef->ref() : std::shared_ptr<void>();
+            auto heTransferFin = shared_ptr<void>(inputFrameBuf.heTransferFin.get(), [hostRefBuf](void *ptr) {
                 SetEvent((HANDLE)ptr);
             });
             for (auto &data : frame.dataList()) {
@@ -4583,7 +4993,17 @@ NVENCSTATUS NVEncCore::Encode() {
                 }
 #endif
             }
-            inputFrame.setHostFrameInfo(inputFrameBuf.cubuf->frame, heTransferFin);
+            if (hostRef) {
+                RGYFrameInfo hostFrame = inputFrameBuf.cubuf->frame;
+                for (int i = 0; i < RGY_MAX_PLANES; i++) {
+                    hostFrame.ptr[i] = hostRef->frame().ptr[i];
+                    hostFrame.pitch[i] = hostRef->frame().pitch[i];
+                }
+                hostFrame.singleAlloc = false;
+                inputFrame.setHostFrameInfo(hostFrame, heTransferFin);
+            } else {
+                inputFrame.setHostFrameInfo(inputFrameBuf.cubuf->frame, heTransferFin);
+            }
             inputFrame.setInputFrameId(nInputFrame);
             PrintMes(RGY_LOG_TRACE, _T("input frame (host) #%d, timestamp %lld, duration %lld\n"), nInputFrame, inputFrame.getTimeStamp(), inputFrame.getDuration());
         } else {
@@ -4596,7 +5016,7 @@ NVENCSTATUS NVEncCore::Encode() {
             //trim反映
             const auto trimSts = frame_inside_range(nInputFrame++, m_trimParam.list);
 #if ENABLE_AVSW_READER
-            const auto inputFramePts = rational_rescale(inputFrame.getTimeStamp(), srcTimebase, m_outputTimebase);
+            const auto inputFramePts = rescaleSrcToOut(inputFrame.getTimeStamp());
             if (((m_nAVSyncMode & RGY_AVSYNC_VFR) || vpp_rff || vpp_afs_rff_aware)
                 && (trimSts.second > 0) //check_pts内で最初のフレームのptsを0とするようnOutFirstPtsが設定されるので、先頭のtrim blockについてはここでは処理しない
                 && (lastTrimFramePts != AV_NOPTS_VALUE)) { //前のフレームがtrimで脱落させたフレームなら
@@ -4613,9 +5033,31 @@ NVENCSTATUS NVEncCore::Encode() {
                 continue; //seektoにより脱落させるフレーム
             }
             lastTrimFramePts = AV_NOPTS_VALUE;
+            std::shared_ptr<RGYFrameDataScene> sceneData;
+            if (m_sceneDetect && inputFrame.inputIsHost()) {
+                //縮小が終わるまで入力バッファへの参照を保持させる
+                auto err = m_sceneDetect->addFrame(inputFrame.getFrameInfo().inputFrameId, inputFrame.getFrameInfo(), inputFrame.getTransferFin(), &sceneData);
+                if (err != RGY_ERR_NONE) {
+                    nvStatus = err_to_nv(err);
+                    break;
+                }
+                //判定結果はフレームとともにフィルタ/エンコーダに渡す
+                inputFrame.addFrameData(sceneData);
+            }
+            if (m_complexity && inputFrame.inputIsHost()) {
+                //縮小が終わるまで入力バッファへの参照を保持させる
+                auto err = m_complexity->addFrame(inputFrame.getFrameInfo().inputFrameId, inputFrame.getFrameInfo(), inputFrame.getTransferFin(), sceneData);
+                if (err != RGY_ERR_NONE) {
+                    nvStatus = err_to_nv(err);
+                    break;
+                }
+            }
             auto decFrames = check_pts(&inputFrame);
 
             for (auto idf = decFrames.begin(); idf != decFrames.end(); idf++) {
+                if (m_frameStats) {
+                    m_frameStats->frameIn((*idf)->getTimeStamp(), rescaleSrcToOut(inputFrame.getTimeStamp()));
+                }
                 dqInFrames.push_back(std::move(*idf));
             }
         }
@@ -4624,6 +5066,11 @@ NVENCSTATUS NVEncCore::Encode() {
         while (((dqInFrames.size() || bInputEmpty) && !bFilterEmpty) && nvStatus == NV_ENC_SUCCESS) {
             const bool bDrain = (dqInFrames.size()) ? false : bInputEmpty;
             auto& inframe = (dqInFrames.size()) ? dqInFrames.front() : dummyFrame;
+            if (!bDrain && !realtimeCtrl.frameIn(inframe->getTimeStamp())) {
+                PrintMes(RGY_LOG_TRACE, _T("realtime: dropped frame, timestamp %lld.\n"), inframe->getTimeStamp());
+                dqInFrames.pop_front(); //締め切りに間に合わないので間引く
+                continue;
+            }
             bool bDrainFin = bDrain;
             auto filter_ret = filter_frame(nFilterFrame, inframe, dqEncFrames, bDrainFin);
             if (filter_ret != NV_ENC_SUCCESS) {
@@ -4653,6 +5100,13 @@ NVENCSTATUS NVEncCore::Encode() {
             return NV_ENC_ERR_GENERIC;
         }
     }
+    //raw出力の残りのフレームを書き出す
+    if (dqRawOutFrames.size()) {
+        NVEncCtxAutoLock(ctxlock(m_dev->vidCtxLock()));
+        if (auto nvsts = write_raw_frame(0); nvsts != NV_ENC_SUCCESS && nvStatus == NV_ENC_SUCCESS) {
+            nvStatus = nvsts;
+        }
+    }
     //エンコードバッファのフレームをすべて転送
     while (dqEncFrames.size()) {
         auto& encframe = dqEncFrames.front();
@@ -4705,12 +5159,23 @@ NVENCSTATUS NVEncCore::Encode() {
             m_ssim->addBitstream(nullptr);
         }
     }
+    //書き出しスレッドに残っているデータを書き出し、書き出しのエラーを確認する
+    if (auto err = m_pFileWriter->WaitFin(); err != RGY_ERR_NONE) {
+        PrintMes(RGY_LOG_ERROR, _T("Error writing output: %s.\n"), get_err_mes(err));
+        if (nvStatus == NV_ENC_SUCCESS) {
+            nvStatus = NV_ENC_ERR_GENERIC;
+        }
+    }
     m_pFileWriter->Close();
     m_pFileReader->Close();
     m_pStatus->WriteResults();
+    realtimeCtrl.printResult();
     if (m_ssim) {
         m_ssim->showResult();
     }
+    if (m_frameStats) {
+        m_frameStats->close();
+    }
     queueHDR10plusMetadata.close([](RGYFrameDataHDR10plus **ptr) { if (*ptr) { delete *ptr; *ptr = nullptr; }; });
     vector<std::pair<tstring, double>> filter_result;
     for (auto& filter : m_vpFilters) {
@@ -4732,6 +5197,9 @@ NVENCSTATUS NVEncCore::Encode() {
             PrintMes(RGY_LOG_INFO, _T("%s %7.1f us\n"), str.c_str(), info.second * 1000.0);
         }
     }
+    if (m_frameCache && m_frameCache->subscribers() > 0) {
+        PrintMes((m_frameCache->subscribers() > 1) ? RGY_LOG_INFO : RGY_LOG_DEBUG, _T("Vpp Frame Cache: %s\n"), m_frameCache->print().c_str());
+    }
     return nvStatus;
 }
 #else
@@ -4997,6 +5465,12 @@ NVENCSTATUS NVEncCore::Encode() {
     } else {
         PrintMes(RGY_LOG_DEBUG, _T("Flushed Encoder\n"));
     }
+    if (auto err = m_pFileWriter->WaitFin(); err != RGY_ERR_NONE) {
+        PrintMes(RGY_LOG_ERROR, _T("Error writing output: %s.\n"), get_err_mes(err));
+        if (nvStatus == NV_ENC_SUCCESS) {
+            nvStatus = NV_ENC_ERR_GENERIC;
+        }
+    }
     m_pFileReader->Close();
     m_pFileWriter->Close();
     m_pStatus->writeResult();
@@ -5200,6 +5674,12 @@ tstring NVEncCore::GetEncodingParamsInfo(int output_level) {
         }
         add_str(RGY_LOG_INFO, _T("%s\n"), strDynamicRC.c_str());
     }
+    if (m_complexity) {
+        add_str(RGY_LOG_INFO, _T("DynamicRC      auto, %s\n"), m_complexity->print().c_str());
+    }
+    if (m_sceneDetect) {
+        add_str(RGY_LOG_INFO, _T("Scene Detect   %s\n"), m_sceneDetect->print().c_str());
+    }
 
     if (m_dev->encoder()->checkAPIver(12, 1)) {
         add_str(RGY_LOG_INFO, _T("Split Enc Mode %s\n"), get_chr_from_value(list_split_enc_mode, m_stCreateEncodeParams.splitEncodeMode));
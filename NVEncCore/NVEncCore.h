@@ -49,12 +49,14 @@
 #include "rgy_osdep.h"
 #include "rgy_tchar.h"
 #include "rgy_status.h"
+#include "rgy_frame_stats.h"
 #include "rgy_log.h"
 #include "rgy_bitstream.h"
 #include "rgy_frame_info.h"
 #include "rgy_hdr10plus.h"
 
 class RGYTimecode;
+class RGYKeyframePlan;
 
 using std::vector;
 
@@ -125,7 +127,7 @@ protected:
     NVENCSTATUS GPUAutoSelect(std::vector<std::unique_ptr<NVGPUInfo>> &gpuList, const InEncodeVideoParam *inputParam);
 
     //デバイスの初期化
-    virtual NVENCSTATUS InitDevice(std::vector<std::unique_ptr<NVGPUInfo>> &gpuList, const InEncodeVideoParam *inputParam);
+    virtual NVENCSTATUS InitDevice(std::vector<std::unique_ptr<NVGPUInfo>> &gpuList, const InEncodeVideoParam *inputParam, bool deviceFixed);
 
     //inputParamからエンコーダに渡すパラメータを設定
     NVENCSTATUS SetInputParam(InEncodeVideoParam *inputParam);
@@ -142,6 +144,18 @@ protected:
     //チャプター読み込み等
     NVENCSTATUS InitChapters(const InEncodeVideoParam *inputParam);
 
+    //--scene-detectの判定を開始
+    NVENCSTATUS InitSceneDetector(const InEncodeVideoParam *inputParam);
+
+    //チャプター/--keyfileによるキーフレームの挿入予定を作成
+    NVENCSTATUS InitKeyframePlan(const InEncodeVideoParam *inputParam);
+
+    //--dynamic-rc-autoの解析を開始
+    NVENCSTATUS InitComplexityAnalyzer(const InEncodeVideoParam *inputParam);
+
+    //解析結果の区間からm_dynamicRCの区間を追加
+    void AddAutoDynamicRC(const int id, const RGYComplexitySegment& seg);
+
     //入出力用バッファを確保
     RGY_ERR AllocateBufferInputHost(const VideoInfo *pInputInfo);
     RGY_ERR AllocateBufferEncoder(const uint32_t uInputWidth, const uint32_t uInputHeight, const NV_ENC_BUFFER_FORMAT inputFormat);
@@ -149,6 +163,9 @@ protected:
 
     NVENCSTATUS NvEncEncodeFrame(EncodeBuffer *pEncodeBuffer, const int id, const int64_t timestamp, const int64_t duration, const int inputFrameId, const std::vector<std::shared_ptr<RGYFrameData>>& frameDataList);
 
+    //リアルタイムモードの劣化段階に応じてエンコーダを再設定
+    NVENCSTATUS ReconfigureRealtime(const RGYRealtimeScheduler& realtimeCtrl);
+
     //エンコーダをフラッシュしてストリームを最後まで取り出す
     NVENCSTATUS FlushEncoder();
 
@@ -179,10 +196,12 @@ protected:
     NV_ENC_INITIALIZE_PARAMS     m_stCreateEncodeParams;  //エンコーダの初期化パラメータ
     std::vector<NVEncRCParam>    m_dynamicRC;             //動的に変更するエンコーダのパラメータ
     int                          m_appliedDynamicRC;      //今適用されているパラメータ(未適用なら-1)
+    unique_ptr<RGYComplexityAnalyzer> m_complexity;       //--dynamic-rc-autoの解析 (m_dynamicRCに区間を追加する)
+    unique_ptr<RGYSceneChangeDetector> m_sceneDetect;     //--scene-detectの判定 (結果はフレームのdataListでフィルタ/エンコーダに渡す)
 
     int                          m_pipelineDepth;
     vector<InputFrameBufInfo>    m_inputHostBuffer;
-    std::unique_ptr<CUFrameBuf>  m_outputFrameHostRaw;
+    std::vector<std::unique_ptr<CUFrameBuf>> m_outputFrameHostRaw; //raw出力時のダウンロード用バッファ (GPU→CPUの転送と書き出しを並列に行う)
 
     sTrimParam                    m_trimParam;
     std::unique_ptr<RGYPoolAVPacket> m_poolPkt;
@@ -197,7 +216,7 @@ protected:
     NV_ENC_CONFIG                 m_stEncConfig;           //エンコード設定
 #if ENABLE_AVSW_READER
     bool                          m_keyOnChapter;        //チャプター上にキーフレームを配置する
-    vector<int>                   m_keyFile;             //キーフレームの指定
+    unique_ptr<RGYKeyframePlan>   m_keyframePlan;        //チャプター/--keyfileによるキーフレームの挿入予定
     vector<unique_ptr<AVChapter>> m_Chapters;            //ファイルから読み込んだチャプター
     bool                          m_hdr10plusMetadataCopy;
 #endif //#if ENABLE_AVSW_READER
@@ -211,9 +230,11 @@ protected:
 
     vector<unique_ptr<NVEncFilter>> m_vpFilters;
     shared_ptr<NVEncFilterParam>    m_pLastFilterParam;
+    shared_ptr<NVEncFilterFrameCache> m_frameCache; //時間方向フィルタで共有するフレームキャッシュ
 #if ENABLE_SSIM
     unique_ptr<NVEncFilterSsim>  m_ssim;
 #endif //#if ENABLE_SSIM
+    unique_ptr<RGYFrameStatsWriter> m_frameStats; //フレームごとの統計情報出力
 
     unique_ptr<RGYListRef<RGYFrameDataQP>> m_qpTable;
 
@@ -224,6 +245,9 @@ protected:
     VideoVUIInfo                 m_encVUI;                //出力のVUI情報
 
     int                          m_nProcSpeedLimit;       //処理速度制限 (0で制限なし)
+    RGYParamRealtime             m_realtime;              //リアルタイムモード
+    std::unique_ptr<NV_ENC_CONFIG> m_realtimeBaseConfig;  //リアルタイムモードで変更する前のエンコード設定
+    GUID                         m_realtimeBasePreset;    //リアルタイムモードで変更する前のプリセット
     RGYAVSync                    m_nAVSyncMode;           //映像音声同期設定
     bool                         m_timestampPassThrough;  //timestampをそのまま転送する
     rgy_rational<int>            m_inputFps;              //入力フレームレート
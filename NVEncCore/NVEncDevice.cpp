@@ -27,6 +27,7 @@
 // ------------------------------------------------------------------------------------------
 
 #include "rgy_osdep.h"
+#include <filesystem>
 
 #include "cpu_info.h"
 #include "gpu_info.h"
@@ -34,6 +35,7 @@
 #include "rgy_log.h"
 #include "rgy_util.h"
 #include "rgy_env.h"
+#include "rgy_filesystem.h"
 #include "NVEncDevice.h"
 #include "NVEncUtil.h"
 #include "rgy_perf_monitor.h"
@@ -462,6 +464,20 @@ NVENCSTATUS NVEncoder::NvEncReconfigureEncoder(NV_ENC_RECONFIGURE_PARAMS *reconf
     return nvStatus;
 }
 
+NVENCSTATUS NVEncoder::NvEncGetEncodePresetConfig(const GUID& codec, const GUID& preset, NV_ENC_TUNING_INFO tuningInfo, NV_ENC_PRESET_CONFIG *presetConfig) {
+    INIT_STRUCT(*presetConfig);
+    setStructVer(presetConfig->presetCfg);
+    //API v10以降はtuningInfoを指定するEx版を使用する
+    NVENCSTATUS nvStatus = (checkAPIver(10, 0))
+        ? m_pEncodeAPI->nvEncGetEncodePresetConfigEx(m_hEncoder, codec, preset, tuningInfo, presetConfig)
+        : m_pEncodeAPI->nvEncGetEncodePresetConfig(m_hEncoder, codec, preset, presetConfig);
+    if (nvStatus != NV_ENC_SUCCESS) {
+        NVPrintFuncError(_T("nvEncGetEncodePresetConfig"), nvStatus);
+        return nvStatus;
+    }
+    return nvStatus;
+}
+
 NVENCSTATUS NVEncoder::NvEncEncodePicture(NV_ENC_PIC_PARAMS *picParams) {
     NVENCSTATUS nvStatus = m_pEncodeAPI->nvEncEncodePicture(m_hEncoder, picParams);
     if (nvStatus != NV_ENC_SUCCESS && nvStatus != NV_ENC_ERR_NEED_MORE_INPUT) {
@@ -858,83 +874,109 @@ NVENCSTATUS NVEncoder::setInputFormatList(NVEncCodecFeature& codecFeature) {
     return nvStatus;
 }
 
+//取得するfeatureの一覧
+//キャッシュから読み込む場合も、名前と説明はここから復元する
+struct NVEncCapInfo {
+    NV_ENC_CAPS id;
+    uint32_t apiVerMin;          //必要なAPIバージョン (0なら制限なし)
+    bool forH264Only;
+    bool isBool;
+    const TCHAR *name;
+    const CX_DESC *desc;
+    const CX_DESC *descBitFlag;
+    bool descLevel;              //descとしてコーデックごとのレベルのリストを使用する
+};
+
+static const NVEncCapInfo NVENC_CAP_LIST[] = {
+    { NV_ENC_CAPS_NUM_ENCODER_ENGINES,          nvenc_api_ver(10, 0), false, false, _T("Encoder Engines"),           nullptr, nullptr, false },
+    { NV_ENC_CAPS_NUM_MAX_BFRAMES,              0,                    false, false, _T("Max Bframes"),               nullptr, nullptr, false },
+    { NV_ENC_CAPS_SUPPORT_BFRAME_REF_MODE,      0,                    false, false, _T("B Ref Mode"),                list_nvenc_caps_bref_mode, nullptr, false },
+    { NV_ENC_CAPS_SUPPORTED_RATECONTROL_MODES,  0,                    false, false, _T("RC Modes"),                  nullptr, list_nvenc_rc_method_en, false },
+    { NV_ENC_CAPS_SUPPORT_FIELD_ENCODING,       0,                    false, false, _T("Field Encoding"),            list_nvenc_caps_field_encoding, nullptr, false },
+    { NV_ENC_CAPS_SUPPORT_MONOCHROME,           0,                    false, true,  _T("MonoChrome"),                nullptr, nullptr, false },
+    { NV_ENC_CAPS_SUPPORT_FMO,                  0,                    true,  true,  _T("FMO"),                       nullptr, nullptr, false },
+    { NV_ENC_CAPS_SUPPORT_QPELMV,               0,                    false, true,  _T("Quater-Pel MV"),             nullptr, nullptr, false },
+    { NV_ENC_CAPS_SUPPORT_BDIRECT_MODE,         0,                    false, true,  _T("B Direct Mode"),             nullptr, nullptr, false },
+    { NV_ENC_CAPS_SUPPORT_CABAC,                0,                    true,  true,  _T("CABAC"),                     nullptr, nullptr, false },
+    { NV_ENC_CAPS_SUPPORT_ADAPTIVE_TRANSFORM,   0,                    true,  true,  _T("Adaptive Transform"),        nullptr, nullptr, false },
+    { NV_ENC_CAPS_NUM_MAX_TEMPORAL_LAYERS,      0,                    false, false, _T("Max Temporal Layers"),       nullptr, nullptr, false },
+    { NV_ENC_CAPS_SUPPORT_HIERARCHICAL_PFRAMES, 0,                    false, true,  _T("Hierarchial P Frames"),      nullptr, nullptr, false },
+    { NV_ENC_CAPS_SUPPORT_HIERARCHICAL_BFRAMES, 0,                    false, true,  _T("Hierarchial B Frames"),      nullptr, nullptr, false },
+    { NV_ENC_CAPS_LEVEL_MAX,                    0,                    false, false, _T("Max Level"),                 nullptr, nullptr, true },
+    { NV_ENC_CAPS_LEVEL_MIN,                    0,                    false, false, _T("Min Level"),                 nullptr, nullptr, true },
+    { NV_ENC_CAPS_SUPPORT_YUV444_ENCODE,        0,                    false, true,  _T("4:4:4"),                     nullptr, nullptr, false },
+    { NV_ENC_CAPS_WIDTH_MIN,                    0,                    false, false, _T("Min Width"),                 nullptr, nullptr, false },
+    { NV_ENC_CAPS_WIDTH_MAX,                    0,                    false, false, _T("Max Width"),                 nullptr, nullptr, false },
+    { NV_ENC_CAPS_HEIGHT_MIN,                   0,                    false, false, _T("Min Height"),                nullptr, nullptr, false },
+    { NV_ENC_CAPS_HEIGHT_MAX,                   0,                    false, false, _T("Max Height"),                nullptr, nullptr, false },
+    { NV_ENC_CAPS_SUPPORT_MULTIPLE_REF_FRAMES,  0,                    false, true,  _T("Multiple Refs"),             nullptr, nullptr, false },
+    { NV_ENC_CAPS_NUM_MAX_LTR_FRAMES,           0,                    false, false, _T("Max LTR Frames"),            nullptr, nullptr, false },
+    { NV_ENC_CAPS_SUPPORT_DYN_RES_CHANGE,       0,                    false, true,  _T("Dynamic Resolution Change"), nullptr, nullptr, false },
+    { NV_ENC_CAPS_SUPPORT_DYN_BITRATE_CHANGE,   0,                    false, true,  _T("Dynamic Bitrate Change"),    nullptr, nullptr, false },
+    { NV_ENC_CAPS_SUPPORT_DYN_FORCE_CONSTQP,    0,                    false, true,  _T("Forced constant QP"),        nullptr, nullptr, false },
+    { NV_ENC_CAPS_SUPPORT_DYN_RCMODE_CHANGE,    0,                    false, true,  _T("Dynamic RC Mode Change"),    nullptr, nullptr, false },
+    { NV_ENC_CAPS_SUPPORT_SUBFRAME_READBACK,    0,                    false, true,  _T("Subframe Readback"),         nullptr, nullptr, false },
+    { NV_ENC_CAPS_SUPPORT_CONSTRAINED_ENCODING, 0,                    false, true,  _T("Constrained Encoding"),      nullptr, nullptr, false },
+    { NV_ENC_CAPS_SUPPORT_INTRA_REFRESH,        0,                    false, true,  _T("Intra Refresh"),             nullptr, nullptr, false },
+    { NV_ENC_CAPS_SUPPORT_CUSTOM_VBV_BUF_SIZE,  0,                    false, true,  _T("Custom VBV Bufsize"),        nullptr, nullptr, false },
+    { NV_ENC_CAPS_SUPPORT_DYNAMIC_SLICE_MODE,   0,                    false, true,  _T("Dynamic Slice Mode"),        nullptr, nullptr, false },
+    { NV_ENC_CAPS_SUPPORT_REF_PIC_INVALIDATION, 0,                    false, true,  _T("Ref Pic Invalidiation"),     nullptr, nullptr, false },
+    { NV_ENC_CAPS_PREPROC_SUPPORT,              0,                    false, true,  _T("PreProcess"),                nullptr, nullptr, false },
+    { NV_ENC_CAPS_ASYNC_ENCODE_SUPPORT,         0,                    false, true,  _T("Async Encoding"),            nullptr, nullptr, false },
+    { NV_ENC_CAPS_MB_NUM_MAX,                   0,                    false, false, _T("Max MBs"),                   nullptr, nullptr, false },
+    //{ NV_ENC_CAPS_MB_PER_SEC_MAX,               0,                    false, false, _T("MAX MB per sec"),            nullptr, nullptr, false },
+    { NV_ENC_CAPS_SUPPORT_LOSSLESS_ENCODE,      0,                    false, true,  _T("Lossless"),                  nullptr, nullptr, false },
+    { NV_ENC_CAPS_SUPPORT_SAO,                  0,                    false, true,  _T("SAO"),                       nullptr, nullptr, false },
+    { NV_ENC_CAPS_SUPPORT_MEONLY_MODE,          0,                    false, false, _T("Me Only Mode"),              list_nvenc_caps_me_only, nullptr, false },
+    { NV_ENC_CAPS_SUPPORT_LOOKAHEAD,            0,                    false, true,  _T("Lookahead"),                 nullptr, nullptr, false },
+    { NV_ENC_CAPS_SUPPORT_TEMPORAL_AQ,          0,                    false, true,  _T("AQ (temporal)"),             nullptr, nullptr, false },
+    { NV_ENC_CAPS_SUPPORT_WEIGHTED_PREDICTION,  0,                    false, true,  _T("Weighted Prediction"),       nullptr, nullptr, false },
+    { NV_ENC_CAPS_SUPPORT_TEMPORAL_FILTER,      nvenc_api_ver(12, 2), false, true,  _T("Temporal Filter"),           nullptr, nullptr, false },
+    { NV_ENC_CAPS_SUPPORT_LOOKAHEAD_LEVEL,      nvenc_api_ver(12, 2), false, true,  _T("Lookahead Level"),           nullptr, nullptr, false },
+    { NV_ENC_CAPS_SUPPORT_UNIDIRECTIONAL_B,     nvenc_api_ver(12, 2), false, true,  _T("Undirectional B"),           nullptr, nullptr, false },
+    { NV_ENC_CAPS_SUPPORT_10BIT_ENCODE,         0,                    false, true,  _T("10bit depth"),               nullptr, nullptr, false },
+};
+
+static NVEncCap nvenc_cap_from_info(const NVEncCapInfo& info, const RGY_CODEC codec, const int value) {
+    NVEncCap cap = { 0 };
+    cap.id = info.id;
+    cap.isBool = info.isBool;
+    cap.name = info.name;
+    cap.value = value;
+    cap.desc = (info.descLevel) ? get_level_list(codec) : info.desc;
+    cap.desc_bit_flag = info.descBitFlag;
+    return cap;
+}
+
+static const NVEncCapInfo *nvenc_cap_info(const int id) {
+    for (const auto& info : NVENC_CAP_LIST) {
+        if (info.id == id) {
+            return &info;
+        }
+    }
+    return nullptr;
+}
+
 NVENCSTATUS NVEncoder::GetCurrentDeviceNVEncCapability(NVEncCodecFeature& codecFeature) {
     NVENCSTATUS nvStatus = NV_ENC_SUCCESS;
     const auto codec = codec_guid_enc_to_rgy(codecFeature.codec);
-    bool check_h264 = codec == RGY_CODEC_H264;
-    auto add_cap_info = [&](NV_ENC_CAPS cap_id, bool for_h264_only, bool is_boolean, const TCHAR *cap_name, const CX_DESC *desc = nullptr, const CX_DESC* desc_bitflag = nullptr) {
-        if (!(!check_h264 && for_h264_only)) {
-            NV_ENC_CAPS_PARAM param;
-            INIT_STRUCT(param);
-            param.capsToQuery = cap_id;
-            int value = 0;
-            NVENCSTATUS result = m_pEncodeAPI->nvEncGetEncodeCaps(m_hEncoder, codecFeature.codec, &param, &value);
-            if (NV_ENC_SUCCESS == result) {
-                NVEncCap cap = { 0 };
-                cap.id = cap_id;
-                cap.isBool = is_boolean;
-                cap.name = cap_name;
-                cap.value = value;
-                cap.desc = desc;
-                cap.desc_bit_flag = desc_bitflag;
-                codecFeature.caps.push_back(cap);
-            } else {
-                nvStatus = result;
-            }
+    const bool check_h264 = codec == RGY_CODEC_H264;
+    for (const auto& info : NVENC_CAP_LIST) {
+        if ((!check_h264 && info.forH264Only)
+            || (info.apiVerMin > 0 && !nvenc_api_ver_check(m_apiVer, info.apiVerMin))) {
+            continue;
+        }
+        NV_ENC_CAPS_PARAM param;
+        INIT_STRUCT(param);
+        param.capsToQuery = info.id;
+        int value = 0;
+        NVENCSTATUS result = m_pEncodeAPI->nvEncGetEncodeCaps(m_hEncoder, codecFeature.codec, &param, &value);
+        if (NV_ENC_SUCCESS == result) {
+            codecFeature.caps.push_back(nvenc_cap_from_info(info, codec, value));
+        } else {
+            nvStatus = result;
         }
-    };
-
-    if (nvenc_api_ver_check(m_apiVer, nvenc_api_ver(10,0))) {
-        add_cap_info(NV_ENC_CAPS_NUM_ENCODER_ENGINES, false, false, _T("Encoder Engines"));
-    }
-    add_cap_info(NV_ENC_CAPS_NUM_MAX_BFRAMES,              false, false, _T("Max Bframes"));
-    add_cap_info(NV_ENC_CAPS_SUPPORT_BFRAME_REF_MODE,      false, false, _T("B Ref Mode"), list_nvenc_caps_bref_mode);
-    add_cap_info(NV_ENC_CAPS_SUPPORTED_RATECONTROL_MODES,  false, false, _T("RC Modes"), nullptr, list_nvenc_rc_method_en);
-    add_cap_info(NV_ENC_CAPS_SUPPORT_FIELD_ENCODING,       false, false, _T("Field Encoding"), list_nvenc_caps_field_encoding);
-    add_cap_info(NV_ENC_CAPS_SUPPORT_MONOCHROME,           false, true,  _T("MonoChrome"));
-    add_cap_info(NV_ENC_CAPS_SUPPORT_FMO,                  true,  true,  _T("FMO"));
-    add_cap_info(NV_ENC_CAPS_SUPPORT_QPELMV,               false, true,  _T("Quater-Pel MV"));
-    add_cap_info(NV_ENC_CAPS_SUPPORT_BDIRECT_MODE,         false, true,  _T("B Direct Mode"));
-    add_cap_info(NV_ENC_CAPS_SUPPORT_CABAC,                true,  true,  _T("CABAC"));
-    add_cap_info(NV_ENC_CAPS_SUPPORT_ADAPTIVE_TRANSFORM,   true,  true,  _T("Adaptive Transform"));
-    add_cap_info(NV_ENC_CAPS_NUM_MAX_TEMPORAL_LAYERS,      false, false, _T("Max Temporal Layers"));
-    add_cap_info(NV_ENC_CAPS_SUPPORT_HIERARCHICAL_PFRAMES, false, true,  _T("Hierarchial P Frames"));
-    add_cap_info(NV_ENC_CAPS_SUPPORT_HIERARCHICAL_BFRAMES, false, true,  _T("Hierarchial B Frames"));
-    add_cap_info(NV_ENC_CAPS_LEVEL_MAX,                    false, false, _T("Max Level"), get_level_list(codec));
-    add_cap_info(NV_ENC_CAPS_LEVEL_MIN,                    false, false, _T("Min Level"), get_level_list(codec));
-    add_cap_info(NV_ENC_CAPS_SUPPORT_YUV444_ENCODE,        false, true,  _T("4:4:4"));
-    add_cap_info(NV_ENC_CAPS_WIDTH_MIN,                    false, false, _T("Min Width"));
-    add_cap_info(NV_ENC_CAPS_WIDTH_MAX,                    false, false, _T("Max Width"));
-    add_cap_info(NV_ENC_CAPS_HEIGHT_MIN,                   false, false, _T("Min Height"));
-    add_cap_info(NV_ENC_CAPS_HEIGHT_MAX,                   false, false, _T("Max Height"));
-    add_cap_info(NV_ENC_CAPS_SUPPORT_MULTIPLE_REF_FRAMES,  false, true,  _T("Multiple Refs"));
-    add_cap_info(NV_ENC_CAPS_NUM_MAX_LTR_FRAMES,           false, false, _T("Max LTR Frames"));
-    add_cap_info(NV_ENC_CAPS_SUPPORT_DYN_RES_CHANGE,       false, true,  _T("Dynamic Resolution Change"));
-    add_cap_info(NV_ENC_CAPS_SUPPORT_DYN_BITRATE_CHANGE,   false, true,  _T("Dynamic Bitrate Change"));
-    add_cap_info(NV_ENC_CAPS_SUPPORT_DYN_FORCE_CONSTQP,    false, true,  _T("Forced constant QP"));
-    add_cap_info(NV_ENC_CAPS_SUPPORT_DYN_RCMODE_CHANGE,    false, true,  _T("Dynamic RC Mode Change"));
-    add_cap_info(NV_ENC_CAPS_SUPPORT_SUBFRAME_READBACK,    false, true,  _T("Subframe Readback"));
-    add_cap_info(NV_ENC_CAPS_SUPPORT_CONSTRAINED_ENCODING, false, true,  _T("Constrained Encoding"));
-    add_cap_info(NV_ENC_CAPS_SUPPORT_INTRA_REFRESH,        false, true,  _T("Intra Refresh"));
-    add_cap_info(NV_ENC_CAPS_SUPPORT_CUSTOM_VBV_BUF_SIZE,  false, true,  _T("Custom VBV Bufsize"));
-    add_cap_info(NV_ENC_CAPS_SUPPORT_DYNAMIC_SLICE_MODE,   false, true,  _T("Dynamic Slice Mode"));
-    add_cap_info(NV_ENC_CAPS_SUPPORT_REF_PIC_INVALIDATION, false, true,  _T("Ref Pic Invalidiation"));
-    add_cap_info(NV_ENC_CAPS_PREPROC_SUPPORT,              false, true,  _T("PreProcess"));
-    add_cap_info(NV_ENC_CAPS_ASYNC_ENCODE_SUPPORT,         false, true,  _T("Async Encoding"));
-    add_cap_info(NV_ENC_CAPS_MB_NUM_MAX,                   false, false, _T("Max MBs"));
-    //add_cap_info(NV_ENC_CAPS_MB_PER_SEC_MAX,               false, false, _T("MAX MB per sec"));
-    add_cap_info(NV_ENC_CAPS_SUPPORT_LOSSLESS_ENCODE,      false, true,  _T("Lossless"));
-    add_cap_info(NV_ENC_CAPS_SUPPORT_SAO,                  false, true,  _T("SAO"));
-    add_cap_info(NV_ENC_CAPS_SUPPORT_MEONLY_MODE,          false, false, _T("Me Only Mode"), list_nvenc_caps_me_only);
-    add_cap_info(NV_ENC_CAPS_SUPPORT_LOOKAHEAD,            false, true,  _T("Lookahead"));
-    add_cap_info(NV_ENC_CAPS_SUPPORT_TEMPORAL_AQ,          false, true,  _T("AQ (temporal)"));
-    add_cap_info(NV_ENC_CAPS_SUPPORT_WEIGHTED_PREDICTION,  false, true,  _T("Weighted Prediction"));
-    if (nvenc_api_ver_check(m_apiVer, nvenc_api_ver(12, 2))) {
-        add_cap_info(NV_ENC_CAPS_SUPPORT_TEMPORAL_FILTER,  false, true, _T("Temporal Filter"));
-        add_cap_info(NV_ENC_CAPS_SUPPORT_LOOKAHEAD_LEVEL,  false, true, _T("Lookahead Level"));
-        add_cap_info(NV_ENC_CAPS_SUPPORT_UNIDIRECTIONAL_B, false, true, _T("Undirectional B"));
     }
-    add_cap_info(NV_ENC_CAPS_SUPPORT_10BIT_ENCODE,         false, true,  _T("10bit depth"));
     return nvStatus;
 }
 
@@ -992,10 +1034,27 @@ RGY_ERR NVGPUInfo::initDevice(int deviceID, CUctx_flags ctxFlags, bool error_if_
             val = 0; \
         } \
     }
+    auto& pool = NVEncDevicePool::instance();
+    if (pool.enabled()) {
+        auto err = pool.acquire(this, deviceID, ctxFlags);
+        if (err != RGY_ERR_NOT_FOUND) {
+            writeLog((err == RGY_ERR_NONE) ? RGY_LOG_DEBUG : ((error_if_fail) ? RGY_LOG_ERROR : RGY_LOG_DEBUG),
+                _T("device #%d from pool: %s.\n"), deviceID, get_err_mes(err));
+            return err;
+        }
+    }
     char pci_bus_name[64] = { 0 };
     char dev_name[256] = { 0 };
     CUdevice cuDevice = 0;
     const auto error_level = (error_if_fail) ? RGY_LOG_ERROR : RGY_LOG_DEBUG;
+    //起動時間の内訳をデバッグログに出力する
+    auto timeLap = std::chrono::steady_clock::now();
+    auto elapsedMs = [&timeLap]() {
+        const auto now = std::chrono::steady_clock::now();
+        const double ms = std::chrono::duration_cast<std::chrono::microseconds>(now - timeLap).count() * 1e-3;
+        timeLap = now;
+        return ms;
+    };
     writeLog(RGY_LOG_DEBUG, _T("checking for device #%d.\n"), deviceID);
     auto cuResult = cuDeviceGet(&cuDevice, deviceID);
     if (cuResult != CUDA_SUCCESS) {
@@ -1043,8 +1102,16 @@ RGY_ERR NVGPUInfo::initDevice(int deviceID, CUctx_flags ctxFlags, bool error_if_
     m_nv_driver_version = std::numeric_limits<int>::max();
     m_pcie_gen = 0;
     m_pcie_link = 0;
+    writeLog(RGY_LOG_DEBUG, _T("  time: cuda device info %.1f ms.\n"), elapsedMs());
+
+    //キャッシュがあれば、NVML・HWデコード・エンコード機能の取得を省略する
+    auto& cache = NVEncDeviceCache::instance();
+    NVEncDeviceCacheKey cacheKey;
+    const bool cacheAvail = cache.enabled() && cache.makeKey(cacheKey, cuDevice, skipHWDecodeCheck, disableNVML);
+    const bool cacheHit = cacheAvail && cache.load(this, cacheKey);
+    writeLog(RGY_LOG_DEBUG, _T("  device cache: %s (%.1f ms).\n"), (cacheHit) ? _T("hit") : ((cacheAvail) ? _T("miss") : _T("unavailable")), elapsedMs());
 #if ENABLE_NVML
-    if (m_pciBusId.length() > 0) {
+    if (!cacheHit && m_pciBusId.length() > 0) {
         int version = 0, pcie_gen = 0, pcie_link = 0;
         NVMLMonitor nvml_monitor;
         if (NVML_SUCCESS == nvml_monitor.Init(m_pciBusId)
@@ -1055,6 +1122,7 @@ RGY_ERR NVGPUInfo::initDevice(int deviceID, CUctx_flags ctxFlags, bool error_if_
             m_pcie_link = pcie_link;
             writeLog(RGY_LOG_DEBUG, _T("  Got GPU Info from NVML.\n"));
         }
+        writeLog(RGY_LOG_DEBUG, _T("  time: nvml %.1f ms.\n"), elapsedMs());
     }
 #endif //#if ENABLE_NVML
     if (m_nv_driver_version != std::numeric_limits<int>::max()) {
@@ -1073,13 +1141,63 @@ RGY_ERR NVGPUInfo::initDevice(int deviceID, CUctx_flags ctxFlags, bool error_if_
     }
     writeLog(RGY_LOG_DEBUG, _T("  CUDA Driver version: %d.\n"), m_cuda_driver_version);
 
+    if (cacheHit && !pool.enabled()) {
+        //Contextは実際に使用するGPUでのみ、initContext()で作成する
+        m_ctxFlags = ctxFlags;
+        writeLog(RGY_LOG_DEBUG, _T("  device info loaded from cache, context creation deferred.\n"));
+        return RGY_ERR_NONE;
+    }
+
+    if (auto err = createContext(ctxFlags); err != RGY_ERR_NONE) {
+        return err;
+    }
+    writeLog(RGY_LOG_DEBUG, _T("  time: create context %.1f ms.\n"), elapsedMs());
+    if (cacheHit) {
+        pool.add(this);
+        return RGY_ERR_NONE;
+    }
+    {
+        NVEncCtxAutoLock(ctxlock(m_vidCtxLock.get()));
+        m_cuvid_csp = getHWDecCodecCsp(skipHWDecodeCheck);
+    }
+    writeLog(RGY_LOG_DEBUG, _T("  time: hw decode caps %.1f ms.\n"), elapsedMs());
+
+    // DeviceFeature取得のため、一時的なencoder sessionを作成する
+    // session数の上限に達するのを防ぐため、featureを取得したらすぐに破棄する
+    auto encoder = std::make_unique<NVEncoder>(m_cuCtx.get(), m_log);
+    auto nvsts = encoder->InitSession();
+    if (nvsts != NV_ENC_SUCCESS) {
+        writeLog(RGY_LOG_ERROR, _T("Failed to init encoder session for getting features.\n"));
+        return RGY_ERR_UNSUPPORTED;
+    }
+    nvsts = encoder->createDeviceFeatureList();
+    if (nvsts != NV_ENC_SUCCESS) {
+        writeLog(RGY_LOG_ERROR, _T("Failed to create device codec list.\n"));
+        return RGY_ERR_UNSUPPORTED;
+    }
+    writeLog(RGY_LOG_DEBUG, _T("  createDeviceFeatureList\n"));
+    m_nvenc_codec_features = encoder->GetNVEncCapability();
+    encoder.reset();
+    writeLog(RGY_LOG_DEBUG, _T("  time: encoder features %.1f ms.\n"), elapsedMs());
+    if (cacheAvail) {
+        cache.store(this, cacheKey);
+    }
+    if (pool.enabled()) {
+        pool.add(this);
+    }
+    return RGY_ERR_NONE;
+}
+
+RGY_ERR NVGPUInfo::createContext(CUctx_flags ctxFlags) {
+    CUresult cuResult = CUDA_SUCCESS;
     writeLog(RGY_LOG_DEBUG, _T("using cuda schedule mode: %s.\n"), get_chr_from_value(list_cuda_schedule, ctxFlags));
     CUcontext cuCtxCreated;
-    if (CUDA_SUCCESS != (cuResult = cuCtxCreate(&cuCtxCreated, ctxFlags, cuDevice))) {
+    m_ctxFlags = ctxFlags;
+    if (CUDA_SUCCESS != (cuResult = cuCtxCreate(&cuCtxCreated, ctxFlags, m_cudevice))) {
         if (ctxFlags != 0) {
             writeLog(RGY_LOG_WARN, _T("cuCtxCreate error:0x%x (%s)\n"), cuResult, char_to_tstring(_cudaGetErrorEnum(cuResult)).c_str());
             writeLog(RGY_LOG_WARN, _T("retry cuCtxCreate with auto scheduling mode.\n"));
-            if (CUDA_SUCCESS != (cuResult = cuCtxCreate(&cuCtxCreated, 0, cuDevice))) {
+            if (CUDA_SUCCESS != (cuResult = cuCtxCreate(&cuCtxCreated, 0, m_cudevice))) {
                 writeLog(RGY_LOG_ERROR, _T("cuCtxCreate error:0x%x (%s)\n"), cuResult, char_to_tstring(_cudaGetErrorEnum(cuResult)).c_str());
                 return RGY_ERR_DEVICE_NOT_FOUND;
             }
@@ -1105,30 +1223,563 @@ RGY_ERR NVGPUInfo::initDevice(int deviceID, CUctx_flags ctxFlags, bool error_if_
     }
     writeLog(RGY_LOG_DEBUG, _T("cuvidCtxLockCreate: Success.\n"));
     m_vidCtxLock = std::unique_ptr<std::remove_pointer<CUvideoctxlock>::type, decltype(cuvidCtxLockDestroy)>(vidCtxLockTmp, cuvidCtxLockDestroy);
+    return RGY_ERR_NONE;
+}
+
+NVEncDevicePool& NVEncDevicePool::instance() {
+    static NVEncDevicePool pool;
+    return pool;
+}
+
+NVEncDevicePool::NVEncDevicePool() :
+    m_mtx(),
+    m_cv(),
+    m_enabled(false),
+    m_maxSessions(0),
+    m_devices() {
+}
+
+NVEncDevicePool::~NVEncDevicePool() {
+    //プロセス終了時にはCUDAのランタイムがすでに破棄されている可能性があるので、ここではContextを破棄しない
+    //明示的にclear()を呼ぶこと
+}
+
+void NVEncDevicePool::enable(int maxSessionsPerDevice) {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    m_enabled = true;
+    m_maxSessions = std::max(maxSessionsPerDevice, 1);
+}
+
+void NVEncDevicePool::destroyContext(const IdleContext& ctx) {
+    if (ctx.vidCtxLock) {
+        cuvidCtxLockDestroy(ctx.vidCtxLock);
+    }
+    if (ctx.ctx) {
+        cuCtxDestroy(ctx.ctx);
+    }
+}
+
+RGY_ERR NVEncDevicePool::acquire(NVGPUInfo *gpu, int deviceID, CUctx_flags ctxFlags) {
+    IdleContext idle = { nullptr, nullptr, CU_CTX_SCHED_AUTO };
     {
-        NVEncCtxAutoLock(ctxlock(m_vidCtxLock.get()));
-        m_cuvid_csp = getHWDecCodecCsp(skipHWDecodeCheck);
+        std::lock_guard<std::mutex> lock(m_mtx);
+        auto it = m_devices.find(deviceID);
+        if (it == m_devices.end()) {
+            return RGY_ERR_NOT_FOUND;
+        }
+        auto& entry = it->second;
+        if (entry.active >= m_maxSessions) {
+            return RGY_ERR_DEVICE_NOT_AVAILABLE;
+        }
+        entry.active++;
+        gpu->copyDeviceInfo(*entry.info);
+        auto ctx = std::find_if(entry.idle.begin(), entry.idle.end(), [ctxFlags](const IdleContext& c) { return c.ctxFlags == ctxFlags; });
+        if (ctx != entry.idle.end()) {
+            idle = *ctx;
+            entry.idle.erase(ctx);
+        }
+    }
+    gpu->m_pooled = true;
+    if (idle.ctx) {
+        gpu->m_cuCtx = unique_cuCtx(idle.ctx, cuCtxDestroy);
+        gpu->m_vidCtxLock = unique_vidCtxLock(idle.vidCtxLock, cuvidCtxLockDestroy);
+        gpu->m_ctxFlags = idle.ctxFlags;
+        return RGY_ERR_NONE;
+    }
+    //同じモードの空きContextがなければ新たに作成する (デバイス情報の取得は省略できる)
+    auto err = gpu->createContext(ctxFlags);
+    if (err != RGY_ERR_NONE) {
+        gpu->m_pooled = false;
+        std::lock_guard<std::mutex> lock(m_mtx);
+        auto& entry = m_devices[deviceID];
+        entry.active = std::max(entry.active - 1, 0);
+        m_cv.notify_all();
+    }
+    return err;
+}
+
+void NVEncDevicePool::add(NVGPUInfo *gpu) {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    auto& entry = m_devices[gpu->id()];
+    if (!entry.info) {
+        entry.info = std::make_unique<NVGPUInfo>(nullptr);
+        entry.info->copyDeviceInfo(*gpu);
+    }
+    entry.active++;
+    gpu->m_pooled = true;
+}
+
+void NVEncDevicePool::release(NVGPUInfo *gpu) {
+    IdleContext idle = { gpu->m_cuCtx.release(), gpu->m_vidCtxLock.release(), gpu->m_ctxFlags };
+    gpu->m_pooled = false;
+    if (idle.ctx) {
+        //次のジョブに処理が残らないよう、同期してから戻す
+        if (cuCtxPushCurrent(idle.ctx) == CUDA_SUCCESS) {
+            cuCtxSynchronize();
+            CUcontext cuCtxTemp;
+            cuCtxPopCurrent(&cuCtxTemp);
+        }
+    }
+    std::lock_guard<std::mutex> lock(m_mtx);
+    auto it = m_devices.find(gpu->id());
+    if (it == m_devices.end() || !m_enabled) {
+        destroyContext(idle);
+        return;
     }
+    it->second.active = std::max(it->second.active - 1, 0);
+    if (idle.ctx) {
+        it->second.idle.push_back(idle);
+    }
+    m_cv.notify_all();
+}
 
-    // DeviceFeature取得のため、一時的なencoder sessionを作成する
-    // session数の上限に達するのを防ぐため、featureを取得したらすぐに破棄する
-    auto encoder = std::make_unique<NVEncoder>(cuCtxCreated, m_log);
-    auto nvsts = encoder->InitSession();
-    if (nvsts != NV_ENC_SUCCESS) {
-        writeLog(RGY_LOG_ERROR, _T("Failed to init encoder session for getting features.\n"));
-        return RGY_ERR_UNSUPPORTED;
+bool NVEncDevicePool::waitForRelease(int timeoutMs) {
+    std::unique_lock<std::mutex> lock(m_mtx);
+    return m_cv.wait_for(lock, std::chrono::milliseconds(timeoutMs)) == std::cv_status::no_timeout;
+}
+
+void NVEncDevicePool::clear() {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    for (auto& [id, entry] : m_devices) {
+        for (auto& ctx : entry.idle) {
+            destroyContext(ctx);
+        }
+        entry.idle.clear();
     }
-    nvsts = encoder->createDeviceFeatureList();
-    if (nvsts != NV_ENC_SUCCESS) {
-        writeLog(RGY_LOG_ERROR, _T("Failed to create device codec list.\n"));
-        return RGY_ERR_UNSUPPORTED;
+    m_devices.clear();
+    m_enabled = false;
+    m_cv.notify_all();
+}
+
+bool NVEncDeviceCacheKey::operator==(const NVEncDeviceCacheKey& x) const {
+    return memcmp(uuid, x.uuid, sizeof(uuid)) == 0
+        && cudaDriverVersion == x.cudaDriverVersion
+        && apiVersion == x.apiVersion
+        && driverFileSize == x.driverFileSize
+        && driverFileTime == x.driverFileTime
+        && flags == x.flags
+        && buildHash == x.buildHash;
+}
+
+static uint32_t nvenc_device_cache_checksum(const uint8_t *data, const size_t size, uint32_t hash = 2166136261u /* FNV-1a */) {
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ data[i]) * 16777619u;
     }
-    writeLog(RGY_LOG_DEBUG, _T("  createDeviceFeatureList\n"));
-    m_nvenc_codec_features = encoder->GetNVEncCapability();
+    return hash;
+}
+
+//NVEncのバージョンや取得するエンコード機能が変わったら、キャッシュを使用しない
+static uint32_t nvenc_device_cache_build_hash() {
+    static const char version[] = VER_STR_FILEVERSION;
+    uint32_t hash = nvenc_device_cache_checksum((const uint8_t *)version, strlen(version));
+    for (const auto& info : NVENC_CAP_LIST) {
+        const uint32_t data[3] = { (uint32_t)info.id, info.apiVerMin, (uint32_t)info.forH264Only };
+        hash = nvenc_device_cache_checksum((const uint8_t *)data, sizeof(data), hash);
+    }
+    return hash;
+}
+
+class NVEncDeviceCacheWriter {
+public:
+    NVEncDeviceCacheWriter(std::vector<uint8_t>& buf) : m_buf(buf) {};
+    template<typename T>
+    void put(const T& value) {
+        const auto ptr = (const uint8_t *)&value;
+        m_buf.insert(m_buf.end(), ptr, ptr + sizeof(T));
+    }
+    template<typename T>
+    void putArray(const std::vector<T>& values) {
+        put((uint32_t)values.size());
+        if (values.size() > 0) {
+            const auto ptr = (const uint8_t *)values.data();
+            m_buf.insert(m_buf.end(), ptr, ptr + sizeof(T) * values.size());
+        }
+    }
+protected:
+    std::vector<uint8_t>& m_buf;
+};
+
+class NVEncDeviceCacheReader {
+public:
+    NVEncDeviceCacheReader(const uint8_t *data, const size_t size) : m_ptr(data), m_fin(data + size) {};
+    template<typename T>
+    bool get(T& value) {
+        if ((size_t)(m_fin - m_ptr) < sizeof(T)) {
+            return false;
+        }
+        memcpy(&value, m_ptr, sizeof(T));
+        m_ptr += sizeof(T);
+        return true;
+    }
+    template<typename T>
+    bool getArray(std::vector<T>& values) {
+        uint32_t count = 0;
+        if (!get(count) || count > (size_t)(m_fin - m_ptr) / sizeof(T)) {
+            return false;
+        }
+        values.resize(count);
+        if (count > 0) {
+            memcpy(values.data(), m_ptr, sizeof(T) * count);
+            m_ptr += sizeof(T) * count;
+        }
+        return true;
+    }
+    bool getBytes(std::vector<uint8_t>& data, const size_t size) {
+        if ((size_t)(m_fin - m_ptr) < size) {
+            return false;
+        }
+        data.assign(m_ptr, m_ptr + size);
+        m_ptr += size;
+        return true;
+    }
+    bool fin() const { return m_ptr == m_fin; }
+protected:
+    const uint8_t *m_ptr;
+    const uint8_t *m_fin;
+};
+
+//ドライバのファイルの情報 (ドライバの更新の検出に使用する)
+static bool nvenc_driver_file_info(uint64_t *fileSize, int64_t *fileTime) {
+#if defined(_WIN32) || defined(_WIN64)
+    HMODULE hModule = GetModuleHandle(_T("nvcuda.dll"));
+    if (hModule == NULL) {
+        return false;
+    }
+    const tstring driverPath = getModulePath(hModule);
+#else
+    Dl_info info;
+    if (dladdr((void *)cuDriverGetVersion, &info) == 0 || info.dli_fname == nullptr) {
+        return false;
+    }
+    const tstring driverPath = info.dli_fname;
+#endif
+    return driverPath.length() > 0
+        && rgy_get_filesize(driverPath.c_str(), fileSize)
+        && rgy_get_filetime(driverPath.c_str(), fileTime);
+}
+
+NVEncDeviceCache& NVEncDeviceCache::instance() {
+    static NVEncDeviceCache cache;
+    return cache;
+}
+
+NVEncDeviceCache::NVEncDeviceCache() :
+    m_mtx(),
+    m_enabled(true),
+    m_loaded(false),
+    m_dirty(false),
+    m_path(),
+    m_entries() {
+}
+
+NVEncDeviceCache::~NVEncDeviceCache() {
+}
+
+tstring NVEncDeviceCache::defaultPath() {
+    const auto dir = rgy_get_user_cache_dir(_T("NVEnc"));
+    if (dir.length() == 0) {
+        return tstring();
+    }
+    return (std::filesystem::path(dir) / _T("NVEncDeviceCache.bin")).native();
+}
+
+void NVEncDeviceCache::init(const tstring& path) {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    if (path == NVENC_DEVICE_CACHE_OFF) {
+        m_enabled = false;
+        return;
+    }
+    const auto newPath = (path.length() == 0 || path == NVENC_DEVICE_CACHE_AUTO) ? defaultPath() : path;
+    if (newPath != m_path) {
+        m_path = newPath;
+        m_loaded = false;
+        m_dirty = false;
+        m_entries.clear();
+    }
+    m_enabled = true;
+}
+
+bool NVEncDeviceCache::makeKey(NVEncDeviceCacheKey& key, CUdevice cuDevice, bool skipHWDecodeCheck, bool disableNVML) {
+    memset(&key, 0, sizeof(key));
+    CUuuid uuid;
+    if (cuDeviceGetUuid(&uuid, cuDevice) != CUDA_SUCCESS) {
+        return false;
+    }
+    static_assert(sizeof(uuid.bytes) == sizeof(key.uuid), "unexpected size of CUuuid");
+    memcpy(key.uuid, uuid.bytes, sizeof(key.uuid));
+    if (cuDriverGetVersion(&key.cudaDriverVersion) != CUDA_SUCCESS) {
+        return false;
+    }
+    if (!nvenc_driver_file_info(&key.driverFileSize, &key.driverFileTime)) {
+        return false;
+    }
+    key.apiVersion = NVENCAPI_VERSION;
+    key.buildHash = nvenc_device_cache_build_hash();
+    key.flags = ((skipHWDecodeCheck) ? NVENC_DEVICE_CACHE_SKIP_HWDEC_CHECK : 0)
+              | ((disableNVML)       ? NVENC_DEVICE_CACHE_DISABLE_NVML     : 0);
+    return true;
+}
+
+RGY_ERR NVEncDeviceCache::read() {
+    m_loaded = true;
+    m_entries.clear();
+    if (m_path.length() == 0) {
+        m_path = defaultPath();
+    }
+    std::vector<uint8_t> buffer;
+    {
+        FILE *fptmp = nullptr;
+        if (m_path.length() == 0 || _tfopen_s(&fptmp, m_path.c_str(), _T("rb")) != 0 || fptmp == nullptr) {
+            return RGY_ERR_FILE_OPEN;
+        }
+        std::unique_ptr<FILE, fp_deleter> fp(fptmp, fp_deleter());
+        std::error_code ec;
+        const uint64_t filesize = (uint64_t)std::filesystem::file_size(std::filesystem::path(m_path), ec);
+        if (ec || filesize < sizeof(NVEncDeviceCacheHeader)) {
+            return RGY_ERR_INVALID_FORMAT;
+        }
+        buffer.resize((size_t)filesize);
+        if (fread(buffer.data(), 1, buffer.size(), fp.get()) != buffer.size()) {
+            return RGY_ERR_FILE_OPEN;
+        }
+    }
+    NVEncDeviceCacheHeader header;
+    memcpy(&header, buffer.data(), sizeof(header));
+    if (memcmp(header.magic, NVENC_DEVICE_CACHE_MAGIC, sizeof(header.magic)) != 0
+        || header.version != NVENC_DEVICE_CACHE_VERSION
+        || header.headerSize != sizeof(header)
+        || header.dataSize != buffer.size() - sizeof(header)
+        || header.checksum != nvenc_device_cache_checksum(buffer.data() + sizeof(header), (size_t)header.dataSize)) {
+        return RGY_ERR_INVALID_FORMAT;
+    }
+    //entryCountは確保量に使わず、データの終端まで読み取ってから件数を照合する
+    std::vector<Entry> entries;
+    NVEncDeviceCacheReader reader(buffer.data() + sizeof(header), (size_t)header.dataSize);
+    while (!reader.fin()) {
+        Entry entry;
+        uint32_t dataSize = 0;
+        if (!reader.get(entry.key) || !reader.get(dataSize) || !reader.getBytes(entry.data, dataSize)) {
+            return RGY_ERR_INVALID_FORMAT;
+        }
+        entries.push_back(std::move(entry));
+    }
+    if (entries.size() != header.entryCount) {
+        return RGY_ERR_INVALID_FORMAT;
+    }
+    m_entries = std::move(entries);
     return RGY_ERR_NONE;
 }
 
+std::vector<uint8_t> NVEncDeviceCache::serialize(const NVGPUInfo *gpu) {
+    std::vector<uint8_t> data;
+    NVEncDeviceCacheWriter writer(data);
+    writer.put((int32_t)gpu->m_nv_driver_version);
+    writer.put((int32_t)gpu->m_pcie_gen);
+    writer.put((int32_t)gpu->m_pcie_link);
+    writer.put((uint32_t)gpu->m_cuvid_csp.size());
+    for (const auto& [codec, csps] : gpu->m_cuvid_csp) {
+        writer.put((uint32_t)codec);
+        std::vector<uint32_t> cspList(csps.begin(), csps.end());
+        writer.putArray(cspList);
+    }
+    writer.put((uint32_t)gpu->m_nvenc_codec_features.size());
+    for (const auto& feature : gpu->m_nvenc_codec_features) {
+        writer.put(feature.codec);
+        writer.putArray(feature.profiles);
+        writer.putArray(feature.presets);
+        std::vector<uint32_t> surfaceFmt(feature.surfaceFmt.begin(), feature.surfaceFmt.end());
+        writer.putArray(surfaceFmt);
+        writer.put((uint32_t)feature.caps.size());
+        for (const auto& cap : feature.caps) {
+            writer.put((int32_t)cap.id);
+            writer.put((int32_t)cap.value);
+        }
+    }
+    return data;
+}
+
+bool NVEncDeviceCache::deserialize(NVGPUInfo *gpu, const std::vector<uint8_t>& data) {
+    NVEncDeviceCacheReader reader(data.data(), data.size());
+    int32_t nvDriverVersion = 0, pcieGen = 0, pcieLink = 0;
+    uint32_t codecCount = 0;
+    if (!reader.get(nvDriverVersion) || !reader.get(pcieGen) || !reader.get(pcieLink) || !reader.get(codecCount)) {
+        return false;
+    }
+    CodecCsp cuvidCsp;
+    for (uint32_t i = 0; i < codecCount; i++) {
+        uint32_t codec = 0;
+        std::vector<uint32_t> cspList;
+        if (!reader.get(codec) || !reader.getArray(cspList)) {
+            return false;
+        }
+        auto& csps = cuvidCsp[(RGY_CODEC)codec];
+        for (const auto csp : cspList) {
+            csps.push_back((RGY_CSP)csp);
+        }
+    }
+    uint32_t featureCount = 0;
+    if (!reader.get(featureCount)) {
+        return false;
+    }
+    std::vector<NVEncCodecFeature> features;
+    for (uint32_t i = 0; i < featureCount; i++) {
+        NVEncCodecFeature feature;
+        std::vector<uint32_t> surfaceFmt;
+        uint32_t capCount = 0;
+        if (!reader.get(feature.codec)
+            || !reader.getArray(feature.profiles)
+            || !reader.getArray(feature.presets)
+            || !reader.getArray(surfaceFmt)
+            || !reader.get(capCount)) {
+            return false;
+        }
+        for (const auto fmt : surfaceFmt) {
+            feature.surfaceFmt.push_back((NV_ENC_BUFFER_FORMAT)fmt);
+        }
+        const auto codec = codec_guid_enc_to_rgy(feature.codec);
+        for (uint32_t icap = 0; icap < capCount; icap++) {
+            int32_t id = 0, value = 0;
+            if (!reader.get(id) || !reader.get(value)) {
+                return false;
+            }
+            //名前と説明はこのビルドの定義から復元する
+            const auto info = nvenc_cap_info(id);
+            if (info == nullptr) {
+                return false;
+            }
+            feature.caps.push_back(nvenc_cap_from_info(*info, codec, value));
+        }
+        features.push_back(std::move(feature));
+    }
+    if (!reader.fin()) {
+        return false;
+    }
+    gpu->m_nv_driver_version = nvDriverVersion;
+    gpu->m_pcie_gen = pcieGen;
+    gpu->m_pcie_link = pcieLink;
+    gpu->m_cuvid_csp = std::move(cuvidCsp);
+    gpu->m_nvenc_codec_features = std::move(features);
+    return true;
+}
+
+bool NVEncDeviceCache::load(NVGPUInfo *gpu, const NVEncDeviceCacheKey& key) {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    if (!m_enabled) {
+        return false;
+    }
+    if (!m_loaded) {
+        read();
+    }
+    auto entry = std::find_if(m_entries.begin(), m_entries.end(), [&key](const Entry& e) { return e.key == key; });
+    return entry != m_entries.end() && deserialize(gpu, entry->data);
+}
+
+void NVEncDeviceCache::store(const NVGPUInfo *gpu, const NVEncDeviceCacheKey& key) {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    if (!m_enabled) {
+        return;
+    }
+    if (!m_loaded) {
+        read();
+    }
+    //同じGPU・同じフラグの古いエントリ (ドライバ更新前のもの) は置き換える
+    auto entry = std::find_if(m_entries.begin(), m_entries.end(), [&key](const Entry& e) {
+        return memcmp(e.key.uuid, key.uuid, sizeof(key.uuid)) == 0 && e.key.flags == key.flags;
+    });
+    if (entry == m_entries.end()) {
+        entry = m_entries.insert(m_entries.end(), Entry());
+    }
+    entry->key = key;
+    entry->data = serialize(gpu);
+    m_dirty = true;
+}
+
+RGY_ERR NVEncDeviceCache::save(RGYLog *log) {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    if (!m_enabled || !m_dirty || m_path.length() == 0) {
+        return RGY_ERR_NONE;
+    }
+    m_dirty = false;
+
+    NVEncDeviceCacheHeader header = { 0 };
+    memcpy(header.magic, NVENC_DEVICE_CACHE_MAGIC, sizeof(header.magic));
+    header.version = NVENC_DEVICE_CACHE_VERSION;
+    header.headerSize = sizeof(header);
+    header.entryCount = (uint32_t)m_entries.size();
+
+    std::vector<uint8_t> data(sizeof(header));
+    NVEncDeviceCacheWriter writer(data);
+    for (const auto& entry : m_entries) {
+        writer.put(entry.key);
+        writer.putArray(entry.data);
+    }
+    header.dataSize = data.size() - sizeof(header);
+    header.checksum = nvenc_device_cache_checksum(data.data() + sizeof(header), (size_t)header.dataSize);
+    memcpy(data.data(), &header, sizeof(header));
+
+    const auto dir = PathRemoveFileSpecFixed(m_path).second;
+    if (dir.length() > 0 && !rgy_directory_exists(dir)) {
+        CreateDirectoryRecursive(dir.c_str());
+    }
+    // 複数のプロセスから同時に作成される可能性があるので、一時ファイルに書いてからリネームする
+    const auto tmpFile = m_path + strsprintf(_T(".%u.tmp"), GetCurrentProcessId());
+    auto err = RGY_ERR_NONE;
+    {
+        FILE *fptmp = nullptr;
+        if (_tfopen_s(&fptmp, tmpFile.c_str(), _T("wb")) != 0 || fptmp == nullptr) {
+            err = RGY_ERR_FILE_OPEN;
+        } else {
+            std::unique_ptr<FILE, fp_deleter> fp(fptmp, fp_deleter());
+            if (fwrite(data.data(), 1, data.size(), fp.get()) != data.size()) {
+                err = RGY_ERR_UNDEFINED_BEHAVIOR;
+            }
+        }
+    }
+    if (err == RGY_ERR_NONE) {
+        std::error_code ec;
+        std::filesystem::rename(std::filesystem::path(tmpFile), std::filesystem::path(m_path), ec);
+        if (ec) {
+            err = RGY_ERR_FILE_OPEN;
+        }
+    }
+    if (err != RGY_ERR_NONE) {
+        _tremove(tmpFile.c_str());
+    }
+    if (log) {
+        log->write(RGY_LOG_DEBUG, RGY_LOGT_DEV, _T("%s device cache: %s.\n"),
+            (err == RGY_ERR_NONE) ? _T("Saved") : _T("Failed to save"), m_path.c_str());
+    }
+    return err;
+}
+
+void NVGPUInfo::copyDeviceInfo(const NVGPUInfo& src) {
+    m_id = src.m_id;
+    m_pciBusId = src.m_pciBusId;
+    m_name = src.m_name;
+    m_compute_capability = src.m_compute_capability;
+    m_nv_driver_version = src.m_nv_driver_version;
+    m_cuda_driver_version = src.m_cuda_driver_version;
+    m_cuda_cores = src.m_cuda_cores;
+    m_clock_rate = src.m_clock_rate;
+    m_pcie_gen = src.m_pcie_gen;
+    m_pcie_link = src.m_pcie_link;
+    m_cuvid_csp = src.m_cuvid_csp;
+    m_nvenc_codec_features = src.m_nvenc_codec_features;
+    m_cudevice = src.m_cudevice;
+}
+
+RGY_ERR NVGPUInfo::initContext() {
+    if (m_cuCtx) {
+        return RGY_ERR_NONE;
+    }
+    writeLog(RGY_LOG_DEBUG, _T("Creating deferred context for device #%d: %s...\n"), m_id, m_name.c_str());
+    return createContext(m_ctxFlags);
+}
+
 RGY_ERR NVGPUInfo::initEncoder() {
+    if (auto err = initContext(); err != RGY_ERR_NONE) {
+        return err;
+    }
     m_encoder = std::make_unique<NVEncoder>(m_cuCtx.get(), m_log);
     auto nvsts = m_encoder->InitSession();
     if (nvsts != NV_ENC_SUCCESS) {
@@ -1150,6 +1801,12 @@ void NVGPUInfo::close_device() {
         m_encoder.reset();
         writeLog(RGY_LOG_DEBUG, _T("Closed Encoder.\n"));
     }
+    if (m_pooled && m_cuCtx) {
+        //サーバーモードではCUDA Contextを破棄せず、次のジョブのためにプールに戻す
+        writeLog(RGY_LOG_DEBUG, _T("Returning CUDA Context to pool...\n"));
+        NVEncDevicePool::instance().release(this);
+        writeLog(RGY_LOG_DEBUG, _T("Returned CUDA Context to pool.\n"));
+    }
     if (m_vidCtxLock) {
         writeLog(RGY_LOG_DEBUG, _T("Closed cuvid Ctx Lock...\n"));
         m_vidCtxLock.reset();
@@ -1409,6 +2066,20 @@ NVENCSTATUS NVEncCtrl::ShowNVEncFeatures(const int cudaSchedule, const bool skip
     return nvStatus;
 }
 
+NVENCSTATUS NVEncCtrl::WarmupDevices(const int cudaSchedule, const bool skipHWDecodeCheck) {
+    //デバイスの初期化を一度行い、デバイス情報とCUDA ContextをNVEncDevicePoolに登録しておく
+    std::vector<std::unique_ptr<NVGPUInfo>> gpuList;
+    auto nvStatus = InitDeviceList(gpuList, cudaSchedule, skipHWDecodeCheck, 0);
+    if (nvStatus != NV_ENC_SUCCESS) {
+        return nvStatus;
+    }
+    for (const auto& gpu : gpuList) {
+        PrintMes(RGY_LOG_INFO, _T("Device #%d: %s ready.\n"), gpu->id(), gpu->infostr().c_str());
+    }
+    //gpuListの破棄により、ContextはPoolに返却される
+    return NV_ENC_SUCCESS;
+}
+
 NVENCSTATUS NVEncCtrl::InitDeviceList(std::vector<std::unique_ptr<NVGPUInfo>>& gpuList, const int cudaSchedule, const bool skipHWDecodeCheck, const int disableNVML) {
     int deviceCount = 0;
     auto cuResult = cuDeviceGetCount(&deviceCount);
@@ -1429,16 +2100,33 @@ NVENCSTATUS NVEncCtrl::InitDeviceList(std::vector<std::unique_ptr<NVGPUInfo>>& g
 
     const bool disableNVMLCheck = (disableNVML > 1 || (disableNVML == 1 && deviceCount > 1));
 
+    const auto timeStart = std::chrono::steady_clock::now();
+    auto& pool = NVEncDevicePool::instance();
     gpuList.clear();
-    for (int currentDevice = 0; currentDevice < deviceCount; currentDevice++) {
-        cudaGetLastError(); //これまでのエラーを初期化
-        if ((m_nDeviceId < 0 || m_nDeviceId == currentDevice)) {
-            auto gpu = std::make_unique<NVGPUInfo>(m_pNVLog);
-            if (gpu->initDevice(currentDevice, (CUctx_flags)cudaSchedule, m_nDeviceId == currentDevice, skipHWDecodeCheck, disableNVMLCheck) == RGY_ERR_NONE) {
-                gpuList.push_back(std::move(gpu));
+    for (;;) {
+        bool deviceBusy = false;
+        for (int currentDevice = 0; currentDevice < deviceCount; currentDevice++) {
+            cudaGetLastError(); //これまでのエラーを初期化
+            if ((m_nDeviceId < 0 || m_nDeviceId == currentDevice)) {
+                auto gpu = std::make_unique<NVGPUInfo>(m_pNVLog);
+                const auto err = gpu->initDevice(currentDevice, (CUctx_flags)cudaSchedule, m_nDeviceId == currentDevice, skipHWDecodeCheck, disableNVMLCheck);
+                if (err == RGY_ERR_NONE) {
+                    gpuList.push_back(std::move(gpu));
+                } else if (err == RGY_ERR_DEVICE_NOT_AVAILABLE) {
+                    deviceBusy = true;
+                }
             }
         }
+        //サーバーモードで全デバイスが使用中の場合は、セッションが空くまで待機する
+        if (gpuList.size() > 0 || !pool.enabled() || !deviceBusy) {
+            break;
+        }
+        PrintMes(RGY_LOG_DEBUG, _T("All devices are busy, waiting for a free session...\n"));
+        pool.waitForRelease(1000);
     }
+    NVEncDeviceCache::instance().save(m_pNVLog.get());
+    PrintMes(RGY_LOG_DEBUG, _T("InitDeviceList: %d device(s) checked in %.1f ms.\n"), (int)gpuList.size(),
+        std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - timeStart).count() * 1e-3);
     if (gpuList.size() == 0) {
         PrintMes(RGY_LOG_ERROR, _T("No GPU found suitable for NVEnc Encoding.\n"));
         return NV_ENC_ERR_NO_ENCODE_DEVICE;
@@ -41,7 +41,11 @@
 #include "NVEncParam.h"
 #include <vector>
 #include <list>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
 
 #include "rgy_version.h"
 #include "rgy_log.h"
@@ -179,6 +183,7 @@ public:
     NVENCSTATUS NvEncLockInputBuffer(void *inputBuffer, void **bufferDataPtr, uint32_t *pitch);
     NVENCSTATUS NvEncUnlockInputBuffer(NV_ENC_INPUT_PTR inputBuffer);
     NVENCSTATUS NvEncReconfigureEncoder(NV_ENC_RECONFIGURE_PARAMS *reconf_params);
+    NVENCSTATUS NvEncGetEncodePresetConfig(const GUID& codec, const GUID& preset, NV_ENC_TUNING_INFO tuningInfo, NV_ENC_PRESET_CONFIG *presetConfig);
     NVENCSTATUS NvEncEncodePicture(NV_ENC_PIC_PARAMS *picParams);
     NVENCSTATUS NvEncGetEncodeStats(NV_ENC_STAT *encodeStats);
     NVENCSTATUS NvEncGetSequenceParams(NV_ENC_SEQUENCE_PARAM_PAYLOAD *sequenceParamPayload);
@@ -260,6 +265,8 @@ using unique_cuCtx = std::unique_ptr<std::remove_pointer<CUcontext>::type, declt
 using unique_vidCtxLock = std::unique_ptr<std::remove_pointer<CUvideoctxlock>::type, decltype(cuvidCtxLockDestroy)>;
 
 class NVGPUInfo {
+    friend class NVEncDevicePool;
+    friend class NVEncDeviceCache;
 protected:
     int m_id;                 //CUDA device id
     std::string m_pciBusId;   //PCI Bus ID
@@ -277,6 +284,8 @@ protected:
     unique_vidCtxLock m_vidCtxLock;
     std::unique_ptr<NVEncoder> m_encoder;
     std::shared_ptr<RGYLog> m_log;
+    CUctx_flags m_ctxFlags;    //コンテキスト作成時のフラグ
+    bool m_pooled;             //コンテキストをNVEncDevicePoolに返却する
 public:
     NVGPUInfo(std::shared_ptr<RGYLog> log) :
         m_id(-1),
@@ -295,7 +304,9 @@ public:
         m_cuCtx(unique_cuCtx(nullptr, cuCtxDestroy)),
         m_vidCtxLock(unique_vidCtxLock(nullptr, cuvidCtxLockDestroy)),
         m_encoder(),
-        m_log(log) {}
+        m_log(log),
+        m_ctxFlags(CU_CTX_SCHED_AUTO),
+        m_pooled(false) {}
 
     ~NVGPUInfo() {
         close_device();
@@ -321,9 +332,14 @@ public:
     void close_device();
 
     RGY_ERR initDevice(int deviceID, CUctx_flags ctxFlags, bool error_if_fail, bool skipHWDecodeCheck, bool disableNVML);
+    //CUDA Contextが未作成なら作成する (キャッシュから初期化した場合は必要になるまで作成しない)
+    RGY_ERR initContext();
     RGY_ERR initEncoder();
     tstring infostr() const;
 protected:
+    RGY_ERR createContext(CUctx_flags ctxFlags);
+    void copyDeviceInfo(const NVGPUInfo& src);
+
     void writeLog(RGYLogLevel log_level, const tstring &str) {
         if (!m_log || log_level < m_log->getLogLevel(RGY_LOGT_DEV)) {
             return;
@@ -351,6 +367,134 @@ protected:
     }
 };
 
+//サーバーモードで複数のジョブの間でCUDAコンテキストとデバイス情報を再利用する
+//有効な場合、NVGPUInfo::initDeviceはキャッシュされたデバイス情報と未使用のコンテキストを使い、
+//NVGPUInfo::close_deviceはコンテキストを破棄せずにここに返却する
+class NVEncDevicePool {
+public:
+    static NVEncDevicePool& instance();
+
+    void enable(int maxSessionsPerDevice);
+    bool enabled() const { return m_enabled; }
+    int maxSessions() const { return m_maxSessions; }
+
+    //キャッシュされたデバイス情報とコンテキストを割り当てる
+    //RGY_ERR_NOT_FOUND: 未登録なので通常の初期化が必要, RGY_ERR_DEVICE_NOT_AVAILABLE: セッション数の上限
+    RGY_ERR acquire(NVGPUInfo *gpu, int deviceID, CUctx_flags ctxFlags);
+    //通常の初期化を行ったデバイスの情報を登録する
+    void add(NVGPUInfo *gpu);
+    //コンテキストを返却する
+    void release(NVGPUInfo *gpu);
+    //いずれかのデバイスが返却されるまで待機する
+    bool waitForRelease(int timeoutMs);
+    //保持しているコンテキストをすべて破棄する
+    void clear();
+protected:
+    NVEncDevicePool();
+    ~NVEncDevicePool();
+    NVEncDevicePool(const NVEncDevicePool&) = delete;
+    NVEncDevicePool& operator=(const NVEncDevicePool&) = delete;
+
+    struct IdleContext {
+        CUcontext ctx;
+        CUvideoctxlock vidCtxLock;
+        CUctx_flags ctxFlags;
+    };
+    struct Entry {
+        std::unique_ptr<NVGPUInfo> info; //デバイス情報 (コンテキストは持たない)
+        std::vector<IdleContext> idle;   //未使用のコンテキスト
+        int active;                      //使用中のセッション数
+        Entry() : info(), idle(), active(0) {};
+    };
+    static void destroyContext(const IdleContext& ctx);
+    std::mutex m_mtx;
+    std::condition_variable m_cv;
+    std::atomic<bool> m_enabled;
+    int m_maxSessions;
+    std::map<int, Entry> m_devices;
+};
+
+//デバイス情報・エンコード機能のファイルキャッシュ
+//
+//  [NVEncDeviceCacheHeader]
+//  [entry] x entryCount
+//    NVEncDeviceCacheKey, uint32_t dataSize, data[dataSize]
+//
+// キャッシュが有効なら、エンコードセッションの作成とHWデコードの対応状況の確認、NVMLの初期化を省略する
+// マルチバイトの値はすべてリトルエンディアン
+static const char NVENC_DEVICE_CACHE_MAGIC[8] = { 'N', 'V', 'E', 'N', 'C', 'D', 'E', 'V' };
+static const uint32_t NVENC_DEVICE_CACHE_VERSION = 2;
+static const TCHAR *NVENC_DEVICE_CACHE_AUTO = _T("auto");
+static const TCHAR *NVENC_DEVICE_CACHE_OFF  = _T("off");
+
+struct NVEncDeviceCacheHeader {
+    char     magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    uint32_t entryCount;
+    uint32_t checksum;     // ヘッダ以降のデータのFNV-1a
+    uint64_t dataSize;     // ヘッダ以降のデータサイズ
+};
+static_assert(sizeof(NVEncDeviceCacheHeader) == 32, "unexpected size of NVEncDeviceCacheHeader");
+
+struct NVEncDeviceCacheKey {
+    uint8_t  uuid[16];         // GPUのUUID
+    int32_t  cudaDriverVersion;
+    uint32_t apiVersion;       // ビルド時のNVENCAPI_VERSION
+    uint64_t driverFileSize;   // ドライバ(nvcuda.dll/libcuda.so)のファイルサイズ
+    int64_t  driverFileTime;   // ドライバの更新時刻
+    uint32_t flags;            // NVEncDeviceCacheFlags
+    uint32_t buildHash;        // NVEncのバージョンと取得する機能のリストのハッシュ
+    bool operator==(const NVEncDeviceCacheKey& x) const;
+};
+static_assert(sizeof(NVEncDeviceCacheKey) == 48, "unexpected size of NVEncDeviceCacheKey");
+
+enum NVEncDeviceCacheFlags : uint32_t {
+    NVENC_DEVICE_CACHE_SKIP_HWDEC_CHECK = 0x01,
+    NVENC_DEVICE_CACHE_DISABLE_NVML     = 0x02,
+};
+
+class NVEncDeviceCache {
+public:
+    static NVEncDeviceCache& instance();
+
+    //path: キャッシュファイル ("auto"ならユーザーごとのキャッシュディレクトリ, "off"なら無効)
+    void init(const tstring& path);
+    bool enabled() const { return m_enabled; }
+
+    //キャッシュのキーを作成する (UUIDやドライバの情報が取得できなければfalse)
+    bool makeKey(NVEncDeviceCacheKey& key, CUdevice cuDevice, bool skipHWDecodeCheck, bool disableNVML);
+    //キャッシュからデバイス情報を読み込む
+    bool load(NVGPUInfo *gpu, const NVEncDeviceCacheKey& key);
+    //デバイス情報をキャッシュに登録する
+    void store(const NVGPUInfo *gpu, const NVEncDeviceCacheKey& key);
+    //変更があればファイルに書き出す
+    RGY_ERR save(RGYLog *log);
+
+    static tstring defaultPath();
+protected:
+    NVEncDeviceCache();
+    ~NVEncDeviceCache();
+    NVEncDeviceCache(const NVEncDeviceCache&) = delete;
+    NVEncDeviceCache& operator=(const NVEncDeviceCache&) = delete;
+
+    RGY_ERR read();
+
+    struct Entry {
+        NVEncDeviceCacheKey key;
+        std::vector<uint8_t> data;
+    };
+    static std::vector<uint8_t> serialize(const NVGPUInfo *gpu);
+    static bool deserialize(NVGPUInfo *gpu, const std::vector<uint8_t>& data);
+
+    std::mutex m_mtx;
+    std::atomic<bool> m_enabled;
+    bool m_loaded;   // ファイルを読み込み済み
+    bool m_dirty;    // 書き出しが必要
+    tstring m_path;
+    std::vector<Entry> m_entries;
+};
+
 class NVEncCtrl {
 public:
     NVEncCtrl();
@@ -363,6 +507,9 @@ public:
     NVENCSTATUS ShowCodecSupport(const int cudaSchedule, const bool skipHWDecodeCheck);
     NVENCSTATUS ShowNVEncFeatures(const int cudaSchedule, const bool skipHWDecodeCheck);
 
+    //NVEncDevicePoolが有効な場合に、あらかじめ各デバイスのコンテキストを作成しておく
+    NVENCSTATUS WarmupDevices(const int cudaSchedule, const bool skipHWDecodeCheck);
+
 protected:
     //既定の出力先に情報をメッセージを出力
     virtual void PrintMes(RGYLogLevel logLevel, const TCHAR *format, ...);
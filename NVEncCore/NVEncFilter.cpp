@@ -50,7 +50,8 @@ NVEncFilter::NVEncFilter() :
     RGYFilterBase(),
     m_frameBuf(), m_nFrameIdx(0),
     m_pFieldPairIn(), m_pFieldPairOut(),
-    m_peFilterStart(), m_peFilterFin() {
+    m_peFilterStart(), m_peFilterFin(),
+    m_frameCache() {
 
 }
 
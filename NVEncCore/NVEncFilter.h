@@ -39,6 +39,7 @@
 #include "convert_csp.h"
 #include "rgy_filter.h"
 #include "rgy_cuda_util.h"
+#include "NVEncFilterFrameCache.h"
 
 #pragma comment(lib, "cudart_static.lib")
 
@@ -92,6 +93,8 @@ public:
     virtual ~NVEncFilter();
     RGY_ERR filter(RGYFrameInfo *pInputFrame, RGYFrameInfo **ppOutputFrames, int *pOutputFrameNum, cudaStream_t stream);
     virtual void setCheckPerformance(const bool check) override;
+    //時間方向フィルタで共有するフレームキャッシュを設定する (init前に呼ぶこと)
+    void setFrameCache(std::shared_ptr<NVEncFilterFrameCache> cache) { m_frameCache = cache; }
 protected:
     virtual RGY_ERR AllocFrameBuf(const RGYFrameInfo &frame, int frames) override;
     RGY_ERR filter_as_interlaced_pair(const RGYFrameInfo *pInputFrame, RGYFrameInfo *pOutputFrame, cudaStream_t stream);
@@ -104,6 +107,7 @@ protected:
     std::unique_ptr<CUFrameBuf> m_pFieldPairOut;
     std::unique_ptr<cudaEvent_t, cudaevent_deleter> m_peFilterStart;
     std::unique_ptr<cudaEvent_t, cudaevent_deleter> m_peFilterFin;
+    std::shared_ptr<NVEncFilterFrameCache> m_frameCache;
 };
 
 class NVEncFilterParamCrop : public NVEncFilterParam {
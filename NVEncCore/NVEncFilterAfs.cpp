@@ -51,37 +51,40 @@ T absdiff(T a, T b) {
 }
 
 afsSourceCache::afsSourceCache() :
+    m_cache(),
+    m_subscriber(-1),
     m_sourceArray(),
     m_nFramesInput(0) {
 }
 
-RGY_ERR afsSourceCache::alloc(const RGYFrameInfo& frameInfo) {
-    for (int i = 0; i < _countof(m_sourceArray); i++) {
-        m_sourceArray[i].frame = frameInfo;
-        auto ret = m_sourceArray[i].alloc();
-        if (ret != RGY_ERR_NONE) {
-            m_sourceArray[i].clear();
-            return ret;
-        }
-    }
-    return RGY_ERR_NONE;
+void afsSourceCache::init(std::shared_ptr<NVEncFilterFrameCache> cache) {
+    clear();
+    m_cache = cache;
+    m_subscriber = m_cache->subscribe(_T("afs"), AFS_SOURCE_CACHE_NUM);
 }
 
 RGY_ERR afsSourceCache::add(const RGYFrameInfo *pInputFrame, cudaStream_t stream) {
     const int iframe = m_nFramesInput++;
     auto pDstFrame = get(iframe);
-    auto ret = copyFrameAsync(&pDstFrame->frame, pInputFrame, stream);
+    auto ret = m_cache->add(pDstFrame->entry, pInputFrame, stream);
     if (ret != RGY_ERR_NONE) {
         return ret;
     }
-    copyFrameProp(&pDstFrame->frame, pInputFrame);
+    pDstFrame->frame = *pDstFrame->entry->frame();
+    copyFramePropWithoutRes(&pDstFrame->frame, pInputFrame);
     return RGY_ERR_NONE;
 }
 
 void afsSourceCache::clear() {
     for (int i = 0; i < _countof(m_sourceArray); i++) {
-        m_sourceArray[i].clear();
+        m_sourceArray[i].entry.reset();
+        m_sourceArray[i].frame = RGYFrameInfo();
+    }
+    if (m_cache) {
+        m_cache->unsubscribe(m_subscriber);
+        m_subscriber = -1;
     }
+    m_cache.reset();
     m_nFramesInput = 0;
 }
 
@@ -523,12 +526,11 @@ RGY_ERR NVEncFilterAfs::init(shared_ptr<NVEncFilterParam> pParam, shared_ptr<RGY
     AddMessage(RGY_LOG_DEBUG, _T("allocated output buffer: %dx%d, pitch %d, %s.\n"),
         m_frameBuf[0]->frame.width, m_frameBuf[0]->frame.height, m_frameBuf[0]->frame.pitch[0], RGY_CSP_NAMES[m_frameBuf[0]->frame.csp]);
 
-    if (RGY_ERR_NONE != (err = m_source.alloc(pAfsParam->frameOut))) {
-        AddMessage(RGY_LOG_ERROR, _T("failed to allocate memory: %s.\n"), get_err_mes(err));
-        return RGY_ERR_MEMORY_ALLOC;
+    if (!m_frameCache) {
+        m_frameCache = std::make_shared<NVEncFilterFrameCache>();
     }
-    AddMessage(RGY_LOG_DEBUG, _T("allocated source buffer: %dx%d, pitch %d, %s.\n"),
-        m_source.get(0)->frame.width, m_source.get(0)->frame.height, m_source.get(0)->frame.pitch[0], RGY_CSP_NAMES[m_source.get(0)->frame.csp]);
+    m_source.init(m_frameCache);
+    AddMessage(RGY_LOG_DEBUG, _T("source buffer: %d frames from frame cache.\n"), AFS_SOURCE_CACHE_NUM);
 
     if (RGY_ERR_NONE != (err = m_scan.alloc(pAfsParam->frameOut))) {
         AddMessage(RGY_LOG_ERROR, _T("failed to allocate memory: %s.\n"), get_err_mes(err));
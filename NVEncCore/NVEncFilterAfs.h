@@ -83,25 +83,32 @@ public:
     virtual tstring print() const override;
 };
 
+struct afsSourceFrame {
+    std::shared_ptr<NVEncFilterFrameCacheEntry> entry; // 画素データは共有のキャッシュから
+    RGYFrameInfo frame;                                // フレーム情報はafsで個別に持つ
+};
+
 class afsSourceCache {
 public:
     afsSourceCache();
     ~afsSourceCache();
 
-    RGY_ERR alloc(const RGYFrameInfo& frameInfo);
+    void init(std::shared_ptr<NVEncFilterFrameCache> cache);
 
     RGY_ERR add(const RGYFrameInfo *pInputFrame, cudaStream_t stream);
 
     RGY_ERR sep_field_uv(RGYFrameInfo *pDstFrame, const RGYFrameInfo *pSrcFrame, cudaStream_t stream);
 
-    CUFrameBuf *get(int iframe) {
+    afsSourceFrame *get(int iframe) {
         iframe = clamp(iframe, 0, m_nFramesInput-1);
         return &m_sourceArray[iframe & (AFS_SOURCE_CACHE_NUM-1)];
     }
     int inframe() const { return m_nFramesInput; }
     void clear();
 protected:
-    CUFrameBuf m_sourceArray[AFS_SOURCE_CACHE_NUM];
+    std::shared_ptr<NVEncFilterFrameCache> m_cache;
+    int m_subscriber;
+    afsSourceFrame m_sourceArray[AFS_SOURCE_CACHE_NUM];
     int m_nFramesInput;
 };
 
@@ -236,7 +243,7 @@ protected:
     virtual void close() override;
     RGY_ERR check_param(shared_ptr<NVEncFilterParamAfs> pAfsParam);
 
-    RGY_ERR analyze_stripe(CUFrameBuf *p0, CUFrameBuf *p1, AFS_SCAN_DATA *sp, CUMemBufPair *count_motion, const NVEncFilterParamAfs *pAfsPrm, cudaStream_t stream);
+    RGY_ERR analyze_stripe(afsSourceFrame *p0, afsSourceFrame *p1, AFS_SCAN_DATA *sp, CUMemBufPair *count_motion, const NVEncFilterParamAfs *pAfsPrm, cudaStream_t stream);
     bool scan_frame_result_cached(int iframe, const VppAfs *pAfsPrm);
     RGY_ERR scan_frame(int iframe, int force, const NVEncFilterParamAfs *pAfsPrm, cudaStream_t stream);
     RGY_ERR count_motion(AFS_SCAN_DATA *sp, const AFS_SCAN_CLIP *clip);
@@ -248,7 +255,7 @@ protected:
     int detect_telecine_cross(int iframe, int coeff_shift);
     RGY_ERR analyze_frame(int iframe, const NVEncFilterParamAfs *pAfsPrm, int reverse[4], int assume_shift[4], int result_stat[4]);
 
-    RGY_ERR synthesize(int iframe, CUFrameBuf *pOut, CUFrameBuf *p0, CUFrameBuf *p1, AFS_STRIPE_DATA *sip, const NVEncFilterParamAfs *pAfsPrm, cudaStream_t stream);
+    RGY_ERR synthesize(int iframe, CUFrameBuf *pOut, afsSourceFrame *p0, afsSourceFrame *p1, AFS_STRIPE_DATA *sip, const NVEncFilterParamAfs *pAfsPrm, cudaStream_t stream);
 
     int open_timecode(tstring tc_filename);
     void write_timecode(int64_t pts, const rgy_rational<int>& timebase);
@@ -581,7 +581,7 @@ RGY_ERR run_analyze_stripe(uint8_t *dst, const int dstPitch,
     return err_to_rgy(cudaGetLastError());
 }
 
-RGY_ERR NVEncFilterAfs::analyze_stripe(CUFrameBuf *p0, CUFrameBuf *p1, AFS_SCAN_DATA *sp, CUMemBufPair *count_motion, const NVEncFilterParamAfs *pAfsParam, cudaStream_t stream) {
+RGY_ERR NVEncFilterAfs::analyze_stripe(afsSourceFrame *p0, afsSourceFrame *p1, AFS_SCAN_DATA *sp, CUMemBufPair *count_motion, const NVEncFilterParamAfs *pAfsParam, cudaStream_t stream) {
     struct analyze_func {
         decltype(run_analyze_stripe<uint8_t, uint32_t, 8, true, true>)* func[2];
         analyze_func(decltype(run_analyze_stripe<uint8_t, uint32_t, 8, true, true>)* tb_order_0, decltype(run_analyze_stripe<uint8_t, uint32_t, 8, true, true>)* tb_order_1) {
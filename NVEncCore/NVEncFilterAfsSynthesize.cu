@@ -899,7 +899,7 @@ RGY_ERR run_synthesize(RGYFrameInfo *pFrameOut,
     return err_to_rgy(cudaGetLastError());
 }
 
-RGY_ERR NVEncFilterAfs::synthesize(int iframe, CUFrameBuf *pOut, CUFrameBuf *p0, CUFrameBuf *p1, AFS_STRIPE_DATA *sip, const NVEncFilterParamAfs *pAfsPrm, cudaStream_t stream) {
+RGY_ERR NVEncFilterAfs::synthesize(int iframe, CUFrameBuf *pOut, afsSourceFrame *p0, afsSourceFrame *p1, AFS_STRIPE_DATA *sip, const NVEncFilterParamAfs *pAfsPrm, cudaStream_t stream) {
     struct synthesize_func {
         decltype(run_synthesize<uint8_t, uchar2, uint32_t, uint2, 3, true>)* func[6];
         synthesize_func(
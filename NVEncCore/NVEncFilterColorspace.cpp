@@ -35,6 +35,7 @@
 #include "rgy_filesystem.h"
 #include "rgy_log.h"
 #include "rgy_resource.h"
+#include "rgy_lut3d.h"
 #include "convert_csp.h"
 #include "NVEncFilterColorspace.h"
 #include "NVEncFilterColorspaceFunc.h"
@@ -586,9 +587,9 @@ public:
     virtual bool add(const ColorspaceOp *op) { UNREFERENCED_PARAMETER(op); return false; }
     virtual RGY_ERR init(std::vector<uint8_t>& devParams);
 protected:
-    void setAdditionalParams(std::vector<uint8_t>& additionalParams, const std::vector<LUTVEC>& luttable);
+    void setAdditionalParams(std::vector<uint8_t>& additionalParams, const RGYLUT3D& lut);
+    void checkTable(const std::vector<uint8_t>& additionalParams, const RGYLUT3D& lut);
     RGY_ERR parseTable(std::vector<uint8_t>& additionalParams);
-    RGY_ERR parseCube(std::vector<uint8_t>& additionalParams);
     void clearTable();
     tstring m_table_file;
     LUT3DInterp m_interp;
@@ -634,7 +635,7 @@ std::string ColorspaceOpLUT3D::print() {
         x = lut3d_interp_%s(x, getDevParamsLut(params), lutSize0, lutSize01);
     })",
         m_tableSize0, m_tableSize01,
-        scale_to_table((int)LUT3DIDX::r), scale_to_table((int)LUT3DIDX::b), scale_to_table((int)LUT3DIDX::b),
+        scale_to_table((int)LUT3DIDX::r), scale_to_table((int)LUT3DIDX::g), scale_to_table((int)LUT3DIDX::b),
         tchar_to_string(get_cx_desc(list_vpp_colorspace_lut3d_interp, (int)m_interp)).c_str());
     return str;
 }
@@ -657,77 +658,109 @@ void ColorspaceOpLUT3D::clearTable() {
 }
 
 RGY_ERR ColorspaceOpLUT3D::parseTable(std::vector<uint8_t>& additionalParams) {
-    if (check_ext(m_table_file.c_str(), { ".cube" })) {
-        return parseCube(additionalParams);
-    }
-    m_log->write(RGY_LOG_ERROR, RGY_LOGT_VPP, _T("Unsupported lut3d file type: %s\n"), m_table_file.c_str());
-    return RGY_ERR_UNSUPPORTED;
-}
-
-RGY_ERR ColorspaceOpLUT3D::parseCube(std::vector<uint8_t>& additionalParams) {
     clearTable();
 
-    FILE *fptmp = nullptr;
-    if (_tfopen_s(&fptmp, m_table_file.c_str(), _T("r")) != 0) {
-        m_log->write(RGY_LOG_ERROR, RGY_LOGT_VPP, _T("Failed to open lut3d cube file: %s\n"), m_table_file.c_str());
-        return RGY_ERR_FILE_OPEN;
-    }
-    m_log->write(RGY_LOG_DEBUG, RGY_LOGT_VPP, _T("Opened lut3d cube file: %s\n"), m_table_file.c_str());
-    std::unique_ptr<FILE, fp_deleter> fp(fptmp, fp_deleter());
-    char buffer[512];
-    float lutmin[3] = { 0.0f, 0.0f, 0.0f };
-    float lutmax[3] = { 1.0f, 1.0f, 1.0f };
-    LUTVEC value;
-    memset(&value, 0, sizeof(value));
-
-    std::vector<LUTVEC> luttable;
-    size_t tableidx = 0;
-    while (fgets(buffer, _countof(buffer), fp.get()) != nullptr) {
-        if (buffer[0] == '#') continue;
-        if (buffer[0] == '\n') continue;
-        if (m_tableSize01 > 0
-            && sscanf_s(buffer, "%f %f %f", &value.x, &value.y, &value.z) == 3) {
-            const auto b = tableidx / m_tableSize01;
-            const auto g = (tableidx - m_tableSize01 * b) / m_tableSize0;
-            const auto r = tableidx - m_tableSize01 * b - m_tableSize0 * g;
-            if (b >= (size_t)m_tableSize0 || g >= (size_t)m_tableSize0 || r >= (size_t)m_tableSize0) {
-                return RGY_ERR_INVALID_DATA_TYPE;
-            }
-            luttable[r * m_tableSize01 + g * m_tableSize0 + b] = value;
-            tableidx++;
-        } else if (sscanf_s(buffer, "LUT_3D_SIZE %d", &m_tableSize0) == 1) {
-            m_tableSize01 = m_tableSize0 * m_tableSize0;
-            if (m_tableSize01 <= 0) {
-                m_log->write(RGY_LOG_ERROR, RGY_LOGT_VPP, _T("Invalid lut3d cube file: size %d\n"), m_tableSize01);
-                return RGY_ERR_INVALID_DATA_TYPE;
-            }
-            m_log->write(RGY_LOG_DEBUG, RGY_LOGT_VPP, _T("lut3d cube file: size %d\n"), m_tableSize01);
-            luttable.resize(m_tableSize0 * m_tableSize0 * m_tableSize0);
-        } else if (sscanf_s(buffer, "DOMAIN_MIN %f %f %f", &lutmin[0], &lutmin[1], &lutmin[2]) == 3
-                || sscanf_s(buffer, "DOMAIN_MAX %f %f %f", &lutmax[0], &lutmax[1], &lutmax[2]) == 3) {
-            // なにもしない
-        } 
-    }
-    if (tableidx != luttable.size()) {
-        m_log->write(RGY_LOG_ERROR, RGY_LOGT_VPP, _T("Invalid lut3d cube file: found %llu entry, which should be %llu\n"), (uint64_t)tableidx, (uint64_t)luttable.size());
-        return RGY_ERR_INVALID_DATA_TYPE;
+    // .cubeは初回に同じ場所にバイナリ形式(<file>.cube.rgylut3d)のキャッシュを作成し、次回以降はそちらを読み込む
+    RGYLUT3D lut;
+    auto err = lut.load(m_table_file, m_log);
+    if (err != RGY_ERR_NONE) {
+        return err;
     }
+    m_log->write(RGY_LOG_DEBUG, RGY_LOGT_VPP, _T("lut3d file: size %d, prelut size %d%s\n"), lut.size(), lut.prelutSize(), (lut.fromCache()) ? _T(" (cache)") : _T(""));
+    m_tableSize0 = lut.size();
+    m_tableSize01 = m_tableSize0 * m_tableSize0;
     for (int i = 0; i < 3; i++) {
-        m_rgbscale(i) = clamp(1.0f / (lutmax[i] - lutmin[i]), 0.0f, 1.0f);
-        m_log->write(RGY_LOG_DEBUG, RGY_LOGT_VPP, _T("lut3d cube file: rgbscale(%d): %f\n"), i, m_rgbscale(i));
+        m_rgbscale(i) = clamp(1.0f / (lut.domainMax()[i] - lut.domainMin()[i]), 0.0f, 1.0f);
+        m_log->write(RGY_LOG_DEBUG, RGY_LOGT_VPP, _T("lut3d file: rgbscale(%d): %f\n"), i, m_rgbscale(i));
+    }
+    if (lut.prelutSize() > 0) {
+        m_preLUT.size = lut.prelutSize();
+        m_preLUT.min = vec3f(lut.prelutMin()[0], lut.prelutMin()[1], lut.prelutMin()[2]);
+        m_preLUT.max = vec3f(lut.prelutMax()[0], lut.prelutMax()[1], lut.prelutMax()[2]);
+        for (int i = 0; i < 3; i++) {
+            m_preLUT.scale(i) = (float)(m_preLUT.size - 1) / (m_preLUT.max(i) - m_preLUT.min(i));
+        }
+    }
+    setAdditionalParams(additionalParams, lut);
+    if (m_log->getLogLevel(RGY_LOGT_VPP) <= RGY_LOG_DEBUG) {
+        checkTable(additionalParams, lut);
     }
-    setAdditionalParams(additionalParams, luttable);
     return RGY_ERR_NONE;
 }
 
-void ColorspaceOpLUT3D::setAdditionalParams(std::vector<uint8_t>& additionalParams, const std::vector<LUTVEC>& luttable) {
+void ColorspaceOpLUT3D::setAdditionalParams(std::vector<uint8_t>& additionalParams, const RGYLUT3D& lut) {
+    static_assert(sizeof(RGYLUT3DVec) == sizeof(LUTVEC), "RGYLUT3DVec must have same layout as LUTVEC");
     RGYColorspaceDevParams *addPrmPtr = (RGYColorspaceDevParams *)additionalParams.data();
+    const size_t prelutBytes = sizeof(float) * lut.prelutSize() * 3;
+    addPrmPtr->prelut_offset = (int)additionalParams.size();
     // LUTVECのアライメントをとるため、最初の位置を調整する
-    addPrmPtr->lut_offset = (int)rgy_ceil_int(additionalParams.size(), sizeof(LUTVEC));
-    m_log->write(RGY_LOG_DEBUG, RGY_LOGT_VPP, _T("lut3d table: lut_offset: %d, luttable size %llu\n"), addPrmPtr->lut_offset, sizeof(luttable[0]) * luttable.size());
-    additionalParams.resize(addPrmPtr->lut_offset + sizeof(luttable[0]) * luttable.size());
+    addPrmPtr->lut_offset = (int)rgy_ceil_int(additionalParams.size() + prelutBytes, sizeof(LUTVEC));
+    m_log->write(RGY_LOG_DEBUG, RGY_LOGT_VPP, _T("lut3d table: lut_offset: %d, luttable size %llu\n"), addPrmPtr->lut_offset, (uint64_t)lut.tableBytes());
+    additionalParams.resize(addPrmPtr->lut_offset + lut.tableBytes());
     addPrmPtr = nullptr; // resizeで失効
-    memcpy(getDevParamsLut(additionalParams.data()), luttable.data(), sizeof(luttable[0]) * luttable.size());
+    if (prelutBytes > 0) {
+        memcpy(getDevParamsPrelut(additionalParams.data()), lut.prelut(), prelutBytes);
+    }
+    memcpy(getDevParamsLut(additionalParams.data()), lut.table(), lut.tableBytes());
+}
+
+//GPUに転送するパラメータに対し、カーネルと同じ関数(NVEncFilterColorspaceFunc.h)をCPUで実行し、
+//RGYLUT3D::apply()の結果と一致することを確認する (デバッグ用)
+void ColorspaceOpLUT3D::checkTable(const std::vector<uint8_t>& additionalParams, const RGYLUT3D& lut) {
+    if (m_interp != LUT3DInterp::Nearest && m_interp != LUT3DInterp::Trilinear && m_interp != LUT3DInterp::Tetrahedral) {
+        m_log->write(RGY_LOG_DEBUG, RGY_LOGT_VPP, _T("lut3d check: skipped, no reference for interp=%s.\n"),
+            get_cx_desc(list_vpp_colorspace_lut3d_interp, (int)m_interp));
+        return;
+    }
+    const void *params = additionalParams.data();
+    const vec3f scale_to_table = m_rgbscale * (float)(m_tableSize0 - 1);
+    const float lut_max_idx = (float)(m_tableSize0 - 1) + 1e-6f;
+    const float prelutmin[3]   = { m_preLUT.min(0),   m_preLUT.min(1),   m_preLUT.min(2) };
+    const float prelutscale[3] = { m_preLUT.scale(0), m_preLUT.scale(1), m_preLUT.scale(2) };
+    //格子点、格子の間、範囲外の値を含むように入力を選ぶ
+    const int steps = 2 * std::min(m_tableSize0 - 1, 16) + 3;
+    float inputScale[3];
+    for (int i = 0; i < 3; i++) {
+        inputScale[i] = (m_rgbscale(i) > 0.0f) ? 1.0f / m_rgbscale(i) : 1.0f;
+    }
+    float maxErr = 0.0f;
+    RGYLUT3DVec maxErrIn = { 0.0f, 0.0f, 0.0f, 0.0f };
+    for (int ir = 0; ir < steps; ir++) {
+        for (int ig = 0; ig < steps; ig++) {
+            for (int ib = 0; ib < steps; ib++) {
+                const RGYLUT3DVec in = {
+                    ((float)(ir - 1) / (steps - 3)) * inputScale[0],
+                    ((float)(ig - 1) / (steps - 3)) * inputScale[1],
+                    ((float)(ib - 1) / (steps - 3)) * inputScale[2], 0.0f };
+                float3 x;
+                x.x = in.x;
+                x.y = in.y;
+                x.z = in.z;
+                if (m_preLUT.size > 0) {
+                    x = lut3d_prelut(x, m_preLUT.size, prelutmin, prelutscale, getDevParamsPrelut(params));
+                }
+                x.x = clamp(x.x * scale_to_table((int)LUT3DIDX::r), 0.0f, lut_max_idx);
+                x.y = clamp(x.y * scale_to_table((int)LUT3DIDX::g), 0.0f, lut_max_idx);
+                x.z = clamp(x.z * scale_to_table((int)LUT3DIDX::b), 0.0f, lut_max_idx);
+                float3 dev;
+                switch (m_interp) {
+                case LUT3DInterp::Nearest:     dev = lut3d_interp_nearest(x, getDevParamsLut(params), m_tableSize0, m_tableSize01); break;
+                case LUT3DInterp::Tetrahedral: dev = lut3d_interp_tetrahedral(x, getDevParamsLut(params), m_tableSize0, m_tableSize01); break;
+                case LUT3DInterp::Trilinear:
+                default:                       dev = lut3d_interp_trilinear(x, getDevParamsLut(params), m_tableSize0, m_tableSize01); break;
+                }
+                const auto ref = lut.apply(in, m_interp);
+                const float err = std::max(std::abs(ref.x - dev.x), std::max(std::abs(ref.y - dev.y), std::abs(ref.z - dev.z)));
+                if (err > maxErr) {
+                    maxErr = err;
+                    maxErrIn = in;
+                }
+            }
+        }
+    }
+    const auto level = (maxErr > 1e-4f) ? RGY_LOG_WARN : RGY_LOG_DEBUG;
+    m_log->write(level, RGY_LOGT_VPP, _T("lut3d check: %d samples, max error %e (input %f, %f, %f).\n"),
+        steps * steps * steps, maxErr, maxErrIn.x, maxErrIn.y, maxErrIn.z);
 }
 
 bool ColorspaceOpMatrix::add(const ColorspaceOp *op) {
@@ -218,7 +218,7 @@ static RGY_ERR denoise_convolution3d_frame(RGYFrameInfo *pOutputFrame,
     return RGY_ERR_UNSUPPORTED;
 }
 
-NVEncFilterConvolution3d::NVEncFilterConvolution3d() : m_bInterlacedWarn(false), m_prevFrames(), m_cacheIdx(0) {
+NVEncFilterConvolution3d::NVEncFilterConvolution3d() : m_bInterlacedWarn(false), m_prevEntries(), m_prevFrames(), m_subscriber(-1), m_cacheIdx(0) {
     m_name = _T("convolution3d");
 }
 
@@ -264,15 +264,15 @@ RGY_ERR NVEncFilterConvolution3d::init(shared_ptr<NVEncFilterParam> pParam, shar
         }
     }
 
-    if (!m_prevFrames.front() ||
-        cmpFrameInfoCspResolution(&m_prevFrames.front()->frame, &param->frameOut)) {
-        for (auto& f : m_prevFrames) {
-            f.reset(new CUFrameBuf(param->frameOut));
-            f->releasePtr();
-            sts = f->alloc();
-            if (sts != RGY_ERR_NONE) {
-                return sts;
-            }
+    if (!m_frameCache) {
+        m_frameCache = std::make_shared<NVEncFilterFrameCache>();
+    }
+    if (m_subscriber < 0) {
+        m_subscriber = m_frameCache->subscribe(_T("convolution3d"), (int)m_prevEntries.size());
+    }
+    if (cmpFrameInfoCspResolution(&m_prevFrames.front(), &param->frameOut)) {
+        for (auto& e : m_prevEntries) {
+            e.reset();
         }
         m_cacheIdx = 0;
     }
@@ -337,8 +337,8 @@ RGY_ERR NVEncFilterConvolution3d::run_filter(const RGYFrameInfo *pInputFrame, RG
             }
         }
 
-        auto framePrev = &m_prevFrames[std::max(m_cacheIdx-2, 0) % m_prevFrames.size()]->frame;
-        auto frameCur  = &m_prevFrames[        (m_cacheIdx-1)    % m_prevFrames.size()]->frame;
+        auto framePrev = &m_prevFrames[std::max(m_cacheIdx-2, 0) % m_prevFrames.size()];
+        auto frameCur  = &m_prevFrames[        (m_cacheIdx-1)    % m_prevFrames.size()];
         if (frameNext->ptr[0] == nullptr) {
             frameNext = frameCur;
         }
@@ -382,22 +382,30 @@ RGY_ERR NVEncFilterConvolution3d::run_filter(const RGYFrameInfo *pInputFrame, RG
     }
     //sourceキャッシュにコピー
     if (pInputFrame->ptr[0]) {
-        auto cacheFrame = &m_prevFrames[m_cacheIdx++ % m_prevFrames.size()]->frame;
-        sts = copyFrameAsync(cacheFrame, frameNext, stream);
+        const int idx = m_cacheIdx++ % m_prevFrames.size();
+        sts = m_frameCache->add(m_prevEntries[idx], frameNext, stream);
         if (sts != RGY_ERR_NONE) {
             AddMessage(RGY_LOG_ERROR, _T("failed to set frame to data cache: %s.\n"), get_err_mes(sts));
             return sts;
         }
-        copyFrameProp(cacheFrame, frameNext);
+        m_prevFrames[idx] = *m_prevEntries[idx]->frame();
+        copyFramePropWithoutRes(&m_prevFrames[idx], frameNext);
     }
     return sts;
 }
 
 void NVEncFilterConvolution3d::close() {
     m_frameBuf.clear();
+    for (auto& e : m_prevEntries) {
+        e.reset();
+    }
     for (auto& f : m_prevFrames) {
-        f.reset();
+        f = RGYFrameInfo();
+    }
+    if (m_frameCache && m_subscriber >= 0) {
+        m_frameCache->unsubscribe(m_subscriber);
     }
+    m_subscriber = -1;
     m_bInterlacedWarn = false;
     m_cacheIdx = 0;
 }
@@ -51,6 +51,8 @@ protected:
     virtual RGY_ERR run_filter(const RGYFrameInfo *pInputFrame, RGYFrameInfo **ppOutputFrames, int *pOutputFrameNum, cudaStream_t stream) override;
     virtual void close() override;
     bool m_bInterlacedWarn;
-    std::array<std::unique_ptr<CUFrameBuf>, 2> m_prevFrames;
+    std::array<std::shared_ptr<NVEncFilterFrameCacheEntry>, 2> m_prevEntries; // 画素データは共有のキャッシュから
+    std::array<RGYFrameInfo, 2> m_prevFrames;                                 // フレーム情報は個別に持つ
+    int m_subscriber;
     int m_cacheIdx;
 };
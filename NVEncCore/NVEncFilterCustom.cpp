@@ -33,6 +33,7 @@
 #include "rgy_filesystem.h"
 #include "NVEncFilterCustom.h"
 #include "NVEncFilterParam.h"
+#include "NVEncDevice.h"
 #pragma warning (push)
 #pragma warning (disable: 4819)
 #include "cuda_runtime.h"
@@ -41,6 +42,25 @@
 
 const char *NVEncFilterCustom::KERNEL_NAME = "kernel_filter";
 
+#if ENABLE_NVRTC
+//サーバーモードでは、ビルド済みのカーネルをCUDA Contextごとに保持し、同じContextを使う次のジョブで再利用する
+static std::shared_ptr<jitify::JitCache> get_kernel_cache() {
+    if (!NVEncDevicePool::instance().enabled()) {
+        return std::make_shared<jitify::JitCache>();
+    }
+    CUcontext ctx = nullptr;
+    cuCtxGetCurrent(&ctx);
+    static std::mutex mtx;
+    static std::map<CUcontext, std::shared_ptr<jitify::JitCache>> caches;
+    std::lock_guard<std::mutex> lock(mtx);
+    auto& cache = caches[ctx];
+    if (!cache) {
+        cache = std::make_shared<jitify::JitCache>();
+    }
+    return cache;
+}
+#endif //#if ENABLE_NVRTC
+
 NVEncFilterCustom::NVEncFilterCustom()
 #if ENABLE_NVRTC
     : m_kernel_cache(), m_program()
@@ -143,7 +163,10 @@ RGY_ERR NVEncFilterCustom::init(shared_ptr<NVEncFilterParam> pParam, shared_ptr<
         AddMessage(RGY_LOG_DEBUG, _T("program source will be read from \"%s\".\n"), prm->custom.kernel_path.c_str());
     }
     try {
-        m_program.reset(new jitify::Program(m_kernel_cache, program_source, 0, split(prm->custom.compile_options, " ", true)));
+        if (!m_kernel_cache) {
+            m_kernel_cache = get_kernel_cache();
+        }
+        m_program.reset(new jitify::Program(*m_kernel_cache, program_source, 0, split(prm->custom.compile_options, " ", true)));
     } catch (const std::exception& e) {
         AddMessage(RGY_LOG_ERROR, _T("failed to build program source.\n%s\n"), char_to_tstring(e.what()).c_str());
         return RGY_ERR_CUDA;
@@ -87,7 +87,7 @@ protected:
     virtual RGY_ERR run_planes(RGYFrameInfo *ppOutputFrames, const RGYFrameInfo *pInputFrame, cudaStream_t stream);
 
 #if ENABLE_NVRTC
-    jitify::JitCache m_kernel_cache;
+    std::shared_ptr<jitify::JitCache> m_kernel_cache;
     unique_ptr<jitify::Program> m_program;
 #endif //#if ENABLE_NVRTC
 };
@@ -449,38 +449,46 @@ NVEncFilterDecimateFrameData::NVEncFilterDecimateFrameData() :
     m_inFrameId(-1),
     m_blockX(0),
     m_blockY(0),
-    m_buf(),
+    m_entry(),
+    m_frame(),
     m_tmp(std::make_unique<CUMemBufPair>()),
+    m_diffReady(false),
     m_diffMaxBlock(std::numeric_limits<int64_t>::max()),
-    m_diffTotal(std::numeric_limits<int64_t>::max()) {
+    m_diffTotal(std::numeric_limits<int64_t>::max()),
+    m_scene() {
 }
 
 NVEncFilterDecimateFrameData::~NVEncFilterDecimateFrameData() {
-    m_buf.reset();
+    m_entry.reset();
+    m_scene.reset();
 }
 
-RGY_ERR NVEncFilterDecimateFrameData::set(const RGYFrameInfo *pInputFrame, int inputFrameId, int blockSizeX, int blockSizeY, cudaStream_t stream) {
+RGY_ERR NVEncFilterDecimateFrameData::set(NVEncFilterFrameCache *cache, const RGYFrameInfo *pInputFrame, int inputFrameId, int blockSizeX, int blockSizeY, cudaStream_t stream) {
     m_inFrameId = inputFrameId;
     m_blockX = blockSizeX;
     m_blockY = blockSizeY;
+    m_diffReady = false;
     m_diffMaxBlock = std::numeric_limits<int64_t>::max();
     m_diffTotal = std::numeric_limits<int64_t>::max();
-    if (!m_buf) {
-        m_buf = std::make_unique<CUFrameBuf>();
-        m_buf->alloc(pInputFrame->width, pInputFrame->height, pInputFrame->csp);
+    m_scene.reset();
+    if (auto data = std::find_if(pInputFrame->dataList.begin(), pInputFrame->dataList.end(), [](const std::shared_ptr<RGYFrameData>& frameData) {
+        return frameData->dataType() == RGY_FRAME_DATA_SCENE;
+    }); data != pInputFrame->dataList.end()) {
+        m_scene = std::dynamic_pointer_cast<RGYFrameDataScene>(*data);
     }
-    auto sts = m_buf->copyFrameAsync(pInputFrame, stream);
+    auto sts = cache->add(m_entry, pInputFrame, stream);
     if (sts != RGY_ERR_NONE) {
         return sts;
     }
     CUDA_DEBUG_SYNC_ERR;
-    copyFrameProp(&m_buf->frame, pInputFrame);
+    m_frame = *m_entry->frame();
+    copyFramePropWithoutRes(&m_frame, pInputFrame);
     return RGY_ERR_NONE;
 }
 
 RGY_ERR NVEncFilterDecimateFrameData::calcDiff(funcCalcDiff func, const NVEncFilterDecimateFrameData *target, const bool chroma,
     cudaStream_t streamDiff, cudaEvent_t eventTransfer, cudaStream_t streamTransfer) {
-    func(&m_buf->frame, &target->get()->frame, m_tmp.get(),
+    func(&m_frame, target->get(), m_tmp.get(),
         m_blockX, m_blockY, chroma,
         streamDiff, eventTransfer, streamTransfer);
     return err_to_rgy(cudaGetLastError());
@@ -492,6 +500,9 @@ void NVEncFilterDecimateFrameData::calcDiffFromTmp() {
         m_diffTotal = std::numeric_limits<int64_t>::max();
         return;
     }
+    if (m_diffReady) {
+        return;
+    }
     const int blockHalfX = m_blockX / 2;
     const int blockHalfY = m_blockY / 2;
     const bool useKernel2 = (m_blockX / 2 <= DECIMATE_KERNEL2_BLOCK_X_THRESHOLD);
@@ -505,8 +516,8 @@ void NVEncFilterDecimateFrameData::calcDiffFromTmp() {
             m_diffMaxBlock = std::max<int64_t>(m_diffMaxBlock, tmpHost[i].y);
         }
     } else {
-        const int blockXHalfCount = divCeil(m_buf->frame.width, blockHalfX);
-        const int blockYHalfCount = divCeil(m_buf->frame.height, blockHalfY);
+        const int blockXHalfCount = divCeil(m_frame.width, blockHalfX);
+        const int blockYHalfCount = divCeil(m_frame.height, blockHalfY);
         const int blockXYHalfCount = blockXHalfCount * blockYHalfCount;
 
         int *const tmpHost = (int *)m_tmp->ptrHost;
@@ -525,29 +536,52 @@ void NVEncFilterDecimateFrameData::calcDiffFromTmp() {
     }
 }
 
-NVEncFilterDecimateCache::NVEncFilterDecimateCache() : m_inputFrames(0), m_frames() {
+bool NVEncFilterDecimateFrameData::sceneChange() const {
+    return m_scene && m_scene->sceneChange();
+}
+
+void NVEncFilterDecimateFrameData::setDiff(int64_t diffMaxBlock, int64_t diffTotal) {
+    m_diffMaxBlock = diffMaxBlock;
+    m_diffTotal = diffTotal;
+    m_diffReady = true;
+}
+
+NVEncFilterDecimateCache::NVEncFilterDecimateCache() : m_cache(), m_subscriber(-1), m_blockX(0), m_blockY(0), m_inputFrames(0), m_frames() {
 
 }
 
 NVEncFilterDecimateCache::~NVEncFilterDecimateCache() {
-    m_frames.clear();
+    close();
 }
 
-void NVEncFilterDecimateCache::init(int bufCount, int blockX, int blockY) {
+void NVEncFilterDecimateCache::init(std::shared_ptr<NVEncFilterFrameCache> cache, int bufCount, int blockX, int blockY) {
+    close();
+    m_cache = cache;
+    m_subscriber = m_cache->subscribe(_T("decimate"), bufCount);
     m_blockX = blockX;
     m_blockY = blockY;
-    m_frames.clear();
+    m_inputFrames = 0;
     for (int i = 0; i < bufCount; i++) {
         m_frames.push_back(std::make_unique<NVEncFilterDecimateFrameData>());
     }
 }
 
+void NVEncFilterDecimateCache::close() {
+    m_frames.clear();
+    if (m_cache) {
+        m_cache->unsubscribe(m_subscriber);
+        m_subscriber = -1;
+    }
+    m_cache.reset();
+}
+
 RGY_ERR NVEncFilterDecimateCache::add(const RGYFrameInfo *pInputFrame, cudaStream_t stream) {
     const int id = m_inputFrames++;
-    return frame(id)->set(pInputFrame, id, m_blockX, m_blockY, stream);
+    return frame(id)->set(m_cache.get(), pInputFrame, id, m_blockX, m_blockY, stream);
 }
 
-NVEncFilterDecimate::NVEncFilterDecimate() : m_flushed(false), m_frameLastDropped(-1), m_frameLastInputDuration(0), m_cache(), m_eventDiff(), m_streamDiff(), m_streamTransfer() {
+NVEncFilterDecimate::NVEncFilterDecimate() : m_flushed(false), m_frameLastDropped(-1), m_frameLastInputDuration(0), m_cache(), m_eventDiff(), m_streamDiff(), m_streamTransfer(),
+    m_analysisWriter(), m_analysisFrames(), m_analysisResult() {
     m_name = _T("decimate");
 }
 
@@ -584,6 +618,57 @@ RGY_ERR NVEncFilterDecimate::checkParam(const std::shared_ptr<NVEncFilterParamDe
         AddMessage(RGY_LOG_ERROR, _T("Invalid blockY: %d.\n"), prm->decimate.blockY);
         return RGY_ERR_INVALID_PARAM;
     }
+    if (prm->decimate.pass > 0 && prm->decimate.analysis.length() == 0) {
+        AddMessage(RGY_LOG_ERROR, _T("analysis file must be set for pass=%d.\n"), prm->decimate.pass);
+        return RGY_ERR_INVALID_PARAM;
+    }
+    return RGY_ERR_NONE;
+}
+
+RGY_ERR NVEncFilterDecimate::initAnalysis(const std::shared_ptr<NVEncFilterParamDecimate> prm) {
+    m_analysisWriter.reset();
+    m_analysisFrames.clear();
+    m_analysisResult.clear();
+    if (prm->decimate.pass == 1) {
+        RGYDecimateAnalysisHeader header = { 0 };
+        header.width = prm->frameIn.width;
+        header.height = prm->frameIn.height;
+        header.bitDepth = RGY_CSP_BIT_DEPTH[prm->frameIn.csp];
+        header.blockX = prm->decimate.blockX;
+        header.blockY = prm->decimate.blockY;
+        header.chroma = (prm->decimate.chroma) ? 1 : 0;
+        m_analysisWriter = std::make_unique<RGYDecimateAnalysisWriter>();
+        auto err = m_analysisWriter->open(prm->decimate.analysis, header);
+        if (err != RGY_ERR_NONE) {
+            AddMessage(RGY_LOG_ERROR, _T("failed to open analysis file \"%s\": %s.\n"), prm->decimate.analysis.c_str(), get_err_mes(err));
+            return err;
+        }
+        AddMessage(RGY_LOG_DEBUG, _T("Opened analysis file for write: %s.\n"), prm->decimate.analysis.c_str());
+    } else if (prm->decimate.pass == 2) {
+        RGYDecimateAnalysisHeader header = { 0 };
+        auto err = rgy_decimate_analysis_read(prm->decimate.analysis, &header, &m_analysisFrames);
+        if (err != RGY_ERR_NONE) {
+            AddMessage(RGY_LOG_ERROR, _T("failed to read analysis file \"%s\": %s.\n"), prm->decimate.analysis.c_str(), get_err_mes(err));
+            return err;
+        }
+        if (header.width != prm->frameIn.width || header.height != prm->frameIn.height
+            || header.bitDepth != RGY_CSP_BIT_DEPTH[prm->frameIn.csp]
+            || header.blockX != prm->decimate.blockX || header.blockY != prm->decimate.blockY
+            || (header.chroma != 0) != prm->decimate.chroma) {
+            AddMessage(RGY_LOG_ERROR, _T("analysis file \"%s\" does not match current settings:\n"), prm->decimate.analysis.c_str());
+            AddMessage(RGY_LOG_ERROR, _T("  file    %dx%d, %dbit, block %dx%d, chroma %s.\n"),
+                header.width, header.height, header.bitDepth, header.blockX, header.blockY, (header.chroma) ? _T("on") : _T("off"));
+            AddMessage(RGY_LOG_ERROR, _T("  current %dx%d, %dbit, block %dx%d, chroma %s.\n"),
+                prm->frameIn.width, prm->frameIn.height, RGY_CSP_BIT_DEPTH[prm->frameIn.csp], prm->decimate.blockX, prm->decimate.blockY, (prm->decimate.chroma) ? _T("on") : _T("off"));
+            return RGY_ERR_INVALID_PARAM;
+        }
+        m_analysisResult = rgy_decimate_solve(m_analysisFrames, prm->decimate.cycle, prm->decimate.drop, m_threDuplicate, m_threSceneChange);
+        const auto dropCount = std::count_if(m_analysisResult.begin(), m_analysisResult.end(), [](const RGYDecimateResult& r) {
+            return (r.flags & RGY_DECIMATE_RESULT_DROP) != 0;
+        });
+        AddMessage(RGY_LOG_DEBUG, _T("Loaded analysis file %s: %d frames, %d frames to drop.\n"),
+            prm->decimate.analysis.c_str(), (int)m_analysisFrames.size(), (int)dropCount);
+    }
     return RGY_ERR_NONE;
 }
 
@@ -602,7 +687,10 @@ RGY_ERR NVEncFilterDecimate::init(shared_ptr<NVEncFilterParam> pParam, shared_pt
 
     if (!m_param || std::dynamic_pointer_cast<NVEncFilterParamDecimate>(m_param)->decimate != prm->decimate) {
 
-        m_cache.init(prm->decimate.cycle + 1, prm->decimate.blockX, prm->decimate.blockY);
+        if (!m_frameCache) {
+            m_frameCache = std::make_shared<NVEncFilterFrameCache>();
+        }
+        m_cache.init(m_frameCache, prm->decimate.cycle + 1, prm->decimate.blockX, prm->decimate.blockY);
 
         pParam->baseFps *= rgy_rational<int>(prm->decimate.cycle - prm->decimate.drop, prm->decimate.cycle);
 
@@ -652,6 +740,10 @@ RGY_ERR NVEncFilterDecimate::init(shared_ptr<NVEncFilterParam> pParam, shared_pt
         m_frameLastDropped = -1;
         m_flushed = false;
 
+        if ((sts = initAnalysis(prm)) != RGY_ERR_NONE) {
+            return sts;
+        }
+
         setFilterInfo(pParam->print());
     }
     m_param = pParam;
@@ -677,7 +769,7 @@ std::vector<DecimateSelectResult> NVEncFilterDecimate::selectDropFrame(const int
                     frameLowest++;
                 }
             } else {
-                if (m_cache.frame(iframe)->diffTotal() > m_threSceneChange) {
+                if (m_cache.frame(iframe)->diffTotal() > m_threSceneChange || m_cache.frame(iframe)->sceneChange()) {
                     frameSceneChange = iframe;
                 }
                 if (m_cache.frame(iframe)->diffMaxBlock() < m_cache.frame(frameLowest)->diffMaxBlock()) {
@@ -707,6 +799,19 @@ std::vector<DecimateSelectResult> NVEncFilterDecimate::selectDropFrame(const int
     return selectResults;
 }
 
+std::vector<DecimateSelectResult> NVEncFilterDecimate::selectDropFrameFromAnalysis(const int iframeStart) {
+    std::vector<DecimateSelectResult> selectResults(m_cache.inframe() - iframeStart, DecimateSelectResult::NONE);
+    for (int iframe = iframeStart; iframe < m_cache.inframe(); iframe++) {
+        const auto& result = m_analysisResult[iframe];
+        auto& select = selectResults[iframe - iframeStart];
+        if (result.flags & RGY_DECIMATE_RESULT_DROP)         select |= DecimateSelectResult::DROP;
+        if (result.flags & RGY_DECIMATE_RESULT_DUPLICATE)    select |= DecimateSelectResult::DUPLICATE;
+        if (result.flags & RGY_DECIMATE_RESULT_SCENE_CHANGE) select |= DecimateSelectResult::SCENE_CHANGE;
+        select |= (uint32_t)result.order;
+    }
+    return selectResults;
+}
+
 RGY_ERR NVEncFilterDecimate::setOutputFrame(int64_t nextTimestamp, RGYFrameInfo **ppOutputFrames, int *pOutputFrameNum) {
     auto prm = std::dynamic_pointer_cast<NVEncFilterParamDecimate>(m_param);
     if (!prm) {
@@ -720,9 +825,22 @@ RGY_ERR NVEncFilterDecimate::setOutputFrame(int64_t nextTimestamp, RGYFrameInfo
     for (int iframe = iframeStart; iframe < m_cache.inframe(); iframe++) {
         m_cache.frame(iframe)->calcDiffFromTmp();
     }
+    if (m_analysisWriter) {
+        for (int iframe = iframeStart; iframe < m_cache.inframe(); iframe++) {
+            RGYDecimateAnalysisFrame analysis;
+            analysis.diffTotal = m_cache.frame(iframe)->diffTotal();
+            analysis.diffMaxBlock = m_cache.frame(iframe)->diffMaxBlock();
+            auto err = m_analysisWriter->write(analysis);
+            if (err != RGY_ERR_NONE) {
+                AddMessage(RGY_LOG_ERROR, _T("failed to write analysis file: %s.\n"), get_err_mes(err));
+                return err;
+            }
+        }
+    }
 
-    //判定
-    const auto selectResults = selectDropFrame(iframeStart);
+    //判定 (解析結果があればクリップ全体から決めたものを使う)
+    const auto selectResults = (m_cache.inframe() <= (int)m_analysisResult.size())
+        ? selectDropFrameFromAnalysis(iframeStart) : selectDropFrame(iframeStart);
     if ((int)selectResults.size() != m_cache.inframe() - iframeStart) {
         AddMessage(RGY_LOG_ERROR, _T("NVEncFilterDecimate::setOutputFrame: unexpected error, %d != %d - %d.\n"), (int)selectResults.size(), m_cache.inframe(), iframeStart);
         return RGY_ERR_UNKNOWN;
@@ -735,7 +853,7 @@ RGY_ERR NVEncFilterDecimate::setOutputFrame(int64_t nextTimestamp, RGYFrameInfo
     std::vector<int64_t> cycleInPts;
     cycleInPts.reserve(prm->decimate.cycle+1);
     for (int iframe = iframeStart; iframe < m_cache.inframe(); iframe++) {
-        auto timestamp = m_cache.frame(iframe)->get()->frame.timestamp;
+        auto timestamp = m_cache.frame(iframe)->get()->timestamp;
         if (timestamp == AV_NOPTS_VALUE) {
             ptsInvalid = true;
         }
@@ -801,7 +919,7 @@ RGY_ERR NVEncFilterDecimate::setOutputFrame(int64_t nextTimestamp, RGYFrameInfo
         if (selectResults[i] & DecimateSelectResult::DROP) {
             m_frameLastDropped = iframe;
         } else {
-            auto frame = &iframeData->get()->frame;
+            auto frame = iframeData->get();
             frame->timestamp = cycleOutPts[iout];
             frame->duration = cycleOutPts[iout + 1] - cycleOutPts[iout];
             if (frame->duration < 0) {
@@ -829,7 +947,7 @@ RGY_ERR NVEncFilterDecimate::calcDiffWithPrevFrameAndSetDiffToCurr(const int cur
     //前のフレームとの差分をとる
     auto frameCurrent = m_cache.frame(curr);
     auto framePrev    = m_cache.frame(prev);
-    const auto csp    = frameCurrent->get()->frame.csp;
+    const auto csp    = frameCurrent->get()->csp;
 
     cudaEventRecord(*m_eventDiff.get(), stream);
     cudaStreamWaitEvent(*m_streamDiff.get(), *m_eventDiff.get(), 0);
@@ -881,6 +999,13 @@ RGY_ERR NVEncFilterDecimate::run_filter(const RGYFrameInfo *pInputFrame, RGYFram
 
         if (pInputFrame->ptr[0] == nullptr) {
             m_flushed = true;
+            if (m_analysisWriter) {
+                AddMessage(RGY_LOG_DEBUG, _T("Wrote analysis of %lld frames.\n"), (long long)m_analysisWriter->frames());
+                if ((sts = m_analysisWriter->close()) != RGY_ERR_NONE) {
+                    AddMessage(RGY_LOG_ERROR, _T("failed to finalize analysis file: %s.\n"), get_err_mes(sts));
+                }
+                m_analysisWriter.reset();
+            }
             return sts;
         }
     }
@@ -892,7 +1017,11 @@ RGY_ERR NVEncFilterDecimate::run_filter(const RGYFrameInfo *pInputFrame, RGYFram
         return sts;
     }
 
-    if (inframeId > 0) {
+    if (inframeId < (int)m_analysisFrames.size()) {
+        //解析結果があれば差分の計算は不要
+        const auto& analysis = m_analysisFrames[inframeId];
+        m_cache.frame(inframeId)->setDiff(analysis.diffMaxBlock, analysis.diffTotal);
+    } else if (inframeId > 0) {
         auto ret = calcDiffWithPrevFrameAndSetDiffToCurr(inframeId + 0, inframeId - 1, stream);
         if (ret != RGY_ERR_NONE) {
             return ret;
@@ -903,6 +1032,10 @@ RGY_ERR NVEncFilterDecimate::run_filter(const RGYFrameInfo *pInputFrame, RGYFram
 
 void NVEncFilterDecimate::close() {
     m_frameBuf.clear();
+    m_cache.close();
+    m_analysisWriter.reset();
+    m_analysisFrames.clear();
+    m_analysisResult.clear();
     m_eventDiff.reset();
     m_streamDiff.reset();
     m_streamTransfer.reset();
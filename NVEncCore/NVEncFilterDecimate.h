@@ -30,6 +30,7 @@
 
 #include "NVEncFilter.h"
 #include "NVEncParam.h"
+#include "rgy_decimate_analysis.h"
 
 class NVEncFilterParamDecimate : public NVEncFilterParam {
 public:
@@ -80,24 +81,29 @@ public:
     NVEncFilterDecimateFrameData();
     ~NVEncFilterDecimateFrameData();
 
-    CUFrameBuf *get() { return m_buf.get(); }
-    const CUFrameBuf *get() const { return m_buf.get(); }
-    RGY_ERR set(const RGYFrameInfo *pInputFrame, int inputFrameId, int blockSizeX, int blockSizeY, cudaStream_t stream);
+    RGYFrameInfo *get() { return &m_frame; }
+    const RGYFrameInfo *get() const { return &m_frame; }
+    RGY_ERR set(NVEncFilterFrameCache *cache, const RGYFrameInfo *pInputFrame, int inputFrameId, int blockSizeX, int blockSizeY, cudaStream_t stream);
     int id() const { return m_inFrameId; }
     RGY_ERR calcDiff(funcCalcDiff func, const NVEncFilterDecimateFrameData *target, const bool chroma,
         cudaStream_t streamDiff, cudaEvent_t eventTransfer, cudaStream_t streamTransfer);
     void calcDiffFromTmp();
+    void setDiff(int64_t diffMaxBlock, int64_t diffTotal);
 
     int64_t diffMaxBlock() const { return m_diffMaxBlock; }
     int64_t diffTotal() const { return m_diffTotal; }
+    bool sceneChange() const; // 入力のシーンチェンジ判定 (--scene-detect)
 private:
     int m_inFrameId;
     int m_blockX;
     int m_blockY;
-    std::unique_ptr<CUFrameBuf> m_buf;
+    std::shared_ptr<NVEncFilterFrameCacheEntry> m_entry; // 画素データは共有のキャッシュから
+    RGYFrameInfo m_frame;                                // フレーム情報はdecimateで書き換えるので個別に持つ
     std::unique_ptr<CUMemBufPair> m_tmp;
+    bool m_diffReady;    // 差分を取得済み (解析結果から)
     int64_t m_diffMaxBlock;
     int64_t m_diffTotal;
+    std::shared_ptr<RGYFrameDataScene> m_scene;
 };
 
 
@@ -105,17 +111,20 @@ class NVEncFilterDecimateCache {
 public:
     NVEncFilterDecimateCache();
     ~NVEncFilterDecimateCache();
-    void init(int bufCount, int blockX, int blockY);
+    void init(std::shared_ptr<NVEncFilterFrameCache> cache, int bufCount, int blockX, int blockY);
+    void close();
     RGY_ERR add(const RGYFrameInfo *pInputFrame, cudaStream_t stream = 0);
     NVEncFilterDecimateFrameData *frame(int iframe) {
         iframe = clamp(iframe, 0, m_inputFrames - 1);
         return m_frames[iframe % m_frames.size()].get();
     }
-    CUFrameBuf *get(int iframe) {
+    RGYFrameInfo *get(int iframe) {
         return frame(iframe)->get();
     }
     int inframe() const { return m_inputFrames; }
 private:
+    std::shared_ptr<NVEncFilterFrameCache> m_cache;
+    int m_subscriber;
     int m_blockX;
     int m_blockY;
     int m_inputFrames;
@@ -134,6 +143,8 @@ protected:
     RGY_ERR setOutputFrame(int64_t nextTimestamp, RGYFrameInfo **ppOutputFrames, int *pOutputFrameNum);
 
     std::vector<DecimateSelectResult> selectDropFrame(const int iframeStart);
+    std::vector<DecimateSelectResult> selectDropFrameFromAnalysis(const int iframeStart);
+    RGY_ERR initAnalysis(const std::shared_ptr<NVEncFilterParamDecimate> prm);
     RGY_ERR calcDiffWithPrevFrameAndSetDiffToCurr(const int curr, const int prev, cudaStream_t stream);
 
     bool m_flushed;
@@ -147,4 +158,7 @@ protected:
     std::unique_ptr<cudaStream_t, cudastream_deleter> m_streamDiff;
     std::unique_ptr<cudaStream_t, cudastream_deleter> m_streamTransfer;
     unique_ptr<FILE, fp_deleter> m_fpLog;
+    std::unique_ptr<RGYDecimateAnalysisWriter> m_analysisWriter; // pass=1
+    std::vector<RGYDecimateAnalysisFrame> m_analysisFrames;      // pass=2
+    std::vector<RGYDecimateResult> m_analysisResult;             // pass=2
 };
@@ -0,0 +1,199 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2024 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// --------------------------------------------------------------------------------------------
+
+#include <algorithm>
+#include "NVEncFilterFrameCache.h"
+#include "rgy_util.h"
+
+static size_t frameBufBytes(const RGYFrameInfo *frame) {
+    size_t bytes = 0;
+    for (int i = 0; i < RGY_CSP_PLANES[frame->csp]; i++) {
+        const auto plane = getPlane(frame, (RGY_PLANE)i);
+        bytes += (size_t)plane.pitch[0] * plane.height;
+    }
+    return bytes;
+}
+
+NVEncFilterFrameCacheEntry::NVEncFilterFrameCacheEntry(std::weak_ptr<NVEncFilterFrameCache> cache, std::unique_ptr<CUFrameBuf> buf, int64_t id) :
+    m_cache(cache),
+    m_buf(std::move(buf)),
+    m_id(id) {
+}
+
+NVEncFilterFrameCacheEntry::~NVEncFilterFrameCacheEntry() {
+    auto cache = m_cache.lock();
+    if (cache) {
+        cache->release(m_buf);
+    }
+    m_buf.reset();
+}
+
+NVEncFilterFrameCache::NVEncFilterFrameCache() :
+    m_mtx(),
+    m_subscribers(),
+    m_entries(),
+    m_free(),
+    m_nextSubscriber(0),
+    m_nextId(0),
+    m_windowTotal(0),
+    m_allocFrames(0),
+    m_allocFramesPeak(0),
+    m_frameBytes(0),
+    m_allocBytesPeak(0),
+    m_privateBytesPeak(0),
+    m_copied(0),
+    m_shared(0) {
+}
+
+NVEncFilterFrameCache::~NVEncFilterFrameCache() {
+    m_free.clear();
+    m_entries.clear();
+}
+
+int NVEncFilterFrameCache::subscribe(const tstring& name, int window) {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    const int id = m_nextSubscriber++;
+    m_subscribers[id] = Subscriber{ name, window };
+    m_windowTotal += window;
+    return id;
+}
+
+void NVEncFilterFrameCache::unsubscribe(int subscriber) {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    auto it = m_subscribers.find(subscriber);
+    if (it == m_subscribers.end()) {
+        return;
+    }
+    m_windowTotal -= it->second.window;
+    m_subscribers.erase(it);
+    //不要になった空きバッファを解放する
+    while (m_free.size() > 0 && m_allocFrames > m_windowTotal) {
+        m_free.pop_back();
+        m_allocFrames--;
+    }
+}
+
+int NVEncFilterFrameCache::subscribers() const {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    return (int)m_subscribers.size();
+}
+
+void NVEncFilterFrameCache::release(std::unique_ptr<CUFrameBuf>& buf) {
+    if (!buf) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(m_mtx);
+    auto it = m_entries.find(buf->frame.ptr[0]);
+    if (it != m_entries.end() && it->second.expired()) {
+        m_entries.erase(it);
+    }
+    if (m_allocFrames > m_windowTotal) {
+        //どのウィンドウにも不要なバッファは解放する
+        buf.reset();
+        m_allocFrames--;
+    } else {
+        m_free.push_back(std::move(buf));
+    }
+}
+
+RGY_ERR NVEncFilterFrameCache::add(std::shared_ptr<NVEncFilterFrameCacheEntry>& entry, const RGYFrameInfo *pInputFrame, cudaStream_t stream) {
+    //先に以前のエントリを手放し、そのバッファを再利用できるようにする
+    entry.reset();
+    if (pInputFrame == nullptr || pInputFrame->ptr[0] == nullptr) {
+        return RGY_ERR_NULL_PTR;
+    }
+    std::shared_ptr<NVEncFilterFrameCacheEntry> existing;
+    std::unique_ptr<CUFrameBuf> buf;
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        auto it = m_entries.find(pInputFrame->ptr[0]);
+        if (it != m_entries.end()) {
+            existing = it->second.lock();
+        }
+        if (existing
+            && !cmpFrameInfoCspResolution(existing->frame(), pInputFrame)
+            && existing->frame()->pitch[0] == pInputFrame->pitch[0]) {
+            //上流のフィルタがキャッシュのフレームをそのまま出力している
+            m_shared++;
+        } else {
+            existing.reset();
+            auto itFree = std::find_if(m_free.begin(), m_free.end(), [pInputFrame](const std::unique_ptr<CUFrameBuf>& b) {
+                return !cmpFrameInfoCspResolution(&b->frame, pInputFrame);
+            });
+            if (itFree != m_free.end()) {
+                buf = std::move(*itFree);
+                m_free.erase(itFree);
+            }
+        }
+    }
+    if (existing) {
+        entry = existing;
+        return RGY_ERR_NONE;
+    }
+    if (!buf) {
+        buf = std::make_unique<CUFrameBuf>(pInputFrame->width, pInputFrame->height, pInputFrame->csp);
+        auto err = buf->alloc();
+        if (err != RGY_ERR_NONE) {
+            return err;
+        }
+        std::lock_guard<std::mutex> lock(m_mtx);
+        m_allocFrames++;
+        m_frameBytes = std::max(m_frameBytes, frameBufBytes(&buf->frame));
+        m_allocFramesPeak = std::max(m_allocFramesPeak, m_allocFrames);
+        m_allocBytesPeak = std::max(m_allocBytesPeak, m_allocFrames * m_frameBytes);
+        m_privateBytesPeak = std::max(m_privateBytesPeak, m_windowTotal * m_frameBytes);
+    }
+    auto err = copyFrameAsync(&buf->frame, pInputFrame, stream);
+    if (err != RGY_ERR_NONE) {
+        release(buf);
+        return err;
+    }
+    copyFramePropWithoutRes(&buf->frame, pInputFrame);
+
+    std::lock_guard<std::mutex> lock(m_mtx);
+    m_copied++;
+    entry = std::make_shared<NVEncFilterFrameCacheEntry>(shared_from_this(), std::move(buf), m_nextId++);
+    m_entries[entry->frame()->ptr[0]] = entry;
+    return RGY_ERR_NONE;
+}
+
+tstring NVEncFilterFrameCache::print() const {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    if (m_subscribers.size() == 0) {
+        return tstring();
+    }
+    tstring str;
+    for (const auto& s : m_subscribers) {
+        str += strsprintf(_T("%s%s(%d)"), (str.length() > 0) ? _T(", ") : _T(""), s.second.name.c_str(), s.second.window);
+    }
+    const double allocMB = m_allocBytesPeak / (double)(1024 * 1024);
+    const double privateMB = m_privateBytesPeak / (double)(1024 * 1024);
+    str += strsprintf(_T(": peak %d frames (%.1f MB), private caches %.1f MB, saved %.1f MB, shared %lld / copied %lld frames"),
+        m_allocFramesPeak, allocMB, privateMB, std::max(privateMB - allocMB, 0.0),
+        (long long)m_shared, (long long)m_copied);
+    return str;
+}
@@ -0,0 +1,105 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2024 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// --------------------------------------------------------------------------------------------
+
+#pragma once
+#ifndef __NVENC_FILTER_FRAME_CACHE_H__
+#define __NVENC_FILTER_FRAME_CACHE_H__
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <map>
+#include <unordered_map>
+#include <vector>
+#include "rgy_tchar.h"
+#include "rgy_err.h"
+#include "rgy_frame_info.h"
+#include "rgy_cuda_util.h"
+
+class NVEncFilterFrameCache;
+
+// キャッシュ内の1フレーム
+// 画素データは読み取り専用で、どのフィルタからも参照されなくなった時点でバッファがキャッシュに返却される
+// タイムスタンプなどのフレーム情報はフィルタごとに異なりうるので、各フィルタが入力から取得すること
+class NVEncFilterFrameCacheEntry {
+public:
+    NVEncFilterFrameCacheEntry(std::weak_ptr<NVEncFilterFrameCache> cache, std::unique_ptr<CUFrameBuf> buf, int64_t id);
+    ~NVEncFilterFrameCacheEntry();
+
+    int64_t id() const { return m_id; }
+    const RGYFrameInfo *frame() const { return &m_buf->frame; }
+private:
+    NVEncFilterFrameCacheEntry(const NVEncFilterFrameCacheEntry&) = delete;
+    NVEncFilterFrameCacheEntry& operator=(const NVEncFilterFrameCacheEntry&) = delete;
+
+    std::weak_ptr<NVEncFilterFrameCache> m_cache;
+    std::unique_ptr<CUFrameBuf> m_buf;
+    int64_t m_id;
+};
+
+// 時間方向フィルタで共有するフレームキャッシュ
+// 各フィルタは保持するフレーム数(ウィンドウ)を登録し、add()で得たエントリを保持している間だけフレームが残る
+// 入力がすでにキャッシュ内のフレーム(上流のフィルタがキャッシュのフレームをそのまま出力した場合など)であれば、
+// コピーせずにそのエントリを共有する
+class NVEncFilterFrameCache : public std::enable_shared_from_this<NVEncFilterFrameCache> {
+public:
+    NVEncFilterFrameCache();
+    ~NVEncFilterFrameCache();
+
+    // 保持するフレーム数(過去+現在+未来)を登録し、登録IDを返す
+    int subscribe(const tstring& name, int window);
+    void unsubscribe(int subscriber);
+
+    RGY_ERR add(std::shared_ptr<NVEncFilterFrameCacheEntry>& entry, const RGYFrameInfo *pInputFrame, cudaStream_t stream);
+
+    int subscribers() const;
+    tstring print() const;
+protected:
+    friend class NVEncFilterFrameCacheEntry;
+    void release(std::unique_ptr<CUFrameBuf>& buf);
+
+    struct Subscriber {
+        tstring name;
+        int window;
+    };
+    mutable std::mutex m_mtx;
+    std::map<int, Subscriber> m_subscribers;
+    std::unordered_map<const uint8_t *, std::weak_ptr<NVEncFilterFrameCacheEntry>> m_entries;
+    std::vector<std::unique_ptr<CUFrameBuf>> m_free;
+    int m_nextSubscriber;
+    int64_t m_nextId;
+    int m_windowTotal;      // 登録されたウィンドウの合計
+    int m_allocFrames;      // 確保済みのフレーム数 (使用中+空き)
+    int m_allocFramesPeak;
+    size_t m_frameBytes;
+    size_t m_allocBytesPeak;
+    size_t m_privateBytesPeak; // 各フィルタが個別にキャッシュを持った場合に必要なサイズ
+    int64_t m_copied;
+    int64_t m_shared;
+};
+
+#endif //__NVENC_FILTER_FRAME_CACHE_H__
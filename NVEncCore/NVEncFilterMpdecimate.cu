@@ -136,30 +136,29 @@ RGY_ERR calc_block_diff_frame(const RGYFrameInfo *p0, const RGYFrameInfo *p1, RG
 NVEncFilterMpdecimateFrameData::NVEncFilterMpdecimateFrameData(std::shared_ptr<RGYLog> log) :
     m_log(log),
     m_inFrameId(-1),
-    m_buf(),
+    m_entry(),
+    m_frame(),
     m_tmp() {
 
 }
 
 NVEncFilterMpdecimateFrameData::~NVEncFilterMpdecimateFrameData() {
-    m_buf.clear();
+    m_entry.reset();
 }
 
-RGY_ERR NVEncFilterMpdecimateFrameData::set(const RGYFrameInfo *pInputFrame, int inputFrameId, cudaStream_t stream) {
+RGY_ERR NVEncFilterMpdecimateFrameData::set(NVEncFilterFrameCache *cache, const RGYFrameInfo *pInputFrame, int inputFrameId, cudaStream_t stream) {
     m_inFrameId = inputFrameId;
-    if (m_buf.frame.ptr[0] == nullptr) {
-        m_buf.alloc(pInputFrame->width, pInputFrame->height, pInputFrame->csp);
-    }
     if (m_tmp.frameDev.frame.ptr[0] == nullptr) {
         m_tmp.alloc(divCeil(pInputFrame->width, 8), divCeil(pInputFrame->height, 8), RGY_CSP_YUV444_32);
     }
 
-    auto sts = m_buf.copyFrameAsync(pInputFrame, stream);
+    auto sts = cache->add(m_entry, pInputFrame, stream);
     if (sts != RGY_ERR_NONE) {
         m_log->write(RGY_LOG_ERROR, RGY_LOGT_VPP, _T("failed to set frame to data cache: %s.\n"), get_err_mes(sts));
         return sts;
     }
-    copyFrameProp(&m_buf.frame, pInputFrame);
+    m_frame = *m_entry->frame();
+    copyFramePropWithoutRes(&m_frame, pInputFrame);
     return RGY_ERR_NONE;
 }
 
@@ -171,11 +170,11 @@ RGY_ERR NVEncFilterMpdecimateFrameData::calcDiff(const NVEncFilterMpdecimateFram
         { RGY_CSP_YUV444,    calc_block_diff_frame<uchar4>  },
         { RGY_CSP_YUV444_16, calc_block_diff_frame<ushort4> }
     };
-    if (func_list.count(ref->m_buf.frame.csp) == 0) {
-        m_log->write(RGY_LOG_ERROR, RGY_LOGT_VPP, _T("unsupported csp %s.\n"), RGY_CSP_NAMES[ref->m_buf.frame.csp]);
+    if (func_list.count(ref->m_frame.csp) == 0) {
+        m_log->write(RGY_LOG_ERROR, RGY_LOGT_VPP, _T("unsupported csp %s.\n"), RGY_CSP_NAMES[ref->m_frame.csp]);
         return RGY_ERR_UNSUPPORTED;
     }
-    auto sts = func_list.at(ref->m_buf.frame.csp)(&m_buf.frame, &ref->get()->frame, &m_tmp.frameDev.frame, streamDiff);
+    auto sts = func_list.at(ref->m_frame.csp)(&m_frame, ref->get(), &m_tmp.frameDev.frame, streamDiff);
     if (sts != RGY_ERR_NONE) {
         m_log->write(RGY_LOG_ERROR, RGY_LOGT_VPP, _T("failed to run calcDiff: %s.\n"), get_err_mes(sts));
         return RGY_ERR_CUDA;
@@ -199,8 +198,8 @@ RGY_ERR NVEncFilterMpdecimateFrameData::calcDiff(const NVEncFilterMpdecimateFram
 bool NVEncFilterMpdecimateFrameData::checkIfFrameCanbeDropped(const int hi, const int lo, const float factor) {
     const int threshold = (int)((float)m_tmp.frameHost.frame.width * m_tmp.frameHost.frame.height * factor + 0.5f);
     int loCount = 0;
-    for (int iplane = 0; iplane < RGY_CSP_PLANES[m_buf.frame.csp]; iplane++) {
-        const auto plane = getPlane(&m_buf.frame, (RGY_PLANE)iplane);
+    for (int iplane = 0; iplane < RGY_CSP_PLANES[m_frame.csp]; iplane++) {
+        const auto plane = getPlane(&m_frame, (RGY_PLANE)iplane);
         const int blockw = divCeil(plane.width, 8);
         const int blockh = divCeil(plane.height, 8);
         const auto planeHost = getPlane(&m_tmp.frameHost.frame, (RGY_PLANE)iplane);
@@ -223,25 +222,37 @@ bool NVEncFilterMpdecimateFrameData::checkIfFrameCanbeDropped(const int hi, cons
     return true;
 }
 
-NVEncFilterMpdecimateCache::NVEncFilterMpdecimateCache() : m_inputFrames(0), m_frames() {
+NVEncFilterMpdecimateCache::NVEncFilterMpdecimateCache() : m_log(), m_cache(), m_subscriber(-1), m_inputFrames(0), m_frames() {
 
 }
 
 NVEncFilterMpdecimateCache::~NVEncFilterMpdecimateCache() {
-    m_frames.clear();
+    close();
 }
 
-void NVEncFilterMpdecimateCache::init(int bufCount, std::shared_ptr<RGYLog> log) {
+void NVEncFilterMpdecimateCache::init(std::shared_ptr<NVEncFilterFrameCache> cache, int bufCount, std::shared_ptr<RGYLog> log) {
+    close();
     m_log = log;
-    m_frames.clear();
+    m_cache = cache;
+    m_subscriber = m_cache->subscribe(_T("mpdecimate"), bufCount);
+    m_inputFrames = 0;
     for (int i = 0; i < bufCount; i++) {
         m_frames.push_back(std::make_unique<NVEncFilterMpdecimateFrameData>(log));
     }
 }
 
+void NVEncFilterMpdecimateCache::close() {
+    m_frames.clear();
+    if (m_cache) {
+        m_cache->unsubscribe(m_subscriber);
+        m_subscriber = -1;
+    }
+    m_cache.reset();
+}
+
 RGY_ERR NVEncFilterMpdecimateCache::add(const RGYFrameInfo *pInputFrame, cudaStream_t stream) {
     const int id = m_inputFrames++;
-    return getEmpty()->set(pInputFrame, id, stream);
+    return getEmpty()->set(m_cache.get(), pInputFrame, id, stream);
 }
 
 NVEncFilterMpdecimate::NVEncFilterMpdecimate() : m_dropCount(0), m_ref(-1), m_target(-1), m_cache(), m_eventDiff(), m_streamDiff(), m_streamTransfer() {
@@ -287,7 +298,10 @@ RGY_ERR NVEncFilterMpdecimate::init(shared_ptr<NVEncFilterParam> pParam, shared_
 
     if (!m_param || std::dynamic_pointer_cast<NVEncFilterParamMpdecimate>(m_param)->mpdecimate != prm->mpdecimate) {
 
-        m_cache.init(2, m_pLog);
+        if (!m_frameCache) {
+            m_frameCache = std::make_shared<NVEncFilterFrameCache>();
+        }
+        m_cache.init(m_frameCache, 2, m_pLog);
 
         m_eventDiff = std::unique_ptr<cudaEvent_t, cudaevent_deleter>(new cudaEvent_t(), cudaevent_deleter());
         if (RGY_ERR_NONE != (sts = err_to_rgy(cudaEventCreateWithFlags(m_eventDiff.get(), cudaEventDisableTiming)))) {
@@ -358,7 +372,7 @@ bool NVEncFilterMpdecimate::dropFrame(NVEncFilterMpdecimateFrameData *targetFram
         (m_dropCount - 1) > prm->mpdecimate.max) {
         return false;
     }
-    const int bit_depth = RGY_CSP_BIT_DEPTH[targetFrame->get()->frame.csp];
+    const int bit_depth = RGY_CSP_BIT_DEPTH[targetFrame->get()->csp];
     return targetFrame->checkIfFrameCanbeDropped(prm->mpdecimate.hi << (bit_depth - 8), prm->mpdecimate.lo << (bit_depth - 8), prm->mpdecimate.frac);
 }
 
@@ -383,7 +397,7 @@ RGY_ERR NVEncFilterMpdecimate::run_filter(const RGYFrameInfo *pInputFrame, RGYFr
             return err;
         }
         *pOutputFrameNum = 1;
-        ppOutputFrames[0] = &m_cache.get(m_ref)->frame;
+        ppOutputFrames[0] = m_cache.get(m_ref);
         if (m_fpLog) {
             fprintf(m_fpLog.get(), "  %8d: %10lld\n", m_ref, (long long)ppOutputFrames[0]->timestamp);
         }
@@ -396,7 +410,7 @@ RGY_ERR NVEncFilterMpdecimate::run_filter(const RGYFrameInfo *pInputFrame, RGYFr
 
         const bool drop = dropFrame(targetFrame) && pInputFrame->ptr[0] != nullptr; //最終フレームは必ず出力する
         if (m_fpLog) {
-            fprintf(m_fpLog.get(), "%s %8d: %10lld\n", (drop) ? "d" : " ", m_target, (long long)targetFrame->get()->frame.timestamp);
+            fprintf(m_fpLog.get(), "%s %8d: %10lld\n", (drop) ? "d" : " ", m_target, (long long)targetFrame->get()->timestamp);
         }
         if (drop) {
             targetFrame->reset();
@@ -410,7 +424,7 @@ RGY_ERR NVEncFilterMpdecimate::run_filter(const RGYFrameInfo *pInputFrame, RGYFr
             m_ref = m_target;
             m_target = -1;
             *pOutputFrameNum = 1;
-            ppOutputFrames[0] = &targetFrame->get()->frame;
+            ppOutputFrames[0] = targetFrame->get();
         }
     }
     if (pInputFrame->ptr[0] != nullptr) {
@@ -433,6 +447,7 @@ RGY_ERR NVEncFilterMpdecimate::run_filter(const RGYFrameInfo *pInputFrame, RGYFr
 
 void NVEncFilterMpdecimate::close() {
     m_frameBuf.clear();
+    m_cache.close();
     m_eventDiff.reset();
     m_streamDiff.reset();
     m_streamTransfer.reset();
@@ -49,18 +49,19 @@ public:
     NVEncFilterMpdecimateFrameData(std::shared_ptr<RGYLog> log);
     ~NVEncFilterMpdecimateFrameData();
 
-    CUFrameBuf *get() { return &m_buf; }
-    const CUFrameBuf *get() const { return &m_buf; }
-    RGY_ERR set(const RGYFrameInfo *pInputFrame, int inputFrameId, cudaStream_t stream);
+    RGYFrameInfo *get() { return &m_frame; }
+    const RGYFrameInfo *get() const { return &m_frame; }
+    RGY_ERR set(NVEncFilterFrameCache *cache, const RGYFrameInfo *pInputFrame, int inputFrameId, cudaStream_t stream);
     int id() const { return m_inFrameId; }
-    void reset() { m_inFrameId = -1; }
+    void reset() { m_inFrameId = -1; m_entry.reset(); }
     RGY_ERR calcDiff(const NVEncFilterMpdecimateFrameData *ref,
         cudaStream_t streamDiff, cudaEvent_t eventTransfer, cudaStream_t streamTransfer);
     bool checkIfFrameCanbeDropped(const int hi, const int lo, const float factor);
 private:
     std::shared_ptr<RGYLog> m_log;
     int m_inFrameId;
-    CUFrameBuf m_buf;
+    std::shared_ptr<NVEncFilterFrameCacheEntry> m_entry; // 画素データは共有のキャッシュから
+    RGYFrameInfo m_frame;
     CUFrameBufPair m_tmp;
 };
 
@@ -68,7 +69,8 @@ class NVEncFilterMpdecimateCache {
 public:
     NVEncFilterMpdecimateCache();
     ~NVEncFilterMpdecimateCache();
-    void init(int bufCount, std::shared_ptr<RGYLog> log);
+    void init(std::shared_ptr<NVEncFilterFrameCache> cache, int bufCount, std::shared_ptr<RGYLog> log);
+    void close();
     RGY_ERR add(const RGYFrameInfo *pInputFrame, cudaStream_t stream = 0);
     void removeFromCache(int iframe) {
         for (auto &f : m_frames) {
@@ -94,12 +96,14 @@ public:
         }
         return nullptr;
     }
-    CUFrameBuf *get(int iframe) {
+    RGYFrameInfo *get(int iframe) {
         return frame(iframe)->get();
     }
     int inframe() const { return m_inputFrames; }
 private:
     std::shared_ptr<RGYLog> m_log;
+    std::shared_ptr<NVEncFilterFrameCache> m_cache;
+    int m_subscriber;
     int m_inputFrames;
     std::vector<std::unique_ptr<NVEncFilterMpdecimateFrameData>> m_frames;
 };
@@ -32,6 +32,7 @@
 #include <fstream>
 #include <algorithm>
 #include <numeric>
+#include <chrono>
 #define _USE_MATH_DEFINES
 #include <cmath>
 #include "convert_csp.h"
@@ -49,12 +50,14 @@
 #include "rgy_cuda_util_kernel.h"
 #include "rgy_filesystem.h"
 #include "rgy_resource.h"
+#include "rgy_nnedi_weight_cache.h"
 
 static const int NNEDI_BLOCK_X       = 32;
 static const int NNEDI_BLOCK_Y       = 8;
 
 static const int weight0size = 49 * 4 + 5 * 4 + 9 * 4;
 static const int weight0sizenew = 4 * 65 + 4 * 5;
+static const uint32_t weightBinSize = 13574928u;
 
 __device__ __inline__
 static float exp_(float val) {
@@ -1405,7 +1408,7 @@ RGY_ERR NVEncFilterNnedi::checkParam(const std::shared_ptr<NVEncFilterParamNnedi
 
 shared_ptr<const float> NVEncFilterNnedi::readWeights(const tstring& weightFile, HMODULE hModule) {
     shared_ptr<const float> weights;
-    const uint32_t expectedFileSize = 13574928u;
+    const uint32_t expectedFileSize = weightBinSize;
     uint64_t weightFileSize = 0;
     if (weightFile.length() == 0) {
         //埋め込みデータを使用する
@@ -1455,55 +1458,92 @@ shared_ptr<const float> NVEncFilterNnedi::readWeights(const tstring& weightFile,
 }
 
 RGY_ERR NVEncFilterNnedi::initParams(const std::shared_ptr<NVEncFilterParamNnedi> pNnediParam) {
-    auto weights = readWeights(pNnediParam->nnedi.weightfile, pNnediParam->hModule);
-    if (!weights) {
-        return RGY_ERR_INVALID_PARAM;
-    }
+    const auto timeStart = std::chrono::system_clock::now();
+    //変換後の重みは設定ごとにプロセス内で共有し、キャッシュファイルにも保存しておく
+    RGYNnediWeightKey key;
+    key.nns = (uint32_t)pNnediParam->nnedi.nns;
+    key.nsize = (uint32_t)pNnediParam->nnedi.nsize;
+    key.errortype = (uint32_t)pNnediParam->nnedi.errortype;
+    key.precision = (uint32_t)pNnediParam->nnedi.precision;
+    key.prescreen = (uint32_t)(pNnediParam->nnedi.pre_screen & VPP_NNEDI_PRE_SCREEN_MODE);
+    key.layout = ((ENABLE_DP1_WEIGHT_ARRAY_OPT) ? 0x01 : 0x00) | (weight_loop_1 << 4);
+    tstring cacheDir;
+    if (pNnediParam->nnedi.weightfile.length() == 0) {
+        //埋め込みデータの場合は、実行ファイル(モジュール)の更新時刻で検証する
+        //実行ファイルのフォルダは書き込めないことが多いので、ユーザーごとのキャッシュ用フォルダに保存する
+#if defined(_WIN32) || defined(_WIN64)
+        const auto modulePath = getModulePath((pNnediParam->hModule) ? pNnediParam->hModule : GetModuleHandle(NULL));
+#else
+        const auto modulePath = getExePath();
+#endif
+        key.srcFileSize = weightBinSize;
+        if (modulePath.length() > 0 && rgy_get_filetime(modulePath.c_str(), &key.srcFileTime)) {
+            cacheDir = rgy_get_user_cache_dir(_T("NVEnc"));
+        }
+    } else if (rgy_get_filesize(pNnediParam->nnedi.weightfile.c_str(), &key.srcFileSize)
+        && rgy_get_filetime(pNnediParam->nnedi.weightfile.c_str(), &key.srcFileTime)) {
+        cacheDir = PathRemoveFileSpecFixed(pNnediParam->nnedi.weightfile).second;
+    }
+    auto prepare = [&](std::vector<uint8_t>& weight0, std::array<std::vector<uint8_t>, 2>& weight1) {
+        auto weights = readWeights(pNnediParam->nnedi.weightfile, pNnediParam->hModule);
+        if (!weights) {
+            return RGY_ERR_INVALID_PARAM;
+        }
 
-    const int weight1size = pNnediParam->nnedi.nns * 2 * (sizeNX[pNnediParam->nnedi.nsize] * sizeNY[pNnediParam->nnedi.nsize] + 1);
-    const int sizeofweight = (pNnediParam->nnedi.precision == VPP_FP_PRECISION_FP32) ? 4 : 2;
-    int weight1size_tsize = 0;
-    int weight1size_offset = 0;
-    for (int j = 0; j < (int)_countof(sizeNN); j++) {
-        for (int i = 0; i < (int)_countof(sizeNX); i++) {
-            if (i == pNnediParam->nnedi.nsize
-                && j == get_cx_index(list_vpp_nnedi_nns, pNnediParam->nnedi.nns)) {
-                weight1size_offset = weight1size_tsize;
+        const int weight1size = pNnediParam->nnedi.nns * 2 * (sizeNX[pNnediParam->nnedi.nsize] * sizeNY[pNnediParam->nnedi.nsize] + 1);
+        const int sizeofweight = (pNnediParam->nnedi.precision == VPP_FP_PRECISION_FP32) ? 4 : 2;
+        int weight1size_tsize = 0;
+        int weight1size_offset = 0;
+        for (int j = 0; j < (int)_countof(sizeNN); j++) {
+            for (int i = 0; i < (int)_countof(sizeNX); i++) {
+                if (i == pNnediParam->nnedi.nsize
+                    && j == get_cx_index(list_vpp_nnedi_nns, pNnediParam->nnedi.nns)) {
+                    weight1size_offset = weight1size_tsize;
+                }
+                weight1size_tsize += sizeNN[j] * (sizeNX[i] * sizeNY[i] + 1) * 4;
             }
-            weight1size_tsize += sizeNN[j] * (sizeNX[i] * sizeNY[i] + 1) * 4;
         }
-    }
 
-    std::vector<char> weight0f;
-    weight0f.resize((((pNnediParam->nnedi.pre_screen & VPP_NNEDI_PRE_SCREEN_MODE) >= VPP_NNEDI_PRE_SCREEN_NEW) ? weight0sizenew : weight0size) * sizeofweight);
-    if (pNnediParam->nnedi.precision == VPP_FP_PRECISION_FP32) {
-        setWeight0<float>((float *)weight0f.data(), weights.get(), pNnediParam);
-    } else {
+        weight0.resize((((pNnediParam->nnedi.pre_screen & VPP_NNEDI_PRE_SCREEN_MODE) >= VPP_NNEDI_PRE_SCREEN_NEW) ? weight0sizenew : weight0size) * sizeofweight);
+        if (pNnediParam->nnedi.precision == VPP_FP_PRECISION_FP32) {
+            setWeight0<float>((float *)weight0.data(), weights.get(), pNnediParam);
+        } else {
 #if ENABLE_CUDA_FP16_HOST
-        setWeight0<__half>((__half *)weight0f.data(), weights.get(), pNnediParam);
+            setWeight0<__half>((__half *)weight0.data(), weights.get(), pNnediParam);
 #endif //#if ENABLE_CUDA_FP16_HOST
-    }
+        }
 
-    std::array<std::vector<char>, 2> weight1;
-    for (int i = 0; i < 2; i++) {
-        weight1[i].resize(weight1size * sizeofweight, 0);
-        const float *ptrW = weights.get() + weight0size + weight0sizenew * 3 + weight1size_tsize * pNnediParam->nnedi.errortype + weight1size_offset + i * weight1size;
-        if (pNnediParam->nnedi.precision == VPP_FP_PRECISION_FP32) {
-            setWeight1<float>((float *)weight1[i].data(), ptrW, pNnediParam);
-        } else {
+        for (int i = 0; i < 2; i++) {
+            weight1[i].resize(weight1size * sizeofweight, 0);
+            const float *ptrW = weights.get() + weight0size + weight0sizenew * 3 + weight1size_tsize * pNnediParam->nnedi.errortype + weight1size_offset + i * weight1size;
+            if (pNnediParam->nnedi.precision == VPP_FP_PRECISION_FP32) {
+                setWeight1<float>((float *)weight1[i].data(), ptrW, pNnediParam);
+            } else {
 #if ENABLE_CUDA_FP16_HOST
-            setWeight1<__half>((__half *)weight1[i].data(), ptrW, pNnediParam);
+                setWeight1<__half>((__half *)weight1[i].data(), ptrW, pNnediParam);
 #endif //#if ENABLE_CUDA_FP16_HOST
+            }
         }
+        return RGY_ERR_NONE;
+    };
+    std::shared_ptr<const RGYNnediWeightSet> weights;
+    RGYNnediWeightSource source = RGYNnediWeightSource::Prepare;
+    auto sts = rgy_nnedi_weight_get(weights, source, key, cacheDir, prepare, m_pLog);
+    if (sts != RGY_ERR_NONE) {
+        return sts;
     }
-    m_weight0 = CUMemBuf(weight0f.size());
+    m_weight0 = CUMemBuf(weights->weight0Bytes());
     m_weight0.alloc();
-    cudaMemcpy(m_weight0.ptr, weight0f.data(), m_weight0.nSize, cudaMemcpyHostToDevice);
-    for (size_t i = 0; i < weight1.size(); i++) {
-        m_weight1[i] = CUMemBuf(weight1[i].size());
+    cudaMemcpy(m_weight0.ptr, weights->weight0(), m_weight0.nSize, cudaMemcpyHostToDevice);
+    for (size_t i = 0; i < m_weight1.size(); i++) {
+        m_weight1[i] = CUMemBuf(weights->weight1Bytes());
         m_weight1[i].alloc();
-        cudaMemcpy(m_weight1[i].ptr, weight1[i].data(), m_weight1[i].nSize, cudaMemcpyHostToDevice);
+        cudaMemcpy(m_weight1[i].ptr, weights->weight1((int)i), m_weight1[i].nSize, cudaMemcpyHostToDevice);
     }
+    const auto timeEnd = std::chrono::system_clock::now();
+    AddMessage(RGY_LOG_DEBUG, _T("prepared weights (%s, %s) in %.2f ms.\n"),
+        key.print().c_str(), get_nnedi_weight_source_str(source),
+        std::chrono::duration_cast<std::chrono::microseconds>(timeEnd - timeStart).count() * 0.001);
     return RGY_ERR_NONE;
 }
 
@@ -43,8 +43,7 @@ tstring NVEncFilterParamOverlay::print() const {
 void NVEncFilterOverlay::NVEncFilterOverlayFrame::close() {
     crop.reset();
     resize.reset();
-    host->clear();
-    dev->clear();
+    dev.reset();
     inputPtr = nullptr;
 }
 
@@ -55,8 +54,30 @@ NVEncFilterOverlay::NVEncFilterOverlay() :
     m_convert(),
     m_inputCsp(RGY_CSP_NA),
     m_stream(nullptr),
+    m_hostCsp(RGY_CSP_NA),
+    m_hostWidth(0),
+    m_hostHeight(0),
+    m_readAlphaFromPixFmt(false),
+    m_lumaKeyPrm(),
+    m_funcLumaKey8(nullptr),
+    m_funcLumaKey16(nullptr),
     m_frame(),
     m_alpha(),
+    m_srcThread(),
+    m_srcMtx(),
+    m_srcCv(),
+    m_srcQueue(),
+    m_srcErr(RGY_ERR_NONE),
+    m_srcFin(false),
+    m_srcAbort(false),
+    m_cacheBudget(0),
+    m_devCache(),
+    m_devCacheSize(0),
+    m_devCacheOverflow(false),
+    m_devCacheComplete(false),
+    m_devCacheIndex(0),
+    m_passCount(0),
+    m_uploadCount(0),
     m_bInterlacedWarn(false) {
     m_name = _T("overlay");
 }
@@ -86,10 +107,27 @@ RGY_ERR NVEncFilterOverlay::init(shared_ptr<NVEncFilterParam> pParam, shared_ptr
         AddMessage(RGY_LOG_ERROR, _T("alpha should be 0.0 - 1.0.\n"));
         return RGY_ERR_INVALID_PARAM;
     }
+    if (prm->overlay.cacheMB < 0) {
+        AddMessage(RGY_LOG_ERROR, _T("cache should be a positive value.\n"));
+        return RGY_ERR_INVALID_PARAM;
+    }
+    stopSource();
     sts = initInput(prm.get());
     if (sts != RGY_ERR_NONE) {
         return sts;
     }
+    if (!m_readAlphaFromPixFmt && prm->overlay.alphaMode == VppOverlayAlphaMode::Mul) {
+        prm->overlay.alphaMode = VppOverlayAlphaMode::Override; // Mulモードは無効
+    }
+    if (prm->overlay.alphaMode == VppOverlayAlphaMode::LumaKey) {
+        const float baseAlpha = (prm->overlay.alpha > 0.0f) ? prm->overlay.alpha : 1.0f;
+        m_lumaKeyPrm = rgy_lumakey_param(RGY_CSP_BIT_DEPTH[m_hostCsp],
+            prm->overlay.lumaKey.threshold, prm->overlay.lumaKey.tolerance, prm->overlay.lumaKey.shoftness, baseAlpha);
+        m_funcLumaKey8 = get_lumakey8_func();
+        m_funcLumaKey16 = get_lumakey16_func();
+    }
+    // 静止画やloopしない場合はキャッシュは不要
+    m_cacheBudget = (prm->overlay.loop) ? (size_t)prm->overlay.cacheMB << 20 : 0;
 
     sts = AllocFrameBuf(prm->frameOut, 1);
     if (sts != RGY_ERR_NONE) {
@@ -102,10 +140,15 @@ RGY_ERR NVEncFilterOverlay::init(shared_ptr<NVEncFilterParam> pParam, shared_ptr
 
     setFilterInfo(pParam->print());
     m_param = pParam;
+
+    m_srcErr = RGY_ERR_NONE;
+    m_srcFin = false;
+    m_srcAbort = false;
+    m_srcThread = std::thread(&NVEncFilterOverlay::sourceThread, this, prm);
     return sts;
 }
 
-RGY_ERR NVEncFilterOverlay::initInput(NVEncFilterParamOverlay *prm) {
+RGY_ERR NVEncFilterOverlay::openInput(NVEncFilterParamOverlay *prm) {
     m_codecCtxDec.reset();
     m_formatCtx.reset();
 
@@ -133,7 +176,6 @@ RGY_ERR NVEncFilterOverlay::initInput(NVEncFilterParamOverlay *prm) {
     }
     AddMessage(RGY_LOG_DEBUG, _T("got stream information.\n"));
     av_dump_format(m_formatCtx.get(), 0, filename_char.c_str(), 0);
-    m_inputFrames = 0;
 
     m_stream = nullptr;
     for (uint32_t i = 0; i < m_formatCtx->nb_streams; i++) {
@@ -235,8 +277,11 @@ RGY_ERR NVEncFilterOverlay::initInput(NVEncFilterParamOverlay *prm) {
         return RGY_ERR_INVALID_COLOR_FORMAT;
     }
 
+    m_readAlphaFromPixFmt = pixfmt == AV_PIX_FMT_RGBA
+                         || pixfmt == AV_PIX_FMT_BGRA;
     m_inputCsp = csp_avpixfmt_to_rgy(m_codecCtxDec->pix_fmt);
-    const auto hostCsp = pixfmtData->second;
+    m_hostCsp = pixfmtData->second;
+    const auto hostCsp = m_hostCsp;
     if (!m_convert) {
         m_convert = std::make_unique<RGYConvertCSP>(0, prm->threadPrm);
         if (m_convert->getFunc(m_inputCsp, hostCsp, false, RGY_SIMD::SIMD_ALL) == nullptr) {
@@ -246,7 +291,17 @@ RGY_ERR NVEncFilterOverlay::initInput(NVEncFilterParamOverlay *prm) {
         }
         AddMessage(RGY_LOG_DEBUG, _T("color conversion selected: %s -> %s.\n"), RGY_CSP_NAMES[m_inputCsp], RGY_CSP_NAMES[hostCsp]);
     }
+    return RGY_ERR_NONE;
+}
 
+RGY_ERR NVEncFilterOverlay::initInput(NVEncFilterParamOverlay *prm) {
+    auto err = openInput(prm);
+    if (err != RGY_ERR_NONE) {
+        return err;
+    }
+    m_inputFrames = 0;
+
+    const auto hostCsp = m_hostCsp;
     const int frameWidth  = (RGY_CSP_CHROMA_FORMAT[prm->frameIn.csp] == RGY_CHROMAFMT_YUV420) ? (m_codecCtxDec->width & (~1))  : m_codecCtxDec->width;
     const int frameHeight = (RGY_CSP_CHROMA_FORMAT[prm->frameIn.csp] == RGY_CHROMAFMT_YUV420) ? (m_codecCtxDec->height & (~1)) : m_codecCtxDec->height;
     if (RGY_CSP_CHROMA_FORMAT[prm->frameIn.csp] == RGY_CHROMAFMT_YUV420) {
@@ -263,6 +318,8 @@ RGY_ERR NVEncFilterOverlay::initInput(NVEncFilterParamOverlay *prm) {
             prm->overlay.height = ALIGN(prm->overlay.height, 2);
         }
     }
+    m_hostWidth = frameWidth;
+    m_hostHeight = frameHeight;
     if (!m_frame.dev) {
         m_frame.dev = std::make_unique<CUFrameBuf>(frameWidth, frameHeight, hostCsp);
         auto sts = m_frame.dev->alloc();
@@ -273,16 +330,7 @@ RGY_ERR NVEncFilterOverlay::initInput(NVEncFilterParamOverlay *prm) {
         AddMessage(RGY_LOG_DEBUG, _T("Allocated frame(dev) %s %dx%d.\n"), RGY_CSP_NAMES[m_frame.dev->frame.csp], frameWidth, frameHeight);
     }
 
-    if (!m_frame.host) {
-        m_frame.host = std::make_unique<CUFrameBuf>(frameWidth, frameHeight, hostCsp);
-        auto sts = m_frame.host->allocHost();
-        if (sts != RGY_ERR_NONE) {
-            AddMessage(RGY_LOG_ERROR, _T("Failed to allocate frame %s %dx%d: %s.\n"), RGY_CSP_NAMES[m_frame.host->frame.csp], frameWidth, frameHeight, get_err_mes(sts));
-            return sts;
-        }
-        AddMessage(RGY_LOG_DEBUG, _T("Allocated frame(host) %s %dx%d.\n"), RGY_CSP_NAMES[m_frame.host->frame.csp], frameWidth, frameHeight);
-    }
-    
+
     if (!m_alpha.dev) {
         m_alpha.dev = std::make_unique<CUFrameBuf>(frameWidth, frameHeight, RGY_CSP_YUV444);
         auto sts = m_alpha.dev->alloc();
@@ -293,16 +341,6 @@ RGY_ERR NVEncFilterOverlay::initInput(NVEncFilterParamOverlay *prm) {
         AddMessage(RGY_LOG_DEBUG, _T("Allocated alpha frame(dev) %s %dx%d.\n"), RGY_CSP_NAMES[m_alpha.dev->frame.csp], frameWidth, frameHeight);
     }
 
-    if (!m_alpha.host) {
-        m_alpha.host = std::make_unique<CUFrameBuf>(frameWidth, frameHeight, RGY_CSP_YUV444);
-        auto sts = m_alpha.host->allocHost();
-        if (sts != RGY_ERR_NONE) {
-            AddMessage(RGY_LOG_ERROR, _T("Failed to allocate alpha frame %s %dx%d: %s.\n"), RGY_CSP_NAMES[m_alpha.host->frame.csp], frameWidth, frameHeight, get_err_mes(sts));
-            return sts;
-        }
-        AddMessage(RGY_LOG_DEBUG, _T("Allocated alpha frame(host) %s %dx%d.\n"), RGY_CSP_NAMES[m_frame.host->frame.csp], frameWidth, frameHeight);
-    }
-
     auto inFrame = m_frame.dev->frame;
     if (!m_frame.crop
         && prm->frameIn.csp != hostCsp) {
@@ -450,33 +488,11 @@ RGY_ERR NVEncFilterOverlay::prepareFrameDev(NVEncFilterOverlayFrame& target, cud
     return RGY_ERR_NONE;
 }
 
-template<typename TypeSrc>
-static inline void set_lumakey(uint8_t *ptrDstAlpha, const TypeSrc *ptrSrc, const int width, const int srcBitdepth,
-    const float threshold, const float tolerance, const float softness, const float baseAlpha) {
-    const float black = std::max(threshold - tolerance, 0.0f);
-    const float white = std::min(threshold + tolerance, 1.0f);
-    for (int i = 0; i < width; i++) {
-        const float lumaf = clamp(((float)ptrSrc[i] * (float)(1.0f / (float)((1 << srcBitdepth) - 1)) - (16.0f / 255.0f)) * (255.0f / (235.0f - 16.0f)), 0.0f, 1.0f);
-        float alpha = 255.0f;
-        if (lumaf >= black && lumaf <= white) {
-            alpha = 0.0f;
-        } else if (softness > 0.0f && lumaf > black - softness && lumaf < white + softness) {
-            if (lumaf < black) {
-                alpha = 255.0f - (lumaf - black + softness) * 255.0f / softness;
-            } else {
-                alpha = ((lumaf - white) * 255.0f / softness + 0.5f);
-            }
-        }
-        ptrDstAlpha[i] = (uint8_t)clamp((int)(alpha * baseAlpha + 0.5f), 0, 255);
-    }
-}
-
-RGY_ERR NVEncFilterOverlay::getFrame(cudaStream_t stream) {
+RGY_ERR NVEncFilterOverlay::decodeFrame(AVFrame *frame) {
     if (!m_codecCtxDec) {
         AddMessage(RGY_LOG_ERROR, _T("decoder not initialized.\n"));
         return RGY_ERR_NOT_INITIALIZED;
     }
-    std::unique_ptr<AVFrame, RGYAVDeleter<AVFrame>> frame(av_frame_alloc(), RGYAVDeleter<AVFrame>(av_frame_free));
     std::unique_ptr<AVPacket, RGYAVDeleter<AVPacket>> pkt;
     //動画のデコードを行う
     int got_frame = 0;
@@ -503,7 +519,7 @@ RGY_ERR NVEncFilterOverlay::getFrame(cudaStream_t stream) {
             AddMessage(RGY_LOG_ERROR, _T("failed to send packet to video decoder: %s.\n"), qsv_av_err2str(ret).c_str());
             return RGY_ERR_UNDEFINED_BEHAVIOR;
         }
-        ret = avcodec_receive_frame(m_codecCtxDec.get(), frame.get());
+        ret = avcodec_receive_frame(m_codecCtxDec.get(), frame);
         if (ret == AVERROR(EAGAIN)) { //もっとパケットを送る必要がある
             continue;
         }
@@ -517,119 +533,308 @@ RGY_ERR NVEncFilterOverlay::getFrame(cudaStream_t stream) {
         }
         got_frame = TRUE;
     }
+    return RGY_ERR_NONE;
+}
+
+std::shared_ptr<NVEncFilterOverlayHostFrame> NVEncFilterOverlay::allocHostFrame(std::vector<std::shared_ptr<NVEncFilterOverlayHostFrame>>& pool) {
+    //受け渡しが終わって、どこからも参照されていないものは再利用する
+    for (auto& hostFrame : pool) {
+        if (hostFrame.use_count() == 1) {
+            return hostFrame;
+        }
+    }
+    //ワーカースレッドではCUDAのAPIを呼ばないよう、通常のメモリを確保する
+    auto hostFrame = std::make_shared<NVEncFilterOverlayHostFrame>();
+    hostFrame->frame = RGYFrameInfo(m_hostWidth, m_hostHeight, m_hostCsp, RGY_CSP_BIT_DEPTH[m_hostCsp], RGY_PICSTRUCT_FRAME, RGY_MEM_TYPE_CPU);
+    hostFrame->alpha = RGYFrameInfo(m_hostWidth, m_hostHeight, RGY_CSP_YUV444, 8, RGY_PICSTRUCT_FRAME, RGY_MEM_TYPE_CPU);
+    size_t offset[2] = { 0 };
+    size_t totalSize = 0;
+    RGYFrameInfo *targets[2] = { &hostFrame->frame, &hostFrame->alpha };
+    for (int i = 0; i < _countof(targets); i++) {
+        auto target = targets[i];
+        target->singleAlloc = true;
+        target->pitch[0] = ALIGN(target->width * bytesPerPix(target->csp), 128); //このアライメントは色変換の並列化のために必要
+        int totalHeight = 0;
+        for (int iplane = 0; iplane < RGY_CSP_PLANES[target->csp]; iplane++) {
+            totalHeight += getPlane(target, (RGY_PLANE)iplane).height;
+        }
+        offset[i] = totalSize;
+        totalSize += (size_t)target->pitch[0] * totalHeight;
+    }
+    hostFrame->buf = std::unique_ptr<uint8_t, aligned_malloc_deleter>((uint8_t *)_aligned_malloc(totalSize, 128), aligned_malloc_deleter());
+    if (!hostFrame->buf) {
+        return nullptr;
+    }
+    hostFrame->bufSize = totalSize;
+    for (int i = 0; i < _countof(targets); i++) {
+        targets[i]->ptr[0] = hostFrame->buf.get() + offset[i];
+    }
+    //loop時のキャッシュとして保持されるものはプールに入れても再利用されないので、プールは小さいままでよい
+    if (pool.size() < 8) {
+        pool.push_back(hostFrame);
+    }
+    return hostFrame;
+}
+
+RGY_ERR NVEncFilterOverlay::convertFrame(NVEncFilterOverlayHostFrame *hostFrame, const AVFrame *frame) {
+    auto prm = std::dynamic_pointer_cast<NVEncFilterParamOverlay>(m_param);
+    if (!prm) {
+        AddMessage(RGY_LOG_ERROR, _T("Invalid parameter type.\n"));
+        return RGY_ERR_INVALID_PARAM;
+    }
     //フレームデータをコピー
+    const auto& frameHost = hostFrame->frame;
     {
-        const auto& frameHost = m_frame.host->frame;
         sInputCrop crop = { 0 };
         void *dst_array[3] = {
             getPlane(&frameHost, RGY_PLANE_Y).ptr[0],
             getPlane(&frameHost, RGY_PLANE_U).ptr[0],
             getPlane(&frameHost, RGY_PLANE_V).ptr[0]
         };
-        m_convert->run(rgy_avframe_interlaced(frame.get()) ? 1 : 0,
+        m_convert->run(rgy_avframe_interlaced(frame) ? 1 : 0,
             dst_array, (const void **)frame->data,
             frameHost.width, frame->linesize[0], frame->linesize[1], frameHost.pitch[0],
             frameHost.height, frameHost.height, crop.c);
-        auto sts = m_frame.dev->copyFrameAsync(&frameHost, stream);
-        if (sts != RGY_ERR_NONE) {
-            AddMessage(RGY_LOG_ERROR, _T("Failed to copy frame (dev): %s.\n"), get_err_mes(sts));
-            return sts;
+    }
+
+    //不透明度データを作成
+    const auto& frameHostAlpha = hostFrame->alpha;
+    uint8_t *dst_array[3] = {
+        getPlane(&frameHostAlpha, RGY_PLANE_Y).ptr[0],
+        getPlane(&frameHostAlpha, RGY_PLANE_U).ptr[0],
+        getPlane(&frameHostAlpha, RGY_PLANE_V).ptr[0]
+    };
+    const auto pitchDst = frameHostAlpha.pitch[0];
+    if (m_readAlphaFromPixFmt) {
+        const uint8_t *ptrSrcLineA = frame->data[0];
+        const auto pitchSrc = frame->linesize[0];
+        auto ptrDstLineA = dst_array[0];
+        for (int j = 0; j < frameHostAlpha.height; j++, ptrDstLineA += pitchDst, ptrSrcLineA += pitchSrc) {
+            auto ptrSrc = ptrSrcLineA;
+            auto ptrDst = ptrDstLineA;
+            for (int i = 0; i < frameHostAlpha.width; i++) {
+                ptrDst[i] = ptrSrc[4 * i + 3];
+            }
         }
-        if (m_inputFrames == 0) {
-            AddMessage(RGY_LOG_DEBUG, _T("Copied frame to device.\n"));
+    }
+    if (prm->overlay.alphaMode == VppOverlayAlphaMode::LumaKey) {
+        auto ptrSrcLineY = getPlane(&frameHost, RGY_PLANE_Y).ptr[0];
+        const auto pitchSrc = frameHost.pitch[0];
+        auto ptrDstLineA = dst_array[0];
+        for (int j = 0; j < frameHostAlpha.height; j++, ptrDstLineA += pitchDst, ptrSrcLineY += pitchSrc) {
+            if (RGY_CSP_BIT_DEPTH[frameHost.csp] > 8) {
+                m_funcLumaKey16(ptrDstLineA, (const uint16_t *)ptrSrcLineY, frameHostAlpha.width, m_lumaKeyPrm);
+            } else {
+                m_funcLumaKey8(ptrDstLineA, (const uint8_t *)ptrSrcLineY, frameHostAlpha.width, m_lumaKeyPrm);
+            }
+        }
+    } else if (prm->overlay.alpha > 0.0f || !m_readAlphaFromPixFmt) {
+        //値を設定する場合の設定値
+        const uint8_t alpha8 = prm->overlay.alpha > 0.0f ? (uint8_t)std::min((int)(prm->overlay.alpha * 255.0 + 0.001), 255) : 255;
+        if (hostFrame->index == 0) {
+            AddMessage(RGY_LOG_DEBUG, _T("Set alpha %d (%.3f).\n"), alpha8, prm->overlay.alpha);
+        }
+        auto ptrDstLineA = dst_array[0];
+        for (int j = 0; j < frameHostAlpha.height; j++, ptrDstLineA += pitchDst) {
+            auto ptrDst = ptrDstLineA;
+            if (prm->overlay.alphaMode == VppOverlayAlphaMode::Mul) {
+                for (int i = 0; i < frameHostAlpha.width; i++) {
+                    ptrDst[i] = (uint8_t)clamp((int)(ptrDst[i] * prm->overlay.alpha + 0.5), 0, 255);
+                }
+            } else {
+                memset(ptrDst, alpha8, frameHostAlpha.width);
+            }
         }
     }
+    for (int iplane = 1; iplane < _countof(dst_array); iplane++) {
+        memcpy(dst_array[iplane], dst_array[0], frameHostAlpha.pitch[0] * frameHostAlpha.height);
+    }
+    return RGY_ERR_NONE;
+}
 
-    //不透明度データをコピー
+bool NVEncFilterOverlay::pushHostFrame(std::shared_ptr<NVEncFilterOverlayHostFrame> hostFrame) {
+    static const size_t SRC_QUEUE_SIZE = 4;
     {
-        const auto& frameHostAlpha = m_alpha.host->frame;
-        auto prm = std::dynamic_pointer_cast<NVEncFilterParamOverlay>(m_param);
-        if (!prm) {
-            AddMessage(RGY_LOG_ERROR, _T("Invalid parameter type.\n"));
-            return RGY_ERR_INVALID_PARAM;
-        }
-
-        const auto pixfmt = (AVPixelFormat)m_stream->codecpar->format;
-        uint8_t *dst_array[3] = {
-            getPlane(&frameHostAlpha, RGY_PLANE_Y).ptr[0],
-            getPlane(&frameHostAlpha, RGY_PLANE_U).ptr[0],
-            getPlane(&frameHostAlpha, RGY_PLANE_V).ptr[0]
-        };
+        std::unique_lock<std::mutex> lock(m_srcMtx);
+        m_srcCv.wait(lock, [&]() { return m_srcAbort || m_srcQueue.size() < SRC_QUEUE_SIZE; });
+        if (m_srcAbort) {
+            return false;
+        }
+        m_srcQueue.push_back(hostFrame);
+    }
+    m_srcCv.notify_all();
+    return true;
+}
 
-        const bool readAlphaFromPixFmt = pixfmt == AV_PIX_FMT_RGBA
-                                      || pixfmt == AV_PIX_FMT_BGRA;
-        if (readAlphaFromPixFmt) {
-            AddMessage(RGY_LOG_DEBUG, _T("Reading alpha from frame.\n"));
-            for (int iplane = 0; iplane < _countof(dst_array); iplane++) {
-                const uint8_t *ptrSrcLineA = frame->data[0];
-                const auto pitchSrc = frame->linesize[0];
-                auto ptrDstLineA = dst_array[iplane];
-                const auto pitchDst = frameHostAlpha.pitch[0];
-                for (int j = 0; j < frameHostAlpha.height; j++, ptrDstLineA += pitchDst, ptrSrcLineA += pitchSrc) {
-                    auto ptrSrc = ptrSrcLineA;
-                    auto ptrDst = ptrDstLineA;
-                    for (int i = 0; i < frameHostAlpha.width; i++) {
-                        ptrDst[i] = ptrSrc[4 * i + 3];
-                    }
+void NVEncFilterOverlay::sourceThread(std::shared_ptr<NVEncFilterParamOverlay> prm) {
+    auto sts = RGY_ERR_NONE;
+    std::vector<std::shared_ptr<NVEncFilterOverlayHostFrame>> pool;
+    std::vector<std::shared_ptr<NVEncFilterOverlayHostFrame>> hostCache; // 1周分のフレーム (m_cacheBudgetに収まる場合)
+    size_t hostCacheSize = 0;
+    bool hostCacheValid = m_cacheBudget > 0;
+    std::unique_ptr<AVFrame, RGYAVDeleter<AVFrame>> frame(av_frame_alloc(), RGYAVDeleter<AVFrame>(av_frame_free));
+    for (int pass = 0; sts == RGY_ERR_NONE; pass++) {
+        int frameCount = 0;
+        if (pass > 0 && hostCacheValid) {
+            // 1周分がキャッシュにあれば、デコードせずにそれを再度送る
+            for (auto& hostFrame : hostCache) {
+                if (!pushHostFrame(hostFrame)) {
+                    return;
                 }
             }
-        } else if (prm->overlay.alphaMode == VppOverlayAlphaMode::Mul) {
-            prm->overlay.alphaMode = VppOverlayAlphaMode::Override; // Mulモードは無効
-        }
-        if (prm->overlay.alphaMode == VppOverlayAlphaMode::LumaKey) {
-            const auto& frameHost = m_frame.host->frame;
-            const float baseAlpha = (prm->overlay.alpha > 0.0f) ? prm->overlay.alpha : 1.0f;
-            int iplane = 0;
-            auto ptrSrcLineY = getPlane(&frameHost, RGY_PLANE_Y).ptr[0];
-            const auto pitchSrc = frameHost.pitch[0];
-            auto ptrDstLineA = dst_array[iplane];
-            const auto pitchDst = frameHostAlpha.pitch[0];
-            for (int j = 0; j < frameHostAlpha.height; j++, ptrDstLineA += pitchDst, ptrSrcLineY += pitchSrc) {
-                auto ptrDst = ptrDstLineA;
-                if (RGY_CSP_BIT_DEPTH[frameHost.csp] > 8) {
-                    set_lumakey<uint16_t>(ptrDst, (const uint16_t *)ptrSrcLineY, frameHostAlpha.width, RGY_CSP_BIT_DEPTH[frameHost.csp],
-                        prm->overlay.lumaKey.threshold, prm->overlay.lumaKey.tolerance, prm->overlay.lumaKey.shoftness, baseAlpha);
-                } else {
-                    set_lumakey<uint8_t>(ptrDst, (const uint8_t *)ptrSrcLineY, frameHostAlpha.width, RGY_CSP_BIT_DEPTH[frameHost.csp],
-                        prm->overlay.lumaKey.threshold, prm->overlay.lumaKey.tolerance, prm->overlay.lumaKey.shoftness, baseAlpha);
+            frameCount = (int)hostCache.size();
+        } else {
+            if (pass > 0) { // loopさせる場合はファイルを開きなおして再読み込み
+                if ((sts = openInput(prm.get())) != RGY_ERR_NONE) {
+                    AddMessage(RGY_LOG_ERROR, _T("Failed to re-open file.\n"));
+                    break;
                 }
             }
-            for (iplane = 1; iplane < _countof(dst_array); iplane++) {
-                memcpy(dst_array[iplane], dst_array[0], frameHostAlpha.pitch[0] * frameHostAlpha.height);
-            }
-        } else if (prm->overlay.alpha > 0.0f || !readAlphaFromPixFmt) {
-            //値を設定する場合の設定値
-            const uint8_t alpha8 = prm->overlay.alpha > 0.0f ? (uint8_t)std::min((int)(prm->overlay.alpha * 255.0 + 0.001), 255) : 255;
-            AddMessage(RGY_LOG_DEBUG, _T("Set alpha %d (%.3f).\n"), alpha8, prm->overlay.alpha);
-            int iplane = 0;
-            auto ptrDstLineA = dst_array[iplane];
-            const auto pitchDst = frameHostAlpha.pitch[0];
-            for (int j = 0; j < frameHostAlpha.height; j++, ptrDstLineA += pitchDst) {
-                auto ptrDst = ptrDstLineA;
-                if (prm->overlay.alphaMode == VppOverlayAlphaMode::Mul) {
-                    for (int i = 0; i < frameHostAlpha.width; i++) {
-                        ptrDst[i] = (uint8_t)clamp((int)(ptrDst[i] * prm->overlay.alpha + 0.5), 0, 255);
-                    }
-                } else {
-                    for (int i = 0; i < frameHostAlpha.width; i++) {
-                        ptrDst[i] = alpha8;
+            while ((sts = decodeFrame(frame.get())) == RGY_ERR_NONE) {
+                auto hostFrame = allocHostFrame(pool);
+                if (!hostFrame) {
+                    AddMessage(RGY_LOG_ERROR, _T("Failed to allocate host frame.\n"));
+                    sts = RGY_ERR_NULL_PTR;
+                    break;
+                }
+                hostFrame->index = frameCount++;
+                if ((sts = convertFrame(hostFrame.get(), frame.get())) != RGY_ERR_NONE) {
+                    break;
+                }
+                av_frame_unref(frame.get());
+                if (pass == 0 && hostCacheValid) {
+                    hostCacheSize += hostFrame->bufSize;
+                    if (hostCacheSize <= m_cacheBudget) {
+                        hostCache.push_back(hostFrame);
+                    } else {
+                        AddMessage(RGY_LOG_DEBUG, _T("frames exceeded cache size %d MB, will decode again on loop.\n"), prm->overlay.cacheMB);
+                        hostCacheValid = false;
+                        hostCache.clear();
                     }
                 }
+                if (!pushHostFrame(hostFrame)) {
+                    return;
+                }
             }
-            for (iplane = 1; iplane < _countof(dst_array); iplane++) {
-                memcpy(dst_array[iplane], dst_array[0], frameHostAlpha.pitch[0] * frameHostAlpha.height);
+            if (sts != RGY_ERR_MORE_DATA) {
+                break;
             }
+            sts = RGY_ERR_NONE;
+        }
+        if (!pushHostFrame(nullptr)) { // 1周分の終端
+            return;
         }
-        auto sts = m_alpha.dev->copyFrameAsync(&frameHostAlpha, stream);
+        // 静止画はloopさせず、最後のフレームを使い続ける
+        if (!prm->overlay.loop || frameCount <= 1) {
+            break;
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_srcMtx);
+        m_srcErr = sts;
+        m_srcFin = true;
+    }
+    m_srcCv.notify_all();
+}
+
+void NVEncFilterOverlay::stopSource() {
+    {
+        std::lock_guard<std::mutex> lock(m_srcMtx);
+        m_srcAbort = true;
+    }
+    m_srcCv.notify_all();
+    if (m_srcThread.joinable()) {
+        m_srcThread.join();
+    }
+    m_srcQueue.clear();
+}
+
+RGY_ERR NVEncFilterOverlay::cacheDevFrame(cudaStream_t stream) {
+    NVEncFilterOverlayDevFrame devFrame;
+    size_t devFrameSize = 0;
+    for (auto& [target, input] : { std::make_pair(&devFrame.frame, m_frame.inputPtr), std::make_pair(&devFrame.alpha, m_alpha.inputPtr) }) {
+        for (int iplane = 0; iplane < RGY_CSP_PLANES[input->csp]; iplane++) {
+            const auto plane = getPlane(input, (RGY_PLANE)iplane);
+            devFrameSize += (size_t)plane.pitch[0] * plane.height;
+        }
+    }
+    if (m_devCacheSize + devFrameSize > m_cacheBudget) {
+        AddMessage(RGY_LOG_DEBUG, _T("frames exceeded cache size, device cache disabled.\n"));
+        m_devCacheOverflow = true;
+        m_devCache.clear();
+        return RGY_ERR_NONE;
+    }
+    for (auto& [target, input] : { std::make_pair(&devFrame.frame, m_frame.inputPtr), std::make_pair(&devFrame.alpha, m_alpha.inputPtr) }) {
+        *target = std::make_unique<CUFrameBuf>(*input);
+        auto sts = (*target)->alloc();
         if (sts != RGY_ERR_NONE) {
-            AddMessage(RGY_LOG_ERROR, _T("Failed to copy frame (alpha): %s.\n"), get_err_mes(sts));
+            AddMessage(RGY_LOG_ERROR, _T("Failed to allocate cache frame %s %dx%d: %s.\n"), RGY_CSP_NAMES[input->csp], input->width, input->height, get_err_mes(sts));
             return sts;
         }
-        if (m_inputFrames == 0) {
-            AddMessage(RGY_LOG_DEBUG, _T("Copied alpha to device.\n"));
+        sts = copyFrameAsync(&(*target)->frame, input, stream);
+        if (sts != RGY_ERR_NONE) {
+            AddMessage(RGY_LOG_ERROR, _T("Failed to copy cache frame: %s.\n"), get_err_mes(sts));
+            return sts;
         }
     }
-    auto sts = RGY_ERR_NONE;
+    m_devCacheSize += devFrameSize;
+    m_devCache.push_back(std::move(devFrame));
+    return RGY_ERR_NONE;
+}
+
+RGY_ERR NVEncFilterOverlay::getFrame(cudaStream_t stream) {
+    if (m_devCacheComplete) {
+        // 1周分がデバイス側にあるので、転送もcrop/resizeも不要
+        if (m_devCacheIndex >= (int)m_devCache.size()) {
+            m_devCacheIndex = 0;
+            m_passCount++;
+            return RGY_ERR_MORE_DATA;
+        }
+        auto& devFrame = m_devCache[m_devCacheIndex++];
+        m_frame.inputPtr = &devFrame.frame->frame;
+        m_alpha.inputPtr = &devFrame.alpha->frame;
+        m_inputFrames++;
+        return RGY_ERR_NONE;
+    }
+    std::shared_ptr<NVEncFilterOverlayHostFrame> hostFrame;
+    {
+        std::unique_lock<std::mutex> lock(m_srcMtx);
+        m_srcCv.wait(lock, [&]() { return !m_srcQueue.empty() || m_srcFin; });
+        if (m_srcQueue.empty()) {
+            return (m_srcErr != RGY_ERR_NONE) ? m_srcErr : RGY_ERR_MORE_DATA;
+        }
+        hostFrame = m_srcQueue.front();
+        m_srcQueue.pop_front();
+    }
+    m_srcCv.notify_all();
+    if (!hostFrame) { // 1周分の終端
+        if (m_passCount == 0 && m_cacheBudget > 0 && !m_devCacheOverflow && m_devCache.size() > 1) {
+            AddMessage(RGY_LOG_DEBUG, _T("cached all %d frames (%.1f MB) on device.\n"), (int)m_devCache.size(), m_devCacheSize / (double)(1024 * 1024));
+            m_devCacheComplete = true;
+            m_devCacheIndex = 0;
+            stopSource();
+        }
+        m_passCount++;
+        return RGY_ERR_MORE_DATA;
+    }
+
+    auto sts = m_frame.dev->copyFrameAsync(&hostFrame->frame, stream);
+    if (sts != RGY_ERR_NONE) {
+        AddMessage(RGY_LOG_ERROR, _T("Failed to copy frame (dev): %s.\n"), get_err_mes(sts));
+        return sts;
+    }
+    sts = m_alpha.dev->copyFrameAsync(&hostFrame->alpha, stream);
+    if (sts != RGY_ERR_NONE) {
+        AddMessage(RGY_LOG_ERROR, _T("Failed to copy frame (alpha): %s.\n"), get_err_mes(sts));
+        return sts;
+    }
+    //pageableなメモリからの転送は関数から戻った時点でステージングへのコピーが済んでいるので、host側のフレームはすぐに返却できる
+    hostFrame.reset();
+    if (m_inputFrames == 0) {
+        AddMessage(RGY_LOG_DEBUG, _T("Copied frame to device.\n"));
+    }
+    m_uploadCount++;
+
     sts = prepareFrameDev(m_frame, stream);
     if (sts != RGY_ERR_NONE) {
         return sts;
@@ -638,6 +843,11 @@ RGY_ERR NVEncFilterOverlay::getFrame(cudaStream_t stream) {
     if (sts != RGY_ERR_NONE) {
         return sts;
     }
+    if (m_passCount == 0 && m_cacheBudget > 0 && !m_devCacheOverflow) {
+        if ((sts = cacheDevFrame(stream)) != RGY_ERR_NONE) {
+            return sts;
+        }
+    }
     m_inputFrames++;
     return RGY_ERR_NONE;
 }
@@ -679,16 +889,11 @@ RGY_ERR NVEncFilterOverlay::run_filter(const RGYFrameInfo *pInputFrame, RGYFrame
             AddMessage(RGY_LOG_ERROR, _T("Unknown error.\n"));
             return RGY_ERR_UNKNOWN;
         } else if (m_inputFrames > 1) {
-            if (prm->overlay.loop) { // loopさせる場合はファイルを開きなおして再読み込み
-                m_codecCtxDec.reset();
-                m_formatCtx.reset();
-                if ((sts = initInput(prm.get())) != RGY_ERR_NONE) {
-                    return sts;
-                }
+            if (prm->overlay.loop) { // loopさせる場合は次の周の先頭フレームを取得 (再読み込み・キャッシュはsourceThread側で行う)
                 if ((sts = getFrame(stream)) != RGY_ERR_NONE) {
                     return sts;
                 }
-                if (m_inputFrames == 0 || !m_frame.inputPtr) {
+                if (!m_frame.inputPtr) {
                     AddMessage(RGY_LOG_ERROR, _T("Failed to re-open file.\n"));
                     return RGY_ERR_UNKNOWN;
                 }
@@ -713,6 +918,21 @@ RGY_ERR NVEncFilterOverlay::run_filter(const RGYFrameInfo *pInputFrame, RGYFrame
 }
 
 void NVEncFilterOverlay::close() {
+    stopSource();
+    if (m_inputFrames > 0) {
+        AddMessage(RGY_LOG_DEBUG, _T("overlay frames: %d, uploaded: %lld, loop: %d, device cache: %s.\n"),
+            m_inputFrames, (long long)m_uploadCount, m_passCount,
+            (m_devCacheComplete) ? strsprintf(_T("%d frames, %.1f MB"), (int)m_devCache.size(), m_devCacheSize / (double)(1024 * 1024)).c_str() : _T("off"));
+    }
+    m_devCache.clear();
+    m_devCacheSize = 0;
+    m_devCacheOverflow = false;
+    m_devCacheComplete = false;
+    m_devCacheIndex = 0;
+    m_passCount = 0;
+    m_uploadCount = 0;
+    m_frame.close();
+    m_alpha.close();
     m_convert.reset();
     m_codecCtxDec.reset();
     m_formatCtx.reset();
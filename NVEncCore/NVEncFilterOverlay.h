@@ -29,9 +29,14 @@
 #pragma once
 
 #include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
 #include "rgy_avutil.h"
 #include "rgy_input.h"
 #include "convert_csp.h"
+#include "rgy_lumakey.h"
 #include "NVEncFilter.h"
 #include "NVEncParam.h"
 
@@ -47,15 +52,31 @@ public:
     virtual tstring print() const override;
 };
 
+// デコード・色変換・不透明度の生成まで済ませたフレーム (host側)
+struct NVEncFilterOverlayHostFrame {
+    int index;          // 入力ファイル内でのフレーム番号
+    std::unique_ptr<uint8_t, aligned_malloc_deleter> buf;
+    size_t bufSize;
+    RGYFrameInfo frame; // 色変換済みのフレーム
+    RGYFrameInfo alpha; // 不透明度 (YUV444)
+
+    NVEncFilterOverlayHostFrame() : index(-1), buf(), bufSize(0), frame(), alpha() {};
+};
+
+// デバイスに転送・crop/resize済みのフレーム
+struct NVEncFilterOverlayDevFrame {
+    std::unique_ptr<CUFrameBuf> frame;
+    std::unique_ptr<CUFrameBuf> alpha;
+};
+
 class NVEncFilterOverlay : public NVEncFilter {
     struct NVEncFilterOverlayFrame {
         std::unique_ptr<NVEncFilterCspCrop> crop;
         std::unique_ptr<NVEncFilterResize> resize;
-        std::unique_ptr<CUFrameBuf> host;
         std::unique_ptr<CUFrameBuf> dev;
         RGYFrameInfo *inputPtr;
 
-        NVEncFilterOverlayFrame() : crop(), resize(), host(), dev(), inputPtr(nullptr) {};
+        NVEncFilterOverlayFrame() : crop(), resize(), dev(), inputPtr(nullptr) {};
         void close();
     };
 public:
@@ -63,11 +84,19 @@ public:
     virtual ~NVEncFilterOverlay();
     virtual RGY_ERR init(shared_ptr<NVEncFilterParam> pParam, shared_ptr<RGYLog> pPrintMes) override;
 protected:
+    virtual RGY_ERR openInput(NVEncFilterParamOverlay *prm);
     virtual RGY_ERR initInput(NVEncFilterParamOverlay *prm);
     virtual RGY_ERR run_filter(const RGYFrameInfo *pInputFrame, RGYFrameInfo **ppOutputFrames, int *pOutputFrameNum, cudaStream_t stream) override;
     virtual void close() override;
 
     std::tuple<RGY_ERR, std::unique_ptr<AVPacket, RGYAVDeleter<AVPacket>>> getFramePkt();
+    RGY_ERR decodeFrame(AVFrame *frame);
+    std::shared_ptr<NVEncFilterOverlayHostFrame> allocHostFrame(std::vector<std::shared_ptr<NVEncFilterOverlayHostFrame>>& pool);
+    RGY_ERR convertFrame(NVEncFilterOverlayHostFrame *hostFrame, const AVFrame *frame);
+    bool pushHostFrame(std::shared_ptr<NVEncFilterOverlayHostFrame> hostFrame);
+    void sourceThread(std::shared_ptr<NVEncFilterParamOverlay> prm);
+    void stopSource();
+    RGY_ERR cacheDevFrame(cudaStream_t stream);
     RGY_ERR getFrame(cudaStream_t stream);
     RGY_ERR prepareFrameDev(NVEncFilterOverlayFrame& target, cudaStream_t stream);
     RGY_ERR overlayFrame(RGYFrameInfo *pOutputFrame, const RGYFrameInfo *pInputFrame, cudaStream_t stream);
@@ -78,8 +107,34 @@ protected:
     std::unique_ptr<RGYConvertCSP> m_convert;
     RGY_CSP m_inputCsp;
     AVStream *m_stream;
+    RGY_CSP m_hostCsp;
+    int m_hostWidth;
+    int m_hostHeight;
+    bool m_readAlphaFromPixFmt;
+    RGYLumaKeyParam m_lumaKeyPrm;
+    funcLumaKey8 m_funcLumaKey8;
+    funcLumaKey16 m_funcLumaKey16;
     NVEncFilterOverlayFrame m_frame;
     NVEncFilterOverlayFrame m_alpha;
 
+    // 入力ファイルのデコードは別スレッドで行い、m_srcQueueで受け渡す
+    std::thread m_srcThread;
+    std::mutex m_srcMtx;
+    std::condition_variable m_srcCv;
+    std::deque<std::shared_ptr<NVEncFilterOverlayHostFrame>> m_srcQueue; // nullptrは1周分の終端
+    RGY_ERR m_srcErr;
+    bool m_srcFin;
+    bool m_srcAbort;
+    size_t m_cacheBudget; // host/deviceそれぞれのキャッシュの上限 (byte)
+
+    // 1周分のフレームがデバイス側のキャッシュに収まる場合は、2周目以降はそちらを使う
+    std::vector<NVEncFilterOverlayDevFrame> m_devCache;
+    size_t m_devCacheSize;
+    bool m_devCacheOverflow;
+    bool m_devCacheComplete;
+    int m_devCacheIndex;
+    int m_passCount;
+    int64_t m_uploadCount;
+
     bool m_bInterlacedWarn;
 };
@@ -27,6 +27,7 @@
 // ------------------------------------------------------------------------------------------
 
 #include <map>
+#include <tuple>
 #include "rgy_avutil.h"
 #include "rgy_filesystem.h"
 #include "cpu_info.h"
@@ -66,6 +67,18 @@ static double get_psnr(double mse, uint64_t nb_frames, int max) {
     return 10.0 * log10((max * max) / (mse / nb_frames));
 }
 
+//ソフトウェアデコード時に比較に使用する色空間 (エンコードのビット深度のplanar)
+static RGY_CSP ssim_sw_csp(const RGY_CSP csp, const int bitDepth) {
+    static const auto cspYUV420 = make_array<RGY_CSP>(RGY_CSP_YV12, RGY_CSP_YV12_09, RGY_CSP_YV12_10, RGY_CSP_YV12_12, RGY_CSP_YV12_14, RGY_CSP_YV12_16);
+    static const auto cspYUV444 = make_array<RGY_CSP>(RGY_CSP_YUV444, RGY_CSP_YUV444_09, RGY_CSP_YUV444_10, RGY_CSP_YUV444_12, RGY_CSP_YUV444_14, RGY_CSP_YUV444_16);
+    const auto& list = (RGY_CSP_CHROMA_FORMAT[csp] == RGY_CHROMAFMT_YUV420) ? cspYUV420 : cspYUV444;
+    if (RGY_CSP_CHROMA_FORMAT[csp] != RGY_CHROMAFMT_YUV420 && RGY_CSP_CHROMA_FORMAT[csp] != RGY_CHROMAFMT_YUV444) {
+        return RGY_CSP_NA;
+    }
+    auto target = std::find_if(list.begin(), list.end(), [bitDepth](RGY_CSP c) { return RGY_CSP_BIT_DEPTH[c] == bitDepth; });
+    return (target != list.end()) ? *target : RGY_CSP_NA;
+}
+
 tstring NVEncFilterParamSsim::print() const {
     tstring str;
     if (ssim) str += _T("ssim ");
@@ -84,6 +97,12 @@ NVEncFilterSsim::NVEncFilterSsim() :
     m_input(),
     m_unused(),
     m_decoder(),
+    m_swDecoder(),
+    m_swPackets(),
+    m_swMtx(),
+    m_swCond(),
+    m_swDecodeErr(false),
+    m_metricCsp(RGY_CSP_NA),
     m_crop(),
     m_cropDToH(),
     m_frameHostSendIndex(0),
@@ -104,7 +123,14 @@ NVEncFilterSsim::NVEncFilterSsim() :
     m_ssimTotal(0.0),
     m_psnrTotalPlane(),
     m_psnrTotal(0.0),
-    m_frames(0) {
+    m_frames(0),
+    m_frameSsim(0.0),
+    m_frameMse(0.0),
+    m_frameMetricsCallback(),
+    m_inputFrames(0),
+    m_tmFirstFrame(),
+    m_tmLastFrame(),
+    m_tmCompareFin() {
     m_name = _T("ssim/psnr/vmaf");
 }
 
@@ -148,12 +174,25 @@ RGY_ERR NVEncFilterSsim::init(shared_ptr<NVEncFilterParam> pParam, shared_ptr<RG
     }
     AddMessage(RGY_LOG_DEBUG, _T("ssim original format %s -> %s.\n"), RGY_CSP_NAMES[pParam->frameIn.csp], RGY_CSP_NAMES[pParam->frameOut.csp]);
 
+    m_metricCsp = pParam->frameOut.csp;
+    if (prm->swDecode) {
+        //CPUでの計算はplanarのYUV420/YUV444のみ対応
+        //ソフトウェアデコーダの出力に合わせ、エンコードのビット深度のplanarに変換して比較する
+        m_metricCsp = ssim_sw_csp(pParam->frameOut.csp, prm->bitDepth);
+        if (m_metricCsp == RGY_CSP_NA) {
+            AddMessage(RGY_LOG_ERROR, _T("unsupported csp %s (%dbit) for ssim/psnr/vmaf calculation with sw decoder.\n"), RGY_CSP_NAMES[pParam->frameOut.csp], prm->bitDepth);
+            return RGY_ERR_UNSUPPORTED;
+        }
+        AddMessage(RGY_LOG_DEBUG, _T("ssim/psnr/vmaf will be calculated using sw decoder (%s).\n"), RGY_CSP_NAMES[m_metricCsp]);
+    }
+
     m_cropDToH.reset();
-    if (prm->vmaf.enable) {
+    if (prm->vmaf.enable || prm->swDecode) {
         unique_ptr<NVEncFilterCspCrop> filterCrop(new NVEncFilterCspCrop());
         shared_ptr<NVEncFilterParamCrop> paramCrop(new NVEncFilterParamCrop());
         paramCrop->frameIn = pParam->frameOut;
         paramCrop->frameOut = pParam->frameOut;
+        paramCrop->frameOut.csp = m_metricCsp;
         paramCrop->baseFps = pParam->baseFps;
         paramCrop->frameIn.mem_type = RGY_MEM_TYPE_GPU;
         paramCrop->frameOut.mem_type = RGY_MEM_TYPE_CPU;
@@ -165,7 +204,8 @@ RGY_ERR NVEncFilterSsim::init(shared_ptr<NVEncFilterParam> pParam, shared_ptr<RG
         }
         m_cropDToH = std::move(filterCrop);
         AddMessage(RGY_LOG_DEBUG, _T("created %s.\n"), m_cropDToH->GetInputMessage().c_str());
-
+    }
+    if (prm->vmaf.enable) {
         if (prm->vmaf.model.length() == 0) {
             AddMessage(RGY_LOG_ERROR, _T("\"model\" not set for vmaf.\n"));
             return RGY_ERR_INVALID_PARAM;
@@ -180,13 +220,15 @@ RGY_ERR NVEncFilterSsim::init(shared_ptr<NVEncFilterParam> pParam, shared_ptr<RG
     }
 
     {
+        auto metricFrame = pParam->frameOut;
+        metricFrame.csp = m_metricCsp;
         int elemSum = 0;
         for (size_t i = 0; i < m_ssimTotalPlane.size(); i++) {
-            const auto plane = getPlane(&pParam->frameOut, (RGY_PLANE)i);
+            const auto plane = getPlane(&metricFrame, (RGY_PLANE)i);
             elemSum += plane.width * plane.height;
         }
         for (size_t i = 0; i < m_ssimTotalPlane.size(); i++) {
-            const auto plane = getPlane(&pParam->frameOut, (RGY_PLANE)i);
+            const auto plane = getPlane(&metricFrame, (RGY_PLANE)i);
             m_planeCoef[i] = (double)(plane.width * plane.height) / elemSum;
             AddMessage(RGY_LOG_DEBUG, _T("Plane coef : %f\n"), m_planeCoef[i]);
         }
@@ -284,6 +326,23 @@ RGY_ERR NVEncFilterSsim::initDecode(const RGYBitstream *bitstream) {
     }
     av_packet_unref(&pkt);
 
+    if (prm->swDecode) {
+        //GPUでデコードできないので、ソフトウェアデコーダを使用する
+        m_swDecoder = std::unique_ptr<AVCodecContext, RGYAVDeleter<AVCodecContext>>(avcodec_alloc_context3(codec), RGYAVDeleter<AVCodecContext>(avcodec_free_context));
+        if (prm->input.codecExtra && prm->input.codecExtraSize > 0) {
+            m_swDecoder->extradata = (uint8_t *)av_mallocz(prm->input.codecExtraSize + AV_INPUT_BUFFER_PADDING_SIZE);
+            m_swDecoder->extradata_size = prm->input.codecExtraSize;
+            memcpy(m_swDecoder->extradata, prm->input.codecExtra, prm->input.codecExtraSize);
+        }
+        m_swDecoder->pkt_timebase = av_make_q(prm->streamtimebase);
+        m_swDecoder->thread_count = 0; //自動
+        if (0 > (ret = avcodec_open2(m_swDecoder.get(), codec, nullptr))) {
+            AddMessage(RGY_LOG_ERROR, _T("failed to open sw decoder for %s: %s.\n"), char_to_tstring(avcodec_get_name(avcodecID)).c_str(), qsv_av_err2str(ret).c_str());
+            return RGY_ERR_NULL_PTR;
+        }
+        AddMessage(RGY_LOG_DEBUG, _T("Opened sw decoder for codec %s\n"), char_to_tstring(avcodec_get_name(avcodecID)).c_str());
+    }
+
     //比較用のスレッドの開始
     m_thread = std::thread(&NVEncFilterSsim::thread_func_ssim_psnr, this, prm->threadParamCompare);
     AddMessage(RGY_LOG_DEBUG, _T("Started ssim/psnr calculation thread.\n"));
@@ -306,7 +365,7 @@ RGY_ERR NVEncFilterSsim::init_cuda_resources() {
 
     //HWデコーダの出力フォーマットに合わせる
     VideoInfo vidInfo = prm->input;
-    if (RGY_CSP_BIT_DEPTH[vidInfo.csp] > 8) {
+    if (!prm->swDecode && RGY_CSP_BIT_DEPTH[vidInfo.csp] > 8) {
         if (RGY_CSP_CHROMA_FORMAT[vidInfo.csp] == RGY_CHROMAFMT_YUV420) {
             vidInfo.csp = RGY_CSP_P010;
         } else if (RGY_CSP_CHROMA_FORMAT[vidInfo.csp] == RGY_CHROMAFMT_YUV444) {
@@ -316,18 +375,20 @@ RGY_ERR NVEncFilterSsim::init_cuda_resources() {
             return RGY_ERR_INVALID_COLOR_FORMAT;
         }
     }
-    AddMessage(RGY_LOG_DEBUG, _T("cuvid output format %s.\n"), RGY_CSP_NAMES[vidInfo.csp]);
+    if (!prm->swDecode) {
+        AddMessage(RGY_LOG_DEBUG, _T("cuvid output format %s.\n"), RGY_CSP_NAMES[vidInfo.csp]);
 
-    m_decoder = std::make_unique<CuvidDecode>();
-    auto result = m_decoder->InitDecode(m_vidctxlock, &vidInfo, nullptr, av_make_q(prm->streamtimebase), m_pLog, NV_ENC_AVCUVID_NATIVE, false);
-    if (result != CUDA_SUCCESS) {
-        AddMessage(RGY_LOG_ERROR, _T("failed to init decoder.\n"));
-        return RGY_ERR_INVALID_PARAM;
+        m_decoder = std::make_unique<CuvidDecode>();
+        auto result = m_decoder->InitDecode(m_vidctxlock, &vidInfo, nullptr, av_make_q(prm->streamtimebase), m_pLog, NV_ENC_AVCUVID_NATIVE, false);
+        if (result != CUDA_SUCCESS) {
+            AddMessage(RGY_LOG_ERROR, _T("failed to init decoder.\n"));
+            return RGY_ERR_INVALID_PARAM;
+        }
     }
     //SSIM用のスレッドで使用するリソースもすべてSSIM用のスレッド内で作成する
     {
         CCtxAutoLock ctxLock(m_vidctxlock);
-        if (prm->ssim) {
+        if (prm->ssim && !prm->swDecode) {
             for (size_t i = 0; i < m_streamCalcSsim.size(); i++) {
                 m_streamCalcSsim[i] = std::unique_ptr<cudaStream_t, cudastream_deleter>(new cudaStream_t(), cudastream_deleter());
                 auto sts = err_to_rgy(cudaStreamCreateWithFlags(m_streamCalcSsim[i].get(), cudaStreamDefault));
@@ -338,7 +399,7 @@ RGY_ERR NVEncFilterSsim::init_cuda_resources() {
                 AddMessage(RGY_LOG_DEBUG, _T("cudaStreamCreateWithFlags for m_streamCalcSsim[%d]: Success.\n"), i);
             }
         }
-        if (prm->psnr) {
+        if (prm->psnr && !prm->swDecode) {
             for (size_t i = 0; i < m_streamCalcPsnr.size(); i++) {
                 m_streamCalcPsnr[i] = std::unique_ptr<cudaStream_t, cudastream_deleter>(new cudaStream_t(), cudastream_deleter());
                 auto sts = err_to_rgy(cudaStreamCreateWithFlags(m_streamCalcPsnr[i].get(), cudaStreamDefault));
@@ -365,8 +426,8 @@ RGY_ERR NVEncFilterSsim::init_cuda_resources() {
         }
         AddMessage(RGY_LOG_DEBUG, _T("cudaEventCreate for m_cropEvent: Success.\n"));
 
-        if (prm->vmaf.enable) {
-            //VMAF用のスレッドで使用するリソースもすべてスレッド内で作成する
+        if (m_cropDToH) {
+            //VMAF用/CPUでの計算用のHostメモリのバッファもスレッド内で作成する
             const auto frameInfo = m_cropDToH->GetFilterParam()->frameOut;
             for (auto &frame : m_frameHostOrg) {
                 frame = std::make_unique<CUFrameBuf>(frameInfo.width, frameInfo.height, frameInfo.csp);
@@ -384,12 +445,13 @@ RGY_ERR NVEncFilterSsim::init_cuda_resources() {
                     return sts;
                 }
             }
-
+        }
 #if ENABLE_VMAF
+        if (prm->vmaf.enable) {
             m_vmaf.thread = std::thread(&NVEncFilterSsim::thread_func_vmaf, this, prm->threadParamCompare);
             AddMessage(RGY_LOG_DEBUG, _T("Started vmaf calculation thread.\n"));
-#endif //#if ENABLE_VMAF
         }
+#endif //#if ENABLE_VMAF
     }
     return RGY_ERR_NONE;
 }
@@ -430,6 +492,29 @@ void NVEncFilterSsim::close_cuda_resources() {
 }
 
 RGY_ERR NVEncFilterSsim::addBitstream(const RGYBitstream *bitstream) {
+    if (m_swDecoder) {
+        //ソフトウェアデコードは比較用のスレッドで行う
+        if (m_swDecodeErr) {
+            return RGY_ERR_UNKNOWN;
+        }
+        std::unique_ptr<AVPacket, RGYAVDeleter<AVPacket>> pkt;
+        if (bitstream != nullptr) {
+            pkt = std::unique_ptr<AVPacket, RGYAVDeleter<AVPacket>>(av_packet_alloc(), RGYAVDeleter<AVPacket>(av_packet_free));
+            if (av_new_packet(pkt.get(), (int)bitstream->size()) < 0) {
+                AddMessage(RGY_LOG_ERROR, _T("Failed to allocate packet.\n"));
+                return RGY_ERR_NULL_PTR;
+            }
+            memcpy(pkt->data, bitstream->data(), bitstream->size());
+            pkt->pts = bitstream->pts();
+            pkt->dts = bitstream->dts();
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_swMtx);
+            m_swPackets.push_back(std::move(pkt));
+        }
+        m_swCond.notify_all();
+        return RGY_ERR_NONE;
+    }
     if (m_decoder->GetError()) {
         return RGY_ERR_UNKNOWN;
     }
@@ -461,6 +546,10 @@ RGY_ERR NVEncFilterSsim::run_filter(const RGYFrameInfo *pInputFrame, RGYFrameInf
     RGY_ERR sts = RGY_ERR_NONE;
 
     std::lock_guard<std::mutex> lock(m_mtx); //ロックを忘れないこと
+    m_tmLastFrame = std::chrono::system_clock::now();
+    if (m_inputFrames++ == 0) {
+        m_tmFirstFrame = m_tmLastFrame;
+    }
     if (m_unused.empty()) {
         //待機中のフレームバッファがなければ新たに作成する
         auto frameBuf = std::make_unique<CUFrameBuf>();
@@ -514,7 +603,7 @@ void NVEncFilterSsim::showResult() {
     }
     if (prm->ssim) {
         auto str = strsprintf(_T("\nSSIM YUV:"));
-        for (int i = 0; i < RGY_CSP_PLANES[m_param->frameOut.csp]; i++) {
+        for (int i = 0; i < RGY_CSP_PLANES[m_metricCsp]; i++) {
             str += strsprintf(_T(" %f (%f),"), m_ssimTotalPlane[i] / m_frames, ssim_db(m_ssimTotalPlane[i], (double)m_frames));
         }
         str += strsprintf(_T(" All: %f (%f), (Frames: %d)\n"), m_ssimTotal / m_frames, ssim_db(m_ssimTotal, (double)m_frames), m_frames);
@@ -522,19 +611,54 @@ void NVEncFilterSsim::showResult() {
     }
     if (prm->psnr) {
         auto str = strsprintf(_T("\nPSNR YUV:"));
-        for (int i = 0; i < RGY_CSP_PLANES[m_param->frameOut.csp]; i++) {
-            str += strsprintf(_T(" %f,"), get_psnr(m_psnrTotalPlane[i], m_frames, (1 << RGY_CSP_BIT_DEPTH[prm->frameOut.csp]) - 1));
+        for (int i = 0; i < RGY_CSP_PLANES[m_metricCsp]; i++) {
+            str += strsprintf(_T(" %f,"), get_psnr(m_psnrTotalPlane[i], m_frames, (1 << RGY_CSP_BIT_DEPTH[m_metricCsp]) - 1));
         }
-        str += strsprintf(_T(" Avg: %f, (Frames: %d)\n"), get_psnr(m_psnrTotal, m_frames, (1 << RGY_CSP_BIT_DEPTH[prm->frameOut.csp]) - 1), m_frames);
+        str += strsprintf(_T(" Avg: %f, (Frames: %d)\n"), get_psnr(m_psnrTotal, m_frames, (1 << RGY_CSP_BIT_DEPTH[m_metricCsp]) - 1), m_frames);
         AddMessage(RGY_LOG_INFO, _T("%s\n"), str.c_str());
     }
 #if ENABLE_VMAF
     if (prm->vmaf.enable) {
         if (m_vmaf.error == 0) {
             AddMessage(RGY_LOG_INFO, _T("VMAF Score %.6f\n"), m_vmaf.score);
+            if (!m_vmaf.scores.empty()) {
+                AddMessage(RGY_LOG_INFO, _T("VMAF harmonic mean %.6f, min %.6f, 1%% %.6f, 5%% %.6f (Frames: %d)\n"),
+                    m_vmaf.scores.harmonicMean(), m_vmaf.scores.minScore(),
+                    m_vmaf.scores.percentile(1.0), m_vmaf.scores.percentile(5.0), (int)m_vmaf.scores.count());
+            }
         }
     }
 #endif //#if ENABLE_VMAF
+    showSpeed();
+}
+
+void NVEncFilterSsim::showSpeed() {
+    auto prm = std::dynamic_pointer_cast<NVEncFilterParamSsim>(m_param);
+    if (!prm || m_inputFrames <= 1) {
+        return;
+    }
+    //エンコード側からフレームが渡された速度と、評価の計算速度を比較する
+    auto sec = [](const std::chrono::system_clock::time_point& start, const std::chrono::system_clock::time_point& fin) {
+        return std::chrono::duration_cast<std::chrono::microseconds>(fin - start).count() * 1e-6;
+    };
+    const double encSec = sec(m_tmFirstFrame, m_tmLastFrame);
+    auto str = strsprintf(_T("Metric speed: input %.2f fps"), (encSec > 0.0) ? m_inputFrames / encSec : 0.0);
+    auto tmFin = m_tmCompareFin;
+    if (prm->ssim || prm->psnr) {
+        const double calcSec = sec(m_tmFirstFrame, m_tmCompareFin);
+        str += strsprintf(_T(", %s %.2f fps"), (prm->swDecode) ? _T("ssim/psnr(sw)") : _T("ssim/psnr"), (calcSec > 0.0) ? m_frames / calcSec : 0.0);
+    }
+#if ENABLE_VMAF
+    if (prm->vmaf.enable && m_vmaf.error == 0) {
+        const double calcSec = sec(m_tmFirstFrame, m_vmaf.tmFin);
+        const int shards = std::max(prm->vmaf.shards, 1);
+        str += strsprintf(_T(", vmaf %.2f fps (%d shard%s)"), (calcSec > 0.0) ? m_vmaf.procIndex / calcSec : 0.0, shards, (shards > 1) ? _T("s") : _T(""));
+        tmFin = std::max(tmFin, m_vmaf.tmFin);
+    }
+#endif //#if ENABLE_VMAF
+    //エンコードの終了後に評価の終了を待った時間
+    str += strsprintf(_T(", waited %.2f sec after last frame"), std::max(sec(m_tmLastFrame, tmFin), 0.0));
+    AddMessage(RGY_LOG_INFO, _T("%s\n"), str.c_str());
 }
 
 #if ENABLE_VMAF
@@ -621,6 +745,11 @@ RGY_ERR NVEncFilterSsim::thread_func_vmaf(RGYParamThread threadParam) {
     for (auto &handle : m_vmaf.heProcFin) {
         SetEvent(handle);
     }
+    if (prm->vmaf.shards > 1) {
+        auto sts = run_vmaf_sharded(frameInfo, (int)vmafPixFmt, threadParam);
+        m_vmaf.tmFin = std::chrono::system_clock::now();
+        return sts;
+    }
     const bool do_psnr = false;
     const bool do_ssim = false;
     const bool do_ms_ssim = false;
@@ -741,6 +870,8 @@ RGY_ERR NVEncFilterSsim::thread_func_vmaf(RGYParamThread threadParam) {
 
         m_vmaf.error = read_frames_vmaf2(&pic_ref, &pic_dist, this);
         if (m_vmaf.error == 2) {
+            vmaf_picture_unref(&pic_ref);
+            vmaf_picture_unref(&pic_dist);
             break; //EOF
         } else if (m_vmaf.error == 1) {
             vmaf_picture_unref(&pic_ref);
@@ -777,6 +908,14 @@ RGY_ERR NVEncFilterSsim::thread_func_vmaf(RGYParamThread threadParam) {
         AddMessage(RGY_LOG_ERROR, _T("problem generating pooled VMAF score\n"));
         return RGY_ERR_UNKNOWN;
     }
+    //調和平均やパーセンタイルの計算用に、フレームごとのスコアを取得する (subsampleで計算しなかったフレームは取得できない)
+    for (unsigned i = 0; i < picture_index; i++) {
+        double score = 0.0;
+        if (vmaf_score_at_index(vmaf.get(), model.get(), &score, i) == 0) {
+            m_vmaf.scores.add((int)i, score);
+        }
+    }
+    m_vmaf.tmFin = std::chrono::system_clock::now();
 #if 0
     const enum VmafOutputFormat output_fmt = log_fmt_map(log_fmt);
     if (output_fmt) {
@@ -795,6 +934,300 @@ RGY_ERR NVEncFilterSsim::thread_func_vmaf(RGYParamThread threadParam) {
     vmaf.reset();
     return (m_vmaf.error == 0) ? RGY_ERR_NONE : RGY_ERR_UNKNOWN;
 }
+
+// 分割計算の1区間
+//  motionの特徴量は前後のフレームを参照するため、区間の前後に1フレームずつ余分に読み込んで計算し、
+//  余分に読み込んだフレームのスコアは使わない
+struct NVEncFilterVMAFShardJob {
+    int scoreStart; // スコアを採用する範囲 [scoreStart, scoreEnd)
+    int scoreEnd;
+    std::deque<std::tuple<VmafPicture, VmafPicture, unsigned>> frames; // オリジナル, エンコードしたもの, フレーム番号
+    bool fin;       // すべてのフレームを追加した
+
+    NVEncFilterVMAFShardJob(int start, int end) : scoreStart(start), scoreEnd(end), frames(), fin(false) {};
+    ~NVEncFilterVMAFShardJob() {
+        for (auto& frame : frames) {
+            vmaf_picture_unref(&std::get<0>(frame));
+            vmaf_picture_unref(&std::get<1>(frame));
+        }
+    }
+};
+
+//区間の重複部分で使うため、フレームを複製する
+static int vmaf_picture_copy(VmafPicture *dst, const VmafPicture *src) {
+    int err = vmaf_picture_alloc(dst, src->pix_fmt, src->bpc, src->w[0], src->h[0]);
+    if (err) {
+        return err;
+    }
+    const int pixsize = (src->bpc > 8) ? 2 : 1;
+    for (int i = 0; i < 3; i++) {
+        for (unsigned y = 0; y < src->h[i]; y++) {
+            memcpy((uint8_t *)dst->data[i] + dst->stride[i] * y, (const uint8_t *)src->data[i] + src->stride[i] * y, src->w[i] * pixsize);
+        }
+    }
+    return 0;
+}
+
+struct NVEncFilterVMAFShardQueue {
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::deque<std::shared_ptr<NVEncFilterVMAFShardJob>> pending; // まだ計算を開始していない区間
+    int active;  // 計算の終わっていない区間の数
+    bool fin;    // もう区間は追加されない
+    bool abort;  // エラーで中断する
+
+    NVEncFilterVMAFShardQueue() : mtx(), cv(), pending(), active(0), fin(false), abort(false) {};
+};
+
+RGY_ERR NVEncFilterSsim::run_vmaf_sharded(const RGYFrameInfo& frameInfo, int pixFmt, RGYParamThread threadParam) {
+    auto prm = std::dynamic_pointer_cast<NVEncFilterParamSsim>(m_param);
+    if (!prm) {
+        AddMessage(RGY_LOG_ERROR, _T("Invalid parameter type.\n"));
+        return RGY_ERR_INVALID_PARAM;
+    }
+    const int shards = prm->vmaf.shards;
+    const int shardFrames = std::max(prm->vmaf.shard_frames, 2);
+    const int threadsTotal = (prm->vmaf.threads > 0) ? prm->vmaf.threads : get_cpu_info().physical_cores;
+    const int threadsPerShard = std::max(threadsTotal / shards, 1);
+    AddMessage(RGY_LOG_DEBUG, _T("vmaf: %d shards x %d frames, %d thread(s) per shard.\n"), shards, shardFrames, threadsPerShard);
+
+    NVEncFilterVMAFShardQueue queue;
+    std::vector<RGYMetricScores> shardScores(shards);
+    std::vector<RGY_ERR> shardErr(shards, RGY_ERR_NONE);
+    std::vector<std::thread> workers;
+    for (int i = 0; i < shards; i++) {
+        workers.push_back(std::thread([&, i]() {
+            shardErr[i] = thread_func_vmaf_shard(&queue, &shardScores[i], threadsPerShard, threadParam);
+        }));
+    }
+
+    //フレームを順に読み込み、区間ごとに振り分ける
+    RGY_ERR sts = RGY_ERR_NONE;
+    std::map<int, std::shared_ptr<NVEncFilterVMAFShardJob>> filling; // フレームを追加中の区間
+    for (unsigned index = 0;; index++) {
+        VmafPicture pic_ref; // オリジナルのこと
+        VmafPicture pic_dist; //エンコードしたもののこと
+        int err = vmaf_picture_alloc(&pic_ref, (VmafPixelFormat)pixFmt, RGY_CSP_BIT_DEPTH[frameInfo.csp], frameInfo.width, frameInfo.height);
+        err |= vmaf_picture_alloc(&pic_dist, (VmafPixelFormat)pixFmt, RGY_CSP_BIT_DEPTH[frameInfo.csp], frameInfo.width, frameInfo.height);
+        if (err) {
+            vmaf_picture_unref(&pic_ref);
+            vmaf_picture_unref(&pic_dist);
+            AddMessage(RGY_LOG_ERROR, _T("problem allocating picture memory\n"));
+            sts = RGY_ERR_NULL_PTR;
+            break;
+        }
+        if (read_frames_vmaf2(&pic_ref, &pic_dist, this) != 0) {
+            vmaf_picture_unref(&pic_ref);
+            vmaf_picture_unref(&pic_dist);
+            break; //EOF
+        }
+        const int chunk = (int)index / shardFrames;
+        std::vector<int> targets = { chunk };
+        if ((int)index % shardFrames == shardFrames - 1) {
+            targets.push_back(chunk + 1); //次の区間の前側の重複
+        }
+        if ((int)index % shardFrames == 0 && chunk > 0) {
+            targets.push_back(chunk - 1); //前の区間の後ろ側の重複
+        }
+        bool passed = false; //pic_ref, pic_distを区間に渡したか
+        bool abort = false;
+        {
+            std::unique_lock<std::mutex> lock(queue.mtx);
+            for (size_t it = 0; it < targets.size(); it++) {
+                const int target = targets[it];
+                auto job = filling.find(target);
+                if (job == filling.end()) {
+                    //計算中の区間がshards未満になるまで、新たな区間は開始しない
+                    queue.cv.wait(lock, [&]() { return queue.abort || queue.active < shards; });
+                    if (queue.abort) {
+                        break;
+                    }
+                    auto newJob = std::make_shared<NVEncFilterVMAFShardJob>(target * shardFrames, (target + 1) * shardFrames);
+                    queue.pending.push_back(newJob);
+                    queue.active++;
+                    job = filling.emplace(target, newJob).first;
+                }
+                if (it + 1 == targets.size()) {
+                    job->second->frames.push_back(std::make_tuple(pic_ref, pic_dist, index));
+                    passed = true;
+                } else {
+                    //重複部分は複製して渡す
+                    VmafPicture ref, dist;
+                    err = vmaf_picture_copy(&ref, &pic_ref);
+                    err |= vmaf_picture_copy(&dist, &pic_dist);
+                    if (err) {
+                        vmaf_picture_unref(&ref);
+                        vmaf_picture_unref(&dist);
+                        AddMessage(RGY_LOG_ERROR, _T("problem allocating picture memory\n"));
+                        sts = RGY_ERR_NULL_PTR;
+                        break;
+                    }
+                    job->second->frames.push_back(std::make_tuple(ref, dist, index));
+                }
+                if (target < chunk) {
+                    job->second->fin = true;
+                    filling.erase(job);
+                }
+            }
+            abort = queue.abort;
+        }
+        queue.cv.notify_all();
+        if (!passed) {
+            vmaf_picture_unref(&pic_ref);
+            vmaf_picture_unref(&pic_dist);
+        }
+        if (abort || sts != RGY_ERR_NONE) {
+            break;
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(queue.mtx);
+        for (auto& job : filling) {
+            job.second->fin = true;
+        }
+        filling.clear();
+        queue.fin = true;
+        if (sts != RGY_ERR_NONE) {
+            queue.abort = true;
+        }
+    }
+    queue.cv.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    for (const auto err : shardErr) {
+        if (err != RGY_ERR_NONE) {
+            sts = err;
+        }
+    }
+    if (sts != RGY_ERR_NONE) {
+        m_vmaf.error = 1;
+        return sts;
+    }
+    //区間ごとの平均ではなく、すべてのフレームのスコアから集計する
+    for (const auto& scores : shardScores) {
+        m_vmaf.scores.merge(scores);
+    }
+    m_vmaf.score = m_vmaf.scores.mean();
+    m_vmaf.error = 0;
+    return RGY_ERR_NONE;
+}
+
+RGY_ERR NVEncFilterSsim::thread_func_vmaf_shard(NVEncFilterVMAFShardQueue *queue, RGYMetricScores *scores, int threads, RGYParamThread threadParam) {
+    threadParam.apply(GetCurrentThread());
+    auto setAbort = [queue]() {
+        {
+            std::lock_guard<std::mutex> lock(queue->mtx);
+            queue->abort = true;
+        }
+        queue->cv.notify_all();
+    };
+    auto prm = std::dynamic_pointer_cast<NVEncFilterParamSsim>(m_param);
+    if (!prm) {
+        AddMessage(RGY_LOG_ERROR, _T("Invalid parameter type.\n"));
+        setAbort();
+        return RGY_ERR_INVALID_PARAM;
+    }
+    std::string model_str;
+    if (tchar_to_string(prm->vmaf.model.c_str(), model_str) == 0) {
+        AddMessage(RGY_LOG_ERROR, _T("Failed to convert model \"%s\" to char.\n"), prm->vmaf.model.c_str());
+        setAbort();
+        return RGY_ERR_INVALID_PARAM;
+    }
+    //モデルは区間をまたいで使いまわす
+    VmafModelConfig model_cfg;
+    model_cfg.name = "vmaf";
+    model_cfg.flags = (prm->vmaf.enable_transform || prm->vmaf.phone_model) ? VMAF_MODEL_FLAG_ENABLE_TRANSFORM : VMAF_MODEL_FLAGS_DEFAULT;
+    VmafModel *model_ptr = nullptr;
+    int err = (rgy_file_exists(model_str))
+        ? vmaf_model_load_from_path(&model_ptr, &model_cfg, model_str.c_str())
+        : vmaf_model_load(&model_ptr, &model_cfg, model_str.c_str());
+    if (err) {
+        AddMessage(RGY_LOG_ERROR, _T("problem loading model: %s\n"), prm->vmaf.model.c_str());
+        setAbort();
+        return RGY_ERR_UNKNOWN;
+    }
+    std::unique_ptr<VmafModel, decltype(&vmaf_model_destroy)> model(model_ptr, vmaf_model_destroy);
+
+    for (;;) {
+        std::shared_ptr<NVEncFilterVMAFShardJob> job;
+        {
+            std::unique_lock<std::mutex> lock(queue->mtx);
+            queue->cv.wait(lock, [&]() { return queue->abort || queue->fin || !queue->pending.empty(); });
+            if (queue->abort || queue->pending.empty()) {
+                break;
+            }
+            job = queue->pending.front();
+            queue->pending.pop_front();
+        }
+        //libvmafのコンテキストは区間ごとに作り直す
+        VmafConfiguration cfg;
+        cfg.log_level = VMAF_LOG_LEVEL_INFO;
+        cfg.n_threads = threads;
+        cfg.n_subsample = prm->vmaf.subsample;
+        cfg.cpumask = 0;
+        VmafContext *vmafptr = nullptr;
+        if (vmaf_init(&vmafptr, cfg)) {
+            AddMessage(RGY_LOG_ERROR, _T("problem initializing VMAF context\n"));
+            setAbort();
+            return RGY_ERR_UNKNOWN;
+        }
+        std::unique_ptr<VmafContext, decltype(&vmaf_close)> vmaf(vmafptr, vmaf_close);
+        if (vmaf_use_features_from_model(vmaf.get(), model.get())) {
+            AddMessage(RGY_LOG_ERROR, _T("problem loading feature extractors from model: %s\n"), prm->vmaf.model.c_str());
+            setAbort();
+            return RGY_ERR_UNKNOWN;
+        }
+        //フレーム番号は通しの番号のまま渡し、subsampleの対象が分割しない場合と一致するようにする
+        int indexFirst = -1;
+        int indexLast = -1;
+        for (;;) {
+            std::tuple<VmafPicture, VmafPicture, unsigned> frame;
+            {
+                std::unique_lock<std::mutex> lock(queue->mtx);
+                queue->cv.wait(lock, [&]() { return queue->abort || job->fin || !job->frames.empty(); });
+                if (queue->abort) {
+                    return RGY_ERR_NONE;
+                }
+                if (job->frames.empty()) {
+                    break;
+                }
+                frame = job->frames.front();
+                job->frames.pop_front();
+            }
+            const auto index = std::get<2>(frame);
+            if (indexFirst < 0) {
+                indexFirst = (int)index;
+            }
+            indexLast = (int)index;
+            if (vmaf_read_pictures(vmaf.get(), &std::get<0>(frame), &std::get<1>(frame), index)) {
+                AddMessage(RGY_LOG_ERROR, _T("problem reading pictures\n"));
+                setAbort();
+                return RGY_ERR_UNKNOWN;
+            }
+        }
+        if (vmaf_read_pictures(vmaf.get(), NULL, NULL, 0)) {
+            AddMessage(RGY_LOG_ERROR, _T("problem flushing context\n"));
+            setAbort();
+            return RGY_ERR_UNKNOWN;
+        }
+        if (indexFirst >= 0) {
+            for (int i = std::max(indexFirst, job->scoreStart); i <= indexLast && i < job->scoreEnd; i++) {
+                double score = 0.0;
+                if (vmaf_score_at_index(vmaf.get(), model.get(), &score, (unsigned)i) == 0) {
+                    scores->add(i, score);
+                }
+            }
+        }
+        vmaf.reset();
+        {
+            std::lock_guard<std::mutex> lock(queue->mtx);
+            queue->active--;
+        }
+        queue->cv.notify_all();
+    }
+    return RGY_ERR_NONE;
+}
 #endif //#if ENABLE_VMAF
 
 RGY_ERR NVEncFilterSsim::thread_func_ssim_psnr(RGYParamThread threadParam) {
@@ -805,7 +1238,8 @@ RGY_ERR NVEncFilterSsim::thread_func_ssim_psnr(RGYParamThread threadParam) {
         return sts;
     }
     m_decodeStarted = true;
-    auto ret = compare_frames(true);
+    auto ret = (m_swDecoder) ? compare_frames_sw() : compare_frames(true);
+    m_tmCompareFin = std::chrono::system_clock::now();
     AddMessage(RGY_LOG_DEBUG, _T("Finishing ssim/psnr calculation thread: %s.\n"), get_err_mes(ret));
 #if ENABLE_VMAF
     m_vmaf.thread_fin();
@@ -971,6 +1405,12 @@ RGY_ERR NVEncFilterSsim::compare_frames(bool flush) {
         if (sts_filter != RGY_ERR_NONE) {
             return sts_filter;
         }
+        if (m_frameMetricsCallback) {
+            auto prm = std::dynamic_pointer_cast<NVEncFilterParamSsim>(m_param);
+            const int maxval = (1 << RGY_CSP_BIT_DEPTH[m_metricCsp]) - 1;
+            const double psnr = (m_frameMse > 0.0) ? std::min(get_psnr(m_frameMse, 1, maxval), 100.0) : 100.0;
+            m_frameMetricsCallback(m_frames, prm->ssim ? m_frameSsim : -1.0, prm->psnr ? psnr : -1.0);
+        }
 
         //フレームをm_inputからm_unusedに移す
         std::lock_guard<std::mutex> lock(m_mtx); //ロックを忘れないこと
@@ -981,12 +1421,194 @@ RGY_ERR NVEncFilterSsim::compare_frames(bool flush) {
     return RGY_ERR_NONE;
 }
 
+RGY_ERR NVEncFilterSsim::compare_frames_sw() {
+    std::unique_ptr<AVFrame, RGYAVDeleter<AVFrame>> frame(av_frame_alloc(), RGYAVDeleter<AVFrame>(av_frame_free));
+    bool flushed = false;
+    while (!m_abort) {
+        std::unique_ptr<AVPacket, RGYAVDeleter<AVPacket>> pkt;
+        if (!flushed) {
+            std::unique_lock<std::mutex> lock(m_swMtx);
+            m_swCond.wait(lock, [&]() { return m_abort || !m_swPackets.empty(); });
+            if (m_abort) {
+                break;
+            }
+            pkt = std::move(m_swPackets.front());
+            m_swPackets.pop_front();
+            flushed = !pkt; //nullptrならflush
+        }
+        //送るたびにすべてのフレームを取り出しているので、AVERROR(EAGAIN)にはならない
+        int ret = avcodec_send_packet(m_swDecoder.get(), pkt.get());
+        if (ret < 0 && ret != AVERROR_EOF) {
+            AddMessage(RGY_LOG_ERROR, _T("failed to send packet to sw decoder: %s.\n"), qsv_av_err2str(ret).c_str());
+            m_swDecodeErr = true;
+            return RGY_ERR_UNDEFINED_BEHAVIOR;
+        }
+        for (;;) {
+            ret = avcodec_receive_frame(m_swDecoder.get(), frame.get());
+            if (ret == AVERROR(EAGAIN)) {
+                break;
+            }
+            if (ret == AVERROR_EOF) {
+                AddMessage(RGY_LOG_DEBUG, _T("Finished decoding.\n"));
+                return RGY_ERR_NONE;
+            }
+            if (ret < 0) {
+                AddMessage(RGY_LOG_ERROR, _T("failed to receive frame from sw decoder: %s.\n"), qsv_av_err2str(ret).c_str());
+                m_swDecodeErr = true;
+                return RGY_ERR_UNDEFINED_BEHAVIOR;
+            }
+            auto sts = compare_frame_sw(frame.get());
+            av_frame_unref(frame.get());
+            if (sts != RGY_ERR_NONE) {
+                m_swDecodeErr = true;
+                return sts;
+            }
+        }
+    }
+    return RGY_ERR_NONE;
+}
+
+RGY_ERR NVEncFilterSsim::compare_frame_sw(const AVFrame *frame) {
+    auto prm = std::dynamic_pointer_cast<NVEncFilterParamSsim>(m_param);
+    if (!prm) {
+        AddMessage(RGY_LOG_ERROR, _T("Invalid parameter type.\n"));
+        return RGY_ERR_INVALID_PARAM;
+    }
+#if ENABLE_VMAF
+    if (prm->vmaf.enable) {
+        WaitForSingleObject(m_vmaf.heProcFin[m_frameHostSendIndex % m_vmaf.heProcFin.size()], INFINITE);
+    }
+#endif //#if ENABLE_VMAF
+    CUFrameBuf *originalFrame = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(m_mtx); //ロックを忘れないこと
+        if (m_input.empty()) {
+            AddMessage(RGY_LOG_ERROR, _T("Original frame #%d to be compared is missing.\n"), m_frames);
+            return RGY_ERR_UNKNOWN;
+        }
+        originalFrame = m_input.front().get();
+    }
+    //オリジナルのフレームをHostメモリに転送する
+    auto &frameHostOrg = m_frameHostOrg[m_frameHostSendIndex % m_frameHostOrg.size()];
+    {
+        NVEncCtxAutoLock(ctxlock(m_vidctxlock));
+        cudaStreamWaitEvent(*m_streamCrop.get(), originalFrame->event, 0);
+        int cropFilterOutputNum = 0;
+        RGYFrameInfo *outInfoOrg[1] = { &frameHostOrg->frame };
+        auto sts_filter = m_cropDToH->filter(&originalFrame->frame, (RGYFrameInfo **)&outInfoOrg, &cropFilterOutputNum, *m_streamCrop.get());
+        if (sts_filter != RGY_ERR_NONE || outInfoOrg[0] == nullptr || cropFilterOutputNum != 1) {
+            AddMessage(RGY_LOG_ERROR, _T("Error while running filter \"%s\".\n"), m_cropDToH->name().c_str());
+            return (sts_filter != RGY_ERR_NONE) ? sts_filter : RGY_ERR_UNKNOWN;
+        }
+        cudaEventRecord(frameHostOrg->event, *m_streamCrop.get());
+        auto sts = err_to_rgy(cudaEventSynchronize(frameHostOrg->event));
+        if (sts != RGY_ERR_NONE) {
+            AddMessage(RGY_LOG_ERROR, _T("error at m_cropDToH(Org)->filter: %s.\n"), get_err_mes(sts));
+            return sts;
+        }
+    }
+    //デコードしたフレームを比較用のバッファにコピーする
+    auto &frameHostEnc = m_frameHostEnc[m_frameHostSendIndex % m_frameHostEnc.size()];
+    auto sts = copy_decoded_frame(&frameHostEnc->frame, frame);
+    if (sts != RGY_ERR_NONE) {
+        return sts;
+    }
+    sts = calc_ssim_psnr_cpu(&frameHostOrg->frame, &frameHostEnc->frame);
+    if (sts != RGY_ERR_NONE) {
+        return sts;
+    }
+    m_frameHostSendIndex++;
+
+    if (m_frameMetricsCallback) {
+        const int maxval = (1 << RGY_CSP_BIT_DEPTH[m_metricCsp]) - 1;
+        const double psnr = (m_frameMse > 0.0) ? std::min(get_psnr(m_frameMse, 1, maxval), 100.0) : 100.0;
+        m_frameMetricsCallback(m_frames, prm->ssim ? m_frameSsim : -1.0, prm->psnr ? psnr : -1.0);
+    }
+
+    //フレームをm_inputからm_unusedに移す
+    std::lock_guard<std::mutex> lock(m_mtx); //ロックを忘れないこと
+    m_unused.push_back(std::move(m_input.front()));
+    m_input.pop_front();
+    m_frames++;
+    return RGY_ERR_NONE;
+}
+
+RGY_ERR NVEncFilterSsim::copy_decoded_frame(RGYFrameInfo *dst, const AVFrame *src) {
+    const auto desc = av_pix_fmt_desc_get((AVPixelFormat)src->format);
+    const int bitdepth = RGY_CSP_BIT_DEPTH[dst->csp];
+    const int log2_chroma = (RGY_CSP_CHROMA_FORMAT[dst->csp] == RGY_CHROMAFMT_YUV420) ? 1 : 0;
+    if (desc == nullptr
+        || (desc->flags & (AV_PIX_FMT_FLAG_RGB | AV_PIX_FMT_FLAG_BE)) != 0
+        || (desc->flags & AV_PIX_FMT_FLAG_PLANAR) == 0
+        || desc->nb_components < 3
+        || desc->comp[0].depth != bitdepth
+        || desc->log2_chroma_w != log2_chroma
+        || desc->log2_chroma_h != log2_chroma
+        || src->width < dst->width
+        || src->height < dst->height) {
+        AddMessage(RGY_LOG_ERROR, _T("Unexpected frame from sw decoder: %s %dx%d, expected %s %dx%d.\n"),
+            char_to_tstring((desc) ? desc->name : "unknown").c_str(), src->width, src->height,
+            RGY_CSP_NAMES[dst->csp], dst->width, dst->height);
+        return RGY_ERR_INVALID_COLOR_FORMAT;
+    }
+    const int pixsize = (bitdepth > 8) ? 2 : 1;
+    for (int i = 0; i < RGY_CSP_PLANES[dst->csp]; i++) {
+        auto plane = getPlane(dst, (RGY_PLANE)i);
+        for (int y = 0; y < plane.height; y++) {
+            memcpy(plane.ptr[0] + y * plane.pitch[0], src->data[i] + y * src->linesize[i], plane.width * pixsize);
+        }
+    }
+    return RGY_ERR_NONE;
+}
+
+RGY_ERR NVEncFilterSsim::calc_ssim_psnr_cpu(const RGYFrameInfo *p0, const RGYFrameInfo *p1) {
+    auto prm = std::dynamic_pointer_cast<NVEncFilterParamSsim>(m_param);
+    if (!prm) {
+        AddMessage(RGY_LOG_ERROR, _T("Invalid parameter type.\n"));
+        return RGY_ERR_INVALID_PARAM;
+    }
+    //計算方法はGPU版(calc_ssim_psnr)と同じ
+    const int bitdepth = RGY_CSP_BIT_DEPTH[p0->csp];
+    if (prm->ssim) {
+        double ssimv = 0.0;
+        for (int i = 0; i < RGY_CSP_PLANES[p0->csp]; i++) {
+            const auto plane0 = getPlane(p0, (RGY_PLANE)i);
+            const auto plane1 = getPlane(p1, (RGY_PLANE)i);
+            const double ssimPlane = rgy_ssim_plane(plane0.ptr[0], plane0.pitch[0], plane1.ptr[0], plane1.pitch[0], plane0.width, plane0.height, bitdepth);
+            m_ssimTotalPlane[i] += ssimPlane;
+            ssimv += ssimPlane * m_planeCoef[i];
+        }
+        m_ssimTotal += ssimv;
+        m_frameSsim = ssimv;
+    }
+    if (prm->psnr) {
+        double psnrv = 0.0;
+        for (int i = 0; i < RGY_CSP_PLANES[p0->csp]; i++) {
+            const auto plane0 = getPlane(p0, (RGY_PLANE)i);
+            const auto plane1 = getPlane(p1, (RGY_PLANE)i);
+            const uint64_t sse = rgy_sse_plane(plane0.ptr[0], plane0.pitch[0], plane1.ptr[0], plane1.pitch[0], plane0.width, plane0.height, bitdepth);
+            const double psnrPlaneF = sse / (double)(plane0.width * plane0.height);
+            m_psnrTotalPlane[i] += psnrPlaneF;
+            psnrv += psnrPlaneF * m_planeCoef[i];
+        }
+        m_psnrTotal += psnrv;
+        m_frameMse = psnrv;
+    }
+    return RGY_ERR_NONE;
+}
+
 void NVEncFilterSsim::close() {
     if (m_thread.joinable()) {
         AddMessage(RGY_LOG_DEBUG, _T("Forcing ssim/psnr calculation thread to finish.\n"));
-        m_abort = true;
+        {
+            std::lock_guard<std::mutex> lock(m_swMtx);
+            m_abort = true;
+        }
+        m_swCond.notify_all();
         m_thread.join();
     }
+    m_swPackets.clear();
+    m_swDecoder.reset();
     close_cuda_resources();
     AddMessage(RGY_LOG_DEBUG, _T("closed ssim/psnr filter.\n"));
 }
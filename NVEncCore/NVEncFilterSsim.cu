@@ -424,6 +424,7 @@ RGY_ERR NVEncFilterSsim::calc_ssim_psnr(const RGYFrameInfo *p0, const RGYFrameIn
             AddMessage(RGY_LOG_TRACE, _T("ssimPlane = %.16e, m_ssimTotalPlane[i] = %.16e"), ssimPlane, m_ssimTotalPlane[i]);
         }
         m_ssimTotal += ssimv;
+        m_frameSsim = ssimv;
     }
 
     if (prm->psnr) {
@@ -444,6 +445,7 @@ RGY_ERR NVEncFilterSsim::calc_ssim_psnr(const RGYFrameInfo *p0, const RGYFrameIn
             AddMessage(RGY_LOG_TRACE, _T("psnrPlane = %.16e, m_psnrTotalPlane[i] = %.16e"), psnrPlane, m_psnrTotalPlane[i]);
         }
         m_psnrTotal += psnrv;
+        m_frameMse = psnrv;
     }
     return RGY_ERR_NONE;
 }
@@ -33,8 +33,13 @@
 #include <memory>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <functional>
 #include "rgy_osdep.h"
 #include "rgy_event.h"
+#include "rgy_avutil.h"
+#include "rgy_metrics.h"
 #include "NVEncFilter.h"
 #include "NVEncParam.h"
 #include "NVEncUtil.h"
@@ -44,6 +49,7 @@
 #if ENABLE_SSIM
 
 class CuvidDecode;
+struct NVEncFilterVMAFShardQueue;
 
 class NVEncFilterParamSsim : public NVEncFilterParam {
 public:
@@ -55,8 +61,10 @@ public:
     VideoInfo input;
     rgy_rational<int> streamtimebase;
     RGYParamThread threadParamCompare;
+    bool swDecode; //GPUでデコードできない場合に、ソフトウェアデコードとCPUでのssim/psnr計算を行う
+    int bitDepth;  //エンコードのビット深度 (ソフトウェアデコード時の比較に使用)
 
-    NVEncFilterParamSsim() : ssim(true), psnr(false), vmaf(), deviceId(0), vidctxlock(), input(), streamtimebase(), threadParamCompare() {
+    NVEncFilterParamSsim() : ssim(true), psnr(false), vmaf(), deviceId(0), vidctxlock(), input(), streamtimebase(), threadParamCompare(), swDecode(false), bitDepth(8) {
 
     };
     virtual ~NVEncFilterParamSsim() {};
@@ -69,6 +77,8 @@ struct NVEncFilterVMAFData {
     int procIndex;
     int error;
     double score;
+    RGYMetricScores scores; //フレームごとのスコア
+    std::chrono::system_clock::time_point tmFin; //計算の終了時刻
     std::thread thread;
 
     void thread_fin();
@@ -87,6 +97,7 @@ public:
     RGY_ERR thread_func_ssim_psnr(RGYParamThread threadParam);
     RGY_ERR thread_func_vmaf(RGYParamThread threadParam);
     RGY_ERR compare_frames(bool flush);
+    RGY_ERR compare_frames_sw();
 
     RGY_ERR addBitstream(const RGYBitstream *bitstream);
     virtual void showResult();
@@ -97,12 +108,22 @@ public:
     NVEncFilterVMAFData &vmaf() { return m_vmaf; }
 #endif //#if ENABLE_VMAF
     int frameHostSendIndex() const { return m_frameHostSendIndex; }
+    //フレームごとの評価結果を受け取る (評価スレッドから呼ばれる)
+    void setFrameMetricsCallback(std::function<void(int, double, double)> callback) { m_frameMetricsCallback = callback; }
 protected:
     RGY_ERR init_cuda_resources();
     void close_cuda_resources();
     virtual RGY_ERR run_filter(const RGYFrameInfo *pInputFrame, RGYFrameInfo **ppOutputFrames, int *pOutputFrameNum, cudaStream_t stream) override;
     virtual void close() override;
     virtual RGY_ERR calc_ssim_psnr(const RGYFrameInfo *p0, const RGYFrameInfo *p1);
+    RGY_ERR calc_ssim_psnr_cpu(const RGYFrameInfo *p0, const RGYFrameInfo *p1);
+    RGY_ERR compare_frame_sw(const AVFrame *frame);
+    RGY_ERR copy_decoded_frame(RGYFrameInfo *dst, const AVFrame *src);
+#if ENABLE_VMAF
+    RGY_ERR thread_func_vmaf_shard(NVEncFilterVMAFShardQueue *queue, RGYMetricScores *scores, int threads, RGYParamThread threadParam);
+    RGY_ERR run_vmaf_sharded(const RGYFrameInfo& frameInfo, int pixFmt, RGYParamThread threadParam);
+#endif //#if ENABLE_VMAF
+    void showSpeed();
 
 
     bool m_decodeStarted; //デコードが開始したか
@@ -117,6 +138,12 @@ protected:
     std::deque<std::unique_ptr<CUFrameBuf>> m_input;  //使用中のフレームバッファ(オリジナルフレーム格納用)
     std::deque<std::unique_ptr<CUFrameBuf>> m_unused; //使っていないフレームバッファ(オリジナルフレーム格納用)
     std::unique_ptr<CuvidDecode> m_decoder;     // デコーダエンジン
+    std::unique_ptr<AVCodecContext, RGYAVDeleter<AVCodecContext>> m_swDecoder; // GPUでデコードできない場合のソフトウェアデコーダ
+    std::deque<std::unique_ptr<AVPacket, RGYAVDeleter<AVPacket>>> m_swPackets; // ソフトウェアデコーダに渡すパケット (nullptrでflush)
+    std::mutex m_swMtx;                 // m_swPackets操作用のロック
+    std::condition_variable m_swCond;   // m_swPacketsへの追加の通知
+    bool m_swDecodeErr;                 // ソフトウェアデコード側でエラーが発生した
+    RGY_CSP m_metricCsp;                // ssim/psnrを計算するフレームの色空間 (ソフトウェアデコード時はエンコードのビット深度のplanar)
     unique_ptr<NVEncFilterCspCrop> m_crop;      // NV12->YV12変換用
     unique_ptr<NVEncFilterCspCrop> m_cropDToH;  // Device to Host 転送用
     int m_frameHostSendIndex;
@@ -138,6 +165,13 @@ protected:
     std::array<double, 3> m_psnrTotalPlane; // 評価結果の累積値 YUV
     double m_psnrTotal;                     // 評価結果の累積値 All
     int m_frames;                           // 評価したフレーム数
+    double m_frameSsim;                     // 直前に評価したフレームの評価結果 (SSIM)
+    double m_frameMse;                      // 直前に評価したフレームの評価結果 (PSNR計算用のMSE)
+    std::function<void(int, double, double)> m_frameMetricsCallback; // フレームごとの評価結果の通知先 (表示順, SSIM, PSNR)
+    int m_inputFrames;                                    // 受け取ったフレーム数
+    std::chrono::system_clock::time_point m_tmFirstFrame; // 最初のフレームを受け取った時刻
+    std::chrono::system_clock::time_point m_tmLastFrame;  // 最後のフレームを受け取った時刻
+    std::chrono::system_clock::time_point m_tmCompareFin; // ssim/psnrの計算が終了した時刻
 };
 
 #endif //#if ENABLE_SSIM
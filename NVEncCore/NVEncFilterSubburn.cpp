@@ -33,6 +33,7 @@
 #include <filesystem>
 #include <algorithm>
 #include <numeric>
+#include <chrono>
 #define _USE_MATH_DEFINES
 #include <cmath>
 #include "rgy_codepage.h"
@@ -129,6 +130,22 @@ NVEncFilterSubburn::NVEncFilterSubburn() :
     m_assLibrary(unique_ptr<ASS_Library, decltype(&ass_library_done)>(nullptr, ass_library_done)),
     m_assRenderer(unique_ptr<ASS_Renderer, decltype(&ass_renderer_done)>(nullptr, ass_renderer_done)),
     m_assTrack(unique_ptr<ASS_Track, decltype(&ass_free_track)>(nullptr, ass_free_track)),
+    m_assLookahead(0),
+    m_assTimebase(),
+    m_assAtlasWidth(0),
+    m_assMtx(),
+    m_assQueueMtx(),
+    m_assQueueCv(),
+    m_assResults(),
+    m_assNextTimestamp(AV_NOPTS_VALUE),
+    m_assLastTimestamp(AV_NOPTS_VALUE),
+    m_assFrameDuration(0),
+    m_assGeneration(0),
+    m_assAbort(false),
+    m_assThread(),
+    m_assLastAtlas(),
+    m_assAtlasGPU(),
+    m_assStats(),
     m_resize(),
     m_poolPkt(nullptr),
     m_queueSubPackets() {
@@ -167,6 +184,10 @@ RGY_ERR NVEncFilterSubburn::checkParam(const std::shared_ptr<NVEncFilterParamSub
         AddMessage(RGY_LOG_ERROR, _T("\"transparency\" must be in range of 0.0 - 1.0, but %.2f set.\n"), prm->subburn.transparency_offset);
         return RGY_ERR_INVALID_PARAM;
     }
+    if (prm->subburn.lookahead < 0) {
+        AddMessage(RGY_LOG_ERROR, _T("\"lookahead\" must be 0 or positive value, but %d set.\n"), prm->subburn.lookahead);
+        return RGY_ERR_INVALID_PARAM;
+    }
     return RGY_ERR_NONE;
 }
 
@@ -422,6 +443,299 @@ RGY_ERR NVEncFilterSubburn::readSubFile() {
     return RGY_ERR_NONE;
 }
 
+RGYFrameInfo SubAssAtlas::hostFrame() const {
+    RGYFrameInfo frame(width, height, RGY_CSP_YUVA444, 8, RGY_PICSTRUCT_FRAME, RGY_MEM_TYPE_CPU);
+    for (int i = 0; i < 4; i++) {
+        frame.ptr[i] = (uint8_t *)buf.data() + (size_t)pitch * height * i;
+        frame.pitch[i] = pitch;
+    }
+    return frame;
+}
+
+//描画スレッドで計算しておき、転送時の検索に使用する
+void SubAssAtlas::calcHash() {
+    uint64_t h = 14695981039346656037ull; // FNV-1a (8byte単位)
+    const size_t count = buf.size() / sizeof(uint64_t);
+    const uint8_t *ptr = buf.data();
+    for (size_t i = 0; i < count; i++, ptr += sizeof(uint64_t)) {
+        uint64_t v;
+        memcpy(&v, ptr, sizeof(v));
+        h = (h ^ v) * 1099511628211ull;
+    }
+    for (size_t i = count * sizeof(uint64_t); i < buf.size(); i++) {
+        h = (h ^ buf[i]) * 1099511628211ull;
+    }
+    hash = h ^ ((uint64_t)width << 32) ^ (uint64_t)height;
+}
+
+bool SubAssAtlas::sameImage(const SubAssAtlas& x) const {
+    return hash == x.hash && width == x.width && height == x.height && pitch == x.pitch && buf == x.buf;
+}
+
+std::shared_ptr<SubAssAtlas> NVEncFilterSubburn::buildAssAtlas(const ASS_Image *images) {
+    auto atlas = std::make_shared<SubAssAtlas>();
+
+    //YUV420の関係で縦横2pixelずつ処理するので、各画像は2で割り切れるようにして配置する
+    std::vector<const ASS_Image *> imageList;
+    int maxWidth = 0;
+    for (auto image = images; image; image = image->next) {
+        if (image->w <= 0 || image->h <= 0) {
+            continue;
+        }
+        const int x_offset = ((image->dst_x % 2) != 0) ? 1 : 0;
+        maxWidth = std::max(maxWidth, ALIGN(image->w + x_offset, 2));
+        imageList.push_back(image);
+    }
+    //棚詰めで配置
+    atlas->width = ALIGN(std::max(maxWidth, m_assAtlasWidth), 2);
+    int shelfX = 0, shelfY = 0, shelfHeight = 0;
+    for (const auto image : imageList) {
+        const int x_offset = ((image->dst_x % 2) != 0) ? 1 : 0;
+        const int y_offset = ((image->dst_y % 2) != 0) ? 1 : 0;
+        SubAssAtlasRect rect;
+        rect.width  = ALIGN(image->w + x_offset, 2);
+        rect.height = ALIGN(image->h + y_offset, 2);
+        if (shelfX + rect.width > atlas->width) {
+            shelfY += shelfHeight;
+            shelfX = 0;
+            shelfHeight = 0;
+        }
+        rect.atlasX = shelfX;
+        rect.atlasY = shelfY;
+        rect.dstX = image->dst_x;
+        rect.dstY = image->dst_y;
+        atlas->rects.push_back(rect);
+        shelfX += rect.width;
+        shelfHeight = std::max(shelfHeight, rect.height);
+    }
+    atlas->height = shelfY + shelfHeight;
+    if (atlas->rects.size() == 0) {
+        return atlas;
+    }
+    atlas->pitch = ALIGN(atlas->width, 64);
+
+    //Y=0, A=0 (透明), U=V=128で初期化
+    const size_t planeSize = (size_t)atlas->pitch * atlas->height;
+    atlas->buf.resize(planeSize * 4);
+    memset(atlas->buf.data() + planeSize * 0, 0,   planeSize);
+    memset(atlas->buf.data() + planeSize * 1, 128, planeSize);
+    memset(atlas->buf.data() + planeSize * 2, 128, planeSize);
+    memset(atlas->buf.data() + planeSize * 3, 0,   planeSize);
+
+    for (size_t i = 0; i < imageList.size(); i++) {
+        const auto image = imageList[i];
+        const auto& rect = atlas->rects[i];
+        const int x_offset = ((image->dst_x % 2) != 0) ? 1 : 0;
+        const int y_offset = ((image->dst_y % 2) != 0) ? 1 : 0;
+
+        const uint32_t subColor = image->color;
+        const uint8_t subR = (uint8_t) (subColor >> 24);
+        const uint8_t subG = (uint8_t)((subColor >> 16) & 0xff);
+        const uint8_t subB = (uint8_t)((subColor >>  8) & 0xff);
+        const uint8_t subA = (uint8_t)(255 - (subColor        & 0xff));
+
+        const uint8_t subY = (uint8_t)clamp((( 66 * subR + 129 * subG +  25 * subB + 128) >> 8) +  16, 0, 255);
+        const uint8_t subU = (uint8_t)clamp(((-38 * subR -  74 * subG + 112 * subB + 128) >> 8) + 128, 0, 255);
+        const uint8_t subV = (uint8_t)clamp(((112 * subR -  94 * subG -  18 * subB + 128) >> 8) + 128, 0, 255);
+
+        //YUVで字幕の画像データを構築
+        for (int j = 0; j < image->h; j++) {
+            const size_t dstOffset = (size_t)(rect.atlasY + j + y_offset) * atlas->pitch + rect.atlasX + x_offset;
+            uint8_t *ptrY = atlas->buf.data() + planeSize * 0 + dstOffset;
+            uint8_t *ptrU = atlas->buf.data() + planeSize * 1 + dstOffset;
+            uint8_t *ptrV = atlas->buf.data() + planeSize * 2 + dstOffset;
+            uint8_t *ptrA = atlas->buf.data() + planeSize * 3 + dstOffset;
+            const uint8_t *ptrSrc = image->bitmap + j * image->stride;
+            memset(ptrY, subY, image->w);
+            memset(ptrU, subU, image->w);
+            memset(ptrV, subV, image->w);
+            for (int x = 0; x < image->w; x++) {
+                ptrA[x] = (uint8_t)clamp(((int)subA * ptrSrc[x]) >> 8, 0, 255);
+            }
+        }
+    }
+    atlas->calcHash();
+    return atlas;
+}
+
+//m_assMtxをロックした状態で呼ぶこと
+std::shared_ptr<SubAssAtlas> NVEncFilterSubburn::renderAss(const int64_t timeMs) {
+    const auto timeStart = std::chrono::high_resolution_clock::now();
+    int detectChange = 0;
+    const auto images = ass_render_frame(m_assRenderer.get(), m_assTrack.get(), timeMs, &detectChange);
+    m_assStats.renders++;
+    if (!images) {
+        m_assLastAtlas.reset();
+    } else if (detectChange == 0 && m_assLastAtlas) {
+        //直前の描画から変化がなければ、同じ画像を使いまわす
+        m_assStats.reused++;
+    } else {
+        m_assLastAtlas = buildAssAtlas(images);
+    }
+    m_assStats.renderMs += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - timeStart).count();
+    return m_assLastAtlas;
+}
+
+int64_t NVEncFilterSubburn::assTimestampToMs(const int64_t timestamp) const {
+    return av_rescale_q(timestamp, m_assTimebase, { 1, 1000 });
+}
+
+void NVEncFilterSubburn::startAssRenderThread() {
+    m_assAbort = false;
+    m_assThread = std::thread(&NVEncFilterSubburn::assRenderThread, this);
+}
+
+void NVEncFilterSubburn::stopAssRenderThread() {
+    if (m_assThread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(m_assQueueMtx);
+            m_assAbort = true;
+        }
+        m_assQueueCv.notify_all();
+        m_assThread.join();
+    }
+}
+
+void NVEncFilterSubburn::assRenderThread() {
+    std::unique_lock<std::mutex> lock(m_assQueueMtx);
+    while (!m_assAbort) {
+        if (m_assNextTimestamp == AV_NOPTS_VALUE || (int)m_assResults.size() >= m_assLookahead) {
+            m_assQueueCv.wait(lock);
+            continue;
+        }
+        const int64_t timestamp = m_assNextTimestamp;
+        const uint64_t generation = m_assGeneration;
+        lock.unlock();
+        {
+            //ロックの順序は m_assMtx -> m_assQueueMtx
+            std::lock_guard<std::mutex> lockAss(m_assMtx);
+            const int64_t timeMs = assTimestampToMs(timestamp);
+            auto atlas = renderAss(timeMs);
+            lock.lock();
+            if (generation == m_assGeneration) {
+                m_assResults.push_back({ timestamp, timeMs, atlas });
+                m_assNextTimestamp = timestamp + std::max<int64_t>(m_assFrameDuration, 1);
+            }
+        }
+        m_assQueueCv.notify_all();
+    }
+}
+
+//新たな字幕が追加されたら、その開始時刻以降の描画結果は破棄する
+//m_assMtxをロックした状態で呼ぶこと
+void NVEncFilterSubburn::invalidateAssResults(const int64_t startMs) {
+    if (!m_assThread.joinable()) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(m_assQueueMtx);
+    auto it = std::find_if(m_assResults.begin(), m_assResults.end(), [startMs](const SubAssRenderResult& r) { return r.timeMs >= startMs; });
+    if (it != m_assResults.end()) {
+        m_assNextTimestamp = it->timestamp;
+        m_assResults.erase(it, m_assResults.end());
+    }
+    //描画待ちのものも、新しい字幕を反映して描画しなおす
+    m_assGeneration++;
+    m_assQueueCv.notify_all();
+}
+
+RGY_ERR NVEncFilterSubburn::getAssAtlas(std::shared_ptr<SubAssAtlas>& atlas, const int64_t timestamp, const int64_t duration, const int64_t timeMs) {
+    atlas.reset();
+    if (!m_assThread.joinable()) {
+        //同期描画
+        std::lock_guard<std::mutex> lock(m_assMtx);
+        m_assStats.requests++;
+        atlas = renderAss(timeMs);
+        return RGY_ERR_NONE;
+    }
+    std::unique_lock<std::mutex> lock(m_assQueueMtx);
+    m_assStats.requests++;
+    //次のtimestampを予測するためのフレーム間隔
+    if (duration > 0) {
+        m_assFrameDuration = duration;
+    } else if (m_assLastTimestamp != AV_NOPTS_VALUE && timestamp > m_assLastTimestamp) {
+        m_assFrameDuration = timestamp - m_assLastTimestamp;
+    }
+    m_assLastTimestamp = timestamp;
+
+    bool stalled = false;
+    const auto timeStart = std::chrono::high_resolution_clock::now();
+    for (;;) {
+        //要求より古いもの(ドロップされたフレームなど)は不要
+        while (!m_assResults.empty() && m_assResults.front().timestamp < timestamp) {
+            m_assResults.pop_front();
+        }
+        if (!m_assResults.empty() && m_assResults.front().timestamp == timestamp) {
+            break;
+        }
+        if (m_assNextTimestamp == AV_NOPTS_VALUE) {
+            //最初の要求、ここから先行描画を開始する
+            m_assNextTimestamp = timestamp;
+        } else if (!m_assResults.empty() || m_assNextTimestamp != timestamp) {
+            //予測が外れた場合は、要求されたtimestampから描画しなおす
+            m_assResults.clear();
+            m_assNextTimestamp = timestamp;
+            m_assGeneration++;
+            m_assStats.mispredict++;
+        }
+        stalled = true;
+        m_assQueueCv.notify_all();
+        m_assQueueCv.wait(lock);
+    }
+    if (stalled) {
+        m_assStats.stalls++;
+        m_assStats.stallMs += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - timeStart).count();
+    } else {
+        m_assStats.ready++;
+    }
+    m_assStats.aheadSum += (int64_t)m_assResults.size() - 1;
+    atlas = m_assResults.front().atlas;
+    m_assResults.pop_front();
+    lock.unlock();
+    m_assQueueCv.notify_all();
+    return RGY_ERR_NONE;
+}
+
+RGY_ERR NVEncFilterSubburn::uploadAssAtlas(const RGYFrameInfo **ppAtlasGPU, const std::shared_ptr<SubAssAtlas>& atlas, cudaStream_t stream) {
+    static const size_t ASS_ATLAS_GPU_CACHE_SIZE = 4;
+    *ppAtlasGPU = nullptr;
+    //同じ内容の画像が転送済みならそれを使用する
+    //点滅する字幕などでは、libassが描画しなおした画像でも以前と同じ内容になることがある
+    for (auto it = m_assAtlasGPU.begin(); it != m_assAtlasGPU.end(); it++) {
+        if (it->first == atlas || it->first->sameImage(*atlas)) {
+            if (it->first != atlas) {
+                m_assStats.uploadHits++;
+            }
+            if (it != m_assAtlasGPU.begin()) {
+                auto entry = std::move(*it);
+                m_assAtlasGPU.erase(it);
+                m_assAtlasGPU.push_front(std::move(entry));
+            }
+            *ppAtlasGPU = &m_assAtlasGPU.front().second->frame;
+            return RGY_ERR_NONE;
+        }
+    }
+    while (m_assAtlasGPU.size() >= ASS_ATLAS_GPU_CACHE_SIZE) {
+        m_assAtlasGPU.pop_back();
+    }
+    auto frame = std::make_unique<CUFrameBuf>(atlas->width, atlas->height, RGY_CSP_YUVA444);
+    auto err = frame->alloc();
+    if (err != RGY_ERR_NONE) {
+        AddMessage(RGY_LOG_ERROR, _T("Failed to allocate device memory for subtitle image %dx%d: %s.\n"), atlas->width, atlas->height, get_err_mes(err));
+        return err;
+    }
+    //GPUへ転送 (atlas全体を1回で転送する)
+    const auto hostFrame = atlas->hostFrame();
+    err = frame->copyFrameAsync(&hostFrame, stream);
+    if (err != RGY_ERR_NONE) {
+        AddMessage(RGY_LOG_ERROR, _T("Failed to send subtitle image to device: %s.\n"), get_err_mes(err));
+        return err;
+    }
+    m_assStats.uploads++;
+    m_assAtlasGPU.push_front(std::make_pair(atlas, std::move(frame)));
+    *ppAtlasGPU = &m_assAtlasGPU.front().second->frame;
+    return RGY_ERR_NONE;
+}
+
 RGY_ERR NVEncFilterSubburn::init(shared_ptr<NVEncFilterParam> pParam, shared_ptr<RGYLog> pPrintMes) {
     RGY_ERR sts = RGY_ERR_NONE;
     m_pLog = pPrintMes;
@@ -474,6 +788,15 @@ RGY_ERR NVEncFilterSubburn::init(shared_ptr<NVEncFilterParam> pParam, shared_ptr
         AddMessage(RGY_LOG_WARN, _T("manual scaling not available for text type fonts.\n"));
         prm->subburn.scale = 1.0f;
     }
+    if (m_subType & AV_CODEC_PROP_TEXT_SUB) {
+        m_assTimebase = prm->videoOutTimebase;
+        m_assAtlasWidth = prm->frameOut.width;
+        m_assLookahead = prm->subburn.lookahead;
+        if (m_assLookahead > 0) {
+            startAssRenderThread();
+            AddMessage(RGY_LOG_DEBUG, _T("started subtitle render thread, lookahead %d frames.\n"), m_assLookahead);
+        }
+    }
 
     setFilterInfo(pParam->print());
     m_param = prm;
@@ -557,7 +880,9 @@ RGY_ERR NVEncFilterSubburn::procFrame(RGYFrameInfo *pOutputFrame, cudaStream_t s
                 if (!ass) {
                     break;
                 }
+                std::lock_guard<std::mutex> lock(m_assMtx);
                 ass_process_chunk(m_assTrack.get(), ass, (int)strlen(ass), nStartTime, nDuration);
+                invalidateAssResults(nStartTime);
             }
         }
         m_poolPkt->returnFree(&pkt);
@@ -620,6 +945,19 @@ RGY_ERR NVEncFilterSubburn::run_filter(const RGYFrameInfo *pInputFrame, RGYFrame
 }
 
 void NVEncFilterSubburn::close() {
+    stopAssRenderThread();
+    if (m_assStats.requests > 0) {
+        const auto& st = m_assStats;
+        AddMessage(RGY_LOG_DEBUG, _T("text subtitle render: %lld frames, ready %lld, stall %lld (%.1f ms), mispredict %lld, avg ahead %.2f frames.\n"),
+            (long long)st.requests, (long long)st.ready, (long long)st.stalls, st.stallMs, (long long)st.mispredict,
+            st.aheadSum / (double)st.requests);
+        AddMessage(RGY_LOG_DEBUG, _T("text subtitle render: render %lld (%.1f ms), reused %lld, upload %lld (skipped %lld).\n"),
+            (long long)st.renders, st.renderMs, (long long)st.reused, (long long)st.uploads, (long long)st.uploadHits);
+        m_assStats = SubAssRenderStats();
+    }
+    m_assResults.clear();
+    m_assLastAtlas.reset();
+    m_assAtlasGPU.clear();
     m_assTrack.reset();
     m_assRenderer.reset();
     m_assLibrary.reset();
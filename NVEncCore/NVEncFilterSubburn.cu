@@ -181,125 +181,49 @@ RGY_ERR proc_frame(RGYFrameInfo *pFrame,
     return RGY_ERR_NONE;
 }
 
-SubImageData NVEncFilterSubburn::textRectToImage(const ASS_Image *image, cudaStream_t stream) {
-    //YUV420の関係で縦横2pixelずつ処理するので、2で割り切れている必要がある
-    const int x_offset = ((image->dst_x % 2) != 0) ? 1 : 0;
-    const int y_offset = ((image->dst_y % 2) != 0) ? 1 : 0;
-    RGYFrameInfo img;
-    img.csp = RGY_CSP_YUVA444;
-    img.width  = ALIGN(image->w + x_offset, 2);
-    img.height = ALIGN(image->h + y_offset, 2);
-    img.mem_type = RGY_MEM_TYPE_CPU;
-    img.picstruct = RGY_PICSTRUCT_FRAME;
-    auto bufCPU = std::make_unique<CUFrameBuf>(img);
-    auto err = bufCPU->allocHost();
-    if (err != RGY_ERR_NONE) {
-        AddMessage(RGY_LOG_ERROR, _T("Failed to allocate host memory for subtitle image %dx%d: %s.\n"), image->w, image->h, get_err_mes(err));
-        return SubImageData(
-            std::unique_ptr<CUFrameBuf>(), std::unique_ptr<CUFrameBuf>(),
-            std::unique_ptr<CUFrameBuf>(), 0, 0);
-    }
-
-    auto planeY = getPlane(&bufCPU->frame, RGY_PLANE_Y);
-    auto planeU = getPlane(&bufCPU->frame, RGY_PLANE_U);
-    auto planeV = getPlane(&bufCPU->frame, RGY_PLANE_V);
-    auto planeA = getPlane(&bufCPU->frame, RGY_PLANE_A);
-
-    //とりあえずすべて0で初期化しておく
-    memset(planeY.ptr[0], 0, (size_t)planeY.pitch[0] * planeY.height);
-
-    //とりあえずすべて0で初期化しておく
-    //Alpha=0で透明なので都合がよい
-    memset(planeA.ptr[0], 0, (size_t)planeA.pitch[0] * planeA.height);
-
-    for (int j = 0; j < planeU.height; j++) {
-        auto ptr = planeU.ptr[0] + j * planeU.pitch[0];
-        for (int i = 0; i < planeU.pitch[0] / (int)sizeof(ptr[0]); i++) {
-            ptr[i] = 128;
-        }
-    }
-    for (int j = 0; j < planeV.height; j++) {
-        auto ptr = planeV.ptr[0] + j * planeV.pitch[0];
-        for (int i = 0; i < planeV.pitch[0] / (int)sizeof(ptr[0]); i++) {
-            ptr[i] = 128;
-        }
-    }
-
-    const uint32_t subColor = image->color;
-    const uint8_t subR = (uint8_t) (subColor >> 24);
-    const uint8_t subG = (uint8_t)((subColor >> 16) & 0xff);
-    const uint8_t subB = (uint8_t)((subColor >>  8) & 0xff);
-    const uint8_t subA = (uint8_t)(255 - (subColor        & 0xff));
-
-    const uint8_t subY = (uint8_t)clamp((( 66 * subR + 129 * subG +  25 * subB + 128) >> 8) +  16, 0, 255);
-    const uint8_t subU = (uint8_t)clamp(((-38 * subR -  74 * subG + 112 * subB + 128) >> 8) + 128, 0, 255);
-    const uint8_t subV = (uint8_t)clamp(((112 * subR -  94 * subG -  18 * subB + 128) >> 8) + 128, 0, 255);
-
-    //YUVで字幕の画像データを構築
-    for (int j = 0; j < image->h; j++) {
-        for (int i = 0; i < image->w; i++) {
-            const int src_idx = j * image->stride + i;
-            const uint8_t alpha = image->bitmap[src_idx];
-
-            #define PLANE_DST(plane, x, y) (plane.ptr[0][(y) * plane.pitch[0] + (x)])
-            PLANE_DST(planeY, i + x_offset, j + y_offset) = subY;
-            PLANE_DST(planeU, i + x_offset, j + y_offset) = subU;
-            PLANE_DST(planeV, i + x_offset, j + y_offset) = subV;
-            PLANE_DST(planeA, i + x_offset, j + y_offset) = (uint8_t)clamp(((int)subA * alpha) >> 8, 0, 255);
-            #undef PLANE_DST
-        }
-    }
-    //GPUへ転送
-    auto frame = std::make_unique<CUFrameBuf>(bufCPU->frame.width, bufCPU->frame.height, bufCPU->frame.csp);
-    err = frame->alloc();
-    if (err != RGY_ERR_NONE) {
-        AddMessage(RGY_LOG_ERROR, _T("Failed to allocate device memory for subtitle image %dx%d: %s.\n"), image->w, image->h, get_err_mes(err));
-        return SubImageData(
-            std::unique_ptr<CUFrameBuf>(), std::unique_ptr<CUFrameBuf>(),
-            std::unique_ptr<CUFrameBuf>(), 0, 0);
-    }
-    frame->copyFrameAsync(&bufCPU->frame, stream);
-    return SubImageData(std::move(frame), std::unique_ptr<CUFrameBuf>(), std::move(bufCPU), image->dst_x, image->dst_y);
-}
-
 RGY_ERR NVEncFilterSubburn::procFrameText(RGYFrameInfo *pOutputFrame, int64_t frameTimeMs, cudaStream_t stream) {
-    int nDetectChange = 0;
-    const auto frameImages = ass_render_frame(m_assRenderer.get(), m_assTrack.get(), frameTimeMs, &nDetectChange);
-
-    if (!frameImages) {
-        m_subImages.clear();
-    } else if (nDetectChange) {
-        m_subImages.clear();
-        for (auto image = frameImages; image; image = image->next) {
-            m_subImages.push_back(textRectToImage(image, stream));
-        }
+    std::shared_ptr<SubAssAtlas> atlas;
+    auto sts = getAssAtlas(atlas, pOutputFrame->timestamp, pOutputFrame->duration, frameTimeMs);
+    if (sts != RGY_ERR_NONE) {
+        return sts;
+    }
+    if (!atlas || atlas->rects.size() == 0) {
+        return RGY_ERR_NONE;
     }
     auto prm = std::dynamic_pointer_cast<NVEncFilterParamSubburn>(m_param);
     if (!prm) {
         AddMessage(RGY_LOG_ERROR, _T("Invalid parameter type.\n"));
         return RGY_ERR_INVALID_PARAM;
     }
-    if (m_subImages.size()) {
-        static const std::map<RGY_CSP, decltype(proc_frame<uint8_t, 8>) *> func_list ={
-            { RGY_CSP_YV12,      proc_frame<uint8_t,   8> },
-            { RGY_CSP_YV12_16,   proc_frame<uint16_t, 16> },
-            { RGY_CSP_YUV444,    proc_frame<uint8_t,   8> },
-            { RGY_CSP_YUV444_16, proc_frame<uint16_t, 16> }
-        };
-        if (func_list.count(pOutputFrame->csp) == 0) {
-            AddMessage(RGY_LOG_ERROR, _T("unsupported csp %s.\n"), RGY_CSP_NAMES[pOutputFrame->csp]);
-            return RGY_ERR_UNSUPPORTED;
+    static const std::map<RGY_CSP, decltype(proc_frame<uint8_t, 8>) *> func_list ={
+        { RGY_CSP_YV12,      proc_frame<uint8_t,   8> },
+        { RGY_CSP_YV12_16,   proc_frame<uint16_t, 16> },
+        { RGY_CSP_YUV444,    proc_frame<uint8_t,   8> },
+        { RGY_CSP_YUV444_16, proc_frame<uint16_t, 16> }
+    };
+    if (func_list.count(pOutputFrame->csp) == 0) {
+        AddMessage(RGY_LOG_ERROR, _T("unsupported csp %s.\n"), RGY_CSP_NAMES[pOutputFrame->csp]);
+        return RGY_ERR_UNSUPPORTED;
+    }
+    const RGYFrameInfo *pAtlas = nullptr;
+    if ((sts = uploadAssAtlas(&pAtlas, atlas, stream)) != RGY_ERR_NONE) {
+        return sts;
+    }
+    for (const auto& rect : atlas->rects) {
+        //atlas内の各画像の範囲を切り出して焼きこむ
+        RGYFrameInfo subImg = *pAtlas;
+        for (int i = 0; i < RGY_CSP_PLANES[subImg.csp]; i++) {
+            subImg.ptr[i] += rect.atlasY * subImg.pitch[i] + rect.atlasX;
         }
-        for (uint32_t irect = 0; irect < m_subImages.size(); irect++) {
-            const RGYFrameInfo *pSubImg = &m_subImages[irect].image->frame;
-            auto sts = func_list.at(pOutputFrame->csp)(pOutputFrame, pSubImg, m_subImages[irect].x, m_subImages[irect].y,
-                prm->subburn.transparency_offset, prm->subburn.brightness, prm->subburn.contrast, stream);
-            if (sts != RGY_ERR_NONE) {
-                AddMessage(RGY_LOG_ERROR, _T("error at subburn(%s): %s.\n"),
-                    RGY_CSP_NAMES[pOutputFrame->csp],
-                    get_err_mes(sts));
-                return sts;
-            }
+        subImg.width  = rect.width;
+        subImg.height = rect.height;
+        sts = func_list.at(pOutputFrame->csp)(pOutputFrame, &subImg, rect.dstX, rect.dstY,
+            prm->subburn.transparency_offset, prm->subburn.brightness, prm->subburn.contrast, stream);
+        if (sts != RGY_ERR_NONE) {
+            AddMessage(RGY_LOG_ERROR, _T("error at subburn(%s): %s.\n"),
+                RGY_CSP_NAMES[pOutputFrame->csp],
+                get_err_mes(sts));
+            return sts;
         }
     }
     return RGY_ERR_NONE;
@@ -28,6 +28,10 @@
 
 #pragma once
 
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include "NVEncFilter.h"
 #include "NVEncParam.h"
 #include "rgy_avutil.h"
@@ -76,6 +80,48 @@ struct SubImageData {
         image(std::move(img)), imageTemp(std::move(imgTemp)), imageCPU(std::move(imgCPU)), x(posX), y(posY) { }
 };
 
+// libassで描画した1フレーム分の字幕画像
+// 転送が1回で済むよう、すべての画像を1枚(atlas)に詰めて保持する
+struct SubAssAtlasRect {
+    int atlasX, atlasY; // atlas内の位置
+    int width, height;  // 2の倍数
+    int dstX, dstY;     // 焼きこみ先の位置
+};
+
+struct SubAssAtlas {
+    uint64_t hash; // bufの内容のハッシュ (転送済みのatlasの検索用)
+    int width, height, pitch;
+    std::vector<uint8_t> buf; // YUVA444 (各planeを縦に連結)
+    std::vector<SubAssAtlasRect> rects;
+
+    SubAssAtlas() : hash(0), width(0), height(0), pitch(0), buf(), rects() {};
+    RGYFrameInfo hostFrame() const;
+    void calcHash();
+    bool sameImage(const SubAssAtlas& x) const;
+};
+
+struct SubAssRenderResult {
+    int64_t timestamp; // 映像のtimestamp (videoOutTimebase)
+    int64_t timeMs;
+    std::shared_ptr<SubAssAtlas> atlas; // 字幕がなければnullptr
+};
+
+struct SubAssRenderStats {
+    int64_t requests;   // 字幕画像を要求したフレーム数
+    int64_t ready;      // 先行描画が間に合っていたフレーム数
+    int64_t stalls;     // 描画の完了を待ったフレーム数
+    int64_t mispredict; // 予測したtimestampと一致せず、描画をやり直した回数
+    int64_t aheadSum;   // 要求時点で先行描画済みだったフレーム数の合計
+    int64_t renders;    // ass_render_frameの呼び出し回数
+    int64_t reused;     // 変化がなく、直前の画像を再利用した回数
+    int64_t uploads;    // GPUへの転送回数
+    int64_t uploadHits; // 同じ内容のatlasが転送済みで、転送を省略した回数
+    double stallMs;
+    double renderMs;
+
+    SubAssRenderStats() : requests(0), ready(0), stalls(0), mispredict(0), aheadSum(0), renders(0), reused(0), uploads(0), uploadHits(0), stallMs(0.0), renderMs(0.0) {};
+};
+
 class NVEncFilterSubburn : public NVEncFilter {
 public:
     NVEncFilterSubburn();
@@ -91,7 +137,15 @@ protected:
     virtual RGY_ERR InitLibAss(const std::shared_ptr<NVEncFilterParamSubburn> prm);
     void SetExtraData(AVCodecContext *codecCtx, const uint8_t *data, uint32_t size);
     RGY_ERR readSubFile();
-    SubImageData textRectToImage(const ASS_Image *image, cudaStream_t stream);
+    std::shared_ptr<SubAssAtlas> buildAssAtlas(const ASS_Image *images);
+    std::shared_ptr<SubAssAtlas> renderAss(const int64_t timeMs);
+    RGY_ERR getAssAtlas(std::shared_ptr<SubAssAtlas>& atlas, const int64_t timestamp, const int64_t duration, const int64_t timeMs);
+    RGY_ERR uploadAssAtlas(const RGYFrameInfo **ppAtlasGPU, const std::shared_ptr<SubAssAtlas>& atlas, cudaStream_t stream);
+    void invalidateAssResults(const int64_t startMs);
+    void startAssRenderThread();
+    void stopAssRenderThread();
+    void assRenderThread();
+    int64_t assTimestampToMs(const int64_t timestamp) const;
     SubImageData bitmapRectToImage(const AVSubtitleRect *rect, const RGYFrameInfo *outputFrame, const sInputCrop &crop, cudaStream_t stream);
     RGY_ERR procFrameText(RGYFrameInfo *pOutputFrame, int64_t frameTimeMs, cudaStream_t stream);
     RGY_ERR procFrameBitmap(RGYFrameInfo *pOutputFrame, const int64_t frameTimeMs, const sInputCrop& crop, const bool forced_subs_only, cudaStream_t stream);
@@ -110,6 +164,24 @@ protected:
     unique_ptr<ASS_Renderer, decltype(&ass_renderer_done)> m_assRenderer; //libassのレンダラ
     unique_ptr<ASS_Track, decltype(&ass_free_track)> m_assTrack; //libassのトラック
 
+    //テキスト字幕の先行描画
+    int m_assLookahead;                   //先行描画するフレーム数 (0なら同期描画)
+    AVRational m_assTimebase;             //映像のtimestampのtimebase
+    int m_assAtlasWidth;                  //atlasの基本の幅
+    std::mutex m_assMtx;                  //libassのレンダラ/トラックの保護
+    std::mutex m_assQueueMtx;             //先行描画の結果の保護
+    std::condition_variable m_assQueueCv;
+    std::deque<SubAssRenderResult> m_assResults; //先行描画の結果 (timestamp順)
+    int64_t m_assNextTimestamp;           //次に描画するtimestamp
+    int64_t m_assLastTimestamp;           //最後に要求されたtimestamp
+    int64_t m_assFrameDuration;           //次のtimestampの予測に使用するフレーム間隔
+    uint64_t m_assGeneration;             //予測のやり直しごとに更新
+    bool m_assAbort;
+    std::thread m_assThread;
+    std::shared_ptr<SubAssAtlas> m_assLastAtlas; //直前に描画した画像 (m_assMtxで保護)
+    std::deque<std::pair<std::shared_ptr<SubAssAtlas>, unique_ptr<CUFrameBuf>>> m_assAtlasGPU; //転送済みのatlas (内容で検索するLRU)
+    SubAssRenderStats m_assStats;
+
     unique_ptr<NVEncFilterResize> m_resize;
 
     RGYPoolAVPacket *m_poolPkt;
@@ -66,7 +66,10 @@ NVEncRCParam::NVEncRCParam() :
     max_bitrate(0),
     targetQuality(-1),
     targetQualityLSB(-1),
-    qp() {
+    qp(),
+    qpMin(0, 0, 0, false),
+    qpMax(0, 0, 0, false),
+    aqStrength(-1) {
 
 }
 tstring NVEncRCParam::print() const {
@@ -92,6 +95,15 @@ tstring NVEncRCParam::print() const {
     if (max_bitrate != 0) {
         t << ",maxbitrate=" << max_bitrate / 1000;
     }
+    if (qpMin.enable) {
+        t << ",qp-min=" << qpMin.qpI << ":" << qpMin.qpP << ":" << qpMin.qpB;
+    }
+    if (qpMax.enable) {
+        t << ",qp-max=" << qpMax.qpI << ":" << qpMax.qpP << ":" << qpMax.qpB;
+    }
+    if (aqStrength >= 0) {
+        t << ",aq-strength=" << aqStrength;
+    }
     return t.str();
 }
 bool NVEncRCParam::operator==(const NVEncRCParam &x) const {
@@ -102,7 +114,10 @@ bool NVEncRCParam::operator==(const NVEncRCParam &x) const {
         && max_bitrate == x.max_bitrate
         && targetQuality == x.targetQuality
         && targetQualityLSB == x.targetQualityLSB
-        && qp == x.qp;
+        && qp == x.qp
+        && qpMin == x.qpMin
+        && qpMax == x.qpMax
+        && aqStrength == x.aqStrength;
 }
 bool NVEncRCParam::operator!=(const NVEncRCParam &x) const {
     return !(*this == x);
@@ -233,6 +248,7 @@ InEncodeVideoParam::InEncodeVideoParam() :
     cudaSchedule(DEFAULT_CUDA_SCHEDULE),
     sessionRetry(0),
     disableNVML(0),
+    deviceCache(_T("auto")),
     input(),
     preset(0),
     nHWDecType(0),
@@ -263,6 +279,8 @@ InEncodeVideoParam::InEncodeVideoParam() :
     tuningInfo(NV_ENC_TUNING_INFO_UNDEFINED),
     encConfig(),
     dynamicRC(),
+    dynamicRCAuto(),
+    sceneDetect(),
     codec_rgy(RGY_CODEC_H264),
     bluray(0),                   //bluray出力
     outputDepth(8),
@@ -46,6 +46,8 @@
 #include "rgy_simd.h"
 #include "rgy_prm.h"
 #include "convert_csp.h"
+#include "rgy_complexity.h"
+#include "rgy_scenechange.h"
 
 static const int MAX_DECODE_FRAMES = 16;
 
@@ -65,6 +67,7 @@ static const int DEFAULT_QVBR_TARGET = 25;
 
 static const int PIPELINE_DEPTH = 4;
 static const int MAX_FILTER_OUTPUT = 2;
+static const int RAW_OUTPUT_HOST_BUFFERS = 3;
 
 // --------------------------------------------------------------------------------
 // 昔の定義
@@ -679,6 +682,9 @@ struct NVEncRCParam {
     int targetQuality;
     int targetQualityLSB;
     RGYQPSet qp;
+    RGYQPSet qpMin;      //enable=falseなら変更しない
+    RGYQPSet qpMax;      //enable=falseなら変更しない
+    int aqStrength;      //負なら変更しない
 
     NVEncRCParam();
     tstring print() const;
@@ -692,6 +698,7 @@ struct InEncodeVideoParam {
     int cudaSchedule;
     int sessionRetry;
     int disableNVML;
+    tstring deviceCache;          //デバイス情報のキャッシュ ("auto", "off", またはファイル名)
 
     VideoInfo input;              //入力する動画の情報
     int preset;                   //出力プリセット
@@ -726,6 +733,8 @@ struct InEncodeVideoParam {
     NV_ENC_CONFIG encConfig;      //エンコード設定
 
     std::vector<NVEncRCParam> dynamicRC;
+    RGYComplexityParam dynamicRCAuto; //解析結果からdynamicRCを自動で設定する
+    RGYSceneChangeParam sceneDetect;  //CPUでのシーンチェンジ/フェードの判定
     RGY_CODEC codec_rgy;          //出力コーデック
     int bluray;                   //bluray出力
     int outputDepth;              //出力ビット深度
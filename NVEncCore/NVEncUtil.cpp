@@ -171,7 +171,6 @@ void RGYBitstream::addFrameData(RGYFrameData *frameData) {
 }
 
 void RGYBitstream::clearFrameDataList() {
-    frameDataNum = 0;
     if (frameDataList) {
         for (int i = 0; i < frameDataNum; i++) {
             if (frameDataList[i]) {
@@ -181,6 +180,7 @@ void RGYBitstream::clearFrameDataList() {
         free(frameDataList);
         frameDataList = nullptr;
     }
+    frameDataNum = 0;
 }
 std::vector<RGYFrameData *> RGYBitstream::getFrameDataList() {
     return make_vector(frameDataList, frameDataNum);
@@ -257,31 +257,3 @@ VideoInfo videooutputinfo(
     }
     return info;
 }
-
-#if !ENABLE_AVSW_READER
-#define TTMATH_NOASM
-#pragma warning(push)
-#pragma warning(disable: 4244)
-#pragma warning(disable: 4834)
-#include "ttmath/ttmath.h"
-#pragma warning(pop)
-
-int64_t rational_rescale(int64_t v, rgy_rational<int> from, rgy_rational<int> to) {
-    auto mul = rgy_rational<int64_t>((int64_t)from.n() * (int64_t)to.d(), (int64_t)from.d() * (int64_t)to.n());
-
-#if _M_IX86
-#define RESCALE_INT_SIZE 4
-#else
-#define RESCALE_INT_SIZE 2
-#endif
-    ttmath::Int<RESCALE_INT_SIZE> tmp1 = v;
-    tmp1 *= mul.n();
-    ttmath::Int<RESCALE_INT_SIZE> tmp2 = mul.d();
-
-    tmp1 = (tmp1 + tmp2 - 1) / tmp2;
-    int64_t ret;
-    tmp1.ToInt(ret);
-    return ret;
-}
-
-#endif
\ No newline at end of file
@@ -31,15 +31,12 @@
 #if ENABLE_AVSW_READER && !FOR_AUO
 
 #include "rgy_avutil.h"
+#include "rgy_frame.h"
 
 extern "C" {
 #include <libavutil/timestamp.h>
 }
 
-int64_t rational_rescale(int64_t v, rgy_rational<int> from, rgy_rational<int> to) {
-    return av_rescale_q(v, av_make_q(from), av_make_q(to));
-}
-
 //必要なavcodecのdllがそろっているかを確認
 bool check_avcodec_dll() {
 #if defined(_WIN32) || defined(_WIN64)
@@ -921,4 +918,44 @@ tstring getDispositionStr(uint32_t disposition) {
     return str;
 }
 
+static void rgy_av_frame_data_free([[maybe_unused]] void *opaque, uint8_t *data) {
+    delete reinterpret_cast<RGYAVFrameDataList *>(data);
+}
+
+static RGYAVFrameDataList *rgy_av_frame_data_list(const AVBufferRef *opaque_ref) {
+    if (opaque_ref == nullptr || opaque_ref->data == nullptr || (size_t)opaque_ref->size != sizeof(RGYAVFrameDataList)) {
+        return nullptr;
+    }
+    auto list = reinterpret_cast<RGYAVFrameDataList *>(opaque_ref->data);
+    return (list->magic == RGY_AV_FRAME_DATA_MAGIC) ? list : nullptr;
+}
+
+int rgy_av_add_frame_data(AVBufferRef **opaque_ref, std::shared_ptr<RGYFrameData> data) {
+    if (!data) {
+        return 0;
+    }
+    auto list = rgy_av_frame_data_list(*opaque_ref);
+    if (list == nullptr || !av_buffer_is_writable(*opaque_ref)) {
+        //他からも参照されている場合は、新たなリストを作成して付け替える
+        auto newlist = std::make_unique<RGYAVFrameDataList>();
+        newlist->magic = RGY_AV_FRAME_DATA_MAGIC;
+        if (list) {
+            newlist->list = list->list;
+        }
+        auto ref = av_buffer_create((uint8_t *)newlist.get(), sizeof(RGYAVFrameDataList), rgy_av_frame_data_free, nullptr, 0);
+        if (ref == nullptr) {
+            return AVERROR(ENOMEM);
+        }
+        list = newlist.release();
+        av_buffer_unref(opaque_ref);
+        *opaque_ref = ref;
+    }
+    list->list.push_back(std::move(data));
+    return 0;
+}
+
+const RGYAVFrameDataList *rgy_av_get_frame_data(const AVBufferRef *opaque_ref) {
+    return rgy_av_frame_data_list(opaque_ref);
+}
+
 #endif //ENABLE_AVSW_READER
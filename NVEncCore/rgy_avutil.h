@@ -472,6 +472,20 @@ static void AVStreamCopySideData(AVStream *streamDst, const AVStream *streamSrc)
 #endif
 }
 
+//AVPacket/AVFrameのopaque_refに付加するフレームごとのメタデータ
+//文字列に変換せず、RGYFrameDataの参照をそのままパケット→フレームへ受け渡す
+class RGYFrameData;
+static const uint32_t RGY_AV_FRAME_DATA_MAGIC = 0x4c444652; // "RFDL"
+struct RGYAVFrameDataList {
+    uint32_t magic;
+    std::vector<std::shared_ptr<RGYFrameData>> list;
+};
+
+//パケット/フレームのopaque_refにメタデータを追加する (失敗時はAVERRORを返す)
+int rgy_av_add_frame_data(AVBufferRef **opaque_ref, std::shared_ptr<RGYFrameData> data);
+//opaque_refに付加されたメタデータを取得する (ない場合はnullptr)
+const RGYAVFrameDataList *rgy_av_get_frame_data(const AVBufferRef *opaque_ref);
+
 //利用可能なプロトコル情報のリストを取得
 vector<std::string> getAVProtocolList(int bOutput);
 
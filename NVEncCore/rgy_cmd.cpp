@@ -1620,7 +1620,7 @@ int parse_one_vpp_option(const TCHAR *option_name, const TCHAR *strInput[], int
             return 0;
         }
         i++;
-        const auto paramList = std::vector<std::string>{ "cycle", "drop", "thresc", "thredup", "blockx", "blocky", "chroma", "log" /*, "pp"*/ };
+        const auto paramList = std::vector<std::string>{ "cycle", "drop", "thresc", "thredup", "blockx", "blocky", "chroma", "log", "pass", "analysis" /*, "pp"*/ };
 
         for (const auto &param : split(strInput[i], _T(","))) {
             auto pos = param.find_first_of(_T("="));
@@ -1714,6 +1714,23 @@ int parse_one_vpp_option(const TCHAR *option_name, const TCHAR *strInput[], int
                     }
                     continue;
                 }
+                if (param_arg == _T("pass")) {
+                    try {
+                        vpp->decimate.pass = std::stoi(param_val);
+                    } catch (...) {
+                        print_cmd_error_invalid_value(tstring(option_name) + _T(" ") + param_arg + _T("="), param_val);
+                        return 1;
+                    }
+                    if (vpp->decimate.pass < 0 || 2 < vpp->decimate.pass) {
+                        print_cmd_error_invalid_value(tstring(option_name) + _T(" ") + param_arg + _T("="), param_val, _T("pass should be 0, 1 or 2."));
+                        return 1;
+                    }
+                    continue;
+                }
+                if (param_arg == _T("analysis")) {
+                    vpp->decimate.analysis = trim(param_val, _T("\""));
+                    continue;
+                }
                 if (param_arg == _T("log")) {
                     bool b = false;
                     if (!cmd_string_to_bool(&b, param_val)) {
@@ -2541,7 +2558,7 @@ int parse_one_vpp_option(const TCHAR *option_name, const TCHAR *strInput[], int
         }
         param_list.push_back(tstring(qstr, pstr - qstr));
 
-        const auto paramList = std::vector<std::string>{ "track", "filename", "charcode", "shaping", "scale", "transparency", "brightness", "contrast", "vid_ts_offset", "ts_offset", "fontsdir", "forced_subs_only" };
+        const auto paramList = std::vector<std::string>{ "track", "filename", "charcode", "shaping", "scale", "transparency", "brightness", "contrast", "vid_ts_offset", "ts_offset", "fontsdir", "forced_subs_only", "lookahead" };
 
         for (const auto &param : param_list) {
             auto pos = param.find_first_of(_T("="));
@@ -2655,6 +2672,15 @@ int parse_one_vpp_option(const TCHAR *option_name, const TCHAR *strInput[], int
                     }
                     continue;
                 }
+                if (param_arg == _T("lookahead")) {
+                    try {
+                        subburn.lookahead = std::stoi(param_val);
+                    } catch (...) {
+                        print_cmd_error_invalid_value(tstring(option_name) + _T(" ") + param_arg + _T("="), param_val);
+                        return 1;
+                    }
+                    continue;
+                }
                 print_cmd_error_unknown_opt_param(option_name, param, paramList);
                 return 1;
             } else {
@@ -3335,7 +3361,7 @@ int parse_one_vpp_option(const TCHAR *option_name, const TCHAR *strInput[], int
         const auto paramList = std::vector<std::string>{
             "pos", "posx", "posy",
             "size", "width", "height",
-            "alpha", "alpha_mode", "loop", "file",
+            "alpha", "alpha_mode", "loop", "cache", "file",
             "lumakey_threshold", "lumakey_tolerance", "lumakey_softness"};
 
         for (const auto& param : param_list) {
@@ -3474,6 +3500,19 @@ int parse_one_vpp_option(const TCHAR *option_name, const TCHAR *strInput[], int
                     }
                     continue;
                 }
+                if (param_arg == _T("cache")) {
+                    try {
+                        overlay.cacheMB = std::stoi(param_val);
+                    } catch (...) {
+                        print_cmd_error_invalid_value(tstring(option_name) + _T(" ") + param_arg + _T("="), param_val);
+                        return 1;
+                    }
+                    if (overlay.cacheMB < 0) {
+                        print_cmd_error_invalid_value(tstring(option_name) + _T(" ") + param_arg + _T("="), param_val);
+                        return 1;
+                    }
+                    continue;
+                }
                 print_cmd_error_unknown_opt_param(option_name, param_arg, paramList);
                 return 1;
             } else {
@@ -4770,6 +4809,26 @@ int parse_one_common_option(const TCHAR *option_name, const TCHAR *strInput[], i
         }
         return 0;
     }
+    if (IS_OPTION("keyfile-out")) {
+        if (i+1 < nArgNum && strInput[i+1][0] != _T('-')) {
+            i++;
+            common->keyFileOut = strInput[i];
+        } else {
+            print_cmd_error_invalid_value(option_name, strInput[i+1]);
+            return 1;
+        }
+        return 0;
+    }
+    if (IS_OPTION("key-tolerance")) {
+        i++;
+        int v = 0;
+        if (1 != _stscanf_s(strInput[i], _T("%d"), &v) || v < 0) {
+            print_cmd_error_invalid_value(option_name, strInput[i]);
+            return 1;
+        }
+        common->keyTolerance = v;
+        return 0;
+    }
 #endif // #if ENABLE_KEYFRAME_INSERT
 #if ENABLE_AVSW_READER && !FOR_AUO
     if (IS_OPTION("sub-copy") || IS_OPTION("copy-sub")) {
@@ -5410,7 +5469,7 @@ int parse_one_common_option(const TCHAR *option_name, const TCHAR *strInput[], i
         }
         i++;
 
-        const auto paramList = std::vector<std::string>{ "model", "threads", "subsample", "phone_model", "enable_transform" };
+        const auto paramList = std::vector<std::string>{ "model", "threads", "subsample", "phone_model", "enable_transform", "shards", "shard_frames" };
 
         for (const auto &param : split(strInput[i], _T(","))) {
             auto pos = param.find_first_of(_T("="));
@@ -5450,6 +5509,32 @@ int parse_one_common_option(const TCHAR *option_name, const TCHAR *strInput[], i
                     }
                     continue;
                 }
+                if (param_arg == _T("shards")) {
+                    try {
+                        common->metric.vmaf.shards = std::stoi(param_val);
+                    } catch (...) {
+                        print_cmd_error_invalid_value(tstring(option_name) + _T(" ") + param_arg + _T("="), param_val);
+                        return 1;
+                    }
+                    if (common->metric.vmaf.shards < 1) {
+                        print_cmd_error_invalid_value(tstring(option_name) + _T(" ") + param_arg + _T("="), param_val);
+                        return 1;
+                    }
+                    continue;
+                }
+                if (param_arg == _T("shard_frames")) {
+                    try {
+                        common->metric.vmaf.shard_frames = std::stoi(param_val);
+                    } catch (...) {
+                        print_cmd_error_invalid_value(tstring(option_name) + _T(" ") + param_arg + _T("="), param_val);
+                        return 1;
+                    }
+                    if (common->metric.vmaf.shard_frames < 2) {
+                        print_cmd_error_invalid_value(tstring(option_name) + _T(" ") + param_arg + _T("="), param_val);
+                        return 1;
+                    }
+                    continue;
+                }
                 if (param_arg == _T("phone_model")) {
                     bool b = false;
                     if (!cmd_string_to_bool(&b, param_val)) {
@@ -5528,7 +5613,7 @@ int parse_one_ctrl_option(const TCHAR *option_name, const TCHAR *strInput[], int
             return 1;
         }
         i++;
-        const auto paramList = std::vector<std::string>{ "addtime", "framelist", "packets" };
+        const auto paramList = std::vector<std::string>{ "addtime", "framelist", "packets", "json", "repeat" };
 
         for (const auto &param : split(strInput[i], _T(","))) {
             auto pos = param.find_first_of(_T("="));
@@ -5546,6 +5631,25 @@ int parse_one_ctrl_option(const TCHAR *option_name, const TCHAR *strInput[], int
                     }
                     continue;
                 }
+                if (param_arg == _T("json")) {
+                    bool b = false;
+                    if (!cmd_string_to_bool(&b, param_val)) {
+                        ctrl->logJson = b;
+                    } else {
+                        print_cmd_error_invalid_value(tstring(option_name) + _T(" ") + param_arg + _T("="), param_val);
+                        return 1;
+                    }
+                    continue;
+                }
+                if (param_arg == _T("repeat")) {
+                    try {
+                        ctrl->logRepeatLimit = std::max(std::stoi(param_val), 0);
+                    } catch (...) {
+                        print_cmd_error_invalid_value(tstring(option_name) + _T(" ") + param_arg + _T("="), param_val);
+                        return 1;
+                    }
+                    continue;
+                }
                 if (param_arg == _T("framelist")) {
                     bool b = false;
                     if (!cmd_string_to_bool(&b, param_val)) {
@@ -5582,6 +5686,9 @@ int parse_one_ctrl_option(const TCHAR *option_name, const TCHAR *strInput[], int
                 if (param == _T("addtime")) {
                     ctrl->logAddTime = true;
                     continue;
+                } else if (param == _T("json")) {
+                    ctrl->logJson = true;
+                    continue;
                 } else if (param == _T("framelist")) {
                     ctrl->logFramePosList.enable = true;
                     continue;
@@ -5633,6 +5740,15 @@ int parse_one_ctrl_option(const TCHAR *option_name, const TCHAR *strInput[], int
         ctrl->logMuxVidTs.filename = strInput[i];
         return 0;
     }
+    if (IS_OPTION("frame-stats")) {
+        ctrl->frameStats.enable = true;
+        if (i + 1 >= nArgNum || strInput[i + 1][0] == _T('-')) {
+            return 0;
+        }
+        i++;
+        ctrl->frameStats.filename = strInput[i];
+        return 0;
+    }
     if (IS_OPTION("max-procfps")) {
         i++;
         int value = 0;
@@ -5647,6 +5763,53 @@ int parse_one_ctrl_option(const TCHAR *option_name, const TCHAR *strInput[], int
         ctrl->procSpeedLimit = (std::min)(value, std::numeric_limits<decltype(ctrl->procSpeedLimit)>::max());
         return 0;
     }
+    if (IS_OPTION("realtime")) {
+        ctrl->realtime.enable = true;
+        if (i + 1 >= nArgNum || strInput[i + 1][0] == _T('-')) {
+            return 0;
+        }
+        i++;
+
+        const auto paramList = std::vector<std::string>{ "latency", "degrade" };
+
+        for (const auto &param : split(strInput[i], _T(","))) {
+            auto pos = param.find_first_of(_T("="));
+            if (pos != std::string::npos) {
+                auto param_arg = param.substr(0, pos);
+                auto param_val = param.substr(pos + 1);
+                param_arg = tolowercase(param_arg);
+                if (param_arg == _T("latency")) {
+                    try {
+                        ctrl->realtime.latency = std::stoi(param_val);
+                    } catch (...) {
+                        print_cmd_error_invalid_value(tstring(option_name) + _T(" ") + param_arg + _T("="), param_val);
+                        return 1;
+                    }
+                    if (ctrl->realtime.latency <= 0) {
+                        print_cmd_error_invalid_value(tstring(option_name) + _T(" ") + param_arg + _T("="), param_val);
+                        return 1;
+                    }
+                    continue;
+                }
+                if (param_arg == _T("degrade")) {
+                    int value = 0;
+                    if (get_list_value(list_realtime_degrade, param_val.c_str(), &value)) {
+                        ctrl->realtime.maxLevel = (RGYRealtimeLevel)value;
+                    } else {
+                        print_cmd_error_invalid_value(tstring(option_name) + _T(" ") + param_arg + _T("="), param_val, list_realtime_degrade);
+                        return 1;
+                    }
+                    continue;
+                }
+                print_cmd_error_unknown_opt_param(option_name, param_arg, paramList);
+                return 1;
+            } else {
+                print_cmd_error_unknown_opt_param(option_name, param, paramList);
+                return 1;
+            }
+        }
+        return 0;
+    }
     if (IS_OPTION("no-avoid-idle-clock")) {
         ctrl->avoidIdleClock.mode = RGYParamAvoidIdleClockMode::Disabled;
     }
@@ -6431,6 +6594,8 @@ tstring gen_cmd(const RGYParamVpp *param, const RGYParamVpp *defaultPrm, bool sa
             ADD_BOOL(_T("pp"), decimate.preProcessed);
             ADD_BOOL(_T("chroma"), decimate.chroma);
             ADD_BOOL(_T("log"), decimate.log);
+            ADD_NUM(_T("pass"), decimate.pass);
+            ADD_PATH(_T("analysis"), decimate.analysis.c_str());
         }
         if (!tmp.str().empty()) {
             cmd << _T(" --vpp-decimate ") << tmp.str().substr(1);
@@ -6633,6 +6798,7 @@ tstring gen_cmd(const RGYParamVpp *param, const RGYParamVpp *defaultPrm, bool sa
                 ADD_FLOAT2(_T("ts_offset"), param->subburn[i], subburnDefault, ts_offset, 4);
                 ADD_PATH2(_T("fontsdir"), param->subburn[i], fontsdir.c_str());
                 ADD_BOOL2(_T("forced_subs_only"), param->subburn[i], subburnDefault, forced_subs_only);
+                ADD_NUM2(_T("lookahead"), param->subburn[i], subburnDefault, lookahead);
             }
             if (!tmp.str().empty()) {
                 cmd << _T(" --vpp-subburn ") << tmp.str().substr(1);
@@ -6802,6 +6968,7 @@ tstring gen_cmd(const RGYParamVpp *param, const RGYParamVpp *defaultPrm, bool sa
                 ADD_FLOAT2(_T("lumakey_tolerance"), param->overlay[i], overlayDefault, lumaKey.tolerance, 3);
                 ADD_FLOAT2(_T("lumakey_shoftness"), param->overlay[i], overlayDefault, lumaKey.shoftness, 3);
                 ADD_BOOL2(_T("loop"), param->overlay[i], overlayDefault, loop);
+                ADD_NUM2(_T("cache"), param->overlay[i], overlayDefault, cacheMB);
             }
             if (!tmp.str().empty()) {
                 cmd << _T(" --vpp-overlay ") << tmp.str().substr(1);
@@ -7186,6 +7353,8 @@ tstring gen_cmd(const RGYParamCommon *param, const RGYParamCommon *defaultPrm, b
     OPT_BOOL(_T("--chapter-no-trim"), _T(""), chapterNoTrim);
     OPT_BOOL(_T("--key-on-chapter"), _T(""), keyOnChapter);
     OPT_STR_PATH(_T("--keyfile"), keyFile);
+    OPT_STR_PATH(_T("--keyfile-out"), keyFileOut);
+    OPT_NUM(_T("--key-tolerance"), keyTolerance);
 
     OPT_BOOL(_T("--no-mp4opt"), _T(""), disableMp4Opt);
     OPT_LST(_T("--avsync"), AVSyncMode, list_avsync);
@@ -7237,6 +7406,8 @@ tstring gen_cmd(const RGYParamCommon *param, const RGYParamCommon *defaultPrm, b
             ADD_NUM(_T("subsample"), metric.vmaf.subsample);
             ADD_BOOL(_T("phone_model"), metric.vmaf.phone_model);
             ADD_BOOL(_T("enable_transform"), metric.vmaf.enable_transform);
+            ADD_NUM(_T("shards"), metric.vmaf.shards);
+            ADD_NUM(_T("shard_frames"), metric.vmaf.shard_frames);
         }
         if (!tmp.str().empty()) {
             cmd << _T(" --vmaf ") << tmp.str().substr(1);
@@ -7262,6 +7433,12 @@ tstring gen_cmd(const RGYParamControl *param, const RGYParamControl *defaultPrm,
     }
     OPT_LST(_T("--simd-csp"), simdCsp, list_simd);
     OPT_NUM(_T("--max-procfps"), procSpeedLimit);
+    if (param->realtime != defaultPrm->realtime) {
+        if (param->realtime.enable) {
+            cmd << _T(" --realtime latency=") << param->realtime.latency
+                << _T(",degrade=") << get_chr_from_value(list_realtime_degrade, (int)param->realtime.maxLevel);
+        }
+    }
     if (param->avoidIdleClock != defaultPrm->avoidIdleClock) {
         cmd << _T(" --avoid-idle-clock ") << get_chr_from_value(list_avoid_idle_clock, (int)param->avoidIdleClock.mode);
         if (param->avoidIdleClock.mode != RGYParamAvoidIdleClockMode::Disabled
@@ -7276,12 +7453,20 @@ tstring gen_cmd(const RGYParamControl *param, const RGYParamControl *defaultPrm,
         cmd << _T(" --log-level ") << param->loglevel.to_string();
     }
 
-    if (param->logAddTime != defaultPrm->logAddTime) {
+    if (param->logAddTime != defaultPrm->logAddTime
+        || param->logJson != defaultPrm->logJson
+        || param->logRepeatLimit != defaultPrm->logRepeatLimit) {
         std::basic_stringstream<TCHAR> tmp;
         tmp.str(tstring());
         if (param->logAddTime != defaultPrm->logAddTime) {
             tmp << _T(",addtime");
         }
+        if (param->logJson != defaultPrm->logJson) {
+            tmp << _T(",json");
+        }
+        if (param->logRepeatLimit != defaultPrm->logRepeatLimit) {
+            tmp << _T(",repeat=") << param->logRepeatLimit;
+        }
         if (!tmp.str().empty()) {
             cmd << _T(" --log-opt ") << tmp.str().substr(1);
         }
@@ -7304,6 +7489,12 @@ tstring gen_cmd(const RGYParamControl *param, const RGYParamControl *defaultPrm,
             cmd << _T(" \"") << param->logMuxVidTs.filename << _T("\"");
         }
     }
+    if (param->frameStats.enable) {
+        cmd << _T(" --frame-stats");
+        if (param->frameStats.filename.length() > 0) {
+            cmd << _T(" \"") << param->frameStats.filename << _T("\"");
+        }
+    }
     OPT_BOOL(_T("--skip-hwenc-check"), _T(""), skipHWEncodeCheck);
     OPT_BOOL(_T("--skip-hwdec-check"), _T(""), skipHWDecodeCheck);
     OPT_STR_PATH(_T("--avsdll"), avsdll);
@@ -7582,6 +7773,10 @@ tstring gen_cmd_help_common() {
         _T("   --key-on-chapter             set key frame on chapter.\n")
         _T("   --keyfile <string>           set keyframes on frames specified in the file.\n")
         _T("                                  frame num should start from 0.\n")
+        _T("   --keyfile-out <string>       output frame num of keyframes inserted by\n")
+        _T("                                  --key-on-chapter and --keyfile.\n")
+        _T("   --key-tolerance <int>        merge keyframes within the specified frames\n")
+        _T("                                  into one (default: 0 = disabled).\n")
 #endif //#if ENABLE_KEYFRAME_INSERT
         _T("   --sub-source <string>        input extra subtitle file.\n")
         _T("   --sub-copy [<int>[,...]]     copy subtitle to output file.\n")
@@ -7648,8 +7843,11 @@ tstring gen_cmd_help_common() {
         _T("      threads=<int>             cpu thread(s) to calculate vmaf score.\n")
         _T("      subsample=<int>           interval for frame subsampling calculating vmaf score.\n")
         _T("      phone_model=<bool>        use phone model which generate higher vmaf score.\n")
-        _T("      enable_transform=<bool>   enable transform when calculating vmaf score.\n"),
-        VMAF_DEFAULT_MODEL_VERSION);
+        _T("      enable_transform=<bool>   enable transform when calculating vmaf score.\n")
+        _T("      shards=<int>              number of libvmaf contexts run in parallel [default:1].\n")
+        _T("                                 frames are split into ranges and calculated independently.\n")
+        _T("      shard_frames=<int>        frames per range when shards > 1 [default:%d].\n"),
+        VMAF_DEFAULT_MODEL_VERSION, VMAF_DEFAULT_SHARD_FRAMES);
 #endif //#if ENABLE_VMAF
     return str;
 }
@@ -7841,13 +8039,20 @@ tstring gen_cmd_help_vpp() {
         _T("      blocky=<int>              block size of y direction (default=%d).\n")
         _T("                                  block size could be 4, 8, 16, 32, 64.\n")
         _T("      chroma=<bool>             consdier chroma (default: %s)\n")
-        _T("      log=<bool>                output log file (default: %s).\n"),
+        _T("      log=<bool>                output log file (default: %s).\n")
+        _T("      pass=<int>                two pass mode (default: %d).\n")
+        _T("                                  0 ... decide drops within each cycle.\n")
+        _T("                                  1 ... write block diffs to the analysis file.\n")
+        _T("                                  2 ... decide drops over the whole clip\n")
+        _T("                                        using the analysis file.\n")
+        _T("      analysis=<string>         analysis file for pass=1/2.\n"),
         FILTER_DEFAULT_DECIMATE_CYCLE, FILTER_DEFAULT_DECIMATE_DROP,
         FILTER_DEFAULT_DECIMATE_THRE_DUP, FILTER_DEFAULT_DECIMATE_THRE_SC,
         FILTER_DEFAULT_DECIMATE_BLOCK_X, FILTER_DEFAULT_DECIMATE_BLOCK_Y,
         FILTER_DEFAULT_DECIMATE_PREPROCESSED ? _T("on") : _T("off"),
         FILTER_DEFAULT_DECIMATE_CHROMA ? _T("on") : _T("off"),
-        FILTER_DEFAULT_DECIMATE_LOG ? _T("on") : _T("off"));
+        FILTER_DEFAULT_DECIMATE_LOG ? _T("on") : _T("off"),
+        FILTER_DEFAULT_DECIMATE_PASS);
 #endif
 #if ENABLE_VPP_FILTER_MPDECIMATE
     str += strsprintf(_T("\n")
@@ -8024,8 +8229,10 @@ tstring gen_cmd_help_vpp() {
         _T("                                  (when \"track\" is used this options is always on)\n")
         _T("      ts_offset=<float>         add offset in seconds to subtitle timestamps.\n")
         _T("      fontsdir=<string>         directory with fonts used.\n")
-        _T("      forced_subs_only=<bool>   render forced subs only.\n"),
-        FILTER_DEFAULT_TWEAK_BRIGHTNESS, FILTER_DEFAULT_TWEAK_CONTRAST);
+        _T("      forced_subs_only=<bool>   render forced subs only.\n")
+        _T("      lookahead=<int>           frames to render text subtitles ahead\n")
+        _T("                                  in a background thread. (default=%d, 0 = off)\n"),
+        FILTER_DEFAULT_TWEAK_BRIGHTNESS, FILTER_DEFAULT_TWEAK_CONTRAST, FILTER_DEFAULT_SUBBURN_LOOKAHEAD);
 #if ENABLE_VPP_FILTER_UNSHARP
     str += strsprintf(_T("\n")
         _T("   --vpp-unsharp [<param1>=<value>][,<param2>=<value>][...]\n")
@@ -8157,6 +8364,9 @@ tstring gen_cmd_help_vpp() {
         _T("                                  default: 0.1 (0.0 - 1.0)\n")
         _T("      lumakey_threshold=<float> set the range of softness for lumakey\n")
         _T("      loop=<bool>\n")
+        _T("      cache=<int>               max memory to keep decoded frames for loop. (MB)\n")
+        _T("                                  default: %d, 0 to disable\n"),
+        FILTER_DEFAULT_OVERLAY_CACHE_MB
     );
 #endif
 #if ENABLE_VPP_FILTER_FRUC
@@ -8182,15 +8392,26 @@ tstring gen_cmd_help_ctrl() {
         _T("     additional options for log output.\n")
         _T("    params\n")
         _T("      addtime                   add time to log lines.\n")
+        _T("      json                      output log file in JSON Lines format.\n")
+        _T("      repeat=<int>              limit output of the same message repeated\n")
+        _T("                                  in a row to the specified count.\n")
         _T("   --log-framelist [<string>]   output debug info for avsw/avhw reader.\n")
         _T("   --log-packets [<string>]     output debug info for avsw/avhw reader.\n")
-        _T("   --log-mux-ts [<string>]      output debug info for avsw/avhw reader.\n"));
+        _T("   --log-mux-ts [<string>]      output debug info for avsw/avhw reader.\n")
+        _T("   --frame-stats [<string>]     output per frame stats (binary) of encoded frames.\n")
+        _T("                                  default: <output file>.framestats\n"));
 
     str += strsprintf(_T("\n")
         _T("   --option-file <string>       read commanline options written in file.\n"));
     str += strsprintf(_T("")
         _T("   --max-procfps <int>          limit encoding speed for lower utilization.\n")
         _T("                                 default:0 (no limit)\n")
+        _T("   --realtime [<param1>=<value>][,<param2>=<value>]...\n")
+        _T("     keep up with real time, degrading quality when falling behind.\n")
+        _T("    params\n")
+        _T("      latency=<int>             allowed latency in ms (default: %d)\n")
+        _T("      degrade=<string>          how far to degrade (default: drop)\n")
+        _T("                                  none, filter, lookahead, preset, drop\n")
         _T("   --avoid-idle-clock <string>[=<float>]\n")
         _T("                                add dummy load to avoid idle GPU clock.\n")
         _T("                                - off\n")
@@ -8198,7 +8419,7 @@ tstring gen_cmd_help_ctrl() {
         _T("                                - on\n")
         _T("                                 the optional value is target dummy load percentage,\n")
         _T("                                 when number omitted: %.2f percent load\n"),
-        DEFAULT_DUMMY_LOAD_PERCENT);
+        RGY_REALTIME_LATENCY_DEFAULT, DEFAULT_DUMMY_LOAD_PERCENT);
     str += strsprintf(_T("")
 #if ENCODER_QSV
         _T("   --task-perf-monitor          enable task performance monitoring.\n")
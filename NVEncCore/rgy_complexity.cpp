@@ -0,0 +1,668 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2024 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// --------------------------------------------------------------------------------------------
+
+
+#include <cmath>
+#include <climits>
+#include <cstring>
+#include <algorithm>
+#include "rgy_complexity.h"
+#include "rgy_simd.h"
+#include "rgy_filesystem.h"
+#include "convert_csp.h"
+
+RGYComplexityParam::RGYComplexityParam() :
+    enable(false),
+    stats(),
+    scenecut(40),
+    minLength(0),
+    qcomp(0.6f),
+    maxScale(2.0f),
+    threads(0) {
+
+}
+
+bool RGYComplexityParam::operator==(const RGYComplexityParam& x) const {
+    return enable == x.enable
+        && stats == x.stats
+        && scenecut == x.scenecut
+        && minLength == x.minLength
+        && qcomp == x.qcomp
+        && maxScale == x.maxScale
+        && threads == x.threads;
+}
+bool RGYComplexityParam::operator!=(const RGYComplexityParam& x) const {
+    return !(*this == x);
+}
+
+tstring RGYComplexityParam::print() const {
+    tstring str = strsprintf(_T("scenecut %d, min-len %s, qcomp %.2f, max-scale %.2f"),
+        scenecut, (minLength > 0) ? strsprintf(_T("%d"), minLength).c_str() : _T("auto"), qcomp, maxScale);
+    if (stats.length() > 0) {
+        str += _T(", stats ") + stats;
+    }
+    return str;
+}
+
+int rgy_sad8x8_c(const uint8_t *p0, const int pitch0, const uint8_t *p1, const int pitch1) {
+    int sad = 0;
+    for (int y = 0; y < 8; y++, p0 += pitch0, p1 += pitch1) {
+        for (int x = 0; x < 8; x++) {
+            sad += std::abs((int)p0[x] - (int)p1[x]);
+        }
+    }
+    return sad;
+}
+
+// 8点のアダマール変換
+static void hadamard8_c(int *v, const int stride) {
+    for (int step = 1; step < 8; step <<= 1) {
+        for (int i = 0; i < 8; i += step * 2) {
+            for (int j = i; j < i + step; j++) {
+                const int a = v[j * stride];
+                const int b = v[(j + step) * stride];
+                v[j * stride] = a + b;
+                v[(j + step) * stride] = a - b;
+            }
+        }
+    }
+}
+
+// 差分の2次元アダマール変換の係数の絶対値の合計
+int rgy_satd8x8_c(const uint8_t *p0, const int pitch0, const uint8_t *p1, const int pitch1) {
+    int d[64];
+    for (int y = 0; y < 8; y++, p0 += pitch0, p1 += pitch1) {
+        for (int x = 0; x < 8; x++) {
+            d[y * 8 + x] = (int)p0[x] - (int)p1[x];
+        }
+    }
+    for (int i = 0; i < 8; i++) {
+        hadamard8_c(d + i * 8, 1);
+    }
+    for (int i = 0; i < 8; i++) {
+        hadamard8_c(d + i, 8);
+    }
+    int satd = 0;
+    for (int i = 0; i < 64; i++) {
+        satd += std::abs(d[i]);
+    }
+    return satd;
+}
+
+funcComplexityBlock get_complexity_sad_func() {
+#if defined(_M_IX86) || defined(_M_X64) || defined(__x86_64)
+    if ((get_availableSIMD() & RGY_SIMD::AVX2) == RGY_SIMD::AVX2) {
+        return rgy_sad8x8_avx2;
+    }
+#endif
+    return rgy_sad8x8_c;
+}
+
+funcComplexityBlock get_complexity_satd_func() {
+#if defined(_M_IX86) || defined(_M_X64) || defined(__x86_64)
+    if ((get_availableSIMD() & RGY_SIMD::AVX2) == RGY_SIMD::AVX2) {
+        return rgy_satd8x8_avx2;
+    }
+#endif
+    return rgy_satd8x8_c;
+}
+
+RGY_ERR rgy_complexity_stats_read(const tstring& filename, RGYComplexityStatsHeader *header, std::vector<RGYComplexityFrame> *frames) {
+    uint64_t filesize = 0;
+    if (!rgy_get_filesize(filename.c_str(), &filesize)) {
+        return RGY_ERR_FILE_OPEN;
+    }
+    std::unique_ptr<FILE, fp_deleter> fp(_tfopen(filename.c_str(), _T("rb")), fp_deleter());
+    if (!fp) {
+        return RGY_ERR_FILE_OPEN;
+    }
+    RGYComplexityStatsHeader head = { 0 };
+    if (fread(&head, sizeof(head), 1, fp.get()) != 1
+        || memcmp(head.magic, RGY_COMPLEXITY_STATS_MAGIC, sizeof(head.magic)) != 0
+        || head.version != RGY_COMPLEXITY_STATS_VERSION
+        || head.headerSize < sizeof(head)
+        || filesize < head.headerSize) {
+        return RGY_ERR_INVALID_FORMAT;
+    }
+    const uint64_t framesInFile = (filesize - head.headerSize) / sizeof(RGYComplexityFrame);
+    if (head.frames > framesInFile) {
+        return RGY_ERR_INVALID_FORMAT;
+    }
+    if (_fseeki64(fp.get(), head.headerSize, SEEK_SET) != 0) {
+        return RGY_ERR_INVALID_FORMAT;
+    }
+    frames->resize((size_t)head.frames);
+    if (head.frames > 0 && fread(frames->data(), sizeof(RGYComplexityFrame), frames->size(), fp.get()) != frames->size()) {
+        return RGY_ERR_INVALID_FORMAT;
+    }
+    *header = head;
+    return RGY_ERR_NONE;
+}
+
+RGY_ERR rgy_complexity_stats_write(const tstring& filename, const RGYComplexityStatsHeader& header, const std::vector<RGYComplexityFrame>& frames) {
+    RGYComplexityStatsHeader head = header;
+    memcpy(head.magic, RGY_COMPLEXITY_STATS_MAGIC, sizeof(head.magic));
+    head.version = RGY_COMPLEXITY_STATS_VERSION;
+    head.headerSize = sizeof(head);
+    head.frames = frames.size();
+    std::unique_ptr<FILE, fp_deleter> fp(_tfopen(filename.c_str(), _T("wb")), fp_deleter());
+    if (!fp) {
+        return RGY_ERR_FILE_OPEN;
+    }
+    if (fwrite(&head, sizeof(head), 1, fp.get()) != 1
+        || (frames.size() > 0 && fwrite(frames.data(), sizeof(RGYComplexityFrame), frames.size(), fp.get()) != frames.size())) {
+        return RGY_ERR_UNDEFINED_BEHAVIOR;
+    }
+    return RGY_ERR_NONE;
+}
+
+RGYComplexityAnalyzer::RGYComplexityAnalyzer() :
+    m_prm(),
+    m_srcWidth(0),
+    m_srcHeight(0),
+    m_srcBitDepth(0),
+    m_srcShift(0),
+    m_scale(1),
+    m_width(0),
+    m_height(0),
+    m_minLength(0),
+    m_funcDownscale(nullptr),
+    m_funcSad(nullptr),
+    m_funcSatd(nullptr),
+    m_fromStats(false),
+    m_threads(),
+    m_mtx(),
+    m_cvJob(),
+    m_cvDone(),
+    m_jobs(),
+    m_pending(),
+    m_lastImage(),
+    m_maxPending(0),
+    m_fin(false),
+    m_frames(),
+    m_sumCost(0.0),
+    m_sumIntra(0.0),
+    m_costFrames(0),
+    m_analyzed(0),
+    m_plan(),
+    m_planIdx(0),
+    m_checkedInput(-1),
+    m_segmentStartEnc(0),
+    m_segments(0),
+    m_log() {
+}
+
+RGYComplexityAnalyzer::~RGYComplexityAnalyzer() {
+    close();
+}
+
+void RGYComplexityAnalyzer::AddMessage(RGYLogLevel log_level, const TCHAR *format, ...) {
+    if (m_log == nullptr || log_level < m_log->getLogLevel(RGY_LOGT_CORE)) {
+        return;
+    }
+    va_list args;
+    va_start(args, format);
+    int len = _vsctprintf(format, args) + 1; // _vscprintf doesn't count terminating '\0'
+    tstring buffer;
+    buffer.resize(len, _T('\0'));
+    _vstprintf_s(&buffer[0], len, format, args);
+    va_end(args);
+    m_log->write(log_level, RGY_LOGT_CORE, (_T("complexity: ") + tstring(buffer.c_str())).c_str());
+}
+
+RGY_ERR RGYComplexityAnalyzer::init(const RGYComplexityParam& prm, const int width, const int height, const RGY_CSP csp, const rgy_rational<int>& fps, std::shared_ptr<RGYLog> log) {
+    close();
+    m_prm = prm;
+    m_log = log;
+    m_srcWidth = width;
+    m_srcHeight = height;
+    m_scale = 1;
+    while (width / m_scale > RGY_COMPLEXITY_MAX_WIDTH) {
+        m_scale *= 2;
+    }
+    m_width  = (width  / m_scale) & ~(RGY_COMPLEXITY_BLOCK - 1);
+    m_height = (height / m_scale) & ~(RGY_COMPLEXITY_BLOCK - 1);
+    if (m_width < RGY_COMPLEXITY_BLOCK * 2 || m_height < RGY_COMPLEXITY_BLOCK * 2) {
+        AddMessage(RGY_LOG_ERROR, _T("frame size %dx%d too small.\n"), width, height);
+        return RGY_ERR_UNSUPPORTED;
+    }
+    m_minLength = (prm.minLength > 0) ? prm.minLength
+        : ((fps.n() > 0 && fps.d() > 0) ? (int)(fps.n() * 2.0 / fps.d() + 0.5) : 60);
+    m_funcSad = get_complexity_sad_func();
+    m_funcSatd = get_complexity_satd_func();
+
+    if (prm.stats.length() > 0 && rgy_file_exists(prm.stats)) {
+        RGYComplexityStatsHeader header = { 0 };
+        std::vector<RGYComplexityFrame> frames;
+        const auto err = rgy_complexity_stats_read(prm.stats, &header, &frames);
+        if (err != RGY_ERR_NONE) {
+            AddMessage(RGY_LOG_WARN, _T("failed to read stats file \"%s\": %s, running analysis again.\n"), prm.stats.c_str(), get_err_mes(err));
+        } else if (header.width != width || header.height != height || header.scale != m_scale) {
+            AddMessage(RGY_LOG_WARN, _T("stats file \"%s\" was created for %dx%d, running analysis again.\n"), prm.stats.c_str(), header.width, header.height);
+        } else if (frames.size() == 0) {
+            AddMessage(RGY_LOG_WARN, _T("stats file \"%s\" is empty, running analysis again.\n"), prm.stats.c_str());
+        } else {
+            for (const auto& f : frames) {
+                if (f.frame < 0 || !(f.flags & RGY_COMPLEXITY_FRAME_VALID)) {
+                    continue;
+                }
+                if ((int)m_frames.size() <= f.frame) {
+                    m_frames.resize(f.frame + 1, RGYComplexityFrame{ 0, RGY_COMPLEXITY_FRAME_NONE, 0.0f, 0.0f });
+                }
+                m_frames[f.frame] = f;
+            }
+            m_fromStats = true;
+            planFromStats();
+            AddMessage(RGY_LOG_DEBUG, _T("loaded %d frames from stats file \"%s\", %d segments.\n"), (int)frames.size(), prm.stats.c_str(), (int)m_plan.size());
+            return RGY_ERR_NONE;
+        }
+    }
+    if (!rgy_luma_downscale_supported(csp, &m_srcShift)) {
+        AddMessage(RGY_LOG_ERROR, _T("analysis of %s input is not supported.\n"), RGY_CSP_NAMES[csp]);
+        return RGY_ERR_UNSUPPORTED;
+    }
+    m_srcBitDepth = RGY_CSP_BIT_DEPTH[csp];
+    m_funcDownscale = get_luma_downscale_func(csp);
+    const int threads = (prm.threads > 0) ? prm.threads
+        : clamp((int)std::thread::hardware_concurrency() / 4, 1, RGY_COMPLEXITY_MAX_THREADS);
+    m_maxPending = threads + 1;
+    m_fin = false;
+    for (int i = 0; i < threads; i++) {
+        m_threads.push_back(std::thread(&RGYComplexityAnalyzer::threadFunc, this));
+    }
+    AddMessage(RGY_LOG_DEBUG, _T("analyzing %dx%d (1/%d), %d threads, %s.\n"), m_width, m_height, m_scale, threads, m_prm.print().c_str());
+    return RGY_ERR_NONE;
+}
+
+void RGYComplexityAnalyzer::downscale(uint8_t *dst, const RGYFrameInfo& src) const {
+    m_funcDownscale(dst, m_width, m_height, src.ptr[0], src.pitch[0], m_scale, m_srcShift);
+}
+
+RGYComplexityFrame RGYComplexityAnalyzer::analyze(const int frame, const uint8_t *cur, const uint8_t *prev) const {
+    static const uint8_t zero[RGY_COMPLEXITY_BLOCK] = { 0 };
+    const int range = RGY_COMPLEXITY_SEARCH_RANGE;
+    const int blockX = m_width / RGY_COMPLEXITY_BLOCK;
+    const int blockY = m_height / RGY_COMPLEXITY_BLOCK;
+    std::vector<std::pair<int, int>> mvs((prev) ? blockX * blockY : 0, std::make_pair(0, 0));
+    int64_t sumIntra = 0;
+    int64_t sumInter = 0;
+    for (int by = 0; by < blockY; by++) {
+        for (int bx = 0; bx < blockX; bx++) {
+            const int x = bx * RGY_COMPLEXITY_BLOCK;
+            const int y = by * RGY_COMPLEXITY_BLOCK;
+            const uint8_t *ptrCur = cur + y * m_width + x;
+            // 2次元アダマール変換のDC係数はブロックの画素値の合計なので、SADで求めて除く
+            const int intra = m_funcSatd(ptrCur, m_width, zero, 0) - m_funcSad(ptrCur, m_width, zero, 0);
+            sumIntra += intra;
+            if (!prev) {
+                continue;
+            }
+            auto sadAt = [&](const int mx, const int my) {
+                if (std::abs(mx) > range || std::abs(my) > range
+                    || x + mx < 0 || y + my < 0 || x + mx + RGY_COMPLEXITY_BLOCK > m_width || y + my + RGY_COMPLEXITY_BLOCK > m_height) {
+                    return INT_MAX;
+                }
+                return m_funcSad(ptrCur, m_width, prev + (y + my) * m_width + x + mx, m_width);
+            };
+            // 左、上、右上のブロックのベクトルを候補とし、小さいダイヤモンドで探索する
+            int bestX = 0, bestY = 0;
+            int bestSad = sadAt(0, 0);
+            const std::pair<int, int> candidates[3] = {
+                (bx > 0) ? mvs[by * blockX + bx - 1] : std::make_pair(0, 0),
+                (by > 0) ? mvs[(by - 1) * blockX + bx] : std::make_pair(0, 0),
+                (by > 0 && bx + 1 < blockX) ? mvs[(by - 1) * blockX + bx + 1] : std::make_pair(0, 0)
+            };
+            for (const auto& c : candidates) {
+                if (c.first == bestX && c.second == bestY) continue;
+                const int sad = sadAt(c.first, c.second);
+                if (sad < bestSad) {
+                    bestSad = sad;
+                    bestX = c.first;
+                    bestY = c.second;
+                }
+            }
+            static const int dx[4] = { -1, 1, 0, 0 };
+            static const int dy[4] = { 0, 0, -1, 1 };
+            for (int iter = 0; iter < range; iter++) {
+                int nextX = bestX, nextY = bestY;
+                for (int i = 0; i < 4; i++) {
+                    const int sad = sadAt(bestX + dx[i], bestY + dy[i]);
+                    if (sad < bestSad) {
+                        bestSad = sad;
+                        nextX = bestX + dx[i];
+                        nextY = bestY + dy[i];
+                    }
+                }
+                if (nextX == bestX && nextY == bestY) {
+                    break;
+                }
+                bestX = nextX;
+                bestY = nextY;
+            }
+            mvs[by * blockX + bx] = std::make_pair(bestX, bestY);
+            const int inter = m_funcSatd(ptrCur, m_width, prev + (y + bestY) * m_width + x + bestX, m_width);
+            sumInter += std::min(inter, intra);
+        }
+    }
+    const double pixels = (double)m_width * m_height;
+    RGYComplexityFrame result;
+    result.frame = frame;
+    result.flags = RGY_COMPLEXITY_FRAME_VALID | ((prev) ? 0 : RGY_COMPLEXITY_FRAME_FIRST);
+    result.intraCost = (float)(sumIntra / pixels);
+    result.interCost = (prev) ? (float)(sumInter / pixels) : result.intraCost;
+    return result;
+}
+
+void RGYComplexityAnalyzer::threadFunc() {
+    for (;;) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(m_mtx);
+            m_cvJob.wait(lock, [&]() { return m_fin || m_jobs.size() > 0; });
+            if (m_jobs.size() == 0) {
+                return;
+            }
+            job = std::move(m_jobs.front());
+            m_jobs.pop_front();
+        }
+        downscale(job.cur->buf.data(), job.src);
+        job.ref.reset(); //入力フレームのバッファを解放
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            job.cur->ready = true;
+        }
+        m_cvDone.notify_all();
+        if (job.prev) {
+            //前のフレームは先に取り出されているので、縮小が終わるのを待てばよい
+            std::unique_lock<std::mutex> lock(m_mtx);
+            m_cvDone.wait(lock, [&]() { return job.prev->ready; });
+        }
+        auto result = analyze(job.frame, job.cur->buf.data(), (job.prev) ? job.prev->buf.data() : nullptr);
+        if (job.scene) {
+            //シーンチェンジの判定は別スレッドで行われているので、終わっていなければ待つ
+            result.flags |= RGY_COMPLEXITY_FRAME_SCENE_EXT;
+            if (job.scene->sceneChange()) {
+                result.flags |= RGY_COMPLEXITY_FRAME_SCENECUT;
+            }
+            job.scene.reset();
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            if ((int)m_frames.size() <= job.frame) {
+                m_frames.resize(job.frame + 1, RGYComplexityFrame{ 0, RGY_COMPLEXITY_FRAME_NONE, 0.0f, 0.0f });
+            }
+            m_frames[job.frame] = result;
+            if (!(result.flags & RGY_COMPLEXITY_FRAME_FIRST) && !isSceneChange(result)) {
+                m_sumCost += result.interCost;
+                m_costFrames++;
+            }
+            m_sumIntra += result.intraCost;
+            m_analyzed++;
+            m_pending.erase(job.frame);
+        }
+        m_cvDone.notify_all();
+    }
+}
+
+RGY_ERR RGYComplexityAnalyzer::addFrame(const int inputFrameId, const RGYFrameInfo& frame, std::shared_ptr<void> ref, std::shared_ptr<RGYFrameDataScene> scene) {
+    if (m_fromStats || m_threads.size() == 0) {
+        return RGY_ERR_NONE;
+    }
+    if (frame.width < m_width * m_scale || frame.height < m_height * m_scale || RGY_CSP_BIT_DEPTH[frame.csp] != m_srcBitDepth) {
+        AddMessage(RGY_LOG_ERROR, _T("unexpected frame #%d: %dx%d %s.\n"), inputFrameId, frame.width, frame.height, RGY_CSP_NAMES[frame.csp]);
+        return RGY_ERR_INVALID_PARAM;
+    }
+    auto image = std::make_shared<Image>();
+    image->buf.resize(m_width * m_height);
+    image->ready = false;
+
+    Job job;
+    job.frame = inputFrameId;
+    job.src = frame;
+    job.ref = ref;
+    job.scene = scene;
+    job.cur = image;
+    {
+        std::unique_lock<std::mutex> lock(m_mtx);
+        m_cvDone.wait(lock, [&]() { return (int)m_pending.size() < m_maxPending; });
+        job.prev = m_lastImage;
+        m_lastImage = image;
+        m_pending.insert(inputFrameId);
+        m_jobs.push_back(std::move(job));
+    }
+    m_cvJob.notify_one();
+    return RGY_ERR_NONE;
+}
+
+bool RGYComplexityAnalyzer::isSceneChange(const RGYComplexityFrame& frame) const {
+    if (frame.flags & RGY_COMPLEXITY_FRAME_FIRST) {
+        return false;
+    }
+    //RGYSceneChangeDetectorの判定があればそれに合わせ、キーフレームと区間の切り替えを揃える
+    if (frame.flags & RGY_COMPLEXITY_FRAME_SCENE_EXT) {
+        return (frame.flags & RGY_COMPLEXITY_FRAME_SCENECUT) != 0;
+    }
+    // x264と同じく、動き補償後のコストがintraのコストに近ければシーンチェンジとする
+    if (m_prm.scenecut <= 0) {
+        return false;
+    }
+    const double threshold = 1.0 - m_prm.scenecut / 100.0;
+    return frame.interCost >= frame.intraCost * threshold;
+}
+
+RGYComplexitySegment RGYComplexityAnalyzer::makeSegment(const int start, const std::vector<const RGYComplexityFrame *>& frames, const double avgCost, const double avgIntra) const {
+    RGYComplexitySegment seg;
+    seg.start = start;
+    seg.frames = 0;
+    seg.complexity = 0.0;
+    seg.ratio = 1.0;
+    seg.intraRatio = 1.0;
+    seg.bitrateScale = 1.0;
+    seg.qpOffset = 0;
+    seg.aqOffset = 0;
+    // 先頭(シーンチェンジ)のフレームはIDRになるので、残りのフレームのコストで推定する
+    double sumCost = 0.0, sumIntra = 0.0;
+    for (size_t i = 1; i < frames.size(); i++) {
+        sumCost += frames[i]->interCost;
+        sumIntra += frames[i]->intraCost;
+        seg.frames++;
+    }
+    if (seg.frames == 0 || avgCost <= 0.0 || avgIntra <= 0.0) {
+        return seg; //推定できない場合は変更しない
+    }
+    seg.complexity = sumCost / seg.frames;
+    seg.ratio = std::max(seg.complexity / avgCost, 1e-3);
+    seg.intraRatio = std::max(sumIntra / seg.frames / avgIntra, 1e-3);
+    // x264のABRと同様、ビットレートは複雑さのqcomp乗に比例させる
+    const double maxScale = std::max((double)m_prm.maxScale, 1.0);
+    seg.bitrateScale = clamp(std::pow(seg.ratio, (double)m_prm.qcomp), 1.0 / maxScale, maxScale);
+    // 固定品質系ではx264のCRFと同様、qscaleを複雑さの(1-qcomp)乗に比例させる
+    const int maxQPOffset = (int)(6.0 * std::log2(maxScale) + 0.5);
+    seg.qpOffset = clamp((int)std::lround(6.0 * (1.0 - m_prm.qcomp) * std::log2(seg.ratio)), -maxQPOffset, maxQPOffset);
+    // 空間方向に複雑なほど平坦部との差が大きくなるので、AQを強める
+    seg.aqOffset = clamp((int)std::lround(2.0 * std::log2(seg.intraRatio)), -4, 4);
+    return seg;
+}
+
+void RGYComplexityAnalyzer::planFromStats() {
+    m_plan.clear();
+    m_planIdx = 0;
+    double sumCost = 0.0, sumIntra = 0.0;
+    int costFrames = 0, frames = 0;
+    for (const auto& f : m_frames) {
+        if (!(f.flags & RGY_COMPLEXITY_FRAME_VALID)) continue;
+        if (!(f.flags & RGY_COMPLEXITY_FRAME_FIRST) && !isSceneChange(f)) {
+            sumCost += f.interCost;
+            costFrames++;
+        }
+        sumIntra += f.intraCost;
+        frames++;
+    }
+    const double avgCost = (costFrames > 0) ? sumCost / costFrames : 0.0;
+    const double avgIntra = (frames > 0) ? sumIntra / frames : 0.0;
+    // シーンチェンジで区切り、区間の最小フレーム数に満たないものは前の区間に含める
+    std::vector<const RGYComplexityFrame *> segFrames;
+    int segStart = -1;
+    for (const auto& f : m_frames) {
+        if (!(f.flags & RGY_COMPLEXITY_FRAME_VALID)) continue;
+        if (segStart < 0 || ((int)segFrames.size() >= m_minLength && isSceneChange(f))) {
+            if (segStart >= 0) {
+                m_plan.push_back(makeSegment(segStart, segFrames, avgCost, avgIntra));
+            }
+            segStart = f.frame;
+            segFrames.clear();
+        }
+        segFrames.push_back(&f);
+    }
+    if (segStart >= 0) {
+        m_plan.push_back(makeSegment(segStart, segFrames, avgCost, avgIntra));
+    }
+}
+
+bool RGYComplexityAnalyzer::checkSegment(const int encFrameId, const int inputFrameId, RGYComplexitySegment *seg) {
+    if (inputFrameId <= m_checkedInput) {
+        return false; //同じ入力フレームの複製
+    }
+    const int prevChecked = m_checkedInput;
+    m_checkedInput = inputFrameId;
+    if (m_fromStats) {
+        //判定済みのフレームからこのフレームまでに始まる区間があれば切り替える
+        //(フィルタでフレームが間引かれていても、区間の開始を見逃さないようにする)
+        bool found = false;
+        while (m_planIdx < m_plan.size() && m_plan[m_planIdx].start <= inputFrameId) {
+            *seg = m_plan[m_planIdx++];
+            found = true;
+        }
+        if (!found) {
+            return false;
+        }
+    } else {
+        if (m_threads.size() == 0) {
+            return false;
+        }
+        std::unique_lock<std::mutex> lock(m_mtx);
+        //このフレームまでの解析を待つ
+        m_cvDone.wait(lock, [&]() { return m_pending.size() == 0 || *m_pending.begin() > inputFrameId; });
+        bool cut = (m_segments == 0);
+        if (!cut && encFrameId - m_segmentStartEnc >= m_minLength) {
+            for (int i = prevChecked + 1; i <= inputFrameId && i < (int)m_frames.size(); i++) {
+                if ((m_frames[i].flags & RGY_COMPLEXITY_FRAME_VALID) && isSceneChange(m_frames[i])) {
+                    cut = true;
+                    break;
+                }
+            }
+        }
+        if (!cut) {
+            return false;
+        }
+        //解析済みのフレームのうち、次のシーンチェンジまでを区間の複雑さの推定に使う
+        //先読みできるのはパイプラインに入っているフレームまで
+        std::vector<const RGYComplexityFrame *> frames;
+        for (int i = inputFrameId; i < (int)m_frames.size(); i++) {
+            const auto& f = m_frames[i];
+            if (!(f.flags & RGY_COMPLEXITY_FRAME_VALID)) {
+                if (m_pending.count(i)) break;
+                continue;
+            }
+            if (i > inputFrameId && isSceneChange(f)) break;
+            frames.push_back(&f);
+        }
+        const double avgCost = (m_costFrames > 0) ? m_sumCost / m_costFrames : 0.0;
+        const double avgIntra = (m_analyzed > 0) ? m_sumIntra / m_analyzed : 0.0;
+        *seg = makeSegment(inputFrameId, frames, avgCost, avgIntra);
+    }
+    m_segmentStartEnc = encFrameId;
+    m_segments++;
+    AddMessage(RGY_LOG_DEBUG, _T("segment #%d at frame %d (input %d): complexity %.2f (x%.2f, intra x%.2f, %d frames), bitrate x%.2f, qp %+d, aq %+d.\n"),
+        m_segments, encFrameId, inputFrameId, seg->complexity, seg->ratio, seg->intraRatio, seg->frames, seg->bitrateScale, seg->qpOffset, seg->aqOffset);
+    return true;
+}
+
+tstring RGYComplexityAnalyzer::print() const {
+    tstring str = m_prm.print();
+    if (m_fromStats) {
+        str += _T(" (from stats)");
+    } else {
+        str += strsprintf(_T(", threads %d"), (int)m_threads.size());
+    }
+    return str;
+}
+
+RGY_ERR RGYComplexityAnalyzer::close() {
+    if (m_threads.size() > 0) {
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            m_fin = true;
+        }
+        m_cvJob.notify_all();
+        for (auto& th : m_threads) {
+            if (th.joinable()) {
+                th.join();
+            }
+        }
+        m_threads.clear();
+    }
+    auto err = RGY_ERR_NONE;
+    if (!m_fromStats && m_prm.stats.length() > 0 && m_analyzed > 0) {
+        RGYComplexityStatsHeader header = { 0 };
+        header.width = m_srcWidth;
+        header.height = m_srcHeight;
+        header.scale = m_scale;
+        std::vector<RGYComplexityFrame> frames;
+        for (const auto& f : m_frames) {
+            if (f.flags & RGY_COMPLEXITY_FRAME_VALID) {
+                frames.push_back(f);
+            }
+        }
+        err = rgy_complexity_stats_write(m_prm.stats, header, frames);
+        if (err != RGY_ERR_NONE) {
+            AddMessage(RGY_LOG_ERROR, _T("failed to write stats file \"%s\": %s.\n"), m_prm.stats.c_str(), get_err_mes(err));
+        } else {
+            AddMessage(RGY_LOG_DEBUG, _T("wrote %d frames to stats file \"%s\".\n"), (int)frames.size(), m_prm.stats.c_str());
+        }
+    }
+    if (m_segments > 0) {
+        AddMessage(RGY_LOG_DEBUG, _T("%d segments.\n"), m_segments);
+    }
+    m_jobs.clear();
+    m_pending.clear();
+    m_lastImage.reset();
+    m_frames.clear();
+    m_plan.clear();
+    m_planIdx = 0;
+    m_sumCost = 0.0;
+    m_sumIntra = 0.0;
+    m_costFrames = 0;
+    m_analyzed = 0;
+    m_checkedInput = -1;
+    m_segmentStartEnc = 0;
+    m_segments = 0;
+    m_fromStats = false;
+    m_fin = false;
+    m_log.reset();
+    return err;
+}
@@ -0,0 +1,216 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2024 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// --------------------------------------------------------------------------------------------
+
+
+#pragma once
+#ifndef __RGY_COMPLEXITY_H__
+#define __RGY_COMPLEXITY_H__
+
+#include <cstdint>
+#include <vector>
+#include <deque>
+#include <set>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "rgy_tchar.h"
+#include "rgy_err.h"
+#include "rgy_log.h"
+#include "rgy_util.h"
+#include "rgy_frame_info.h"
+#include "rgy_scenechange.h"
+
+static const int RGY_COMPLEXITY_BLOCK = 8;            // 解析のブロックサイズ (縮小後)
+static const int RGY_COMPLEXITY_MAX_WIDTH = 1024;     // 縮小後の幅の上限
+static const int RGY_COMPLEXITY_SEARCH_RANGE = 16;    // 動き探索の範囲 (縮小後の画素)
+static const int RGY_COMPLEXITY_MAX_THREADS = 4;
+
+struct RGYComplexityParam {
+    bool enable;
+    tstring stats;     // 解析結果ファイル (あれば読み込んで解析を省略し、なければ解析結果を書き出す)
+    int scenecut;      // シーンチェンジ判定の閾値 (x264の--scenecut相当、0で無効)
+    int minLength;     // 区間の最小フレーム数 (0なら2秒)
+    float qcomp;       // 複雑さをどの程度ビットレートに反映させるか (x264の--qcomp相当)
+    float maxScale;    // ビットレートの変更幅の上限 (倍率)
+    int threads;       // 解析スレッド数 (0なら自動)
+
+    RGYComplexityParam();
+    bool operator==(const RGYComplexityParam& x) const;
+    bool operator!=(const RGYComplexityParam& x) const;
+    tstring print() const;
+};
+
+// 解析結果ファイル
+//
+//  [RGYComplexityStatsHeader]
+//  [RGYComplexityFrame] x frames (入力フレーム番号順、trimで除いたフレームは含まない)
+//
+// マルチバイトの値はすべてリトルエンディアン
+static const char RGY_COMPLEXITY_STATS_MAGIC[8] = { 'R', 'G', 'Y', 'C', 'P', 'L', 'X', 'S' };
+static const uint32_t RGY_COMPLEXITY_STATS_VERSION = 1;
+
+struct RGYComplexityStatsHeader {
+    char     magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    int32_t  width;    // 入力の解像度
+    int32_t  height;
+    int32_t  scale;    // 縮小率
+    int32_t  reserved;
+    uint64_t frames;
+};
+static_assert(sizeof(RGYComplexityStatsHeader) == 40, "unexpected size of RGYComplexityStatsHeader");
+
+enum RGYComplexityFrameFlag : uint32_t {
+    RGY_COMPLEXITY_FRAME_NONE  = 0x00,
+    RGY_COMPLEXITY_FRAME_VALID = 0x01, // 解析済み
+    RGY_COMPLEXITY_FRAME_FIRST = 0x02, // 前のフレームがない (interCost = intraCost)
+    RGY_COMPLEXITY_FRAME_SCENE_EXT = 0x04, // シーンチェンジをRGYSceneChangeDetectorで判定した
+    RGY_COMPLEXITY_FRAME_SCENECUT  = 0x08, // RGYSceneChangeDetectorでシーンチェンジと判定された
+};
+
+struct RGYComplexityFrame {
+    int32_t  frame;     // 入力フレーム番号
+    uint32_t flags;     // RGYComplexityFrameFlag
+    float    intraCost; // 空間方向の複雑さ (縮小後の1画素あたりのSATD、DC成分を除く)
+    float    interCost; // 時間方向の複雑さ (動き補償後の1画素あたりのSATD、ブロックごとにintraCost以下)
+};
+static_assert(sizeof(RGYComplexityFrame) == 16, "unexpected size of RGYComplexityFrame");
+
+RGY_ERR rgy_complexity_stats_read(const tstring& filename, RGYComplexityStatsHeader *header, std::vector<RGYComplexityFrame> *frames);
+RGY_ERR rgy_complexity_stats_write(const tstring& filename, const RGYComplexityStatsHeader& header, const std::vector<RGYComplexityFrame>& frames);
+
+// 動的レート制御の区間
+struct RGYComplexitySegment {
+    int start;            // 開始する入力フレーム番号
+    int frames;           // 複雑さの推定に使ったフレーム数
+    double complexity;    // 区間の平均の複雑さ
+    double ratio;         // 全体の(ライブ解析時はこれまでの)平均に対する比
+    double intraRatio;    // 空間方向の複雑さの平均に対する比
+    double bitrateScale;  // ビットレート系のモードで掛けるビットレートの倍率
+    int qpOffset;         // 固定品質系のモードで加えるQP
+    int aqOffset;         // 空間AQの強度に加える値
+};
+
+// 8x8ブロックのSAD/SATD (8bit)
+typedef int (*funcComplexityBlock)(const uint8_t *p0, const int pitch0, const uint8_t *p1, const int pitch1);
+
+int rgy_sad8x8_c(const uint8_t *p0, const int pitch0, const uint8_t *p1, const int pitch1);
+int rgy_satd8x8_c(const uint8_t *p0, const int pitch0, const uint8_t *p1, const int pitch1);
+#if defined(_M_IX86) || defined(_M_X64) || defined(__x86_64)
+int rgy_sad8x8_avx2(const uint8_t *p0, const int pitch0, const uint8_t *p1, const int pitch1);
+int rgy_satd8x8_avx2(const uint8_t *p0, const int pitch0, const uint8_t *p1, const int pitch1);
+#endif
+
+funcComplexityBlock get_complexity_sad_func();
+funcComplexityBlock get_complexity_satd_func();
+
+// 入力フレームの輝度を縮小して、フレームごとの空間/時間方向の複雑さとシーンチェンジを求め、
+// 動的レート制御の区間を決める
+//
+// 解析は別スレッドで行い、エンコーダ側ではcheckSegment()で区間の切り替えを判定する
+// 区間の切り替えはIDRを伴うので、シーンチェンジの位置でのみ行う
+// 解析結果ファイルがある場合は解析を省略し、クリップ全体から区間を決める
+class RGYComplexityAnalyzer {
+public:
+    RGYComplexityAnalyzer();
+    ~RGYComplexityAnalyzer();
+
+    RGY_ERR init(const RGYComplexityParam& prm, const int width, const int height, const RGY_CSP csp, const rgy_rational<int>& fps, std::shared_ptr<RGYLog> log);
+    // 解析結果ファイルから区間を決めた場合はtrue (addFrameは不要)
+    bool fromStats() const { return m_fromStats; }
+    tstring print() const;
+    // 入力フレームの輝度を解析キューに追加する
+    // refは縮小が終わるまで保持するので、それまでframeのバッファは再利用されない
+    // sceneを指定した場合は、シーンチェンジの判定にその結果を使う
+    RGY_ERR addFrame(const int inputFrameId, const RGYFrameInfo& frame, std::shared_ptr<void> ref, std::shared_ptr<RGYFrameDataScene> scene = nullptr);
+    // エンコードするフレーム順に呼ぶ
+    // このフレームから新しい区間を開始する場合はtrueを返す
+    bool checkSegment(const int encFrameId, const int inputFrameId, RGYComplexitySegment *seg);
+    // 解析を終了し、必要なら解析結果ファイルを書き出す
+    RGY_ERR close();
+protected:
+    struct Image {
+        std::vector<uint8_t> buf;
+        bool ready;
+    };
+    struct Job {
+        int frame;
+        RGYFrameInfo src;
+        std::shared_ptr<void> ref;
+        std::shared_ptr<RGYFrameDataScene> scene;
+        std::shared_ptr<Image> cur;
+        std::shared_ptr<Image> prev;
+    };
+    void threadFunc();
+    void downscale(uint8_t *dst, const RGYFrameInfo& src) const;
+    RGYComplexityFrame analyze(const int frame, const uint8_t *cur, const uint8_t *prev) const;
+    bool isSceneChange(const RGYComplexityFrame& frame) const;
+    RGYComplexitySegment makeSegment(const int start, const std::vector<const RGYComplexityFrame *>& frames, const double avgCost, const double avgIntra) const;
+    void planFromStats();
+    void AddMessage(RGYLogLevel log_level, const TCHAR *format, ...);
+
+    RGYComplexityParam m_prm;
+    int m_srcWidth;
+    int m_srcHeight;
+    int m_srcBitDepth;
+    int m_srcShift;        // 8bitにするためのシフト量
+    int m_scale;           // 縮小率
+    int m_width;           // 縮小後の解像度 (ブロックサイズの倍数)
+    int m_height;
+    int m_minLength;
+    funcLumaDownscale m_funcDownscale;
+    funcComplexityBlock m_funcSad;
+    funcComplexityBlock m_funcSatd;
+    bool m_fromStats;
+
+    std::vector<std::thread> m_threads;
+    std::mutex m_mtx;
+    std::condition_variable m_cvJob;   // 解析待ちのフレームの追加/終了要求
+    std::condition_variable m_cvDone;  // 縮小/解析の完了
+    std::deque<Job> m_jobs;
+    std::set<int> m_pending;           // 追加済みで解析の終わっていないフレーム
+    std::shared_ptr<Image> m_lastImage;
+    int m_maxPending;                  // 解析待ちのフレーム数の上限 (超えたら入力側を待たせる)
+    bool m_fin;                        // 追加済みのフレームを解析したら終了する
+
+    std::vector<RGYComplexityFrame> m_frames; // 入力フレーム番号をインデックスとする
+    double m_sumCost;                         // 解析済みのフレームの合計 (ライブ解析時の基準)
+    double m_sumIntra;
+    int m_costFrames;                         // m_sumCostに含めたフレーム数 (シーンチェンジを除く)
+    int m_analyzed;
+
+    std::vector<RGYComplexitySegment> m_plan; // 解析結果ファイルから決めた区間
+    size_t m_planIdx;
+    int m_checkedInput;      // 判定済みの入力フレーム番号
+    int m_segmentStartEnc;   // 現在の区間の開始エンコードフレーム番号
+    int m_segments;
+    std::shared_ptr<RGYLog> m_log;
+};
+
+#endif //__RGY_COMPLEXITY_H__
@@ -0,0 +1,112 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2024 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// --------------------------------------------------------------------------------------------
+
+
+#include <immintrin.h>
+#include "rgy_osdep.h"
+#include "rgy_complexity.h"
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__x86_64)
+
+//4行分の8画素を読み込む
+static RGY_FORCEINLINE __m256i load_8x4_avx2(const uint8_t *ptr, const int pitch) {
+    const __m128i r01 = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i *)(ptr + 0 * pitch)), _mm_loadl_epi64((const __m128i *)(ptr + 1 * pitch)));
+    const __m128i r23 = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i *)(ptr + 2 * pitch)), _mm_loadl_epi64((const __m128i *)(ptr + 3 * pitch)));
+    return _mm256_inserti128_si256(_mm256_castsi128_si256(r01), r23, 1);
+}
+
+int rgy_sad8x8_avx2(const uint8_t *p0, const int pitch0, const uint8_t *p1, const int pitch1) {
+    __m256i sad = _mm256_sad_epu8(load_8x4_avx2(p0, pitch0), load_8x4_avx2(p1, pitch1));
+    sad = _mm256_add_epi64(sad, _mm256_sad_epu8(load_8x4_avx2(p0 + 4 * pitch0, pitch0), load_8x4_avx2(p1 + 4 * pitch1, pitch1)));
+    const __m128i s = _mm_add_epi64(_mm256_castsi256_si128(sad), _mm256_extracti128_si256(sad, 1));
+    return _mm_cvtsi128_si32(_mm_add_epi64(s, _mm_unpackhi_epi64(s, s)));
+}
+
+//y行目とy+4行目の差分を16bitで、下位/上位128bitに並べる
+static RGY_FORCEINLINE __m256i load_diff_row_avx2(const uint8_t *p0, const int pitch0, const uint8_t *p1, const int pitch1, const int y) {
+    const __m256i a = _mm256_cvtepu8_epi16(_mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i *)(p0 + y * pitch0)), _mm_loadl_epi64((const __m128i *)(p0 + (y + 4) * pitch0))));
+    const __m256i b = _mm256_cvtepu8_epi16(_mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i *)(p1 + y * pitch1)), _mm_loadl_epi64((const __m128i *)(p1 + (y + 4) * pitch1))));
+    return _mm256_sub_epi16(a, b);
+}
+
+//各128bit内の8要素について、距離stepのバタフライ演算を行う
+//係数の符号は標準の順序と異なるが、絶対値の合計には影響しない
+template<int step>
+static RGY_FORCEINLINE __m256i hadamard_h_avx2(const __m256i v) {
+    __m256i s;
+    if (step == 1) {
+        s = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1)), _MM_SHUFFLE(2, 3, 0, 1));
+    } else if (step == 2) {
+        s = _mm256_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1));
+    } else {
+        s = _mm256_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2));
+    }
+    const __m256i sum = _mm256_add_epi16(v, s);
+    const __m256i diff = _mm256_sub_epi16(s, v);
+    if (step == 1) {
+        return _mm256_blend_epi16(sum, diff, 0xAA);
+    } else if (step == 2) {
+        return _mm256_blend_epi16(sum, diff, 0xCC);
+    }
+    return _mm256_blend_epi32(sum, diff, 0xCC);
+}
+
+// 8bitの差分は6段のバタフライ演算後も16bitに収まる (255 x 64)
+int rgy_satd8x8_avx2(const uint8_t *p0, const int pitch0, const uint8_t *p1, const int pitch1) {
+    const __m256i r0 = load_diff_row_avx2(p0, pitch0, p1, pitch1, 0); // [0 | 4]
+    const __m256i r1 = load_diff_row_avx2(p0, pitch0, p1, pitch1, 1); // [1 | 5]
+    const __m256i r2 = load_diff_row_avx2(p0, pitch0, p1, pitch1, 2); // [2 | 6]
+    const __m256i r3 = load_diff_row_avx2(p0, pitch0, p1, pitch1, 3); // [3 | 7]
+    //縦方向 (行間の距離1, 2)
+    const __m256i a0 = _mm256_add_epi16(r0, r1);
+    const __m256i a1 = _mm256_sub_epi16(r0, r1);
+    const __m256i a2 = _mm256_add_epi16(r2, r3);
+    const __m256i a3 = _mm256_sub_epi16(r2, r3);
+    __m256i b[4];
+    b[0] = _mm256_add_epi16(a0, a2);
+    b[1] = _mm256_add_epi16(a1, a3);
+    b[2] = _mm256_sub_epi16(a0, a2);
+    b[3] = _mm256_sub_epi16(a1, a3);
+    __m256i sum = _mm256_setzero_si256();
+    const __m256i ones = _mm256_set1_epi16(1);
+    for (int i = 0; i < 4; i++) {
+        //縦方向 (行間の距離4 = 上位/下位128bit間)
+        const __m256i swap = _mm256_permute2x128_si256(b[i], b[i], 0x01);
+        __m256i v = _mm256_blend_epi32(_mm256_add_epi16(b[i], swap), _mm256_sub_epi16(swap, b[i]), 0xF0);
+        //横方向
+        v = hadamard_h_avx2<1>(v);
+        v = hadamard_h_avx2<2>(v);
+        v = hadamard_h_avx2<4>(v);
+        sum = _mm256_add_epi32(sum, _mm256_madd_epi16(_mm256_abs_epi16(v), ones));
+    }
+    __m128i s = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(1, 0, 3, 2)));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(s);
+}
+
+#endif //#if defined(_M_IX86) || defined(_M_X64) || defined(__x86_64)
@@ -0,0 +1,255 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2024 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// --------------------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <numeric>
+#include <limits>
+#include <cstring>
+#include "rgy_decimate_analysis.h"
+#include "rgy_filesystem.h"
+
+RGYDecimateAnalysisWriter::RGYDecimateAnalysisWriter() :
+    m_fp(),
+    m_header(),
+    m_frames(0) {
+}
+
+RGYDecimateAnalysisWriter::~RGYDecimateAnalysisWriter() {
+    close();
+}
+
+RGY_ERR RGYDecimateAnalysisWriter::open(const tstring& filename, const RGYDecimateAnalysisHeader& header) {
+    close();
+    m_fp = std::unique_ptr<FILE, fp_deleter>(_tfopen(filename.c_str(), _T("wb")), fp_deleter());
+    if (!m_fp) {
+        return RGY_ERR_FILE_OPEN;
+    }
+    m_header = header;
+    memcpy(m_header.magic, RGY_DECIMATE_ANALYSIS_MAGIC, sizeof(m_header.magic));
+    m_header.version = RGY_DECIMATE_ANALYSIS_VERSION;
+    m_header.headerSize = sizeof(m_header);
+    m_header.frames = 0;
+    m_frames = 0;
+    if (fwrite(&m_header, sizeof(m_header), 1, m_fp.get()) != 1) {
+        m_fp.reset();
+        return RGY_ERR_UNDEFINED_BEHAVIOR;
+    }
+    return RGY_ERR_NONE;
+}
+
+RGY_ERR RGYDecimateAnalysisWriter::write(const RGYDecimateAnalysisFrame& frame) {
+    if (!m_fp) {
+        return RGY_ERR_NOT_INITIALIZED;
+    }
+    if (fwrite(&frame, sizeof(frame), 1, m_fp.get()) != 1) {
+        return RGY_ERR_UNDEFINED_BEHAVIOR;
+    }
+    m_frames++;
+    return RGY_ERR_NONE;
+}
+
+RGY_ERR RGYDecimateAnalysisWriter::close() {
+    if (!m_fp) {
+        return RGY_ERR_NONE;
+    }
+    //最後にフレーム数を書き込む
+    auto err = RGY_ERR_NONE;
+    m_header.frames = m_frames;
+    if (fseek(m_fp.get(), 0, SEEK_SET) != 0
+        || fwrite(&m_header, sizeof(m_header), 1, m_fp.get()) != 1) {
+        err = RGY_ERR_UNDEFINED_BEHAVIOR;
+    }
+    m_fp.reset();
+    return err;
+}
+
+RGY_ERR rgy_decimate_analysis_read(const tstring& filename, RGYDecimateAnalysisHeader *header, std::vector<RGYDecimateAnalysisFrame> *frames) {
+    uint64_t filesize = 0;
+    if (!rgy_get_filesize(filename.c_str(), &filesize)) {
+        return RGY_ERR_FILE_OPEN;
+    }
+    std::unique_ptr<FILE, fp_deleter> fp(_tfopen(filename.c_str(), _T("rb")), fp_deleter());
+    if (!fp) {
+        return RGY_ERR_FILE_OPEN;
+    }
+    RGYDecimateAnalysisHeader head = { 0 };
+    if (fread(&head, sizeof(head), 1, fp.get()) != 1
+        || memcmp(head.magic, RGY_DECIMATE_ANALYSIS_MAGIC, sizeof(head.magic)) != 0
+        || head.version != RGY_DECIMATE_ANALYSIS_VERSION
+        || head.headerSize < sizeof(head)
+        || filesize < head.headerSize) {
+        return RGY_ERR_INVALID_FORMAT;
+    }
+    const uint64_t framesInFile = (filesize - head.headerSize) / sizeof(RGYDecimateAnalysisFrame);
+    if (head.frames == 0 || head.frames > framesInFile) {
+        head.frames = framesInFile;
+    }
+    if (_fseeki64(fp.get(), head.headerSize, SEEK_SET) != 0) {
+        return RGY_ERR_INVALID_FORMAT;
+    }
+    frames->resize((size_t)head.frames);
+    if (head.frames > 0 && fread(frames->data(), sizeof(RGYDecimateAnalysisFrame), frames->size(), fp.get()) != frames->size()) {
+        return RGY_ERR_INVALID_FORMAT;
+    }
+    *header = head;
+    return RGY_ERR_NONE;
+}
+
+// 1cycle内でdropするフレームの位置の組み合わせを列挙する
+static bool decimate_enum_patterns(std::vector<std::vector<int>>& patterns, const int cycle, const int drop, const size_t maxPatterns) {
+    std::vector<int> pos(drop);
+    std::iota(pos.begin(), pos.end(), 0);
+    for (;;) {
+        if (patterns.size() >= maxPatterns) {
+            return false;
+        }
+        patterns.push_back(pos);
+        int i = drop - 1;
+        while (i >= 0 && pos[i] == cycle - drop + i) {
+            i--;
+        }
+        if (i < 0) {
+            break;
+        }
+        pos[i]++;
+        for (int j = i + 1; j < drop; j++) {
+            pos[j] = pos[j - 1] + 1;
+        }
+    }
+    return true;
+}
+
+std::vector<RGYDecimateResult> rgy_decimate_solve(const std::vector<RGYDecimateAnalysisFrame>& frames,
+    const int cycle, const int drop, const int64_t threDuplicate, const int64_t threSceneChange) {
+    const int nframes = (int)frames.size();
+    std::vector<RGYDecimateResult> results(nframes, RGYDecimateResult{ RGY_DECIMATE_RESULT_NONE, 0 });
+    if (nframes == 0 || cycle <= 1 || drop <= 0 || drop >= cycle) {
+        return results;
+    }
+    //dropのコスト、重複の閾値を1として正規化し、大きな差分は打ち切る
+    const double costMax = 4.0;
+    const double thre = (double)std::max<int64_t>(threDuplicate, 1);
+    std::vector<double> cost(nframes);
+    std::vector<bool> sceneChange(nframes);
+    for (int i = 0; i < nframes; i++) {
+        const auto& f = frames[i];
+        sceneChange[i] = (i > 0 && f.diffTotal > threSceneChange);
+        cost[i] = (i == 0 || f.diffMaxBlock == std::numeric_limits<int64_t>::max()) ? costMax : std::min((double)f.diffMaxBlock / thre, costMax);
+        if (sceneChange[i]) {
+            //重複フレームがなければ、シーンチェンジのフレームをdropする
+            cost[i] = std::min(cost[i], 1.0);
+        }
+        if (f.diffMaxBlock < threDuplicate) {
+            results[i].flags |= RGY_DECIMATE_RESULT_DUPLICATE;
+        }
+        if (sceneChange[i]) {
+            results[i].flags |= RGY_DECIMATE_RESULT_SCENE_CHANGE;
+        }
+    }
+    auto setDrop = [&](const int start, const std::vector<int>& pos) {
+        std::vector<int> sorted(pos);
+        std::stable_sort(sorted.begin(), sorted.end(), [&](int a, int b) { return cost[start + a] < cost[start + b]; });
+        for (size_t i = 0; i < sorted.size(); i++) {
+            results[start + sorted[i]].flags |= RGY_DECIMATE_RESULT_DROP;
+            results[start + sorted[i]].order = (uint8_t)std::min<size_t>(i + 1, UINT8_MAX);
+        }
+    };
+    auto selectLowest = [&](const int start, const int count, const int dropCount) {
+        std::vector<int> order(count);
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return cost[start + a] < cost[start + b]; });
+        order.resize(std::min(dropCount, count));
+        std::sort(order.begin(), order.end());
+        return order;
+    };
+
+    const int fullCycles = nframes / cycle;
+    std::vector<std::vector<int>> patterns;
+    const size_t maxDPSize = 16 * 1024 * 1024;
+    const bool useDP = fullCycles > 0
+        && decimate_enum_patterns(patterns, cycle, drop, std::max<size_t>(maxDPSize / fullCycles, 1));
+    if (useDP) {
+        //パターンを変更するコスト (シーンチェンジを含むcycleでは0)
+        const double costChange = 1.0;
+        const int npat = (int)patterns.size();
+        std::vector<double> dpPrev(npat, 0.0), dpCurr(npat);
+        std::vector<int> from((size_t)fullCycles * npat);
+        for (int c = 0; c < fullCycles; c++) {
+            const int start = c * cycle;
+            const bool hasSceneChange = std::any_of(sceneChange.begin() + start, sceneChange.begin() + start + cycle, [](bool b) { return b; });
+            const int bestPrev = (int)(std::min_element(dpPrev.begin(), dpPrev.end()) - dpPrev.begin());
+            for (int p = 0; p < npat; p++) {
+                double patCost = 0.0;
+                for (const auto pos : patterns[p]) {
+                    patCost += cost[start + pos];
+                }
+                const double viaChange = dpPrev[bestPrev] + ((c > 0 && !hasSceneChange) ? costChange : 0.0);
+                if (dpPrev[p] <= viaChange) {
+                    dpCurr[p] = dpPrev[p] + patCost;
+                    from[(size_t)c * npat + p] = p;
+                } else {
+                    dpCurr[p] = viaChange + patCost;
+                    from[(size_t)c * npat + p] = bestPrev;
+                }
+            }
+            std::swap(dpPrev, dpCurr);
+        }
+        int p = (int)(std::min_element(dpPrev.begin(), dpPrev.end()) - dpPrev.begin());
+        for (int c = fullCycles - 1; c >= 0; c--) {
+            setDrop(c * cycle, patterns[p]);
+            p = from[(size_t)c * npat + p];
+        }
+    } else {
+        //組み合わせが多すぎる場合はcycleごとに決める
+        for (int c = 0; c < fullCycles; c++) {
+            setDrop(c * cycle, selectLowest(c * cycle, cycle, drop));
+        }
+    }
+    //最後の半端なcycleは、直前のdropから十分離れている場合のみdropする
+    const int start = fullCycles * cycle;
+    const int remain = nframes - start;
+    if (remain > 0) {
+        int lastDropped = -1;
+        for (int i = start - 1; i >= 0; i--) {
+            if (results[i].flags & RGY_DECIMATE_RESULT_DROP) {
+                lastDropped = i;
+                break;
+            }
+        }
+        int dropCount = 0;
+        for (int idrop = 0; idrop < drop; idrop++) {
+            if (lastDropped + (cycle - idrop) >= nframes) {
+                break;
+            }
+            dropCount++;
+        }
+        if (dropCount > 0) {
+            setDrop(start, selectLowest(start, remain, dropCount));
+        }
+    }
+    return results;
+}
@@ -0,0 +1,103 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2024 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// --------------------------------------------------------------------------------------------
+
+#pragma once
+#ifndef __RGY_DECIMATE_ANALYSIS_H__
+#define __RGY_DECIMATE_ANALYSIS_H__
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+#include <memory>
+#include "rgy_tchar.h"
+#include "rgy_err.h"
+#include "rgy_util.h"
+
+// decimateの解析結果ファイル
+//
+//  [RGYDecimateAnalysisHeader]
+//  [RGYDecimateAnalysisFrame] x frames
+//
+// マルチバイトの値はすべてリトルエンディアン
+static const char RGY_DECIMATE_ANALYSIS_MAGIC[8] = { 'R', 'G', 'Y', 'D', 'E', 'C', 'A', 'N' };
+static const uint32_t RGY_DECIMATE_ANALYSIS_VERSION = 1;
+
+struct RGYDecimateAnalysisHeader {
+    char     magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    int32_t  width;
+    int32_t  height;
+    int32_t  bitDepth;
+    int32_t  blockX;
+    int32_t  blockY;
+    int32_t  chroma;
+    uint64_t frames;  // 0なら書き込みが途中で終了したとして、ファイルサイズから求める
+};
+static_assert(sizeof(RGYDecimateAnalysisHeader) == 48, "unexpected size of RGYDecimateAnalysisHeader");
+
+// 前のフレームとのブロック差分
+struct RGYDecimateAnalysisFrame {
+    int64_t diffTotal;
+    int64_t diffMaxBlock;
+};
+static_assert(sizeof(RGYDecimateAnalysisFrame) == 16, "unexpected size of RGYDecimateAnalysisFrame");
+
+class RGYDecimateAnalysisWriter {
+public:
+    RGYDecimateAnalysisWriter();
+    ~RGYDecimateAnalysisWriter();
+    RGY_ERR open(const tstring& filename, const RGYDecimateAnalysisHeader& header);
+    RGY_ERR write(const RGYDecimateAnalysisFrame& frame);
+    RGY_ERR close();
+    uint64_t frames() const { return m_frames; }
+private:
+    std::unique_ptr<FILE, fp_deleter> m_fp;
+    RGYDecimateAnalysisHeader m_header;
+    uint64_t m_frames;
+};
+
+RGY_ERR rgy_decimate_analysis_read(const tstring& filename, RGYDecimateAnalysisHeader *header, std::vector<RGYDecimateAnalysisFrame> *frames);
+
+enum RGYDecimateResultFlag : uint8_t {
+    RGY_DECIMATE_RESULT_NONE         = 0x00,
+    RGY_DECIMATE_RESULT_DROP         = 0x01,
+    RGY_DECIMATE_RESULT_DUPLICATE    = 0x02,
+    RGY_DECIMATE_RESULT_SCENE_CHANGE = 0x04,
+};
+
+struct RGYDecimateResult {
+    uint8_t flags; // RGYDecimateResultFlag
+    uint8_t order; // cycle内でdropの候補とした順番 (1～), 0なら候補外
+};
+
+// クリップ全体の解析結果から、各cycleでdropするフレームを決める
+// cycleごとのdropの位置(パターン)は、シーンチェンジのない限りなるべく変えないようにする
+std::vector<RGYDecimateResult> rgy_decimate_solve(const std::vector<RGYDecimateAnalysisFrame>& frames,
+    const int cycle, const int drop, const int64_t threDuplicate, const int64_t threSceneChange);
+
+#endif //__RGY_DECIMATE_ANALYSIS_H__
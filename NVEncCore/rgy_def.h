@@ -54,6 +54,7 @@ static const int MAX_SPLIT_CHANNELS = 32;
 static const char *RGY_CHANNEL_AUTO = "RGY_CHANNEL_AUTO";
 static const int RGY_OUTPUT_BUF_MB_DEFAULT = 8;
 static const int RGY_OUTPUT_BUF_MB_MAX = 128;
+static const int RGY_REALTIME_LATENCY_DEFAULT = 1000; //ms
 
 static const TCHAR *RGY_AVCODEC_AUTO = _T("auto");
 static const TCHAR *RGY_AVCODEC_COPY = _T("copy");
@@ -801,6 +802,24 @@ const CX_DESC list_avsync[] = {
     { NULL, 0 }
 };
 
+//リアルタイムモードでの劣化段階 (遅延が大きいときにこの順で適用する)
+enum class RGYRealtimeLevel : int {
+    None = 0,
+    SkipFilter,      //省略可能なフィルタをスキップ
+    ReduceLookahead, //lookaheadを無効化
+    FastPreset,      //高速なプリセットに切り替え
+    DropFrame,       //フレームを間引く
+};
+
+const CX_DESC list_realtime_degrade[] = {
+    { _T("none"),      (int)RGYRealtimeLevel::None            },
+    { _T("filter"),    (int)RGYRealtimeLevel::SkipFilter      },
+    { _T("lookahead"), (int)RGYRealtimeLevel::ReduceLookahead },
+    { _T("preset"),    (int)RGYRealtimeLevel::FastPreset      },
+    { _T("drop"),      (int)RGYRealtimeLevel::DropFrame       },
+    { NULL, 0 }
+};
+
 const CX_DESC list_resampler[] = {
     { _T("swr"),  RGY_RESAMPLER_SWR  },
     { _T("soxr"), RGY_RESAMPLER_SOXR },
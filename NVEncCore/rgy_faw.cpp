@@ -47,7 +47,7 @@ decltype(rgy_memmem_fawstart1_c)* get_memmem_fawstart1_func() {
 
 static const std::array<uint8_t, 2> AACSYNC_BYTES = { 0xff, 0xf0 };
 
-static size_t rgy_find_aacsync_c(const void *data_, const size_t data_size) {
+size_t rgy_find_aacsync_c(const void *data_, const size_t data_size) {
     const uint16_t target = *(const uint16_t *)AACSYNC_BYTES.data();
     const size_t target_size = AACSYNC_BYTES.size();
     const uint8_t *data = (const uint8_t *)data_;
@@ -83,9 +83,23 @@ void rgy_split_audio_16to8x2(uint8_t *dst0, uint8_t *dst1, const short *src, con
     }
 }
 
+decltype(rgy_find_aacsync_c)* get_find_aacsync_func() {
+#if defined(_M_IX86) || defined(_M_X64) || defined(__x86_64)
+    const auto simd = get_availableSIMD();
+#if defined(_M_X64) || defined(__x86_64)
+    if ((simd & RGY_SIMD::AVX512BW) == RGY_SIMD::AVX512BW) return rgy_find_aacsync_avx512bw;
+#endif
+    if ((simd & RGY_SIMD::AVX2) == RGY_SIMD::AVX2) return rgy_find_aacsync_avx2;
+#endif
+    return rgy_find_aacsync_c;
+}
+
 decltype(rgy_convert_audio_16to8)* get_convert_audio_16to8_func() {
 #if defined(_M_IX86) || defined(_M_X64) || defined(__x86_64)
     const auto simd = get_availableSIMD();
+#if defined(_M_X64) || defined(__x86_64)
+    if ((simd & RGY_SIMD::AVX512BW) == RGY_SIMD::AVX512BW) return rgy_convert_audio_16to8_avx512bw;
+#endif
     if ((simd & RGY_SIMD::AVX2) == RGY_SIMD::AVX2) return rgy_convert_audio_16to8_avx2;
 #endif
     return rgy_convert_audio_16to8;
@@ -94,11 +108,25 @@ decltype(rgy_convert_audio_16to8)* get_convert_audio_16to8_func() {
 decltype(rgy_split_audio_16to8x2)* get_split_audio_16to8x2_func() {
 #if defined(_M_IX86) || defined(_M_X64) || defined(__x86_64)
     const auto simd = get_availableSIMD();
+#if defined(_M_X64) || defined(__x86_64)
+    if ((simd & RGY_SIMD::AVX512BW) == RGY_SIMD::AVX512BW) return rgy_split_audio_16to8x2_avx512bw;
+#endif
     if ((simd & RGY_SIMD::AVX2) == RGY_SIMD::AVX2) return rgy_split_audio_16to8x2_avx2;
 #endif
     return rgy_split_audio_16to8x2;
 }
 
+decltype(rgy_faw_checksum_calc_c)* get_faw_checksum_calc_func() {
+#if defined(_M_IX86) || defined(_M_X64) || defined(__x86_64)
+    const auto simd = get_availableSIMD();
+#if defined(_M_X64) || defined(__x86_64)
+    if ((simd & RGY_SIMD::AVX512BW) == RGY_SIMD::AVX512BW) return rgy_faw_checksum_calc_avx512bw;
+#endif
+    if ((simd & RGY_SIMD::AVX2) == RGY_SIMD::AVX2) return rgy_faw_checksum_calc_avx2;
+#endif
+    return rgy_faw_checksum_calc_c;
+}
+
 template<bool upperhalf>
 static uint8_t faw_read_half(const uint16_t v) {
     uint8_t i = (upperhalf) ? (v & 0xff00) >> 8 : (v & 0xff);
@@ -117,22 +145,8 @@ void faw_read(uint8_t *dst, const uint8_t *src, const size_t outlen) {
     }
 }
 
-static uint32_t faw_checksum_calc(const uint8_t *buf, const size_t len) {
-    uint32_t _v4288 = 0;
-    uint32_t _v48 = 0;
-    const size_t fin_mod2 = (len & (~1));
-    for (size_t i = 0; i < fin_mod2; i += 2) {
-        uint32_t _v132 = *(uint16_t *)(buf + i);
-        _v4288 += _v132;
-        _v48 ^= _v132;
-    }
-    if ((len & 1) != 0) {
-        uint32_t _v132 = *(uint8_t *)(buf + len - 1);
-        _v4288 += _v132;
-        _v48 ^= _v132;
-    }
-    uint32_t res = (_v4288 & 0xffff) | ((_v48 & 0xffff) << 16);
-    return res;
+uint32_t rgy_faw_checksum_calc_c(const uint8_t *buf, const size_t len) {
+    return rgy_faw_checksum_fin(0, 0, buf, len, 0);
 }
 
 static uint32_t faw_checksum_read(const uint8_t *buf) {
@@ -206,6 +220,16 @@ void RGYFAWBitstream::setBytePerSample(const int val) {
     bytePerWholeSample = val;
 }
 
+void RGYFAWBitstream::reserve(const size_t size) {
+    if (buffer.size() < size) {
+        if (bufferOffset > 0 && bufferLength > 0) {
+            memmove(buffer.data(), buffer.data() + bufferOffset, bufferLength);
+        }
+        bufferOffset = 0;
+        buffer.resize(size);
+    }
+}
+
 void RGYFAWBitstream::parseAACHeader(const uint8_t *buf) {
     aacHeader.parse(buf);
 }
@@ -237,7 +261,7 @@ void RGYFAWBitstream::addOutputSamples(size_t samples) {
 
 void RGYFAWBitstream::append(const uint8_t *input, const size_t inputLength) {
     if (buffer.size() < bufferLength + inputLength) {
-        buffer.resize(std::max(bufferLength + inputLength, buffer.size() * 2));
+        // 先に詰めてからresizeすることで、拡張時のコピーを必要な範囲に限定する
         if (bufferLength == 0) {
             bufferOffset = 0;
         }
@@ -245,6 +269,7 @@ void RGYFAWBitstream::append(const uint8_t *input, const size_t inputLength) {
             memmove(buffer.data(), buffer.data() + bufferOffset, bufferLength);
             bufferOffset = 0;
         }
+        buffer.resize(std::max(bufferLength + inputLength, buffer.size() * 2));
     } else if (buffer.size() < bufferOffset + bufferLength + inputLength) {
         if (bufferLength == 0) {
             bufferOffset = 0;
@@ -297,7 +322,8 @@ RGYFAWDecoder::RGYFAWDecoder() :
     funcMemMem(get_memmem_func()),
     funcMemMemFAWStart1(get_memmem_fawstart1_func()),
     funcAudio16to8(get_convert_audio_16to8_func()),
-    funcSplitAudio16to8x2(get_split_audio_16to8x2_func()) {
+    funcSplitAudio16to8x2(get_split_audio_16to8x2_func()),
+    funcChecksum(get_faw_checksum_calc_func()) {
 }
 RGYFAWDecoder::~RGYFAWDecoder() {
 
@@ -309,6 +335,11 @@ void RGYFAWDecoder::setWavInfo() {
         bufferHalf0.setBytePerSample(wavheader.number_of_channels * wavheader.bits_per_sample / 16);
         bufferHalf1.setBytePerSample(wavheader.number_of_channels * wavheader.bits_per_sample / 16);
     }
+    // 1秒分程度のバッファをあらかじめ確保し、定常状態での再確保を避ける
+    const size_t bytesPerSec = (size_t)std::max<uint32_t>(wavheader.sample_rate, 48000) * std::max<int>(wavheader.number_of_channels * wavheader.bits_per_sample / 8, 4);
+    bufferIn.reserve(bytesPerSec);
+    bufferHalf0.reserve(bytesPerSec / 2);
+    bufferHalf1.reserve(bytesPerSec / 2);
 }
 
 int RGYFAWDecoder::init(const uint8_t *data) {
@@ -433,7 +464,7 @@ int RGYFAWDecoder::decodeBlock(std::vector<uint8_t>& output, RGYFAWBitstream& in
         return 1;
     }
     const size_t blockSize = posFin - posStart - fawstart1.size() - 4 /*checksum*/;
-    const uint32_t checksumCalc = faw_checksum_calc(input.data() + posStart + fawstart1.size(), blockSize);
+    const uint32_t checksumCalc = funcChecksum(input.data() + posStart + fawstart1.size(), blockSize);
     const uint32_t checksumRead = faw_checksum_read(input.data() + posFin - 4);
     // checksumとフレーム長が一致しない場合、そのデータは破棄
     if (checksumCalc != checksumRead || blockSize != input.aacFrameSize()) {
@@ -457,10 +488,9 @@ int RGYFAWDecoder::decodeBlock(std::vector<uint8_t>& output, RGYFAWBitstream& in
         addSilent(output, input);
     }
 
-    // ブロックを出力に追加
-    const auto orig_size = output.size();
-    output.resize(orig_size + blockSize);
-    memcpy(output.data() + orig_size, input.data() + posStart + fawstart1.size(), blockSize);
+    // ブロックを出力に追加 (outputは呼び出し側で再利用され、容量が足りていれば再確保しない)
+    const auto blockPtr = input.data() + posStart + fawstart1.size();
+    output.insert(output.end(), blockPtr, blockPtr + blockSize);
     //fprintf(stderr, "Set block: %lld: %lld -> %lld\n", posStartSample, input.outputSamples(), input.outputSamples() + AAC_BLOCK_SAMPLES);
 
     input.addOutputSamples(AAC_BLOCK_SAMPLES);
@@ -488,9 +518,7 @@ void RGYFAWDecoder::addSilent(std::vector<uint8_t>& output, RGYFAWBitstream& inp
         dataSize = aac_silent2.size();
         break;
     }
-    const auto orig_size = output.size();
-    output.resize(orig_size + dataSize);
-    memcpy(output.data() + orig_size, ptrSilent, dataSize);
+    output.insert(output.end(), ptrSilent, ptrSilent + dataSize);
     input.addOutputSamples(AAC_BLOCK_SAMPLES);
 }
 
@@ -522,8 +550,10 @@ RGYFAWEncoder::RGYFAWEncoder() :
     delaySamples(0),
     inputAACPosByte(0),
     outputFAWPosByte(0),
+    bytePerWholeSample(0),
     bufferIn(),
-    bufferTmp() {
+    funcFindAACSync(get_find_aacsync_func()),
+    funcChecksum(get_faw_checksum_calc_func()) {
 
 }
 
@@ -534,15 +564,16 @@ RGYFAWEncoder::~RGYFAWEncoder() {
 int RGYFAWEncoder::init(const RGYWAVHeader *data, const RGYFAWMode mode, const int delayMillisec) {
     wavheader = *data;
     fawmode = mode;
-    bufferTmp.setBytePerSample(wavheader.number_of_channels * wavheader.bits_per_sample / 8);
+    bytePerWholeSample = wavheader.number_of_channels * wavheader.bits_per_sample / 8;
     delaySamples = delayMillisec * (int)wavheader.sample_rate / 1000;
-    inputAACPosByte += delaySamples * bufferTmp.bytePerSample();
+    inputAACPosByte += delaySamples * bytePerWholeSample;
+    // AACの入力は高々数百kbpsなので、余裕をもって確保しておく
+    bufferIn.reserve(256 * 1024);
     return 0;
 }
 
 int RGYFAWEncoder::encode(std::vector<uint8_t>& output, const uint8_t *input, const size_t inputLength) {
     output.clear();
-    bufferTmp.clear();
 
     if (fawmode == RGYFAWMode::Unknown) {
         return -1;
@@ -550,7 +581,7 @@ int RGYFAWEncoder::encode(std::vector<uint8_t>& output, const uint8_t *input, co
 
     bufferIn.append(input, inputLength);
 
-    const auto ret = rgy_find_aacsync_c(bufferIn.data(), bufferIn.size());
+    const auto ret = funcFindAACSync(bufferIn.data(), bufferIn.size());
     if (ret == RGY_MEMMEM_NOT_FOUND) {
         return 0;
     }
@@ -567,7 +598,7 @@ int RGYFAWEncoder::encode(std::vector<uint8_t>& output) {
     if (aacBlockSize > bufferIn.size()) {
         return 0;
     }
-    auto ret0 = rgy_find_aacsync_c(bufferIn.data() + aacBlockSize, bufferIn.size() - aacBlockSize);
+    auto ret0 = funcFindAACSync(bufferIn.data() + aacBlockSize, bufferIn.size() - aacBlockSize);
     while (ret0 != RGY_MEMMEM_NOT_FOUND) {
         ret0 += aacBlockSize;
         if (inputAACPosByte < outputFAWPosByte) {
@@ -575,15 +606,13 @@ int RGYFAWEncoder::encode(std::vector<uint8_t>& output) {
         } else {
             if (outputFAWPosByte < inputAACPosByte) {
                 const auto offsetBytes = inputAACPosByte - outputFAWPosByte;
-                const auto origSize = bufferTmp.size();
-                bufferTmp.append(nullptr, (size_t)offsetBytes);
-                memset(bufferTmp.data() + origSize, 0, (size_t)offsetBytes);
+                output.resize(output.size() + (size_t)offsetBytes, 0);
                 outputFAWPosByte = inputAACPosByte;
             }
             // outputWavPosSample == inputAACPosSample
-            encodeBlock(bufferIn.data(), aacBlockSize);
+            encodeBlock(output, bufferIn.data(), aacBlockSize);
         }
-        inputAACPosByte += AAC_BLOCK_SAMPLES * bufferTmp.bytePerSample();
+        inputAACPosByte += AAC_BLOCK_SAMPLES * bytePerWholeSample;
 
         bufferIn.addOffset(ret0);
         if (bufferIn.size() < AAC_HEADER_MIN_SIZE) {
@@ -594,29 +623,21 @@ int RGYFAWEncoder::encode(std::vector<uint8_t>& output) {
         if (aacBlockSize > bufferIn.size()) {
             break;
         }
-        ret0 = rgy_find_aacsync_c(bufferIn.data() + aacBlockSize, bufferIn.size() - aacBlockSize);
+        ret0 = funcFindAACSync(bufferIn.data() + aacBlockSize, bufferIn.size() - aacBlockSize);
     }
-
-    output.resize(bufferTmp.size());
-    memcpy(output.data(), bufferTmp.data(), bufferTmp.size());
-    bufferTmp.clear();
     return 0;
 }
 
-void RGYFAWEncoder::encodeBlock(const uint8_t *data, const size_t dataLength) {
-    const uint32_t checksumCalc = faw_checksum_calc(data, dataLength);
-
-    bufferTmp.append(fawstart1.data(), fawstart1.size());
-    outputFAWPosByte += fawstart1.size();
-
-    bufferTmp.append(data, dataLength);
-    outputFAWPosByte += dataLength;
-
-    bufferTmp.append((const uint8_t *)&checksumCalc, sizeof(checksumCalc));
-    outputFAWPosByte += sizeof(checksumCalc);
+void RGYFAWEncoder::encodeBlock(std::vector<uint8_t>& output, const uint8_t *data, const size_t dataLength) {
+    const uint32_t checksumCalc = funcChecksum(data, dataLength);
+    const auto checksumPtr = (const uint8_t *)&checksumCalc;
 
-    bufferTmp.append(fawfin1.data(), fawfin1.size());
-    outputFAWPosByte += fawfin1.size();
+    // 出力先に直接書き込む
+    output.insert(output.end(), fawstart1.begin(), fawstart1.end());
+    output.insert(output.end(), data, data + dataLength);
+    output.insert(output.end(), checksumPtr, checksumPtr + sizeof(checksumCalc));
+    output.insert(output.end(), fawfin1.begin(), fawfin1.end());
+    outputFAWPosByte += fawstart1.size() + dataLength + sizeof(checksumCalc) + fawfin1.size();
 }
 
 int RGYFAWEncoder::fin(std::vector<uint8_t>& output) {
@@ -630,7 +651,7 @@ int RGYFAWEncoder::fin(std::vector<uint8_t>& output) {
     }
     if (delaySamples < 0) {
         // 負のdelayの場合、wavの長さを合わせるために0で埋める
-        const auto offsetBytes = -1 * delaySamples * bufferTmp.bytePerSample();
+        const auto offsetBytes = -1 * delaySamples * bytePerWholeSample;
         output.resize(output.size() + offsetBytes, 0);
     }
     //最終出力は4byte少ない (先頭に4byte入れたためと思われる)
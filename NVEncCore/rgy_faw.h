@@ -31,6 +31,7 @@
 #include <cstdint>
 #include <array>
 #include <vector>
+#include <cstring>
 #include "rgy_wav_parser.h"
 #include "rgy_memmem.h"
 
@@ -57,9 +58,38 @@ size_t rgy_memmem_fawstart1_avx512bw(const void *data_, const size_t data_size);
 
 void rgy_convert_audio_16to8(uint8_t *dst, const short *src, const size_t n);
 void rgy_convert_audio_16to8_avx2(uint8_t *dst, const short *src, const size_t n);
+void rgy_convert_audio_16to8_avx512bw(uint8_t *dst, const short *src, const size_t n);
 
 void rgy_split_audio_16to8x2(uint8_t *dst0, uint8_t *dst1, const short *src, const size_t n);
 void rgy_split_audio_16to8x2_avx2(uint8_t *dst0, uint8_t *dst1, const short *src, const size_t n);
+void rgy_split_audio_16to8x2_avx512bw(uint8_t *dst0, uint8_t *dst1, const short *src, const size_t n);
+
+// AACのsyncword (0xFFF) の探索
+size_t rgy_find_aacsync_c(const void *data_, const size_t data_size);
+size_t rgy_find_aacsync_avx2(const void *data_, const size_t data_size);
+size_t rgy_find_aacsync_avx512bw(const void *data_, const size_t data_size);
+
+// FAWのブロックのchecksum (下位16bit: 16bit単位の和, 上位16bit: 16bit単位のxor)
+uint32_t rgy_faw_checksum_calc_c(const uint8_t *buf, const size_t len);
+uint32_t rgy_faw_checksum_calc_avx2(const uint8_t *buf, const size_t len);
+uint32_t rgy_faw_checksum_calc_avx512bw(const uint8_t *buf, const size_t len);
+
+// 奇数長の場合の最後の1byteを含めたchecksumの仕上げ
+static inline uint32_t rgy_faw_checksum_fin(uint32_t sum, uint32_t xorv, const uint8_t *buf, const size_t len, size_t pos) {
+    const size_t fin_mod2 = (len & (~1));
+    for (; pos < fin_mod2; pos += 2) {
+        uint16_t v;
+        memcpy(&v, buf + pos, sizeof(v));
+        sum += v;
+        xorv ^= v;
+    }
+    if ((len & 1) != 0) {
+        const uint32_t v = buf[len - 1];
+        sum += v;
+        xorv ^= v;
+    }
+    return (sum & 0xffff) | ((xorv & 0xffff) << 16);
+}
 
 using RGYFAWDecoderOutput = std::array<std::vector<uint8_t>, 2>;
 
@@ -92,6 +122,8 @@ struct RGYAACHeader {
     int sampleRateIdxToRate(const uint32_t idx);
 };
 
+// 入力の蓄積用のバッファ
+// 先頭から消費し、末尾に追加する。確保した領域は再利用し、定常状態では再確保しない
 class RGYFAWBitstream {
 private:
     std::vector<uint8_t> buffer;
@@ -108,6 +140,7 @@ public:
     ~RGYFAWBitstream();
 
     void setBytePerSample(const int val);
+    void reserve(const size_t size);
 
     uint8_t *data() { return buffer.data() + bufferOffset; }
     const uint8_t *data() const { return buffer.data() + bufferOffset; }
@@ -144,6 +177,7 @@ private:
     decltype(rgy_memmem_fawstart1_c)* funcMemMemFAWStart1;
     decltype(rgy_convert_audio_16to8)* funcAudio16to8;
     decltype(rgy_split_audio_16to8x2)* funcSplitAudio16to8x2;
+    decltype(rgy_faw_checksum_calc_c)* funcChecksum;
 public:
     RGYFAWDecoder();
     ~RGYFAWDecoder();
@@ -172,8 +206,11 @@ private:
 
     int64_t inputAACPosByte;
     int64_t outputFAWPosByte;
+    int bytePerWholeSample;
     RGYFAWBitstream bufferIn;
-    RGYFAWBitstream bufferTmp;
+
+    decltype(rgy_find_aacsync_c)* funcFindAACSync;
+    decltype(rgy_faw_checksum_calc_c)* funcChecksum;
 public:
     RGYFAWEncoder();
     ~RGYFAWEncoder();
@@ -183,7 +220,7 @@ public:
     int fin(std::vector<uint8_t>& output);
 private:
     int encode(std::vector<uint8_t>& output);
-    void encodeBlock(const uint8_t *data, const size_t dataLength);
+    void encodeBlock(std::vector<uint8_t>& output, const uint8_t *data, const size_t dataLength);
 };
 
 #endif //__RGY_FAW_H__
\ No newline at end of file
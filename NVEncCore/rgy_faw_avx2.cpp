@@ -71,7 +71,7 @@ void rgy_convert_audio_16to8_avx2(uint8_t *dst, const short *src, const size_t n
 
 void rgy_split_audio_16to8x2_avx2(uint8_t *dst0, uint8_t *dst1, const short *src, const size_t n) {
     const short *sh = src;
-    const short *sh_fin = src + (n & ~15);
+    const short *sh_fin = src + (n & ~31);
     __m256i y0, y1, y2, y3;
     __m256i yMask = _mm256_srli_epi16(_mm256_cmpeq_epi8(_mm256_setzero_si256(), _mm256_setzero_si256()), 8);
     __m256i yConst = _mm256_set1_epi8(-128);
@@ -89,10 +89,58 @@ void rgy_split_audio_16to8x2_avx2(uint8_t *dst0, uint8_t *dst1, const short *src
         _mm256_storeu_si256((__m256i*)dst0, y0);
         _mm256_storeu_si256((__m256i*)dst1, y2);
     }
-    sh_fin = sh + (n & 15);
+    sh_fin = src + n;
     for (; sh < sh_fin; sh++, dst0++, dst1++) {
         *dst0 = (*sh >> 8) + 128;
         *dst1 = (*sh & 0xff) + 128;
     }
 }
+
+size_t rgy_find_aacsync_avx2(const void *data_, const size_t data_size) {
+    const uint8_t *data = (const uint8_t *)data_;
+    if (data_size < 2) {
+        return RGY_MEMMEM_NOT_FOUND;
+    }
+    const __m256i yFF = _mm256_set1_epi8(-1);
+    const __m256i yF0 = _mm256_set1_epi8((char)0xf0);
+    size_t i = 0;
+    // 1byte目が0xFF、2byte目の上位4bitが0xFのところを探す
+    for (; i + 32 + 1 <= data_size; i += 32) {
+        const __m256i y0 = _mm256_loadu_si256((const __m256i *)(data + i));
+        const __m256i y1 = _mm256_loadu_si256((const __m256i *)(data + i + 1));
+        const __m256i yCmp0 = _mm256_cmpeq_epi8(y0, yFF);
+        const __m256i yCmp1 = _mm256_cmpeq_epi8(_mm256_and_si256(y1, yF0), yF0);
+        const uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_and_si256(yCmp0, yCmp1));
+        if (mask != 0) {
+            return i + CTZ32(mask);
+        }
+    }
+    for (; i + 1 < data_size; i++) {
+        if (data[i] == 0xff && (data[i + 1] & 0xf0) == 0xf0) {
+            return i;
+        }
+    }
+    return RGY_MEMMEM_NOT_FOUND;
+}
+
+uint32_t rgy_faw_checksum_calc_avx2(const uint8_t *buf, const size_t len) {
+    __m256i ySum = _mm256_setzero_si256();
+    __m256i yXor = _mm256_setzero_si256();
+    size_t i = 0;
+    // 和は16bitで切り捨てられるので、16bit単位の加算で問題ない
+    for (; i + 32 <= len; i += 32) {
+        const __m256i y0 = _mm256_loadu_si256((const __m256i *)(buf + i));
+        ySum = _mm256_add_epi16(ySum, y0);
+        yXor = _mm256_xor_si256(yXor, y0);
+    }
+    alignas(32) uint16_t sum16[16], xor16[16];
+    _mm256_store_si256((__m256i *)sum16, ySum);
+    _mm256_store_si256((__m256i *)xor16, yXor);
+    uint32_t sum = 0, xorv = 0;
+    for (int j = 0; j < 16; j++) {
+        sum += sum16[j];
+        xorv ^= xor16[j];
+    }
+    return rgy_faw_checksum_fin(sum, xorv, buf, len, i);
+}
 #endif
@@ -31,4 +31,84 @@
 size_t rgy_memmem_fawstart1_avx512bw(const void *data_, const size_t data_size) {
     return rgy_memmem_avx512_imp(data_, data_size, fawstart1.data(), fawstart1.size());
 }
+
+void rgy_convert_audio_16to8_avx512bw(uint8_t *dst, const short *src, const size_t n) {
+    const short *sh = src;
+    const short *sh_fin = src + (n & ~63);
+    const __m512i zConst = _mm512_set1_epi16(128);
+    for (; sh < sh_fin; sh += 64, dst += 64) {
+        __m512i z0 = _mm512_loadu_si512((const __m512i *)(sh + 0));
+        __m512i z1 = _mm512_loadu_si512((const __m512i *)(sh + 32));
+        z0 = _mm512_add_epi16(_mm512_srai_epi16(z0, 8), zConst);
+        z1 = _mm512_add_epi16(_mm512_srai_epi16(z1, 8), zConst);
+        _mm256_storeu_si256((__m256i *)(dst +  0), _mm512_cvtepi16_epi8(z0));
+        _mm256_storeu_si256((__m256i *)(dst + 32), _mm512_cvtepi16_epi8(z1));
+    }
+    sh_fin = src + n;
+    for (; sh < sh_fin; sh++, dst++) {
+        *dst = (*sh >> 8) + 128;
+    }
+}
+
+void rgy_split_audio_16to8x2_avx512bw(uint8_t *dst0, uint8_t *dst1, const short *src, const size_t n) {
+    const short *sh = src;
+    const short *sh_fin = src + (n & ~31);
+    const __m256i yConst = _mm256_set1_epi8(-128);
+    for (; sh < sh_fin; sh += 32, dst0 += 32, dst1 += 32) {
+        const __m512i z0 = _mm512_loadu_si512((const __m512i *)sh);
+        const __m256i yUpper = _mm512_cvtepi16_epi8(_mm512_srli_epi16(z0, 8));
+        const __m256i yLower = _mm512_cvtepi16_epi8(z0); // 下位8bitへの切り捨て
+        _mm256_storeu_si256((__m256i *)dst0, _mm256_add_epi8(yUpper, yConst));
+        _mm256_storeu_si256((__m256i *)dst1, _mm256_add_epi8(yLower, yConst));
+    }
+    sh_fin = src + n;
+    for (; sh < sh_fin; sh++, dst0++, dst1++) {
+        *dst0 = (*sh >> 8) + 128;
+        *dst1 = (*sh & 0xff) + 128;
+    }
+}
+
+size_t rgy_find_aacsync_avx512bw(const void *data_, const size_t data_size) {
+    const uint8_t *data = (const uint8_t *)data_;
+    if (data_size < 2) {
+        return RGY_MEMMEM_NOT_FOUND;
+    }
+    const __m512i zFF = _mm512_set1_epi8(-1);
+    const __m512i zF0 = _mm512_set1_epi8((char)0xf0);
+    size_t i = 0;
+    for (; i + 64 + 1 <= data_size; i += 64) {
+        const __m512i z0 = _mm512_loadu_si512((const __m512i *)(data + i));
+        const __m512i z1 = _mm512_loadu_si512((const __m512i *)(data + i + 1));
+        const __mmask64 mask = _mm512_cmpeq_epi8_mask(z0, zFF) & _mm512_cmpeq_epi8_mask(_mm512_and_si512(z1, zF0), zF0);
+        if (mask != 0) {
+            return i + CTZ64(mask);
+        }
+    }
+    for (; i + 1 < data_size; i++) {
+        if (data[i] == 0xff && (data[i + 1] & 0xf0) == 0xf0) {
+            return i;
+        }
+    }
+    return RGY_MEMMEM_NOT_FOUND;
+}
+
+uint32_t rgy_faw_checksum_calc_avx512bw(const uint8_t *buf, const size_t len) {
+    __m512i zSum = _mm512_setzero_si512();
+    __m512i zXor = _mm512_setzero_si512();
+    size_t i = 0;
+    for (; i + 64 <= len; i += 64) {
+        const __m512i z0 = _mm512_loadu_si512((const __m512i *)(buf + i));
+        zSum = _mm512_add_epi16(zSum, z0);
+        zXor = _mm512_xor_si512(zXor, z0);
+    }
+    alignas(64) uint16_t sum16[32], xor16[32];
+    _mm512_store_si512((__m512i *)sum16, zSum);
+    _mm512_store_si512((__m512i *)xor16, zXor);
+    uint32_t sum = 0, xorv = 0;
+    for (int j = 0; j < 32; j++) {
+        sum += sum16[j];
+        xorv ^= xor16[j];
+    }
+    return rgy_faw_checksum_fin(sum, xorv, buf, len, i);
+}
 #endif
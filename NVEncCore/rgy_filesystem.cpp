@@ -27,6 +27,10 @@
 
 #include <filesystem>
 #include <cstdint>
+#if !(defined(_WIN32) || defined(_WIN64))
+#include <fcntl.h>
+#include <sys/mman.h>
+#endif //#if !(defined(_WIN32) || defined(_WIN64))
 #include "rgy_util.h"
 #include "rgy_env.h"
 #include "rgy_codepage.h"
@@ -208,14 +212,15 @@ bool rgy_get_filesize(const char *filepath, uint64_t *filesize) {
     struct stat stat;
     FILE *fp = fopen(filepath, "rb");
     if (fp == NULL || fstat(fileno(fp), &stat)) {
+        if (fp) {
+            fclose(fp);
+        }
         *filesize = 0;
-        return 1;
-    }
-    if (fp) {
-        fclose(fp);
+        return false;
     }
+    fclose(fp);
     *filesize = stat.st_size;
-    return 0;
+    return true;
 #endif //#if defined(_WIN32) || defined(_WIN64)
 }
 
@@ -309,6 +314,26 @@ tstring getExeDir() {
     return PathRemoveFileSpecFixed(getExePath()).second;
 }
 
+tstring rgy_get_user_cache_dir(const tstring& appName) {
+    std::filesystem::path dir;
+#if defined(_WIN32) || defined(_WIN64)
+    const TCHAR *appdata = _tgetenv(_T("LOCALAPPDATA"));
+    if (appdata == nullptr || appdata[0] == _T('\0')) {
+        return tstring();
+    }
+    dir = std::filesystem::path(appdata) / appName;
+#else
+    if (const char *xdg = getenv("XDG_CACHE_HOME"); xdg != nullptr && xdg[0] != '\0') {
+        dir = std::filesystem::path(xdg) / tolowercase(appName);
+    } else if (const char *home = getenv("HOME"); home != nullptr && home[0] != '\0') {
+        dir = std::filesystem::path(home) / ".cache" / tolowercase(appName);
+    } else {
+        return tstring();
+    }
+#endif
+    return dir.native();
+}
+
 bool rgy_path_is_same(const TCHAR *path1, const TCHAR *path2) {
     try {
         const auto p1 = std::filesystem::path(path1);
@@ -324,6 +349,132 @@ bool rgy_path_is_same(const tstring& path1, const tstring& path2) {
     return rgy_path_is_same(path1.c_str(), path2.c_str());
 }
 
+int rgy_pipe_expand(int fd, size_t targetSize, int *originalSize) {
+#if defined(F_SETPIPE_SZ) && defined(F_GETPIPE_SZ)
+    const int currentSize = fcntl(fd, F_GETPIPE_SZ);
+    if (originalSize) {
+        *originalSize = currentSize;
+    }
+    if (currentSize < 0) {
+        return -1;
+    }
+    int maxSize = 1024 * 1024;
+    if (FILE *fp = fopen("/proc/sys/fs/pipe-max-size", "r"); fp != nullptr) {
+        int value = 0;
+        if (fscanf(fp, "%d", &value) == 1 && value > 0) {
+            maxSize = value;
+        }
+        fclose(fp);
+    }
+    //拡大できない場合は半分ずつ小さくして再試行する
+    for (int size = (int)std::min<size_t>(maxSize, std::max<size_t>(targetSize, currentSize));
+        size > currentSize; size >>= 1) {
+        if (fcntl(fd, F_SETPIPE_SZ, size) >= 0) {
+            break;
+        }
+    }
+    return std::max(fcntl(fd, F_GETPIPE_SZ), currentSize);
+#else
+    UNREFERENCED_PARAMETER(fd);
+    UNREFERENCED_PARAMETER(targetSize);
+    if (originalSize) {
+        *originalSize = -1;
+    }
+    return -1;
+#endif
+}
+
+bool rgy_get_filetime(const TCHAR *filepath, int64_t *filetime) {
+    std::error_code ec;
+    const auto t = std::filesystem::last_write_time(std::filesystem::path(filepath), ec);
+    if (ec) {
+        *filetime = 0;
+        return false;
+    }
+    *filetime = (int64_t)t.time_since_epoch().count();
+    return true;
+}
+
+#if defined(_WIN32) || defined(_WIN64)
+RGYMappedFile::RGYMappedFile() : m_file(INVALID_HANDLE_VALUE), m_mapping(nullptr), m_ptr(nullptr), m_size(0) {}
+#else
+RGYMappedFile::RGYMappedFile() : m_fd(-1), m_ptr(nullptr), m_size(0) {}
+#endif
+
+RGYMappedFile::~RGYMappedFile() {
+    close();
+}
+
+bool RGYMappedFile::open(const TCHAR *filepath) {
+    close();
+#if defined(_WIN32) || defined(_WIN64)
+    m_file = CreateFile(filepath, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (m_file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    LARGE_INTEGER filesize = { 0 };
+    if (!GetFileSizeEx(m_file, &filesize) || filesize.QuadPart == 0) {
+        close();
+        return false;
+    }
+    m_mapping = CreateFileMapping(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (m_mapping == nullptr) {
+        close();
+        return false;
+    }
+    m_ptr = (const uint8_t *)MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+    if (m_ptr == nullptr) {
+        close();
+        return false;
+    }
+    m_size = (uint64_t)filesize.QuadPart;
+#else
+    m_fd = ::open(filepath, O_RDONLY);
+    if (m_fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(m_fd, &st) != 0 || st.st_size == 0) {
+        close();
+        return false;
+    }
+    void *ptr = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, m_fd, 0);
+    if (ptr == MAP_FAILED) {
+        close();
+        return false;
+    }
+    m_ptr = (const uint8_t *)ptr;
+    m_size = (uint64_t)st.st_size;
+#endif
+    return true;
+}
+
+void RGYMappedFile::close() {
+#if defined(_WIN32) || defined(_WIN64)
+    if (m_ptr) {
+        UnmapViewOfFile(m_ptr);
+    }
+    if (m_mapping) {
+        CloseHandle(m_mapping);
+        m_mapping = nullptr;
+    }
+    if (m_file != INVALID_HANDLE_VALUE) {
+        CloseHandle(m_file);
+        m_file = INVALID_HANDLE_VALUE;
+    }
+#else
+    if (m_ptr) {
+        munmap((void *)m_ptr, (size_t)m_size);
+    }
+    if (m_fd >= 0) {
+        ::close(m_fd);
+        m_fd = -1;
+    }
+#endif
+    m_ptr = nullptr;
+    m_size = 0;
+}
+
 #if defined(_WIN32) || defined(_WIN64)
 std::vector<std::basic_string<TCHAR>> createProcessOpenedFileList(const std::vector<size_t>& list_pid) {
     const auto list_handle = createProcessHandleList(list_pid, L"File");
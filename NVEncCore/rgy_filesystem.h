@@ -48,6 +48,9 @@ tstring getModulePath(void *module);
 #endif //#if defined(_WIN32) || defined(_WIN64)
 tstring getExePath();
 tstring getExeDir();
+//ユーザーごとのキャッシュ用フォルダ (%LOCALAPPDATA%\<appName>, $XDG_CACHE_HOME/<appname>, ~/.cache/<appname>)
+//取得できなければ空文字列を返す (フォルダの作成はしない)
+tstring rgy_get_user_cache_dir(const tstring& appName);
 std::vector<tstring> get_file_list_with_filter(const tstring& dir, const tstring& filter_filename);
 
 std::string GetFullPathFrom(const char *path, const char *baseDir = nullptr);
@@ -74,6 +77,36 @@ std::wstring rgy_get_extension(const std::wstring& filename);
 bool rgy_path_is_same(const TCHAR *path1, const TCHAR *path2);
 bool rgy_path_is_same(const tstring& path1, const tstring& path2);
 
+//パイプのバッファをtargetSizeまで拡大する (Linuxのみ、非特権ユーザーはpipe-max-sizeまで)
+//fdがパイプでなければ-1、パイプなら拡大後のサイズを返す (originalSizeには拡大前のサイズを返す)
+int rgy_pipe_expand(int fd, size_t targetSize, int *originalSize = nullptr);
+
+//ファイルの最終更新時刻を取得する (比較用、単位は実装依存)
+bool rgy_get_filetime(const TCHAR *filepath, int64_t *filetime);
+
+//読み取り専用でファイルをメモリにマップする
+class RGYMappedFile {
+public:
+    RGYMappedFile();
+    ~RGYMappedFile();
+    bool open(const TCHAR *filepath);
+    void close();
+    const uint8_t *data() const { return m_ptr; }
+    uint64_t size() const { return m_size; }
+    bool is_open() const { return m_ptr != nullptr; }
+private:
+    RGYMappedFile(const RGYMappedFile&) = delete;
+    RGYMappedFile& operator=(const RGYMappedFile&) = delete;
+#if defined(_WIN32) || defined(_WIN64)
+    void *m_file;
+    void *m_mapping;
+#else
+    int m_fd;
+#endif
+    const uint8_t *m_ptr;
+    uint64_t m_size;
+};
+
 #if defined(_WIN32) || defined(_WIN64)
 std::vector<std::basic_string<TCHAR>> createProcessOpenedFileList(const std::vector<size_t>& list_pid);
 #endif //#if defined(_WIN32) || defined(_WIN64)
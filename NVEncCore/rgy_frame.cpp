@@ -114,15 +114,15 @@ RGY_ERR RGYFrameDataQP::transferToGPU(cudaStream_t stream) {
 #endif //#if ENABLE_VPP_SMOOTH_QP_FRAME
 
 
-RGYFrameDataMetadata::RGYFrameDataMetadata() : m_timestamp(-1), m_data() { m_dataType = RGY_FRAME_DATA_METADATA; };
+RGYFrameDataMetadata::RGYFrameDataMetadata() : m_timestamp(-1), m_data(std::make_shared<std::vector<uint8_t>>()) { m_dataType = RGY_FRAME_DATA_METADATA; };
 
 RGYFrameDataMetadata::RGYFrameDataMetadata(const uint8_t *data, size_t size, int64_t timestamp) {
     m_dataType = RGY_FRAME_DATA_METADATA;
     m_timestamp = timestamp;
-    m_data = make_vector(data, size);
+    m_data = std::make_shared<std::vector<uint8_t>>(make_vector(data, size));
 }
 
-RGYFrameDataMetadata::~RGYFrameDataMetadata() { m_data.clear(); }
+RGYFrameDataMetadata::~RGYFrameDataMetadata() { m_data.reset(); }
 
 #if !CLFILTERS_AUF
 RGYFrameDataHDR10plus::RGYFrameDataHDR10plus() : RGYFrameDataMetadata() { m_dataType = RGY_FRAME_DATA_HDR10PLUS; };
@@ -142,11 +142,11 @@ std::vector<uint8_t> RGYFrameDataHDR10plus::gen_nal() const {
     u16 |= (NALU_HEVC_PREFIX_SEI << 9) | 1;
     add_u16(buf, u16);
     buf.push_back(USER_DATA_REGISTERED_ITU_T_T35);
-    auto datasize = m_data.size();
+    auto datasize = m_data->size();
     for (; datasize > 0xff; datasize -= 0xff)
         buf.push_back((uint8_t)0xff);
     buf.push_back((uint8_t)datasize);
-    vector_cat(buf, m_data);
+    vector_cat(buf, *m_data);
     to_nal(buf);
 
     std::vector<uint8_t> nal_hdr10plus;
@@ -158,7 +158,11 @@ std::vector<uint8_t> RGYFrameDataHDR10plus::gen_nal() const {
 }
 
 std::vector<uint8_t> RGYFrameDataHDR10plus::gen_obu() const {
-    return gen_av1_obu_metadata(AV1_METADATA_TYPE_ITUT_T35, m_data);
+    return gen_av1_obu_metadata(AV1_METADATA_TYPE_ITUT_T35, *m_data);
+}
+
+RGYFrameDataMetadata *RGYFrameDataHDR10plus::clone() const {
+    return new RGYFrameDataHDR10plus(*this);
 }
 
 RGYFrameDataDOVIRpu::RGYFrameDataDOVIRpu() : RGYFrameDataMetadata() { m_dataType = RGY_FRAME_DATA_DOVIRPU; };
@@ -168,13 +172,31 @@ RGYFrameDataDOVIRpu::RGYFrameDataDOVIRpu(const uint8_t *data, size_t size, int64
 RGYFrameDataDOVIRpu::~RGYFrameDataDOVIRpu() { }
 
 std::vector<uint8_t> RGYFrameDataDOVIRpu::gen_nal() const {
-    return m_data;
+    return *m_data;
 }
 std::vector<uint8_t> RGYFrameDataDOVIRpu::gen_obu() const {
-    return gen_av1_obu_metadata(AV1_METADATA_TYPE_ITUT_T35, m_data);
+    return gen_av1_obu_metadata(AV1_METADATA_TYPE_ITUT_T35, *m_data);
+}
+
+RGYFrameDataMetadata *RGYFrameDataDOVIRpu::clone() const {
+    return new RGYFrameDataDOVIRpu(*this);
 }
 #endif
 
+RGYFrameDataHostRef::RGYFrameDataHostRef(const RGYFrameInfo& frame, std::shared_ptr<void> ref) :
+    m_frame(frame), m_ref(ref) {
+    m_dataType = RGY_FRAME_DATA_HOSTREF;
+    m_frame.dataList.clear();
+};
+
+RGYFrameDataHostRef::~RGYFrameDataHostRef() { }
+
+RGYFrameDataScene::RGYFrameDataScene(std::shared_future<RGYSceneInfo> result) :
+    m_result(result) {
+    m_dataType = RGY_FRAME_DATA_SCENE;
+};
+
+RGYFrameDataScene::~RGYFrameDataScene() { }
 
 RGYSysFrame::RGYSysFrame() : frame() {}
 RGYSysFrame::RGYSysFrame(const RGYFrameInfo& frame_) : frame(frame_) {}
@@ -31,6 +31,7 @@
 
 #include <memory>
 #include <array>
+#include <future>
 #include "rgy_version.h"
 #include "rgy_err.h"
 #include "convert_csp.h"
@@ -45,6 +46,8 @@ enum RGYFrameDataType {
     RGY_FRAME_DATA_METADATA,
     RGY_FRAME_DATA_HDR10PLUS,
     RGY_FRAME_DATA_DOVIRPU,
+    RGY_FRAME_DATA_HOSTREF,
+    RGY_FRAME_DATA_SCENE,
 
     RGY_FRAME_DATA_MAX,
 };
@@ -92,11 +95,12 @@ public:
 
     virtual std::vector<uint8_t> gen_nal() const = 0;
     virtual std::vector<uint8_t> gen_obu() const = 0;
-    const std::vector<uint8_t>& getData() const { return m_data; }
+    virtual RGYFrameDataMetadata *clone() const = 0;
+    const std::vector<uint8_t>& getData() const { return *m_data; }
     int64_t timestamp() const { return m_timestamp; }
 protected:
     int64_t m_timestamp;
-    std::vector<uint8_t> m_data;
+    std::shared_ptr<const std::vector<uint8_t>> m_data; // コピー時はデータ本体を共有する
 };
 
 class RGYFrameDataHDR10plus : public RGYFrameDataMetadata {
@@ -106,6 +110,7 @@ public:
     virtual ~RGYFrameDataHDR10plus();
     virtual std::vector<uint8_t> gen_nal() const override;
     virtual std::vector<uint8_t> gen_obu() const override;
+    virtual RGYFrameDataMetadata *clone() const override;
 };
 
 class RGYFrameDataDOVIRpu : public RGYFrameDataMetadata {
@@ -115,6 +120,51 @@ public:
     virtual ~RGYFrameDataDOVIRpu();
     virtual std::vector<uint8_t> gen_nal() const override;
     virtual std::vector<uint8_t> gen_obu() const override;
+    virtual RGYFrameDataMetadata *clone() const override;
+};
+
+// 入力側のバッファを直接参照するフレーム
+// 入力モジュールでのコピーを省略し、このフレームから直接GPUへ転送する
+class RGYFrameDataHostRef : public RGYFrameData {
+public:
+    RGYFrameDataHostRef(const RGYFrameInfo& frame, std::shared_ptr<void> ref);
+    virtual ~RGYFrameDataHostRef();
+    const RGYFrameInfo& frame() const { return m_frame; }
+    std::shared_ptr<void> ref() const { return m_ref; }
+protected:
+    RGYFrameInfo m_frame; // 各プレーンへのポインタとpitch
+    std::shared_ptr<void> m_ref; // 転送が終了するまで保持し、解放時に入力側のバッファを返却する
+};
+
+enum RGYSceneFlag : uint32_t {
+    RGY_SCENE_NONE     = 0x00,
+    RGY_SCENE_CHANGE   = 0x01, // 前のフレームからシーンが切り替わった
+    RGY_SCENE_FADE_IN  = 0x02, // 明るくなるフェードの途中
+    RGY_SCENE_FADE_OUT = 0x04, // 暗くなるフェードの途中
+    RGY_SCENE_FIRST    = 0x08, // 前のフレームがない
+};
+
+// シーンチェンジ/フェードの判定結果 (値は縮小した8bitの輝度で計算したもの)
+struct RGYSceneInfo {
+    int frame;       // 入力フレーム番号
+    uint32_t flags;  // RGYSceneFlag
+    float mean;      // 輝度の平均
+    float mad;       // 前のフレームとの差の絶対値の平均
+    float madComp;   // 輝度の平均の変化を補正した差の絶対値の平均
+    float histDiff;  // ヒストグラムの差 (0 - 1)
+    float score;     // シーンチェンジの判定値 (0 - 100)
+};
+
+// RGYSceneChangeDetectorの判定結果
+// 判定は別スレッドで行うので、取り出す際に終わっていなければ待機する
+class RGYFrameDataScene : public RGYFrameData {
+public:
+    RGYFrameDataScene(std::shared_future<RGYSceneInfo> result);
+    virtual ~RGYFrameDataScene();
+    const RGYSceneInfo& info() const { return m_result.get(); }
+    bool sceneChange() const { return (info().flags & RGY_SCENE_CHANGE) != 0; }
+protected:
+    std::shared_future<RGYSceneInfo> m_result;
 };
 
 struct RGYFrame {
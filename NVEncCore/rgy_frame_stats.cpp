@@ -0,0 +1,399 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2024 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// --------------------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <numeric>
+#include <cmath>
+#include <cstring>
+#include <cstdarg>
+#include "rgy_frame_stats.h"
+#include "rgy_osdep.h"
+#include "rgy_filesystem.h"
+
+static const size_t FRAME_STATS_TIMING_MAX = 4096; // 出力されなかったフレームの情報が溜まり続けないように
+static const size_t FRAME_STATS_WRITE_BATCH = 256;
+
+RGYFrameStatsWriter::RGYFrameStatsWriter() :
+    m_fp(),
+    m_filename(),
+    m_log(),
+    m_mtxTiming(),
+    m_timing(),
+    m_frameOut(0),
+    m_mtxQueue(),
+    m_cvQueue(),
+    m_queue(),
+    m_fin(false),
+    m_thread() {
+}
+
+RGYFrameStatsWriter::~RGYFrameStatsWriter() {
+    close();
+}
+
+void RGYFrameStatsWriter::AddMessage(RGYLogLevel log_level, const TCHAR *format, ...) {
+    if (m_log == nullptr || log_level < m_log->getLogLevel(RGY_LOGT_OUT)) {
+        return;
+    }
+    va_list args;
+    va_start(args, format);
+    int len = _vsctprintf(format, args) + 1; // _vscprintf doesn't count terminating '\0'
+    vector<TCHAR> buffer(len, 0);
+    _vstprintf_s(buffer.data(), len, format, args);
+    va_end(args);
+    m_log->write(log_level, RGY_LOGT_OUT, (_T("framestats: ") + tstring(buffer.data())).c_str());
+}
+
+RGY_ERR RGYFrameStatsWriter::init(const tstring& filename, const rgy_rational<int>& timebase, const rgy_rational<int>& fps, std::shared_ptr<RGYLog> log) {
+    close();
+    m_log = log;
+    m_filename = filename;
+    FILE *fp = nullptr;
+    if (_tfopen_s(&fp, filename.c_str(), _T("wb")) != 0 || fp == nullptr) {
+        AddMessage(RGY_LOG_ERROR, _T("failed to open \"%s\".\n"), filename.c_str());
+        return RGY_ERR_FILE_OPEN;
+    }
+    m_fp.reset(fp);
+
+    RGYFrameStatsHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, RGY_FRAME_STATS_MAGIC, sizeof(header.magic));
+    header.version = RGY_FRAME_STATS_VERSION;
+    header.headerSize = sizeof(RGYFrameStatsHeader);
+    header.recordSize = sizeof(RGYFrameStatsRecord);
+    header.timebaseNum = timebase.n();
+    header.timebaseDen = timebase.d();
+    header.fpsNum = fps.n();
+    header.fpsDen = fps.d();
+    if (fwrite(&header, 1, sizeof(header), m_fp.get()) != sizeof(header)) {
+        AddMessage(RGY_LOG_ERROR, _T("failed to write header to \"%s\".\n"), filename.c_str());
+        m_fp.reset();
+        return RGY_ERR_UNKNOWN;
+    }
+    m_fin = false;
+    m_frameOut = 0;
+    m_queue.reserve(FRAME_STATS_WRITE_BATCH * 2);
+    m_thread = std::thread(&RGYFrameStatsWriter::threadWrite, this);
+    AddMessage(RGY_LOG_DEBUG, _T("writing per-frame stats to \"%s\".\n"), filename.c_str());
+    return RGY_ERR_NONE;
+}
+
+void RGYFrameStatsWriter::frameIn(int64_t pts, int64_t inputPts) {
+    if (!m_fp) return;
+    std::lock_guard<std::mutex> lock(m_mtxTiming);
+    if (m_timing.size() >= FRAME_STATS_TIMING_MAX) {
+        m_timing.erase(m_timing.begin());
+    }
+    FrameTiming timing;
+    timing.inputPts = inputPts;
+    timing.in = std::chrono::high_resolution_clock::now();
+    timing.submit = timing.in;
+    timing.submitted = false;
+    m_timing[pts] = timing;
+}
+
+void RGYFrameStatsWriter::frameSubmit(int64_t pts) {
+    if (!m_fp) return;
+    const auto now = std::chrono::high_resolution_clock::now();
+    std::lock_guard<std::mutex> lock(m_mtxTiming);
+    auto it = m_timing.find(pts);
+    if (it == m_timing.end()) {
+        //フィルタでptsが変わった場合など、入力時の情報がない
+        if (m_timing.size() >= FRAME_STATS_TIMING_MAX) {
+            m_timing.erase(m_timing.begin());
+        }
+        FrameTiming timing;
+        timing.inputPts = RGY_FRAME_STATS_NO_PTS;
+        timing.in = now;
+        timing.submit = now;
+        timing.submitted = true;
+        m_timing[pts] = timing;
+        return;
+    }
+    it->second.submit = now;
+    it->second.submitted = true;
+}
+
+void RGYFrameStatsWriter::frameOut(int64_t pts, int64_t dts, RGY_FRAMETYPE frameType, uint32_t size, uint32_t avgQP) {
+    if (!m_fp) return;
+    const auto now = std::chrono::high_resolution_clock::now();
+    RGYFrameStatsRecord record;
+    memset(&record, 0, sizeof(record));
+    record.type = (uint32_t)RGYFrameStatsRecordType::Frame;
+    record.index = m_frameOut++;
+    record.inputPts = RGY_FRAME_STATS_NO_PTS;
+    record.pts = pts;
+    record.dts = dts;
+    record.frameType = (uint32_t)frameType;
+    record.size = size;
+    record.avgQP = (float)avgQP;
+    record.filterLatency = -1.0f;
+    record.encodeLatency = -1.0f;
+    record.ssim = -1.0f;
+    record.psnr = -1.0f;
+    {
+        std::lock_guard<std::mutex> lock(m_mtxTiming);
+        auto it = m_timing.find(pts);
+        if (it != m_timing.end()) {
+            const auto& timing = it->second;
+            record.inputPts = timing.inputPts;
+            if (timing.submitted) {
+                if (timing.inputPts != RGY_FRAME_STATS_NO_PTS) {
+                    record.filterLatency = (float)std::chrono::duration<double, std::milli>(timing.submit - timing.in).count();
+                }
+                record.encodeLatency = (float)std::chrono::duration<double, std::milli>(now - timing.submit).count();
+            }
+            m_timing.erase(it);
+        }
+    }
+    push(record);
+}
+
+void RGYFrameStatsWriter::frameQuality(int index, double ssim, double psnr) {
+    if (!m_fp) return;
+    RGYFrameStatsRecord record;
+    memset(&record, 0, sizeof(record));
+    record.type = (uint32_t)RGYFrameStatsRecordType::Quality;
+    record.index = (uint32_t)index;
+    record.inputPts = RGY_FRAME_STATS_NO_PTS;
+    record.pts = RGY_FRAME_STATS_NO_PTS;
+    record.dts = RGY_FRAME_STATS_NO_PTS;
+    record.filterLatency = -1.0f;
+    record.encodeLatency = -1.0f;
+    record.ssim = (float)ssim;
+    record.psnr = (float)psnr;
+    push(record);
+}
+
+void RGYFrameStatsWriter::push(const RGYFrameStatsRecord& record) {
+    bool notify = false;
+    {
+        std::lock_guard<std::mutex> lock(m_mtxQueue);
+        m_queue.push_back(record);
+        notify = m_queue.size() >= FRAME_STATS_WRITE_BATCH;
+    }
+    if (notify) {
+        m_cvQueue.notify_one();
+    }
+}
+
+void RGYFrameStatsWriter::threadWrite() {
+    std::vector<RGYFrameStatsRecord> records;
+    records.reserve(FRAME_STATS_WRITE_BATCH * 2);
+    bool fin = false;
+    while (!fin) {
+        {
+            std::unique_lock<std::mutex> lock(m_mtxQueue);
+            m_cvQueue.wait_for(lock, std::chrono::milliseconds(500), [&]() { return m_fin || m_queue.size() >= FRAME_STATS_WRITE_BATCH; });
+            fin = m_fin;
+            std::swap(records, m_queue);
+        }
+        if (records.size() > 0) {
+            if (fwrite(records.data(), sizeof(records[0]), records.size(), m_fp.get()) != records.size()) {
+                AddMessage(RGY_LOG_ERROR, _T("failed to write to \"%s\".\n"), m_filename.c_str());
+            }
+            records.clear();
+        }
+    }
+}
+
+void RGYFrameStatsWriter::close() {
+    if (m_thread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(m_mtxQueue);
+            m_fin = true;
+        }
+        m_cvQueue.notify_one();
+        m_thread.join();
+    }
+    m_fp.reset();
+    m_timing.clear();
+    m_queue.clear();
+    m_log.reset();
+}
+
+template<typename T>
+static double percentile(const std::vector<T>& sorted, double p) {
+    if (sorted.size() == 0) return 0.0;
+    const size_t idx = std::min(sorted.size() - 1, (size_t)(p * 0.01 * (sorted.size() - 1) + 0.5));
+    return (double)sorted[idx];
+}
+
+static tstring frame_stats_latency_str(const TCHAR *name, std::vector<float>& values) {
+    if (values.size() == 0) {
+        return strsprintf(_T("%-14s -\n"), name);
+    }
+    std::sort(values.begin(), values.end());
+    const double avg = std::accumulate(values.begin(), values.end(), 0.0) / values.size();
+    return strsprintf(_T("%-14s avg %8.2f, p50 %8.2f, p90 %8.2f, p99 %8.2f, max %8.2f ms\n"), name,
+        avg, percentile(values, 50.0), percentile(values, 90.0), percentile(values, 99.0), (double)values.back());
+}
+
+int rgy_frame_stats_summary(const tstring& filename, FILE *fpOut) {
+    RGYMappedFile file;
+    if (!file.open(filename.c_str())) {
+        _ftprintf(stderr, _T("Failed to open \"%s\".\n"), filename.c_str());
+        return 1;
+    }
+    RGYFrameStatsHeader header;
+    if (file.size() < sizeof(header)) {
+        _ftprintf(stderr, _T("Invalid frame stats file \"%s\".\n"), filename.c_str());
+        return 1;
+    }
+    memcpy(&header, file.data(), sizeof(header));
+    if (memcmp(header.magic, RGY_FRAME_STATS_MAGIC, sizeof(header.magic)) != 0
+        || header.version > RGY_FRAME_STATS_VERSION
+        || header.headerSize < sizeof(header)
+        || header.recordSize < sizeof(RGYFrameStatsRecord)
+        || header.timebaseNum <= 0 || header.timebaseDen <= 0) {
+        _ftprintf(stderr, _T("Invalid frame stats file \"%s\".\n"), filename.c_str());
+        return 1;
+    }
+    const size_t recordCount = (size_t)((file.size() - header.headerSize) / header.recordSize);
+    std::vector<RGYFrameStatsRecord> frames;
+    std::map<uint32_t, std::pair<float, float>> quality;
+    frames.reserve(recordCount);
+    for (size_t i = 0; i < recordCount; i++) {
+        RGYFrameStatsRecord record;
+        memcpy(&record, file.data() + header.headerSize + i * header.recordSize, sizeof(record));
+        if (record.type == (uint32_t)RGYFrameStatsRecordType::Frame) {
+            frames.push_back(record);
+        } else if (record.type == (uint32_t)RGYFrameStatsRecordType::Quality) {
+            quality[record.index] = std::make_pair(record.ssim, record.psnr);
+        }
+    }
+    if (frames.size() == 0) {
+        _ftprintf(fpOut, _T("no frames found in \"%s\".\n"), filename.c_str());
+        return 0;
+    }
+    //表示順に並べ替え
+    std::sort(frames.begin(), frames.end(), [](const RGYFrameStatsRecord& a, const RGYFrameStatsRecord& b) { return a.pts < b.pts; });
+    const double timebase = header.timebaseNum / (double)header.timebaseDen;
+    const double fps = (header.fpsNum > 0 && header.fpsDen > 0) ? header.fpsNum / (double)header.fpsDen : 0.0;
+    const double frameDuration = (fps > 0.0) ? 1.0 / fps : 0.0;
+    const double duration = (frames.back().pts - frames.front().pts) * timebase + frameDuration;
+    const uint64_t totalBytes = std::accumulate(frames.begin(), frames.end(), (uint64_t)0, [](uint64_t sum, const RGYFrameStatsRecord& r) { return sum + r.size; });
+
+    tstring str;
+    str += strsprintf(_T("file           %s\n"), filename.c_str());
+    str += strsprintf(_T("frames         %zu, %.3f sec"), frames.size(), duration);
+    if (fps > 0.0) {
+        str += strsprintf(_T(" (%d/%d fps)"), header.fpsNum, header.fpsDen);
+    }
+    str += _T("\n");
+    if (duration > 0.0) {
+        str += strsprintf(_T("avg bitrate    %.2f kbps\n"), totalBytes * 8.0 / duration * 0.001);
+    }
+
+    //ピクチャタイプごとの集計
+    static const std::array<std::pair<RGY_FRAMETYPE, const TCHAR *>, 3> picTypes = {
+        std::make_pair(RGY_FRAMETYPE_I, _T("I")), std::make_pair(RGY_FRAMETYPE_P, _T("P")), std::make_pair(RGY_FRAMETYPE_B, _T("B"))
+    };
+    for (const auto& picType : picTypes) {
+        uint64_t count = 0, bytes = 0, maxBytes = 0;
+        double qpSum = 0.0;
+        for (const auto& r : frames) {
+            //IDRはIとして集計
+            const bool match = (picType.first == RGY_FRAMETYPE_I) ? (r.frameType & (RGY_FRAMETYPE_I | RGY_FRAMETYPE_IDR)) != 0 : (r.frameType & picType.first) != 0;
+            if (match) {
+                count++;
+                bytes += r.size;
+                maxBytes = std::max<uint64_t>(maxBytes, r.size);
+                qpSum += r.avgQP;
+            }
+        }
+        if (count > 0) {
+            str += strsprintf(_T("frame type %s   %6llu, avg %10.1f bytes, max %10llu bytes, avgQP %5.2f\n"),
+                picType.second, count, bytes / (double)count, maxBytes, qpSum / count);
+        }
+    }
+
+    //一定時間の窓でのビットレート
+    for (const int windowMs : { 1000, 5000 }) {
+        const int64_t window = (int64_t)(windowMs * 0.001 / timebase + 0.5);
+        if (window <= 0 || duration * 1000.0 < windowMs) continue;
+        double minKbps = std::numeric_limits<double>::max(), maxKbps = 0.0;
+        int64_t maxAt = 0;
+        uint64_t windowBytes = 0;
+        for (size_t head = 0, tail = 0; head < frames.size(); head++) {
+            windowBytes += frames[head].size;
+            while (frames[head].pts - frames[tail].pts >= window) {
+                windowBytes -= frames[tail].size;
+                tail++;
+            }
+            if (frames[head].pts - frames.front().pts + (int64_t)(frameDuration / timebase) < window) {
+                continue; //窓が埋まるまでは評価しない
+            }
+            const double kbps = windowBytes * 8.0 / (windowMs * 0.001) * 0.001;
+            minKbps = std::min(minKbps, kbps);
+            if (kbps > maxKbps) {
+                maxKbps = kbps;
+                maxAt = frames[tail].pts - frames.front().pts;
+            }
+        }
+        if (maxKbps > 0.0) {
+            str += strsprintf(_T("bitrate %5.1fs  min %10.2f, max %10.2f kbps (max at %.3f sec)\n"),
+                windowMs * 0.001, minKbps, maxKbps, maxAt * timebase);
+        }
+    }
+
+    //遅延
+    std::vector<float> filterLatency, encodeLatency, totalLatency;
+    for (const auto& r : frames) {
+        if (r.filterLatency >= 0.0f) filterLatency.push_back(r.filterLatency);
+        if (r.encodeLatency >= 0.0f) encodeLatency.push_back(r.encodeLatency);
+        if (r.filterLatency >= 0.0f && r.encodeLatency >= 0.0f) totalLatency.push_back(r.filterLatency + r.encodeLatency);
+    }
+    str += frame_stats_latency_str(_T("filter latency"), filterLatency);
+    str += frame_stats_latency_str(_T("encode latency"), encodeLatency);
+    str += frame_stats_latency_str(_T("total latency"), totalLatency);
+
+    //品質
+    if (quality.size() > 0) {
+        double ssimSum = 0.0, psnrSum = 0.0, ssimMin = 1.0, psnrMin = std::numeric_limits<double>::max();
+        int ssimCount = 0, psnrCount = 0;
+        uint32_t ssimMinIdx = 0, psnrMinIdx = 0;
+        for (const auto& [idx, q] : quality) {
+            if (q.first >= 0.0f) {
+                ssimSum += q.first; ssimCount++;
+                if (q.first < ssimMin) { ssimMin = q.first; ssimMinIdx = idx; }
+            }
+            if (q.second >= 0.0f) {
+                psnrSum += q.second; psnrCount++;
+                if (q.second < psnrMin) { psnrMin = q.second; psnrMinIdx = idx; }
+            }
+        }
+        if (ssimCount > 0) {
+            str += strsprintf(_T("SSIM           avg %.6f, min %.6f (frame %u)\n"), ssimSum / ssimCount, ssimMin, ssimMinIdx);
+        }
+        if (psnrCount > 0) {
+            str += strsprintf(_T("PSNR           avg %.4f, min %.4f dB (frame %u)\n"), psnrSum / psnrCount, psnrMin, psnrMinIdx);
+        }
+    }
+    _ftprintf(fpOut, _T("%s"), str.c_str());
+    return 0;
+}
@@ -0,0 +1,138 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2024 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// --------------------------------------------------------------------------------------------
+
+#pragma once
+#ifndef __RGY_FRAME_STATS_H__
+#define __RGY_FRAME_STATS_H__
+
+#include <cstdint>
+#include <cstdio>
+#include <limits>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include "rgy_tchar.h"
+#include "rgy_err.h"
+#include "rgy_def.h"
+#include "rgy_util.h"
+#include "rgy_log.h"
+
+// フレームごとの統計情報ファイル (--frame-stats)
+//
+//  [RGYFrameStatsHeader]
+//  [RGYFrameStatsRecord] x N (出力順、品質の評価結果は計算され次第追記される)
+//
+// マルチバイトの値はすべてリトルエンディアン
+static const char RGY_FRAME_STATS_MAGIC[8] = { 'R', 'G', 'Y', 'F', 'S', 'T', 'A', 'T' };
+static const uint32_t RGY_FRAME_STATS_VERSION = 1;
+static const TCHAR *RGY_FRAME_STATS_EXT = _T(".framestats");
+static const int64_t RGY_FRAME_STATS_NO_PTS = std::numeric_limits<int64_t>::min();
+
+enum class RGYFrameStatsRecordType : uint32_t {
+    Frame   = 0, // エンコード済みフレーム (出力順)
+    Quality = 1, // SSIM/PSNR (表示順)
+};
+
+struct RGYFrameStatsHeader {
+    char     magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    uint32_t recordSize;
+    int32_t  timebaseNum; // pts/dtsのtimebase
+    int32_t  timebaseDen;
+    int32_t  fpsNum;
+    int32_t  fpsDen;
+    uint32_t reserved[7];
+};
+static_assert(sizeof(RGYFrameStatsHeader) == 64, "unexpected size of RGYFrameStatsHeader");
+
+struct RGYFrameStatsRecord {
+    uint32_t type;          // RGYFrameStatsRecordType
+    uint32_t index;         // Frame: 出力順の番号, Quality: 表示順の番号
+    int64_t  inputPts;      // 入力フレームのpts (timebaseは出力と同じ、不明な場合はRGY_FRAME_STATS_NO_PTS)
+    int64_t  pts;
+    int64_t  dts;
+    uint32_t frameType;     // RGY_FRAMETYPE
+    uint32_t size;          // byte
+    float    avgQP;
+    float    filterLatency; // ms, 入力からエンコーダへの投入まで (不明な場合は負)
+    float    encodeLatency; // ms, エンコーダへの投入から出力まで (不明な場合は負)
+    float    ssim;          // Qualityのみ (不明な場合は負)
+    float    psnr;          // Qualityのみ, dB (不明な場合は負)
+    uint32_t reserved;
+};
+static_assert(sizeof(RGYFrameStatsRecord) == 64, "unexpected size of RGYFrameStatsRecord");
+
+// エンコード中のフレームごとの情報を集め、別スレッドでファイルに書き出す
+class RGYFrameStatsWriter {
+public:
+    RGYFrameStatsWriter();
+    ~RGYFrameStatsWriter();
+
+    RGY_ERR init(const tstring& filename, const rgy_rational<int>& timebase, const rgy_rational<int>& fps, std::shared_ptr<RGYLog> log);
+    // 入力フレーム (check_pts後のptsと、元の入力のpts)
+    void frameIn(int64_t pts, int64_t inputPts);
+    // エンコーダへの投入
+    void frameSubmit(int64_t pts);
+    // エンコーダからの出力
+    void frameOut(int64_t pts, int64_t dts, RGY_FRAMETYPE frameType, uint32_t size, uint32_t avgQP);
+    // SSIM/PSNRの計算結果 (別スレッドから呼ばれる)
+    void frameQuality(int index, double ssim, double psnr);
+    void close();
+    bool enabled() const { return m_fp != nullptr; }
+protected:
+    struct FrameTiming {
+        int64_t inputPts;
+        std::chrono::high_resolution_clock::time_point in;
+        std::chrono::high_resolution_clock::time_point submit;
+        bool submitted;
+    };
+    void push(const RGYFrameStatsRecord& record);
+    void threadWrite();
+    void AddMessage(RGYLogLevel log_level, const TCHAR *format, ...);
+
+    std::unique_ptr<FILE, fp_deleter> m_fp;
+    tstring m_filename;
+    std::shared_ptr<RGYLog> m_log;
+    std::mutex m_mtxTiming;
+    std::map<int64_t, FrameTiming> m_timing; // pts -> 時刻
+    uint32_t m_frameOut;
+    std::mutex m_mtxQueue;
+    std::condition_variable m_cvQueue;
+    std::vector<RGYFrameStatsRecord> m_queue;
+    bool m_fin;
+    std::thread m_thread;
+};
+
+// --frame-stats-summary: 統計情報ファイルを読み込み、ビットレートと遅延の集計を表示する
+int rgy_frame_stats_summary(const tstring& filename, FILE *fpOut);
+
+#endif //__RGY_FRAME_STATS_H__
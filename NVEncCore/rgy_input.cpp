@@ -330,6 +330,35 @@ void RGYInput::CreateInputInfo(const TCHAR *inputTypeName, const TCHAR *inputCSp
     m_inputInfo = ss.str();
 }
 
+bool RGYInput::directPlanesAvailable() const {
+#if ENCODER_NVENC
+    //cropとインタレ保持の場合は、CPU側で処理する
+    if (cropEnabled(m_inputVideoInfo.crop)
+        || (m_inputVideoInfo.picstruct & RGY_PICSTRUCT_INTERLACED) != 0) {
+        return false;
+    }
+    static const auto directCspList = make_array<std::pair<RGY_CSP, RGY_CSP>>(
+        std::make_pair(RGY_CSP_NV12,       RGY_CSP_NV12),
+        std::make_pair(RGY_CSP_P010,       RGY_CSP_P010),
+        std::make_pair(RGY_CSP_YV12,       RGY_CSP_NV12),
+        std::make_pair(RGY_CSP_YV12_09,    RGY_CSP_P010),
+        std::make_pair(RGY_CSP_YV12_10,    RGY_CSP_P010),
+        std::make_pair(RGY_CSP_YV12_12,    RGY_CSP_P010),
+        std::make_pair(RGY_CSP_YV12_14,    RGY_CSP_P010),
+        std::make_pair(RGY_CSP_YV12_16,    RGY_CSP_P010),
+        std::make_pair(RGY_CSP_YUV444,     RGY_CSP_YUV444),
+        std::make_pair(RGY_CSP_YUV444_09,  RGY_CSP_YUV444_16),
+        std::make_pair(RGY_CSP_YUV444_10,  RGY_CSP_YUV444_16),
+        std::make_pair(RGY_CSP_YUV444_12,  RGY_CSP_YUV444_16),
+        std::make_pair(RGY_CSP_YUV444_14,  RGY_CSP_YUV444_16),
+        std::make_pair(RGY_CSP_YUV444_16,  RGY_CSP_YUV444_16)
+    );
+    return std::find(directCspList.begin(), directCspList.end(), std::make_pair(m_inputCsp, m_inputVideoInfo.csp)) != directCspList.end();
+#else
+    return false;
+#endif
+}
+
 #include "rgy_avutil.h"
 #include "rgy_input_raw.h"
 #include "rgy_input_avi.h"
@@ -550,6 +579,9 @@ RGY_ERR initReaders(
 
     RGYInputPrmRaw inputPrmRaw(inputPrm);
     inputPrmRaw.inputCsp = inputCspOfRawReader;
+    inputPrmRaw.threadInput = ctrl->threadInput;
+    inputPrmRaw.threadParamInput = ctrl->threadParams.get(RGYThreadType::INPUT);
+    inputPrmRaw.lowLatency = ctrl->lowLatency;
 #if ENABLE_AVISYNTH_READER
     RGYInputAvsPrm inputPrmAvs(inputPrm);
 #endif
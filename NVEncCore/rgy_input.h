@@ -304,6 +304,10 @@ protected:
     virtual void CreateInputInfo(const TCHAR *inputTypeName, const TCHAR *inputCSpName, const TCHAR *outputCSpName, const TCHAR *convSIMD, const VideoInfo *inputPrm);
     virtual RGY_ERR LoadNextFrameInternal(RGYFrame *surface) = 0;
 
+    //CPUで変換せずに、入力側のバッファの各プレーンをそのままGPUに転送できるか
+    //(CPUでの変換後と同じ色空間にGPUで変換できる場合)
+    bool directPlanesAvailable() const;
+
     //trim listを参照し、動画の最大フレームインデックスを取得する
     int getVideoTrimMaxFramIdx() {
         if (m_trimParam.list.size() == 0) {
@@ -35,7 +35,7 @@
 #include <climits>
 #include <limits>
 #include <memory>
-#include <cppcodec/base64_rfc4648.hpp>
+#include <chrono>
 #include "rgy_thread.h"
 #include "rgy_input_avcodec.h"
 #include "rgy_bitstream.h"
@@ -126,6 +126,7 @@ AVDemuxVideo::AVDemuxVideo() :
     extradataSize(0),
     nAvgFramerate({ 0 }),
     findPosLastIdx(0),
+    findPosConsumer(-1),
     nSampleGetCount(0),
     decRFFStatus(0),
     pParserCtx(nullptr),
@@ -136,6 +137,9 @@ AVDemuxVideo::AVDemuxVideo() :
     hevcNaluLengthSize(0),
     hdr10plusMetadataCopy(false),
     doviRpuCopy(false),
+#if !AV_CODEC_COPY_OPAQUE_AVAIL
+    frameDataPending(),
+#endif //#if !AV_CODEC_COPY_OPAQUE_AVAIL
     simdCsp(RGY_SIMD::SIMD_ALL),
     masteringDisplay(std::unique_ptr<AVMasteringDisplayMetadata, RGYAVDeleter<AVMasteringDisplayMetadata>>(nullptr, RGYAVDeleter<AVMasteringDisplayMetadata>(av_freep))),
     contentLight(std::unique_ptr<AVContentLightMetadata, RGYAVDeleter<AVContentLightMetadata>>(nullptr, RGYAVDeleter<AVContentLightMetadata>(av_freep))),
@@ -200,10 +204,19 @@ void AVDemuxVideo::close(RGYLog *log) {
         CLOSE_LOG_DEBUG(_T("Freed extra data.\n"));
         extradata = nullptr;
     }
+#if !AV_CODEC_COPY_OPAQUE_AVAIL
+    frameDataPending.clear();
+#endif //#if !AV_CODEC_COPY_OPAQUE_AVAIL
     index = -1;
 }
 
 void AVDemuxThread::close(RGYLog *log) {
+    if (thDecode.joinable()) {
+        CLOSE_LOG_DEBUG(_T("Closing Decode thread.\n"));
+        thDecode.join();
+        CLOSE_LOG_DEBUG(_T("Closed Decode thread.\n"));
+    }
+    decodeFin = false;
     if (thInput.joinable()) {
         CLOSE_LOG_DEBUG(_T("Closing Input thread.\n"));
         thInput.join();
@@ -282,6 +295,7 @@ void RGYInputAvcodec::CloseThread() {
     m_Demux.thread.bAbortInput = true;
     m_Demux.qVideoPkt.set_capacity(SIZE_MAX);
     m_Demux.qVideoPkt.set_keep_length(0);
+    m_Demux.qVideoFrame.set_capacity(SIZE_MAX);
     m_Demux.thread.close(m_printMes.get());
 }
 
@@ -326,7 +340,16 @@ void RGYInputAvcodec::Close() {
     AddMessage(RGY_LOG_DEBUG, _T("Closing...\n"));
     //リソースの解放
     CloseThread();
+    m_Demux.qVideoFrame.close([](AVFrame **frame) { av_frame_free(frame); });
     m_Demux.qVideoPkt.close([](AVPacket **pkt) { av_packet_free(pkt); });
+    if (const auto& stats = m_Demux.video.decodeStats; stats.decodeFrames > 0) {
+        const double decodeMs = stats.decodeTime * 1e-3 / stats.decodeFrames;
+        const double convertMs = stats.convertTime * 1e-3 / stats.decodeFrames;
+        AddMessage(RGY_LOG_DEBUG, _T("sw decode: %d frames, threads %d, decode %.2f ms/frame (%.1f fps), convert %.2f ms/frame (%.1f fps).\n"),
+            (int)stats.decodeFrames, stats.decodeThreads,
+            decodeMs, (decodeMs > 0.0) ? 1000.0 / decodeMs : 0.0,
+            convertMs, (convertMs > 0.0) ? 1000.0 / convertMs : 0.0);
+    }
     for (uint32_t i = 0; i < m_Demux.qStreamPktL1.size(); i++) {
         av_packet_free(&m_Demux.qStreamPktL1[i]);
     }
@@ -1246,63 +1269,40 @@ RGY_ERR RGYInputAvcodec::parseHDR10plus(AVPacket *pkt) {
                 size += *ptr++;
             }
             size += *ptr++;
-            //AVDictionaryに格納するため、base64 encodeを行う
-            const auto encoded = cppcodec::base64_rfc4648::encode(ptr, size);
-            AVDictionary *frameDict = nullptr;
-            int ret = av_dict_set(&frameDict, HDR10PLUS_METADATA_KEY, encoded.c_str(), 0);
+            //文字列に変換せず、そのままパケットに付加する
+            int ret = rgy_av_add_frame_data(&pkt->opaque_ref, std::make_shared<RGYFrameDataHDR10plus>(ptr, size, pkt->pts));
             if (ret < 0) {
-                AddMessage(RGY_LOG_ERROR, _T("Failed to set dictionary for key=%s\n"), char_to_tstring(HDR10PLUS_METADATA_KEY).c_str());
-                return RGY_ERR_UNKNOWN;
+                AddMessage(RGY_LOG_ERROR, _T("Failed to add hdr10plus metadata to packet: %s.\n"), qsv_av_err2str(ret).c_str());
+                return RGY_ERR_MEMORY_ALLOC;
             }
-            std::remove_pointer<RGYArgN<1U, decltype(av_packet_pack_dictionary)>::type>::type frameDictSize = 0;
-            uint8_t *frameDictData = av_packet_pack_dictionary(frameDict, &frameDictSize);
-            if (frameDictData == nullptr) {
-                AddMessage(RGY_LOG_ERROR, _T("Failed to pack dictionary for key=%s\n"), char_to_tstring(HDR10PLUS_METADATA_KEY).c_str());
-                return RGY_ERR_UNKNOWN;
-            }
-            ret = av_packet_add_side_data(pkt, AV_PKT_DATA_STRINGS_METADATA, frameDictData, frameDictSize);
-            if (ret < 0) {
-                AddMessage(RGY_LOG_ERROR, _T("Failed to add side packet hdr10plus metadata.\n"), char_to_tstring(HDR10PLUS_METADATA_KEY).c_str());
-                return RGY_ERR_UNKNOWN;
-            }
-            av_dict_free(&frameDict);
-            AddMessage(RGY_LOG_TRACE, _T("Added hdr10plus metadata to packet timestamp %lld (%s), size %d, encoded size %d\n"), pkt->pts,
-                getTimestampString(pkt->pts, m_Demux.format.formatCtx->streams[pkt->stream_index]->time_base).c_str(), size, (int)encoded.size());
+            AddMessage(RGY_LOG_TRACE, _T("Added hdr10plus metadata to packet timestamp %lld (%s), size %d\n"), pkt->pts,
+                getTimestampString(pkt->pts, m_Demux.format.formatCtx->streams[pkt->stream_index]->time_base).c_str(), (int)size);
         }
     }
     return RGY_ERR_NONE;
 }
 
-RGYFrameDataHDR10plus *RGYInputAvcodec::getHDR10plusMetaData(const AVFrame *frame) {
-    auto ptrDictMetadata = av_dict_get(frame->metadata, HDR10PLUS_METADATA_KEY, nullptr, 0);
-    if (ptrDictMetadata) {
-        const auto ptrDictMetadataValLen = strlen(ptrDictMetadata->value);
-        const auto decoded = cppcodec::base64_rfc4648::decode(ptrDictMetadata->value, ptrDictMetadataValLen);
-        AddMessage(RGY_LOG_TRACE, _T("Got hdr10plus metadata to packet timestamp %lld (%s), size %d, decoded size %d\n"), frame->pts,
-            getTimestampString(frame->pts, m_Demux.video.stream->time_base).c_str(), ptrDictMetadataValLen, (int)decoded.size());
-        return new RGYFrameDataHDR10plus(decoded.data(), decoded.size(), frame->pts);
+std::vector<std::shared_ptr<RGYFrameData>> RGYInputAvcodec::getFrameData(const AVPacket *pkt) {
+    std::vector<std::shared_ptr<RGYFrameData>> list;
+    if (auto frameData = rgy_av_get_frame_data(pkt->opaque_ref); frameData) {
+        list = frameData->list;
+        AddMessage(RGY_LOG_TRACE, _T("Got %d frame data from packet timestamp %lld (%s)\n"), (int)list.size(), pkt->pts,
+            getTimestampString(pkt->pts, m_Demux.video.stream->time_base).c_str());
     }
-    return nullptr;
+    return list;
 }
 
-RGYFrameDataHDR10plus *RGYInputAvcodec::getHDR10plusMetaData(const AVPacket *pkt) {
-    std::remove_pointer<RGYArgN<2U, decltype(av_packet_get_side_data)>::type>::type side_data_size = 0;
-    auto side_data = av_packet_get_side_data(pkt, AV_PKT_DATA_STRINGS_METADATA, &side_data_size);
-    if (side_data) {
-        AVDictionary *dict = nullptr;
-        auto ret = av_packet_unpack_dictionary(side_data, side_data_size, &dict);
-        if (ret == 0) {
-            const auto ptrDictMetadata = av_dict_get(dict, HDR10PLUS_METADATA_KEY, nullptr, 0);
-            if (ptrDictMetadata) {
-                const auto ptrDictMetadataValLen = strlen(ptrDictMetadata->value);
-                const auto decoded = cppcodec::base64_rfc4648::decode(ptrDictMetadata->value, ptrDictMetadataValLen);
-                AddMessage(RGY_LOG_TRACE, _T("Got hdr10plus metadata to packet timestamp %lld (%s), size %d, decoded size %d\n"), pkt->pts,
-                    getTimestampString(pkt->pts, m_Demux.video.stream->time_base).c_str(), ptrDictMetadataValLen, (int)decoded.size());
-                return new RGYFrameDataHDR10plus(decoded.data(), decoded.size(), pkt->pts);
-            }
-        }
+std::vector<std::shared_ptr<RGYFrameData>> RGYInputAvcodec::getFrameData(const AVFrame *frame) {
+    std::vector<std::shared_ptr<RGYFrameData>> list;
+    //パケットのopaque_refはAV_CODEC_FLAG_COPY_OPAQUE (あるいはdecodeFrame) によりフレームに引き継がれる
+    if (auto frameData = rgy_av_get_frame_data(frame->opaque_ref); frameData) {
+        list = frameData->list;
     }
-    return nullptr;
+    if (list.size() > 0) {
+        AddMessage(RGY_LOG_TRACE, _T("Got %d frame data from frame timestamp %lld (%s)\n"), (int)list.size(), frame->pts,
+            getTimestampString(frame->pts, m_Demux.video.stream->time_base).c_str());
+    }
+    return list;
 }
 
 RGYFrameDataDOVIRpu *RGYInputAvcodec::getDoviRpu(const AVFrame *frame) {
@@ -1748,9 +1748,12 @@ RGY_ERR RGYInputAvcodec::Init(const TCHAR *strFileName, VideoInfo *inputInfo, co
 
         m_Demux.video.decRFFStatus = 0;
         m_Demux.video.findPosLastIdx = 0;
+        m_Demux.video.findPosConsumer = m_Demux.frames.addConsumer();
         m_logFramePosList.clear();
         if (input_prm->logFramePosList.length() > 0) {
             m_logFramePosList = input_prm->logFramePosList;
+            //最後にすべてのフレーム情報を出力するので、破棄しない
+            m_Demux.frames.setKeepAll(true);
             AddMessage(RGY_LOG_DEBUG, _T("Opened framepos log file: \"%s\"\n"), input_prm->logCopyFrameData.c_str());
         }
 
@@ -2091,17 +2094,9 @@ RGY_ERR RGYInputAvcodec::Init(const TCHAR *strFileName, VideoInfo *inputInfo, co
                 AddMessage(RGY_LOG_ERROR, _T("failed to set codec param to context for decoder: %s.\n"), qsv_av_err2str(ret).c_str());
                 return RGY_ERR_UNKNOWN;
             }
-            cpu_info_t cpu_info;
-            if (get_cpu_info(&cpu_info)) {
-                AVDictionary *pDict = nullptr;
-                av_dict_set_int(&pDict, "threads", std::min(cpu_info.logical_cores, 16), 0);
-                if (0 > (ret = av_opt_set_dict(m_Demux.video.codecCtxDecode, &pDict))) {
-                    AddMessage(RGY_LOG_ERROR, _T("Failed to set threads for decode (codec: %s): %s\n"),
-                        char_to_tstring(avcodec_get_name(m_Demux.video.stream->codecpar->codec_id)).c_str(), qsv_av_err2str(ret).c_str());
-                    return RGY_ERR_UNKNOWN;
-                }
-                av_dict_free(&pDict);
-            }
+            //入力スレッドを使用する場合は、デコードも別スレッドで行う
+            const bool useDecodeThread = (input_prm->threadInput == RGY_INPUT_THREAD_AUTO) ? !input_prm->lowLatency : input_prm->threadInput != 0;
+            setDecodeThreads(useDecodeThread, input_prm->lowLatency);
             if ((m_Demux.video.codecDecode->capabilities & AV_CODEC_CAP_EXPERIMENTAL)) {
                 AVDictionary *pDict = nullptr;
                 if (0 > (ret = av_dict_set_int(&pDict, "strict", FF_COMPLIANCE_EXPERIMENTAL, 0))) {
@@ -2118,6 +2113,10 @@ RGY_ERR RGYInputAvcodec::Init(const TCHAR *strFileName, VideoInfo *inputInfo, co
             }
             m_Demux.video.codecCtxDecode->time_base = av_stream_get_codec_timebase(m_Demux.video.stream);
             m_Demux.video.codecCtxDecode->pkt_timebase = m_Demux.video.stream->time_base;
+#if AV_CODEC_COPY_OPAQUE_AVAIL
+            //パケットに付加したメタデータ(opaque_ref)をフレームに引き継ぐ
+            m_Demux.video.codecCtxDecode->flags |= AV_CODEC_FLAG_COPY_OPAQUE;
+#endif //#if AV_CODEC_COPY_OPAQUE_AVAIL
             if (0 > (ret = avcodec_open2(m_Demux.video.codecCtxDecode, m_Demux.video.codecDecode, nullptr))) {
                 AddMessage(RGY_LOG_ERROR, _T("Failed to open decoder for %s: %s\n"), char_to_tstring(avcodec_get_name(m_Demux.video.stream->codecpar->codec_id)).c_str(), qsv_av_err2str(ret).c_str());
                 return RGY_ERR_UNSUPPORTED;
@@ -2245,6 +2244,14 @@ RGY_ERR RGYInputAvcodec::Init(const TCHAR *strFileName, VideoInfo *inputInfo, co
             //はじめcapacityを無限大にセットしたので、この段階で制限をかける
             //入力をスレッド化しない場合には、自動的に同期が保たれるので、ここでの制限は必要ない
             m_Demux.qVideoPkt.set_capacity(256);
+            if (m_Demux.video.codecCtxDecode) {
+                //swデコードを別スレッドで行い、色空間変換と並列に動作させる
+                m_Demux.qVideoFrame.init(AVSW_DECODE_QUEUE_SIZE * 2, AVSW_DECODE_QUEUE_SIZE);
+                m_Demux.thread.decodeFin = false;
+                m_Demux.thread.decodeSts = RGY_ERR_NONE;
+                m_Demux.thread.thDecode = std::thread(&RGYInputAvcodec::ThreadFuncDecode, this, input_prm->threadParamInput);
+                AddMessage(RGY_LOG_DEBUG, _T("Started decode thread, queue size %d.\n"), AVSW_DECODE_QUEUE_SIZE);
+            }
         }
     } else {
         //音声との同期とかに使うので、動画の情報を格納する
@@ -2319,6 +2326,17 @@ FramePosList *RGYInputAvcodec::GetFramePosList() {
     return &m_Demux.frames;
 }
 
+void RGYInputAvcodec::EnableFramePosEvict() {
+    //trimの開始位置は音声の時刻の補正に使用するので、破棄後も保持する
+    for (const auto& trim : m_trimParam.list) {
+        if (trim.start >= 0) {
+            m_Demux.frames.pin((uint32_t)trim.start);
+        }
+    }
+    m_Demux.frames.enableEvict(true);
+    AddMessage(RGY_LOG_DEBUG, _T("Enabled eviction of frame position list.\n"));
+}
+
 //seektoで指定された時刻の範囲内かチェックする
 bool RGYInputAvcodec::checkTimeSeekTo(int64_t pts, rgy_rational<int> timebase, float marginSec) {
     if (m_seek.second <= 0.0f
@@ -2342,6 +2360,12 @@ bool RGYInputAvcodec::checkOtherTimeSeekTo(int64_t pts, const AVDemuxStream *str
 
 int RGYInputAvcodec::getVideoFrameIdx(int64_t pts, AVRational timebase, int iStart) {
     const int framePosCount = m_Demux.frames.frameNum();
+    //破棄済みのフレーム情報は参照できないので、保持している範囲から探す
+    //(返り値が保持している範囲に収まるよう、その次のフレームから探す)
+    const int firstIndex = (int)m_Demux.frames.firstIndex();
+    if (firstIndex > 0) {
+        iStart = (std::max)(iStart, firstIndex + 1);
+    }
     const AVRational vid_pkt_timebase = (m_Demux.video.stream) ? m_Demux.video.stream->time_base : av_inv_q(m_Demux.video.nAvgFramerate);
     if (av_cmp_q(timebase, vid_pkt_timebase) == 0) {
         for (int i = (std::max)(0, iStart); i < framePosCount; i++) {
@@ -2715,10 +2739,15 @@ RGY_ERR RGYInputAvcodec::GetNextBitstream(RGYBitstream *pBitstream) {
             sts = pBitstream->copy(pkt->data, pkt->size, pkt->dts, pts);
         }
         if (m_Demux.video.stream->codecpar->codec_id == AV_CODEC_ID_HEVC && m_Demux.video.hdr10plusMetadataCopy) {
-            pBitstream->addFrameData(getHDR10plusMetaData(pkt));
+            //payloadは共有したまま、RGYBitstreamの所有するオブジェクトを作成する
+            for (const auto& frameData : getFrameData(pkt)) {
+                if (auto metadata = dynamic_cast<const RGYFrameDataMetadata *>(frameData.get()); metadata) {
+                    pBitstream->addFrameData(metadata->clone());
+                }
+            }
         }
         auto flags = RGY_FRAME_FLAG_NONE;
-        const auto findPos = m_Demux.frames.findpts(pBitstream->pts(), &m_Demux.video.findPosLastIdx);
+        const auto findPos = m_Demux.frames.findpts(pBitstream->pts(), &m_Demux.video.findPosLastIdx, m_Demux.video.findPosConsumer);
         if (findPos.poc != FRAMEPOS_POC_INVALID
             && (findPos.pic_struct & RGY_PICSTRUCT_INTERLACED) == 0
             && findPos.repeat_pict > 1) {
@@ -3005,75 +3034,198 @@ RGY_ERR RGYInputAvcodec::GetHeader(RGYBitstream *pBitstream) {
 
 #pragma warning(push)
 #pragma warning(disable:4100)
+void RGYInputAvcodec::setDecodeThreads(const bool useDecodeThread, const bool lowLatency) {
+    cpu_info_t cpu_info;
+    if (!get_cpu_info(&cpu_info)) {
+        return; //ffmpegの既定値のまま
+    }
+    const auto capabilities = m_Demux.video.codecDecode->capabilities;
+    int threadType = 0;
+    //低遅延モードでは、フレーム単位の並列化による遅延を避ける
+    if (!lowLatency && (capabilities & AV_CODEC_CAP_FRAME_THREADS)) {
+        threadType |= FF_THREAD_FRAME;
+    }
+    if (capabilities & AV_CODEC_CAP_SLICE_THREADS) {
+        threadType |= FF_THREAD_SLICE;
+    }
+    int threads = 1;
+    if (threadType & FF_THREAD_FRAME) {
+        //フレーム並列は論理コア数まで伸びるが、デコードスレッドを使う場合は変換を行うスレッドの分を空けておく
+        threads = cpu_info.logical_cores - (useDecodeThread ? 1 : 0);
+        //低解像度では、多数のフレームスレッドはメモリと遅延を増やすだけなので制限する
+        if (m_Demux.video.stream->codecpar->width * m_Demux.video.stream->codecpar->height <= 1280 * 720) {
+            threads = std::min(threads, 8);
+        }
+    } else if (threadType & FF_THREAD_SLICE) {
+        //スライス並列はSMTの効果が薄いので物理コア数まで
+        threads = cpu_info.physical_cores;
+    }
+    threads = clamp(threads, 1, 16);
+    m_Demux.video.codecCtxDecode->thread_count = threads;
+    if (threadType) {
+        m_Demux.video.codecCtxDecode->thread_type = threadType;
+    }
+    m_Demux.video.decodeStats.decodeThreads = threads;
+    m_Demux.video.decodeStats.decodeThreadType = threadType;
+    AddMessage(RGY_LOG_DEBUG, _T("decoder threads: %d (%s%s), cores %d/%d.\n"), threads,
+        (threadType & FF_THREAD_FRAME) ? _T("frame") : _T(""),
+        (threadType & FF_THREAD_SLICE) ? ((threadType & FF_THREAD_FRAME) ? _T("+slice") : _T("slice")) : _T(""),
+        cpu_info.physical_cores, cpu_info.logical_cores);
+}
+
+RGY_ERR RGYInputAvcodec::decodeFrame(AVFrame *frame) {
+    int64_t decodeTime = 0; //パケットの待機時間を含まないデコード時間 (us)
+    int got_frame = 0;
+    while (!got_frame) {
+        if (!m_Demux.thread.thInput.joinable() //入力スレッドがなければ、自分で読み込む
+            && m_Demux.qVideoPkt.get_keep_length() > 0) { //keep_length == 0なら読み込みは終了していて、これ以上読み込む必要はない
+            auto [ret, pkt] = getSample();
+            if (ret == 0) {
+                m_Demux.qVideoPkt.push(pkt.release());
+            } else if (ret != AVERROR_EOF) {
+                return RGY_ERR_UNKNOWN;
+            }
+        }
+
+        bool bGetPacket = false;
+        AVPacket *pkt = nullptr;
+        for (int i = 0; false == (bGetPacket = m_Demux.qVideoPkt.front_copy_no_lock(&pkt, (m_Demux.thread.queueInfo) ? &m_Demux.thread.queueInfo->usage_vid_in : nullptr)) && m_Demux.qVideoPkt.size() > 0; i++) {
+            m_Demux.qVideoPkt.wait_for_push();
+        }
+        if (!bGetPacket && pkt) {
+            //flushするためのパケット
+            pkt->data = nullptr;
+            pkt->size = 0;
+        }
+#if !AV_CODEC_COPY_OPAQUE_AVAIL
+        if (bGetPacket && pkt->opaque_ref && m_Demux.video.frameDataPending.count(pkt->pts) == 0) {
+            if (auto frameData = getFrameData(pkt); frameData.size() > 0) {
+                m_Demux.video.frameDataPending[pkt->pts] = std::move(frameData);
+            }
+        }
+#endif //#if !AV_CODEC_COPY_OPAQUE_AVAIL
+        const auto timeStart = std::chrono::steady_clock::now();
+        int ret = avcodec_send_packet(m_Demux.video.codecCtxDecode, pkt);
+        //AVERROR(EAGAIN) -> パケットを送る前に受け取る必要がある
+        //パケットが受け取られていないのでpopしない
+        if (ret != AVERROR(EAGAIN)) {
+            m_Demux.qVideoPkt.pop();
+            m_poolPkt->returnFree(&pkt);
+        }
+        if (ret == AVERROR_EOF) { //これ以上パケットを送れない
+            AddMessage(RGY_LOG_DEBUG, _T("failed to send packet to video decoder, already flushed: %s.\n"), qsv_av_err2str(ret).c_str());
+        } else if (ret < 0 && ret != AVERROR(EAGAIN)) {
+            AddMessage(RGY_LOG_ERROR, _T("failed to send packet to video decoder: %s.\n"), qsv_av_err2str(ret).c_str());
+            return RGY_ERR_UNDEFINED_BEHAVIOR;
+        }
+        ret = avcodec_receive_frame(m_Demux.video.codecCtxDecode, frame);
+        decodeTime += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - timeStart).count();
+        if (ret == AVERROR(EAGAIN)) { //もっとパケットを送る必要がある
+            continue;
+        }
+        if (ret == AVERROR_EOF) {
+            //最後まで読み込んだ
+            return RGY_ERR_MORE_DATA;
+        }
+        if (ret < 0) {
+            AddMessage(RGY_LOG_ERROR, _T("failed to receive frame from video decoder: %s.\n"), qsv_av_err2str(ret).c_str());
+            return RGY_ERR_UNDEFINED_BEHAVIOR;
+        }
+        got_frame = TRUE;
+    }
+#if !AV_CODEC_COPY_OPAQUE_AVAIL
+    //opaque_refが引き継がれないので、デコーダに送った際に保存したものをptsで探してフレームに付加する
+    auto& pending = m_Demux.video.frameDataPending;
+    if (auto it = pending.find(frame->pts); it != pending.end()) {
+        for (auto& frameData : it->second) {
+            rgy_av_add_frame_data(&frame->opaque_ref, frameData);
+        }
+        pending.erase(pending.begin(), std::next(it));
+    }
+#endif //#if !AV_CODEC_COPY_OPAQUE_AVAIL
+    m_Demux.video.decodeStats.decodeTime += decodeTime;
+    m_Demux.video.decodeStats.decodeFrames++;
+    return RGY_ERR_NONE;
+}
+
+RGY_ERR RGYInputAvcodec::ThreadFuncDecode(RGYParamThread threadParam) {
+    threadParam.apply(GetCurrentThread());
+    AddMessage(RGY_LOG_DEBUG, _T("Set decode thread param: %s.\n"), threadParam.desc().c_str());
+    auto sts = RGY_ERR_NONE;
+    while (!m_Demux.thread.bAbortInput) {
+        AVFrame *frame = (m_poolFrame) ? m_poolFrame->getFree().release() : av_frame_alloc();
+        if (frame == nullptr) {
+            sts = RGY_ERR_NULL_PTR;
+            break;
+        }
+        if ((sts = decodeFrame(frame)) != RGY_ERR_NONE) {
+            releaseDecodedFrame(&frame);
+            break;
+        }
+        //キューが一杯なら、取り出されるまでここで待機する
+        m_Demux.qVideoFrame.push(frame);
+    }
+    if (sts == RGY_ERR_NONE) {
+        sts = RGY_ERR_ABORTED; //中断された
+    }
+    AddMessage((sts == RGY_ERR_NONE || sts == RGY_ERR_MORE_DATA) ? RGY_LOG_DEBUG : RGY_LOG_ERROR,
+        _T("Finished decode thread: %s.\n"), get_err_mes(sts));
+    m_Demux.thread.decodeSts = sts;
+    m_Demux.thread.decodeFin = true;
+    return sts;
+}
+
+void RGYInputAvcodec::releaseDecodedFrame(AVFrame **frame) {
+    if (*frame == nullptr) {
+        return;
+    }
+    if (m_poolFrame) {
+        m_poolFrame->returnFree(frame);
+    } else {
+        av_frame_free(frame);
+    }
+    *frame = nullptr;
+}
+
 RGY_ERR RGYInputAvcodec::LoadNextFrameInternal(RGYFrame *pSurface) {
     if (m_Demux.video.codecCtxDecode) {
         //動画のデコードを行う
-        int got_frame = 0;
-        while (!got_frame) {
-            if (!m_Demux.thread.thInput.joinable() //入力スレッドがなければ、自分で読み込む
-                && m_Demux.qVideoPkt.get_keep_length() > 0) { //keep_length == 0なら読み込みは終了していて、これ以上読み込む必要はない
-                auto [ret, pkt] = getSample();
-                if (ret == 0) {
-                    m_Demux.qVideoPkt.push(pkt.release());
-                } else if (ret != AVERROR_EOF) {
-                    return RGY_ERR_UNKNOWN;
+        AVFrame *frame = nullptr;
+        if (m_Demux.thread.thDecode.joinable()) {
+            //デコードスレッドでデコード済みのフレームを取得する
+            while (!m_Demux.qVideoFrame.front_copy_and_pop_no_lock(&frame)) {
+                if (m_Demux.thread.decodeFin) {
+                    //終了フラグを立てる前にpushされたものがないか、再度確認する
+                    if (!m_Demux.qVideoFrame.front_copy_and_pop_no_lock(&frame)) {
+                        return m_Demux.thread.decodeSts;
+                    }
+                    break;
                 }
+                m_Demux.qVideoFrame.wait_for_push();
             }
-
-            bool bGetPacket = false;
-            AVPacket *pkt = nullptr;
-            for (int i = 0; false == (bGetPacket = m_Demux.qVideoPkt.front_copy_no_lock(&pkt, (m_Demux.thread.queueInfo) ? &m_Demux.thread.queueInfo->usage_vid_in : nullptr)) && m_Demux.qVideoPkt.size() > 0; i++) {
-                m_Demux.qVideoPkt.wait_for_push();
-            }
-            if (!bGetPacket && pkt) {
-                //flushするためのパケット
-                pkt->data = nullptr;
-                pkt->size = 0;
-            }
-            int ret = avcodec_send_packet(m_Demux.video.codecCtxDecode, pkt);
-            //AVERROR(EAGAIN) -> パケットを送る前に受け取る必要がある
-            //パケットが受け取られていないのでpopしない
-            if (ret != AVERROR(EAGAIN)) {
-                m_Demux.qVideoPkt.pop();
-                m_poolPkt->returnFree(&pkt);
-            }
-            if (ret == AVERROR_EOF) { //これ以上パケットを送れない
-                AddMessage(RGY_LOG_DEBUG, _T("failed to send packet to video decoder, already flushed: %s.\n"), qsv_av_err2str(ret).c_str());
-            } else if (ret < 0 && ret != AVERROR(EAGAIN)) {
-                AddMessage(RGY_LOG_ERROR, _T("failed to send packet to video decoder: %s.\n"), qsv_av_err2str(ret).c_str());
-                return RGY_ERR_UNDEFINED_BEHAVIOR;
-            }
-            ret = avcodec_receive_frame(m_Demux.video.codecCtxDecode, m_Demux.video.frame);
-            if (ret == AVERROR(EAGAIN)) { //もっとパケットを送る必要がある
-                continue;
-            }
-            if (ret == AVERROR_EOF) {
-                //最後まで読み込んだ
-                return RGY_ERR_MORE_DATA;
-            }
-            if (ret < 0) {
-                AddMessage(RGY_LOG_ERROR, _T("failed to receive frame from video decoder: %s.\n"), qsv_av_err2str(ret).c_str());
-                return RGY_ERR_UNDEFINED_BEHAVIOR;
+        } else {
+            if (auto sts = decodeFrame(m_Demux.video.frame); sts != RGY_ERR_NONE) {
+                return sts;
             }
-            got_frame = TRUE;
+            frame = m_Demux.video.frame;
         }
         auto flags = RGY_FRAME_FLAG_NONE;
-        const auto findPos = m_Demux.frames.findpts(m_Demux.video.frame->pts, &m_Demux.video.findPosLastIdx);
+        const auto findPos = m_Demux.frames.findpts(frame->pts, &m_Demux.video.findPosLastIdx, m_Demux.video.findPosConsumer);
         if (findPos.poc != FRAMEPOS_POC_INVALID) {
             if (findPos.repeat_pict > 1) {
                 flags |= RGY_FRAME_FLAG_RFF;
                 m_Demux.video.decRFFStatus ^= 1; // 反転させる
             }
-            if (rgy_avframe_tff_flag(m_Demux.video.frame) || findPos.repeat_pict > 1 || m_Demux.video.decRFFStatus) {
+            if (rgy_avframe_tff_flag(frame) || findPos.repeat_pict > 1 || m_Demux.video.decRFFStatus) {
                 // RFF用のTFF/BFFを示すフラグを設定 (picstructとは別)
-                flags |= (rgy_avframe_tff_flag(m_Demux.video.frame)) ? RGY_FRAME_FLAG_RFF_TFF : RGY_FRAME_FLAG_RFF_BFF;
+                flags |= (rgy_avframe_tff_flag(frame)) ? RGY_FRAME_FLAG_RFF_TFF : RGY_FRAME_FLAG_RFF_BFF;
             }
         }
         pSurface->setFlags(flags);
-        pSurface->setTimestamp(m_Demux.video.frame->pts);
-        pSurface->setDuration(rgy_avframe_get_duration(m_Demux.video.frame));
+        pSurface->setTimestamp(frame->pts);
+        pSurface->setDuration(rgy_avframe_get_duration(frame));
         if (m_inputVideoInfo.picstruct == RGY_PICSTRUCT_AUTO) { //autoの時は、frameのインタレ情報をセットする
-            pSurface->setPicstruct(picstruct_avframe_to_rgy(m_Demux.video.frame));
+            pSurface->setPicstruct(picstruct_avframe_to_rgy(frame));
         }
         pSurface->dataList().clear();
 #if 0
@@ -3084,48 +3236,52 @@ RGY_ERR RGYInputAvcodec::LoadNextFrameInternal(RGYFrame *pSurface) {
             #pragma warning(disable:4996) // warning C4996: 'av_frame_get_qp_table': が古い形式として宣言されました。
             RGY_DISABLE_WARNING_PUSH
             RGY_DISABLE_WARNING_STR("-Wdeprecated-declarations")
-            const auto qp_table = av_frame_get_qp_table(m_Demux.video.frame, &qp_stride, &qscale_type);
+            const auto qp_table = av_frame_get_qp_table(frame, &qp_stride, &qscale_type);
             RGY_DISABLE_WARNING_POP
             #pragma warning(pop)
             if (qp_table != nullptr) {
                 auto table = m_Demux.video.qpTableListRef->get();
                 const int qpw = (qp_stride) ? qp_stride : (pSurface->width() + 15) / 16;
                 const int qph = (qp_stride) ? (pSurface->height() + 15) / 16 : 1;
-                table->setQPTable(qp_table, qpw, qph, qp_stride, qscale_type, m_Demux.video.frame->pict_type, m_Demux.video.frame->pts);
+                table->setQPTable(qp_table, qpw, qph, qp_stride, qscale_type, frame->pict_type, frame->pts);
                 pSurface->dataList().push_back(table);
             }
         }
 #endif //#if ENCODER_NVENC
-        {
-            auto hdr10plus = std::shared_ptr<RGYFrameData>(getHDR10plusMetaData(m_Demux.video.frame));
-            if (hdr10plus) {
-                pSurface->dataList().push_back(hdr10plus);
-            }
+        for (auto& frameData : getFrameData(frame)) {
+            pSurface->dataList().push_back(std::move(frameData));
         }
         {
-            auto dovirpu = std::shared_ptr<RGYFrameData>(getDoviRpu(m_Demux.video.frame));
+            auto dovirpu = std::shared_ptr<RGYFrameData>(getDoviRpu(frame));
             if (dovirpu) {
                 pSurface->dataList().push_back(dovirpu);
             }
         }
 
         //実際には初期化時と異なるcspの場合があるので、ここで再度チェック
-        m_inputCsp = csp_avpixfmt_to_rgy((AVPixelFormat)m_Demux.video.frame->format);
+        m_inputCsp = csp_avpixfmt_to_rgy((AVPixelFormat)frame->format);
         if (m_convert->getFunc(m_inputCsp, m_inputVideoInfo.csp, m_Demux.video.simdCsp) == nullptr) {
             AddMessage(RGY_LOG_ERROR, _T("color conversion not supported: %s -> %s.\n"),
                 RGY_CSP_NAMES[m_inputCsp], RGY_CSP_NAMES[m_inputVideoInfo.csp]);
+            if (frame != m_Demux.video.frame) {
+                releaseDecodedFrame(&frame);
+            }
             return RGY_ERR_INVALID_COLOR_FORMAT;
         }
 
-        //フレームデータをコピー
+        //フレームデータをコピー (pSurfaceはGPUへの転送用のpinned memory)
+        const auto timeConvStart = std::chrono::steady_clock::now();
         void *dst_array[3];
         pSurface->ptrArray(dst_array);
-        m_convert->run(rgy_avframe_interlaced(m_Demux.video.frame),
-            dst_array, (const void **)m_Demux.video.frame->data,
-            m_inputVideoInfo.srcWidth, m_Demux.video.frame->linesize[0], m_Demux.video.frame->linesize[1], pSurface->pitch(),
+        m_convert->run(rgy_avframe_interlaced(frame),
+            dst_array, (const void **)frame->data,
+            m_inputVideoInfo.srcWidth, frame->linesize[0], frame->linesize[1], pSurface->pitch(),
             m_inputVideoInfo.srcHeight, m_inputVideoInfo.srcHeight, m_inputVideoInfo.crop.c);
-        if (got_frame) {
-            av_frame_unref(m_Demux.video.frame);
+        m_Demux.video.decodeStats.convertTime += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - timeConvStart).count();
+        if (frame == m_Demux.video.frame) {
+            av_frame_unref(frame);
+        } else {
+            releaseDecodedFrame(&frame);
         }
         m_encSatusInfo->m_sData.frameIn++;
     } else {
@@ -39,6 +39,10 @@
 #include "rgy_bitstream.h"
 #include "convert_csp.h"
 #include <deque>
+#include <array>
+#include <map>
+#include <set>
+#include <mutex>
 #include <atomic>
 #include <thread>
 #include <cassert>
@@ -50,8 +54,11 @@ using std::deque;
 static const uint32_t AVCODEC_READER_INPUT_BUF_SIZE = 16 * 1024 * 1024;
 static const uint32_t AV_FRAME_MAX_REORDER = 16;
 static const int FRAMEPOS_POC_INVALID = -1;
-
-static const char* HDR10PLUS_METADATA_KEY = "rgy_hdr10plus_metadata";
+static const int FRAMEPOS_CONSUMER_MAX = 8;        //FramePosListを参照する側の最大数
+static const uint32_t FRAMEPOS_EVICT_MARGIN = 8192; //参照位置からこれだけ前までのフレーム情報は残す
+static const uint32_t FRAMEPOS_EVICT_CHUNK = 4096;  //まとめて破棄するフレーム情報の数
+static const uint32_t FRAMEPOS_FIND_NEAR = 8;       //findptsで直前の位置から順に探す数
+static const int AVSW_DECODE_QUEUE_SIZE = 4;        //デコードスレッドでデコード済みのフレームを保持する最大数
 
 enum RGYPtsStatus : uint32_t {
     RGY_PTS_UNKNOWN           = 0x00,
@@ -147,6 +154,15 @@ public:
     FramePosList() :
         m_frameDuration(0.0),
         m_list(),
+        m_mtx(),
+        m_evicted(0),
+        m_evictEnable(false),
+        m_keepAll(false),
+        m_pinIndex({ 0, 1, 2 }),
+        m_pinned(),
+        m_consumerPos(),
+        m_consumerCount(0),
+        m_sortedFrom(0),
         m_nextFixNumIndex(0),
         m_inputFin(false),
         m_duration(0),
@@ -160,6 +176,9 @@ public:
         m_PAFFRewind(0),
         m_ptsWrapArroundThreshold(0xFFFFFFFF),
         m_fpDebugCopyFrameData() {
+        for (auto& pos : m_consumerPos) {
+            pos = 0;
+        }
         m_list.init();
         static_assert(sizeof(m_list.get()[0]) == sizeof(m_list.get()->data), "FramePos must not have padding.");
     };
@@ -184,7 +203,7 @@ public:
 #pragma warning(pop)
     //filenameに情報をcsv形式で出力する
     int printList(const TCHAR *filename) {
-        const int nList = (int)m_list.size();
+        const int nList = frameNum();
         if (nList == 0) {
             return 0;
         }
@@ -196,14 +215,14 @@ public:
             return 1;
         }
         fprintf(fp, "     poc, T,flags,repeat,  pts,         dts,duration,duration2,pic_struct\r\n");
-        for (int i = 0; i < nList; i++) {
+        for (int i = (int)m_evicted; i < nList; i++) {
             fprintf(fp, "%8d,%2s,%2d,%2d,%12lld, %12lld, %6d, %6d, %s\r\n",
-                m_list[i].data.poc,
-                (m_list[i].data.pict_type == 1) ? "I" : ((m_list[i].data.pict_type == 2) ? "P" : ((m_list[i].data.pict_type == 3) ? "B" : "X")),
-                (int)m_list[i].data.flags, m_list[i].data.repeat_pict,
-                (lls)m_list[i].data.pts, (lls)m_list[i].data.dts,
-                m_list[i].data.duration, m_list[i].data.duration2,
-                tchar_to_string(picstrcut_to_str((RGY_PICSTRUCT)m_list[i].data.pic_struct)).c_str());
+                list(i).poc,
+                (list(i).pict_type == 1) ? "I" : ((list(i).pict_type == 2) ? "P" : ((list(i).pict_type == 3) ? "B" : "X")),
+                (int)list(i).flags, list(i).repeat_pict,
+                (lls)list(i).pts, (lls)list(i).dts,
+                list(i).duration, list(i).duration2,
+                tchar_to_string(picstrcut_to_str((RGY_PICSTRUCT)list(i).pic_struct)).c_str());
         }
         fclose(fp);
         return 0;
@@ -211,11 +230,56 @@ public:
     //indexの位置への参照を返す
     // !! push側のスレッドからのみ有効 !!
     FramePos& list(uint32_t index) {
-        return m_list[index].data;
+        if (index < m_evicted) {
+            //破棄済みの場合は、保持しておいたものを返す
+            auto it = m_pinned.find(index);
+            if (it != m_pinned.end()) {
+                return it->second;
+            }
+            //本来ここには来ないはずだが、念のため保持している最も古いものを返す
+            assert(false);
+            index = m_evicted;
+        }
+        return m_list[index - m_evicted].data;
+    }
+    //保持している最初のフレームのインデックス (これより前は破棄済み)
+    uint32_t firstIndex() const {
+        return m_evicted;
+    }
+    //FramePosListを参照する側を登録し、findptsで使用する番号を返す
+    //登録した参照位置より十分前のフレーム情報は、enableEvict()後に破棄される
+    int addConsumer() {
+        const int id = m_consumerCount++;
+        if (id >= FRAMEPOS_CONSUMER_MAX) {
+            m_consumerCount--;
+            return -1;
+        }
+        m_consumerPos[id] = 0;
+        return id;
+    }
+    //古いフレーム情報の破棄を許可する
+    //すべての参照側をaddConsumer()で登録してから呼ぶこと
+    void enableEvict(bool enable) {
+        m_evictEnable = enable;
+    }
+    //すべてのフレーム情報を保持する (printList用)
+    void setKeepAll(bool keepAll) {
+        m_keepAll = keepAll;
+    }
+    //破棄した後も参照されるフレーム情報を指定する (trimの開始位置など)
+    void pin(uint32_t index) {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        m_pinIndex.insert(index);
     }
     //初期化
     void clear() {
         m_list.close();
+        m_evicted = 0;
+        m_pinned.clear();
+        for (auto& pos : m_consumerPos) {
+            pos = 0;
+        }
+        m_sortedFrom = 0;
         m_frameDuration = 0.0;
         m_nextFixNumIndex = 0;
         m_inputFin = false;
@@ -238,7 +302,7 @@ public:
     }
     //登録された(ptsの確定していないものを含む)フレーム数を返す
     int frameNum() const {
-        return (int)m_list.size();
+        return (int)(m_list.size() + m_evicted);
     }
     //ptsが確定したフレーム数を返す
     int fixedNum() const {
@@ -250,14 +314,14 @@ public:
     }
     void clearPtsStatus() {
         if (m_streamPtsStatus & RGY_PTS_DUPLICATE) {
-            const int nListSize = (int)m_list.size();
-            for (int i = 0; i < nListSize; i++) {
-                if (m_list[i].data.duration == 0
-                    && m_list[i].data.pts != AV_NOPTS_VALUE
-                    && m_list[i].data.dts != AV_NOPTS_VALUE
-                    && m_list[i+1].data.pts - m_list[i].data.pts <= (std::min)(m_list[i+1].data.duration / 10, 1)
-                    && m_list[i+1].data.dts - m_list[i].data.dts <= (std::min)(m_list[i+1].data.duration / 10, 1)) {
-                    m_list[i].data.duration = m_list[i+1].data.duration;
+            const int nListSize = frameNum();
+            for (int i = (int)m_evicted; i < nListSize - 1; i++) {
+                if (list(i).duration == 0
+                    && list(i).pts != AV_NOPTS_VALUE
+                    && list(i).dts != AV_NOPTS_VALUE
+                    && list(i+1).pts - list(i).pts <= (std::min)(list(i+1).duration / 10, 1)
+                    && list(i+1).dts - list(i).dts <= (std::min)(list(i+1).duration / 10, 1)) {
+                    list(i).duration = list(i+1).duration;
                 }
             }
         }
@@ -270,35 +334,71 @@ public:
     RGYPtsStatus getStreamPtsStatus() const {
         return m_streamPtsStatus;
     }
-    FramePos findpts(int64_t pts, uint32_t *lastIndex) {
-        FramePos pos_last = framePosInit();
-        for (uint32_t index = *lastIndex + 1; ; index++) {
-            FramePos pos = framePosInit();
-            if (!m_list.copy(&pos, index)) {
-                break;
+    //ptsの一致するフレームの情報のコピーを返す
+    //一致するものがなければ、ptsの直前のフレームの情報を返す
+    //consumerにはaddConsumer()で登録した番号を指定すると、見つかった位置を参照位置として記録する
+    FramePos findpts(int64_t pts, uint32_t *lastIndex, int consumer = -1) {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        const uint32_t first = m_evicted;
+        const uint32_t last = first + (uint32_t)m_list.size();
+        //ptsでソート済みの範囲 [sortedStart, sortedEnd)
+        const uint32_t sortedFrom = m_sortedFrom;
+        const uint32_t fixedNum = (uint32_t)(std::max)((int)m_nextFixNumIndex, 0);
+        const uint32_t sortedStart = clamp(sortedFrom, first, last);
+        const uint32_t sortedEnd = clamp(fixedNum, sortedStart, last);
+        FramePos pos = framePosInit();
+        auto found = [&](uint32_t index) {
+            *lastIndex = index;
+            if (0 <= consumer && consumer < m_consumerCount) {
+                m_consumerPos[consumer] = (index == UINT32_MAX) ? 0 : index;
             }
-            if (pts == pos.pts) {
-                *lastIndex = index;
+        };
+        //まず直前の位置の後ろを探す (通常はここで見つかる)
+        const uint32_t nearStart = (std::max)(*lastIndex + 1, first);
+        for (uint32_t index = nearStart; index < (std::min)(last, nearStart + FRAMEPOS_FIND_NEAR); index++) {
+            if (copyAt(&pos, index) && pts == pos.pts) {
+                found(index);
                 return pos;
             }
-            pos_last = pos;
         }
-        //最初から探索
-        for (uint32_t index = 0; ; index++) {
-            FramePos pos = framePosInit();
-            if (!m_list.copy(&pos, index)) {
-                break;
+        //ソート済みの範囲は二分探索、それ以外は線形探索で一致するものを探す
+        const uint32_t sortedIndex = lowerBoundPts(pts, sortedStart, sortedEnd);
+        if (sortedIndex < sortedEnd && copyAt(&pos, sortedIndex) && pts == pos.pts) {
+            found(sortedIndex);
+            return pos;
+        }
+        for (const auto& range : { std::make_pair(first, sortedStart), std::make_pair(sortedEnd, last) }) {
+            for (uint32_t index = range.first; index < range.second; index++) {
+                if (copyAt(&pos, index) && pts == pos.pts) {
+                    found(index);
+                    return pos;
+                }
             }
-            if (pts == pos.pts) {
-                *lastIndex = index;
-                return pos;
+        }
+        //pts < demux.videoFramePts[i]となる最初のフレームを探し、その前のフレームを返す
+        uint32_t nextIndex = last;
+        for (uint32_t index = first; index < sortedStart; index++) {
+            if (copyAt(&pos, index) && pts < pos.pts) {
+                nextIndex = index;
+                break;
             }
-            //pts < demux.videoFramePts[i]であるなら、その前のフレームを返す
-            if (pts < pos.pts) {
-                *lastIndex = index-1;
-                return pos_last;
+        }
+        if (nextIndex == last && sortedIndex < sortedEnd) {
+            nextIndex = sortedIndex;
+        }
+        if (nextIndex == last) {
+            for (uint32_t index = sortedEnd; index < last; index++) {
+                if (copyAt(&pos, index) && pts < pos.pts) {
+                    nextIndex = index;
+                    break;
+                }
             }
-            pos_last = pos;
+        }
+        if (nextIndex < last) {
+            FramePos pos_last = framePosInit();
+            copyAt(&pos_last, nextIndex - 1);
+            found(nextIndex - 1);
+            return pos_last;
         }
         //エラー
         FramePos poserr = framePosInit();
@@ -307,14 +407,14 @@ public:
     //FramePosを追加し、内部状態を変更する
     void add(const FramePos& pos) {
         m_list.push(pos);
-        const int nListSize = (int)m_list.size();
+        const int nListSize = frameNum();
         //自分のフレームのインデックス
         const int nIndex = nListSize-1;
         //ptsの補正
         adjustFrameInfo(nIndex);
         //最初のキーフレームの位置を記憶しておく
         if (m_firstKeyframePts == AV_NOPTS_VALUE && (pos.flags & AV_PKT_FLAG_KEY) && nIndex == 0) {
-            m_firstKeyframePts = m_list[nIndex].data.pts;
+            m_firstKeyframePts = list(nIndex).pts;
         }
         //m_streamPtsStatusがRGY_PTS_UNKNOWNの場合には、ソートなどは行わない
         if (m_inputFin || (m_streamPtsStatus && nListSize - m_nextFixNumIndex > (int)AV_FRAME_MAX_REORDER)) {
@@ -323,17 +423,22 @@ public:
             setPocAndFix(nListSize);
         }
         calcDuration();
+        evict();
     };
     //pocの一致するフレームの情報のコピーを返す
-    FramePos copy(int poc, uint32_t *lastIndex) {
+    FramePos copy(int poc, uint32_t *lastIndex, int consumer = -1) {
         assert(lastIndex != nullptr);
-        for (uint32_t index = *lastIndex + 1; ; index++) {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        for (uint32_t index = (std::max)(*lastIndex + 1, (uint32_t)m_evicted); ; index++) {
             FramePos pos = framePosInit();
-            if (!m_list.copy(&pos, index)) {
+            if (!copyAt(&pos, index)) {
                 break;
             }
             if (pos.poc == poc) {
                 *lastIndex = index;
+                if (0 <= consumer && consumer < m_consumerCount) {
+                    m_consumerPos[consumer] = index;
+                }
                 DEBUG_FRAME_COPY(_ftprintf(m_fpDebugCopyFrameData.get(), _T("request poc: %8d, hit index: %8d, pts: %lld\n"), poc, index, (lls)pos.pts));
                 return pos;
             }
@@ -344,14 +449,14 @@ public:
                 //とりあえず、ptsを推定して返してしまう
                 pos.poc = poc;
                 FramePos pos_tmp = framePosInit();
-                m_list.copy(&pos_tmp, index-1);
+                copyAt(&pos_tmp, index-1);
                 int nLastPoc = pos_tmp.poc;
                 int64_t nLastPts = pos_tmp.pts;
-                m_list.copy(&pos_tmp, 0);
+                copyAt(&pos_tmp, 0);
                 int64_t pts0 = pos_tmp.pts;
-                m_list.copy(&pos_tmp, 1);
+                copyAt(&pos_tmp, 1);
                 if (pos_tmp.poc == -1) {
-                    m_list.copy(&pos_tmp, 2);
+                    copyAt(&pos_tmp, 2);
                 }
                 int64_t pts1 = pos_tmp.pts;
                 int nFrameDuration = (int)(pts1 - pts0);
@@ -362,7 +467,7 @@ public:
         }
         //エラー
         FramePos pos = framePosInit();
-        DEBUG_FRAME_COPY(_ftprintf(m_fpDebugCopyFrameData.get(), _T("request: %8d, invalid, list size: %d\n"), poc, (int)m_list.size()));
+        DEBUG_FRAME_COPY(_ftprintf(m_fpDebugCopyFrameData.get(), _T("request: %8d, invalid, list size: %d\n"), poc, frameNum()));
         return pos;
     }
     //入力が終了した際に使用し、内部状態を変更する
@@ -371,12 +476,13 @@ public:
         if (m_streamPtsStatus == RGY_PTS_UNKNOWN) {
             checkPtsStatus();
         }
-        const int nFrame = (int)m_list.size();
+        const int nFrame = frameNum();
         sortPts(m_nextFixNumIndex, nFrame - m_nextFixNumIndex);
         m_nextFixNumIndex += m_PAFFRewind;
         for (int i = m_nextFixNumIndex; i < nFrame; i++) {
             adjustDurationAfterSort(m_nextFixNumIndex);
             setPoc(i);
+            updateSortedRange(i);
         }
         m_nextFixNumIndex = nFrame;
         add(pos);
@@ -391,7 +497,7 @@ public:
     //現在の情報から、ptsの状態を確認する
     //さらにptsの補正、ptsのソート、pocの確定を行う
     void checkPtsStatus(double durationHintifPtsAllInvalid = 0.0) {
-        const int nInputPacketCount = (int)m_list.size();
+        const int nInputPacketCount = frameNum();
         int nInputFrames = 0;
         int nInputFields = 0;
         int nInputKeys = 0;
@@ -406,32 +512,32 @@ public:
         m_ptsAllInvalidPtsStartPointPts = 0;
         vector<std::pair<int, int>> durationHistgram;
         for (int i = 0; i < nInputPacketCount; i++) {
-            nInputFrames += (m_list[i].data.pic_struct & RGY_PICSTRUCT_FRAME) != 0;
-            nInputFields += (m_list[i].data.pic_struct & RGY_PICSTRUCT_FIELD) != 0;
-            nInputKeys   += (m_list[i].data.flags & AV_PKT_FLAG_KEY) != 0;
-            nInvalidDuration += m_list[i].data.duration <= 0;
-            if (m_list[i].data.pts == AV_NOPTS_VALUE) {
+            nInputFrames += (list(i).pic_struct & RGY_PICSTRUCT_FRAME) != 0;
+            nInputFields += (list(i).pic_struct & RGY_PICSTRUCT_FIELD) != 0;
+            nInputKeys   += (list(i).flags & AV_PKT_FLAG_KEY) != 0;
+            nInvalidDuration += list(i).duration <= 0;
+            if (list(i).pts == AV_NOPTS_VALUE) {
                 nInvalidPtsCount++;
-                nInvalidPtsCountField += (m_list[i].data.pic_struct & RGY_PICSTRUCT_FIELD) != 0;
-                nInvalidPtsCountKeyFrame += (m_list[i].data.flags & AV_PKT_FLAG_KEY) != 0;
-                nInvalidPtsCountNonKeyFrame += (m_list[i].data.flags & AV_PKT_FLAG_KEY) == 0;
+                nInvalidPtsCountField += (list(i).pic_struct & RGY_PICSTRUCT_FIELD) != 0;
+                nInvalidPtsCountKeyFrame += (list(i).flags & AV_PKT_FLAG_KEY) != 0;
+                nInvalidPtsCountNonKeyFrame += (list(i).flags & AV_PKT_FLAG_KEY) == 0;
             }
-            if (m_list[i].data.dts == AV_NOPTS_VALUE) {
+            if (list(i).dts == AV_NOPTS_VALUE) {
                 nInvalidDtsCount++;
             }
             if (i > 0) {
                 //VP8/VP9では重複するpts/dts/durationを持つフレームが存在することがあるが、これを無視する
                 if (bFractionExists
-                    && m_list[i].data.duration > 0
-                    && m_list[i].data.pts != AV_NOPTS_VALUE
-                    && m_list[i].data.dts != AV_NOPTS_VALUE
-                    && m_list[i].data.pts - m_list[i-1].data.pts <= (std::min)(m_list[i].data.duration / 10, 1)
-                    && m_list[i].data.dts - m_list[i-1].data.dts <= (std::min)(m_list[i].data.duration / 10, 1)
-                    && m_list[i].data.duration == m_list[i-1].data.duration) {
+                    && list(i).duration > 0
+                    && list(i).pts != AV_NOPTS_VALUE
+                    && list(i).dts != AV_NOPTS_VALUE
+                    && list(i).pts - list(i-1).pts <= (std::min)(list(i).duration / 10, 1)
+                    && list(i).dts - list(i-1).dts <= (std::min)(list(i).duration / 10, 1)
+                    && list(i).duration == list(i-1).duration) {
                     nDuplicateFrameInfo++;
                 }
             }
-            int nDuration = m_list[i].data.duration;
+            int nDuration = list(i).duration;
             auto target = std::find_if(durationHistgram.begin(), durationHistgram.end(), [nDuration](const std::pair<int, int>& pair) { return pair.first == nDuration; });
             if (target != durationHistgram.end()) {
                 target->second++;
@@ -451,7 +557,7 @@ public:
         } else {
             m_frameDuration = durationHintifPtsAllInvalid;
             if (nInvalidPtsCount >= nInputPacketCount - 1) {
-                if (m_list[0].data.duration || durationHintifPtsAllInvalid > 0.0) {
+                if (list(0).duration || durationHintifPtsAllInvalid > 0.0) {
                     //durationが得られていれば、durationに基づいて、cfrでptsを発行する
                     //主にH.264/HEVCのESなど
                     m_streamPtsStatus |= RGY_PTS_ALL_INVALID;
@@ -481,16 +587,16 @@ public:
         }
         if ((m_streamPtsStatus & RGY_PTS_ALL_INVALID)) {
             auto& mostPopularDuration = durationHistgram[durationHistgram.size() > 1 && durationHistgram[0].first == 0];
-            if ((m_frameDuration > 0.0 && m_list[0].data.duration == 0) || mostPopularDuration.first == 0) {
+            if ((m_frameDuration > 0.0 && list(0).duration == 0) || mostPopularDuration.first == 0) {
                 //主にH.264/HEVCのESなど向けの対策
-                m_list[0].data.duration = (int)(m_frameDuration * ((m_list[0].data.pic_struct & RGY_PICSTRUCT_FIELD) ? 0.5 : 1.0) + 0.5);
+                list(0).duration = (int)(m_frameDuration * ((list(0).pic_struct & RGY_PICSTRUCT_FIELD) ? 0.5 : 1.0) + 0.5);
             } else {
                 //durationのヒストグラムを作成
                 m_frameDuration = durationHistgram[durationHistgram.size() > 1 && durationHistgram[0].first == 0].first;
             }
             // 先頭のフレームには時刻があれば、その時刻を先頭のptsとして計算するようにする "Hard Target.mkv"等
-            if (m_list[0].data.pts != AV_NOPTS_VALUE) {
-                m_ptsAllInvalidPtsStartPointPts = m_list[0].data.pts;
+            if (list(0).pts != AV_NOPTS_VALUE) {
+                m_ptsAllInvalidPtsStartPointPts = list(0).pts;
                 m_ptsAllInvalidPtsStartPointIndex = 0;
             }
         }
@@ -500,15 +606,15 @@ public:
         sortPts(m_nextFixNumIndex, nInputPacketCount - m_nextFixNumIndex);
         setPocAndFix(nInputPacketCount);
         if (m_nextFixNumIndex > 1) {
-            int64_t pts0 = m_list[0].data.pts;
-            int64_t pts1 = m_list[1 + (m_list[0].data.poc == -1)].data.pts;
+            int64_t pts0 = list(0).pts;
+            int64_t pts1 = list(1 + (list(0).poc == -1)).pts;
             m_ptsWrapArroundThreshold = (uint32_t)clamp((int64_t)(std::max)((uint32_t)(pts1 - pts0), (uint32_t)(m_frameDuration + 0.5)) * 360, 360, (int64_t)0xFFFFFFFF);
         }
     }
     RGY_PICSTRUCT getVideoPicStruct() {
-        const int nListSize = (int)m_list.size();
-        for (int i = 0; i < nListSize; i++) {
-            auto pic_struct = m_list[i].data.pic_struct;
+        const int nListSize = frameNum();
+        for (int i = (int)m_evicted; i < nListSize; i++) {
+            auto pic_struct = list(i).pic_struct;
             if (pic_struct & RGY_PICSTRUCT_INTERLACED) {
                 return (RGY_PICSTRUCT)(pic_struct & RGY_PICSTRUCT_INTERLACED);
             }
@@ -516,8 +622,66 @@ public:
         return RGY_PICSTRUCT_FRAME;
     }
 protected:
+    //indexの位置のコピーを取得する (破棄済みの場合は保持しておいたもの)
+    // m_mtxをロックした状態で呼ぶこと
+    bool copyAt(FramePos *pos, uint32_t index) {
+        if (index < m_evicted) {
+            auto it = m_pinned.find(index);
+            if (it == m_pinned.end()) {
+                return false;
+            }
+            *pos = it->second;
+            return true;
+        }
+        return m_list.copy(pos, index - m_evicted);
+    }
+    //[start, end)の範囲で、pts以上となる最初のインデックスを返す (範囲はptsでソート済みであること)
+    // m_mtxをロックした状態で呼ぶこと
+    uint32_t lowerBoundPts(int64_t pts, uint32_t start, uint32_t end) {
+        FramePos pos = framePosInit();
+        while (start < end) {
+            const uint32_t mid = start + (end - start) / 2;
+            if (copyAt(&pos, mid) && pos.pts < pts) {
+                start = mid + 1;
+            } else {
+                end = mid;
+            }
+        }
+        return start;
+    }
+    //確定したフレームのptsが前のフレームより小さい場合 (wrap aroundなど)、そこから先をソート済みの範囲とする
+    void updateSortedRange(int index) {
+        if (index > (int)m_sortedFrom && index > (int)m_evicted
+            && list(index).pts < list(index - 1).pts) {
+            m_sortedFrom = index;
+        }
+    }
+    //すべての参照側が十分に先に進んだら、古いフレーム情報を破棄する
+    void evict() {
+        if (!m_evictEnable || m_keepAll || m_consumerCount == 0) {
+            return;
+        }
+        int64_t limit = (std::min)((int)m_nextFixNumIndex, m_durationNum);
+        for (int i = 0; i < m_consumerCount; i++) {
+            limit = (std::min)(limit, (int64_t)m_consumerPos[i]);
+        }
+        limit -= FRAMEPOS_EVICT_MARGIN;
+        if (limit < (int64_t)m_evicted + FRAMEPOS_EVICT_CHUNK) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(m_mtx);
+        //破棄後も参照されるものは別途保持しておく
+        for (auto it = m_pinIndex.lower_bound(m_evicted); it != m_pinIndex.end() && *it < limit; it++) {
+            m_pinned[*it] = list(*it);
+        }
+        for (int64_t i = m_evicted; i < limit; i++) {
+            m_list.pop();
+        }
+        m_evicted = (uint32_t)limit;
+    }
     //ptsでソート
     void sortPts(uint32_t index, uint32_t len) {
+        index -= m_evicted;
 #if (!defined(_MSC_VER) && __cplusplus <= 201103) || defined(__NVCC__)
         FramePos *pStart = (FramePos *)m_list.get(index);
         FramePos *pEnd = (FramePos *)m_list.get(index + len);
@@ -530,96 +694,96 @@ protected:
     }
     //ptsの補正
     void adjustFrameInfo(uint32_t nIndex) {
-        if (m_list[nIndex].data.pts != AV_NOPTS_VALUE) {
-            m_ptsAllInvalidPtsStartPointPts = m_list[nIndex].data.pts;
+        if (list(nIndex).pts != AV_NOPTS_VALUE) {
+            m_ptsAllInvalidPtsStartPointPts = list(nIndex).pts;
             m_ptsAllInvalidPtsStartPointIndex = nIndex;
         }
         if (m_streamPtsStatus & RGY_PTS_SOMETIMES_INVALID) {
             if (m_streamPtsStatus & RGY_DTS_SOMETIMES_INVALID) {
                 //ptsもdtsはあてにならないので、durationから再構築する (ワンセグなど)
                 if (nIndex == 0) {
-                    if (m_list[nIndex].data.pts == AV_NOPTS_VALUE) {
-                        m_list[nIndex].data.pts = 0;
+                    if (list(nIndex).pts == AV_NOPTS_VALUE) {
+                        list(nIndex).pts = 0;
                     }
-                } else if (m_list[nIndex].data.pts == AV_NOPTS_VALUE) {
-                    m_list[nIndex].data.pts = m_list[nIndex-1].data.pts + m_list[nIndex-1].data.duration;
+                } else if (list(nIndex).pts == AV_NOPTS_VALUE) {
+                    list(nIndex).pts = list(nIndex-1).pts + list(nIndex-1).duration;
                 }
             } else {
                 //ptsはあてにならないので、dtsから再構築する (VC-1など)
-                int64_t firstFramePtsDtsDiff = m_list[0].data.pts - m_list[0].data.dts;
-                if (nIndex > 0 && m_list[nIndex].data.dts == AV_NOPTS_VALUE) {
-                    m_list[nIndex].data.dts = m_list[nIndex-1].data.dts + m_list[0].data.duration;
+                int64_t firstFramePtsDtsDiff = list(0).pts - list(0).dts;
+                if (nIndex > 0 && list(nIndex).dts == AV_NOPTS_VALUE) {
+                    list(nIndex).dts = list(nIndex-1).dts + list(0).duration;
                 }
-                m_list[nIndex].data.pts = m_list[nIndex].data.dts + firstFramePtsDtsDiff;
+                list(nIndex).pts = list(nIndex).dts + firstFramePtsDtsDiff;
             }
-        } else if (m_list[nIndex].data.pts == AV_NOPTS_VALUE) {
+        } else if (list(nIndex).pts == AV_NOPTS_VALUE) {
             if (nIndex == 0) {
-                m_list[nIndex].data.pts = 0;
-                m_list[nIndex].data.dts = 0;
+                list(nIndex).pts = 0;
+                list(nIndex).dts = 0;
             } else if (m_streamPtsStatus & RGY_PTS_ALL_INVALID) {
                 //AVPacketのもたらすptsが無効であれば、CFRを仮定して適当にptsとdurationを突っ込んでいく
-                const double frameDuration = m_frameDuration * ((m_list[0].data.pic_struct & RGY_PICSTRUCT_FIELD) ? 2.0 : 1.0);
-                m_list[nIndex].data.pts = m_ptsAllInvalidPtsStartPointPts + (int64_t)((nIndex - m_ptsAllInvalidPtsStartPointIndex) * frameDuration * ((m_list[nIndex].data.pic_struct & RGY_PICSTRUCT_FIELD) ? 0.5 : 1.0) + 0.5);
-                m_list[nIndex].data.dts = m_list[nIndex].data.pts;
+                const double frameDuration = m_frameDuration * ((list(0).pic_struct & RGY_PICSTRUCT_FIELD) ? 2.0 : 1.0);
+                list(nIndex).pts = m_ptsAllInvalidPtsStartPointPts + (int64_t)((nIndex - m_ptsAllInvalidPtsStartPointIndex) * frameDuration * ((list(nIndex).pic_struct & RGY_PICSTRUCT_FIELD) ? 0.5 : 1.0) + 0.5);
+                list(nIndex).dts = list(nIndex).pts;
             } else if (m_streamPtsStatus & RGY_PTS_NONKEY_INVALID) {
                 //キーフレーム以外のptsとdtsが無効な場合は、適当に推定する
-                double frameDuration = m_frameDuration * ((m_list[0].data.pic_struct & RGY_PICSTRUCT_FIELD) ? 2.0 : 1.0);
-                m_list[nIndex].data.pts = m_list[nIndex-1].data.pts + (int)(frameDuration * ((m_list[nIndex].data.pic_struct & RGY_PICSTRUCT_FIELD) ? 0.5 : 1.0) + 0.5);
-                m_list[nIndex].data.dts = m_list[nIndex-1].data.dts + (int)(frameDuration * ((m_list[nIndex].data.pic_struct & RGY_PICSTRUCT_FIELD) ? 0.5 : 1.0) + 0.5);
+                double frameDuration = m_frameDuration * ((list(0).pic_struct & RGY_PICSTRUCT_FIELD) ? 2.0 : 1.0);
+                list(nIndex).pts = list(nIndex-1).pts + (int)(frameDuration * ((list(nIndex).pic_struct & RGY_PICSTRUCT_FIELD) ? 0.5 : 1.0) + 0.5);
+                list(nIndex).dts = list(nIndex-1).dts + (int)(frameDuration * ((list(nIndex).pic_struct & RGY_PICSTRUCT_FIELD) ? 0.5 : 1.0) + 0.5);
             } else if (m_streamPtsStatus & RGY_PTS_HALF_INVALID) {
                 //ptsがないのは音声抽出で、正常に抽出されない問題が生じる
                 //半分PTSがないPAFFのような動画については、前のフレームからの補完を行う
-                if (m_list[nIndex].data.dts == AV_NOPTS_VALUE) {
-                    m_list[nIndex].data.dts = m_list[nIndex-1].data.dts + m_list[nIndex-1].data.duration;
+                if (list(nIndex).dts == AV_NOPTS_VALUE) {
+                    list(nIndex).dts = list(nIndex-1).dts + list(nIndex-1).duration;
                 }
-                m_list[nIndex].data.pts = m_list[nIndex-1].data.pts + m_list[nIndex-1].data.duration;
+                list(nIndex).pts = list(nIndex-1).pts + list(nIndex-1).duration;
             } else if (m_streamPtsStatus & RGY_PTS_NORMAL) {
-                if (m_list[nIndex].data.pts == AV_NOPTS_VALUE) {
-                    m_list[nIndex].data.pts = m_list[nIndex-1].data.pts + m_list[nIndex-1].data.duration;
+                if (list(nIndex).pts == AV_NOPTS_VALUE) {
+                    list(nIndex).pts = list(nIndex-1).pts + list(nIndex-1).duration;
                 }
             }
         }
         //最大ptsの更新
-        if (m_list[nIndex].data.pts != AV_NOPTS_VALUE) {
-            m_maxPts = std::max(m_maxPts, m_list[nIndex].data.pts);
+        if (list(nIndex).pts != AV_NOPTS_VALUE) {
+            m_maxPts = std::max(m_maxPts, list(nIndex).pts);
         }
     }
     //ソートにより確定したptsに対して、pocを設定する
     void setPoc(int index) {
         if ((m_streamPtsStatus & RGY_PTS_DUPLICATE)
-            && m_list[index].data.duration == 0
-            && m_list[index+1].data.pts - m_list[index].data.pts <= (std::min)(m_list[index+1].data.duration / 10, 1)
-            && m_list[index+1].data.dts - m_list[index].data.dts <= (std::min)(m_list[index+1].data.duration / 10, 1)) {
+            && list(index).duration == 0
+            && list(index+1).pts - list(index).pts <= (std::min)(list(index+1).duration / 10, 1)
+            && list(index+1).dts - list(index).dts <= (std::min)(list(index+1).duration / 10, 1)) {
             //VP8/VP9では重複するpts/dts/durationを持つフレームが存在することがあるが、これを無視する
-            m_list[index].data.poc = FRAMEPOS_POC_INVALID;
-        } else if (m_list[index].data.pic_struct & RGY_PICSTRUCT_FIELD) {
-            if (index > 0 && (m_list[index-1].data.poc != FRAMEPOS_POC_INVALID && (m_list[index-1].data.pic_struct & RGY_PICSTRUCT_FIELD))) {
-                m_list[index].data.poc = FRAMEPOS_POC_INVALID;
-                m_list[index-1].data.duration2 = m_list[index].data.duration;
+            list(index).poc = FRAMEPOS_POC_INVALID;
+        } else if (list(index).pic_struct & RGY_PICSTRUCT_FIELD) {
+            if (index > 0 && (list(index-1).poc != FRAMEPOS_POC_INVALID && (list(index-1).pic_struct & RGY_PICSTRUCT_FIELD))) {
+                list(index).poc = FRAMEPOS_POC_INVALID;
+                list(index-1).duration2 = list(index).duration;
             } else {
-                m_list[index].data.poc = m_lastPoc++;
+                list(index).poc = m_lastPoc++;
             }
         } else {
-            m_list[index].data.poc = m_lastPoc++;
+            list(index).poc = m_lastPoc++;
         }
     }
     //ソート後にindexのdurationを再計算する
     //ソートはindex+1まで確定している必要がある
     //ソート後のこの段階では、AV_NOPTS_VALUEはないものとする
     void adjustDurationAfterSort(int index) {
-        int diff = (int)(m_list[index+1].data.pts - m_list[index].data.pts);
+        int diff = (int)(list(index+1).pts - list(index).pts);
         if ((m_streamPtsStatus & RGY_PTS_DUPLICATE)
             && diff <= 1
-            && m_list[index].data.duration > 0
-            && m_list[index].data.pts != AV_NOPTS_VALUE
-            && m_list[index].data.dts != AV_NOPTS_VALUE
-            && m_list[index+1].data.duration == m_list[index].data.duration
-            && m_list[index+1].data.pts - m_list[index].data.pts <= (std::min)(m_list[index].data.duration / 10, 1)
-            && m_list[index+1].data.dts - m_list[index].data.dts <= (std::min)(m_list[index].data.duration / 10, 1)) {
+            && list(index).duration > 0
+            && list(index).pts != AV_NOPTS_VALUE
+            && list(index).dts != AV_NOPTS_VALUE
+            && list(index+1).duration == list(index).duration
+            && list(index+1).pts - list(index).pts <= (std::min)(list(index).duration / 10, 1)
+            && list(index+1).dts - list(index).dts <= (std::min)(list(index).duration / 10, 1)) {
             //VP8/VP9では重複するpts/dts/durationを持つフレームが存在することがあるが、これを無視する
-            m_list[index].data.duration = 0;
+            list(index).duration = 0;
         } else if (diff > 0) {
-            m_list[index].data.duration = diff;
+            list(index).duration = diff;
         }
     }
     //進捗表示用のdurationの計算を行う
@@ -627,7 +791,7 @@ protected:
     void calcDuration() {
         int nNonDurationCalculatedFrames = m_nextFixNumIndex - m_durationNum;
         if (nNonDurationCalculatedFrames >= 16) {
-            const auto *pos_fixed = m_list.get(m_durationNum);
+            const auto *pos_fixed = m_list.get(m_durationNum - m_evicted);
             int64_t duration = pos_fixed[nNonDurationCalculatedFrames-1].data.pts - pos_fixed[0].data.pts;
             if (duration < 0 || duration > m_ptsWrapArroundThreshold) {
                 duration = 0;
@@ -648,24 +812,29 @@ protected:
         int nSortFixedSize = nSortedSize - (int)AV_FRAME_MAX_REORDER - 1;
         m_nextFixNumIndex += m_PAFFRewind;
         for (; m_nextFixNumIndex < nSortFixedSize; m_nextFixNumIndex++) {
-            if (m_list[m_nextFixNumIndex].data.pts < m_firstKeyframePts //ソートの先頭のptsが塚下キーフレームの先頭のptsよりも小さいことがある(opengop)
+            if (list(m_nextFixNumIndex).pts < m_firstKeyframePts //ソートの先頭のptsが塚下キーフレームの先頭のptsよりも小さいことがある(opengop)
                 && m_nextFixNumIndex <= 16) { //wrap arroundの場合は除く
                 //これはフレームリストから取り除く
+                assert(m_evicted == 0);
                 m_list.pop();
                 m_nextFixNumIndex--;
                 nSortFixedSize--;
+                if (m_sortedFrom > 0) {
+                    m_sortedFrom--;
+                }
             } else {
                 adjustDurationAfterSort(m_nextFixNumIndex);
                 //ソートにより確定したptsに対して、pocとdurationを設定する
                 setPoc(m_nextFixNumIndex);
+                updateSortedRange(m_nextFixNumIndex);
             }
         }
         m_PAFFRewind = 0;
         //もし、現在のインデックスがフィールドデータの片割れなら、次のフィールドがくるまでdurationは確定しない
         //setPocでduration2が埋まるのを待つ必要がある
         if (m_nextFixNumIndex > 0
-            && (m_list[m_nextFixNumIndex-1].data.pic_struct & RGY_PICSTRUCT_FIELD)
-            && m_list[m_nextFixNumIndex-1].data.poc != FRAMEPOS_POC_INVALID) {
+            && (list(m_nextFixNumIndex-1).pic_struct & RGY_PICSTRUCT_FIELD)
+            && list(m_nextFixNumIndex-1).poc != FRAMEPOS_POC_INVALID) {
             m_nextFixNumIndex--;
             m_PAFFRewind = 1;
         }
@@ -673,7 +842,16 @@ protected:
 protected:
     double m_frameDuration; //CFRを仮定する際のフレーム長 (RGY_PTS_ALL_INVALID, RGY_PTS_NONKEY_INVALID, RGY_PTS_NONKEY_INVALID時有効)
     RGYQueueMPMP<FramePos, 1> m_list; //内部データサイズとFramePosのデータサイズを一致させるため、alignを1に設定
-    int m_nextFixNumIndex; //次にptsを確定させるフレームのインデックス
+    std::mutex m_mtx; //findpts/copyとevictの排他用
+    std::atomic<uint32_t> m_evicted; //破棄したフレーム情報の数 (m_listの先頭のインデックス)
+    std::atomic<bool> m_evictEnable; //古いフレーム情報の破棄を行うか (evictは読み込みスレッドから呼ばれる)
+    bool m_keepAll; //すべてのフレーム情報を保持する
+    std::set<uint32_t> m_pinIndex; //破棄後も参照されるフレームのインデックス
+    std::map<uint32_t, FramePos> m_pinned; //破棄後も参照されるフレームの情報
+    std::array<std::atomic<uint32_t>, FRAMEPOS_CONSUMER_MAX> m_consumerPos; //参照側ごとの参照位置
+    std::atomic<int> m_consumerCount; //参照側の数
+    std::atomic<uint32_t> m_sortedFrom; //これ以降の確定したフレームはptsでソートされている
+    std::atomic<int> m_nextFixNumIndex; //次にptsを確定させるフレームのインデックス
     bool m_inputFin; //入力が終了したことを示すフラグ
     int64_t m_duration; //m_durationNumのフレーム数分のdurationの総和
     int m_durationNum; //durationを計算したフレーム数
@@ -722,6 +900,17 @@ struct AVDemuxFormat {
     void close(RGYLog *log = nullptr);
 };
 
+//swデコードの処理時間の統計
+struct AVDemuxDecodeStats {
+    std::atomic<int64_t>      decodeTime;            //デコードにかかった時間 (us)
+    std::atomic<int>          decodeFrames;          //デコードしたフレーム数
+    int64_t                   convertTime;           //色空間変換にかかった時間 (us)
+    int                       decodeThreads;         //デコーダのスレッド数
+    int                       decodeThreadType;      //デコーダのスレッドの種類 (FF_THREAD_xxx)
+
+    AVDemuxDecodeStats() : decodeTime(0), decodeFrames(0), convertTime(0), decodeThreads(0), decodeThreadType(0) {};
+};
+
 struct AVDemuxVideo {
                                                      //動画は音声のみ抽出する場合でも同期のため参照することがあり、
                                                      //pCodecCtxのチェックだけでは読み込むかどうか判定できないので、
@@ -742,6 +931,7 @@ struct AVDemuxVideo {
     int                       extradataSize;         //動画のヘッダサイズ
     AVRational                nAvgFramerate;         //動画のフレームレート
     uint32_t                  findPosLastIdx;        //findpos用のindex
+    int                       findPosConsumer;       //findpos用のFramePosListの参照側の番号
 
     int                       nSampleGetCount;       //sampleをGetNextBitstreamで取得した数
     int                       decRFFStatus;          //swデコード時にRFF展開中かどうか
@@ -756,6 +946,10 @@ struct AVDemuxVideo {
     int                       hevcNaluLengthSize;
     bool                      hdr10plusMetadataCopy; //HDR10plusのメタ情報を取得する
     bool                      doviRpuCopy;           //dovi rpuのメタ情報を取得する
+    AVDemuxDecodeStats        decodeStats;           //swデコードの処理時間の統計
+#if !AV_CODEC_COPY_OPAQUE_AVAIL
+    std::map<int64_t, std::vector<std::shared_ptr<RGYFrameData>>> frameDataPending; //デコーダに送ったパケットのメタデータ (pts順)
+#endif //#if !AV_CODEC_COPY_OPAQUE_AVAIL
 
     RGY_SIMD                  simdCsp;               //使用するSIMD
 
@@ -775,9 +969,12 @@ struct AVDemuxThread {
     int                          threadInput;        //入力スレッドを使用する
     std::atomic<bool>            bAbortInput;        //読み込みスレッドに停止を通知する
     std::thread                  thInput;            //読み込みスレッド
+    std::thread                  thDecode;           //swデコードスレッド
+    std::atomic<bool>            decodeFin;          //swデコードスレッドが終了した
+    RGY_ERR                      decodeSts;          //swデコードスレッドの終了時の状態
     PerfQueueInfo               *queueInfo;          //キューの情報を格納する構造体
 
-    AVDemuxThread() : threadInput(0), bAbortInput(false), thInput(), queueInfo(nullptr) {};
+    AVDemuxThread() : threadInput(0), bAbortInput(false), thInput(), thDecode(), decodeFin(false), decodeSts(RGY_ERR_NONE), queueInfo(nullptr) {};
     ~AVDemuxThread() { close(); }
     void close(RGYLog *log = nullptr);
 };
@@ -790,10 +987,11 @@ struct AVDemuxer {
     std::vector<const AVChapter*> chapter;
     AVDemuxThread                 thread;
     RGYQueueMPMP<AVPacket*>       qVideoPkt;
+    RGYQueueMPMP<AVFrame*>        qVideoFrame;       //swデコードスレッドでデコード済みのフレーム
     std::deque<AVPacket*>         qStreamPktL1;
     RGYQueueMPMP<AVPacket*>       qStreamPktL2;
 
-    AVDemuxer() : format(), video(), frames(), stream(), chapter(), thread(), qVideoPkt(), qStreamPktL1(), qStreamPktL2() {};
+    AVDemuxer() : format(), video(), frames(), stream(), chapter(), thread(), qVideoPkt(), qVideoFrame(), qStreamPktL1(), qStreamPktL2() {};
 };
 
 class RGYInputAvcodecPrm : public RGYInputPrm {
@@ -893,6 +1091,10 @@ public:
     //フレーム情報構造へのポインタを返す
     FramePosList *GetFramePosList();
 
+    //参照の済んだ古いフレーム情報を破棄できるようにする
+    //外部からfindptsを使用する場合は、GetFramePosList()->addConsumer()で登録してから呼ぶこと
+    void EnableFramePosEvict();
+
     virtual rgy_rational<int> getInputTimebase() override;
 
     virtual bool rffAware() override;
@@ -919,8 +1121,9 @@ public:
     const AVMasteringDisplayMetadata *getMasteringDisplay() const;
     const AVContentLightMetadata *getContentLight() const;
 
-    RGYFrameDataHDR10plus *getHDR10plusMetaData(const AVFrame* frame);
-    RGYFrameDataHDR10plus *getHDR10plusMetaData(const AVPacket* pkt);
+    //パケット/フレームに付加されたフレームごとのメタデータを取得する
+    std::vector<std::shared_ptr<RGYFrameData>> getFrameData(const AVPacket *pkt);
+    std::vector<std::shared_ptr<RGYFrameData>> getFrameData(const AVFrame *frame);
     RGYFrameDataDOVIRpu *getDoviRpu(const AVFrame *frame);
 
     //seektoで指定された時刻の範囲内かチェックする
@@ -994,6 +1197,18 @@ protected:
     //読み込みスレッド関数
     RGY_ERR ThreadFuncRead(RGYParamThread threadParam);
 
+    //swデコードスレッド関数
+    RGY_ERR ThreadFuncDecode(RGYParamThread threadParam);
+
+    //パケットを送り、1フレーム分デコードする
+    RGY_ERR decodeFrame(AVFrame *frame);
+
+    //デコードスレッドで取得したフレームを返却する
+    void releaseDecodedFrame(AVFrame **frame);
+
+    //swデコーダのスレッド数と種類をCPUの構成から決める
+    void setDecodeThreads(const bool useDecodeThread, const bool lowLatency);
+
     //seektoで指定された時刻の範囲内かチェックする
     bool checkTimeSeekTo(int64_t pts, AVRational timebase, float marginSec);
     bool checkOtherTimeSeekTo(int64_t pts, const AVDemuxStream *stream);
@@ -32,6 +32,7 @@
 #pragma warning(disable:4456)
 #include "avisynth_c.h"
 #pragma warning(pop)
+#include <chrono>
 
 #define AVS_FUNCTYPE(x) typedef decltype(avs_ ## x)* func_avs_ ## x;
 
@@ -55,6 +56,10 @@ AVS_FUNCTYPE(is_444);
 
 #undef AVS_FUNCTYPE
 
+//Avisynth+ (interface 8以降) でのみ使用可能
+typedef size_t (AVSC_CC *func_avs_get_env_property)(AVS_ScriptEnvironment *, int);
+static const int RGY_AVS_AEP_FILTERCHAIN_THREADS = 4; //Prefetchで使用されるスレッド数
+
 #define AVS_FUNCDECL(x) func_avs_ ## x f_ ## x;
 #define AVS_FUNCINITNULL(x) f_ ## x(NULL)
 
@@ -77,6 +82,7 @@ struct avs_dll_t {
     AVS_FUNCDECL(is_420)
     AVS_FUNCDECL(is_422)
     AVS_FUNCDECL(is_444)
+    AVS_FUNCDECL(get_env_property)
 
     avs_dll_t() : h_avisynth(nullptr),
         AVS_FUNCINITNULL(invoke),
@@ -95,7 +101,8 @@ struct avs_dll_t {
         AVS_FUNCINITNULL(clip_get_error),
         AVS_FUNCINITNULL(is_420),
         AVS_FUNCINITNULL(is_422),
-        AVS_FUNCINITNULL(is_444) {
+        AVS_FUNCINITNULL(is_444),
+        AVS_FUNCINITNULL(get_env_property) {
 
         }
 };
@@ -142,6 +149,21 @@ RGYInputAvs::RGYInputAvs() :
     m_sAVSclip(nullptr),
     m_sAVSinfo(nullptr),
     m_sAvisynth(),
+    m_asyncWindow(0),
+    m_asyncSlot(),
+    m_asyncThreads(),
+    m_asyncMtx(),
+    m_cvAsyncRequest(),
+    m_cvAsyncReady(),
+    m_asyncNextRequest(0),
+    m_asyncConsumed(0),
+    m_asyncAbort(false),
+    m_scriptMtx(),
+    m_scriptSerialize(true),
+    m_directPlanes(false),
+    m_scriptTime(0),
+    m_stallTime(0),
+    m_convertTime(0),
 #if ENABLE_AVSW_READER
     m_audio(),
     m_format(unique_ptr<AVFormatContext, decltype(&avformat_free_context)>(nullptr, &avformat_free_context)),
@@ -216,6 +238,7 @@ RGY_ERR RGYInputAvs::load_avisynth(const tstring &avsdll) {
     LOAD_FUNC(is_420, false, nullptr);
     LOAD_FUNC(is_422, false, nullptr);
     LOAD_FUNC(is_444, false, nullptr);
+    LOAD_FUNC(get_env_property, false, nullptr);
 #if defined(__GNUC__) || defined(__clang__)
 #pragma warning(pop)
 #endif
@@ -337,8 +360,15 @@ std::vector<AVPacket*> RGYInputAvs::GetStreamDataPackets(int inputFrame) {
     pkt->stream_index = m_audio.begin()->index;
     pkt->flags = (pkt->flags & 0xffff) | ((uint32_t)m_audio.begin()->trackId << 16); //flagsの上位16bitには、trackIdへのポインタを格納しておく
 
+    std::unique_lock<std::mutex> scriptLock(m_scriptMtx, std::defer_lock);
+    if (m_scriptSerialize) {
+        scriptLock.lock();
+    }
     m_sAvisynth->f_get_audio(m_sAVSclip, pkt->data, m_audioCurrentSample, samples);
     const auto avs_err = m_sAvisynth->f_clip_get_error(m_sAVSclip);
+    if (scriptLock.owns_lock()) {
+        scriptLock.unlock();
+    }
     if (avs_err) {
         AddMessage(RGY_LOG_ERROR, _T("Unknown error when reading audio frame from avisynth: %d.\n"), avs_err);
         return pkts;
@@ -496,6 +526,13 @@ RGY_ERR RGYInputAvs::Init(const TCHAR *strFileName, VideoInfo *pInputInfo, const
         m_inputVideoInfo.frames = std::numeric_limits<decltype(m_inputVideoInfo.frames)>::max();
     }
     m_inputVideoInfo.frames = std::min(m_inputVideoInfo.frames, m_sAVSinfo->num_frames);
+    //Avisynthのフレームの各プレーンをそのままGPUへ転送できる場合は、CPUでの変換を行わない
+    m_directPlanes = directPlanesAvailable();
+    if (m_directPlanes) {
+        AddMessage(RGY_LOG_DEBUG, _T("Passing Avisynth frames directly (%s), conversion to %s will be done on GPU.\n"),
+            RGY_CSP_NAMES[m_inputCsp], RGY_CSP_NAMES[m_inputVideoInfo.csp]);
+        m_inputVideoInfo.csp = m_inputCsp;
+    }
     m_inputVideoInfo.bitdepth = RGY_CSP_BIT_DEPTH[m_inputVideoInfo.csp];
     if (cspShiftUsed(m_inputVideoInfo.csp) && RGY_CSP_BIT_DEPTH[m_inputVideoInfo.csp] > RGY_CSP_BIT_DEPTH[m_inputCsp]) {
         m_inputVideoInfo.bitdepth = RGY_CSP_BIT_DEPTH[m_inputCsp];
@@ -537,15 +574,136 @@ RGY_ERR RGYInputAvs::Init(const TCHAR *strFileName, VideoInfo *pInputInfo, const
     }
     m_sAvisynth->f_release_value(val_version);
 
-    CreateInputInfo(avisynth_version.c_str(), RGY_CSP_NAMES[m_convert->getFunc()->csp_from], RGY_CSP_NAMES[m_convert->getFunc()->csp_to], get_simd_str(m_convert->getFunc()->simd), &m_inputVideoInfo);
+    //Prefetchが使用されている場合は、そのスレッド数分のフレームを並列に要求する
+    //使用されていない場合は、スクリプトを複数のスレッドから呼ぶのは安全でないので1フレームずつ要求する
+    int prefetchThreads = 0;
+    if (m_sAvisynth->f_get_env_property) {
+        prefetchThreads = (int)m_sAvisynth->f_get_env_property(m_sAVSenv, RGY_AVS_AEP_FILTERCHAIN_THREADS);
+    }
+    AddMessage(RGY_LOG_DEBUG, _T("Prefetch threads: %d.\n"), prefetchThreads);
+    m_scriptSerialize = prefetchThreads <= 1;
+    initAsync(std::min(std::max(prefetchThreads, 1), RGY_AVS_MAX_ASYNC_FRAMES));
+
+    if (m_directPlanes) {
+        CreateInputInfo(avisynth_version.c_str(), RGY_CSP_NAMES[m_inputCsp], RGY_CSP_NAMES[m_inputVideoInfo.csp], _T("direct"), &m_inputVideoInfo);
+    } else {
+        CreateInputInfo(avisynth_version.c_str(), RGY_CSP_NAMES[m_convert->getFunc()->csp_from], RGY_CSP_NAMES[m_convert->getFunc()->csp_to], get_simd_str(m_convert->getFunc()->simd), &m_inputVideoInfo);
+    }
     AddMessage(RGY_LOG_DEBUG, m_inputInfo);
     *pInputInfo = m_inputVideoInfo;
     return RGY_ERR_NONE;
 }
 #pragma warning(pop)
 
+void RGYInputAvs::initAsync(int window) {
+    closeAsync();
+    m_asyncWindow = window;
+    m_asyncSlot.resize(m_asyncWindow);
+    for (auto& slot : m_asyncSlot) {
+        slot.frame = nullptr;
+        slot.error = 0;
+        slot.ready = false;
+    }
+    m_asyncNextRequest = 0;
+    m_asyncConsumed = 0;
+    m_asyncAbort = false;
+    for (int i = 0; i < m_asyncWindow; i++) {
+        m_asyncThreads.push_back(std::thread(&RGYInputAvs::threadFuncGetFrame, this));
+    }
+    AddMessage(RGY_LOG_DEBUG, _T("Started %d threads to request frames.\n"), m_asyncWindow);
+}
+
+void RGYInputAvs::closeAsync() {
+    {
+        std::lock_guard<std::mutex> lock(m_asyncMtx);
+        m_asyncAbort = true;
+    }
+    m_cvAsyncRequest.notify_all();
+    for (auto& th : m_asyncThreads) {
+        th.join();
+    }
+    m_asyncThreads.clear();
+    //受け取られなかったフレームを解放する
+    for (auto& slot : m_asyncSlot) {
+        if (slot.frame) {
+            m_sAvisynth->f_release_video_frame(slot.frame);
+            slot.frame = nullptr;
+        }
+        slot.ready = false;
+    }
+    m_asyncSlot.clear();
+    m_asyncWindow = 0;
+}
+
+void RGYInputAvs::threadFuncGetFrame() {
+    std::unique_lock<std::mutex> lock(m_asyncMtx);
+    for (;;) {
+        //受け取り済みのフレームからm_asyncWindow先までを要求する
+        m_cvAsyncRequest.wait(lock, [this]() {
+            return m_asyncAbort
+                || (m_asyncNextRequest < m_inputVideoInfo.frames && m_asyncNextRequest < m_asyncConsumed + m_asyncWindow);
+        });
+        if (m_asyncAbort) {
+            break;
+        }
+        const int n = m_asyncNextRequest++;
+        lock.unlock();
+
+        std::unique_lock<std::mutex> scriptLock(m_scriptMtx, std::defer_lock);
+        if (m_scriptSerialize) {
+            scriptLock.lock(); //音声の取得と同時に呼ばないようにする
+        }
+        const auto timeStart = std::chrono::steady_clock::now();
+        AVS_VideoFrame *frame = m_sAvisynth->f_get_frame(m_sAVSclip, n);
+        const int error = m_sAvisynth->f_clip_get_error(m_sAVSclip) ? 1 : 0;
+        if (scriptLock.owns_lock()) {
+            scriptLock.unlock();
+        }
+        const auto scriptTime = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - timeStart).count();
+
+        lock.lock();
+        auto& slot = m_asyncSlot[n % m_asyncWindow];
+        slot.frame = frame;
+        slot.error = error;
+        slot.ready = true;
+        m_scriptTime += scriptTime;
+        m_cvAsyncReady.notify_all();
+    }
+}
+
+AVS_VideoFrame *RGYInputAvs::getAsyncFrame(int n, RGY_ERR& err) {
+    err = RGY_ERR_NONE;
+    std::unique_lock<std::mutex> lock(m_asyncMtx);
+    auto& slot = m_asyncSlot[n % m_asyncWindow];
+    if (!slot.ready) {
+        //スクリプト側の処理待ち
+        const auto waitStart = std::chrono::steady_clock::now();
+        m_cvAsyncReady.wait(lock, [&slot]() { return slot.ready; });
+        m_stallTime += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - waitStart).count();
+    }
+    AVS_VideoFrame *frame = slot.frame;
+    if (slot.error) {
+        err = RGY_ERR_UNKNOWN;
+    }
+    slot.frame = nullptr;
+    slot.ready = false;
+    m_asyncConsumed = n + 1;
+    lock.unlock();
+    m_cvAsyncRequest.notify_all();
+    return frame;
+}
+
 void RGYInputAvs::Close() {
     AddMessage(RGY_LOG_DEBUG, _T("Closing...\n"));
+    if (m_asyncWindow > 0) {
+        AddMessage(RGY_LOG_DEBUG, _T("window %d, script %.1f ms (sum of all threads), stalled %.1f ms, convert %.1f ms.\n"),
+            m_asyncWindow, m_scriptTime / 1000.0, m_stallTime / 1000.0, m_convertTime / 1000.0);
+    }
+    closeAsync();
+    m_directPlanes = false;
+    m_scriptTime = 0;
+    m_stallTime = 0;
+    m_convertTime = 0;
 #if ENABLE_AVSW_READER
     m_format.reset();
 #endif //#if ENABLE_AVSW_READER
@@ -571,26 +729,46 @@ RGY_ERR RGYInputAvs::LoadNextFrameInternal(RGYFrame *pSurface) {
         return RGY_ERR_MORE_DATA;
     }
 
-    AVS_VideoFrame *frame = m_sAvisynth->f_get_frame(m_sAVSclip, m_encSatusInfo->m_sData.frameIn);
+    RGY_ERR avs_err = RGY_ERR_NONE;
+    AVS_VideoFrame *frame = getAsyncFrame((int)m_encSatusInfo->m_sData.frameIn, avs_err);
+    if (avs_err != RGY_ERR_NONE) {
+        AddMessage(RGY_LOG_ERROR, _T("Unknown error when reading video frame %d from avisynth.\n"), (int)m_encSatusInfo->m_sData.frameIn);
+        if (frame) {
+            m_sAvisynth->f_release_video_frame(frame);
+        }
+        return RGY_ERR_UNKNOWN;
+    }
     if (frame == nullptr) {
         return RGY_ERR_MORE_DATA;
     }
-    auto avs_err = m_sAvisynth->f_clip_get_error(m_sAVSclip);
-    if (avs_err) {
-        AddMessage(RGY_LOG_ERROR, _T("Unknown error when reading video frame from avisynth: %d.\n"), avs_err);
-        return RGY_ERR_UNKNOWN;
-    }
 
-    void *dst_array[3];
-    pSurface->ptrArray(dst_array);
-    const void *src_array[3] = { m_sAvisynth->f_get_read_ptr_p(frame, AVS_PLANAR_Y), m_sAvisynth->f_get_read_ptr_p(frame, AVS_PLANAR_U), m_sAvisynth->f_get_read_ptr_p(frame, AVS_PLANAR_V) };
-
-    m_convert->run((m_inputVideoInfo.picstruct & RGY_PICSTRUCT_INTERLACED) ? 1 : 0,
-        dst_array, src_array,
-        m_inputVideoInfo.srcWidth, m_sAvisynth->f_get_pitch_p(frame, AVS_PLANAR_Y), m_sAvisynth->f_get_pitch_p(frame, AVS_PLANAR_U),
-        pSurface->pitch(), m_inputVideoInfo.srcHeight, m_inputVideoInfo.srcHeight, m_inputVideoInfo.crop.c);
-
-    m_sAvisynth->f_release_video_frame(frame);
+    if (m_directPlanes) {
+        //Avisynthのフレームはコピーせず、GPUへの転送が終了した後で解放する
+        RGYFrameInfo planes;
+        static const int avsPlanes[3] = { AVS_PLANAR_Y, AVS_PLANAR_U, AVS_PLANAR_V };
+        for (int i = 0; i < 3; i++) {
+            planes.ptr[i] = (uint8_t *)m_sAvisynth->f_get_read_ptr_p(frame, avsPlanes[i]);
+            planes.pitch[i] = m_sAvisynth->f_get_pitch_p(frame, avsPlanes[i]);
+        }
+        auto releaseFrame = m_sAvisynth->f_release_video_frame;
+        auto frameRef = std::shared_ptr<void>((void *)frame, [releaseFrame](void *ptr) {
+            releaseFrame((AVS_VideoFrame *)ptr);
+        });
+        pSurface->dataList().push_back(std::make_shared<RGYFrameDataHostRef>(planes, frameRef));
+    } else {
+        const auto timeStart = std::chrono::steady_clock::now();
+        void *dst_array[3];
+        pSurface->ptrArray(dst_array);
+        const void *src_array[3] = { m_sAvisynth->f_get_read_ptr_p(frame, AVS_PLANAR_Y), m_sAvisynth->f_get_read_ptr_p(frame, AVS_PLANAR_U), m_sAvisynth->f_get_read_ptr_p(frame, AVS_PLANAR_V) };
+
+        m_convert->run((m_inputVideoInfo.picstruct & RGY_PICSTRUCT_INTERLACED) ? 1 : 0,
+            dst_array, src_array,
+            m_inputVideoInfo.srcWidth, m_sAvisynth->f_get_pitch_p(frame, AVS_PLANAR_Y), m_sAvisynth->f_get_pitch_p(frame, AVS_PLANAR_U),
+            pSurface->pitch(), m_inputVideoInfo.srcHeight, m_inputVideoInfo.srcHeight, m_inputVideoInfo.crop.c);
+
+        m_sAvisynth->f_release_video_frame(frame);
+        m_convertTime += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - timeStart).count();
+    }
 
     m_encSatusInfo->m_sData.frameIn++;
     return m_encSatusInfo->UpdateDisplay();
@@ -34,6 +34,9 @@
 #pragma warning(push)
 #pragma warning(disable:4244)
 #pragma warning(disable:4456)
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include "rgy_osdep.h"
 #include "rgy_input.h"
 #pragma warning(pop)
@@ -41,8 +44,18 @@
 struct AVS_ScriptEnvironment;
 struct AVS_Clip;
 struct AVS_VideoInfo;
+struct AVS_VideoFrame;
 struct avs_dll_t;
 
+static const int RGY_AVS_MAX_ASYNC_FRAMES = 32; //同時に要求するフレーム数の上限
+
+//先行して要求したフレームの受け取り先
+struct RGYInputAvsAsyncSlot {
+    AVS_VideoFrame *frame;
+    int error;  //avs_clip_get_errorの結果
+    bool ready;
+};
+
 class RGYInputAvsPrm : public RGYInputPrm {
 public:
     int            nAudioSelectCount;       //muxする音声のトラック数
@@ -76,12 +89,34 @@ protected:
     RGY_ERR load_avisynth(const tstring& avsdll);
     void release_avisynth();
 
+    //複数のスレッドからフレームを先行して要求し、フレーム番号順に受け取る
+    void initAsync(int window);
+    void closeAsync();
+    void threadFuncGetFrame();
+    AVS_VideoFrame *getAsyncFrame(int n, RGY_ERR& err);
+
     AVS_ScriptEnvironment *m_sAVSenv;
     AVS_Clip *m_sAVSclip;
     const AVS_VideoInfo *m_sAVSinfo;
 
     std::unique_ptr<avs_dll_t> m_sAvisynth;
 
+    int m_asyncWindow;                         //先行して要求するフレーム数
+    std::vector<RGYInputAvsAsyncSlot> m_asyncSlot;
+    std::vector<std::thread> m_asyncThreads;
+    std::mutex m_asyncMtx;
+    std::condition_variable m_cvAsyncRequest;  //要求可能になったことの通知
+    std::condition_variable m_cvAsyncReady;    //フレームが完成したことの通知
+    int m_asyncNextRequest;                    //次に要求するフレーム番号
+    int m_asyncConsumed;                       //受け取り済みのフレーム数
+    bool m_asyncAbort;
+    std::mutex m_scriptMtx;                    //Prefetchなしの場合のスクリプト呼び出しの排他
+    bool m_scriptSerialize;
+    bool m_directPlanes;                       //Avisynthのフレームを変換せずにそのまま渡す
+    int64_t m_scriptTime;                      //avs_get_frameにかかった時間の合計 (us)
+    int64_t m_stallTime;                       //フレームの完成を待った時間 (us)
+    int64_t m_convertTime;                     //色空間変換にかかった時間 (us)
+
 #if ENABLE_AVSW_READER
     RGY_ERR InitAudio(const RGYInputAvsPrm *input_prm);
 
@@ -27,6 +27,9 @@
 
 #include <sstream>
 #include <fcntl.h>
+#if !(defined(_WIN32) || defined(_WIN64))
+#include <sys/stat.h>
+#endif
 #include "rgy_input_raw.h"
 
 #if ENABLE_RAW_READER
@@ -115,7 +118,9 @@ RGY_ERR RGYInputRaw::ParseY4MHeader(char *buf, VideoInfo *pInfo) {
 RGYInputRaw::RGYInputRaw() :
     m_fSource(NULL),
     m_nBufSize(0),
-    m_pBuffer() {
+    m_frameSize(0),
+    m_pBuffer(),
+    m_pipeReader() {
     m_readerName = _T("raw");
 }
 
@@ -124,12 +129,18 @@ RGYInputRaw::~RGYInputRaw() {
 }
 
 void RGYInputRaw::Close() {
+    if (m_pipeReader) {
+        //読み込みスレッドを先に終了させる
+        m_pipeReader->close();
+        m_pipeReader.reset();
+    }
     if (m_fSource) {
         fclose(m_fSource);
         m_fSource = NULL;
     }
     m_pBuffer.reset();
     m_nBufSize = 0;
+    m_frameSize = 0;
     RGYInput::Close();
 }
 
@@ -139,6 +150,7 @@ RGY_ERR RGYInputRaw::Init(const TCHAR *strFileName, VideoInfo *pInputInfo, const
 
     m_convert = std::make_unique<RGYConvertCSP>(prm->threadCsp, prm->threadParamCsp);
 
+    auto rawprm = dynamic_cast<const RGYInputPrmRaw *>(prm);
     bool use_stdin = _tcscmp(strFileName, _T("-")) == 0;
     if (use_stdin) {
         m_fSource = stdin;
@@ -158,6 +170,22 @@ RGY_ERR RGYInputRaw::Init(const TCHAR *strFileName, VideoInfo *pInputInfo, const
             AddMessage(RGY_LOG_DEBUG, _T("Opened file: \"%s\".\n"), strFileName);
         }
     }
+    //パイプ入力の場合は、専用のスレッドで大きな単位で読み込む
+    bool use_pipe = use_stdin;
+#if !(defined(_WIN32) || defined(_WIN64))
+    struct stat st;
+    if (!use_pipe && fstat(fileno(m_fSource), &st) == 0 && S_ISFIFO(st.st_mode)) {
+        use_pipe = true;
+    }
+#endif //#if !(defined(_WIN32) || defined(_WIN64))
+    if (use_pipe && rawprm) {
+        const int threadInput = (rawprm->threadInput == RGY_INPUT_THREAD_AUTO) ? (rawprm->lowLatency ? 0 : 1) : rawprm->threadInput;
+        use_pipe = threadInput > 0;
+    }
+    if (use_pipe) {
+        //読み込みスレッドはstdioを介さずに読み込むので、ヘッダの読み込みでstdioのバッファに先読みされないようにする
+        setvbuf(m_fSource, nullptr, _IONBF, 0);
+    }
 
     auto nOutputCSP = m_inputVideoInfo.csp; //RGYInputRawがエンコーダに渡すべき色空間
     m_inputCsp = RGY_CSP_YV12;
@@ -177,8 +205,7 @@ RGY_ERR RGYInputRaw::Init(const TCHAR *strFileName, VideoInfo *pInputInfo, const
         }
         m_inputCsp = m_inputVideoInfo.csp;
     } else {
-        auto rawprm = reinterpret_cast<const RGYInputPrmRaw *>(prm);
-        m_inputCsp = (rawprm->inputCsp == RGY_CSP_NA) ? RGY_CSP_YV12 : rawprm->inputCsp; //input-cspで指定されたraw読み込みの値
+        m_inputCsp = (rawprm == nullptr || rawprm->inputCsp == RGY_CSP_NA) ? RGY_CSP_YV12 : rawprm->inputCsp; //input-cspで指定されたraw読み込みの値
         m_inputVideoInfo.srcPitch = m_inputVideoInfo.srcWidth * (RGY_CSP_BIT_DEPTH[m_inputCsp] > 8 ? 2 : 1);
     }
 
@@ -245,6 +272,7 @@ RGY_ERR RGYInputRaw::Init(const TCHAR *strFileName, VideoInfo *pInputInfo, const
         AddMessage(RGY_LOG_ERROR, _T("Unknown color foramt.\n"));
         return RGY_ERR_INVALID_COLOR_FORMAT;
     }
+    m_frameSize = bufferSize;
     // 幅が割り切れない場合に備え、変換時にAVX2等で読みすぎて異常終了しないようにあらかじめ多めに確保する
     bufferSize += (ALIGN(m_inputVideoInfo.srcWidth, 128) - m_inputVideoInfo.srcWidth) * bytesPerPix(m_inputCsp);
     AddMessage(RGY_LOG_DEBUG, _T("%dx%d, pitch:%d, bufferSize:%d.\n"), m_inputVideoInfo.srcWidth, m_inputVideoInfo.srcHeight, m_inputVideoInfo.srcPitch, bufferSize);
@@ -263,10 +291,21 @@ RGY_ERR RGYInputRaw::Init(const TCHAR *strFileName, VideoInfo *pInputInfo, const
     if (cspShiftUsed(m_inputVideoInfo.csp) && RGY_CSP_BIT_DEPTH[m_inputVideoInfo.csp] > RGY_CSP_BIT_DEPTH[m_inputCsp]) {
         m_inputVideoInfo.bitdepth = RGY_CSP_BIT_DEPTH[m_inputCsp];
     }
-    m_pBuffer = std::shared_ptr<uint8_t>((uint8_t *)_aligned_malloc(bufferSize, 32), aligned_malloc_deleter());
-    if (!m_pBuffer) {
-        AddMessage(RGY_LOG_ERROR, _T("Failed to allocate input buffer.\n"));
-        return RGY_ERR_NULL_PTR;
+    if (use_pipe) {
+        m_pipeReader = std::make_unique<RGYPipeFrameReader>();
+        auto err = m_pipeReader->init(m_fSource, m_frameSize, bufferSize, m_inputVideoInfo.type == RGY_INPUT_FMT_Y4M,
+            (rawprm) ? rawprm->threadParamInput : RGYParamThread(), m_printMes);
+        if (err != RGY_ERR_NONE) {
+            AddMessage(RGY_LOG_ERROR, _T("Failed to start pipe reader: %s.\n"), get_err_mes(err));
+            return err;
+        }
+        AddMessage(RGY_LOG_DEBUG, _T("Started pipe reader thread, %d buffers, pipe size %d.\n"), m_pipeReader->frames(), m_pipeReader->pipeSize());
+    } else {
+        m_pBuffer = std::shared_ptr<uint8_t>((uint8_t *)_aligned_malloc(bufferSize, 32), aligned_malloc_deleter());
+        if (!m_pBuffer) {
+            AddMessage(RGY_LOG_ERROR, _T("Failed to allocate input buffer.\n"));
+            return RGY_ERR_NULL_PTR;
+        }
     }
 
     if (m_convert->getFunc(m_inputCsp, m_inputVideoInfo.csp, false, prm->simdCsp) == nullptr) {
@@ -281,78 +320,10 @@ RGY_ERR RGYInputRaw::Init(const TCHAR *strFileName, VideoInfo *pInputInfo, const
     return RGY_ERR_NONE;
 }
 
-RGY_ERR RGYInputRaw::LoadNextFrameInternal(RGYFrame *pSurface) {
-    if ((m_inputVideoInfo.frames > 0
-          &&(int)m_encSatusInfo->m_sData.frameIn >= m_inputVideoInfo.frames)
-        //m_encSatusInfo->m_nInputFramesがtrimの結果必要なフレーム数を大きく超えたら、エンコードを打ち切る
-        //ちょうどのところで打ち切ると他のストリームに影響があるかもしれないので、余分に取得しておく
-        || getVideoTrimMaxFramIdx() < (int)m_encSatusInfo->m_sData.frameIn - TRIM_OVERREAD_FRAMES) {
-        return RGY_ERR_MORE_DATA;
-    }
-
-    if (m_inputVideoInfo.type == RGY_INPUT_FMT_Y4M) {
-        uint8_t y4m_buf[8] = { 0 };
-        if (_fread_nolock(y4m_buf, 1, strlen("FRAME"), m_fSource) != strlen("FRAME")) {
-            AddMessage(RGY_LOG_DEBUG, _T("header1: finish.\n"));
-            return RGY_ERR_MORE_DATA;
-        }
-        if (memcmp(y4m_buf, "FRAME", strlen("FRAME")) != 0) {
-            AddMessage(RGY_LOG_DEBUG, _T("header2: finish.\n"));
-            return RGY_ERR_MORE_DATA;
-        }
-        int i;
-        for (i = 0; _fgetc_nolock(m_fSource) != '\n'; i++) {
-            if (i >= 64) {
-                AddMessage(RGY_LOG_DEBUG, _T("header3: finish.\n"));
-                return RGY_ERR_MORE_DATA;
-            }
-        }
-    }
-
-    uint32_t frameSize = 0;
-    switch (m_convert->getFunc()->csp_from) {
-    case RGY_CSP_NV12:
-    case RGY_CSP_YV12:
-        frameSize = m_inputVideoInfo.srcWidth * m_inputVideoInfo.srcHeight * 3 / 2; break;
-    case RGY_CSP_P010:
-        frameSize = m_inputVideoInfo.srcWidth * m_inputVideoInfo.srcHeight * 3; break;
-    case RGY_CSP_YUV422:
-        frameSize = m_inputVideoInfo.srcWidth * m_inputVideoInfo.srcHeight * 2; break;
-    case RGY_CSP_YUV444:
-        frameSize = m_inputVideoInfo.srcWidth * m_inputVideoInfo.srcHeight * 3; break;
-    case RGY_CSP_YV12_09:
-    case RGY_CSP_YV12_10:
-    case RGY_CSP_YV12_12:
-    case RGY_CSP_YV12_14:
-    case RGY_CSP_YV12_16:
-        frameSize = m_inputVideoInfo.srcWidth * m_inputVideoInfo.srcHeight * 3; break;
-    case RGY_CSP_YUV422_09:
-    case RGY_CSP_YUV422_10:
-    case RGY_CSP_YUV422_12:
-    case RGY_CSP_YUV422_14:
-    case RGY_CSP_YUV422_16:
-        frameSize = m_inputVideoInfo.srcWidth * m_inputVideoInfo.srcHeight * 4; break;
-    case RGY_CSP_YUV444_09:
-    case RGY_CSP_YUV444_10:
-    case RGY_CSP_YUV444_12:
-    case RGY_CSP_YUV444_14:
-    case RGY_CSP_YUV444_16:
-        frameSize = m_inputVideoInfo.srcWidth * m_inputVideoInfo.srcHeight * 6; break;
-    default:
-        AddMessage(RGY_LOG_ERROR, _T("Unknown color foramt.\n"));
-        return RGY_ERR_INVALID_COLOR_FORMAT;
-    }
-    if (frameSize != _fread_nolock(m_pBuffer.get(), 1, frameSize, m_fSource)) {
-        AddMessage(RGY_LOG_DEBUG, _T("fread: finish: %d.\n"), frameSize);
-        return RGY_ERR_MORE_DATA;
-    }
-
-    void *dst_array[3];
-    pSurface->ptrArray(dst_array);
-
-    const void *src_array[3];
-    src_array[0] = m_pBuffer.get();
+void RGYInputRaw::getSrcPlanes(const void *src_array[3], int& src_uv_pitch, const void *buffer) const {
+    src_array[0] = buffer;
     src_array[1] = (uint8_t *)src_array[0] + m_inputVideoInfo.srcPitch * m_inputVideoInfo.srcHeight;
+    src_array[2] = nullptr;
     switch (m_convert->getFunc()->csp_from) {
     case RGY_CSP_YV12:
     case RGY_CSP_YV12_09:
@@ -384,7 +355,7 @@ RGY_ERR RGYInputRaw::LoadNextFrameInternal(RGYFrame *pSurface) {
         break;
     }
 
-    int src_uv_pitch = m_inputVideoInfo.srcPitch;
+    src_uv_pitch = m_inputVideoInfo.srcPitch;
     switch (RGY_CSP_CHROMA_FORMAT[m_convert->getFunc()->csp_from]) {
     case RGY_CHROMAFMT_YUV422:
         src_uv_pitch >>= 1;
@@ -399,9 +370,64 @@ RGY_ERR RGYInputRaw::LoadNextFrameInternal(RGYFrame *pSurface) {
         src_uv_pitch >>= 1;
         break;
     }
+}
+
+RGY_ERR RGYInputRaw::LoadNextFrameInternal(RGYFrame *pSurface) {
+    if ((m_inputVideoInfo.frames > 0
+          &&(int)m_encSatusInfo->m_sData.frameIn >= m_inputVideoInfo.frames)
+        //m_encSatusInfo->m_nInputFramesがtrimの結果必要なフレーム数を大きく超えたら、エンコードを打ち切る
+        //ちょうどのところで打ち切ると他のストリームに影響があるかもしれないので、余分に取得しておく
+        || getVideoTrimMaxFramIdx() < (int)m_encSatusInfo->m_sData.frameIn - TRIM_OVERREAD_FRAMES) {
+        return RGY_ERR_MORE_DATA;
+    }
+
+    RGYPipeReaderFrame pipeFrame = { -1, nullptr };
+    const void *buffer = nullptr;
+    if (m_pipeReader) {
+        //読み込みスレッドで読み込み済みのフレームを取得する
+        if (auto err = m_pipeReader->get(&pipeFrame); err != RGY_ERR_NONE) {
+            return (err == RGY_ERR_ABORTED) ? RGY_ERR_MORE_DATA : err;
+        }
+        buffer = pipeFrame.data;
+    } else {
+        if (m_inputVideoInfo.type == RGY_INPUT_FMT_Y4M) {
+            uint8_t y4m_buf[8] = { 0 };
+            if (_fread_nolock(y4m_buf, 1, strlen("FRAME"), m_fSource) != strlen("FRAME")) {
+                AddMessage(RGY_LOG_DEBUG, _T("header1: finish.\n"));
+                return RGY_ERR_MORE_DATA;
+            }
+            if (memcmp(y4m_buf, "FRAME", strlen("FRAME")) != 0) {
+                AddMessage(RGY_LOG_DEBUG, _T("header2: finish.\n"));
+                return RGY_ERR_MORE_DATA;
+            }
+            int i;
+            for (i = 0; _fgetc_nolock(m_fSource) != '\n'; i++) {
+                if (i >= 64) {
+                    AddMessage(RGY_LOG_DEBUG, _T("header3: finish.\n"));
+                    return RGY_ERR_MORE_DATA;
+                }
+            }
+        }
+
+        if (m_frameSize != _fread_nolock(m_pBuffer.get(), 1, m_frameSize, m_fSource)) {
+            AddMessage(RGY_LOG_DEBUG, _T("fread: finish: %d.\n"), m_frameSize);
+            return RGY_ERR_MORE_DATA;
+        }
+        buffer = m_pBuffer.get();
+    }
+
+    void *dst_array[3];
+    pSurface->ptrArray(dst_array);
+
+    const void *src_array[3];
+    int src_uv_pitch = m_inputVideoInfo.srcPitch;
+    getSrcPlanes(src_array, src_uv_pitch, buffer);
     m_convert->run((m_inputVideoInfo.picstruct & RGY_PICSTRUCT_INTERLACED) ? 1 : 0,
         dst_array, src_array, m_inputVideoInfo.srcWidth, m_inputVideoInfo.srcPitch,
         src_uv_pitch, pSurface->pitch(), m_inputVideoInfo.srcHeight, m_inputVideoInfo.srcHeight, m_inputVideoInfo.crop.c);
+    if (m_pipeReader) {
+        m_pipeReader->release(pipeFrame);
+    }
 
     m_encSatusInfo->m_sData.frameIn++;
     return m_encSatusInfo->UpdateDisplay();
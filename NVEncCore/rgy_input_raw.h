@@ -30,6 +30,7 @@
 #define __RGY_INPUT_RAW_H__
 
 #include "rgy_input.h"
+#include "rgy_pipe_reader.h"
 
 #if ENABLE_RAW_READER
 
@@ -38,8 +39,11 @@
 class RGYInputPrmRaw : public RGYInputPrm {
 public:
     RGY_CSP inputCsp;
+    int threadInput;                 //パイプ入力の読み込みスレッドを使用する
+    RGYParamThread threadParamInput; //読み込みスレッドのスレッドアフィニティ
+    bool lowLatency;
 
-    RGYInputPrmRaw(RGYInputPrm base) : RGYInputPrm(base), inputCsp(RGY_CSP_YV12) {};
+    RGYInputPrmRaw(RGYInputPrm base) : RGYInputPrm(base), inputCsp(RGY_CSP_YV12), threadInput(RGY_INPUT_THREAD_AUTO), threadParamInput(), lowLatency(false) {};
     virtual ~RGYInputPrmRaw() {};
 };
 
@@ -54,11 +58,14 @@ protected:
     virtual RGY_ERR Init(const TCHAR *strFileName, VideoInfo *pInputInfo, const RGYInputPrm *prm) override;
     virtual RGY_ERR LoadNextFrameInternal(RGYFrame *pSurface) override;
     RGY_ERR ParseY4MHeader(char *buf, VideoInfo *pInfo);
+    void getSrcPlanes(const void *src_array[3], int& src_uv_pitch, const void *buffer) const;
 
     FILE *m_fSource;
 
     uint32_t m_nBufSize;
+    uint32_t m_frameSize;
     shared_ptr<uint8_t> m_pBuffer;
+    std::unique_ptr<RGYPipeFrameReader> m_pipeReader; //パイプ入力を別スレッドで読み込む
 };
 
 #endif //ENABLE_RAW_READER
@@ -28,6 +28,15 @@
 #include "rgy_input_sm.h"
 
 #if ENABLE_SM_READER
+#if !(defined(_WIN32) || defined(_WIN64))
+#include <cerrno>
+#include <signal.h>
+
+//スロットを直接参照する場合の最小のスロット数
+//エンコード側では読み込み中のフレームのほかに、転送待ちのフレーム(パイプラインの段数分)と
+//処理中のフレームがスロットを参照するので、それより多くのスロットが必要
+static const uint32_t SM_RING_DIRECT_MIN_SLOTS = 8;
+#endif
 
 
 RGYInputSMPrm::RGYInputSMPrm(RGYInputPrm base) :
@@ -37,11 +46,16 @@ RGYInputSMPrm::RGYInputSMPrm(RGYInputPrm base) :
 }
 
 RGYInputSM::RGYInputSM() :
+#if defined(_WIN32) || defined(_WIN64)
     m_prm(),
     m_sm(),
     m_heBufEmpty(),
     m_heBufFilled(),
     m_parentProcess(NULL),
+#else
+    m_ring(),
+    m_directPlanes(false),
+#endif
     m_droppedInAviutl(0) {
     m_readerName = _T("sm");
 }
@@ -51,6 +65,7 @@ RGYInputSM::~RGYInputSM() {
 }
 
 void RGYInputSM::Close() {
+#if defined(_WIN32) || defined(_WIN64)
     for (size_t i = 0; i < m_heBufEmpty.size(); i++) {
         m_heBufEmpty[i] = NULL;
     }
@@ -61,6 +76,13 @@ void RGYInputSM::Close() {
     for (auto& mem : m_sm) {
         mem.reset();
     }
+#else
+    if (m_ring && m_ring->is_open()) {
+        __atomic_store_n(&ringHeader()->consumerPid, 0u, __ATOMIC_RELEASE);
+    }
+    m_ring.reset();
+    m_directPlanes = false;
+#endif
     RGYInput::Close();
 }
 
@@ -69,63 +91,16 @@ rgy_rational<int> RGYInputSM::getInputTimebase() {
 }
 
 bool RGYInputSM::isAfs() {
+#if defined(_WIN32) || defined(_WIN64)
     RGYInputSMSharedData* prmsm = (RGYInputSMSharedData*)m_prm->ptr();
     return prmsm->afs;
+#else
+    return ringHeader()->afs != 0;
+#endif
 }
 
-#pragma warning(push)
-#pragma warning(disable: 4312) //'型キャスト': 'uint32_t' からより大きいサイズの 'HANDLE' へ変換します。
-RGY_ERR RGYInputSM::Init(const TCHAR *strFileName, VideoInfo *pInputInfo, const RGYInputPrm *prm) {
-    UNREFERENCED_PARAMETER(strFileName);
-    m_inputVideoInfo = *pInputInfo;
-
-    m_readerName = _T("sm");
-    if (m_timecode) {
-        AddMessage(RGY_LOG_WARN, _T("--tcfile-in ignored with sm reader.\n"));
-        m_timecode.reset();
-    }
-
-    m_convert = std::make_unique<RGYConvertCSP>(prm->threadCsp, prm->threadParamCsp);
-
-
-    const RGYInputSMPrm *prmSM = dynamic_cast<const RGYInputSMPrm *>(prm);
-
-    auto nOutputCSP = m_inputVideoInfo.csp;
-
-    m_prm = std::unique_ptr<RGYSharedMemWin>(new RGYSharedMemWin(strsprintf("%s_%08x", RGYInputSMPrmSM, prmSM->parentProcessID).c_str(), sizeof(RGYInputSMSharedData)));
-    if (!m_prm->is_open()) {
-        AddMessage(RGY_LOG_ERROR, _T("could not open params for input: %s.\n"), char_to_tstring(m_prm->name()).c_str());
-        return RGY_ERR_INVALID_HANDLE;
-    }
-    AddMessage(RGY_LOG_DEBUG, _T("Opened parameter struct %s, size: %u.\n"), char_to_tstring(m_prm->name()).c_str(), m_prm->size());
-
-    m_parentProcess = OpenProcess(SYNCHRONIZE | PROCESS_VM_READ, FALSE, prmSM->parentProcessID);
-    if (m_parentProcess == NULL) {
-        AddMessage(RGY_LOG_ERROR, _T("could not open parent process handle.\n"));
-        return RGY_ERR_INVALID_HANDLE;
-    }
-    AddMessage(RGY_LOG_DEBUG, _T("Parent process handle: 0x%08p.\n"), m_parentProcess);
-
-    RGYInputSMSharedData *prmsm = (RGYInputSMSharedData *)m_prm->ptr();
-    prmsm->pitch = ALIGN(prmsm->w, 128) * (RGY_CSP_BIT_DEPTH[prmsm->csp] > 8 ? 2 : 1);
-    m_inputVideoInfo.srcWidth = prmsm->w;
-    m_inputVideoInfo.srcHeight = prmsm->h;
-    m_inputVideoInfo.fpsN = prmsm->fpsN;
-    m_inputVideoInfo.fpsD = prmsm->fpsD;
-    m_inputVideoInfo.srcPitch = prmsm->pitch;
-    m_inputVideoInfo.picstruct = prmsm->picstruct;
-    m_inputVideoInfo.frames = prmsm->frames;
-    m_inputCsp = m_inputVideoInfo.csp = prmsm->csp;
-    for (size_t i = 0; i < m_heBufEmpty.size(); i++) {
-        m_heBufEmpty[i] = (HANDLE)prmsm->heBufEmpty[i];
-    }
-    for (size_t i = 0; i < m_heBufFilled.size(); i++) {
-        m_heBufFilled[i] = (HANDLE)prmsm->heBufFilled[i];
-    }
-    AddMessage(RGY_LOG_DEBUG, _T("Got event handle empty: 0x%08p, 0x%08p, filled: 0x%08p, 0x%08p\n"), m_heBufEmpty[0], m_heBufEmpty[1], m_heBufFilled[0], m_heBufFilled[1]);
-
+RGY_ERR RGYInputSM::initCsp(uint32_t& bufferSize, RGY_CSP nOutputCSP) {
     RGY_CSP output_csp_if_lossless = RGY_CSP_NA;
-    uint32_t bufferSize = 0;
     switch (m_inputCsp) {
     case RGY_CSP_NV12:
     case RGY_CSP_YV12:
@@ -201,6 +176,118 @@ RGY_ERR RGYInputSM::Init(const TCHAR *strFileName, VideoInfo *pInputInfo, const
     if (cspShiftUsed(m_inputVideoInfo.csp) && RGY_CSP_BIT_DEPTH[m_inputVideoInfo.csp] > RGY_CSP_BIT_DEPTH[m_inputCsp]) {
         m_inputVideoInfo.bitdepth = RGY_CSP_BIT_DEPTH[m_inputCsp];
     }
+    return RGY_ERR_NONE;
+}
+
+void RGYInputSM::getSrcPlanes(const void *src_array[3], int& src_uv_pitch, const void *buffer) const {
+    src_array[0] = buffer;
+    src_array[2] = nullptr;
+    src_array[1] = (uint8_t *)src_array[0] + m_inputVideoInfo.srcPitch * m_inputVideoInfo.srcHeight;
+    switch (m_inputCsp) {
+    case RGY_CSP_YV12:
+    case RGY_CSP_YV12_09:
+    case RGY_CSP_YV12_10:
+    case RGY_CSP_YV12_12:
+    case RGY_CSP_YV12_14:
+    case RGY_CSP_YV12_16:
+        src_array[2] = (uint8_t *)src_array[1] + m_inputVideoInfo.srcPitch * m_inputVideoInfo.srcHeight / 4;
+        break;
+    case RGY_CSP_YUV422:
+    case RGY_CSP_YUV422_09:
+    case RGY_CSP_YUV422_10:
+    case RGY_CSP_YUV422_12:
+    case RGY_CSP_YUV422_14:
+    case RGY_CSP_YUV422_16:
+        src_array[2] = (uint8_t *)src_array[1] + m_inputVideoInfo.srcPitch * m_inputVideoInfo.srcHeight / 2;
+        break;
+    case RGY_CSP_YUV444:
+    case RGY_CSP_YUV444_09:
+    case RGY_CSP_YUV444_10:
+    case RGY_CSP_YUV444_12:
+    case RGY_CSP_YUV444_14:
+    case RGY_CSP_YUV444_16:
+        src_array[2] = (uint8_t *)src_array[1] + m_inputVideoInfo.srcPitch * m_inputVideoInfo.srcHeight;
+        break;
+    case RGY_CSP_NV12:
+    case RGY_CSP_P010:
+    default:
+        break;
+    }
+
+    src_uv_pitch = m_inputVideoInfo.srcPitch;
+    switch (RGY_CSP_CHROMA_FORMAT[m_inputCsp]) {
+    case RGY_CHROMAFMT_YUV422:
+        src_uv_pitch >>= 1;
+        break;
+    case RGY_CHROMAFMT_YUV444:
+        break;
+    case RGY_CHROMAFMT_RGB:
+    case RGY_CHROMAFMT_RGB_PACKED:
+        break;
+    case RGY_CHROMAFMT_YUV420:
+    default:
+        src_uv_pitch >>= 1;
+        break;
+    }
+}
+
+#pragma warning(push)
+#pragma warning(disable: 4312) //'型キャスト': 'uint32_t' からより大きいサイズの 'HANDLE' へ変換します。
+RGY_ERR RGYInputSM::Init(const TCHAR *strFileName, VideoInfo *pInputInfo, const RGYInputPrm *prm) {
+    m_inputVideoInfo = *pInputInfo;
+
+    m_readerName = _T("sm");
+    if (m_timecode) {
+        AddMessage(RGY_LOG_WARN, _T("--tcfile-in ignored with sm reader.\n"));
+        m_timecode.reset();
+    }
+
+    m_convert = std::make_unique<RGYConvertCSP>(prm->threadCsp, prm->threadParamCsp);
+
+
+    const RGYInputSMPrm *prmSM = dynamic_cast<const RGYInputSMPrm *>(prm);
+
+    auto nOutputCSP = m_inputVideoInfo.csp;
+
+#if defined(_WIN32) || defined(_WIN64)
+    UNREFERENCED_PARAMETER(strFileName);
+    m_prm = std::unique_ptr<RGYSharedMemWin>(new RGYSharedMemWin(strsprintf("%s_%08x", RGYInputSMPrmSM, prmSM->parentProcessID).c_str(), sizeof(RGYInputSMSharedData)));
+    if (!m_prm->is_open()) {
+        AddMessage(RGY_LOG_ERROR, _T("could not open params for input: %s.\n"), char_to_tstring(m_prm->name()).c_str());
+        return RGY_ERR_INVALID_HANDLE;
+    }
+    AddMessage(RGY_LOG_DEBUG, _T("Opened parameter struct %s, size: %u.\n"), char_to_tstring(m_prm->name()).c_str(), m_prm->size());
+
+    m_parentProcess = OpenProcess(SYNCHRONIZE | PROCESS_VM_READ, FALSE, prmSM->parentProcessID);
+    if (m_parentProcess == NULL) {
+        AddMessage(RGY_LOG_ERROR, _T("could not open parent process handle.\n"));
+        return RGY_ERR_INVALID_HANDLE;
+    }
+    AddMessage(RGY_LOG_DEBUG, _T("Parent process handle: 0x%08p.\n"), m_parentProcess);
+
+    RGYInputSMSharedData *prmsm = (RGYInputSMSharedData *)m_prm->ptr();
+    prmsm->pitch = ALIGN(prmsm->w, 128) * (RGY_CSP_BIT_DEPTH[prmsm->csp] > 8 ? 2 : 1);
+    m_inputVideoInfo.srcWidth = prmsm->w;
+    m_inputVideoInfo.srcHeight = prmsm->h;
+    m_inputVideoInfo.fpsN = prmsm->fpsN;
+    m_inputVideoInfo.fpsD = prmsm->fpsD;
+    m_inputVideoInfo.srcPitch = prmsm->pitch;
+    m_inputVideoInfo.picstruct = prmsm->picstruct;
+    m_inputVideoInfo.frames = prmsm->frames;
+    m_inputCsp = m_inputVideoInfo.csp = prmsm->csp;
+    for (size_t i = 0; i < m_heBufEmpty.size(); i++) {
+        m_heBufEmpty[i] = (HANDLE)prmsm->heBufEmpty[i];
+    }
+    for (size_t i = 0; i < m_heBufFilled.size(); i++) {
+        m_heBufFilled[i] = (HANDLE)prmsm->heBufFilled[i];
+    }
+    AddMessage(RGY_LOG_DEBUG, _T("Got event handle empty: 0x%08p, 0x%08p, filled: 0x%08p, 0x%08p\n"), m_heBufEmpty[0], m_heBufEmpty[1], m_heBufFilled[0], m_heBufFilled[1]);
+
+    uint32_t bufferSize = 0;
+    auto err = initCsp(bufferSize, nOutputCSP);
+    if (err != RGY_ERR_NONE) {
+        return err;
+    }
 
     prmsm->bufSize = bufferSize;
     for (size_t i = 0; i < m_sm.size(); i++) {
@@ -218,6 +305,62 @@ RGY_ERR RGYInputSM::Init(const TCHAR *strFileName, VideoInfo *pInputInfo, const
         }
         AddMessage(RGY_LOG_DEBUG, _T("SetEvent: heBufEmpty[%d].\n"), i);
     }
+#else
+    //共有メモリはプロデューサ側が作成する
+    //名前は入力ファイル名で指定し、指定がなければ--parent-pidから決める
+    const auto memName = (strFileName != nullptr && _tcslen(strFileName) > 0 && _tcscmp(strFileName, _T("-")) != 0)
+        ? tchar_to_string(strFileName) : strsprintf("%s_%08x", RGYInputSMBuffer, prmSM->parentProcessID);
+    m_ring = std::make_shared<RGYSharedMemLinux>(memName.c_str(), 0);
+    if (!m_ring->is_open() || m_ring->size() < sizeof(RGYSMRingHeader)) {
+        AddMessage(RGY_LOG_ERROR, _T("could not open shared memory for input: %s.\n"), char_to_tstring(memName).c_str());
+        return RGY_ERR_INVALID_HANDLE;
+    }
+    AddMessage(RGY_LOG_DEBUG, _T("Opened shared memory %s, size: %llu.\n"), char_to_tstring(m_ring->name()).c_str(), (unsigned long long)m_ring->size());
+
+    auto header = ringHeader();
+    if (header->magic != RGY_SM_RING_MAGIC || header->version != RGY_SM_RING_VERSION || header->headerSize < sizeof(RGYSMRingHeader)) {
+        AddMessage(RGY_LOG_ERROR, _T("invalid shared memory header: magic 0x%08x, version %u, headerSize %u.\n"),
+            header->magic, header->version, header->headerSize);
+        return RGY_ERR_INVALID_FORMAT;
+    }
+    if (header->slots < 1 || header->slots > RGY_SM_RING_MAX_SLOTS
+        || header->dataOffset < header->headerSize
+        || (header->dataOffset % RGY_SM_RING_DATA_ALIGN) != 0
+        || header->dataOffset + header->slotSize * header->slots > m_ring->size()) {
+        AddMessage(RGY_LOG_ERROR, _T("invalid shared memory layout: slots %u, slotSize %llu, dataOffset %llu.\n"),
+            header->slots, (unsigned long long)header->slotSize, (unsigned long long)header->dataOffset);
+        return RGY_ERR_INVALID_FORMAT;
+    }
+    if (header->csp <= RGY_CSP_NA || header->csp >= RGY_CSP_COUNT) {
+        AddMessage(RGY_LOG_ERROR, _T("Unknown color foramt.\n"));
+        return RGY_ERR_INVALID_COLOR_FORMAT;
+    }
+    m_inputVideoInfo.srcWidth = header->width;
+    m_inputVideoInfo.srcHeight = header->height;
+    m_inputVideoInfo.fpsN = header->fpsN;
+    m_inputVideoInfo.fpsD = header->fpsD;
+    m_inputVideoInfo.srcPitch = header->pitch;
+    m_inputVideoInfo.picstruct = (RGY_PICSTRUCT)header->picstruct;
+    m_inputVideoInfo.frames = header->frames;
+    m_inputCsp = m_inputVideoInfo.csp = (RGY_CSP)header->csp;
+    if (header->pitch < header->width * (RGY_CSP_BIT_DEPTH[m_inputCsp] > 8 ? 2 : 1)) {
+        AddMessage(RGY_LOG_ERROR, _T("invalid pitch %d for width %d.\n"), header->pitch, header->width);
+        return RGY_ERR_INVALID_FORMAT;
+    }
+
+    uint32_t bufferSize = 0;
+    auto err = initCsp(bufferSize, nOutputCSP);
+    if (err != RGY_ERR_NONE) {
+        return err;
+    }
+    if (header->slotSize < bufferSize) {
+        AddMessage(RGY_LOG_ERROR, _T("slot size %llu is smaller than frame size %u.\n"), (unsigned long long)header->slotSize, bufferSize);
+        return RGY_ERR_INVALID_FORMAT;
+    }
+    __atomic_store_n(&header->consumerPid, (uint32_t)getpid(), __ATOMIC_RELEASE);
+    AddMessage(RGY_LOG_DEBUG, _T("slots: %u, slotSize: %llu, producer pid: %u.\n"),
+        header->slots, (unsigned long long)header->slotSize, header->producerPid);
+#endif
 
     if (m_convert->getFunc(m_inputCsp, m_inputVideoInfo.csp, false, prm->simdCsp) == nullptr) {
         AddMessage(RGY_LOG_ERROR, _T("sm: color conversion not supported: %s -> %s.\n"),
@@ -225,6 +368,21 @@ RGY_ERR RGYInputSM::Init(const TCHAR *strFileName, VideoInfo *pInputInfo, const
         return RGY_ERR_INVALID_COLOR_FORMAT;
     }
 
+#if !(defined(_WIN32) || defined(_WIN64))
+    //共有メモリ上のフレームの各プレーンをそのままGPUへ転送できる場合は、CPUでの変換を行わない
+    m_directPlanes = directPlanesAvailable();
+    if (m_directPlanes && ringHeader()->slots < SM_RING_DIRECT_MIN_SLOTS) {
+        //スロットが少ないと、エンコード側で参照中のスロットを待ち続けてしまう
+        AddMessage(RGY_LOG_DEBUG, _T("slots %u < %u, frames will be copied instead of passing directly.\n"), ringHeader()->slots, SM_RING_DIRECT_MIN_SLOTS);
+        m_directPlanes = false;
+    }
+    if (m_directPlanes) {
+        AddMessage(RGY_LOG_DEBUG, _T("Passing frames in shared memory directly (%s), conversion to %s will be done on GPU.\n"),
+            RGY_CSP_NAMES[m_inputCsp], RGY_CSP_NAMES[m_inputVideoInfo.csp]);
+        m_inputVideoInfo.csp = m_inputCsp;
+        CreateInputInfo(m_readerName.c_str(), RGY_CSP_NAMES[m_inputCsp], RGY_CSP_NAMES[m_inputVideoInfo.csp], _T("direct"), &m_inputVideoInfo);
+    } else
+#endif
     CreateInputInfo(m_readerName.c_str(), RGY_CSP_NAMES[m_convert->getFunc()->csp_from], RGY_CSP_NAMES[m_convert->getFunc()->csp_to], get_simd_str(m_convert->getFunc()->simd), &m_inputVideoInfo);
     AddMessage(RGY_LOG_DEBUG, m_inputInfo);
     *pInputInfo = m_inputVideoInfo;
@@ -238,6 +396,7 @@ RGY_ERR RGYInputSM::LoadNextFrameInternal(RGYFrame *pSurface) {
     if (getVideoTrimMaxFramIdx() < (int)m_encSatusInfo->m_sData.frameIn - TRIM_OVERREAD_FRAMES) {
         return RGY_ERR_MORE_DATA;
     }
+#if defined(_WIN32) || defined(_WIN64)
     RGYInputSMSharedData *prmsm = (RGYInputSMSharedData *)m_prm->ptr();
     if (prmsm->abort) {
         return RGY_ERR_MORE_DATA;
@@ -265,54 +424,8 @@ RGY_ERR RGYInputSM::LoadNextFrameInternal(RGYFrame *pSurface) {
     pSurface->ptrArray(dst_array);
 
     const void *src_array[3];
-    src_array[0] = m_sm[m_encSatusInfo->m_sData.frameIn & 1]->ptr();
-    src_array[1] = (uint8_t *)src_array[0] + m_inputVideoInfo.srcPitch * m_inputVideoInfo.srcHeight;
-    switch (m_convert->getFunc()->csp_from) {
-    case RGY_CSP_YV12:
-    case RGY_CSP_YV12_09:
-    case RGY_CSP_YV12_10:
-    case RGY_CSP_YV12_12:
-    case RGY_CSP_YV12_14:
-    case RGY_CSP_YV12_16:
-        src_array[2] = (uint8_t *)src_array[1] + m_inputVideoInfo.srcPitch * m_inputVideoInfo.srcHeight / 4;
-        break;
-    case RGY_CSP_YUV422:
-    case RGY_CSP_YUV422_09:
-    case RGY_CSP_YUV422_10:
-    case RGY_CSP_YUV422_12:
-    case RGY_CSP_YUV422_14:
-    case RGY_CSP_YUV422_16:
-        src_array[2] = (uint8_t *)src_array[1] + m_inputVideoInfo.srcPitch * m_inputVideoInfo.srcHeight / 2;
-        break;
-    case RGY_CSP_YUV444:
-    case RGY_CSP_YUV444_09:
-    case RGY_CSP_YUV444_10:
-    case RGY_CSP_YUV444_12:
-    case RGY_CSP_YUV444_14:
-    case RGY_CSP_YUV444_16:
-        src_array[2] = (uint8_t *)src_array[1] + m_inputVideoInfo.srcPitch * m_inputVideoInfo.srcHeight;
-        break;
-    case RGY_CSP_NV12:
-    case RGY_CSP_P010:
-    default:
-        break;
-    }
-
     int src_uv_pitch = m_inputVideoInfo.srcPitch;
-    switch (RGY_CSP_CHROMA_FORMAT[m_convert->getFunc()->csp_from]) {
-    case RGY_CHROMAFMT_YUV422:
-        src_uv_pitch >>= 1;
-        break;
-    case RGY_CHROMAFMT_YUV444:
-        break;
-    case RGY_CHROMAFMT_RGB:
-    case RGY_CHROMAFMT_RGB_PACKED:
-        break;
-    case RGY_CHROMAFMT_YUV420:
-    default:
-        src_uv_pitch >>= 1;
-        break;
-    }
+    getSrcPlanes(src_array, src_uv_pitch, m_sm[m_encSatusInfo->m_sData.frameIn & 1]->ptr());
     m_convert->run((m_inputVideoInfo.picstruct & RGY_PICSTRUCT_INTERLACED) ? 1 : 0,
         dst_array, src_array, m_inputVideoInfo.srcWidth, m_inputVideoInfo.srcPitch,
         src_uv_pitch, pSurface->pitch(), m_inputVideoInfo.srcHeight, m_inputVideoInfo.srcHeight, m_inputVideoInfo.crop.c);
@@ -325,6 +438,55 @@ RGY_ERR RGYInputSM::LoadNextFrameInternal(RGYFrame *pSurface) {
         AddMessage(RGY_LOG_ERROR, _T("Failed to set event!\n"));
         return RGY_ERR_UNKNOWN;
     }
+#else
+    auto header = ringHeader();
+    const uint32_t slotIdx = (uint32_t)(m_encSatusInfo->m_sData.frameIn % header->slots);
+    auto& slot = header->slot[slotIdx];
+    //書き込み済みのフレームは、abortが設定されていても読み込む
+    //前の周回のフレームをまだ参照している間はRGY_SM_SLOT_READINGなので、同じフレームを読み直すことはない
+    uint32_t state = 0;
+    while ((state = rgy_sm_load(&slot.state)) != RGY_SM_SLOT_FILLED) {
+        if (rgy_sm_load(&header->abort)) {
+            return RGY_ERR_MORE_DATA;
+        }
+        const auto producerPid = header->producerPid;
+        if (producerPid != 0 && kill((pid_t)producerPid, 0) != 0 && errno == ESRCH) {
+            AddMessage(RGY_LOG_ERROR, _T("Producer process has terminated!\n"));
+            return RGY_ERR_ABORTED;
+        }
+        rgy_sm_wait_while(&slot.state, state, 1000);
+    }
+    __atomic_store_n(&slot.state, (uint32_t)RGY_SM_SLOT_READING, __ATOMIC_RELAXED);
+
+    const void *src_array[3];
+    int src_uv_pitch = m_inputVideoInfo.srcPitch;
+    getSrcPlanes(src_array, src_uv_pitch, (uint8_t *)m_ring->ptr() + header->dataOffset + header->slotSize * slotIdx);
+
+    pSurface->setTimestamp(slot.timestamp);
+    pSurface->setDuration(slot.duration);
+    m_droppedInAviutl = slot.dropped;
+
+    if (m_directPlanes) {
+        //スロットはGPUへの転送が終了するまで使用し、その後プロデューサ側に返却する
+        RGYFrameInfo planes;
+        for (int i = 0; i < 3; i++) {
+            planes.ptr[i] = (uint8_t *)src_array[i];
+            planes.pitch[i] = (i == 0 || RGY_CSP_PLANES[m_inputCsp] == 2) ? m_inputVideoInfo.srcPitch : src_uv_pitch;
+        }
+        auto ring = m_ring;
+        auto slotRef = std::shared_ptr<void>((void *)src_array[0], [ring, slotIdx](void *) {
+            rgy_sm_store_wake(&((RGYSMRingHeader *)ring->ptr())->slot[slotIdx].state, RGY_SM_SLOT_EMPTY);
+        });
+        pSurface->dataList().push_back(std::make_shared<RGYFrameDataHostRef>(planes, slotRef));
+    } else {
+        void *dst_array[3];
+        pSurface->ptrArray(dst_array);
+        m_convert->run((m_inputVideoInfo.picstruct & RGY_PICSTRUCT_INTERLACED) ? 1 : 0,
+            dst_array, src_array, m_inputVideoInfo.srcWidth, m_inputVideoInfo.srcPitch,
+            src_uv_pitch, pSurface->pitch(), m_inputVideoInfo.srcHeight, m_inputVideoInfo.srcHeight, m_inputVideoInfo.crop.c);
+        rgy_sm_store_wake(&slot.state, RGY_SM_SLOT_EMPTY);
+    }
+#endif
     m_encSatusInfo->m_sData.frameIn++;
     return m_encSatusInfo->UpdateDisplay();
 }
@@ -31,6 +31,7 @@
 
 #include "rgy_input.h"
 #include "rgy_shared_mem.h"
+#include "rgy_sm_ring.h"
 
 static const char *RGYInputSMPrmSM       = "RGYInputSMPrmSM";
 static const char *RGYInputSMBuffer      = "RGYInputSMBuffer";
@@ -81,11 +82,22 @@ protected:
     virtual RGY_ERR Init(const TCHAR *strFileName, VideoInfo *pInputInfo, const RGYInputPrm *prm) override;
     virtual RGY_ERR LoadNextFrameInternal(RGYFrame *pSurface) override;
 
+    //入力フレームのバッファサイズを計算し、出力色空間を決定する
+    RGY_ERR initCsp(uint32_t& bufferSize, RGY_CSP nOutputCSP);
+    //バッファ内の各プレーンへのポインタを取得する
+    void getSrcPlanes(const void *src_array[3], int& src_uv_pitch, const void *buffer) const;
+
+#if defined(_WIN32) || defined(_WIN64)
     std::unique_ptr<RGYSharedMemWin> m_prm;
     std::array<std::unique_ptr<RGYSharedMem>,2> m_sm;
     std::array<HANDLE,2> m_heBufEmpty;
     std::array<HANDLE,2> m_heBufFilled;
     HANDLE m_parentProcess;
+#else
+    RGYSMRingHeader *ringHeader() const { return (RGYSMRingHeader *)m_ring->ptr(); }
+    std::shared_ptr<RGYSharedMem> m_ring; //読み込んだフレームの参照からも保持する
+    bool m_directPlanes; //共有メモリ上のフレームをそのままGPUへ転送する
+#endif
     int m_droppedInAviutl;
 };
 
@@ -32,6 +32,7 @@
 #include <sstream>
 #include <map>
 #include <fstream>
+#include <thread>
 
 
 RGYInputVpyPrm::RGYInputVpyPrm(RGYInputPrm base) :
@@ -41,19 +42,24 @@ RGYInputVpyPrm::RGYInputVpyPrm(RGYInputPrm base) :
 }
 
 RGYInputVpy::RGYInputVpy() :
-    m_pAsyncBuffer(),
-    m_hAsyncEventFrameSetFin(),
-    m_hAsyncEventFrameSetStart(),
+    m_asyncBuffer(),
     m_bAbortAsync(false),
     m_nCopyOfInputFrames(0),
     m_sVSapi(nullptr),
     m_sVSscript(nullptr),
     m_sVSnode(nullptr),
     m_nAsyncFrames(0),
+    m_prefetchDepth(1),
+    m_prefetchDepthMin(1),
+    m_prefetchDepthMax(1),
+    m_prefetchNoWait(0),
+    m_directPlanes(false),
+    m_asyncStart(),
+    m_asyncFramesDone(0),
+    m_asyncLastDoneTime(0),
+    m_waitTime(0),
     m_sVS() {
-    memset(m_pAsyncBuffer, 0, sizeof(m_pAsyncBuffer));
-    memset(m_hAsyncEventFrameSetFin,   0, sizeof(m_hAsyncEventFrameSetFin));
-    memset(m_hAsyncEventFrameSetStart, 0, sizeof(m_hAsyncEventFrameSetStart));
+    initAsyncBuffer();
     memset(&m_sVS, 0, sizeof(m_sVS));
     m_readerName = _T("vpy");
 }
@@ -119,50 +125,107 @@ int RGYInputVpy::load_vapoursynth(const tstring& vapoursynthpath) {
     return 0;
 }
 
-int RGYInputVpy::initAsyncEvents() {
-    for (int i = 0; i < _countof(m_hAsyncEventFrameSetFin); i++) {
-        if (   NULL == (m_hAsyncEventFrameSetFin[i]   = CreateEvent(NULL, FALSE, FALSE, NULL))
-            || NULL == (m_hAsyncEventFrameSetStart[i] = CreateEvent(NULL, FALSE, TRUE,  NULL)))
-            return 1;
+void RGYInputVpy::initAsyncBuffer() {
+    for (auto& slot : m_asyncBuffer) {
+        slot.frame.store(nullptr);
+        slot.state.store(VPY_SLOT_EMPTY);
     }
-    return 0;
+    m_asyncStart = std::chrono::steady_clock::now();
+    m_asyncFramesDone = 0;
+    m_asyncLastDoneTime = 0;
+    m_waitTime = 0;
 }
 
-void RGYInputVpy::closeAsyncEvents() {
+void RGYInputVpy::closeAsyncBuffer() {
     m_bAbortAsync = true;
-    for (int i_frame = m_nCopyOfInputFrames; i_frame < m_nAsyncFrames; i_frame++) {
+    //コールバックはthisを参照するので、要求済みのフレームはすべて受け取ってから解放する
+    for (int i_frame = (int)m_nCopyOfInputFrames; i_frame < m_nAsyncFrames; i_frame++) {
         const VSFrameRef *src_frame = getFrameFromAsyncBuffer(i_frame);
-        m_sVSapi->freeFrame(src_frame);
-    }
-    for (int i = 0; i < _countof(m_hAsyncEventFrameSetFin); i++) {
-        if (m_hAsyncEventFrameSetFin[i])
-            CloseEvent(m_hAsyncEventFrameSetFin[i]);
-        if (m_hAsyncEventFrameSetStart[i])
-            CloseEvent(m_hAsyncEventFrameSetStart[i]);
+        if (src_frame) {
+            m_sVSapi->freeFrame(src_frame);
+        }
     }
-    memset(m_hAsyncEventFrameSetFin,   0, sizeof(m_hAsyncEventFrameSetFin));
-    memset(m_hAsyncEventFrameSetStart, 0, sizeof(m_hAsyncEventFrameSetStart));
+    initAsyncBuffer();
     m_bAbortAsync = false;
 }
 
 #pragma warning(push)
 #pragma warning(disable:4100)
 void __stdcall frameDoneCallback(void *userData, const VSFrameRef *f, int n, VSNodeRef *, const char *errorMsg) {
-    reinterpret_cast<RGYInputVpy*>(userData)->setFrameToAsyncBuffer(n, f);
+    reinterpret_cast<RGYInputVpy*>(userData)->setFrameToAsyncBuffer(n, f, errorMsg);
 }
 #pragma warning(pop)
 
-void RGYInputVpy::setFrameToAsyncBuffer(int n, const VSFrameRef* f) {
-    WaitForSingleObject(m_hAsyncEventFrameSetStart[n & (ASYNC_BUFFER_SIZE-1)], INFINITE);
-    m_pAsyncBuffer[n & (ASYNC_BUFFER_SIZE-1)] = f;
-    SetEvent(m_hAsyncEventFrameSetFin[n & (ASYNC_BUFFER_SIZE-1)]);
+//VapourSynthのスレッドから呼ばれる
+void RGYInputVpy::setFrameToAsyncBuffer(int n, const VSFrameRef* f, const char *errorMsg) {
+    if (f == nullptr) {
+        AddMessage(RGY_LOG_ERROR, _T("Failed to get frame #%d: %s\n"), n, (errorMsg) ? char_to_tstring(errorMsg).c_str() : _T("unknown error"));
+    } else {
+        m_asyncFramesDone++;
+        const auto now = elapsedMicroSec();
+        auto prev = m_asyncLastDoneTime.load();
+        while (prev < now && !m_asyncLastDoneTime.compare_exchange_weak(prev, now)) {
+            ;
+        }
+    }
+    auto& slot = m_asyncBuffer[n & (ASYNC_BUFFER_SIZE-1)];
+    slot.frame.store(f, std::memory_order_relaxed);
+    slot.state.store(VPY_SLOT_READY, std::memory_order_release);
+}
 
-    if (m_nAsyncFrames < m_inputVideoInfo.frames && !m_bAbortAsync) {
+//フレームnまでと、その先の先読みの分のフレームを要求する
+//要求は読み込みスレッドからのみ行うので、m_nAsyncFramesは排他不要
+void RGYInputVpy::requestAsyncFrames(int n) {
+    const int requestFin = (std::min)(m_inputVideoInfo.frames, n + m_prefetchDepth);
+    for (; m_nAsyncFrames < requestFin && !m_bAbortAsync; m_nAsyncFrames++) {
+        m_asyncBuffer[m_nAsyncFrames & (ASYNC_BUFFER_SIZE-1)].state.store(VPY_SLOT_REQUESTED, std::memory_order_relaxed);
         m_sVSapi->getFrameAsync(m_nAsyncFrames, m_sVSnode, frameDoneCallback, this);
-        m_nAsyncFrames++;
     }
 }
 
+const VSFrameRef *RGYInputVpy::getFrameFromAsyncBuffer(int n) {
+    auto& slot = m_asyncBuffer[n & (ASYNC_BUFFER_SIZE-1)];
+    const bool waited = slot.state.load(std::memory_order_acquire) != VPY_SLOT_READY;
+    if (waited) {
+        const auto waitStart = elapsedMicroSec();
+        for (int i = 0; slot.state.load(std::memory_order_acquire) != VPY_SLOT_READY; i++) {
+            if (i < 1024) {
+                std::this_thread::yield();
+            } else {
+                std::this_thread::sleep_for(std::chrono::microseconds(200));
+            }
+        }
+        m_waitTime += elapsedMicroSec() - waitStart;
+    }
+    const VSFrameRef *frame = slot.frame.exchange(nullptr, std::memory_order_relaxed);
+    slot.state.store(VPY_SLOT_EMPTY, std::memory_order_relaxed);
+    updatePrefetchDepth(waited);
+    return frame;
+}
+
+//フレームを待機した場合は先読みを増やし、しばらく待機が発生しなければ減らす
+void RGYInputVpy::updatePrefetchDepth(bool waited) {
+    if (waited) {
+        m_prefetchNoWait = 0;
+        if (m_prefetchDepth < m_prefetchDepthMax) {
+            m_prefetchDepth++;
+            AddMessage(RGY_LOG_TRACE, _T("prefetch depth increased to %d.\n"), m_prefetchDepth);
+        }
+    } else if (++m_prefetchNoWait >= ASYNC_PREFETCH_DEC_FRAMES) {
+        m_prefetchNoWait = 0;
+        if (m_prefetchDepth > m_prefetchDepthMin) {
+            m_prefetchDepth--;
+            AddMessage(RGY_LOG_TRACE, _T("prefetch depth decreased to %d.\n"), m_prefetchDepth);
+        }
+    }
+}
+
+double RGYInputVpy::getScriptFps() const {
+    const auto frames = m_asyncFramesDone.load();
+    const auto duration = m_asyncLastDoneTime.load();
+    return (frames > 0 && duration > 0) ? frames * 1e6 / (double)duration : 0.0;
+}
+
 int RGYInputVpy::getRevInfo(const char *vsVersionString) {
     char *api_info = NULL;
     char buf[1024];
@@ -208,9 +271,6 @@ RGY_ERR RGYInputVpy::Init(const TCHAR *strFileName, VideoInfo *pInputInfo, const
     if (!m_sVS.init()) {
         AddMessage(RGY_LOG_ERROR, _T("VapourSynth Initialize Error.\n"));
         return RGY_ERR_NULL_PTR;
-    } else if (initAsyncEvents()) {
-        AddMessage(RGY_LOG_ERROR, _T("Failed to initialize async events.\n"));
-        return RGY_ERR_NULL_PTR;
     } else if ((m_sVSapi = m_sVS.getVSApi()) == nullptr) {
         AddMessage(RGY_LOG_ERROR, _T("Failed to get VapourSynth APIs.\n"));
         return RGY_ERR_NULL_PTR;
@@ -358,21 +418,34 @@ RGY_ERR RGYInputVpy::Init(const TCHAR *strFileName, VideoInfo *pInputInfo, const
         m_inputVideoInfo.frames = std::numeric_limits<decltype(m_inputVideoInfo.frames)>::max();
     }
     m_inputVideoInfo.frames = std::min(m_inputVideoInfo.frames, vsvideoinfo->numFrames);
+    //VapourSynthのフレームの各プレーンをそのままGPUへ転送できる場合は、CPUでの変換を行わない
+    m_directPlanes = directPlanesAvailable();
+    if (m_directPlanes) {
+        AddMessage(RGY_LOG_DEBUG, _T("Passing VapourSynth frames directly (%s), conversion to %s will be done on GPU.\n"),
+            RGY_CSP_NAMES[m_inputCsp], RGY_CSP_NAMES[m_inputVideoInfo.csp]);
+        m_inputVideoInfo.csp = m_inputCsp;
+    }
     m_inputVideoInfo.bitdepth = RGY_CSP_BIT_DEPTH[m_inputVideoInfo.csp];
     if (cspShiftUsed(m_inputVideoInfo.csp) && RGY_CSP_BIT_DEPTH[m_inputVideoInfo.csp] > RGY_CSP_BIT_DEPTH[m_inputCsp]) {
         m_inputVideoInfo.bitdepth = RGY_CSP_BIT_DEPTH[m_inputCsp];
     }
 
-    m_nAsyncFrames = vsvideoinfo->numFrames;
-    m_nAsyncFrames = (std::min)(m_nAsyncFrames, vscoreinfo.numThreads);
-    m_nAsyncFrames = (std::min)(m_nAsyncFrames, ASYNC_BUFFER_SIZE-1);
+    //先読みするフレーム数は、フレームの待機が発生した場合にスレッド数の2倍まで増やす
+    m_prefetchDepthMin = (std::min)((std::min)(vsvideoinfo->numFrames, vscoreinfo.numThreads), ASYNC_BUFFER_SIZE-1);
+    m_prefetchDepthMax = (std::min)((std::min)(vsvideoinfo->numFrames, vscoreinfo.numThreads * 2), ASYNC_BUFFER_SIZE-1);
     if (m_inputVideoInfo.type != RGY_INPUT_FMT_VPY_MT) {
-        m_nAsyncFrames = 1;
+        m_prefetchDepthMin = 1;
+        m_prefetchDepthMax = 1;
     }
+    m_prefetchDepthMin = (std::max)(m_prefetchDepthMin, 1);
+    m_prefetchDepthMax = (std::max)(m_prefetchDepthMax, m_prefetchDepthMin);
+    m_prefetchDepth = m_prefetchDepthMin;
+    m_prefetchNoWait = 0;
+    AddMessage(RGY_LOG_DEBUG, _T("prefetch depth: %d (max %d).\n"), m_prefetchDepthMin, m_prefetchDepthMax);
 
-    for (int i = 0; i < m_nAsyncFrames; i++) {
-        m_sVSapi->getFrameAsync(i, m_sVSnode, frameDoneCallback, this);
-    }
+    m_nAsyncFrames = 0;
+    initAsyncBuffer();
+    requestAsyncFrames(0);
 
     tstring vs_ver = _T("VapourSynth");
     if (m_inputVideoInfo.type == RGY_INPUT_FMT_VPY_MT) {
@@ -383,7 +456,11 @@ RGY_ERR RGYInputVpy::Init(const TCHAR *strFileName, VideoInfo *pInputInfo, const
         vs_ver += strsprintf(_T(" r%d"), rev);
     }
 
-    CreateInputInfo(vs_ver.c_str(), RGY_CSP_NAMES[m_convert->getFunc()->csp_from], RGY_CSP_NAMES[m_convert->getFunc()->csp_to], get_simd_str(m_convert->getFunc()->simd), &m_inputVideoInfo);
+    if (m_directPlanes) {
+        CreateInputInfo(vs_ver.c_str(), RGY_CSP_NAMES[m_inputCsp], RGY_CSP_NAMES[m_inputVideoInfo.csp], _T("direct"), &m_inputVideoInfo);
+    } else {
+        CreateInputInfo(vs_ver.c_str(), RGY_CSP_NAMES[m_convert->getFunc()->csp_from], RGY_CSP_NAMES[m_convert->getFunc()->csp_to], get_simd_str(m_convert->getFunc()->simd), &m_inputVideoInfo);
+    }
     AddMessage(RGY_LOG_DEBUG, m_inputInfo);
     *pInputInfo = m_inputVideoInfo;
     return RGY_ERR_NONE;
@@ -392,7 +469,11 @@ RGY_ERR RGYInputVpy::Init(const TCHAR *strFileName, VideoInfo *pInputInfo, const
 
 void RGYInputVpy::Close() {
     AddMessage(RGY_LOG_DEBUG, _T("Closing...\n"));
-    closeAsyncEvents();
+    if (m_nAsyncFrames > 0) {
+        AddMessage(RGY_LOG_DEBUG, _T("script: %.3f fps, wait for frames %.1f ms, prefetch depth %d.\n"),
+            getScriptFps(), m_waitTime / 1000.0, m_prefetchDepth);
+    }
+    closeAsyncBuffer();
     if (m_sVSapi && m_sVSnode)
         m_sVSapi->freeNode(m_sVSnode);
     if (m_sVSscript)
@@ -409,6 +490,9 @@ void RGYInputVpy::Close() {
     m_sVSscript = nullptr;
     m_sVSnode = nullptr;
     m_nAsyncFrames = 0;
+    m_prefetchDepth = 1;
+    m_prefetchNoWait = 0;
+    m_directPlanes = false;
     m_encSatusInfo.reset();
     AddMessage(RGY_LOG_DEBUG, _T("Closed.\n"));
 }
@@ -421,20 +505,37 @@ RGY_ERR RGYInputVpy::LoadNextFrameInternal(RGYFrame *pSurface) {
         return RGY_ERR_MORE_DATA;
     }
 
-    const VSFrameRef *src_frame = getFrameFromAsyncBuffer(m_encSatusInfo->m_sData.frameIn);
+    const int frameIn = (int)m_encSatusInfo->m_sData.frameIn;
+    requestAsyncFrames(frameIn);
+    const VSFrameRef *src_frame = getFrameFromAsyncBuffer(frameIn);
+    m_nCopyOfInputFrames = frameIn + 1; //このフレームは受け取り済み
     if (src_frame == nullptr) {
         return RGY_ERR_MORE_DATA;
     }
 
-    void *dst_array[3];
-    pSurface->ptrArray(dst_array);
-    const void *src_array[3] = { m_sVSapi->getReadPtr(src_frame, 0), m_sVSapi->getReadPtr(src_frame, 1), m_sVSapi->getReadPtr(src_frame, 2) };
-    m_convert->run((m_inputVideoInfo.picstruct & RGY_PICSTRUCT_INTERLACED) ? 1 : 0,
-        dst_array, src_array,
-        m_inputVideoInfo.srcWidth, m_sVSapi->getStride(src_frame, 0), m_sVSapi->getStride(src_frame, 1),
-        pSurface->pitch(), m_inputVideoInfo.srcHeight, m_inputVideoInfo.srcHeight, m_inputVideoInfo.crop.c);
+    if (m_directPlanes) {
+        //VapourSynthのフレームはGPUへの転送が終了するまで保持し、転送後に解放する
+        RGYFrameInfo planes;
+        for (int i = 0; i < 3; i++) {
+            planes.ptr[i] = (uint8_t *)m_sVSapi->getReadPtr(src_frame, i);
+            planes.pitch[i] = m_sVSapi->getStride(src_frame, i);
+        }
+        const VSAPI *vsapi = m_sVSapi;
+        auto frameRef = std::shared_ptr<void>((void *)src_frame, [vsapi](void *ptr) {
+            vsapi->freeFrame((const VSFrameRef *)ptr);
+        });
+        pSurface->dataList().push_back(std::make_shared<RGYFrameDataHostRef>(planes, frameRef));
+    } else {
+        void *dst_array[3];
+        pSurface->ptrArray(dst_array);
+        const void *src_array[3] = { m_sVSapi->getReadPtr(src_frame, 0), m_sVSapi->getReadPtr(src_frame, 1), m_sVSapi->getReadPtr(src_frame, 2) };
+        m_convert->run((m_inputVideoInfo.picstruct & RGY_PICSTRUCT_INTERLACED) ? 1 : 0,
+            dst_array, src_array,
+            m_inputVideoInfo.srcWidth, m_sVSapi->getStride(src_frame, 0), m_sVSapi->getStride(src_frame, 1),
+            pSurface->pitch(), m_inputVideoInfo.srcHeight, m_inputVideoInfo.srcHeight, m_inputVideoInfo.crop.c);
 
-    m_sVSapi->freeFrame(src_frame);
+        m_sVSapi->freeFrame(src_frame);
+    }
 
     m_encSatusInfo->m_sData.frameIn++;
     m_nCopyOfInputFrames = m_encSatusInfo->m_sData.frameIn;
@@ -31,6 +31,8 @@
 
 #include "rgy_version.h"
 #if ENABLE_VAPOURSYNTH_READER
+#include <atomic>
+#include <chrono>
 #include "rgy_osdep.h"
 #include "rgy_input.h"
 #include "VapourSynth.h"
@@ -38,6 +40,7 @@
 
 const int ASYNC_BUFFER_2N = 7;
 const int ASYNC_BUFFER_SIZE = 1<<ASYNC_BUFFER_2N;
+const int ASYNC_PREFETCH_DEC_FRAMES = 64; //この間待機がなければ先読みを減らす
 
 #if _M_IX86
 #define VPY_X64 0
@@ -79,6 +82,19 @@ public:
     virtual ~RGYInputVpyPrm() {};
 };
 
+//getFrameAsyncで要求したフレームを受け取るスロット
+//コールバック側が書き込み、読み込みスレッド側が取り出す (1対1なのでロックは不要)
+enum RGYInputVpySlotState : int {
+    VPY_SLOT_EMPTY = 0,
+    VPY_SLOT_REQUESTED,
+    VPY_SLOT_READY,
+};
+
+struct RGYInputVpyAsyncSlot {
+    std::atomic<const VSFrameRef *> frame;
+    std::atomic<int> state;
+};
+
 class RGYInputVpy : public RGYInput {
 public:
     RGYInputVpy();
@@ -86,24 +102,25 @@ public:
 
     virtual void Close() override;
 
-    void setFrameToAsyncBuffer(int n, const VSFrameRef* f);
+    void setFrameToAsyncBuffer(int n, const VSFrameRef* f, const char *errorMsg);
+
+    //スクリプトの処理速度 (fps)
+    double getScriptFps() const;
 protected:
     virtual RGY_ERR Init(const TCHAR *strFileName, VideoInfo *pInputInfo, const RGYInputPrm *prm) override;
     virtual RGY_ERR LoadNextFrameInternal(RGYFrame *pSurface) override;
 
     void release_vapoursynth();
     int load_vapoursynth(const tstring& vsdir);
-    int initAsyncEvents();
-    void closeAsyncEvents();
-    const VSFrameRef* getFrameFromAsyncBuffer(int n) {
-        WaitForSingleObject(m_hAsyncEventFrameSetFin[n & (ASYNC_BUFFER_SIZE-1)], INFINITE);
-        const VSFrameRef *frame = m_pAsyncBuffer[n & (ASYNC_BUFFER_SIZE-1)];
-        SetEvent(m_hAsyncEventFrameSetStart[n & (ASYNC_BUFFER_SIZE-1)]);
-        return frame;
+    void initAsyncBuffer();
+    void closeAsyncBuffer();
+    void requestAsyncFrames(int n);
+    const VSFrameRef* getFrameFromAsyncBuffer(int n);
+    void updatePrefetchDepth(bool waited);
+    int64_t elapsedMicroSec() const {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - m_asyncStart).count();
     }
-    const VSFrameRef* m_pAsyncBuffer[ASYNC_BUFFER_SIZE];
-    HANDLE m_hAsyncEventFrameSetFin[ASYNC_BUFFER_SIZE];
-    HANDLE m_hAsyncEventFrameSetStart[ASYNC_BUFFER_SIZE];
+    RGYInputVpyAsyncSlot m_asyncBuffer[ASYNC_BUFFER_SIZE];
 
     int getRevInfo(const char *vs_version_string);
 
@@ -113,7 +130,17 @@ protected:
     const VSAPI *m_sVSapi;
     VSScript *m_sVSscript;
     VSNodeRef *m_sVSnode;
-    int m_nAsyncFrames;
+    int m_nAsyncFrames;       //getFrameAsyncで要求したフレーム数
+    int m_prefetchDepth;      //現在の先読みフレーム数
+    int m_prefetchDepthMin;
+    int m_prefetchDepthMax;
+    int m_prefetchNoWait;     //連続して待機しなかったフレーム数
+    bool m_directPlanes;      //VapourSynthのフレームを変換せずにそのまま渡す
+
+    std::chrono::steady_clock::time_point m_asyncStart;
+    std::atomic<int> m_asyncFramesDone;       //スクリプトから取得できたフレーム数
+    std::atomic<int64_t> m_asyncLastDoneTime; //最後にフレームを取得できた時刻 (us)
+    int64_t m_waitTime;                       //読み込みスレッドでフレームを待機した時間 (us)
 
     vsscript_t m_sVS;
 };
@@ -0,0 +1,203 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2024 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// --------------------------------------------------------------------------------------------
+
+
+#include <algorithm>
+#include "rgy_keyframe_plan.h"
+
+const TCHAR *get_keyframe_source_str(RGYKeyframeSource src) {
+    switch (src) {
+    case RGYKeyframeSource::SceneChange: return _T("scenechange");
+    case RGYKeyframeSource::Chapter:     return _T("chapter");
+    case RGYKeyframeSource::KeyFile:     return _T("keyfile");
+    case RGYKeyframeSource::Segment:     return _T("segment");
+    default:                             return _T("none");
+    }
+}
+
+RGYKeyframePlan::RGYKeyframePlan() :
+    m_tolerance(0),
+    m_frames(),
+    m_times(),
+    m_frameIdx(0),
+    m_timeIdx(0),
+    m_timebase(),
+    m_checkedFrame(-1),
+    m_lastKeyFrame(-1),
+    m_lastKeySrc(RGYKeyframeSource::None),
+    m_inserted(),
+    m_merged(),
+    m_fpOut(),
+    m_log() {
+    m_inserted.fill(0);
+    m_merged.fill(0);
+}
+
+RGYKeyframePlan::~RGYKeyframePlan() {
+    close();
+}
+
+void RGYKeyframePlan::AddMessage(RGYLogLevel log_level, const TCHAR *format, ...) {
+    if (m_log == nullptr || log_level < m_log->getLogLevel(RGY_LOGT_CORE)) {
+        return;
+    }
+    va_list args;
+    va_start(args, format);
+    int len = _vsctprintf(format, args) + 1; // _vscprintf doesn't count terminating '\0'
+    tstring buffer;
+    buffer.resize(len, _T('\0'));
+    _vstprintf_s(&buffer[0], len, format, args);
+    va_end(args);
+    m_log->write(log_level, RGY_LOGT_CORE, (_T("keyframe: ") + tstring(buffer.c_str())).c_str());
+}
+
+RGY_ERR RGYKeyframePlan::init(int tolerance, const tstring& outFile, std::shared_ptr<RGYLog> log) {
+    close();
+    m_log = log;
+    m_tolerance = std::max(tolerance, 0);
+    if (outFile.length() > 0) {
+        FILE *fp = nullptr;
+        if (_tfopen_s(&fp, outFile.c_str(), _T("w")) != 0 || fp == nullptr) {
+            AddMessage(RGY_LOG_ERROR, _T("Failed to open \"%s\".\n"), outFile.c_str());
+            return RGY_ERR_FILE_OPEN;
+        }
+        m_fpOut.reset(fp);
+        AddMessage(RGY_LOG_DEBUG, _T("Writing keyframes to \"%s\".\n"), outFile.c_str());
+    }
+    AddMessage(RGY_LOG_DEBUG, _T("tolerance %d frames.\n"), m_tolerance);
+    return RGY_ERR_NONE;
+}
+
+void RGYKeyframePlan::addFrames(RGYKeyframeSource src, const std::vector<int>& frames) {
+    for (const auto frame : frames) {
+        if (frame > m_checkedFrame) {
+            m_frames.push_back(RGYKeyframeFrameEntry{ frame, src });
+        }
+    }
+    //未判定の部分のみソートし直す (同じフレームは優先度の高いものが先)
+    std::stable_sort(m_frames.begin() + m_frameIdx, m_frames.end(), [](const RGYKeyframeFrameEntry& a, const RGYKeyframeFrameEntry& b) {
+        return (a.frame != b.frame) ? a.frame < b.frame : a.src > b.src;
+    });
+    AddMessage(RGY_LOG_DEBUG, _T("added %d %s keyframes.\n"), (int)frames.size(), get_keyframe_source_str(src));
+}
+
+void RGYKeyframePlan::addTimestamps(RGYKeyframeSource src, const std::vector<std::pair<int64_t, int>>& ptsList, rgy_rational<int> timebase) {
+    m_timebase = timebase;
+    for (const auto& pts : ptsList) {
+        m_times.push_back(RGYKeyframeTimeEntry{ pts.first, pts.second, src });
+    }
+    std::stable_sort(m_times.begin() + m_timeIdx, m_times.end(), [](const RGYKeyframeTimeEntry& a, const RGYKeyframeTimeEntry& b) {
+        return (a.pts != b.pts) ? a.pts < b.pts : a.src > b.src;
+    });
+    AddMessage(RGY_LOG_DEBUG, _T("added %d %s keyframes.\n"), (int)ptsList.size(), get_keyframe_source_str(src));
+}
+
+bool RGYKeyframePlan::higherPriorityAhead(const int frame, const int64_t pts, const int64_t duration, const RGYKeyframeSource src) const {
+    for (auto i = m_frameIdx; i < m_frames.size() && m_frames[i].frame <= frame + m_tolerance; i++) {
+        if (m_frames[i].src > src) {
+            return true;
+        }
+    }
+    //時刻で指定されたものは、以降のフレームも同じdurationと仮定してフレーム数に換算する
+    if (duration > 0) {
+        for (auto i = m_timeIdx; i < m_times.size() && m_times[i].pts <= pts + duration * m_tolerance; i++) {
+            if (m_times[i].src > src) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+RGYKeyframeSource RGYKeyframePlan::check(const int frame, const int64_t pts, const int64_t duration) {
+    m_checkedFrame = frame;
+    auto src = RGYKeyframeSource::None;
+    int merged = 0;
+    for (; m_frameIdx < m_frames.size() && m_frames[m_frameIdx].frame <= frame; m_frameIdx++) {
+        if (src != RGYKeyframeSource::None) merged++;
+        src = std::max(src, m_frames[m_frameIdx].src);
+    }
+    //チャプターの開始時刻 <= フレームの時刻 となった最初のフレームをキーフレームとする
+    for (; m_timeIdx < m_times.size() && m_times[m_timeIdx].pts <= pts; m_timeIdx++) {
+        AddMessage(RGY_LOG_DEBUG, _T("%s %d: %lld at frame #%d: %lld (timebase: %d/%d).\n"),
+            get_keyframe_source_str(m_times[m_timeIdx].src), m_times[m_timeIdx].id, (long long int)m_times[m_timeIdx].pts,
+            frame, (long long int)pts, m_timebase.n(), m_timebase.d());
+        if (src != RGYKeyframeSource::None) merged++;
+        src = std::max(src, m_times[m_timeIdx].src);
+    }
+    if (src == RGYKeyframeSource::None) {
+        return RGYKeyframeSource::None;
+    }
+    m_merged[(int)src] += merged;
+    if (m_tolerance > 0) {
+        //直前のキーフレームが同等以上の優先度なら、そちらにまとめる
+        if (m_lastKeyFrame >= 0 && frame - m_lastKeyFrame <= m_tolerance && m_lastKeySrc >= src) {
+            AddMessage(RGY_LOG_DEBUG, _T("skip %s keyframe at frame #%d, merged to %s keyframe at #%d.\n"),
+                get_keyframe_source_str(src), frame, get_keyframe_source_str(m_lastKeySrc), m_lastKeyFrame);
+            m_merged[(int)src]++;
+            return RGYKeyframeSource::None;
+        }
+        //すぐ後に優先度の高いキーフレームがあれば、そちらにまとめる
+        if (higherPriorityAhead(frame, pts, duration, src)) {
+            AddMessage(RGY_LOG_DEBUG, _T("skip %s keyframe at frame #%d, higher priority keyframe within %d frames.\n"),
+                get_keyframe_source_str(src), frame, m_tolerance);
+            m_merged[(int)src]++;
+            return RGYKeyframeSource::None;
+        }
+    }
+    AddMessage(RGY_LOG_DEBUG, _T("Insert keyframe (%s) on frame #%d.\n"), get_keyframe_source_str(src), frame);
+    m_lastKeyFrame = frame;
+    m_lastKeySrc = src;
+    m_inserted[(int)src]++;
+    if (m_fpOut) {
+        fprintf(m_fpOut.get(), "%d\n", frame);
+    }
+    return src;
+}
+
+void RGYKeyframePlan::close() {
+    if (m_lastKeyFrame >= 0 || std::any_of(m_merged.begin(), m_merged.end(), [](int n) { return n > 0; })) {
+        tstring str;
+        for (int i = (int)RGYKeyframeSource::None + 1; i < RGY_KEYFRAME_SOURCE_COUNT; i++) {
+            if (m_inserted[i] > 0 || m_merged[i] > 0) {
+                str += strsprintf(_T(" %s %d (merged %d)"), get_keyframe_source_str((RGYKeyframeSource)i), m_inserted[i], m_merged[i]);
+            }
+        }
+        AddMessage(RGY_LOG_DEBUG, _T("inserted:%s.\n"), str.c_str());
+    }
+    m_fpOut.reset();
+    m_frames.clear();
+    m_times.clear();
+    m_frameIdx = 0;
+    m_timeIdx = 0;
+    m_checkedFrame = -1;
+    m_lastKeyFrame = -1;
+    m_lastKeySrc = RGYKeyframeSource::None;
+    m_inserted.fill(0);
+    m_merged.fill(0);
+    m_log.reset();
+}
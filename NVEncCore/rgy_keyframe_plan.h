@@ -0,0 +1,107 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2024 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// --------------------------------------------------------------------------------------------
+
+
+#pragma once
+#ifndef __RGY_KEYFRAME_PLAN_H__
+#define __RGY_KEYFRAME_PLAN_H__
+
+#include <cstdint>
+#include <array>
+#include <vector>
+#include <memory>
+#include "rgy_tchar.h"
+#include "rgy_err.h"
+#include "rgy_log.h"
+#include "rgy_util.h"
+
+// キーフレームの挿入要求の種類
+// 値が大きいほど優先度が高く、tolerance内で競合した場合は優先度の高いものを残す
+enum class RGYKeyframeSource : int {
+    None = 0,
+    SceneChange,
+    Chapter,
+    KeyFile,
+    Segment,
+};
+static const int RGY_KEYFRAME_SOURCE_COUNT = (int)RGYKeyframeSource::Segment + 1;
+const TCHAR *get_keyframe_source_str(RGYKeyframeSource src);
+
+struct RGYKeyframeFrameEntry {
+    int frame;               // 出力フレーム番号
+    RGYKeyframeSource src;
+};
+
+struct RGYKeyframeTimeEntry {
+    int64_t pts;             // 出力のtimebase
+    int id;                  // チャプターのidなど (ログ用)
+    RGYKeyframeSource src;
+};
+
+// チャプター、--keyfile などのキーフレームの挿入要求をまとめてソートしておき、
+// 各フレームでキーフレームとするかを先頭から順に判定する
+//
+// フレーム番号で指定されるものと時刻で指定されるもの(VFRでは事前にフレーム番号に変換できない)を
+// それぞれソート済みの配列で持ち、判定位置を進めていくので1フレームあたりO(1)で判定できる
+// toleranceを指定すると、そのフレーム数以内に連続するキーフレームを1つにまとめる
+class RGYKeyframePlan {
+public:
+    RGYKeyframePlan();
+    ~RGYKeyframePlan();
+
+    // outFileを指定すると、実際に挿入したキーフレームのフレーム番号を--keyfileと同じ形式で出力する
+    RGY_ERR init(int tolerance, const tstring& outFile, std::shared_ptr<RGYLog> log);
+    // 判定済みのフレームより前の要求は無視される
+    void addFrames(RGYKeyframeSource src, const std::vector<int>& frames);
+    // ptsは出力のtimebase
+    void addTimestamps(RGYKeyframeSource src, const std::vector<std::pair<int64_t, int>>& ptsList, rgy_rational<int> timebase);
+    bool empty() const { return m_frames.size() == 0 && m_times.size() == 0; }
+
+    // フレーム番号順に呼ぶこと
+    // キーフレームとする場合はその理由を、しない場合はRGYKeyframeSource::Noneを返す
+    RGYKeyframeSource check(const int frame, const int64_t pts, const int64_t duration);
+    void close();
+protected:
+    bool higherPriorityAhead(const int frame, const int64_t pts, const int64_t duration, const RGYKeyframeSource src) const;
+    void AddMessage(RGYLogLevel log_level, const TCHAR *format, ...);
+
+    int m_tolerance;
+    std::vector<RGYKeyframeFrameEntry> m_frames; // フレーム番号順
+    std::vector<RGYKeyframeTimeEntry> m_times;   // 時刻順
+    size_t m_frameIdx;                           // 次に判定するm_framesの位置
+    size_t m_timeIdx;                            // 次に判定するm_timesの位置
+    rgy_rational<int> m_timebase;
+    int m_checkedFrame;                          // 判定済みのフレーム番号
+    int m_lastKeyFrame;                          // 直前に挿入したキーフレーム
+    RGYKeyframeSource m_lastKeySrc;
+    std::array<int, RGY_KEYFRAME_SOURCE_COUNT> m_inserted;
+    std::array<int, RGY_KEYFRAME_SOURCE_COUNT> m_merged;  // toleranceにより他のキーフレームにまとめたもの
+    std::unique_ptr<FILE, fp_deleter> m_fpOut;
+    std::shared_ptr<RGYLog> m_log;
+};
+
+#endif //__RGY_KEYFRAME_PLAN_H__
@@ -28,6 +28,8 @@
 #include <algorithm>
 #include <thread>
 #include <mutex>
+#include <atomic>
+#include <condition_variable>
 #include <chrono>
 #include "rgy_log.h"
 #include "rgy_version.h"
@@ -79,6 +81,203 @@ int rgy_print_stderr(int log_level, const TCHAR *mes, void *handle_) {
 
 const char *RGYLog::HTML_FOOTER = "</body>\n</html>\n";
 
+struct RGYLogMessage {
+    RGYLogMessage *next;
+    std::string str; //そのままファイルに書き込む文字列
+};
+
+//ログファイルを開いたままにして、専用のスレッドでまとめて書き込む
+//各スレッドからはロックを使わずにリストに追加するだけにして、ファイルの開閉やロックの待ちを避ける
+class RGYLogFileWriter {
+public:
+    RGYLogFileWriter();
+    ~RGYLogFileWriter();
+    //footerを指定した場合(html)は、末尾のfooterの前に追記する
+    bool open(const tstring& filename, const char *footer);
+    void push(std::string&& str);
+    void flush();
+    void close();
+protected:
+    void threadFunc();
+    void writeList(RGYLogMessage *list);
+
+    std::unique_ptr<FILE, fp_deleter> m_fp;
+    const char *m_footer;
+    int64_t m_footerPos;                 //footerの位置
+    std::atomic<RGYLogMessage *> m_head; //追加されたメッセージ (新しいものが先頭)
+    std::atomic<int> m_pending;
+    std::thread m_thread;
+    std::mutex m_mtx;
+    std::condition_variable m_cvRequest;
+    std::condition_variable m_cvDone;
+    uint64_t m_flushRequest;
+    uint64_t m_flushDone;
+    bool m_abort;
+    bool m_stopped;                      //書き込みスレッドが終了した (以降のflushは待機しない)
+};
+
+RGYLogFileWriter::RGYLogFileWriter() :
+    m_fp(),
+    m_footer(nullptr),
+    m_footerPos(0),
+    m_head(nullptr),
+    m_pending(0),
+    m_thread(),
+    m_mtx(),
+    m_cvRequest(),
+    m_cvDone(),
+    m_flushRequest(0),
+    m_flushDone(0),
+    m_abort(false),
+    m_stopped(true) {
+}
+
+RGYLogFileWriter::~RGYLogFileWriter() {
+    close();
+}
+
+bool RGYLogFileWriter::open(const tstring& filename, const char *footer) {
+    close();
+    FILE *fp = nullptr;
+    if (_tfopen_s(&fp, filename.c_str(), (footer) ? _T("rb+") : _T("a")) || fp == nullptr) {
+        return false;
+    }
+    m_fp.reset(fp);
+    m_footer = footer;
+    if (m_footer) {
+        _fseeki64(m_fp.get(), 0, SEEK_END);
+        m_footerPos = std::max<int64_t>(_ftelli64(m_fp.get()) - (int64_t)strlen(m_footer), 0);
+    }
+    m_abort = false;
+    m_stopped = false;
+    m_thread = std::thread(&RGYLogFileWriter::threadFunc, this);
+    return true;
+}
+
+void RGYLogFileWriter::push(std::string&& str) {
+    auto msg = new RGYLogMessage();
+    msg->str = std::move(str);
+    msg->next = m_head.load(std::memory_order_relaxed);
+    while (!m_head.compare_exchange_weak(msg->next, msg, std::memory_order_release, std::memory_order_relaxed)) {
+        ;
+    }
+    if (++m_pending == RGY_LOG_FLUSH_PENDING) {
+        m_cvRequest.notify_one();
+    }
+}
+
+void RGYLogFileWriter::flush() {
+    std::unique_lock<std::mutex> lock(m_mtx);
+    //終了処理中・終了後は、残りはclose()で書き込まれるので待たない
+    if (m_abort || m_stopped) {
+        return;
+    }
+    const auto target = ++m_flushRequest;
+    m_cvRequest.notify_one();
+    m_cvDone.wait(lock, [this, target]() { return m_flushDone >= target || m_stopped; });
+}
+
+void RGYLogFileWriter::close() {
+    if (m_thread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            m_abort = true;
+        }
+        m_cvRequest.notify_one();
+        m_thread.join();
+    }
+    writeList(m_head.exchange(nullptr, std::memory_order_acquire));
+    m_fp.reset();
+}
+
+void RGYLogFileWriter::writeList(RGYLogMessage *list) {
+    //追加の逆順になっているので、元の順に戻す
+    RGYLogMessage *ordered = nullptr;
+    while (list) {
+        auto next = list->next;
+        list->next = ordered;
+        ordered = list;
+        list = next;
+    }
+    if (ordered == nullptr) {
+        return;
+    }
+    if (m_fp && m_footer) {
+        _fseeki64(m_fp.get(), m_footerPos, SEEK_SET);
+    }
+    int count = 0;
+    while (ordered) {
+        auto next = ordered->next;
+        if (m_fp) {
+            fwrite(ordered->str.data(), 1, ordered->str.length(), m_fp.get());
+            m_footerPos += (int64_t)ordered->str.length();
+        }
+        delete ordered;
+        ordered = next;
+        count++;
+    }
+    if (m_fp) {
+        if (m_footer) {
+            fwrite(m_footer, 1, strlen(m_footer), m_fp.get());
+        }
+        fflush(m_fp.get());
+    }
+    m_pending -= count;
+}
+
+void RGYLogFileWriter::threadFunc() {
+    std::unique_lock<std::mutex> lock(m_mtx);
+    for (;;) {
+        m_cvRequest.wait_for(lock, std::chrono::milliseconds(RGY_LOG_FLUSH_INTERVAL_MS), [this]() {
+            return m_abort || m_flushRequest > m_flushDone || m_pending.load() >= RGY_LOG_FLUSH_PENDING;
+        });
+        const auto request = m_flushRequest;
+        const bool abort = m_abort;
+        lock.unlock();
+        writeList(m_head.exchange(nullptr, std::memory_order_acquire));
+        lock.lock();
+        m_flushDone = request;
+        if (abort) {
+            m_stopped = true;
+            m_cvDone.notify_all();
+            break;
+        }
+        m_cvDone.notify_all();
+    }
+}
+
+//同じメッセージの連続を検出する
+struct RGYLogRepeatFilter {
+    std::atomic<size_t> lastHash;
+    std::atomic<int> lastLevel;
+    std::atomic<int> lastType;
+    std::atomic<int> count;
+    std::atomic<bool> lastFileOnly;
+    RGYLogRepeatFilter() : lastHash(0), lastLevel(RGY_LOG_INFO), lastType(RGY_LOGT_CORE), count(0), lastFileOnly(false) {};
+};
+
+static std::string rgy_log_json_escape(const std::string& str) {
+    std::string ret;
+    ret.reserve(str.length() + 16);
+    for (const auto c : str) {
+        switch (c) {
+        case '"': ret += "\\\""; break;
+        case '\\': ret += "\\\\"; break;
+        case '\n': ret += "\\n"; break;
+        case '\r': ret += "\\r"; break;
+        case '\t': ret += "\\t"; break;
+        default:
+            if ((uint8_t)c < 0x20) {
+                ret += strsprintf("\\u%04x", (uint8_t)c);
+            } else {
+                ret += c;
+            }
+            break;
+        }
+    }
+    return ret;
+}
+
 const TCHAR *rgy_log_level_to_str(RGYLogLevel level) {
     for (const auto& p : RGY_LOG_LEVEL_STR) {
         if (p.first == level) return p.second;
@@ -231,7 +430,11 @@ RGYLog::RGYLog(const TCHAR *pLogFile, const RGYLogLevel log_level, bool showTime
     m_bHtml(false),
     m_showTime(showTime),
     m_addLogLevel(addLogLevel),
-    m_mtx() {
+    m_json(false),
+    m_repeatLimit(0),
+    m_mtx(),
+    m_fileWriter(),
+    m_repeat() {
     init(pLogFile, RGYParamLogLevel(log_level));
 };
 
@@ -241,17 +444,25 @@ RGYLog::RGYLog(const TCHAR *pLogFile, const RGYParamLogLevel& log_level, bool sh
     m_bHtml(false),
     m_showTime(showTime),
     m_addLogLevel(addLogLevel),
-    m_mtx() {
+    m_json(false),
+    m_repeatLimit(0),
+    m_mtx(),
+    m_fileWriter(),
+    m_repeat() {
     init(pLogFile, log_level);
 }
 
 RGYLog::~RGYLog() {
+    writeRepeatSummary();
+    m_fileWriter.reset();
 }
 
 void RGYLog::init(const TCHAR *pLogFile, const RGYParamLogLevel& log_level) {
     m_pStrLog = pLogFile;
     m_nLogLevel = log_level;
     m_mtx.reset(new std::mutex());
+    m_repeat.reset(new RGYLogRepeatFilter());
+    m_fileWriter.reset();
     if (pLogFile != nullptr && _tcslen(pLogFile) > 0) {
         CreateDirectoryRecursive(PathRemoveFileSpecFixed(pLogFile).second.c_str());
         FILE *fp = NULL;
@@ -272,12 +483,66 @@ void RGYLog::init(const TCHAR *pLogFile, const RGYParamLogLevel& log_level) {
                         m_bHtml = true;
                     }
                 }
+            } else if (check_ext(pLogFile, { ".jsonl" })) {
+                m_json = true;
             }
             fclose(fp);
+            openFileWriter();
         }
     }
 };
 
+void RGYLog::openFileWriter() {
+    m_fileWriter.reset();
+    if (m_pStrLog == nullptr || _tcslen(m_pStrLog) == 0) {
+        return;
+    }
+    auto writer = std::make_unique<RGYLogFileWriter>();
+    if (!writer->open(m_pStrLog, (m_bHtml) ? HTML_FOOTER : nullptr)) {
+        fprintf(stderr, "failed to open log file, log writing disabled.\n");
+        return;
+    }
+    m_fileWriter = std::move(writer);
+}
+
+void RGYLog::setLogFile(const TCHAR *pLogFile) {
+    m_pStrLog = pLogFile;
+    openFileWriter();
+}
+
+bool RGYLog::setOutputOptions(bool json, int repeatLimit) {
+    m_repeatLimit = std::max(repeatLimit, 0);
+    if (json && !m_json) {
+        if (m_bHtml) {
+            //既存のhtmlのログにjsonを追記すると、どちらの形式としても読めなくなる
+            return false;
+        }
+        m_json = true;
+    }
+    return true;
+}
+
+void RGYLog::writeRepeatSummary() {
+    if (!m_repeat || m_repeatLimit <= 0) {
+        return;
+    }
+    //省略中のメッセージがあれば、その数を出力する
+    //次に同じメッセージが来た場合は、改めて出力されるようにしておく
+    m_repeat->lastHash = 0;
+    const int count = m_repeat->count.exchange(0);
+    if (count >= m_repeatLimit) {
+        write_log_output((RGYLogLevel)m_repeat->lastLevel.load(), (RGYLogType)m_repeat->lastType.load(),
+            strsprintf(_T("last message repeated %d more times.\n"), count - m_repeatLimit + 1).c_str(), m_repeat->lastFileOnly);
+    }
+}
+
+void RGYLog::flush() {
+    writeRepeatSummary();
+    if (m_fileWriter) {
+        m_fileWriter->flush();
+    }
+}
+
 void RGYLog::writeHtmlHeader() {
     FILE *fp = NULL;
     if (_tfopen_s(&fp, m_pStrLog, _T("wb"))) {
@@ -366,6 +631,28 @@ void RGYLog::write_log(RGYLogLevel log_level, const RGYLogType logtype, const TC
     if (log_level < m_nLogLevel.get(logtype)) {
         return;
     }
+    if (m_repeatLimit > 0 && logtype != RGY_LOGT_CORE_PROGRESS) {
+        //同じメッセージが連続する場合は、上限を超えた分を省略し、次に別のメッセージが来た時(またはflush/終了時)に省略した数を出力する
+        const auto hash = std::hash<tstring>()(buffer) ^ (size_t)(log_level - RGY_LOG_TRACE);
+        if (m_repeat->lastHash.exchange(hash) == hash) {
+            if (++m_repeat->count >= m_repeatLimit) {
+                return;
+            }
+        } else {
+            const auto lastLevel = (RGYLogLevel)m_repeat->lastLevel.exchange(log_level);
+            const auto lastType = (RGYLogType)m_repeat->lastType.exchange(logtype);
+            const bool lastFileOnly = m_repeat->lastFileOnly.exchange(file_only);
+            const int count = m_repeat->count.exchange(0);
+            if (count >= m_repeatLimit) {
+                write_log_output(lastLevel, lastType, strsprintf(_T("last message repeated %d more times.\n"), count - m_repeatLimit + 1).c_str(), lastFileOnly);
+            }
+        }
+    }
+    write_log_output(log_level, logtype, buffer, file_only);
+}
+
+void RGYLog::write_log_output(RGYLogLevel log_level, const RGYLogType logtype, const TCHAR *buffer, bool file_only) {
+    const TCHAR *message = buffer; //時刻を付加する前のメッセージ
 
     auto convert_to_html = [log_level](std::string str) {
         //str = str_replace(str, "<", "&lt;");
@@ -383,6 +670,22 @@ void RGYLog::write_log(RGYLogLevel log_level, const RGYLogType logtype, const TC
         }
         return strHtml;
     };
+    auto to_json = [log_level, logtype](const TCHAR *str) {
+        const auto tp = std::chrono::system_clock::now();
+        const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(tp.time_since_epoch()).count();
+        const auto sec1 = ms / 1000;
+        const auto timeinfo = localtime(&sec1);
+        char buf[64] = { 0 };
+        strftime(buf, _countof(buf), "%Y-%m-%dT%H:%M:%S", timeinfo);
+        auto msg = tchar_to_string(str, CP_UTF8);
+        while (msg.length() > 0 && (msg.back() == '\n' || msg.back() == '\r')) {
+            msg.pop_back();
+        }
+        return strsprintf("{\"time\":\"%s.%03d\",\"level\":\"%s\",\"type\":\"%s\",\"message\":\"%s\"}\n",
+            buf, (int)(ms - sec1 * 1000),
+            tchar_to_string(rgy_log_level_to_str(log_level)).c_str(), tchar_to_string(rgy_log_type_to_str(logtype)).c_str(),
+            rgy_log_json_escape(msg).c_str());
+    };
     auto add_time = [file_only](tstring str) {
         const auto tp = std::chrono::system_clock::now();
         const auto duration = tp.time_since_epoch();
@@ -426,7 +729,7 @@ void RGYLog::write_log(RGYLogLevel log_level, const RGYLogType logtype, const TC
     char *buffer_ptr = NULL;
     DWORD mode = 0;
     bool stderr_write_to_console = 0 != GetConsoleMode(hStdErr, &mode); //stderrの出力先がコンソールかどうか
-    if (m_pStrLog || !stderr_write_to_console) {
+    if ((m_fileWriter && !m_json) || !stderr_write_to_console) {
         buffer_char = tchar_to_string(buffer, (m_bHtml) ? CP_UTF8 : CP_THREAD_ACP);
         if (m_bHtml) {
             buffer_char = convert_to_html(buffer_char);
@@ -443,24 +746,14 @@ void RGYLog::write_log(RGYLogLevel log_level, const RGYLogType logtype, const TC
         buffer_ptr = &buffer_char[0];
     }
 #endif
-    std::lock_guard<std::mutex> lock(*m_mtx.get());
-    if (m_pStrLog) {
-        FILE *fp_log = NULL;
-        //logはANSI(まあようはShift-JIS)で保存する
-        if (0 == _tfopen_s(&fp_log, m_pStrLog, (m_bHtml) ? _T("rb+") : _T("a")) && fp_log) {
-            if (m_bHtml) {
-                _fseeki64(fp_log, 0, SEEK_END);
-                int64_t pos = _ftelli64(fp_log);
-                _fseeki64(fp_log, 0, SEEK_SET);
-                _fseeki64(fp_log, pos -1 * strlen(HTML_FOOTER), SEEK_CUR);
-            }
-            fwrite(buffer_ptr, 1, strlen(buffer_ptr), fp_log);
-            if (m_bHtml) {
-                fwrite(HTML_FOOTER, 1, strlen(HTML_FOOTER), fp_log);
-            }
-            fclose(fp_log);
+    if (m_fileWriter) {
+        //logはANSI(まあようはShift-JIS)で保存する (html, jsonはUTF-8)
+        m_fileWriter->push((m_json) ? to_json(message) : std::string(buffer_ptr));
+        if (log_level >= RGY_LOG_ERROR) {
+            m_fileWriter->flush(); //異常終了する場合に備え、エラーはすぐに書き込む
         }
     }
+    std::lock_guard<std::mutex> lock(*m_mtx.get());
     if (!file_only) {
         if (m_addLogLevel) {
             auto strLines = split(buffer, _T("\n"));
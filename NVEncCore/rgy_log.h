@@ -40,6 +40,11 @@
 namespace std {
     class mutex;
 }
+class RGYLogFileWriter;
+struct RGYLogRepeatFilter;
+
+static const int RGY_LOG_FLUSH_INTERVAL_MS = 100; //ログファイルへの書き込み間隔
+static const int RGY_LOG_FLUSH_PENDING = 256;     //この数以上のメッセージがたまったら間隔を待たずに書き込む
 
 enum RGYLogLevel {
     RGY_LOG_TRACE = -3,
@@ -157,8 +162,16 @@ protected:
     bool m_bHtml;
     bool m_showTime;
     bool m_addLogLevel;
+    bool m_json;          //ログファイルをJSON Lines形式で出力する
+    int m_repeatLimit;    //同じメッセージが連続した場合に出力する上限 (0で無制限)
     std::unique_ptr<std::mutex> m_mtx;
+    std::unique_ptr<RGYLogFileWriter> m_fileWriter; //ログファイルへの書き込みスレッド
+    std::unique_ptr<RGYLogRepeatFilter> m_repeat;
     static const char *HTML_FOOTER;
+
+    void openFileWriter();
+    void writeRepeatSummary();
+    void write_log_output(RGYLogLevel log_level, const RGYLogType logtype, const TCHAR *buffer, bool file_only);
 public:
     RGYLog(const TCHAR *pLogFile, const RGYLogLevel log_level = RGY_LOG_INFO, bool showTime = false, bool addLogLevel = false);
     RGYLog(const TCHAR *pLogFile, const RGYParamLogLevel& log_level, bool showTime = false, bool addLogLevel = false);
@@ -167,6 +180,12 @@ public:
     void writeHtmlHeader();
     void writeFileHeader(const TCHAR *pDstFilename);
     void writeFileFooter();
+    //json: ログファイルをJSON Lines形式で出力する (拡張子が.jsonlの場合も)
+    //repeatLimit: 同じメッセージが連続した場合、指定回数を超えた分を省略する
+    //htmlのログファイルではjsonに切り替えられないので、falseを返す
+    bool setOutputOptions(bool json, int repeatLimit);
+    //省略中の連続メッセージの数を出力し、ログファイルへの書き込みが終わるまで待機する
+    void flush();
     RGYParamLogLevel getLogLevelAll() const {
         return m_nLogLevel;
     }
@@ -184,9 +203,7 @@ public:
     bool logFileAvail() {
         return m_pStrLog != nullptr;
     }
-    void setLogFile(const TCHAR *pLogFile) {
-        m_pStrLog = pLogFile;
-    }
+    void setLogFile(const TCHAR *pLogFile);
     virtual void write_log(RGYLogLevel log_level, const RGYLogType logtype, const TCHAR *buffer, bool file_only = false);
     virtual void write(RGYLogLevel log_level, const RGYLogType logtype, const TCHAR *format, ...);
     virtual void write(RGYLogLevel log_level, const RGYLogType logtype, const wchar_t *format, va_list args);
@@ -0,0 +1,89 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2024 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// --------------------------------------------------------------------------------------------
+
+
+#include <cmath>
+#include "rgy_lumakey.h"
+
+RGYLumaKeyParam rgy_lumakey_param(const int bitdepth, const float threshold, const float tolerance, const float softness, const float baseAlpha) {
+    // lumaf = ((v / maxv) - 16/255) * 255/219 の関係を入力値の側に変換して、画素ごとの浮動小数点演算を避ける
+    const double maxv = (double)((1 << bitdepth) - 1) * (double)(1 << RGY_LUMAKEY_FRAC_BITS);
+    const double rangeScale = maxv * 219.0 / 255.0;
+    auto toValue = [&](const double l) {
+        return l * rangeScale + maxv * 16.0 / 255.0;
+    };
+    RGYLumaKeyParam prm;
+    prm.lumaMin = (int32_t)std::lround(toValue(0.0));
+    prm.lumaMax = (int32_t)std::lround(toValue(1.0));
+    prm.black   = (int32_t)std::lround(toValue(std::max(threshold - tolerance, 0.0f)));
+    prm.white   = (int32_t)std::lround(toValue(std::min(threshold + tolerance, 1.0f)));
+    const double soft = softness * rangeScale;
+    if (softness > 0.0f && soft >= 2.0) {
+        // diffMaxで差分を頭打ちにしているので、diff * scaleは255 << RGY_LUMAKEY_SCALE_SHIFT程度に収まる
+        prm.diffMax = (int32_t)std::ceil(soft);
+        prm.scale   = (int32_t)std::lround(255.0 * (double)(1 << RGY_LUMAKEY_SCALE_SHIFT) / soft);
+    } else {
+        prm.diffMax = 1;
+        prm.scale   = 255 << RGY_LUMAKEY_SCALE_SHIFT;
+    }
+    prm.baseAlpha = std::min(std::max((int32_t)std::lround(baseAlpha * 256.0f), 0), 256);
+    return prm;
+}
+
+void rgy_lumakey8_c(uint8_t *dst, const uint8_t *src, const int width, const RGYLumaKeyParam& prm) {
+    for (int i = 0; i < width; i++) {
+        dst[i] = rgy_lumakey_pixel(src[i], prm);
+    }
+}
+
+void rgy_lumakey16_c(uint8_t *dst, const uint16_t *src, const int width, const RGYLumaKeyParam& prm) {
+    for (int i = 0; i < width; i++) {
+        dst[i] = rgy_lumakey_pixel(src[i], prm);
+    }
+}
+
+funcLumaKey8 get_lumakey8_func() {
+#if defined(_M_IX86) || defined(_M_X64) || defined(__x86_64)
+    const auto simd = get_availableSIMD();
+#if defined(_M_X64) || defined(__x86_64)
+    if ((simd & RGY_SIMD::AVX512BW) == RGY_SIMD::AVX512BW) return rgy_lumakey8_avx512bw;
+#endif
+    if ((simd & RGY_SIMD::AVX2) == RGY_SIMD::AVX2) return rgy_lumakey8_avx2;
+#endif
+    return rgy_lumakey8_c;
+}
+
+funcLumaKey16 get_lumakey16_func() {
+#if defined(_M_IX86) || defined(_M_X64) || defined(__x86_64)
+    const auto simd = get_availableSIMD();
+#if defined(_M_X64) || defined(__x86_64)
+    if ((simd & RGY_SIMD::AVX512BW) == RGY_SIMD::AVX512BW) return rgy_lumakey16_avx512bw;
+#endif
+    if ((simd & RGY_SIMD::AVX2) == RGY_SIMD::AVX2) return rgy_lumakey16_avx2;
+#endif
+    return rgy_lumakey16_c;
+}
@@ -0,0 +1,79 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2024 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// --------------------------------------------------------------------------------------------
+
+
+#pragma once
+#ifndef __RGY_LUMAKEY_H__
+#define __RGY_LUMAKEY_H__
+
+#include <cstdint>
+#include <algorithm>
+#include "rgy_simd.h"
+
+// lumakeyの整数演算用のパラメータ
+//  輝度は入力値 << RGY_LUMAKEY_FRAC_BITS の固定小数点で扱い、
+//  不透明度は (差分 * scale) >> RGY_LUMAKEY_SCALE_SHIFT で求める
+static const int RGY_LUMAKEY_FRAC_BITS = 8;
+static const int RGY_LUMAKEY_SCALE_SHIFT = 22;
+
+struct RGYLumaKeyParam {
+    int32_t lumaMin;   // limited rangeの下限 (これ以下は0.0として扱う)
+    int32_t lumaMax;   // limited rangeの上限 (これ以上は1.0として扱う)
+    int32_t black;     // 透明にする範囲の下限
+    int32_t white;     // 透明にする範囲の上限
+    int32_t diffMax;   // 不透明度が255に達する差分
+    int32_t scale;     // 差分から不透明度への係数
+    int32_t baseAlpha; // 最終的に乗算する不透明度 (0 - 256)
+};
+
+RGYLumaKeyParam rgy_lumakey_param(const int bitdepth, const float threshold, const float tolerance, const float softness, const float baseAlpha);
+
+static inline uint8_t rgy_lumakey_pixel(const int value, const RGYLumaKeyParam& prm) {
+    const int lumaF = std::min(std::max(value << RGY_LUMAKEY_FRAC_BITS, prm.lumaMin), prm.lumaMax);
+    const int diff = std::min(std::max(std::max(prm.black - lumaF, lumaF - prm.white), 0), prm.diffMax);
+    const int alpha = std::min((diff * prm.scale + (1 << (RGY_LUMAKEY_SCALE_SHIFT - 1))) >> RGY_LUMAKEY_SCALE_SHIFT, 255);
+    return (uint8_t)((alpha * prm.baseAlpha + 128) >> 8);
+}
+
+typedef void (*funcLumaKey8)(uint8_t *dst, const uint8_t *src, const int width, const RGYLumaKeyParam& prm);
+typedef void (*funcLumaKey16)(uint8_t *dst, const uint16_t *src, const int width, const RGYLumaKeyParam& prm);
+
+void rgy_lumakey8_c(uint8_t *dst, const uint8_t *src, const int width, const RGYLumaKeyParam& prm);
+void rgy_lumakey16_c(uint8_t *dst, const uint16_t *src, const int width, const RGYLumaKeyParam& prm);
+#if defined(_M_IX86) || defined(_M_X64) || defined(__x86_64)
+void rgy_lumakey8_avx2(uint8_t *dst, const uint8_t *src, const int width, const RGYLumaKeyParam& prm);
+void rgy_lumakey16_avx2(uint8_t *dst, const uint16_t *src, const int width, const RGYLumaKeyParam& prm);
+#if defined(_M_X64) || defined(__x86_64)
+void rgy_lumakey8_avx512bw(uint8_t *dst, const uint8_t *src, const int width, const RGYLumaKeyParam& prm);
+void rgy_lumakey16_avx512bw(uint8_t *dst, const uint16_t *src, const int width, const RGYLumaKeyParam& prm);
+#endif
+#endif
+
+funcLumaKey8 get_lumakey8_func();
+funcLumaKey16 get_lumakey16_func();
+
+#endif //__RGY_LUMAKEY_H__
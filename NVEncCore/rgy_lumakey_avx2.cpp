@@ -0,0 +1,84 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2024 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// --------------------------------------------------------------------------------------------
+
+
+#include <immintrin.h>
+#include "rgy_osdep.h"
+#include "rgy_lumakey.h"
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__x86_64)
+
+static RGY_FORCEINLINE __m256i lumakey_avx2(__m256i y0, const RGYLumaKeyParam& prm) {
+    y0 = _mm256_slli_epi32(y0, RGY_LUMAKEY_FRAC_BITS);
+    y0 = _mm256_min_epi32(_mm256_max_epi32(y0, _mm256_set1_epi32(prm.lumaMin)), _mm256_set1_epi32(prm.lumaMax));
+    __m256i yDiff = _mm256_max_epi32(_mm256_sub_epi32(_mm256_set1_epi32(prm.black), y0), _mm256_sub_epi32(y0, _mm256_set1_epi32(prm.white)));
+    yDiff = _mm256_min_epi32(_mm256_max_epi32(yDiff, _mm256_setzero_si256()), _mm256_set1_epi32(prm.diffMax));
+    __m256i yAlpha = _mm256_mullo_epi32(yDiff, _mm256_set1_epi32(prm.scale));
+    yAlpha = _mm256_srai_epi32(_mm256_add_epi32(yAlpha, _mm256_set1_epi32(1 << (RGY_LUMAKEY_SCALE_SHIFT - 1))), RGY_LUMAKEY_SCALE_SHIFT);
+    yAlpha = _mm256_min_epi32(yAlpha, _mm256_set1_epi32(255));
+    yAlpha = _mm256_mullo_epi32(yAlpha, _mm256_set1_epi32(prm.baseAlpha));
+    return _mm256_srai_epi32(_mm256_add_epi32(yAlpha, _mm256_set1_epi32(128)), 8);
+}
+
+//32bit x 8 x 4 -> 8bit x 32
+static RGY_FORCEINLINE __m256i pack_32to8_avx2(const __m256i& y0, const __m256i& y1, const __m256i& y2, const __m256i& y3) {
+    const __m256i y01 = _mm256_packus_epi32(y0, y1);
+    const __m256i y23 = _mm256_packus_epi32(y2, y3);
+    return _mm256_permutevar8x32_epi32(_mm256_packus_epi16(y01, y23), _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+}
+
+void rgy_lumakey8_avx2(uint8_t *dst, const uint8_t *src, const int width, const RGYLumaKeyParam& prm) {
+    int i = 0;
+    for (; i <= width - 32; i += 32) {
+        const __m256i y0 = lumakey_avx2(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(src + i +  0))), prm);
+        const __m256i y1 = lumakey_avx2(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(src + i +  8))), prm);
+        const __m256i y2 = lumakey_avx2(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(src + i + 16))), prm);
+        const __m256i y3 = lumakey_avx2(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(src + i + 24))), prm);
+        _mm256_storeu_si256((__m256i *)(dst + i), pack_32to8_avx2(y0, y1, y2, y3));
+    }
+    for (; i < width; i++) {
+        dst[i] = rgy_lumakey_pixel(src[i], prm);
+    }
+    _mm256_zeroupper();
+}
+
+void rgy_lumakey16_avx2(uint8_t *dst, const uint16_t *src, const int width, const RGYLumaKeyParam& prm) {
+    int i = 0;
+    for (; i <= width - 32; i += 32) {
+        const __m256i y0 = lumakey_avx2(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(src + i +  0))), prm);
+        const __m256i y1 = lumakey_avx2(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(src + i +  8))), prm);
+        const __m256i y2 = lumakey_avx2(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(src + i + 16))), prm);
+        const __m256i y3 = lumakey_avx2(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(src + i + 24))), prm);
+        _mm256_storeu_si256((__m256i *)(dst + i), pack_32to8_avx2(y0, y1, y2, y3));
+    }
+    for (; i < width; i++) {
+        dst[i] = rgy_lumakey_pixel(src[i], prm);
+    }
+    _mm256_zeroupper();
+}
+
+#endif //#if defined(_M_IX86) || defined(_M_X64) || defined(__x86_64)
@@ -0,0 +1,75 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2024 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// --------------------------------------------------------------------------------------------
+
+
+#include <immintrin.h>
+#include "rgy_osdep.h"
+#include "rgy_lumakey.h"
+
+#if defined(_M_X64) || defined(__x86_64)
+
+static RGY_FORCEINLINE __m512i lumakey_avx512(__m512i z0, const RGYLumaKeyParam& prm) {
+    z0 = _mm512_slli_epi32(z0, RGY_LUMAKEY_FRAC_BITS);
+    z0 = _mm512_min_epi32(_mm512_max_epi32(z0, _mm512_set1_epi32(prm.lumaMin)), _mm512_set1_epi32(prm.lumaMax));
+    __m512i zDiff = _mm512_max_epi32(_mm512_sub_epi32(_mm512_set1_epi32(prm.black), z0), _mm512_sub_epi32(z0, _mm512_set1_epi32(prm.white)));
+    zDiff = _mm512_min_epi32(_mm512_max_epi32(zDiff, _mm512_setzero_si512()), _mm512_set1_epi32(prm.diffMax));
+    __m512i zAlpha = _mm512_mullo_epi32(zDiff, _mm512_set1_epi32(prm.scale));
+    zAlpha = _mm512_srai_epi32(_mm512_add_epi32(zAlpha, _mm512_set1_epi32(1 << (RGY_LUMAKEY_SCALE_SHIFT - 1))), RGY_LUMAKEY_SCALE_SHIFT);
+    zAlpha = _mm512_min_epi32(zAlpha, _mm512_set1_epi32(255));
+    zAlpha = _mm512_mullo_epi32(zAlpha, _mm512_set1_epi32(prm.baseAlpha));
+    return _mm512_srai_epi32(_mm512_add_epi32(zAlpha, _mm512_set1_epi32(128)), 8);
+}
+
+void rgy_lumakey8_avx512bw(uint8_t *dst, const uint8_t *src, const int width, const RGYLumaKeyParam& prm) {
+    int i = 0;
+    for (; i <= width - 32; i += 32) {
+        const __m512i z0 = lumakey_avx512(_mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i *)(src + i +  0))), prm);
+        const __m512i z1 = lumakey_avx512(_mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i *)(src + i + 16))), prm);
+        _mm_storeu_si128((__m128i *)(dst + i +  0), _mm512_cvtepi32_epi8(z0));
+        _mm_storeu_si128((__m128i *)(dst + i + 16), _mm512_cvtepi32_epi8(z1));
+    }
+    for (; i < width; i++) {
+        dst[i] = rgy_lumakey_pixel(src[i], prm);
+    }
+    _mm256_zeroupper();
+}
+
+void rgy_lumakey16_avx512bw(uint8_t *dst, const uint16_t *src, const int width, const RGYLumaKeyParam& prm) {
+    int i = 0;
+    for (; i <= width - 32; i += 32) {
+        const __m512i z0 = lumakey_avx512(_mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i *)(src + i +  0))), prm);
+        const __m512i z1 = lumakey_avx512(_mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i *)(src + i + 16))), prm);
+        _mm_storeu_si128((__m128i *)(dst + i +  0), _mm512_cvtepi32_epi8(z0));
+        _mm_storeu_si128((__m128i *)(dst + i + 16), _mm512_cvtepi32_epi8(z1));
+    }
+    for (; i < width; i++) {
+        dst[i] = rgy_lumakey_pixel(src[i], prm);
+    }
+    _mm256_zeroupper();
+}
+
+#endif //#if defined(_M_X64) || defined(__x86_64)
@@ -0,0 +1,602 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2024 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// --------------------------------------------------------------------------------------------
+
+#include <cmath>
+#include <cstring>
+#include <thread>
+#include <atomic>
+#include <filesystem>
+#include "rgy_util.h"
+#include "rgy_lut3d.h"
+
+static const int LUT3D_MAX_SIZE = 256;
+static const int LUT3D_MAX_PRELUT_SIZE = 65536;
+
+static const double LUT3D_POW10[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,
+    1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19,
+    1e20, 1e21, 1e22
+};
+
+static inline bool lut3d_is_space(const char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static inline bool lut3d_is_digit(const char c) {
+    return '0' <= c && c <= '9';
+}
+
+const char *rgy_parse_float(const char *ptr, const char *fin, float *value) {
+    while (ptr < fin && lut3d_is_space(*ptr)) ptr++;
+    if (ptr >= fin) return nullptr;
+
+    bool negative = false;
+    if (*ptr == '-' || *ptr == '+') {
+        negative = *ptr == '-';
+        ptr++;
+    }
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int exp10 = 0;
+    bool found = false;
+    for (; ptr < fin && lut3d_is_digit(*ptr); ptr++) {
+        found = true;
+        if (digits < 19) {
+            mantissa = mantissa * 10 + (*ptr - '0');
+            if (mantissa) digits++;
+        } else {
+            exp10++;
+        }
+    }
+    if (ptr < fin && *ptr == '.') {
+        ptr++;
+        for (; ptr < fin && lut3d_is_digit(*ptr); ptr++) {
+            found = true;
+            if (digits < 19) {
+                mantissa = mantissa * 10 + (*ptr - '0');
+                if (mantissa) digits++;
+                exp10--;
+            }
+        }
+    }
+    if (!found) return nullptr;
+    if (ptr < fin && (*ptr == 'e' || *ptr == 'E')) {
+        const char *ptrExp = ptr + 1;
+        bool expNegative = false;
+        if (ptrExp < fin && (*ptrExp == '-' || *ptrExp == '+')) {
+            expNegative = *ptrExp == '-';
+            ptrExp++;
+        }
+        if (ptrExp < fin && lut3d_is_digit(*ptrExp)) {
+            int e = 0;
+            for (; ptrExp < fin && lut3d_is_digit(*ptrExp); ptrExp++) {
+                if (e < 10000) e = e * 10 + (*ptrExp - '0');
+            }
+            exp10 += (expNegative) ? -e : e;
+            ptr = ptrExp;
+        }
+    }
+    double v = (double)mantissa;
+    if (mantissa != 0 && exp10 != 0) {
+        const int exp10abs = std::abs(exp10);
+        const double scale = (exp10abs < (int)_countof(LUT3D_POW10)) ? LUT3D_POW10[exp10abs] : std::pow(10.0, (double)exp10abs);
+        v = (exp10 < 0) ? v / scale : v * scale;
+    }
+    *value = (float)((negative) ? -v : v);
+    return ptr;
+}
+
+// 行頭のキーワードに一致するか確認し、一致すればその直後を返す
+static const char *lut3d_match_keyword(const char *ptr, const char *fin, const char *keyword) {
+    const size_t len = strlen(keyword);
+    if ((size_t)(fin - ptr) < len || memcmp(ptr, keyword, len) != 0) {
+        return nullptr;
+    }
+    ptr += len;
+    return (ptr == fin || lut3d_is_space(*ptr)) ? ptr : nullptr;
+}
+
+static bool lut3d_parse_floats(const char *ptr, const char *fin, float *values, const int count) {
+    for (int i = 0; i < count; i++) {
+        if ((ptr = rgy_parse_float(ptr, fin, &values[i])) == nullptr) {
+            return false;
+        }
+    }
+    return true;
+}
+
+RGYLUT3D::RGYLUT3D() :
+    m_size(0),
+    m_prelutSize(0),
+    m_domainMin(),
+    m_domainMax(),
+    m_prelutMin(),
+    m_prelutMax(),
+    m_prelut(),
+    m_table(),
+    m_mapped(),
+    m_mappedTable(nullptr),
+    m_fromCache(false) {
+    clear();
+}
+
+RGYLUT3D::~RGYLUT3D() {
+    clear();
+}
+
+void RGYLUT3D::clear() {
+    m_size = 0;
+    m_prelutSize = 0;
+    for (int i = 0; i < 3; i++) {
+        m_domainMin[i] = 0.0f;
+        m_domainMax[i] = 1.0f;
+        m_prelutMin[i] = 0.0f;
+        m_prelutMax[i] = 1.0f;
+    }
+    m_prelut.clear();
+    m_table.clear();
+    m_mappedTable = nullptr;
+    m_mapped.reset();
+    m_fromCache = false;
+}
+
+const RGYLUT3DVec *RGYLUT3D::table() const {
+    return (m_mappedTable) ? m_mappedTable : m_table.data();
+}
+
+RGY_ERR RGYLUT3D::load(const tstring& filename, std::shared_ptr<RGYLog> log, bool useCache) {
+    if (check_ext(filename, { ".rgylut3d" })) {
+        auto err = loadBinary(filename);
+        if (err != RGY_ERR_NONE) {
+            log->write(RGY_LOG_ERROR, RGY_LOGT_VPP, _T("Failed to load lut3d binary file: %s: %s\n"), filename.c_str(), get_err_mes(err));
+        }
+        return err;
+    }
+    if (!check_ext(filename, { ".cube" })) {
+        log->write(RGY_LOG_ERROR, RGY_LOGT_VPP, _T("Unsupported lut3d file type: %s\n"), filename.c_str());
+        return RGY_ERR_UNSUPPORTED;
+    }
+    std::error_code ec;
+    const uint64_t srcFileSize = (uint64_t)std::filesystem::file_size(std::filesystem::path(filename), ec);
+    int64_t srcFileTime = 0;
+    const bool srcFileInfoAvail = !ec && rgy_get_filetime(filename.c_str(), &srcFileTime);
+    const auto cacheFile = filename + RGY_LUT3D_BIN_EXT;
+    if (useCache && srcFileInfoAvail && rgy_file_exists(cacheFile)) {
+        if (loadBinary(cacheFile, srcFileSize, srcFileTime) == RGY_ERR_NONE) {
+            m_fromCache = true;
+            log->write(RGY_LOG_DEBUG, RGY_LOGT_VPP, _T("Loaded lut3d from cache: %s\n"), cacheFile.c_str());
+            return RGY_ERR_NONE;
+        }
+        log->write(RGY_LOG_DEBUG, RGY_LOGT_VPP, _T("lut3d cache is outdated or invalid, ignored: %s\n"), cacheFile.c_str());
+    }
+    auto err = loadCube(filename);
+    if (err != RGY_ERR_NONE) {
+        log->write(RGY_LOG_ERROR, RGY_LOGT_VPP, _T("Failed to load lut3d cube file: %s: %s\n"), filename.c_str(), get_err_mes(err));
+        return err;
+    }
+    log->write(RGY_LOG_DEBUG, RGY_LOGT_VPP, _T("Loaded lut3d cube file: %s, size %d, prelut %d\n"), filename.c_str(), m_size, m_prelutSize);
+    if (useCache && srcFileInfoAvail) {
+        // キャッシュが作成できなくても処理は継続する
+        if (saveBinary(cacheFile, RGYLUT3DBinDataType::FP32, srcFileSize, srcFileTime) == RGY_ERR_NONE) {
+            log->write(RGY_LOG_DEBUG, RGY_LOGT_VPP, _T("Created lut3d cache: %s\n"), cacheFile.c_str());
+        } else {
+            log->write(RGY_LOG_DEBUG, RGY_LOGT_VPP, _T("Failed to create lut3d cache: %s\n"), cacheFile.c_str());
+        }
+    }
+    return RGY_ERR_NONE;
+}
+
+RGY_ERR RGYLUT3D::loadCube(const tstring& filename, int threads) {
+    clear();
+
+    std::vector<char> buffer;
+    {
+        FILE *fptmp = nullptr;
+        if (_tfopen_s(&fptmp, filename.c_str(), _T("rb")) != 0 || fptmp == nullptr) {
+            return RGY_ERR_FILE_OPEN;
+        }
+        std::unique_ptr<FILE, fp_deleter> fp(fptmp, fp_deleter());
+        std::error_code ec;
+        const uint64_t filesize = (uint64_t)std::filesystem::file_size(std::filesystem::path(filename), ec);
+        if (ec) {
+            return RGY_ERR_FILE_OPEN;
+        }
+        buffer.resize((size_t)filesize + 1, '\0');
+        if (filesize > 0 && fread(buffer.data(), 1, (size_t)filesize, fp.get()) != (size_t)filesize) {
+            return RGY_ERR_FILE_OPEN;
+        }
+        buffer.resize((size_t)filesize);
+    }
+
+    // ヘッダを解析し、データ行の位置を列挙する
+    bool prelutRangeSet = false;
+    std::vector<size_t> dataLines;
+    const char *const bufStart = buffer.data();
+    const char *const bufFin = bufStart + buffer.size();
+    for (const char *line = bufStart; line < bufFin; ) {
+        const char *lineFin = (const char *)memchr(line, '\n', bufFin - line);
+        if (lineFin == nullptr) lineFin = bufFin;
+        const char *ptr = line;
+        while (ptr < lineFin && lut3d_is_space(*ptr)) ptr++;
+        if (ptr < lineFin && *ptr != '#') {
+            const char c = *ptr;
+            const char *args = nullptr;
+            if (lut3d_is_digit(c) || c == '-' || c == '+' || c == '.') {
+                dataLines.push_back(ptr - bufStart);
+            } else if ((args = lut3d_match_keyword(ptr, lineFin, "LUT_3D_SIZE")) != nullptr) {
+                float value = 0.0f;
+                if (!lut3d_parse_floats(args, lineFin, &value, 1) || value < 2.0f || value > (float)LUT3D_MAX_SIZE) {
+                    return RGY_ERR_INVALID_DATA_TYPE;
+                }
+                m_size = (int)value;
+            } else if ((args = lut3d_match_keyword(ptr, lineFin, "LUT_1D_SIZE")) != nullptr) {
+                float value = 0.0f;
+                if (!lut3d_parse_floats(args, lineFin, &value, 1) || value < 2.0f || value > (float)LUT3D_MAX_PRELUT_SIZE) {
+                    return RGY_ERR_INVALID_DATA_TYPE;
+                }
+                m_prelutSize = (int)value;
+            } else if ((args = lut3d_match_keyword(ptr, lineFin, "DOMAIN_MIN")) != nullptr) {
+                if (!lut3d_parse_floats(args, lineFin, m_domainMin, 3)) return RGY_ERR_INVALID_DATA_TYPE;
+                if (!prelutRangeSet) memcpy(m_prelutMin, m_domainMin, sizeof(m_prelutMin));
+            } else if ((args = lut3d_match_keyword(ptr, lineFin, "DOMAIN_MAX")) != nullptr) {
+                if (!lut3d_parse_floats(args, lineFin, m_domainMax, 3)) return RGY_ERR_INVALID_DATA_TYPE;
+                if (!prelutRangeSet) memcpy(m_prelutMax, m_domainMax, sizeof(m_prelutMax));
+            } else if ((args = lut3d_match_keyword(ptr, lineFin, "LUT_3D_INPUT_RANGE")) != nullptr) {
+                float range[2];
+                if (!lut3d_parse_floats(args, lineFin, range, 2)) return RGY_ERR_INVALID_DATA_TYPE;
+                for (int i = 0; i < 3; i++) {
+                    m_domainMin[i] = range[0];
+                    m_domainMax[i] = range[1];
+                }
+            } else if ((args = lut3d_match_keyword(ptr, lineFin, "LUT_1D_INPUT_RANGE")) != nullptr) {
+                float range[2];
+                if (!lut3d_parse_floats(args, lineFin, range, 2)) return RGY_ERR_INVALID_DATA_TYPE;
+                for (int i = 0; i < 3; i++) {
+                    m_prelutMin[i] = range[0];
+                    m_prelutMax[i] = range[1];
+                }
+                prelutRangeSet = true;
+            }
+            // TITLE等、その他のキーワードは無視する
+        }
+        line = lineFin + 1;
+    }
+    if (m_size <= 0) {
+        return RGY_ERR_INVALID_DATA_TYPE;
+    }
+    const size_t size01 = (size_t)m_size * m_size;
+    const size_t tableSize = size01 * m_size;
+    if (dataLines.size() != (size_t)m_prelutSize + tableSize) {
+        return RGY_ERR_INVALID_DATA_TYPE;
+    }
+    m_prelut.resize((size_t)m_prelutSize * 3);
+    m_table.resize(tableSize);
+
+    // データ行のパースは行ごとに独立しているので、分割して並列に処理する
+    if (threads <= 0) {
+        threads = (int)std::thread::hardware_concurrency();
+    }
+    static const size_t LINES_PER_THREAD_MIN = 16384;
+    threads = (int)clamp((dataLines.size() + LINES_PER_THREAD_MIN - 1) / LINES_PER_THREAD_MIN, (size_t)1, (size_t)std::max(threads, 1));
+
+    std::atomic<bool> parseError(false);
+    auto parseLines = [&](const size_t start, const size_t fin) {
+        for (size_t iline = start; iline < fin; iline++) {
+            const char *ptr = bufStart + dataLines[iline];
+            const char *lineFin = (const char *)memchr(ptr, '\n', bufFin - ptr);
+            if (lineFin == nullptr) lineFin = bufFin;
+            float value[3];
+            if (!lut3d_parse_floats(ptr, lineFin, value, 3)) {
+                parseError = true;
+                return;
+            }
+            if (iline < (size_t)m_prelutSize) {
+                for (int i = 0; i < 3; i++) {
+                    m_prelut[i * m_prelutSize + iline] = value[i];
+                }
+            } else {
+                // .cubeはrが最も速く変化する
+                const size_t idx = iline - m_prelutSize;
+                const size_t b = idx / size01;
+                const size_t g = (idx - size01 * b) / m_size;
+                const size_t r = idx - size01 * b - m_size * g;
+                auto& entry = m_table[r * size01 + g * m_size + b];
+                entry.x = value[0];
+                entry.y = value[1];
+                entry.z = value[2];
+                entry.w = 0.0f;
+            }
+        }
+    };
+    if (threads <= 1) {
+        parseLines(0, dataLines.size());
+    } else {
+        std::vector<std::thread> workers;
+        const size_t linesPerThread = (dataLines.size() + threads - 1) / threads;
+        for (int ith = 0; ith < threads; ith++) {
+            const size_t start = linesPerThread * ith;
+            const size_t fin = std::min(start + linesPerThread, dataLines.size());
+            if (start >= fin) break;
+            workers.push_back(std::thread(parseLines, start, fin));
+        }
+        for (auto& th : workers) {
+            th.join();
+        }
+    }
+    if (parseError) {
+        clear();
+        return RGY_ERR_INVALID_DATA_TYPE;
+    }
+    return RGY_ERR_NONE;
+}
+
+RGY_ERR RGYLUT3D::loadBinary(const tstring& filename, const uint64_t srcFileSize, const int64_t srcFileTime) {
+    clear();
+    auto mapped = std::make_unique<RGYMappedFile>();
+    if (!mapped->open(filename.c_str())) {
+        return RGY_ERR_FILE_OPEN;
+    }
+    const auto filesize = mapped->size();
+    if (filesize < sizeof(RGYLUT3DBinHeader)) {
+        return RGY_ERR_INVALID_FORMAT;
+    }
+    RGYLUT3DBinHeader header;
+    memcpy(&header, mapped->data(), sizeof(header));
+    if (memcmp(header.magic, RGY_LUT3D_BIN_MAGIC, sizeof(header.magic)) != 0
+        || header.headerSize < sizeof(header)) {
+        return RGY_ERR_INVALID_FORMAT;
+    }
+    if (header.version != RGY_LUT3D_BIN_VERSION) {
+        return RGY_ERR_INVALID_VERSION;
+    }
+    if (header.lutSize < 2 || header.lutSize > (uint32_t)LUT3D_MAX_SIZE
+        || header.prelutSize > (uint32_t)LUT3D_MAX_PRELUT_SIZE
+        || (header.dataType != (uint32_t)RGYLUT3DBinDataType::FP32 && header.dataType != (uint32_t)RGYLUT3DBinDataType::FP16)) {
+        return RGY_ERR_INVALID_FORMAT;
+    }
+    // キャッシュとして使用する場合は、変換元のファイルと一致するか確認する
+    if ((srcFileSize != 0 || srcFileTime != 0)
+        && (header.srcFileSize != srcFileSize || header.srcFileTime != srcFileTime)) {
+        return RGY_ERR_INVALID_VERSION;
+    }
+    const uint64_t tableSize = (uint64_t)header.lutSize * header.lutSize * header.lutSize;
+    const uint64_t elemSize = (header.dataType == (uint32_t)RGYLUT3DBinDataType::FP32) ? sizeof(float) * 4 : sizeof(uint16_t) * 4;
+    const uint64_t prelutBytes = (uint64_t)header.prelutSize * 3 * sizeof(float);
+    if (header.lutBytes != tableSize * elemSize
+        || header.lutOffset % sizeof(float) != 0
+        || header.lutOffset + header.lutBytes > filesize
+        || (prelutBytes > 0 && header.prelutOffset + prelutBytes > filesize)) {
+        return RGY_ERR_INVALID_FORMAT;
+    }
+
+    m_size = (int)header.lutSize;
+    m_prelutSize = (int)header.prelutSize;
+    memcpy(m_domainMin, header.domainMin, sizeof(m_domainMin));
+    memcpy(m_domainMax, header.domainMax, sizeof(m_domainMax));
+    memcpy(m_prelutMin, header.prelutMin, sizeof(m_prelutMin));
+    memcpy(m_prelutMax, header.prelutMax, sizeof(m_prelutMax));
+    if (m_prelutSize > 0) {
+        m_prelut.resize((size_t)m_prelutSize * 3);
+        memcpy(m_prelut.data(), mapped->data() + header.prelutOffset, prelutBytes);
+    }
+    if (header.dataType == (uint32_t)RGYLUT3DBinDataType::FP32) {
+        // fp32はそのままLUTVECとして使えるので、コピーせずマップしたまま使用する
+        m_mappedTable = (const RGYLUT3DVec *)(mapped->data() + header.lutOffset);
+        m_mapped = std::move(mapped);
+    } else {
+        const uint16_t *src = (const uint16_t *)(mapped->data() + header.lutOffset);
+        m_table.resize((size_t)tableSize);
+        for (size_t i = 0; i < m_table.size(); i++, src += 4) {
+            m_table[i].x = half2float(src[0]);
+            m_table[i].y = half2float(src[1]);
+            m_table[i].z = half2float(src[2]);
+            m_table[i].w = half2float(src[3]);
+        }
+    }
+    return RGY_ERR_NONE;
+}
+
+RGY_ERR RGYLUT3D::saveBinary(const tstring& filename, const RGYLUT3DBinDataType dataType, const uint64_t srcFileSize, const int64_t srcFileTime) const {
+    if (m_size <= 0) {
+        return RGY_ERR_NOT_INITIALIZED;
+    }
+    const uint64_t tableSize = (uint64_t)m_size * m_size * m_size;
+    const uint64_t elemSize = (dataType == RGYLUT3DBinDataType::FP32) ? sizeof(float) * 4 : sizeof(uint16_t) * 4;
+
+    RGYLUT3DBinHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, RGY_LUT3D_BIN_MAGIC, sizeof(header.magic));
+    header.version = RGY_LUT3D_BIN_VERSION;
+    header.headerSize = sizeof(header);
+    header.dataType = (uint32_t)dataType;
+    header.lutSize = (uint32_t)m_size;
+    header.prelutSize = (uint32_t)m_prelutSize;
+    memcpy(header.domainMin, m_domainMin, sizeof(header.domainMin));
+    memcpy(header.domainMax, m_domainMax, sizeof(header.domainMax));
+    memcpy(header.prelutMin, m_prelutMin, sizeof(header.prelutMin));
+    memcpy(header.prelutMax, m_prelutMax, sizeof(header.prelutMax));
+    header.srcFileSize = srcFileSize;
+    header.srcFileTime = srcFileTime;
+    header.prelutOffset = ALIGN(sizeof(header), RGY_LUT3D_BIN_ALIGN);
+    header.lutOffset = ALIGN(header.prelutOffset + m_prelut.size() * sizeof(float), RGY_LUT3D_BIN_ALIGN);
+    header.lutBytes = tableSize * elemSize;
+
+    std::vector<uint8_t> data((size_t)(header.lutOffset + header.lutBytes), 0);
+    memcpy(data.data(), &header, sizeof(header));
+    if (m_prelut.size() > 0) {
+        memcpy(data.data() + header.prelutOffset, m_prelut.data(), m_prelut.size() * sizeof(float));
+    }
+    if (dataType == RGYLUT3DBinDataType::FP32) {
+        memcpy(data.data() + header.lutOffset, table(), (size_t)header.lutBytes);
+    } else {
+        uint16_t *dst = (uint16_t *)(data.data() + header.lutOffset);
+        const RGYLUT3DVec *src = table();
+        for (size_t i = 0; i < tableSize; i++, dst += 4) {
+            dst[0] = float2half(src[i].x);
+            dst[1] = float2half(src[i].y);
+            dst[2] = float2half(src[i].z);
+            dst[3] = float2half(src[i].w);
+        }
+    }
+
+    // 複数のプロセスから同時に作成される可能性があるので、一時ファイルに書いてからリネームする
+    const auto tmpFile = filename + strsprintf(_T(".%u.tmp"), GetCurrentProcessId());
+    {
+        FILE *fptmp = nullptr;
+        if (_tfopen_s(&fptmp, tmpFile.c_str(), _T("wb")) != 0 || fptmp == nullptr) {
+            return RGY_ERR_FILE_OPEN;
+        }
+        std::unique_ptr<FILE, fp_deleter> fp(fptmp, fp_deleter());
+        if (fwrite(data.data(), 1, data.size(), fp.get()) != data.size()) {
+            fp.reset();
+            _tremove(tmpFile.c_str());
+            return RGY_ERR_UNDEFINED_BEHAVIOR;
+        }
+    }
+    std::error_code ec;
+    std::filesystem::rename(std::filesystem::path(tmpFile), std::filesystem::path(filename), ec);
+    if (ec) {
+        _tremove(tmpFile.c_str());
+        return RGY_ERR_FILE_OPEN;
+    }
+    return RGY_ERR_NONE;
+}
+
+RGYLUT3DVec RGYLUT3D::get(int r, int g, int b) const {
+    return table()[r * m_size * m_size + g * m_size + b];
+}
+
+static inline float lut3d_lerp(float v0, float v1, float a) {
+    return v0 + (v1 - v0) * a;
+}
+
+static inline RGYLUT3DVec lut3d_lerp(const RGYLUT3DVec& v0, const RGYLUT3DVec& v1, float a) {
+    return RGYLUT3DVec{ lut3d_lerp(v0.x, v1.x, a), lut3d_lerp(v0.y, v1.y, a), lut3d_lerp(v0.z, v1.z, a), 0.0f };
+}
+
+static inline int lut3d_prev(float x) {
+    return (int)x;
+}
+
+static inline int lut3d_next(float x, int size) {
+    const int next = lut3d_prev(x) + 1;
+    return (next >= size) ? size - 1 : next;
+}
+
+float RGYLUT3D::applyPrelut(float s, int ch) const {
+    const float scale = (float)(m_prelutSize - 1) / (m_prelutMax[ch] - m_prelutMin[ch]);
+    const float x = clamp((s - m_prelutMin[ch]) * scale, 0.0f, (float)(m_prelutSize - 1));
+    const float c0 = m_prelut[ch * m_prelutSize + lut3d_prev(x)];
+    const float c1 = m_prelut[ch * m_prelutSize + lut3d_next(x, m_prelutSize)];
+    return lut3d_lerp(c0, c1, x - lut3d_prev(x));
+}
+
+RGYLUT3DVec RGYLUT3D::apply(const RGYLUT3DVec& in, const LUT3DInterp interpMode) const {
+    RGYLUT3DVec x = in;
+    if (m_prelutSize > 0) {
+        x.x = applyPrelut(x.x, 0);
+        x.y = applyPrelut(x.y, 1);
+        x.z = applyPrelut(x.z, 2);
+    }
+    // NVEncFilterColorspaceのlut3dと同じスケーリング (演算の順序も合わせる)
+    const float lut_max_idx = (float)(m_size - 1) + 1e-6f;
+    float *v[3] = { &x.x, &x.y, &x.z };
+    for (int i = 0; i < 3; i++) {
+        const float scale_to_table = clamp(1.0f / (m_domainMax[i] - m_domainMin[i]), 0.0f, 1.0f) * (float)(m_size - 1);
+        *v[i] = clamp(*v[i] * scale_to_table, 0.0f, lut_max_idx);
+    }
+    return interp(x, interpMode);
+}
+
+RGYLUT3DVec RGYLUT3D::interp(const RGYLUT3DVec& in, const LUT3DInterp interpMode) const {
+    if (interpMode == LUT3DInterp::Nearest) {
+        return get((int)(in.x + 0.5f), (int)(in.y + 0.5f), (int)(in.z + 0.5f));
+    }
+    const int x0 = lut3d_prev(in.x);
+    const int x1 = lut3d_next(in.x, m_size);
+    const int y0 = lut3d_prev(in.y);
+    const int y1 = lut3d_next(in.y, m_size);
+    const int z0 = lut3d_prev(in.z);
+    const int z1 = lut3d_next(in.z, m_size);
+    const float scalex = in.x - x0;
+    const float scaley = in.y - y0;
+    const float scalez = in.z - z0;
+    if (interpMode == LUT3DInterp::Tetrahedral) {
+        float scale0, scale1, scale2;
+        int xA, yA, zA, xB, yB, zB;
+        if (scalex > scaley) {
+            if (scaley > scalez) {
+                scale0 = scalex; scale1 = scaley; scale2 = scalez;
+                xA = x1; yA = y0; zA = z0;
+                xB = x1; yB = y1; zB = z0;
+            } else if (scalex > scalez) {
+                scale0 = scalex; scale1 = scalez; scale2 = scaley;
+                xA = x1; yA = y0; zA = z0;
+                xB = x1; yB = y0; zB = z1;
+            } else {
+                scale0 = scalez; scale1 = scalex; scale2 = scaley;
+                xA = x0; yA = y0; zA = z1;
+                xB = x1; yB = y0; zB = z1;
+            }
+        } else {
+            if (scalez > scaley) {
+                scale0 = scalez; scale1 = scaley; scale2 = scalex;
+                xA = x0; yA = y0; zA = z1;
+                xB = x0; yB = y1; zB = z1;
+            } else if (scalez > scalex) {
+                scale0 = scaley; scale1 = scalez; scale2 = scalex;
+                xA = x0; yA = y1; zA = z0;
+                xB = x0; yB = y1; zB = z1;
+            } else {
+                scale0 = scaley; scale1 = scalex; scale2 = scalez;
+                xA = x0; yA = y1; zA = z0;
+                xB = x1; yB = y1; zB = z0;
+            }
+        }
+        const auto c000 = get(x0, y0, z0);
+        const auto c111 = get(x1, y1, z1);
+        const auto cA   = get(xA, yA, zA);
+        const auto cB   = get(xB, yB, zB);
+        const float s0 = 1.0f - scale0;
+        const float s1 = scale0 - scale1;
+        const float s2 = scale1 - scale2;
+        const float s3 = scale2;
+        return RGYLUT3DVec{
+            s0 * c000.x + s1 * cA.x + s2 * cB.x + s3 * c111.x,
+            s0 * c000.y + s1 * cA.y + s2 * cB.y + s3 * c111.y,
+            s0 * c000.z + s1 * cA.z + s2 * cB.z + s3 * c111.z,
+            0.0f };
+    }
+    // Trilinear (Pyramid, Prismの参照実装は未実装のためTrilinearで代用)
+    const auto c00 = lut3d_lerp(get(x0, y0, z0), get(x1, y0, z0), scalex);
+    const auto c10 = lut3d_lerp(get(x0, y1, z0), get(x1, y1, z0), scalex);
+    const auto c01 = lut3d_lerp(get(x0, y0, z1), get(x1, y0, z1), scalex);
+    const auto c11 = lut3d_lerp(get(x0, y1, z1), get(x1, y1, z1), scalex);
+    const auto c0  = lut3d_lerp(c00, c10, scaley);
+    const auto c1  = lut3d_lerp(c01, c11, scaley);
+    return lut3d_lerp(c0, c1, scalez);
+}
@@ -0,0 +1,132 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2024 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// --------------------------------------------------------------------------------------------
+
+#pragma once
+#ifndef __RGY_LUT3D_H__
+#define __RGY_LUT3D_H__
+
+#include <cstdint>
+#include <vector>
+#include <memory>
+#include "rgy_tchar.h"
+#include "rgy_err.h"
+#include "rgy_log.h"
+#include "rgy_prm.h"
+#include "rgy_filesystem.h"
+
+// バイナリ形式のLUT3Dファイル
+//
+//  [RGYLUT3DBinHeader]
+//  [prelut]  float32 x prelutSize x 3 (r, g, b の順にそれぞれprelutSize個)
+//  [lut]     float32x4 or float16x4 x lutSize^3 (lutOffsetから、r * lutSize^2 + g * lutSize + b の順)
+//
+// fp32の場合はlutの部分がそのままLUTVEC(float4)の配列としてGPUに転送できる
+// マルチバイトの値はすべてリトルエンディアン
+static const char RGY_LUT3D_BIN_MAGIC[8] = { 'R', 'G', 'Y', 'L', 'U', 'T', '3', 'D' };
+static const uint32_t RGY_LUT3D_BIN_VERSION = 1;
+static const TCHAR *RGY_LUT3D_BIN_EXT = _T(".rgylut3d");
+static const size_t RGY_LUT3D_BIN_ALIGN = 64;
+
+enum class RGYLUT3DBinDataType : uint32_t {
+    FP32 = 0,
+    FP16 = 1,
+};
+
+struct RGYLUT3DBinHeader {
+    char     magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    uint32_t dataType;     // RGYLUT3DBinDataType
+    uint32_t lutSize;      // 一辺のサイズ
+    uint32_t prelutSize;   // 0ならprelutなし
+    uint32_t reserved;
+    float    domainMin[3];
+    float    domainMax[3];
+    float    prelutMin[3];
+    float    prelutMax[3];
+    uint64_t srcFileSize;  // 変換元のファイルサイズ (キャッシュの検証用)
+    int64_t  srcFileTime;  // 変換元の更新時刻 (キャッシュの検証用)
+    uint64_t prelutOffset; // ファイル先頭からのオフセット
+    uint64_t lutOffset;    // ファイル先頭からのオフセット
+    uint64_t lutBytes;
+};
+static_assert(sizeof(RGYLUT3DBinHeader) == 120, "unexpected size of RGYLUT3DBinHeader");
+
+// LUTVEC(float4)と同じメモリ配置
+struct RGYLUT3DVec {
+    float x, y, z, w;
+};
+
+class RGYLUT3D {
+public:
+    RGYLUT3D();
+    ~RGYLUT3D();
+
+    // 拡張子から形式を判定して読み込む
+    // .cubeの場合は同じ場所にキャッシュ(<file>.cube.rgylut3d)を作成し、次回以降はそちらを使用する
+    RGY_ERR load(const tstring& filename, std::shared_ptr<RGYLog> log, bool useCache = true);
+    RGY_ERR loadCube(const tstring& filename, int threads = 0);
+    RGY_ERR loadBinary(const tstring& filename, const uint64_t srcFileSize = 0, const int64_t srcFileTime = 0);
+    RGY_ERR saveBinary(const tstring& filename, const RGYLUT3DBinDataType dataType, const uint64_t srcFileSize = 0, const int64_t srcFileTime = 0) const;
+    void clear();
+
+    int size() const { return m_size; }
+    int prelutSize() const { return m_prelutSize; }
+    const RGYLUT3DVec *table() const;
+    size_t tableBytes() const { return sizeof(RGYLUT3DVec) * m_size * m_size * m_size; }
+    const float *prelut() const { return m_prelut.data(); }
+    const float *domainMin() const { return m_domainMin; }
+    const float *domainMax() const { return m_domainMax; }
+    const float *prelutMin() const { return m_prelutMin; }
+    const float *prelutMax() const { return m_prelutMax; }
+    bool fromCache() const { return m_fromCache; }
+
+    // GPUのlut3dと同じ計算をCPUで行う参照実装
+    RGYLUT3DVec apply(const RGYLUT3DVec& in, const LUT3DInterp interp) const;
+    RGYLUT3DVec interp(const RGYLUT3DVec& idx, const LUT3DInterp interp) const;
+protected:
+    RGYLUT3DVec get(int r, int g, int b) const;
+    float applyPrelut(float x, int ch) const;
+
+    int m_size;
+    int m_prelutSize;
+    float m_domainMin[3];
+    float m_domainMax[3];
+    float m_prelutMin[3];
+    float m_prelutMax[3];
+    std::vector<float> m_prelut;
+    std::vector<RGYLUT3DVec> m_table;  // テキストからの読み込み時、fp16からの変換時
+    std::unique_ptr<RGYMappedFile> m_mapped; // fp32のバイナリはマップしたまま使う
+    const RGYLUT3DVec *m_mappedTable;
+    bool m_fromCache;
+};
+
+// ロケールに依存しない高速なfloatのパース
+// 成功すると数値の直後を指すポインタを返し、失敗するとnullptrを返す
+const char *rgy_parse_float(const char *ptr, const char *fin, float *value);
+
+#endif //__RGY_LUT3D_H__
@@ -0,0 +1,218 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2024 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// --------------------------------------------------------------------------------------------
+
+#include <cmath>
+#include <algorithm>
+#include "rgy_metrics.h"
+
+RGYMetricScores::RGYMetricScores() : m_scores() {
+
+}
+
+void RGYMetricScores::clear() {
+    m_scores.clear();
+}
+
+void RGYMetricScores::add(const int index, const double value) {
+    m_scores.push_back(std::make_pair(index, value));
+}
+
+void RGYMetricScores::merge(const RGYMetricScores& x) {
+    m_scores.insert(m_scores.end(), x.m_scores.begin(), x.m_scores.end());
+}
+
+double RGYMetricScores::mean() const {
+    if (m_scores.empty()) return 0.0;
+    double sum = 0.0;
+    for (const auto& s : m_scores) {
+        sum += s.second;
+    }
+    return sum / (double)m_scores.size();
+}
+
+double RGYMetricScores::harmonicMean() const {
+    if (m_scores.empty()) return 0.0;
+    double sum = 0.0;
+    for (const auto& s : m_scores) {
+        sum += 1.0 / (s.second + 1.0);
+    }
+    return (double)m_scores.size() / sum - 1.0;
+}
+
+double RGYMetricScores::minScore() const {
+    if (m_scores.empty()) return 0.0;
+    return std::min_element(m_scores.begin(), m_scores.end(), [](const std::pair<int, double>& a, const std::pair<int, double>& b) {
+        return a.second < b.second;
+    })->second;
+}
+
+double RGYMetricScores::maxScore() const {
+    if (m_scores.empty()) return 0.0;
+    return std::max_element(m_scores.begin(), m_scores.end(), [](const std::pair<int, double>& a, const std::pair<int, double>& b) {
+        return a.second < b.second;
+    })->second;
+}
+
+double RGYMetricScores::percentile(const double percent) const {
+    if (m_scores.empty()) return 0.0;
+    std::vector<double> values(m_scores.size());
+    for (size_t i = 0; i < m_scores.size(); i++) {
+        values[i] = m_scores[i].second;
+    }
+    std::sort(values.begin(), values.end());
+    const double pos = std::min(std::max(percent, 0.0), 100.0) * 0.01 * (double)(values.size() - 1);
+    const size_t idx = (size_t)pos;
+    if (idx + 1 >= values.size()) {
+        return values.back();
+    }
+    const double frac = pos - (double)idx;
+    return values[idx] + (values[idx + 1] - values[idx]) * frac;
+}
+
+std::vector<std::pair<int, double>> RGYMetricScores::sorted() const {
+    auto scores = m_scores;
+    std::sort(scores.begin(), scores.end());
+    return scores;
+}
+
+template<typename Type>
+static void ssim_block_row_c(RGYSsimBlock *dst, const uint8_t *p0, const int pitch0, const uint8_t *p1, const int pitch1, const int blocks) {
+    for (int ib = 0; ib < blocks; ib++) {
+        RGYSsimBlock sum = { 0, 0, 0, 0 };
+        for (int y = 0; y < 4; y++) {
+            const Type *ptr0 = (const Type *)(p0 + y * pitch0) + ib * 4;
+            const Type *ptr1 = (const Type *)(p1 + y * pitch1) + ib * 4;
+            for (int x = 0; x < 4; x++) {
+                const int64_t a = ptr0[x];
+                const int64_t b = ptr1[x];
+                sum.s1 += a;
+                sum.s2 += b;
+                sum.ss += a * a + b * b;
+                sum.s12 += a * b;
+            }
+        }
+        dst[ib] = sum;
+    }
+}
+
+void rgy_ssim_block_row8_c(RGYSsimBlock *dst, const uint8_t *p0, const int pitch0, const uint8_t *p1, const int pitch1, const int blocks) {
+    ssim_block_row_c<uint8_t>(dst, p0, pitch0, p1, pitch1, blocks);
+}
+
+void rgy_ssim_block_row16_c(RGYSsimBlock *dst, const uint8_t *p0, const int pitch0, const uint8_t *p1, const int pitch1, const int blocks) {
+    ssim_block_row_c<uint16_t>(dst, p0, pitch0, p1, pitch1, blocks);
+}
+
+template<typename Type>
+static uint64_t sse_plane_c(const uint8_t *p0, const int pitch0, const uint8_t *p1, const int pitch1, const int width, const int height) {
+    uint64_t sse = 0;
+    for (int y = 0; y < height; y++) {
+        const Type *ptr0 = (const Type *)(p0 + y * pitch0);
+        const Type *ptr1 = (const Type *)(p1 + y * pitch1);
+        for (int x = 0; x < width; x++) {
+            const int64_t diff = (int64_t)ptr0[x] - (int64_t)ptr1[x];
+            sse += (uint64_t)(diff * diff);
+        }
+    }
+    return sse;
+}
+
+uint64_t rgy_sse_plane8_c(const uint8_t *p0, const int pitch0, const uint8_t *p1, const int pitch1, const int width, const int height) {
+    return sse_plane_c<uint8_t>(p0, pitch0, p1, pitch1, width, height);
+}
+
+uint64_t rgy_sse_plane16_c(const uint8_t *p0, const int pitch0, const uint8_t *p1, const int pitch1, const int width, const int height) {
+    return sse_plane_c<uint16_t>(p0, pitch0, p1, pitch1, width, height);
+}
+
+funcSsimBlockRow get_ssim_block_row_func(const int bitdepth) {
+#if defined(_M_IX86) || defined(_M_X64) || defined(__x86_64)
+    const auto simd = get_availableSIMD();
+    if ((simd & RGY_SIMD::AVX2) == RGY_SIMD::AVX2) {
+        if (bitdepth <= 8) return rgy_ssim_block_row8_avx2;
+        if (bitdepth <= 12) return rgy_ssim_block_row16_avx2;
+    }
+#endif
+    return (bitdepth <= 8) ? rgy_ssim_block_row8_c : rgy_ssim_block_row16_c;
+}
+
+funcSsePlane get_sse_plane_func(const int bitdepth) {
+#if defined(_M_IX86) || defined(_M_X64) || defined(__x86_64)
+    const auto simd = get_availableSIMD();
+    if ((simd & RGY_SIMD::AVX2) == RGY_SIMD::AVX2) {
+        if (bitdepth <= 8) return rgy_sse_plane8_avx2;
+        if (bitdepth <= 12) return rgy_sse_plane16_avx2;
+    }
+#endif
+    return (bitdepth <= 8) ? rgy_sse_plane8_c : rgy_sse_plane16_c;
+}
+
+// NVEncFilterSsim.cuのssim_end1xと同じ計算
+static float ssim_end1x(const int64_t s1, const int64_t s2, const int64_t ss, const int64_t s12, const int64_t ssim_c1, const int64_t ssim_c2) {
+    const int64_t vars = ss * 64 - s1 * s1 - s2 * s2;
+    const int64_t covar = s12 * 64 - s1 * s2;
+    return ((float)(2 * s1 * s2 + ssim_c1) * (float)(2 * covar + ssim_c2))
+        / ((float)(s1 * s1 + s2 * s2 + ssim_c1) * (float)(vars + ssim_c2));
+}
+
+double rgy_ssim_plane(const uint8_t *p0, const int pitch0, const uint8_t *p1, const int pitch1, const int width, const int height, const int bitdepth) {
+    const int blocksX = (width & (~3)) >> 2;
+    const int blocksY = (height & (~3)) >> 2;
+    if (blocksX < 2 || blocksY < 2) {
+        return 1.0;
+    }
+    const int64_t max = ((int64_t)1 << bitdepth) - 1;
+    const int64_t ssim_c1 = (int64_t)(0.01 * 0.01 * max * max * 64.0 + 0.5);
+    const int64_t ssim_c2 = (int64_t)(0.03 * 0.03 * max * max * 64.0 * 63.0 + 0.5);
+    const auto func_block_row = get_ssim_block_row_func(bitdepth);
+
+    //上下2行分のブロックの集計値を使いまわす
+    std::vector<RGYSsimBlock> rows(blocksX * 2);
+    RGYSsimBlock *rowPrev = rows.data();
+    RGYSsimBlock *rowCur = rows.data() + blocksX;
+    func_block_row(rowPrev, p0, pitch0, p1, pitch1, blocksX);
+    double ssim = 0.0;
+    for (int by = 1; by < blocksY; by++) {
+        func_block_row(rowCur, p0 + by * 4 * pitch0, pitch0, p1 + by * 4 * pitch1, pitch1, blocksX);
+        float ssimRow = 0.0f;
+        for (int bx = 0; bx < blocksX - 1; bx++) {
+            ssimRow += ssim_end1x(
+                rowPrev[bx].s1  + rowPrev[bx+1].s1  + rowCur[bx].s1  + rowCur[bx+1].s1,
+                rowPrev[bx].s2  + rowPrev[bx+1].s2  + rowCur[bx].s2  + rowCur[bx+1].s2,
+                rowPrev[bx].ss  + rowPrev[bx+1].ss  + rowCur[bx].ss  + rowCur[bx+1].ss,
+                rowPrev[bx].s12 + rowPrev[bx+1].s12 + rowCur[bx].s12 + rowCur[bx+1].s12,
+                ssim_c1, ssim_c2);
+        }
+        ssim += ssimRow;
+        std::swap(rowPrev, rowCur);
+    }
+    return ssim / (double)((blocksX - 1) * (blocksY - 1));
+}
+
+uint64_t rgy_sse_plane(const uint8_t *p0, const int pitch0, const uint8_t *p1, const int pitch1, const int width, const int height, const int bitdepth) {
+    return get_sse_plane_func(bitdepth)(p0, pitch0, p1, pitch1, width, height);
+}
@@ -0,0 +1,94 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2024 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// --------------------------------------------------------------------------------------------
+
+#pragma once
+#ifndef __RGY_METRICS_H__
+#define __RGY_METRICS_H__
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <utility>
+#include "rgy_simd.h"
+
+// フレームごとの評価値を保持し、まとめて集計する
+//  複数のスレッドで分割して計算した結果は merge() で結合してから集計する
+//  (区間ごとの平均値を平均するとフレーム数の偏りで結果がずれるため)
+class RGYMetricScores {
+public:
+    RGYMetricScores();
+    void clear();
+    void add(const int index, const double value);
+    void merge(const RGYMetricScores& x);
+    size_t count() const { return m_scores.size(); }
+    bool empty() const { return m_scores.empty(); }
+
+    double mean() const;
+    // libvmafのVMAF_POOL_METHOD_HARMONIC_MEANと同じ定義 (1/(x+1)の平均の逆数 - 1)
+    double harmonicMean() const;
+    double minScore() const;
+    double maxScore() const;
+    // percent = 0 - 100 (線形補間)
+    double percentile(const double percent) const;
+    // フレーム番号順に並べた評価値
+    std::vector<std::pair<int, double>> sorted() const;
+protected:
+    std::vector<std::pair<int, double>> m_scores; // フレーム番号, 評価値
+};
+
+// SSIMの4x4ブロックごとの集計値 (s1: Σa, s2: Σb, ss: Σa^2 + Σb^2, s12: Σab)
+struct RGYSsimBlock {
+    int64_t s1, s2, ss, s12;
+};
+
+// 1行分(高さ4)の4x4ブロックの集計値を求める
+typedef void (*funcSsimBlockRow)(RGYSsimBlock *dst, const uint8_t *p0, const int pitch0, const uint8_t *p1, const int pitch1, const int blocks);
+// 二乗誤差の合計を求める
+typedef uint64_t (*funcSsePlane)(const uint8_t *p0, const int pitch0, const uint8_t *p1, const int pitch1, const int width, const int height);
+
+void rgy_ssim_block_row8_c(RGYSsimBlock *dst, const uint8_t *p0, const int pitch0, const uint8_t *p1, const int pitch1, const int blocks);
+void rgy_ssim_block_row16_c(RGYSsimBlock *dst, const uint8_t *p0, const int pitch0, const uint8_t *p1, const int pitch1, const int blocks);
+uint64_t rgy_sse_plane8_c(const uint8_t *p0, const int pitch0, const uint8_t *p1, const int pitch1, const int width, const int height);
+uint64_t rgy_sse_plane16_c(const uint8_t *p0, const int pitch0, const uint8_t *p1, const int pitch1, const int width, const int height);
+#if defined(_M_IX86) || defined(_M_X64) || defined(__x86_64)
+// 16bit版は12bit以下の入力のみ
+void rgy_ssim_block_row8_avx2(RGYSsimBlock *dst, const uint8_t *p0, const int pitch0, const uint8_t *p1, const int pitch1, const int blocks);
+void rgy_ssim_block_row16_avx2(RGYSsimBlock *dst, const uint8_t *p0, const int pitch0, const uint8_t *p1, const int pitch1, const int blocks);
+uint64_t rgy_sse_plane8_avx2(const uint8_t *p0, const int pitch0, const uint8_t *p1, const int pitch1, const int width, const int height);
+uint64_t rgy_sse_plane16_avx2(const uint8_t *p0, const int pitch0, const uint8_t *p1, const int pitch1, const int width, const int height);
+#endif
+
+funcSsimBlockRow get_ssim_block_row_func(const int bitdepth);
+funcSsePlane get_sse_plane_func(const int bitdepth);
+
+// GPU版(NVEncFilterSsim.cu)と同じ方法で1プレーンのSSIMを求める
+//  8x8の窓を4画素ずつずらして評価し、その平均を返す
+double rgy_ssim_plane(const uint8_t *p0, const int pitch0, const uint8_t *p1, const int pitch1, const int width, const int height, const int bitdepth);
+// 1プレーンの二乗誤差の合計を求める
+uint64_t rgy_sse_plane(const uint8_t *p0, const int pitch0, const uint8_t *p1, const int pitch1, const int width, const int height, const int bitdepth);
+
+#endif //__RGY_METRICS_H__
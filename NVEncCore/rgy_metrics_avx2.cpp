@@ -0,0 +1,147 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2024 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// --------------------------------------------------------------------------------------------
+
+#include <immintrin.h>
+#include "rgy_osdep.h"
+#include "rgy_metrics.h"
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__x86_64)
+
+//16画素を16bitに拡張して読み込む
+template<bool is16>
+static RGY_FORCEINLINE __m256i load_16pix_avx2(const uint8_t *ptr) {
+    if (is16) {
+        return _mm256_loadu_si256((const __m256i *)ptr);
+    }
+    return _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)ptr));
+}
+
+// 12bit以下であれば、16bit x 2の積和(_mm256_madd_epi16)を4行分累積しても32bitに収まる
+template<bool is16>
+static void ssim_block_row_avx2(RGYSsimBlock *dst, const uint8_t *p0, const int pitch0, const uint8_t *p1, const int pitch1, const int blocks) {
+    const int pixsize = (is16) ? 2 : 1;
+    const __m256i ones = _mm256_set1_epi16(1);
+    int ib = 0;
+    for (; ib + 4 <= blocks; ib += 4) {
+        __m256i s1 = _mm256_setzero_si256();
+        __m256i s2 = _mm256_setzero_si256();
+        __m256i ss = _mm256_setzero_si256();
+        __m256i s12 = _mm256_setzero_si256();
+        for (int y = 0; y < 4; y++) {
+            const __m256i a = load_16pix_avx2<is16>(p0 + y * pitch0 + ib * 4 * pixsize);
+            const __m256i b = load_16pix_avx2<is16>(p1 + y * pitch1 + ib * 4 * pixsize);
+            s1  = _mm256_add_epi32(s1, _mm256_madd_epi16(a, ones));
+            s2  = _mm256_add_epi32(s2, _mm256_madd_epi16(b, ones));
+            ss  = _mm256_add_epi32(ss, _mm256_add_epi32(_mm256_madd_epi16(a, a), _mm256_madd_epi16(b, b)));
+            s12 = _mm256_add_epi32(s12, _mm256_madd_epi16(a, b));
+        }
+        // 隣接する2画素分の値を足し合わせて4画素(=ブロック)ごとの値にし、ブロックごとに s1, s2, ss, s12 の順に並べ替える
+        const __m256i h0 = _mm256_hadd_epi32(s1, s2);         // s1b0, s1b1, s2b0, s2b1 | s1b2, s1b3, s2b2, s2b3
+        const __m256i h1 = _mm256_hadd_epi32(ss, s12);        // ssb0, ssb1, s12b0, s12b1 | ...
+        const __m256i lo = _mm256_unpacklo_epi32(h0, h1);     // s1b0, ssb0, s1b1, ssb1 | ...
+        const __m256i hi = _mm256_unpackhi_epi32(h0, h1);     // s2b0, s12b0, s2b1, s12b1 | ...
+        const __m256i blk02 = _mm256_unpacklo_epi32(lo, hi);  // block0 | block2
+        const __m256i blk13 = _mm256_unpackhi_epi32(lo, hi);  // block1 | block3
+        _mm256_storeu_si256((__m256i *)(dst + ib + 0), _mm256_cvtepi32_epi64(_mm256_castsi256_si128(blk02)));
+        _mm256_storeu_si256((__m256i *)(dst + ib + 1), _mm256_cvtepi32_epi64(_mm256_castsi256_si128(blk13)));
+        _mm256_storeu_si256((__m256i *)(dst + ib + 2), _mm256_cvtepi32_epi64(_mm256_extracti128_si256(blk02, 1)));
+        _mm256_storeu_si256((__m256i *)(dst + ib + 3), _mm256_cvtepi32_epi64(_mm256_extracti128_si256(blk13, 1)));
+    }
+    if (ib < blocks) {
+        if (is16) {
+            rgy_ssim_block_row16_c(dst + ib, p0 + ib * 4 * pixsize, pitch0, p1 + ib * 4 * pixsize, pitch1, blocks - ib);
+        } else {
+            rgy_ssim_block_row8_c(dst + ib, p0 + ib * 4 * pixsize, pitch0, p1 + ib * 4 * pixsize, pitch1, blocks - ib);
+        }
+    }
+}
+
+void rgy_ssim_block_row8_avx2(RGYSsimBlock *dst, const uint8_t *p0, const int pitch0, const uint8_t *p1, const int pitch1, const int blocks) {
+    ssim_block_row_avx2<false>(dst, p0, pitch0, p1, pitch1, blocks);
+}
+
+void rgy_ssim_block_row16_avx2(RGYSsimBlock *dst, const uint8_t *p0, const int pitch0, const uint8_t *p1, const int pitch1, const int blocks) {
+    ssim_block_row_avx2<true>(dst, p0, pitch0, p1, pitch1, blocks);
+}
+
+static RGY_FORCEINLINE uint64_t hsum_epi64_avx2(const __m256i x) {
+    alignas(16) uint64_t tmp[2];
+    _mm_store_si128((__m128i *)tmp, _mm_add_epi64(_mm256_castsi256_si128(x), _mm256_extracti128_si256(x, 1)));
+    return tmp[0] + tmp[1];
+}
+
+uint64_t rgy_sse_plane8_avx2(const uint8_t *p0, const int pitch0, const uint8_t *p1, const int pitch1, const int width, const int height) {
+    const int widthSimd = width & (~31);
+    __m256i sum64 = _mm256_setzero_si256();
+    uint64_t sse = 0;
+    for (int y = 0; y < height; y++) {
+        const uint8_t *ptr0 = p0 + y * pitch0;
+        const uint8_t *ptr1 = p1 + y * pitch1;
+        // 1行分であれば32bitで累積してもあふれない
+        __m256i sum32 = _mm256_setzero_si256();
+        for (int x = 0; x < widthSimd; x += 32) {
+            const __m256i a = _mm256_loadu_si256((const __m256i *)(ptr0 + x));
+            const __m256i b = _mm256_loadu_si256((const __m256i *)(ptr1 + x));
+            const __m256i d = _mm256_or_si256(_mm256_subs_epu8(a, b), _mm256_subs_epu8(b, a));
+            const __m256i dLo = _mm256_unpacklo_epi8(d, _mm256_setzero_si256());
+            const __m256i dHi = _mm256_unpackhi_epi8(d, _mm256_setzero_si256());
+            sum32 = _mm256_add_epi32(sum32, _mm256_add_epi32(_mm256_madd_epi16(dLo, dLo), _mm256_madd_epi16(dHi, dHi)));
+        }
+        sum64 = _mm256_add_epi64(sum64, _mm256_unpacklo_epi32(sum32, _mm256_setzero_si256()));
+        sum64 = _mm256_add_epi64(sum64, _mm256_unpackhi_epi32(sum32, _mm256_setzero_si256()));
+        for (int x = widthSimd; x < width; x++) {
+            const int diff = (int)ptr0[x] - (int)ptr1[x];
+            sse += (uint64_t)(diff * diff);
+        }
+    }
+    return sse + hsum_epi64_avx2(sum64);
+}
+
+uint64_t rgy_sse_plane16_avx2(const uint8_t *p0, const int pitch0, const uint8_t *p1, const int pitch1, const int width, const int height) {
+    const int widthSimd = width & (~15);
+    __m256i sum64 = _mm256_setzero_si256();
+    uint64_t sse = 0;
+    for (int y = 0; y < height; y++) {
+        const uint16_t *ptr0 = (const uint16_t *)(p0 + y * pitch0);
+        const uint16_t *ptr1 = (const uint16_t *)(p1 + y * pitch1);
+        for (int x = 0; x < widthSimd; x += 16) {
+            const __m256i a = _mm256_loadu_si256((const __m256i *)(ptr0 + x));
+            const __m256i b = _mm256_loadu_si256((const __m256i *)(ptr1 + x));
+            const __m256i d = _mm256_sub_epi16(a, b);
+            const __m256i d2 = _mm256_madd_epi16(d, d);
+            sum64 = _mm256_add_epi64(sum64, _mm256_unpacklo_epi32(d2, _mm256_setzero_si256()));
+            sum64 = _mm256_add_epi64(sum64, _mm256_unpackhi_epi32(d2, _mm256_setzero_si256()));
+        }
+        for (int x = widthSimd; x < width; x++) {
+            const int64_t diff = (int64_t)ptr0[x] - (int64_t)ptr1[x];
+            sse += (uint64_t)(diff * diff);
+        }
+    }
+    return sse + hsum_epi64_avx2(sum64);
+}
+
+#endif //#if defined(_M_IX86) || defined(_M_X64) || defined(__x86_64)
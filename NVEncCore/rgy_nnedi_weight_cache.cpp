@@ -0,0 +1,251 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2024 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// --------------------------------------------------------------------------------------------
+
+
+#include <map>
+#include <mutex>
+#include <tuple>
+#include <cstring>
+#include <filesystem>
+#include "rgy_util.h"
+#include "rgy_nnedi_weight_cache.h"
+
+RGYNnediWeightKey::RGYNnediWeightKey() :
+    nns(0),
+    nsize(0),
+    errortype(0),
+    precision(0),
+    prescreen(0),
+    layout(0),
+    srcFileSize(0),
+    srcFileTime(0) {
+}
+
+bool RGYNnediWeightKey::operator<(const RGYNnediWeightKey& x) const {
+    return std::tie(nns, nsize, errortype, precision, prescreen, layout, srcFileSize, srcFileTime)
+        < std::tie(x.nns, x.nsize, x.errortype, x.precision, x.prescreen, x.layout, x.srcFileSize, x.srcFileTime);
+}
+
+bool RGYNnediWeightKey::operator==(const RGYNnediWeightKey& x) const {
+    return std::tie(nns, nsize, errortype, precision, prescreen, layout, srcFileSize, srcFileTime)
+        == std::tie(x.nns, x.nsize, x.errortype, x.precision, x.prescreen, x.layout, x.srcFileSize, x.srcFileTime);
+}
+
+tstring RGYNnediWeightKey::print() const {
+    return strsprintf(_T("nns%u.nsize%u.err%u.prec%u.ps%u.l%x"), nns, nsize, errortype, precision, prescreen, layout);
+}
+
+RGYNnediWeightSet::RGYNnediWeightSet() :
+    m_data(),
+    m_mapped(),
+    m_weight0(nullptr),
+    m_weight0Bytes(0),
+    m_weight1({ nullptr, nullptr }),
+    m_weight1Bytes(0) {
+}
+
+RGYNnediWeightSet::~RGYNnediWeightSet() {
+    m_weight0 = nullptr;
+    m_weight1 = { nullptr, nullptr };
+    m_mapped.reset();
+    m_data.clear();
+}
+
+RGY_ERR RGYNnediWeightSet::set(std::vector<uint8_t>&& weight0, std::array<std::vector<uint8_t>, 2>&& weight1) {
+    if (weight0.size() == 0 || weight1[0].size() == 0 || weight1[0].size() != weight1[1].size()) {
+        return RGY_ERR_INVALID_PARAM;
+    }
+    // 1つのバッファにまとめておく
+    m_mapped.reset();
+    m_weight0Bytes = weight0.size();
+    m_weight1Bytes = weight1[0].size();
+    m_data.resize(m_weight0Bytes + m_weight1Bytes * 2);
+    memcpy(m_data.data(), weight0.data(), m_weight0Bytes);
+    memcpy(m_data.data() + m_weight0Bytes, weight1[0].data(), m_weight1Bytes);
+    memcpy(m_data.data() + m_weight0Bytes + m_weight1Bytes, weight1[1].data(), m_weight1Bytes);
+    m_weight0 = m_data.data();
+    m_weight1[0] = m_data.data() + m_weight0Bytes;
+    m_weight1[1] = m_data.data() + m_weight0Bytes + m_weight1Bytes;
+    return RGY_ERR_NONE;
+}
+
+RGY_ERR RGYNnediWeightSet::loadBinary(const tstring& filename, const RGYNnediWeightKey& key) {
+    auto mapped = std::make_unique<RGYMappedFile>();
+    if (!mapped->open(filename.c_str())) {
+        return RGY_ERR_FILE_OPEN;
+    }
+    const auto filesize = mapped->size();
+    if (filesize < sizeof(RGYNnediWeightBinHeader)) {
+        return RGY_ERR_INVALID_FORMAT;
+    }
+    RGYNnediWeightBinHeader header;
+    memcpy(&header, mapped->data(), sizeof(header));
+    if (memcmp(header.magic, RGY_NNEDI_WEIGHT_BIN_MAGIC, sizeof(header.magic)) != 0
+        || header.headerSize < sizeof(header)) {
+        return RGY_ERR_INVALID_FORMAT;
+    }
+    if (header.version != RGY_NNEDI_WEIGHT_BIN_VERSION) {
+        return RGY_ERR_INVALID_VERSION;
+    }
+    // パラメータと変換元の重みが一致するか確認する
+    if (!(header.key == key)) {
+        return RGY_ERR_INVALID_VERSION;
+    }
+    if (header.weight0Bytes == 0 || header.weight1Bytes == 0
+        || header.weight0Offset + header.weight0Bytes > filesize
+        || header.weight1Offset[0] + header.weight1Bytes > filesize
+        || header.weight1Offset[1] + header.weight1Bytes > filesize
+        || (header.weight0Offset | header.weight1Offset[0] | header.weight1Offset[1]) % sizeof(float) != 0) {
+        return RGY_ERR_INVALID_FORMAT;
+    }
+    // GPUへの転送元としてそのまま使うので、コピーせずマップしたまま使用する
+    m_data.clear();
+    m_weight0 = mapped->data() + header.weight0Offset;
+    m_weight0Bytes = (size_t)header.weight0Bytes;
+    m_weight1[0] = mapped->data() + header.weight1Offset[0];
+    m_weight1[1] = mapped->data() + header.weight1Offset[1];
+    m_weight1Bytes = (size_t)header.weight1Bytes;
+    m_mapped = std::move(mapped);
+    return RGY_ERR_NONE;
+}
+
+RGY_ERR RGYNnediWeightSet::saveBinary(const tstring& filename, const RGYNnediWeightKey& key) const {
+    if (m_weight0 == nullptr || m_weight0Bytes == 0) {
+        return RGY_ERR_NOT_INITIALIZED;
+    }
+    RGYNnediWeightBinHeader header{};
+    memcpy(header.magic, RGY_NNEDI_WEIGHT_BIN_MAGIC, sizeof(header.magic));
+    header.version = RGY_NNEDI_WEIGHT_BIN_VERSION;
+    header.headerSize = sizeof(header);
+    header.key = key;
+    header.weight0Offset = ALIGN(sizeof(header), RGY_NNEDI_WEIGHT_BIN_ALIGN);
+    header.weight0Bytes = m_weight0Bytes;
+    header.weight1Offset[0] = ALIGN(header.weight0Offset + header.weight0Bytes, RGY_NNEDI_WEIGHT_BIN_ALIGN);
+    header.weight1Offset[1] = ALIGN(header.weight1Offset[0] + m_weight1Bytes, RGY_NNEDI_WEIGHT_BIN_ALIGN);
+    header.weight1Bytes = m_weight1Bytes;
+
+    std::vector<uint8_t> data((size_t)(header.weight1Offset[1] + header.weight1Bytes), 0);
+    memcpy(data.data(), &header, sizeof(header));
+    memcpy(data.data() + header.weight0Offset, m_weight0, m_weight0Bytes);
+    memcpy(data.data() + header.weight1Offset[0], m_weight1[0], m_weight1Bytes);
+    memcpy(data.data() + header.weight1Offset[1], m_weight1[1], m_weight1Bytes);
+
+    // 複数のプロセスから同時に作成される可能性があるので、一時ファイルに書いてからリネームする
+    const auto tmpFile = filename + strsprintf(_T(".%u.tmp"), GetCurrentProcessId());
+    {
+        FILE *fptmp = nullptr;
+        if (_tfopen_s(&fptmp, tmpFile.c_str(), _T("wb")) != 0 || fptmp == nullptr) {
+            return RGY_ERR_FILE_OPEN;
+        }
+        std::unique_ptr<FILE, fp_deleter> fp(fptmp, fp_deleter());
+        if (fwrite(data.data(), 1, data.size(), fp.get()) != data.size()) {
+            fp.reset();
+            _tremove(tmpFile.c_str());
+            return RGY_ERR_UNDEFINED_BEHAVIOR;
+        }
+    }
+    std::error_code ec;
+    std::filesystem::rename(std::filesystem::path(tmpFile), std::filesystem::path(filename), ec);
+    if (ec) {
+        _tremove(tmpFile.c_str());
+        return RGY_ERR_FILE_OPEN;
+    }
+    return RGY_ERR_NONE;
+}
+
+const TCHAR *get_nnedi_weight_source_str(RGYNnediWeightSource source) {
+    switch (source) {
+    case RGYNnediWeightSource::Process: return _T("shared");
+    case RGYNnediWeightSource::File:    return _T("cache file");
+    case RGYNnediWeightSource::Prepare:
+    default:                            return _T("prepared");
+    }
+}
+
+tstring rgy_nnedi_weight_cache_filename(const RGYNnediWeightKey& key, const tstring& cacheDir) {
+    const tstring filename = _T("nnedi3_weights.") + key.print() + RGY_NNEDI_WEIGHT_BIN_EXT;
+#if defined(_WIN32) || defined(_WIN64)
+    return PathCombineS(cacheDir, filename);
+#else
+    return std::filesystem::path(cacheDir).append(filename).string();
+#endif
+}
+
+RGY_ERR rgy_nnedi_weight_get(std::shared_ptr<const RGYNnediWeightSet>& weights, RGYNnediWeightSource& source,
+    const RGYNnediWeightKey& key, const tstring& cacheDir, RGYNnediWeightPrepareFunc prepare, std::shared_ptr<RGYLog> log) {
+    // 変換済みの重みはプロセスの終了まで保持し、以降のインスタンスで共有する
+    // 同じ設定の変換が重複しないよう、変換中もロックしたままにする
+    static std::mutex mtx;
+    static std::map<RGYNnediWeightKey, std::shared_ptr<const RGYNnediWeightSet>> sets;
+    std::lock_guard<std::mutex> lock(mtx);
+    weights.reset();
+    auto it = sets.find(key);
+    if (it != sets.end()) {
+        weights = it->second;
+        source = RGYNnediWeightSource::Process;
+        return RGY_ERR_NONE;
+    }
+
+    const auto cacheFile = (cacheDir.length() > 0) ? rgy_nnedi_weight_cache_filename(key, cacheDir) : tstring();
+    if (cacheFile.length() > 0 && rgy_file_exists(cacheFile)) {
+        auto set = std::make_shared<RGYNnediWeightSet>();
+        if (set->loadBinary(cacheFile, key) == RGY_ERR_NONE) {
+            log->write(RGY_LOG_DEBUG, RGY_LOGT_VPP, _T("Loaded nnedi weights from cache: %s\n"), cacheFile.c_str());
+            weights = set;
+            sets[key] = weights;
+            source = RGYNnediWeightSource::File;
+            return RGY_ERR_NONE;
+        }
+        log->write(RGY_LOG_DEBUG, RGY_LOGT_VPP, _T("nnedi weight cache is outdated or invalid, ignored: %s\n"), cacheFile.c_str());
+    }
+
+    std::vector<uint8_t> weight0;
+    std::array<std::vector<uint8_t>, 2> weight1;
+    auto err = prepare(weight0, weight1);
+    if (err != RGY_ERR_NONE) {
+        return err;
+    }
+    auto set = std::make_shared<RGYNnediWeightSet>();
+    if ((err = set->set(std::move(weight0), std::move(weight1))) != RGY_ERR_NONE) {
+        return err;
+    }
+    if (cacheFile.length() > 0) {
+        // キャッシュが作成できなくても処理は継続する
+        if (!rgy_directory_exists(cacheDir)) {
+            CreateDirectoryRecursive(cacheDir.c_str());
+        }
+        if (set->saveBinary(cacheFile, key) == RGY_ERR_NONE) {
+            log->write(RGY_LOG_DEBUG, RGY_LOGT_VPP, _T("Created nnedi weight cache: %s\n"), cacheFile.c_str());
+        } else {
+            log->write(RGY_LOG_DEBUG, RGY_LOGT_VPP, _T("Failed to create nnedi weight cache: %s\n"), cacheFile.c_str());
+        }
+    }
+    weights = set;
+    sets[key] = weights;
+    source = RGYNnediWeightSource::Prepare;
+    return RGY_ERR_NONE;
+}
@@ -0,0 +1,133 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2024 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// --------------------------------------------------------------------------------------------
+
+
+#pragma once
+#ifndef __RGY_NNEDI_WEIGHT_CACHE_H__
+#define __RGY_NNEDI_WEIGHT_CACHE_H__
+
+#include <cstdint>
+#include <array>
+#include <vector>
+#include <memory>
+#include <functional>
+#include "rgy_tchar.h"
+#include "rgy_err.h"
+#include "rgy_log.h"
+#include "rgy_filesystem.h"
+
+// nnediの重み(GPU転送用の並びに変換済み)のキャッシュファイル
+//
+//  [RGYNnediWeightBinHeader]
+//  [weight0]     weight0Bytes
+//  [weight1[0]]  weight1Bytes
+//  [weight1[1]]  weight1Bytes
+//
+// 各データはそのままGPUに転送できる並び (fp16の場合はSWHT_IDXの並び替え済み)
+// マルチバイトの値はすべてリトルエンディアン
+static const char RGY_NNEDI_WEIGHT_BIN_MAGIC[8] = { 'R', 'G', 'Y', 'N', 'N', 'E', 'D', 'I' };
+static const uint32_t RGY_NNEDI_WEIGHT_BIN_VERSION = 1;
+static const TCHAR *RGY_NNEDI_WEIGHT_BIN_EXT = _T(".rgynnedi");
+static const size_t RGY_NNEDI_WEIGHT_BIN_ALIGN = 64;
+
+// 変換後の重みを決めるパラメータ
+struct RGYNnediWeightKey {
+    uint32_t nns;
+    uint32_t nsize;
+    uint32_t errortype;
+    uint32_t precision;
+    uint32_t prescreen;   // pre_screen & VPP_NNEDI_PRE_SCREEN_MODE
+    uint32_t layout;      // 並び替えの方式 (カーネル側の実装に依存)
+    uint64_t srcFileSize; // 変換元の重みのサイズ (キャッシュの検証用)
+    int64_t  srcFileTime; // 変換元の更新時刻 (キャッシュの検証用)
+
+    RGYNnediWeightKey();
+    bool operator<(const RGYNnediWeightKey& x) const;
+    bool operator==(const RGYNnediWeightKey& x) const;
+    tstring print() const;
+};
+
+struct RGYNnediWeightBinHeader {
+    char     magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    RGYNnediWeightKey key;
+    uint64_t weight0Offset; // ファイル先頭からのオフセット
+    uint64_t weight0Bytes;
+    uint64_t weight1Offset[2];
+    uint64_t weight1Bytes;
+};
+static_assert(sizeof(RGYNnediWeightKey) == 40, "unexpected size of RGYNnediWeightKey");
+static_assert(sizeof(RGYNnediWeightBinHeader) == 96, "unexpected size of RGYNnediWeightBinHeader");
+
+// 変換済みの重み、読み取り専用で複数のインスタンスから共有される
+class RGYNnediWeightSet {
+public:
+    RGYNnediWeightSet();
+    ~RGYNnediWeightSet();
+
+    RGY_ERR set(std::vector<uint8_t>&& weight0, std::array<std::vector<uint8_t>, 2>&& weight1);
+    RGY_ERR loadBinary(const tstring& filename, const RGYNnediWeightKey& key);
+    RGY_ERR saveBinary(const tstring& filename, const RGYNnediWeightKey& key) const;
+
+    const uint8_t *weight0() const { return m_weight0; }
+    size_t weight0Bytes() const { return m_weight0Bytes; }
+    const uint8_t *weight1(int i) const { return m_weight1[i]; }
+    size_t weight1Bytes() const { return m_weight1Bytes; }
+    bool fromFile() const { return m_mapped != nullptr; }
+protected:
+    RGYNnediWeightSet(const RGYNnediWeightSet&) = delete;
+    RGYNnediWeightSet& operator=(const RGYNnediWeightSet&) = delete;
+
+    std::vector<uint8_t> m_data;             // 変換した場合
+    std::unique_ptr<RGYMappedFile> m_mapped; // キャッシュファイルはマップしたまま使う
+    const uint8_t *m_weight0;
+    size_t m_weight0Bytes;
+    std::array<const uint8_t *, 2> m_weight1;
+    size_t m_weight1Bytes;
+};
+
+enum class RGYNnediWeightSource {
+    Process, // プロセス内で共有
+    File,    // キャッシュファイルから読み込み
+    Prepare, // 重みファイルから変換
+};
+
+const TCHAR *get_nnedi_weight_source_str(RGYNnediWeightSource source);
+
+// 重みファイルを読み込んで変換する関数
+typedef std::function<RGY_ERR(std::vector<uint8_t>& weight0, std::array<std::vector<uint8_t>, 2>& weight1)> RGYNnediWeightPrepareFunc;
+
+// プロセス内で変換済みの重みを共有する
+// プロセス内にない場合はcacheDirのキャッシュファイルを探し、それもなければprepareで変換してキャッシュファイルを作成する
+// cacheDirが空ならキャッシュファイルは使用しない
+RGY_ERR rgy_nnedi_weight_get(std::shared_ptr<const RGYNnediWeightSet>& weights, RGYNnediWeightSource& source,
+    const RGYNnediWeightKey& key, const tstring& cacheDir, RGYNnediWeightPrepareFunc prepare, std::shared_ptr<RGYLog> log);
+
+tstring rgy_nnedi_weight_cache_filename(const RGYNnediWeightKey& key, const tstring& cacheDir);
+
+#endif //__RGY_NNEDI_WEIGHT_CACHE_H__
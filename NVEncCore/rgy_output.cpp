@@ -30,6 +30,7 @@
 #include "rgy_bitstream.h"
 #include "rgy_language.h"
 #include "convert_csp.h"
+#include <chrono>
 #include <filesystem>
 #if defined(_M_IX86) || defined(_M_X64) || defined(__x86_64)
 #include <smmintrin.h>
@@ -680,12 +681,25 @@ RGY_ERR RGYOutputRaw::WriteNextFrame(RGYFrame *pSurface) {
 
 #if ENCODER_QSV || ENCODER_NVENC
 
-RGYOutFrame::RGYOutFrame() : m_bY4m(true) {
+RGYOutFrame::RGYOutFrame() :
+    m_bY4m(true),
+    m_frameBufSize(0),
+    m_frameBuf(),
+    m_frameBufBytes(),
+    m_qFrameFree(),
+    m_qFrameFilled(),
+    m_thWrite(),
+    m_writeFin(false),
+    m_writeErr(RGY_ERR_NONE),
+    m_waitFreeTime(0),
+    m_writeTime(0),
+    m_writeBytes(0) {
     m_strWriterName = _T("yuv writer");
     m_OutType = OUT_TYPE_SURFACE;
 };
 
 RGYOutFrame::~RGYOutFrame() {
+    Close();
 };
 
 RGY_ERR RGYOutFrame::Init(const TCHAR *strFileName, const VideoInfo *pVideoOutputInfo, const void *prm) {
@@ -703,11 +717,22 @@ RGY_ERR RGYOutFrame::Init(const TCHAR *strFileName, const VideoInfo *pVideoOutpu
         }
         m_fDest.reset(fp);
     }
+    //パイプ出力の場合は、パイプのサイズを拡大して書き込みの回数を減らす
+    {
+        int originalSize = 0;
+        if (const int pipeSize = rgy_pipe_expand(fileno(m_fDest.get()), std::numeric_limits<int>::max(), &originalSize); pipeSize > 0) {
+            AddMessage(RGY_LOG_DEBUG, _T("pipe size: %d -> %d.\n"), originalSize, pipeSize);
+        }
+    }
 
     YUVWriterParam *writerParam = (YUVWriterParam *)prm;
 
     m_bY4m = writerParam->bY4m;
+#if ENCODER_QSV
     m_sourceHWMem = true;
+#else
+    m_sourceHWMem = false; //ページロックされたホストメモリから直接読み込む
+#endif
     m_inited = true;
 
     return RGY_ERR_NONE;
@@ -718,25 +743,89 @@ RGY_ERR RGYOutFrame::WriteNextFrame(RGYBitstream *pBitstream) {
     return RGY_ERR_UNSUPPORTED;
 }
 
-RGY_ERR RGYOutFrame::WriteNextFrame(RGYFrame *pSurface) {
-    if (!m_fDest) {
-        return RGY_ERR_NULL_PTR;
+RGY_ERR RGYOutFrame::initWriteThread(const size_t frameBufSize) {
+    m_frameBufSize = frameBufSize;
+    m_qFrameFree.init(RGY_OUT_FRAME_ASYNC_BUFFERS * 2, RGY_OUT_FRAME_ASYNC_BUFFERS);
+    m_qFrameFilled.init(RGY_OUT_FRAME_ASYNC_BUFFERS * 2, RGY_OUT_FRAME_ASYNC_BUFFERS);
+    for (int i = 0; i < RGY_OUT_FRAME_ASYNC_BUFFERS; i++) {
+        auto buf = std::unique_ptr<uint8_t, aligned_malloc_deleter>((uint8_t *)_aligned_malloc(m_frameBufSize, 4096), aligned_malloc_deleter());
+        if (!buf) {
+            AddMessage(RGY_LOG_ERROR, _T("Failed to allocate frame buffer.\n"));
+            return RGY_ERR_NULL_PTR;
+        }
+        m_frameBuf.push_back(std::move(buf));
+        m_frameBufBytes.push_back(0);
+        m_qFrameFree.push(i);
     }
+    m_writeFin = false;
+    m_writeErr = RGY_ERR_NONE;
+    m_thWrite = std::thread(&RGYOutFrame::threadFuncWrite, this);
+    AddMessage(RGY_LOG_DEBUG, _T("Started write thread, %d buffers of %llu bytes.\n"), RGY_OUT_FRAME_ASYNC_BUFFERS, (unsigned long long)m_frameBufSize);
+    return RGY_ERR_NONE;
+}
 
-    if (m_sourceHWMem) {
-        if (m_readBuffer.get() == nullptr) {
-            m_readBuffer.reset((uint8_t *)_aligned_malloc(pSurface->pitch() + 128, 16));
+RGY_ERR RGYOutFrame::threadFuncWrite() {
+    auto sts = RGY_ERR_NONE;
+    for (;;) {
+        int idx = -1;
+        if (!m_qFrameFilled.front_copy_and_pop_no_lock(&idx)) {
+            if (m_writeFin) {
+                //終了フラグを立てる前にpushされたものがないか、再度確認する
+                if (!m_qFrameFilled.front_copy_and_pop_no_lock(&idx)) {
+                    break;
+                }
+            } else {
+                m_qFrameFilled.wait_for_push();
+                continue;
+            }
         }
+        //エラー発生後は書き出さずにバッファを返却する
+        if (sts == RGY_ERR_NONE) {
+            const auto timeStart = std::chrono::steady_clock::now();
+            const auto bytes = m_frameBufBytes[idx];
+            if (_fwrite_nolock(m_frameBuf[idx].get(), 1, bytes, m_fDest.get()) != bytes) {
+                AddMessage(RGY_LOG_ERROR, _T("Error writing file.\nNot enough disk space!\n"));
+                sts = RGY_ERR_UNDEFINED_BEHAVIOR;
+                m_writeErr = sts;
+            }
+            m_writeTime += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - timeStart).count();
+            m_writeBytes += bytes;
+        }
+        m_qFrameFree.push(idx);
     }
+    return sts;
+}
 
-    if (m_bY4m) {
-        if (!m_y4mHeaderWritten) {
-            WriteY4MHeader(m_fDest.get(), &m_VideoOutputInfo, pSurface->csp());
-            m_y4mHeaderWritten = true;
-        }
-        WRITE_CHECK(fwrite("FRAME\n", 1, strlen("FRAME\n"), m_fDest.get()), strlen("FRAME\n"));
+void RGYOutFrame::closeWriteThread() {
+    if (m_thWrite.joinable()) {
+        m_writeFin = true;
+        m_thWrite.join();
+        AddMessage(RGY_LOG_DEBUG, _T("wrote %.1f MB in %.1f ms, waited for free buffers %.1f ms.\n"),
+            m_writeBytes / (1024.0 * 1024.0), m_writeTime / 1000.0, m_waitFreeTime / 1000.0);
     }
+    m_qFrameFree.close();
+    m_qFrameFilled.close();
+    m_frameBuf.clear();
+    m_frameBufBytes.clear();
+    m_frameBufSize = 0;
+    m_writeFin = false;
+}
+
+RGY_ERR RGYOutFrame::WaitFin() {
+    closeWriteThread();
+    if (m_fDest && fflush(m_fDest.get()) != 0 && m_writeErr == RGY_ERR_NONE) {
+        AddMessage(RGY_LOG_ERROR, _T("Error writing file.\nNot enough disk space!\n"));
+        m_writeErr = RGY_ERR_UNDEFINED_BEHAVIOR;
+    }
+    return (RGY_ERR)m_writeErr.load();
+}
 
+void RGYOutFrame::Close() {
+    closeWriteThread();
+    RGYOutput::Close();
+}
+
+RGY_ERR RGYOutFrame::packFrame(RGYFrame *pSurface, uint8_t *dst, size_t *packedSize) {
     auto loadLineToBuffer = [](uint8_t *ptrBuf, uint8_t *ptrSrc, const int pitch) {
 #if (defined(_M_IX86) || defined(_M_X64) || defined(__x86_64)) && ENCODER_QSV
         for (int i = 0; i < pitch; i += 128, ptrSrc += 128, ptrBuf += 128) {
@@ -761,6 +850,14 @@ RGY_ERR RGYOutFrame::WriteNextFrame(RGYFrame *pSurface) {
         memcpy(ptrBuf, ptrSrc, pitch);
 #endif
     };
+    //1ライン分のソースの先頭を返す (ビデオメモリの場合は、一度m_readBufferに読み込む)
+    auto loadLine = [&](uint8_t *ptrSrc, const int pitch) {
+        if (m_sourceHWMem) {
+            loadLineToBuffer(m_readBuffer.get(), ptrSrc, pitch);
+            return m_readBuffer.get();
+        }
+        return ptrSrc;
+    };
 
     auto crop = initCrop();
 #if ENCODER_QSV
@@ -768,100 +865,122 @@ RGY_ERR RGYOutFrame::WriteNextFrame(RGYFrame *pSurface) {
         crop = mfxsurf->crop();
     }
 #endif
-    const int pixSize = RGY_CSP_BIT_DEPTH[pSurface->csp()] > 8 ? 2 : 1;
-    if (   RGY_CSP_CHROMA_FORMAT[pSurface->csp()] == RGY_CHROMAFMT_YUV420
-        || RGY_CSP_CHROMA_FORMAT[pSurface->csp()] == RGY_CHROMAFMT_YUV444) {
-        const uint32_t lumaWidthBytes = pSurface->width() * pixSize;
-        const uint32_t cropOffset = crop.e.up * pSurface->pitch() + crop.e.left * pixSize;
-        if (m_sourceHWMem) {
-            for (decltype(pSurface->height()) j = 0; j < pSurface->height(); j++) {
-                uint8_t *ptrBuf = m_readBuffer.get();
-                uint8_t *ptrSrc = pSurface->ptrY() + (crop.e.up + j) * pSurface->pitch();
-                loadLineToBuffer(ptrBuf, ptrSrc, pSurface->pitch());
-                WRITE_CHECK(fwrite(ptrBuf + crop.e.left * pixSize, 1, lumaWidthBytes, m_fDest.get()), lumaWidthBytes);
-            }
-        } else {
-            for (decltype(pSurface->height()) j = 0; j < pSurface->height(); j++) {
-                WRITE_CHECK(fwrite(pSurface->ptrY() + cropOffset + j * pSurface->pitch(), 1, lumaWidthBytes, m_fDest.get()), lumaWidthBytes);
-            }
-        }
-    } else {
-        AddMessage(RGY_LOG_ERROR, _T("Unsupported colorspace %s.\n"), RGY_CSP_NAMES[pSurface->csp()]);
+    const auto csp = pSurface->csp();
+    const int pixSize = RGY_CSP_BIT_DEPTH[csp] > 8 ? 2 : 1;
+    if (   RGY_CSP_CHROMA_FORMAT[csp] != RGY_CHROMAFMT_YUV420
+        && RGY_CSP_CHROMA_FORMAT[csp] != RGY_CHROMAFMT_YUV444) {
+        AddMessage(RGY_LOG_ERROR, _T("Unsupported colorspace %s.\n"), RGY_CSP_NAMES[csp]);
         return RGY_ERR_INVALID_COLOR_FORMAT;
     }
+    uint8_t *ptrDst = dst;
+    if (m_bY4m) {
+        memcpy(ptrDst, "FRAME\n", strlen("FRAME\n"));
+        ptrDst += strlen("FRAME\n");
+    }
 
-    uint32_t frameSize = 0;
-    if (   pSurface->csp() == RGY_CSP_NV12
-        || pSurface->csp() == RGY_CSP_P010) {
-        const uint32_t widthUV = pSurface->width() >> 1;
-        const uint32_t heightUV = pSurface->height() >> 1;
-        const uint32_t planeOffsetUV = ALIGN32((widthUV * heightUV + 32) * pixSize);
-        if (!m_UVBuffer) {
-            m_UVBuffer.reset((uint8_t *)_aligned_malloc(planeOffsetUV * 2, 32));
-        }
+    const uint32_t lumaWidthBytes = pSurface->width() * pixSize;
+    for (decltype(pSurface->height()) j = 0; j < pSurface->height(); j++, ptrDst += lumaWidthBytes) {
+        const uint8_t *ptrLine = loadLine(pSurface->ptrY() + (crop.e.up + j) * pSurface->pitch(), pSurface->pitch());
+        memcpy(ptrDst, ptrLine + crop.e.left * pixSize, lumaWidthBytes);
+    }
 
+    const int shiftUV = (RGY_CSP_CHROMA_FORMAT[csp] == RGY_CHROMAFMT_YUV420) ? 1 : 0;
+    const uint32_t widthUV = pSurface->width() >> shiftUV;
+    const uint32_t heightUV = pSurface->height() >> shiftUV;
+    const uint32_t planeSizeUV = widthUV * heightUV * pixSize;
+    if (csp == RGY_CSP_NV12 || csp == RGY_CSP_P010) {
+        //U, Vに分離する
         for (uint32_t j = 0; j < heightUV; j++) {
-            uint8_t *ptrSrc = pSurface->ptrUV() + (crop.e.up + j) * pSurface->pitch();
-            uint8_t *ptrBuf = ptrSrc;
-            if (m_sourceHWMem) {
-                loadLineToBuffer(m_readBuffer.get(), ptrSrc, pSurface->pitch());
-                ptrBuf = m_readBuffer.get();
-            }
-
-            const void *ptrLineUV = ptrBuf + crop.e.left * pixSize;
-            void *ptrLineU = m_UVBuffer.get() + j * widthUV * pixSize;
-            void *ptrLineV = m_UVBuffer.get() + j * widthUV * pixSize + planeOffsetUV;
-            if (pSurface->csp() == RGY_CSP_NV12) {
-                const uint8_t *ptrUV = (const uint8_t *)ptrLineUV;
-                uint8_t *ptrU = (uint8_t *)ptrLineU;
-                uint8_t *ptrV = (uint8_t *)ptrLineV;
+            const uint8_t *ptrLineUV = loadLine(pSurface->ptrUV() + ((crop.e.up >> 1) + j) * pSurface->pitch(), pSurface->pitch()) + (crop.e.left & ~1) * pixSize;
+            uint8_t *ptrLineU = ptrDst + j * widthUV * pixSize;
+            uint8_t *ptrLineV = ptrDst + j * widthUV * pixSize + planeSizeUV;
+            if (csp == RGY_CSP_NV12) {
+                const uint8_t *ptrUV = ptrLineUV;
+                uint8_t *ptrU = ptrLineU;
+                uint8_t *ptrV = ptrLineV;
+                uint32_t i = 0;
 #if defined(_M_IX86) || defined(_M_X64) || defined(__x86_64)
                 alignas(16) static const uint16_t MASK_LOW8[] = {
                     0x00ff, 0x00ff, 0x00ff, 0x00ff, 0x00ff, 0x00ff, 0x00ff, 0x00ff
                 };
                 const __m128i xMaskLow8 = _mm_load_si128((__m128i *)MASK_LOW8);
-
-                for (uint32_t i = 0; i < widthUV; i += 16, ptrUV += 32, ptrU += 16, ptrV += 16) {
+                //出力先は詰めて並べているので、行末をはみ出して書き込まないようにする
+                for (; i + 16 <= widthUV; i += 16, ptrUV += 32, ptrU += 16, ptrV += 16) {
                     __m128i x0 = _mm_loadu_si128((const __m128i *)(ptrUV + 0));
                     __m128i x1 = _mm_loadu_si128((const __m128i *)(ptrUV + 16));
                     _mm_storeu_si128((__m128i *)ptrU, _mm_packus_epi16(_mm_and_si128(x0, xMaskLow8), _mm_and_si128(x1, xMaskLow8)));
                     _mm_storeu_si128((__m128i *)ptrV, _mm_packus_epi16(_mm_srli_epi16(x0, 8), _mm_srli_epi16(x1, 8)));
                 }
-#else
-                convert_nv12_to_yv12_line_c<uint8_t, uint8_t, 8, 8>(ptrU, ptrV, ptrUV, widthUV);
 #endif
-            } else if (pSurface->csp() == RGY_CSP_P010) {
+                convert_nv12_to_yv12_line_c<uint8_t, uint8_t, 8, 8>(ptrU, ptrV, ptrUV, widthUV - i);
+            } else {
                 const uint16_t *ptrUV = (const uint16_t *)ptrLineUV;
                 uint16_t *ptrU = (uint16_t *)ptrLineU;
                 uint16_t *ptrV = (uint16_t *)ptrLineV;
-                switch (RGY_CSP_BIT_DEPTH[pSurface->csp()]) {
+                switch (RGY_CSP_BIT_DEPTH[csp]) {
                 case 10: convert_nv12_to_yv12_line_c<uint16_t, uint16_t, 16, 10>(ptrU, ptrV, ptrUV, widthUV); break;
                 case 12: convert_nv12_to_yv12_line_c<uint16_t, uint16_t, 16, 12>(ptrU, ptrV, ptrUV, widthUV); break;
                 case 14: convert_nv12_to_yv12_line_c<uint16_t, uint16_t, 16, 14>(ptrU, ptrV, ptrUV, widthUV); break;
                 case 16:
                 default: convert_nv12_to_yv12_line_c<uint16_t, uint16_t, 16, 16>(ptrU, ptrV, ptrUV, widthUV); break;
                 }
-            } else {
-                return RGY_ERR_INVALID_COLOR_FORMAT;
             }
         }
-        WRITE_CHECK(fwrite(m_UVBuffer.get(),                 1, widthUV * heightUV, m_fDest.get()), widthUV * heightUV);
-        WRITE_CHECK(fwrite(m_UVBuffer.get() + planeOffsetUV, 1, widthUV * heightUV, m_fDest.get()), widthUV * heightUV);
-    } else if (RGY_CSP_CHROMA_FORMAT[pSurface->csp()] == RGY_CHROMAFMT_YUV420
-            || RGY_CSP_CHROMA_FORMAT[pSurface->csp()] == RGY_CHROMAFMT_YUV444) {
-        uint8_t *const ptrBuf = m_readBuffer.get();
-
-        for (int iplane = 1; iplane < RGY_CSP_PLANES[pSurface->csp()]; iplane++) {
-            const uint32_t widthUV = pSurface->width() >> (RGY_CSP_CHROMA_FORMAT[pSurface->csp()] == RGY_CHROMAFMT_YUV420 ? 1 : 0);
-            const uint32_t heightUV = pSurface->height() >> (RGY_CSP_CHROMA_FORMAT[pSurface->csp()] == RGY_CHROMAFMT_YUV420 ? 1 : 0);
-            for (uint32_t i = 0; i < heightUV; i++) {
-                loadLineToBuffer(ptrBuf, pSurface->ptrPlane((RGY_PLANE)iplane) + (crop.e.up + i) * pSurface->pitch((RGY_PLANE)iplane), pSurface->pitch((RGY_PLANE)iplane));
-                WRITE_CHECK(fwrite(ptrBuf + (crop.e.left * pixSize >> 1), 1, widthUV * pixSize, m_fDest.get()), widthUV * pixSize);
+        ptrDst += planeSizeUV * 2;
+    } else {
+        for (int iplane = 1; iplane < RGY_CSP_PLANES[csp]; iplane++) {
+            const auto plane = (RGY_PLANE)iplane;
+            for (uint32_t j = 0; j < heightUV; j++, ptrDst += widthUV * pixSize) {
+                const uint8_t *ptrLine = loadLine(pSurface->ptrPlane(plane) + ((crop.e.up >> shiftUV) + j) * pSurface->pitch(plane), pSurface->pitch(plane));
+                memcpy(ptrDst, ptrLine + (crop.e.left >> shiftUV) * pixSize, widthUV * pixSize);
             }
         }
-    } else {
-        return RGY_ERR_INVALID_COLOR_FORMAT;
     }
+    *packedSize = ptrDst - dst;
+    return RGY_ERR_NONE;
+}
+
+RGY_ERR RGYOutFrame::WriteNextFrame(RGYFrame *pSurface) {
+    if (!m_fDest) {
+        return RGY_ERR_NULL_PTR;
+    }
+    if (m_writeErr != RGY_ERR_NONE) {
+        return (RGY_ERR)m_writeErr.load();
+    }
+
+    if (m_sourceHWMem) {
+        if (m_readBuffer.get() == nullptr) {
+            m_readBuffer.reset((uint8_t *)_aligned_malloc(pSurface->pitch() + 128, 16));
+        }
+    }
+
+    if (!m_thWrite.joinable()) {
+        if (m_bY4m && !m_y4mHeaderWritten) {
+            WriteY4MHeader(m_fDest.get(), &m_VideoOutputInfo, pSurface->csp());
+            m_y4mHeaderWritten = true;
+        }
+        const int pixSize = RGY_CSP_BIT_DEPTH[pSurface->csp()] > 8 ? 2 : 1;
+        const size_t frameBufSize = strlen("FRAME\n") + (size_t)pSurface->width() * pSurface->height() * pixSize * 3;
+        if (auto err = initWriteThread(frameBufSize); err != RGY_ERR_NONE) {
+            return err;
+        }
+    }
+
+    //空きバッファができるまで待機する
+    int idx = -1;
+    const auto waitStart = std::chrono::steady_clock::now();
+    while (!m_qFrameFree.front_copy_and_pop_no_lock(&idx)) {
+        m_qFrameFree.wait_for_push();
+    }
+    m_waitFreeTime += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - waitStart).count();
+
+    size_t frameSize = 0;
+    if (auto err = packFrame(pSurface, m_frameBuf[idx].get(), &frameSize); err != RGY_ERR_NONE) {
+        m_qFrameFree.push(idx);
+        return err;
+    }
+    m_frameBufBytes[idx] = frameSize;
+    m_qFrameFilled.push(idx);
 
     m_encSatusInfo->SetOutputData(RGY_FRAMETYPE_IDR, frameSize, 0);
     return RGY_ERR_NONE;
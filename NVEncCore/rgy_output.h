@@ -33,6 +33,8 @@
 #include <vector>
 #include <unordered_map>
 #include <mutex>
+#include <thread>
+#include <atomic>
 #include "rgy_osdep.h"
 #include "rgy_tchar.h"
 #include "rgy_log.h"
@@ -40,6 +42,7 @@
 #include "rgy_avutil.h"
 #include "rgy_bitstream.h"
 #include "rgy_input.h"
+#include "rgy_queue.h"
 #if ENCODER_NVENC
 #include "NVEncUtil.h"
 #include "NVEncParam.h"
@@ -186,8 +189,9 @@ public:
     virtual OutputType getOutType() {
         return m_OutType;
     }
-    virtual void WaitFin() {
-        return;
+    //書き出し待ちのデータをすべて書き出し、書き出し時のエラーを返す
+    virtual RGY_ERR WaitFin() {
+        return RGY_ERR_NONE;
     }
 
     const TCHAR *GetOutputMessage() {
@@ -322,6 +326,8 @@ struct YUVWriterParam {
     bool bY4m;
 };
 
+static const int RGY_OUT_FRAME_ASYNC_BUFFERS = 3; //書き出しスレッドに渡すフレームバッファの数
+
 class RGYOutFrame : public RGYOutput {
 public:
 
@@ -330,10 +336,28 @@ public:
 
     virtual RGY_ERR WriteNextFrame(RGYBitstream *pBitstream) override;
     virtual RGY_ERR WriteNextFrame(RGYFrame *pSurface) override;
+    virtual RGY_ERR WaitFin() override;
+    virtual void Close() override;
 protected:
     virtual RGY_ERR Init(const TCHAR *strFileName, const VideoInfo *pOutputInfo, const void *prm) override;
+    //フレームを"FRAME\n"と各プレーンを連続して並べた形に詰める
+    RGY_ERR packFrame(RGYFrame *pSurface, uint8_t *dst, size_t *packedSize);
+    RGY_ERR initWriteThread(const size_t frameBufSize);
+    RGY_ERR threadFuncWrite();
+    void closeWriteThread();
 
     bool m_bY4m;
+    size_t m_frameBufSize;
+    std::vector<std::unique_ptr<uint8_t, aligned_malloc_deleter>> m_frameBuf;
+    std::vector<size_t> m_frameBufBytes;   //各バッファの書き出すサイズ
+    RGYQueueMPMP<int> m_qFrameFree;        //空きバッファ
+    RGYQueueMPMP<int> m_qFrameFilled;      //書き出し待ちのバッファ
+    std::thread m_thWrite;
+    std::atomic<bool> m_writeFin;          //書き出し待ちをすべて書き出したら終了する
+    std::atomic<int> m_writeErr;           //書き出しスレッドのエラー (RGY_ERR)
+    int64_t m_waitFreeTime;                //空きバッファを待った時間 (us, 書き出し側が律速)
+    int64_t m_writeTime;                   //書き出しにかかった時間 (us)
+    int64_t m_writeBytes;
 };
 
 #endif //#if ENCODER_QSV || ENCODER_NVENC
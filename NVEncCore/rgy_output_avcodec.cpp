@@ -4558,8 +4558,9 @@ RGY_ERR RGYOutputAvcodec::WriteThreadFunc(RGYParamThread threadParam) {
     return (m_Mux.format.streamError) ? RGY_ERR_UNKNOWN : RGY_ERR_NONE;
 }
 
-void RGYOutputAvcodec::WaitFin() {
+RGY_ERR RGYOutputAvcodec::WaitFin() {
     CloseThread();
+    return (m_Mux.format.streamError) ? RGY_ERR_UNKNOWN : RGY_ERR_NONE;
 }
 
 HANDLE RGYOutputAvcodec::getThreadHandleOutput() {
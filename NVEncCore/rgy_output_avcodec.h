@@ -456,7 +456,7 @@ public:
 
     virtual vector<int> GetStreamTrackIdList();
 
-    virtual void WaitFin() override;
+    virtual RGY_ERR WaitFin() override;
 
     virtual void Close() override;
 
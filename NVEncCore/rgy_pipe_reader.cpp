@@ -0,0 +1,306 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2024 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// --------------------------------------------------------------------------------------------
+
+
+#include <chrono>
+#include <fcntl.h>
+#if defined(_WIN32) || defined(_WIN64)
+#include <io.h>
+#else
+#include <cerrno>
+#include <poll.h>
+#include <unistd.h>
+#endif
+#include "rgy_filesystem.h"
+#include "rgy_pipe_reader.h"
+
+static int64_t elapsedMicroSec(const std::chrono::steady_clock::time_point& start) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+RGYPipeFrameReader::RGYPipeFrameReader() :
+    m_fd(-1),
+    m_frameSize(0),
+    m_bufferSize(0),
+    m_y4m(false),
+    m_pipeSize(0),
+    m_log(),
+    m_buffers(),
+    m_data(),
+    m_qFree(),
+    m_qFilled(),
+    m_thread(),
+    m_abort(false),
+    m_fin(false),
+    m_threadSts(RGY_ERR_NONE),
+    m_pipeStarveTime(0),
+    m_bufferWaitTime(0),
+    m_consumerWaitTime(0),
+    m_readBytes(0),
+    m_readCount(0),
+    m_frameCount(0) {
+}
+
+RGYPipeFrameReader::~RGYPipeFrameReader() {
+    close();
+}
+
+void RGYPipeFrameReader::close() {
+    if (m_thread.joinable()) {
+        m_abort = true;
+        m_thread.join();
+        AddMessage(RGY_LOG_DEBUG, stats());
+    }
+    m_qFree.close();
+    m_qFilled.close();
+    m_data.clear();
+    m_buffers.clear();
+    m_abort = false;
+    m_fin = false;
+    m_fd = -1;
+}
+
+tstring RGYPipeFrameReader::stats() const {
+    return strsprintf(_T("%d frames, %.1f MB in %lld reads, pipe size %d KB, pipe starved %.1f ms, waited for free buffers %.1f ms, waited for frames %.1f ms."),
+        m_frameCount, m_readBytes / (1024.0 * 1024.0), (long long)m_readCount, m_pipeSize >> 10,
+        m_pipeStarveTime / 1000.0, m_bufferWaitTime / 1000.0, m_consumerWaitTime / 1000.0);
+}
+
+void RGYPipeFrameReader::setPipeSize() {
+    //1フレーム分あれば十分
+    int currentSize = 0;
+    const int pipeSize = rgy_pipe_expand(m_fd, m_frameSize, &currentSize);
+    if (pipeSize < 0) {
+        AddMessage(RGY_LOG_DEBUG, _T("input is not a pipe.\n"));
+        return;
+    }
+    m_pipeSize = pipeSize;
+    AddMessage(RGY_LOG_DEBUG, _T("pipe size: %d -> %d.\n"), currentSize, m_pipeSize);
+}
+
+RGY_ERR RGYPipeFrameReader::init(FILE *fp, size_t frameSize, size_t bufferSize, bool y4m, const RGYParamThread& threadParam, std::shared_ptr<RGYLog> log) {
+    close();
+    m_log = log;
+#if defined(_WIN32) || defined(_WIN64)
+    m_fd = _fileno(fp);
+#else
+    m_fd = fileno(fp);
+#endif
+    if (m_fd < 0) {
+        AddMessage(RGY_LOG_ERROR, _T("invalid file descriptor.\n"));
+        return RGY_ERR_INVALID_HANDLE;
+    }
+    m_frameSize = frameSize;
+    m_bufferSize = RGY_PIPE_READER_HEADER_ROOM + ALIGN(std::max(frameSize, bufferSize), RGY_PIPE_READER_ALIGN) + RGY_PIPE_READER_TAIL_PAD;
+    m_y4m = y4m;
+    setPipeSize();
+
+    const int frames = (int)std::max<size_t>(2, std::min<size_t>(RGY_PIPE_READER_MAX_FRAMES, RGY_PIPE_READER_MAX_BUFFER / m_bufferSize));
+    m_qFree.init(frames * 2, frames);
+    m_qFilled.init(frames * 2, frames);
+    for (int i = 0; i < frames; i++) {
+        //カーネルからのコピーが効率よく行えるよう、ページ境界に合わせる
+        auto buf = std::unique_ptr<uint8_t, aligned_malloc_deleter>((uint8_t *)_aligned_malloc(m_bufferSize, 4096), aligned_malloc_deleter());
+        if (!buf) {
+            AddMessage(RGY_LOG_ERROR, _T("Failed to allocate buffer.\n"));
+            return RGY_ERR_NULL_PTR;
+        }
+        m_buffers.push_back(std::move(buf));
+        m_data.push_back(nullptr);
+        m_qFree.push(i);
+    }
+    AddMessage(RGY_LOG_DEBUG, _T("%d buffers of %llu bytes, frame size %llu.\n"),
+        frames, (unsigned long long)m_bufferSize, (unsigned long long)m_frameSize);
+    m_thread = std::thread(&RGYPipeFrameReader::threadFunc, this, threadParam);
+    return RGY_ERR_NONE;
+}
+
+bool RGYPipeFrameReader::waitReadable() {
+#if defined(_WIN32) || defined(_WIN64)
+    DWORD avail = 0;
+    const HANDLE handle = (HANDLE)_get_osfhandle(m_fd);
+    if (PeekNamedPipe(handle, nullptr, 0, nullptr, &avail, nullptr) && avail == 0) {
+        const auto waitStart = std::chrono::steady_clock::now();
+        while (!m_abort && PeekNamedPipe(handle, nullptr, 0, nullptr, &avail, nullptr) && avail == 0) {
+            Sleep(1);
+        }
+        m_pipeStarveTime += elapsedMicroSec(waitStart);
+    }
+#else
+    struct pollfd pfd = { m_fd, POLLIN, 0 };
+    if (poll(&pfd, 1, 0) == 0) {
+        //パイプが空の間の待ち時間を入力側の律速として計測する
+        const auto waitStart = std::chrono::steady_clock::now();
+        while (!m_abort && poll(&pfd, 1, 100) == 0) {
+            ;
+        }
+        m_pipeStarveTime += elapsedMicroSec(waitStart);
+    }
+#endif
+    return !m_abort;
+}
+
+RGY_ERR RGYPipeFrameReader::readFull(uint8_t *buf, size_t size, size_t *readSize) {
+    size_t done = 0;
+    while (done < size) {
+        if (!waitReadable()) {
+            return RGY_ERR_ABORTED;
+        }
+        const auto request = std::min<size_t>(size - done, 1 << 30);
+#if defined(_WIN32) || defined(_WIN64)
+        const auto ret = _read(m_fd, buf + done, (uint32_t)request);
+#else
+        const auto ret = read(m_fd, buf + done, request);
+#endif
+        if (ret == 0) {
+            break; //EOF
+        }
+        if (ret < 0) {
+#if !(defined(_WIN32) || defined(_WIN64))
+            if (errno == EINTR || errno == EAGAIN) {
+                continue;
+            }
+#endif
+            AddMessage(RGY_LOG_ERROR, _T("Failed to read from input: %s.\n"), _tcserror(errno));
+            return RGY_ERR_UNKNOWN;
+        }
+        done += ret;
+        m_readBytes += ret;
+        m_readCount++;
+    }
+    *readSize = done;
+    return RGY_ERR_NONE;
+}
+
+RGY_ERR RGYPipeFrameReader::readFrame(uint8_t *buf, const uint8_t **data) {
+    size_t readSize = 0;
+    if (!m_y4m) {
+        auto ptr = buf + RGY_PIPE_READER_HEADER_ROOM;
+        if (auto sts = readFull(ptr, m_frameSize, &readSize); sts != RGY_ERR_NONE) {
+            return sts;
+        }
+        if (readSize != m_frameSize) {
+            AddMessage(RGY_LOG_DEBUG, _T("read: finish: %llu.\n"), (unsigned long long)readSize);
+            return RGY_ERR_MORE_DATA;
+        }
+        *data = ptr;
+        return RGY_ERR_NONE;
+    }
+    //パラメータのない"FRAME\n"を想定して、フレームデータがアラインされた位置に来るよう読み込む
+    const size_t headerMin = strlen("FRAME\n");
+    auto ptr = buf + RGY_PIPE_READER_HEADER_ROOM - headerMin;
+    if (auto sts = readFull(ptr, headerMin + m_frameSize, &readSize); sts != RGY_ERR_NONE) {
+        return sts;
+    }
+    if (readSize < headerMin || memcmp(ptr, "FRAME", strlen("FRAME")) != 0) {
+        AddMessage(RGY_LOG_DEBUG, _T("header: finish.\n"));
+        return RGY_ERR_MORE_DATA;
+    }
+    size_t headerSize = 0;
+    const auto headerSearchEnd = std::min<size_t>(readSize, strlen("FRAME") + RGY_PIPE_READER_Y4M_HEADER_MAX + 1);
+    for (size_t i = strlen("FRAME"); i < headerSearchEnd; i++) {
+        if (ptr[i] == '\n') {
+            headerSize = i + 1;
+            break;
+        }
+    }
+    if (headerSize == 0) {
+        AddMessage(RGY_LOG_DEBUG, _T("header: invalid frame header.\n"));
+        return RGY_ERR_MORE_DATA;
+    }
+    //FRAMEヘッダにパラメータがあった場合は、その分を追加で読み込む
+    if (headerSize > headerMin && readSize == headerMin + m_frameSize) {
+        size_t readSizeAdd = 0;
+        if (auto sts = readFull(ptr + readSize, headerSize - headerMin, &readSizeAdd); sts != RGY_ERR_NONE) {
+            return sts;
+        }
+        readSize += readSizeAdd;
+    }
+    if (readSize != headerSize + m_frameSize) {
+        AddMessage(RGY_LOG_DEBUG, _T("read: finish: %llu.\n"), (unsigned long long)readSize);
+        return RGY_ERR_MORE_DATA;
+    }
+    *data = ptr + headerSize;
+    return RGY_ERR_NONE;
+}
+
+RGY_ERR RGYPipeFrameReader::threadFunc(RGYParamThread threadParam) {
+    threadParam.apply(GetCurrentThread());
+    AddMessage(RGY_LOG_DEBUG, _T("Set pipe reader thread param: %s.\n"), threadParam.desc().c_str());
+    auto sts = RGY_ERR_NONE;
+    while (!m_abort) {
+        int idx = -1;
+        const auto waitStart = std::chrono::steady_clock::now();
+        while (!m_abort && !m_qFree.front_copy_and_pop_no_lock(&idx)) {
+            m_qFree.wait_for_push();
+        }
+        m_bufferWaitTime += elapsedMicroSec(waitStart);
+        if (idx < 0) {
+            break;
+        }
+        const uint8_t *data = nullptr;
+        if ((sts = readFrame(m_buffers[idx].get(), &data)) != RGY_ERR_NONE) {
+            break;
+        }
+        m_data[idx] = data;
+        m_frameCount++;
+        m_qFilled.push(idx);
+    }
+    if (sts == RGY_ERR_NONE) {
+        sts = RGY_ERR_ABORTED; //中断された
+    }
+    AddMessage((sts == RGY_ERR_MORE_DATA || sts == RGY_ERR_ABORTED) ? RGY_LOG_DEBUG : RGY_LOG_ERROR,
+        _T("Finished pipe reader thread: %s.\n"), get_err_mes(sts));
+    m_threadSts = sts;
+    m_fin = true;
+    return sts;
+}
+
+RGY_ERR RGYPipeFrameReader::get(RGYPipeReaderFrame *frame) {
+    int idx = -1;
+    const auto waitStart = std::chrono::steady_clock::now();
+    while (!m_qFilled.front_copy_and_pop_no_lock(&idx)) {
+        if (m_fin) {
+            //終了フラグを立てる前にpushされたものがないか、再度確認する
+            if (!m_qFilled.front_copy_and_pop_no_lock(&idx)) {
+                return m_threadSts;
+            }
+            break;
+        }
+        m_qFilled.wait_for_push();
+    }
+    m_consumerWaitTime += elapsedMicroSec(waitStart);
+    frame->idx = idx;
+    frame->data = m_data[idx];
+    return RGY_ERR_NONE;
+}
+
+void RGYPipeFrameReader::release(const RGYPipeReaderFrame& frame) {
+    if (frame.idx >= 0) {
+        m_qFree.push(frame.idx);
+    }
+}
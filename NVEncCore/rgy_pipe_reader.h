@@ -0,0 +1,140 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2024 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// --------------------------------------------------------------------------------------------
+
+
+#pragma once
+#ifndef __RGY_PIPE_READER_H__
+#define __RGY_PIPE_READER_H__
+
+#include <cstdint>
+#include <cstdio>
+#include <atomic>
+#include <thread>
+#include <memory>
+#include <vector>
+#include "rgy_util.h"
+#include "rgy_err.h"
+#include "rgy_log.h"
+#include "rgy_queue.h"
+#include "rgy_thread_affinity.h"
+
+// パイプ(標準入力)からraw/y4mのフレームを読み込む
+//
+// 専用の読み込みスレッドでフレームバッファのリングに直接readし、
+// y4mのFRAMEヘッダもバッファ上でそのまま解析する
+// Linuxでは可能な範囲でパイプのサイズを拡大する
+//
+// フレームバッファの配置
+//  [RGY_PIPE_READER_HEADER_ROOM]  y4mのFRAMEヘッダ (フレームデータの直前に来るように読み込む)
+//  [frameSize]                    フレームデータ (通常はRGY_PIPE_READER_ALIGNでアラインされる)
+//  [bufferSize - frameSize]       変換時の読みすぎ対策
+//  [RGY_PIPE_READER_TAIL_PAD]     FRAMEヘッダにパラメータがあり、フレームデータが後ろにずれた場合の分
+static const int RGY_PIPE_READER_HEADER_ROOM = 64;
+static const int RGY_PIPE_READER_ALIGN = 64;
+static const int RGY_PIPE_READER_TAIL_PAD = 128;
+static const int RGY_PIPE_READER_Y4M_HEADER_MAX = 64;  // "FRAME"以降のパラメータの最大長
+static const int RGY_PIPE_READER_MAX_FRAMES = 8;
+static const size_t RGY_PIPE_READER_MAX_BUFFER = 512 * 1024 * 1024; // リング全体の上限 (最低2フレームは確保する)
+
+struct RGYPipeReaderFrame {
+    int idx;              // release()に渡すリングの位置
+    const uint8_t *data;  // フレームデータの先頭
+};
+
+class RGYPipeFrameReader {
+public:
+    RGYPipeFrameReader();
+    ~RGYPipeFrameReader();
+
+    // fpは読み込み位置がフレームの先頭にあり、stdioのバッファにデータが残っていないこと
+    // bufferSizeはframeSizeに変換時の読みすぎ対策の分を加えたサイズ
+    RGY_ERR init(FILE *fp, size_t frameSize, size_t bufferSize, bool y4m, const RGYParamThread& threadParam, std::shared_ptr<RGYLog> log);
+    // 次のフレームを取得する (読み込み終了時はRGY_ERR_MORE_DATA)
+    RGY_ERR get(RGYPipeReaderFrame *frame);
+    // 使用済みのフレームバッファを読み込みスレッドに返却する
+    void release(const RGYPipeReaderFrame& frame);
+    void close();
+
+    int frames() const { return (int)m_buffers.size(); }
+    int pipeSize() const { return m_pipeSize; }
+    tstring stats() const;
+protected:
+    RGY_ERR readFrame(uint8_t *buf, const uint8_t **data);
+    RGY_ERR readFull(uint8_t *buf, size_t size, size_t *readSize);
+    bool waitReadable();
+    void setPipeSize();
+    RGY_ERR threadFunc(RGYParamThread threadParam);
+    void AddMessage(RGYLogLevel log_level, const tstring &str) {
+        if (m_log == nullptr || log_level < m_log->getLogLevel(RGY_LOGT_IN)) {
+            return;
+        }
+        auto lines = split(str, _T("\n"));
+        for (const auto &line : lines) {
+            if (line[0] != _T('\0')) {
+                m_log->write(log_level, RGY_LOGT_IN, (_T("pipe: ") + line + _T("\n")).c_str());
+            }
+        }
+    }
+    void AddMessage(RGYLogLevel log_level, const TCHAR *format, ...) {
+        if (m_log == nullptr || log_level < m_log->getLogLevel(RGY_LOGT_IN)) {
+            return;
+        }
+
+        va_list args;
+        va_start(args, format);
+        int len = _vsctprintf(format, args) + 1; // _vscprintf doesn't count terminating '\0'
+        tstring buffer;
+        buffer.resize(len, _T('\0'));
+        _vstprintf_s(&buffer[0], len, format, args);
+        va_end(args);
+        AddMessage(log_level, buffer);
+    }
+
+    int m_fd;
+    size_t m_frameSize;
+    size_t m_bufferSize;
+    bool m_y4m;
+    int m_pipeSize;
+    std::shared_ptr<RGYLog> m_log;
+    std::vector<std::unique_ptr<uint8_t, aligned_malloc_deleter>> m_buffers;
+    std::vector<const uint8_t *> m_data;   // 各バッファのフレームデータの位置
+    RGYQueueMPMP<int> m_qFree;             // 空きバッファ
+    RGYQueueMPMP<int> m_qFilled;           // 読み込み済みバッファ
+    std::thread m_thread;
+    std::atomic<bool> m_abort;
+    std::atomic<bool> m_fin;
+    RGY_ERR m_threadSts;
+    // 統計 (us)
+    int64_t m_pipeStarveTime;    // パイプが空で読み込みスレッドが待機した時間 (入力側が律速)
+    int64_t m_bufferWaitTime;    // 空きバッファを待った時間 (エンコード側が律速)
+    int64_t m_consumerWaitTime;  // 読み込み済みフレームを待った時間
+    int64_t m_readBytes;
+    int64_t m_readCount;       // readの呼び出し回数
+    int m_frameCount;
+};
+
+#endif //__RGY_PIPE_READER_H__
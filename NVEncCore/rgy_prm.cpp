@@ -830,7 +830,9 @@ VppDecimate::VppDecimate() :
     blockY(FILTER_DEFAULT_DECIMATE_BLOCK_Y),
     preProcessed(FILTER_DEFAULT_DECIMATE_PREPROCESSED),
     chroma(FILTER_DEFAULT_DECIMATE_CHROMA),
-    log(FILTER_DEFAULT_DECIMATE_LOG) {
+    log(FILTER_DEFAULT_DECIMATE_LOG),
+    pass(FILTER_DEFAULT_DECIMATE_PASS),
+    analysis() {
 
 }
 
@@ -843,14 +845,16 @@ bool VppDecimate::operator==(const VppDecimate& x) const {
         && blockY == x.blockY
         && preProcessed == x.preProcessed
         && chroma == x.chroma
-        && log == x.log;
+        && log == x.log
+        && pass == x.pass
+        && analysis == x.analysis;
 }
 bool VppDecimate::operator!=(const VppDecimate& x) const {
     return !(*this == x);
 }
 
 tstring VppDecimate::print() const {
-    return strsprintf(_T("decimate: cycle %d, drop %d, threDup %.2f, threSC %.2f\n")
+    auto str = strsprintf(_T("decimate: cycle %d, drop %d, threDup %.2f, threSC %.2f\n")
         _T("                         block %dx%d, chroma %s, log %s"),
         cycle, drop,
         threDuplicate, threSceneChange,
@@ -858,6 +862,10 @@ tstring VppDecimate::print() const {
         /*preProcessed ? _T("on") : _T("off"),*/
         chroma ? _T("on") : _T("off"),
         log ? _T("on") : _T("off"));
+    if (pass > 0) {
+        str += strsprintf(_T("\n                         pass %d, analysis %s"), pass, analysis.c_str());
+    }
+    return str;
 }
 
 
@@ -1138,7 +1146,8 @@ VppSubburn::VppSubburn() :
     contrast(FILTER_DEFAULT_TWEAK_CONTRAST),
     ts_offset(0.0),
     vid_ts_offset(true),
-    forced_subs_only(false) {
+    forced_subs_only(false),
+    lookahead(FILTER_DEFAULT_SUBBURN_LOOKAHEAD) {
 }
 
 bool VppSubburn::operator==(const VppSubburn &x) const {
@@ -1154,7 +1163,8 @@ bool VppSubburn::operator==(const VppSubburn &x) const {
         && contrast == x.contrast
         && ts_offset == x.ts_offset
         && vid_ts_offset == x.vid_ts_offset
-        && forced_subs_only == x.forced_subs_only;
+        && forced_subs_only == x.forced_subs_only
+        && lookahead == x.lookahead;
 }
 bool VppSubburn::operator!=(const VppSubburn &x) const {
     return !(*this == x);
@@ -1184,6 +1194,9 @@ tstring VppSubburn::print() const {
     if (forced_subs_only) {
         str += _T(", forced_subs_only");
     }
+    if (lookahead != FILTER_DEFAULT_SUBBURN_LOOKAHEAD) {
+        str += strsprintf(_T(", lookahead %d"), lookahead);
+    }
     return str;
 }
 
@@ -1425,7 +1438,8 @@ VppOverlay::VppOverlay() :
     alpha(0.0f),
     alphaMode(VppOverlayAlphaMode::Override),
     lumaKey(),
-    loop(false) {
+    loop(false),
+    cacheMB(FILTER_DEFAULT_OVERLAY_CACHE_MB) {
 
 }
 
@@ -1439,7 +1453,8 @@ bool VppOverlay::operator==(const VppOverlay &x) const {
         && alpha == x.alpha
         && alphaMode == x.alphaMode
         && lumaKey == x.lumaKey
-        && loop == x.loop;
+        && loop == x.loop
+        && cacheMB == x.cacheMB;
 }
 bool VppOverlay::operator!=(const VppOverlay &x) const {
     return !(*this == x);
@@ -1464,13 +1479,17 @@ tstring VppOverlay::print() const {
             }
         }
     }
+    tstring loopStr = (loop) ? _T("on") : _T("off");
+    if (loop && cacheMB != FILTER_DEFAULT_OVERLAY_CACHE_MB) {
+        loopStr += strsprintf(_T(" (cache %dMB)"), cacheMB);
+    }
     return strsprintf(_T("overlay: %s\n")
         _T("                        pos (%d,%d), size %dx%d, loop %s\n")
         _T("                        alpha %s"),
         inputFile.c_str(),
         posX, posY,
         width, height,
-        (loop) ? _T("on") : _T("off"),
+        loopStr.c_str(),
         alphaStr.c_str());
 }
 
@@ -1683,7 +1702,9 @@ VMAFParam::VMAFParam() :
     threads(0),
     subsample(1),
     phone_model(false),
-    enable_transform(false) {
+    enable_transform(false),
+    shards(1),
+    shard_frames(VMAF_DEFAULT_SHARD_FRAMES) {
 };
 
 bool VMAFParam::operator==(const VMAFParam &x) const {
@@ -1692,7 +1713,9 @@ bool VMAFParam::operator==(const VMAFParam &x) const {
         && threads == x.threads
         && subsample == x.subsample
         && phone_model == x.phone_model
-        && enable_transform == x.enable_transform;
+        && enable_transform == x.enable_transform
+        && shards == x.shards
+        && shard_frames == x.shard_frames;
 }
 bool VMAFParam::operator!=(const VMAFParam &x) const {
     return !(*this == x);
@@ -1706,6 +1729,9 @@ tstring VMAFParam::print() const {
     if (enable_transform) {
         str += _T(", transform");
     }
+    if (shards > 1) {
+        str += strsprintf(_T(", shards %d x %d frames"), shards, shard_frames);
+    }
     return str;
 }
 
@@ -1816,6 +1842,9 @@ RGYParamCommon::RGYParamCommon() :
     outReplayFile(),
     outReplayCodec(RGY_CODEC_UNKNOWN),
     chapterFile(),
+    keyFile(),
+    keyFileOut(),
+    keyTolerance(0),
     AVInputFormat(nullptr),
     AVSyncMode(RGY_AVSYNC_AUTO),     //avsyncの方法 (RGY_AVSYNC_xxx)
     timestampPassThrough(false),
@@ -1843,20 +1872,40 @@ bool RGYParamAvoidIdleClock::operator!=(const RGYParamAvoidIdleClock &x) const {
 
 RGYParamCommon::~RGYParamCommon() {};
 
+RGYParamRealtime::RGYParamRealtime() :
+    enable(false),
+    latency(RGY_REALTIME_LATENCY_DEFAULT),
+    maxLevel(RGYRealtimeLevel::DropFrame) {
+
+}
+
+bool RGYParamRealtime::operator==(const RGYParamRealtime &x) const {
+    return enable == x.enable
+        && latency == x.latency
+        && maxLevel == x.maxLevel;
+}
+bool RGYParamRealtime::operator!=(const RGYParamRealtime &x) const {
+    return !(*this == x);
+}
+
 RGYParamControl::RGYParamControl() :
     threadCsp(0),
     simdCsp(RGY_SIMD::SIMD_ALL),
     logfile(),              //ログ出力先
     loglevel(RGY_LOG_INFO),                 //ログ出力レベル
     logAddTime(false),
+    logJson(false),
+    logRepeatLimit(0),
     logFramePosList(),     //framePosList出力
     logPacketsList(),
     logMuxVidTs(),
+    frameStats(),
     threadOutput(RGY_OUTPUT_THREAD_AUTO),
     threadAudio(RGY_AUDIO_THREAD_AUTO),
     threadInput(RGY_INPUT_THREAD_AUTO),
     threadParams(),
     procSpeedLimit(0),      //処理速度制限 (0で制限なし)
+    realtime(),
     taskPerfMonitor(false),   //タスクの処理時間を計測する
     perfMonitorSelect(0),
     perfMonitorSelectMatplot(0),
@@ -1987,6 +2036,7 @@ bool invalid_with_raw_out(const RGYParamCommon &prm, shared_ptr<RGYLog> log) {
     INVALID_WITH_RAW_OUT(prm.videoMetadata.size() > 0, "--video-metadata");
     INVALID_WITH_RAW_OUT(prm.muxOpt.size() > 0, "-m");
     INVALID_WITH_RAW_OUT(prm.keyFile.length() > 0, "--keyfile");
+    INVALID_WITH_RAW_OUT(prm.keyFileOut.length() > 0, "--keyfile-out");
     INVALID_WITH_RAW_OUT(prm.timecodeFile.length() > 0, "--timecode");
     INVALID_WITH_RAW_OUT(prm.metric.ssim, "--ssim");
     INVALID_WITH_RAW_OUT(prm.metric.psnr, "--psnr");
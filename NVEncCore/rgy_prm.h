@@ -191,6 +191,7 @@ VppType vppfilter_str_to_type(tstring str);
 std::vector<CX_DESC> get_list_vpp_filter();
 
 static const TCHAR* VMAF_DEFAULT_MODEL_VERSION = _T("vmaf_v0.6.1");
+static const int VMAF_DEFAULT_SHARD_FRAMES = 48;
 
 static const double FILTER_DEFAULT_COLORSPACE_LDRNITS = 100.0;
 static const double FILTER_DEFAULT_COLORSPACE_NOMINAL_SOURCE_PEAK = 100.0;
@@ -249,6 +250,7 @@ static const int   FILTER_DEFAULT_DECIMATE_BLOCK_Y = 32;
 static const bool  FILTER_DEFAULT_DECIMATE_PREPROCESSED = false;
 static const bool  FILTER_DEFAULT_DECIMATE_CHROMA = true;
 static const bool  FILTER_DEFAULT_DECIMATE_LOG = false;
+static const int   FILTER_DEFAULT_DECIMATE_PASS = 0;
 
 static const int   FILTER_DEFAULT_MPDECIMATE_HI = 768;
 static const int   FILTER_DEFAULT_MPDECIMATE_LO = 320;
@@ -303,6 +305,10 @@ static const float FILTER_DEFAULT_TWEAK_GAMMA = 1.0f;
 static const float FILTER_DEFAULT_TWEAK_SATURATION = 1.0f;
 static const float FILTER_DEFAULT_TWEAK_HUE = 0.0f;
 
+static const int   FILTER_DEFAULT_SUBBURN_LOOKAHEAD = 8;
+
+static const int   FILTER_DEFAULT_OVERLAY_CACHE_MB = 256;
+
 static const float FILTER_DEFAULT_EDGELEVEL_STRENGTH = 5.0f;
 static const float FILTER_DEFAULT_EDGELEVEL_THRESHOLD = 20.0f;
 static const float FILTER_DEFAULT_EDGELEVEL_BLACK = 0.0f;
@@ -1170,6 +1176,8 @@ struct VppDecimate {
     bool preProcessed;
     bool chroma;
     bool log;
+    int pass;          // 0: 通常, 1: 解析結果を出力, 2: 解析結果を使用
+    tstring analysis;  // 解析結果のファイル
 
     VppDecimate();
     bool operator==(const VppDecimate &x) const;
@@ -1359,6 +1367,7 @@ struct VppSubburn {
     double ts_offset;
     bool vid_ts_offset;
     bool forced_subs_only;
+    int lookahead; //テキスト字幕を先行して描画するフレーム数 (0で先行描画しない)
 
     VppSubburn();
     bool operator==(const VppSubburn &x) const;
@@ -1539,6 +1548,7 @@ struct VppOverlay {
     VppOverlayAlphaMode alphaMode;
     VppOverlayAlphaKey lumaKey;
     bool loop;
+    int cacheMB; // loop時にフレームを保持しておくキャッシュの上限 (MB, 0で無効)
 
     VppOverlay();
     bool operator==(const VppOverlay &x) const;
@@ -1702,6 +1712,8 @@ struct VMAFParam {
     int subsample;
     bool phone_model;
     bool enable_transform;
+    int shards;       // 並列に計算するlibvmafのコンテキスト数 (1なら分割しない)
+    int shard_frames; // 分割する際の1区間のフレーム数
 
     VMAFParam();
     bool operator==(const VMAFParam &x) const;
@@ -1805,6 +1817,8 @@ struct RGYParamCommon {
     RGY_CODEC outReplayCodec;
     tstring chapterFile;
     tstring keyFile;
+    tstring keyFileOut;       //挿入したキーフレームの出力先
+    int keyTolerance;         //このフレーム数以内のキーフレームは1つにまとめる
     TCHAR *AVInputFormat;
     RGYAVSync AVSyncMode;     //avsyncの方法 (NV_AVSYNC_xxx)
     bool timestampPassThrough; //timestampをそのまま出力する
@@ -1842,20 +1856,34 @@ struct RGYParamAvoidIdleClock {
     bool operator!=(const RGYParamAvoidIdleClock &x) const;
 };
 
+struct RGYParamRealtime {
+    bool enable;
+    int latency;                 //許容する遅延 (ms)
+    RGYRealtimeLevel maxLevel;   //どこまで劣化を許すか
+
+    RGYParamRealtime();
+    bool operator==(const RGYParamRealtime &x) const;
+    bool operator!=(const RGYParamRealtime &x) const;
+};
+
 struct RGYParamControl {
     int threadCsp;
     RGY_SIMD simdCsp;
     tstring logfile;              //ログ出力先
     RGYParamLogLevel loglevel; //ログ出力レベル
     bool logAddTime;
+    bool logJson;                        //ログファイルをJSON Lines形式で出力
+    int logRepeatLimit;                  //同じメッセージが連続した場合の出力上限 (0で無制限)
     RGYDebugLogFile logFramePosList;     //framePosList出力
     RGYDebugLogFile logPacketsList;
     RGYDebugLogFile logMuxVidTs;
+    RGYDebugLogFile frameStats;          //フレームごとの統計情報出力
     int threadOutput;
     int threadAudio;
     int threadInput;
     RGYParamThreads threadParams;
     int procSpeedLimit;      //処理速度制限 (0で制限なし)
+    RGYParamRealtime realtime; //リアルタイムモード
     bool taskPerfMonitor;
     int64_t perfMonitorSelect;
     int64_t perfMonitorSelectMatplot;
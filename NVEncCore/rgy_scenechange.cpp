@@ -0,0 +1,479 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2024 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// --------------------------------------------------------------------------------------------
+
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include "rgy_scenechange.h"
+#include "rgy_simd.h"
+#include "convert_csp.h"
+
+static const float RGY_SCENE_HIST_MIN = 0.05f;        // ヒストグラムの差がこれ未満ならシーンチェンジとしない (パンなど)
+static const float RGY_SCENE_FADE_MIN_DELTA = 0.5f;   // フェードとする輝度の平均の変化の下限
+static const float RGY_SCENE_FADE_MAX_RESIDUAL = 0.6f; // フェードとする補正後の差分の比の上限
+static const int RGY_SCENE_FADE_MIN_FRAMES = 2;       // フェードとする連続したフレーム数
+static const float RGY_SCENE_DARK_MEAN = 24.0f;       // これ未満の輝度の平均からのフェードインをシーンの開始とする
+
+RGYSceneChangeParam::RGYSceneChangeParam() :
+    enable(false),
+    threshold(10.0f),
+    fade(true),
+    keyframe(true),
+    log() {
+
+}
+
+bool RGYSceneChangeParam::operator==(const RGYSceneChangeParam& x) const {
+    return enable == x.enable
+        && threshold == x.threshold
+        && fade == x.fade
+        && keyframe == x.keyframe
+        && log == x.log;
+}
+bool RGYSceneChangeParam::operator!=(const RGYSceneChangeParam& x) const {
+    return !(*this == x);
+}
+
+tstring RGYSceneChangeParam::print() const {
+    tstring str = strsprintf(_T("threshold %.1f, fade %s, keyframe %s"),
+        threshold, fade ? _T("on") : _T("off"), keyframe ? _T("on") : _T("off"));
+    if (log.length() > 0) {
+        str += _T(", log ") + log;
+    }
+    return str;
+}
+
+template<typename Type>
+static void luma_downscale_c(uint8_t *dst, const int width, const int height, const uint8_t *src, const int srcPitch, const int scale, const int shift) {
+    const int div = (scale * scale) << shift;
+    for (int y = 0; y < height; y++) {
+        uint8_t *ptrDst = dst + y * width;
+        for (int x = 0; x < width; x++) {
+            int sum = 0;
+            for (int j = 0; j < scale; j++) {
+                const Type *ptrSrc = (const Type *)(src + (y * scale + j) * srcPitch) + x * scale;
+                for (int i = 0; i < scale; i++) {
+                    sum += ptrSrc[i];
+                }
+            }
+            ptrDst[x] = (uint8_t)std::min((sum + div / 2) / div, 255);
+        }
+    }
+}
+
+void rgy_luma_downscale8_c(uint8_t *dst, const int width, const int height, const uint8_t *src, const int srcPitch, const int scale, const int shift) {
+    luma_downscale_c<uint8_t>(dst, width, height, src, srcPitch, scale, shift);
+}
+
+void rgy_luma_downscale16_c(uint8_t *dst, const int width, const int height, const uint8_t *src, const int srcPitch, const int scale, const int shift) {
+    luma_downscale_c<uint16_t>(dst, width, height, src, srcPitch, scale, shift);
+}
+
+bool rgy_luma_downscale_supported(const RGY_CSP csp, int *shift) {
+    switch (csp) {
+    case RGY_CSP_NV12:
+    case RGY_CSP_YV12:
+    case RGY_CSP_YUV422:
+    case RGY_CSP_NV16:
+    case RGY_CSP_NV24:
+    case RGY_CSP_YUV444:
+    case RGY_CSP_Y8:
+        *shift = 0;
+        return true;
+    case RGY_CSP_P010: // 上位ビットに詰めて格納されている
+    case RGY_CSP_P210:
+    case RGY_CSP_YV12_16:
+    case RGY_CSP_YUV422_16:
+    case RGY_CSP_YUV444_16:
+    case RGY_CSP_Y16:
+        *shift = 8;
+        return true;
+    case RGY_CSP_YV12_09:
+    case RGY_CSP_YV12_10:
+    case RGY_CSP_YV12_12:
+    case RGY_CSP_YV12_14:
+    case RGY_CSP_YUV422_09:
+    case RGY_CSP_YUV422_10:
+    case RGY_CSP_YUV422_12:
+    case RGY_CSP_YUV422_14:
+    case RGY_CSP_YUV444_09:
+    case RGY_CSP_YUV444_10:
+    case RGY_CSP_YUV444_12:
+    case RGY_CSP_YUV444_14:
+        *shift = RGY_CSP_BIT_DEPTH[csp] - 8;
+        return true;
+    default:
+        return false;
+    }
+}
+
+funcLumaDownscale get_luma_downscale_func(const RGY_CSP csp) {
+    const bool highbitdepth = RGY_CSP_BIT_DEPTH[csp] > 8;
+#if defined(_M_IX86) || defined(_M_X64) || defined(__x86_64)
+    if ((get_availableSIMD() & RGY_SIMD::AVX2) == RGY_SIMD::AVX2) {
+        return (highbitdepth) ? rgy_luma_downscale16_avx2 : rgy_luma_downscale8_avx2;
+    }
+#endif
+    return (highbitdepth) ? rgy_luma_downscale16_c : rgy_luma_downscale8_c;
+}
+
+uint64_t rgy_scene_sad_c(const uint8_t *p0, const uint8_t *p1, const size_t n, const int offset) {
+    uint64_t sad = 0;
+    for (size_t i = 0; i < n; i++) {
+        sad += std::abs((int)p0[i] - clamp((int)p1[i] + offset, 0, 255));
+    }
+    return sad;
+}
+
+uint64_t rgy_scene_sum_c(const uint8_t *p, const size_t n) {
+    uint64_t sum = 0;
+    for (size_t i = 0; i < n; i++) {
+        sum += p[i];
+    }
+    return sum;
+}
+
+funcSceneSad get_scene_sad_func() {
+#if defined(_M_IX86) || defined(_M_X64) || defined(__x86_64)
+    if ((get_availableSIMD() & RGY_SIMD::AVX2) == RGY_SIMD::AVX2) {
+        return rgy_scene_sad_avx2;
+    }
+#endif
+    return rgy_scene_sad_c;
+}
+
+funcSceneSum get_scene_sum_func() {
+#if defined(_M_IX86) || defined(_M_X64) || defined(__x86_64)
+    if ((get_availableSIMD() & RGY_SIMD::AVX2) == RGY_SIMD::AVX2) {
+        return rgy_scene_sum_avx2;
+    }
+#endif
+    return rgy_scene_sum_c;
+}
+
+// ストアの依存で詰まらないよう、4つのヒストグラムに分けて数える
+static void scene_hist(std::array<int, RGY_SCENE_HIST_BINS>& hist, const uint8_t *p, const size_t n) {
+    static const int shift = 2;
+    static_assert((256 >> shift) == RGY_SCENE_HIST_BINS, "unexpected RGY_SCENE_HIST_BINS");
+    int h[4][RGY_SCENE_HIST_BINS] = { 0 };
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        h[0][p[i + 0] >> shift]++;
+        h[1][p[i + 1] >> shift]++;
+        h[2][p[i + 2] >> shift]++;
+        h[3][p[i + 3] >> shift]++;
+    }
+    for (; i < n; i++) {
+        h[0][p[i] >> shift]++;
+    }
+    for (int b = 0; b < RGY_SCENE_HIST_BINS; b++) {
+        hist[b] = h[0][b] + h[1][b] + h[2][b] + h[3][b];
+    }
+}
+
+RGYSceneChangeDetector::RGYSceneChangeDetector() :
+    m_prm(),
+    m_srcBitDepth(0),
+    m_srcShift(0),
+    m_scale(1),
+    m_width(0),
+    m_height(0),
+    m_funcDownscale(nullptr),
+    m_funcSad(nullptr),
+    m_funcSum(nullptr),
+    m_thread(),
+    m_mtx(),
+    m_cvJob(),
+    m_cvDone(),
+    m_jobs(),
+    m_processing(false),
+    m_analyzedFrame(-1),
+    m_cuts(),
+    m_fin(false),
+    m_cur(),
+    m_prev(),
+    m_histCur(),
+    m_histPrev(),
+    m_hasPrev(false),
+    m_prevMean(0.0f),
+    m_prevMafd(0.0f),
+    m_fadeRun(0),
+    m_fadeStartMean(0.0f),
+    m_frames(0),
+    m_sceneChanges(0),
+    m_fadeFrames(0),
+    m_fpLog(),
+    m_log() {
+}
+
+RGYSceneChangeDetector::~RGYSceneChangeDetector() {
+    close();
+}
+
+void RGYSceneChangeDetector::AddMessage(RGYLogLevel log_level, const TCHAR *format, ...) {
+    if (m_log == nullptr || log_level < m_log->getLogLevel(RGY_LOGT_CORE)) {
+        return;
+    }
+    va_list args;
+    va_start(args, format);
+    int len = _vsctprintf(format, args) + 1; // _vscprintf doesn't count terminating '\0'
+    tstring buffer;
+    buffer.resize(len, _T('\0'));
+    _vstprintf_s(&buffer[0], len, format, args);
+    va_end(args);
+    m_log->write(log_level, RGY_LOGT_CORE, (_T("scene-detect: ") + tstring(buffer.c_str())).c_str());
+}
+
+RGY_ERR RGYSceneChangeDetector::init(const RGYSceneChangeParam& prm, const int width, const int height, const RGY_CSP csp, std::shared_ptr<RGYLog> log) {
+    close();
+    m_prm = prm;
+    m_log = log;
+    if (!rgy_luma_downscale_supported(csp, &m_srcShift)) {
+        AddMessage(RGY_LOG_ERROR, _T("%s input is not supported.\n"), RGY_CSP_NAMES[csp]);
+        return RGY_ERR_UNSUPPORTED;
+    }
+    m_srcBitDepth = RGY_CSP_BIT_DEPTH[csp];
+    m_scale = 1;
+    while (width / m_scale > RGY_SCENE_MAX_WIDTH) {
+        m_scale *= 2;
+    }
+    m_width  = width  / m_scale;
+    m_height = height / m_scale;
+    if (m_width < 16 || m_height < 16) {
+        AddMessage(RGY_LOG_ERROR, _T("frame size %dx%d too small.\n"), width, height);
+        return RGY_ERR_UNSUPPORTED;
+    }
+    m_funcDownscale = get_luma_downscale_func(csp);
+    m_funcSad = get_scene_sad_func();
+    m_funcSum = get_scene_sum_func();
+    m_cur.resize(m_width * m_height);
+    m_prev.resize(m_width * m_height);
+    if (m_prm.log.length() > 0) {
+        FILE *fp = nullptr;
+        if (_tfopen_s(&fp, m_prm.log.c_str(), _T("w")) != 0 || fp == nullptr) {
+            AddMessage(RGY_LOG_ERROR, _T("Failed to open log file \"%s\".\n"), m_prm.log.c_str());
+            return RGY_ERR_FILE_OPEN;
+        }
+        m_fpLog.reset(fp);
+        fprintf(m_fpLog.get(), "frame,flags,mean,mad,mad_comp,hist_diff,score\n");
+    }
+    m_fin = false;
+    m_thread = std::thread(&RGYSceneChangeDetector::threadFunc, this);
+    AddMessage(RGY_LOG_DEBUG, _T("analyzing %dx%d (1/%d), %s.\n"), m_width, m_height, m_scale, m_prm.print().c_str());
+    return RGY_ERR_NONE;
+}
+
+RGYSceneInfo RGYSceneChangeDetector::analyze(const int frame) {
+    const size_t n = (size_t)m_width * m_height;
+    const uint8_t *cur = m_cur.data();
+    const uint8_t *prev = m_prev.data();
+    RGYSceneInfo info = { 0 };
+    info.frame = frame;
+    info.flags = RGY_SCENE_NONE;
+    info.mean = (float)((double)m_funcSum(cur, n) / n);
+    scene_hist(m_histCur, cur, n);
+    if (!m_hasPrev) {
+        info.flags |= RGY_SCENE_FIRST;
+    } else {
+        const float delta = info.mean - m_prevMean;
+        info.mad = (float)((double)m_funcSad(cur, prev, n, 0) / n);
+        info.madComp = info.mad;
+        const int offset = clamp((int)std::lround(delta), -255, 255);
+        if (offset != 0) {
+            info.madComp = std::min(info.mad, (float)((double)m_funcSad(cur, prev, n, offset) / n));
+        }
+        int histDiff = 0;
+        for (int b = 0; b < RGY_SCENE_HIST_BINS; b++) {
+            histDiff += std::abs(m_histCur[b] - m_histPrev[b]);
+        }
+        info.histDiff = (float)(histDiff / (2.0 * n));
+        // ffmpegのscdetと同じく、直前のフレームの差分との差もとり、動きの大きいシーンの連続では反応しないようにする
+        const float mafd = info.madComp * 100.0f / 255.0f;
+        info.score = std::min(mafd, std::abs(mafd - m_prevMafd));
+        m_prevMafd = mafd;
+
+        bool fading = false;
+        if (m_prm.fade) {
+            if (std::abs(delta) >= RGY_SCENE_FADE_MIN_DELTA && info.madComp <= info.mad * RGY_SCENE_FADE_MAX_RESIDUAL) {
+                const int dir = (delta > 0.0f) ? 1 : -1;
+                if (m_fadeRun == 0 || (m_fadeRun > 0) != (dir > 0)) {
+                    m_fadeRun = dir;
+                    m_fadeStartMean = m_prevMean;
+                } else {
+                    m_fadeRun += dir;
+                }
+            } else {
+                m_fadeRun = 0;
+            }
+            if (std::abs(m_fadeRun) >= RGY_SCENE_FADE_MIN_FRAMES) {
+                info.flags |= (m_fadeRun > 0) ? RGY_SCENE_FADE_IN : RGY_SCENE_FADE_OUT;
+                fading = true;
+            }
+        }
+        if (fading) {
+            //黒からのフェードインは、その開始を新しいシーンとする
+            if (m_fadeRun == RGY_SCENE_FADE_MIN_FRAMES && m_fadeStartMean < RGY_SCENE_DARK_MEAN) {
+                info.flags |= RGY_SCENE_CHANGE;
+            }
+        } else if (info.score >= m_prm.threshold && info.histDiff >= RGY_SCENE_HIST_MIN) {
+            info.flags |= RGY_SCENE_CHANGE;
+        }
+    }
+    m_prevMean = info.mean;
+    m_hasPrev = true;
+    std::swap(m_cur, m_prev);
+    std::swap(m_histCur, m_histPrev);
+
+    m_frames++;
+    if (info.flags & RGY_SCENE_CHANGE) {
+        m_sceneChanges++;
+    }
+    if (info.flags & (RGY_SCENE_FADE_IN | RGY_SCENE_FADE_OUT)) {
+        m_fadeFrames++;
+    }
+    return info;
+}
+
+void RGYSceneChangeDetector::writeLog(const RGYSceneInfo& info) {
+    if (!m_fpLog) {
+        return;
+    }
+    std::string flags;
+    if (info.flags & RGY_SCENE_CHANGE)   flags += "scene ";
+    if (info.flags & RGY_SCENE_FADE_IN)  flags += "fade-in ";
+    if (info.flags & RGY_SCENE_FADE_OUT) flags += "fade-out ";
+    if (flags.length() > 0) {
+        flags.pop_back();
+    }
+    fprintf(m_fpLog.get(), "%d,%s,%.2f,%.2f,%.2f,%.4f,%.2f\n",
+        info.frame, flags.c_str(), info.mean, info.mad, info.madComp, info.histDiff, info.score);
+}
+
+void RGYSceneChangeDetector::threadFunc() {
+    for (;;) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(m_mtx);
+            m_cvJob.wait(lock, [&]() { return m_fin || m_jobs.size() > 0; });
+            if (m_jobs.size() == 0) {
+                return;
+            }
+            job = std::move(m_jobs.front());
+            m_jobs.pop_front();
+            m_processing = true;
+        }
+        m_cvDone.notify_all();
+        m_funcDownscale(m_cur.data(), m_width, m_height, job.src.ptr[0], job.src.pitch[0], m_scale, m_srcShift);
+        job.ref.reset(); //入力フレームのバッファを解放
+        const auto info = analyze(job.frame);
+        writeLog(info);
+        job.result.set_value(info);
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            m_processing = false;
+            m_analyzedFrame = info.frame;
+            if (m_prm.keyframe && (info.flags & RGY_SCENE_CHANGE)) {
+                m_cuts.push_back(info.frame);
+            }
+        }
+        m_cvDone.notify_all();
+    }
+}
+
+RGY_ERR RGYSceneChangeDetector::addFrame(const int inputFrameId, const RGYFrameInfo& frame, std::shared_ptr<void> ref, std::shared_ptr<RGYFrameDataScene> *data) {
+    data->reset();
+    if (!m_thread.joinable()) {
+        return RGY_ERR_NONE;
+    }
+    if (frame.width < m_width * m_scale || frame.height < m_height * m_scale || RGY_CSP_BIT_DEPTH[frame.csp] != m_srcBitDepth) {
+        AddMessage(RGY_LOG_ERROR, _T("unexpected frame #%d: %dx%d %s.\n"), inputFrameId, frame.width, frame.height, RGY_CSP_NAMES[frame.csp]);
+        return RGY_ERR_INVALID_PARAM;
+    }
+    Job job;
+    job.frame = inputFrameId;
+    job.src = frame;
+    job.src.dataList.clear();
+    job.ref = ref;
+    *data = std::make_shared<RGYFrameDataScene>(job.result.get_future().share());
+    {
+        std::unique_lock<std::mutex> lock(m_mtx);
+        m_cvDone.wait(lock, [&]() { return (int)m_jobs.size() < RGY_SCENE_MAX_PENDING; });
+        m_jobs.push_back(std::move(job));
+    }
+    m_cvJob.notify_one();
+    return RGY_ERR_NONE;
+}
+
+bool RGYSceneChangeDetector::checkSceneChange(const int inputFrameId) {
+    if (!m_thread.joinable()) {
+        return false;
+    }
+    std::unique_lock<std::mutex> lock(m_mtx);
+    //このフレームまでの判定を待つ
+    m_cvDone.wait(lock, [&]() { return m_analyzedFrame >= inputFrameId || (m_jobs.size() == 0 && !m_processing); });
+    bool found = false;
+    while (m_cuts.size() > 0 && m_cuts.front() <= inputFrameId) {
+        m_cuts.pop_front();
+        found = true;
+    }
+    return found;
+}
+
+tstring RGYSceneChangeDetector::print() const {
+    return m_prm.print() + strsprintf(_T(", %dx%d (1/%d)"), m_width, m_height, m_scale);
+}
+
+void RGYSceneChangeDetector::close() {
+    if (m_thread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            m_fin = true;
+        }
+        m_cvJob.notify_all();
+        m_thread.join();
+    }
+    if (m_frames > 0) {
+        AddMessage(RGY_LOG_DEBUG, _T("%d scene changes, %d fade frames in %d frames.\n"), m_sceneChanges, m_fadeFrames, m_frames);
+    }
+    m_jobs.clear();
+    m_processing = false;
+    m_analyzedFrame = -1;
+    m_cuts.clear();
+    m_cur.clear();
+    m_prev.clear();
+    m_hasPrev = false;
+    m_prevMean = 0.0f;
+    m_prevMafd = 0.0f;
+    m_fadeRun = 0;
+    m_fadeStartMean = 0.0f;
+    m_frames = 0;
+    m_sceneChanges = 0;
+    m_fadeFrames = 0;
+    m_fpLog.reset();
+    m_log.reset();
+}
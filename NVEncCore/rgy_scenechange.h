@@ -0,0 +1,167 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2024 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// --------------------------------------------------------------------------------------------
+
+
+#pragma once
+#ifndef __RGY_SCENECHANGE_H__
+#define __RGY_SCENECHANGE_H__
+
+#include <cstdint>
+#include <array>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <future>
+#include <condition_variable>
+#include "rgy_tchar.h"
+#include "rgy_err.h"
+#include "rgy_log.h"
+#include "rgy_util.h"
+#include "rgy_frame.h"
+
+static const int RGY_SCENE_MAX_WIDTH = 512;   // 縮小後の幅の上限
+static const int RGY_SCENE_HIST_BINS = 64;
+static const int RGY_SCENE_MAX_PENDING = 4;   // 判定待ちのフレーム数の上限
+
+struct RGYSceneChangeParam {
+    bool enable;
+    float threshold;   // シーンチェンジ判定の閾値 (0 - 100)
+    bool fade;         // フェードを判定し、フェード中はシーンチェンジとしない
+    bool keyframe;     // シーンチェンジをキーフレームにする
+    tstring log;       // フレームごとの判定結果の出力先
+
+    RGYSceneChangeParam();
+    bool operator==(const RGYSceneChangeParam& x) const;
+    bool operator!=(const RGYSceneChangeParam& x) const;
+    tstring print() const;
+};
+
+// 輝度をscale x scale画素の平均で縮小し、8bitにする (shiftは8bitにするためのシフト量)
+typedef void (*funcLumaDownscale)(uint8_t *dst, const int width, const int height, const uint8_t *src, const int srcPitch, const int scale, const int shift);
+
+void rgy_luma_downscale8_c(uint8_t *dst, const int width, const int height, const uint8_t *src, const int srcPitch, const int scale, const int shift);
+void rgy_luma_downscale16_c(uint8_t *dst, const int width, const int height, const uint8_t *src, const int srcPitch, const int scale, const int shift);
+#if defined(_M_IX86) || defined(_M_X64) || defined(__x86_64)
+void rgy_luma_downscale8_avx2(uint8_t *dst, const int width, const int height, const uint8_t *src, const int srcPitch, const int scale, const int shift);
+void rgy_luma_downscale16_avx2(uint8_t *dst, const int width, const int height, const uint8_t *src, const int srcPitch, const int scale, const int shift);
+#endif
+
+// 輝度を8bitで取り出せる色空間か
+bool rgy_luma_downscale_supported(const RGY_CSP csp, int *shift);
+funcLumaDownscale get_luma_downscale_func(const RGY_CSP csp);
+
+// p1の各画素にoffsetを(飽和)加算してからとったSAD
+typedef uint64_t (*funcSceneSad)(const uint8_t *p0, const uint8_t *p1, const size_t n, const int offset);
+// 画素値の合計
+typedef uint64_t (*funcSceneSum)(const uint8_t *p, const size_t n);
+
+uint64_t rgy_scene_sad_c(const uint8_t *p0, const uint8_t *p1, const size_t n, const int offset);
+uint64_t rgy_scene_sum_c(const uint8_t *p, const size_t n);
+#if defined(_M_IX86) || defined(_M_X64) || defined(__x86_64)
+uint64_t rgy_scene_sad_avx2(const uint8_t *p0, const uint8_t *p1, const size_t n, const int offset);
+uint64_t rgy_scene_sum_avx2(const uint8_t *p, const size_t n);
+#endif
+
+funcSceneSad get_scene_sad_func();
+funcSceneSum get_scene_sum_func();
+
+// 入力フレームの輝度を縮小して、シーンチェンジとフェードを判定する
+//
+// 判定は別スレッドで順に行い、結果はRGYFrameDataSceneとしてフレームに付加して後段に渡す
+// (キーフレームの挿入、--dynamic-rc-auto、--vpp-decimate、ログ出力で使用する)
+//
+// シーンチェンジは、輝度の平均の変化を補正した差分(ffmpegのscdetと同じく直前のフレームの差分との差をとる)と
+// ヒストグラムの差で判定する
+// フェードは、輝度の平均が同じ方向に変化し続け、補正後の差分が小さくなるもので判定する
+class RGYSceneChangeDetector {
+public:
+    RGYSceneChangeDetector();
+    ~RGYSceneChangeDetector();
+
+    RGY_ERR init(const RGYSceneChangeParam& prm, const int width, const int height, const RGY_CSP csp, std::shared_ptr<RGYLog> log);
+    // 入力フレームを判定のキューに追加し、判定結果を受け取るRGYFrameDataSceneを返す
+    // refは縮小が終わるまで保持するので、それまでframeのバッファは再利用されない
+    RGY_ERR addFrame(const int inputFrameId, const RGYFrameInfo& frame, std::shared_ptr<void> ref, std::shared_ptr<RGYFrameDataScene> *data);
+    // 前回の呼び出しからinputFrameIdまでの入力フレームにシーンチェンジがあったか (keyframe有効時のみ)
+    // フィルタでフレームが間引かれても、シーンチェンジを見逃さないようにする
+    bool checkSceneChange(const int inputFrameId);
+    bool keyframe() const { return m_prm.keyframe; }
+    tstring print() const;
+    // 追加済みのフレームの判定を終えてから終了する
+    void close();
+protected:
+    struct Job {
+        int frame;
+        RGYFrameInfo src;
+        std::shared_ptr<void> ref;
+        std::promise<RGYSceneInfo> result;
+    };
+    void threadFunc();
+    RGYSceneInfo analyze(const int frame);
+    void writeLog(const RGYSceneInfo& info);
+    void AddMessage(RGYLogLevel log_level, const TCHAR *format, ...);
+
+    RGYSceneChangeParam m_prm;
+    int m_srcBitDepth;
+    int m_srcShift;        // 8bitにするためのシフト量
+    int m_scale;           // 縮小率
+    int m_width;           // 縮小後の解像度
+    int m_height;
+    funcLumaDownscale m_funcDownscale;
+    funcSceneSad m_funcSad;
+    funcSceneSum m_funcSum;
+
+    std::thread m_thread;
+    std::mutex m_mtx;
+    std::condition_variable m_cvJob;   // 判定待ちのフレームの追加/終了要求
+    std::condition_variable m_cvDone;  // 判定の完了
+    std::deque<Job> m_jobs;
+    bool m_processing;                 // 判定中のフレームがある
+    int m_analyzedFrame;               // 判定済みの入力フレーム番号
+    std::deque<int> m_cuts;            // シーンチェンジと判定した入力フレーム番号 (checkSceneChangeで取り出す)
+    bool m_fin;                        // 追加済みのフレームを判定したら終了する
+
+    // 以下は判定スレッドのみで使用する
+    std::vector<uint8_t> m_cur;
+    std::vector<uint8_t> m_prev;
+    std::array<int, RGY_SCENE_HIST_BINS> m_histCur;
+    std::array<int, RGY_SCENE_HIST_BINS> m_histPrev;
+    bool m_hasPrev;
+    float m_prevMean;
+    float m_prevMafd;      // 直前のフレームの補正後の差分 (0 - 100)
+    int m_fadeRun;         // 輝度の平均が同じ方向に変化し続けているフレーム数 (暗くなる場合は負)
+    float m_fadeStartMean; // フェードの直前のフレームの輝度の平均
+    int m_frames;
+    int m_sceneChanges;
+    int m_fadeFrames;
+    std::unique_ptr<FILE, fp_deleter> m_fpLog;
+    std::shared_ptr<RGYLog> m_log;
+};
+
+#endif //__RGY_SCENECHANGE_H__
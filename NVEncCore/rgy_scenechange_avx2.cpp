@@ -0,0 +1,179 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2024 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// --------------------------------------------------------------------------------------------
+
+
+#include <immintrin.h>
+#include <algorithm>
+#include "rgy_osdep.h"
+#include "rgy_scenechange.h"
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__x86_64)
+
+static RGY_FORCEINLINE int log2_pow2(int x) {
+    int n = 0;
+    while ((1 << n) < x) n++;
+    return n;
+}
+
+// 32画素ずつ、隣接する2画素の和をscale行分たしてから、scale/2個ずつまとめる
+void rgy_luma_downscale8_avx2(uint8_t *dst, const int width, const int height, const uint8_t *src, const int srcPitch, const int scale, const int shift) {
+    if (scale < 2 || scale > 16) {
+        rgy_luma_downscale8_c(dst, width, height, src, srcPitch, scale, shift);
+        return;
+    }
+    const int log2div = 2 * log2_pow2(scale) + shift;
+    const int round = (1 << log2div) >> 1;
+    const int outPerChunk = 32 / scale;
+    const int pairs = scale / 2;
+    const int chunks = width / outPerChunk;
+    const __m256i ones = _mm256_set1_epi8(1);
+    alignas(32) uint16_t tmp[16];
+    for (int y = 0; y < height; y++) {
+        const uint8_t *ptrSrc = src + y * scale * srcPitch;
+        uint8_t *ptrDst = dst + y * width;
+        for (int c = 0; c < chunks; c++, ptrSrc += 32, ptrDst += outPerChunk) {
+            __m256i acc = _mm256_setzero_si256();
+            for (int j = 0; j < scale; j++) {
+                const __m256i v = _mm256_loadu_si256((const __m256i *)(ptrSrc + j * srcPitch));
+                acc = _mm256_add_epi16(acc, _mm256_maddubs_epi16(v, ones));
+            }
+            _mm256_store_si256((__m256i *)tmp, acc);
+            for (int o = 0; o < outPerChunk; o++) {
+                int sum = 0;
+                for (int k = 0; k < pairs; k++) {
+                    sum += tmp[o * pairs + k];
+                }
+                ptrDst[o] = (uint8_t)std::min((sum + round) >> log2div, 255);
+            }
+        }
+        for (int x = chunks * outPerChunk; x < width; x++, ptrSrc += scale, ptrDst++) {
+            int sum = 0;
+            for (int j = 0; j < scale; j++) {
+                for (int i = 0; i < scale; i++) {
+                    sum += ptrSrc[j * srcPitch + i];
+                }
+            }
+            ptrDst[0] = (uint8_t)std::min((sum + round) >> log2div, 255);
+        }
+    }
+}
+
+// 16画素ずつ、隣接する2画素の和をscale行分たしてから、scale/2個ずつまとめる
+// _mm256_madd_epi16は符号付きなので、0x8000を引いてから計算し、あとで戻す
+void rgy_luma_downscale16_avx2(uint8_t *dst, const int width, const int height, const uint8_t *src, const int srcPitch, const int scale, const int shift) {
+    if (scale < 2 || scale > 16) {
+        rgy_luma_downscale16_c(dst, width, height, src, srcPitch, scale, shift);
+        return;
+    }
+    const int log2div = 2 * log2_pow2(scale) + shift;
+    const int round = (1 << log2div) >> 1;
+    const int outPerChunk = 16 / scale;
+    const int pairs = scale / 2;
+    const int chunks = (outPerChunk > 0) ? width / outPerChunk : 0;
+    const int bias = pairs * scale * 0x10000; // 0x8000 x 2画素 x scale行 x pairs
+    const __m256i ones = _mm256_set1_epi16(1);
+    const __m256i sign = _mm256_set1_epi16((short)0x8000);
+    alignas(32) int32_t tmp[8];
+    for (int y = 0; y < height; y++) {
+        const uint8_t *ptrSrc = src + y * scale * srcPitch;
+        uint8_t *ptrDst = dst + y * width;
+        for (int c = 0; c < chunks; c++, ptrSrc += 32, ptrDst += outPerChunk) {
+            __m256i acc = _mm256_setzero_si256();
+            for (int j = 0; j < scale; j++) {
+                const __m256i v = _mm256_loadu_si256((const __m256i *)(ptrSrc + j * srcPitch));
+                acc = _mm256_add_epi32(acc, _mm256_madd_epi16(_mm256_xor_si256(v, sign), ones));
+            }
+            _mm256_store_si256((__m256i *)tmp, acc);
+            for (int o = 0; o < outPerChunk; o++) {
+                int sum = bias;
+                for (int k = 0; k < pairs; k++) {
+                    sum += tmp[o * pairs + k];
+                }
+                ptrDst[o] = (uint8_t)std::min((sum + round) >> log2div, 255);
+            }
+        }
+        for (int x = chunks * outPerChunk; x < width; x++, ptrSrc += scale * sizeof(uint16_t), ptrDst++) {
+            int sum = 0;
+            for (int j = 0; j < scale; j++) {
+                const uint16_t *ptr = (const uint16_t *)(ptrSrc + j * srcPitch);
+                for (int i = 0; i < scale; i++) {
+                    sum += ptr[i];
+                }
+            }
+            ptrDst[0] = (uint8_t)std::min((sum + round) >> log2div, 255);
+        }
+    }
+}
+
+static RGY_FORCEINLINE uint64_t hsum_epi64_avx2(const __m256i v) {
+    alignas(16) uint64_t tmp[2];
+    _mm_store_si128((__m128i *)tmp, _mm_add_epi64(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1)));
+    return tmp[0] + tmp[1];
+}
+
+template<bool sub>
+static RGY_FORCEINLINE uint64_t scene_sad_avx2(const uint8_t *p0, const uint8_t *p1, const size_t n, const int offset) {
+    const __m256i off = _mm256_set1_epi8((char)std::min(std::abs(offset), 255));
+    __m256i acc0 = _mm256_setzero_si256();
+    __m256i acc1 = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64) {
+        __m256i b0 = _mm256_loadu_si256((const __m256i *)(p1 + i));
+        __m256i b1 = _mm256_loadu_si256((const __m256i *)(p1 + i + 32));
+        b0 = (sub) ? _mm256_subs_epu8(b0, off) : _mm256_adds_epu8(b0, off);
+        b1 = (sub) ? _mm256_subs_epu8(b1, off) : _mm256_adds_epu8(b1, off);
+        acc0 = _mm256_add_epi64(acc0, _mm256_sad_epu8(_mm256_loadu_si256((const __m256i *)(p0 + i)), b0));
+        acc1 = _mm256_add_epi64(acc1, _mm256_sad_epu8(_mm256_loadu_si256((const __m256i *)(p0 + i + 32)), b1));
+    }
+    uint64_t sad = hsum_epi64_avx2(_mm256_add_epi64(acc0, acc1));
+    if (i < n) {
+        sad += rgy_scene_sad_c(p0 + i, p1 + i, n - i, offset);
+    }
+    return sad;
+}
+
+uint64_t rgy_scene_sad_avx2(const uint8_t *p0, const uint8_t *p1, const size_t n, const int offset) {
+    return (offset < 0) ? scene_sad_avx2<true>(p0, p1, n, offset) : scene_sad_avx2<false>(p0, p1, n, offset);
+}
+
+uint64_t rgy_scene_sum_avx2(const uint8_t *p, const size_t n) {
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i acc0 = _mm256_setzero_si256();
+    __m256i acc1 = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64) {
+        acc0 = _mm256_add_epi64(acc0, _mm256_sad_epu8(_mm256_loadu_si256((const __m256i *)(p + i)), zero));
+        acc1 = _mm256_add_epi64(acc1, _mm256_sad_epu8(_mm256_loadu_si256((const __m256i *)(p + i + 32)), zero));
+    }
+    uint64_t sum = hsum_epi64_avx2(_mm256_add_epi64(acc0, acc1));
+    if (i < n) {
+        sum += rgy_scene_sum_c(p + i, n - i);
+    }
+    return sum;
+}
+
+#endif //#if defined(_M_IX86) || defined(_M_X64) || defined(__x86_64)
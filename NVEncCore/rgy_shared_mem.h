@@ -32,6 +32,12 @@
 #include "rgy_osdep.h"
 #include <cstdint>
 #include <string>
+#if !(defined(_WIN32) || defined(_WIN64))
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
 class RGYSharedMem {
 protected:
@@ -117,6 +123,62 @@ public:
         mem_name.clear();
     }
 };
+#else //#if defined(_WIN32) || defined(_WIN64)
+class RGYSharedMemLinux : public RGYSharedMem {
+public:
+    RGYSharedMemLinux() {
+        shared_size = 0;
+        handle = nullptr;
+        buffer = nullptr;
+    };
+    RGYSharedMemLinux(const char *pipename, uint64_t size) : RGYSharedMemLinux() {
+        open(pipename, size);
+    };
+    virtual ~RGYSharedMemLinux() {
+        close();
+    };
+
+    //size = 0の場合は、既存の共有メモリをそのサイズでマッピングする
+    //"/proc/<pid>/fd/<fd>"のようなパスを指定した場合は、memfdなどをそのファイルとして開く
+    void open(const char *pipename, uint64_t size) override {
+        close();
+        mem_name = (pipename[0] == '/') ? pipename : std::string("/") + pipename;
+        const bool isPath = mem_name.find('/', 1) != std::string::npos;
+        const int flags = O_RDWR | ((size > 0) ? O_CREAT : 0);
+        const int fd = (isPath) ? ::open(mem_name.c_str(), flags, S_IRUSR | S_IWUSR) : shm_open(mem_name.c_str(), flags, S_IRUSR | S_IWUSR);
+        if (fd < 0) {
+            return;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            ::close(fd);
+            return;
+        }
+        if (size == 0) {
+            size = (uint64_t)st.st_size;
+        } else if ((uint64_t)st.st_size < size && ftruncate(fd, (off_t)size) != 0) {
+            ::close(fd);
+            return;
+        }
+        void *ptr = (size > 0) ? mmap(nullptr, (size_t)size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+        ::close(fd); //マッピング後はfdは不要
+        if (ptr == MAP_FAILED) {
+            return;
+        }
+        shared_size = size;
+        buffer = ptr;
+        handle = ptr;
+    }
+    void close() override {
+        if (buffer != nullptr) {
+            munmap(buffer, (size_t)shared_size);
+            buffer = nullptr;
+        }
+        handle = nullptr;
+        shared_size = 0;
+        mem_name.clear();
+    }
+};
 #endif //#if defined(_WIN32) || defined(_WIN64)
 
 #endif //__RGY_SHARED_MEM_H__
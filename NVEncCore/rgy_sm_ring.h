@@ -0,0 +1,133 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2024 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// --------------------------------------------------------------------------------------------
+
+
+#pragma once
+#ifndef __RGY_SM_RING_H__
+#define __RGY_SM_RING_H__
+
+// 共有メモリによるフレームの受け渡し (Linux版 --sm)
+// 他のプロセスからフレームを書き込めるよう、このヘッダ単体で使用できるようにしている
+//
+// プロデューサ側は、shm_open(またはmemfd_create)で作成した共有メモリに以下の配置で書き込む
+//   [RGYSMRingHeader]
+//   [slot 0] [slot 1] ... [slot n-1]   (スロットiは dataOffset + i * slotSize から)
+//
+// 各スロットのフレームの配置は、Windows版の --sm と同じ
+//   Y平面 (pitch x height) の直後に色差平面を詰めて配置する
+//   NV12/P010 : UV (pitch x height/2)
+//   YV12系    : U, V (それぞれ pitch/2 x height/2)
+//   YUV422系  : U, V (それぞれ pitch/2 x height)
+//   YUV444系  : U, V (それぞれ pitch x height)
+//
+// フレームはslot[frame % slots]に順番に書き込む
+//   プロデューサ: stateがRGY_SM_SLOT_EMPTYになるまで待機 -> 書き込み -> RGY_SM_SLOT_FILLEDにしてwake
+//   読み込み側  : stateがRGY_SM_SLOT_FILLEDになるまで待機 -> RGY_SM_SLOT_READINGにして使用 -> RGY_SM_SLOT_EMPTYにしてwake
+// 読み込み側は、GPUへの転送が終わるまでスロットを直接参照する場合がある
+// (その間はRGY_SM_SLOT_READINGのままなので、プロデューサ側はEMPTYになるまで待つこと)
+// 入力の終了時は、abortを1にして全スロットをwakeする (書き込み済みのフレームは読み込まれる)
+// stateはプロセス間で共有するfutexとして使用する (FUTEX_PRIVATE_FLAGは使用しないこと)
+
+#include <stdint.h>
+
+#define RGY_SM_RING_MAGIC       (0x4d535952u) // "RYSM"
+#define RGY_SM_RING_VERSION     (1u)
+#define RGY_SM_RING_MAX_SLOTS   (32)
+#define RGY_SM_RING_DATA_ALIGN  (4096)
+
+enum {
+    RGY_SM_SLOT_EMPTY   = 0,
+    RGY_SM_SLOT_FILLED  = 1,
+    RGY_SM_SLOT_READING = 2, // 読み込み側が使用中 (読み込み側のみが設定する)
+};
+
+typedef struct {
+    uint32_t state;       // RGY_SM_SLOT_EMPTY / RGY_SM_SLOT_FILLED / RGY_SM_SLOT_READING (futex)
+    int32_t  dropped;     // プロデューサ側で脱落させたフレーム数 (累計)
+    int64_t  timestamp;   // timebase = 1 / (fpsN / fpsD * 4)
+    int64_t  duration;    // timebase = 1 / (fpsN / fpsD * 4)
+    uint64_t frameId;     // フレームの通し番号
+    uint8_t  reserved[32];
+} RGYSMRingSlot;
+
+typedef struct {
+    uint32_t magic;       // RGY_SM_RING_MAGIC
+    uint32_t version;     // RGY_SM_RING_VERSION
+    uint32_t headerSize;  // sizeof(RGYSMRingHeader)
+    uint32_t slots;       // スロット数 (1 - RGY_SM_RING_MAX_SLOTS)
+    uint64_t slotSize;    // 1スロットのバイト数
+    uint64_t dataOffset;  // 先頭スロットの共有メモリ先頭からのオフセット (RGY_SM_RING_DATA_ALIGNの倍数)
+    int32_t  width;
+    int32_t  height;
+    int32_t  fpsN;
+    int32_t  fpsD;
+    int32_t  pitch;       // Y平面のpitch (バイト)
+    int32_t  csp;         // RGY_CSP
+    int32_t  picstruct;   // RGY_PICSTRUCT
+    int32_t  frames;      // 総フレーム数 (不明な場合は0)
+    uint32_t afs;
+    uint32_t abort;       // 1なら入力終了
+    uint32_t producerPid; // プロデューサのpid (0ならプロセスの終了を検出しない)
+    uint32_t consumerPid; // 読み込み側のpid (読み込み側が設定する)
+    uint8_t  reserved[48];
+    RGYSMRingSlot slot[RGY_SM_RING_MAX_SLOTS];
+} RGYSMRingHeader;
+
+#if defined(__cplusplus)
+static_assert(sizeof(RGYSMRingSlot) == 64, "unexpected size of RGYSMRingSlot");
+static_assert(sizeof(RGYSMRingHeader) == 128 + 64 * RGY_SM_RING_MAX_SLOTS, "unexpected size of RGYSMRingHeader");
+#endif
+
+#if defined(__linux__)
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+static inline uint32_t rgy_sm_load(const uint32_t *addr) {
+    return __atomic_load_n(addr, __ATOMIC_ACQUIRE);
+}
+
+// *addrを書き換えて、待機しているプロセスを起こす
+static inline void rgy_sm_store_wake(uint32_t *addr, uint32_t value) {
+    __atomic_store_n(addr, value, __ATOMIC_RELEASE);
+    syscall(SYS_futex, addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+// *addrがvalueでなくなるか、timeout_ms経過するまで待機する
+static inline void rgy_sm_wait_while(uint32_t *addr, uint32_t value, int timeout_ms) {
+    struct timespec ts;
+    ts.tv_sec = timeout_ms / 1000;
+    ts.tv_nsec = (long)(timeout_ms % 1000) * 1000000L;
+    if (rgy_sm_load(addr) == value) {
+        syscall(SYS_futex, addr, FUTEX_WAIT, value, &ts, NULL, 0);
+    }
+}
+#endif //#if defined(__linux__)
+
+#endif //__RGY_SM_RING_H__
@@ -0,0 +1,251 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2024 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// --------------------------------------------------------------------------------------------
+
+#if defined(_WIN32) || defined(_WIN64)
+#define WIN32_LEAN_AND_MEAN
+#include <winsock2.h>
+#include <afunix.h>
+#pragma comment(lib, "ws2_32.lib")
+#else
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+#include <cerrno>
+#include <cstring>
+#include <mutex>
+#include "rgy_socket.h"
+#include "rgy_util.h"
+
+#if defined(_WIN32) || defined(_WIN64)
+typedef SOCKET rgy_socket_t;
+static const intptr_t RGY_INVALID_SOCKET = (intptr_t)INVALID_SOCKET;
+#define rgy_closesocket closesocket
+static void rgy_unlink(const tstring& path) { DeleteFileW(path.c_str()); }
+static bool rgy_socket_conn_refused() { return WSAGetLastError() == WSAECONNREFUSED; }
+//Windowsではファイルのアクセス権は作成先フォルダのACLに従う
+static bool rgy_socket_set_owner_only(const char *path) { UNREFERENCED_PARAMETER(path); return true; }
+
+static bool rgy_socket_init() {
+    static std::once_flag initFlag;
+    static bool initialized = false;
+    std::call_once(initFlag, []() {
+        WSADATA wsaData;
+        initialized = WSAStartup(MAKEWORD(2, 2), &wsaData) == 0;
+    });
+    return initialized;
+}
+#else
+typedef int rgy_socket_t;
+static const intptr_t RGY_INVALID_SOCKET = -1;
+#define rgy_closesocket ::close
+static void rgy_unlink(const tstring& path) { unlink(path.c_str()); }
+static bool rgy_socket_conn_refused() { return errno == ECONNREFUSED; }
+static bool rgy_socket_set_owner_only(const char *path) { return chmod(path, S_IRUSR | S_IWUSR) == 0; }
+static bool rgy_socket_init() { return true; }
+#endif
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+static bool set_socket_path(sockaddr_un& addr, const tstring& path) {
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    const auto pathA = tchar_to_string(path, CP_UTF8);
+    if (pathA.length() >= sizeof(addr.sun_path)) {
+        return false;
+    }
+    strcpy_s(addr.sun_path, sizeof(addr.sun_path), pathA.c_str());
+    return true;
+}
+
+RGYLocalSocket::RGYLocalSocket() :
+    m_sock(RGY_INVALID_SOCKET),
+    m_listenPath(),
+    m_buf() {
+}
+
+RGYLocalSocket::~RGYLocalSocket() {
+    close();
+}
+
+bool RGYLocalSocket::is_open() const {
+    return m_sock != RGY_INVALID_SOCKET;
+}
+
+RGY_ERR RGYLocalSocket::listen(const tstring& path) {
+    close();
+    if (!rgy_socket_init()) {
+        return RGY_ERR_NOT_INITIALIZED;
+    }
+    sockaddr_un addr;
+    if (!set_socket_path(addr, path)) {
+        return RGY_ERR_INVALID_PARAM;
+    }
+    rgy_socket_t sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if ((intptr_t)sock == RGY_INVALID_SOCKET) {
+        return RGY_ERR_DEVICE_FAILED;
+    }
+    //既に待ち受け中のプロセスがあれば、そのソケットファイルを削除してはならない
+    //接続を試み、接続が拒否された場合 (前回の異常終了で残ったファイル) のみ削除する
+    if (::connect(sock, (const sockaddr *)&addr, sizeof(addr)) == 0) {
+        rgy_closesocket(sock);
+        return RGY_ERR_ALREADY_INITIALIZED;
+    }
+    const bool staleSocket = rgy_socket_conn_refused();
+    rgy_closesocket(sock);
+    sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if ((intptr_t)sock == RGY_INVALID_SOCKET) {
+        return RGY_ERR_DEVICE_FAILED;
+    }
+    if (staleSocket) {
+        rgy_unlink(path);
+    }
+    //listen前は接続できないので、bindとchmodの間に他のユーザーから接続されることはない
+    if (bind(sock, (const sockaddr *)&addr, sizeof(addr)) != 0
+        || !rgy_socket_set_owner_only(addr.sun_path)
+        || ::listen(sock, 16) != 0) {
+        rgy_closesocket(sock);
+        return RGY_ERR_ACCESS_DENIED;
+    }
+    m_sock = (intptr_t)sock;
+    m_listenPath = path;
+    return RGY_ERR_NONE;
+}
+
+RGY_ERR RGYLocalSocket::connect(const tstring& path) {
+    close();
+    if (!rgy_socket_init()) {
+        return RGY_ERR_NOT_INITIALIZED;
+    }
+    sockaddr_un addr;
+    if (!set_socket_path(addr, path)) {
+        return RGY_ERR_INVALID_PARAM;
+    }
+    rgy_socket_t sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if ((intptr_t)sock == RGY_INVALID_SOCKET) {
+        return RGY_ERR_DEVICE_FAILED;
+    }
+    if (::connect(sock, (const sockaddr *)&addr, sizeof(addr)) != 0) {
+        rgy_closesocket(sock);
+        return RGY_ERR_NOT_FOUND;
+    }
+    m_sock = (intptr_t)sock;
+    return RGY_ERR_NONE;
+}
+
+std::unique_ptr<RGYLocalSocket> RGYLocalSocket::accept() {
+    if (!is_open()) {
+        return nullptr;
+    }
+    rgy_socket_t sock = ::accept((rgy_socket_t)m_sock, nullptr, nullptr);
+    if ((intptr_t)sock == RGY_INVALID_SOCKET) {
+        return nullptr;
+    }
+    auto client = std::make_unique<RGYLocalSocket>();
+    client->m_sock = (intptr_t)sock;
+    return client;
+}
+
+bool RGYLocalSocket::waitReadable(int timeoutMs) {
+    if (!is_open()) {
+        return false;
+    }
+    if (m_buf.find('\n') != std::string::npos) {
+        return true;
+    }
+    fd_set fds;
+    FD_ZERO(&fds);
+    FD_SET((rgy_socket_t)m_sock, &fds);
+    timeval tv;
+    tv.tv_sec = timeoutMs / 1000;
+    tv.tv_usec = (timeoutMs % 1000) * 1000;
+    return select((int)m_sock + 1, &fds, nullptr, nullptr, &tv) > 0;
+}
+
+RGY_ERR RGYLocalSocket::readLine(std::string& line) {
+    line.clear();
+    if (!is_open()) {
+        return RGY_ERR_NOT_INITIALIZED;
+    }
+    for (;;) {
+        const auto pos = m_buf.find('\n');
+        if (pos != std::string::npos) {
+            line = m_buf.substr(0, pos);
+            m_buf.erase(0, pos + 1);
+            if (line.length() > 0 && line.back() == '\r') {
+                line.pop_back();
+            }
+            return RGY_ERR_NONE;
+        }
+        char buffer[4096];
+        const auto ret = recv((rgy_socket_t)m_sock, buffer, sizeof(buffer), 0);
+        if (ret <= 0) {
+            //改行のないまま閉じられた場合は残りを返す
+            if (m_buf.length() > 0) {
+                line = m_buf;
+                m_buf.clear();
+                return RGY_ERR_NONE;
+            }
+            return RGY_ERR_MORE_DATA;
+        }
+        m_buf.append(buffer, ret);
+        if (m_buf.find('\n') == std::string::npos && m_buf.length() > RGY_LOCAL_SOCKET_LINE_MAX) {
+            m_buf.clear();
+            return RGY_ERR_NOT_ENOUGH_BUFFER;
+        }
+    }
+}
+
+RGY_ERR RGYLocalSocket::write(const std::string& str) {
+    if (!is_open()) {
+        return RGY_ERR_NOT_INITIALIZED;
+    }
+    size_t sent = 0;
+    while (sent < str.length()) {
+        const auto ret = send((rgy_socket_t)m_sock, str.c_str() + sent, (int)(str.length() - sent), MSG_NOSIGNAL);
+        if (ret <= 0) {
+            return RGY_ERR_DEVICE_FAILED;
+        }
+        sent += ret;
+    }
+    return RGY_ERR_NONE;
+}
+
+void RGYLocalSocket::close() {
+    if (is_open()) {
+        rgy_closesocket((rgy_socket_t)m_sock);
+        m_sock = RGY_INVALID_SOCKET;
+    }
+    if (m_listenPath.length() > 0) {
+        rgy_unlink(m_listenPath);
+        m_listenPath.clear();
+    }
+    m_buf.clear();
+}
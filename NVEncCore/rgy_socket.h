@@ -0,0 +1,73 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2024 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// --------------------------------------------------------------------------------------------
+
+#pragma once
+#ifndef __RGY_SOCKET_H__
+#define __RGY_SOCKET_H__
+
+#include <cstdint>
+#include <string>
+#include <memory>
+#include "rgy_tchar.h"
+#include "rgy_err.h"
+
+// readLineで受け付ける1行の最大長
+static const size_t RGY_LOCAL_SOCKET_LINE_MAX = 64 * 1024;
+
+// ローカル通信用のソケット (AF_UNIX)
+// Windows 10 (1803) 以降とLinuxで使用可能
+// Linuxではソケットファイルを所有者のみ接続可能(0600)で作成する
+class RGYLocalSocket {
+public:
+    RGYLocalSocket();
+    ~RGYLocalSocket();
+
+    // 指定のパスで待ち受けを開始する
+    // 既に待ち受け中のプロセスがある場合はRGY_ERR_ALREADY_INITIALIZEDを返す (接続できない古いソケットファイルは削除する)
+    RGY_ERR listen(const tstring& path);
+    // 指定のパスに接続する
+    RGY_ERR connect(const tstring& path);
+    // 接続を受け付ける (listen中のみ)
+    std::unique_ptr<RGYLocalSocket> accept();
+    // 読み取り可能になるまで最大timeoutMs待機する
+    bool waitReadable(int timeoutMs);
+    // 改行までを読み取る (改行は含まない)、接続が閉じられた場合はRGY_ERR_MORE_DATAを返す
+    // 1行がRGY_LOCAL_SOCKET_LINE_MAXを超える場合はRGY_ERR_NOT_ENOUGH_BUFFERを返す
+    RGY_ERR readLine(std::string& line);
+    RGY_ERR write(const std::string& str);
+    void close();
+    bool is_open() const;
+protected:
+    RGYLocalSocket(const RGYLocalSocket&) = delete;
+    RGYLocalSocket& operator=(const RGYLocalSocket&) = delete;
+
+    intptr_t m_sock;     // SOCKET or fd
+    tstring m_listenPath; // listen時に作成したソケットファイル
+    std::string m_buf;    // readLineの読み残し
+};
+
+#endif //__RGY_SOCKET_H__
@@ -509,3 +509,184 @@ bool CProcSpeedControl::wait(uint32_t nCount) {
     m_nCountLast = nCount;
     return ret;
 }
+
+RGYRealtimeScheduler::RGYRealtimeScheduler() :
+    m_enable(false),
+    m_latencyMs(RGY_REALTIME_LATENCY_DEFAULT),
+    m_maxLevel(RGYRealtimeLevel::DropFrame),
+    m_level(RGYRealtimeLevel::None),
+    m_unavailable(0),
+    m_timebase(),
+    m_firstTimestamp(-1),
+    m_tmStart(),
+    m_tmLevelChanged(),
+    m_tmRecoverStart(),
+    m_recovering(false),
+    m_framesOut(0),
+    m_framesDropped(0),
+    m_latencyMax(0.0),
+    m_latencyHist(),
+    m_events(),
+    m_log() {
+}
+
+RGYRealtimeScheduler::~RGYRealtimeScheduler() {
+}
+
+void RGYRealtimeScheduler::init(int latencyMs, RGYRealtimeLevel maxLevel, rgy_rational<int> timebase, std::shared_ptr<RGYLog> log) {
+    m_enable = latencyMs > 0 && timebase.is_valid() && timebase.n() > 0;
+    m_latencyMs = latencyMs;
+    m_maxLevel = maxLevel;
+    m_level = RGYRealtimeLevel::None;
+    m_unavailable = 0;
+    m_timebase = timebase;
+    m_firstTimestamp = -1;
+    m_recovering = false;
+    m_framesOut = 0;
+    m_framesDropped = 0;
+    m_latencyMax = 0.0;
+    m_latencyHist.assign(HIST_MAX_MS + 1, 0);
+    m_events.clear();
+    m_log = log;
+}
+
+double RGYRealtimeScheduler::elapsedMs(std::chrono::high_resolution_clock::time_point t) const {
+    return std::chrono::duration<double, std::milli>(t - m_tmStart).count();
+}
+
+double RGYRealtimeScheduler::mediaMs(int64_t timestamp) const {
+    return (double)(timestamp - m_firstTimestamp) * m_timebase.qdouble() * 1000.0;
+}
+
+bool RGYRealtimeScheduler::frameIn(int64_t timestamp) {
+    if (!m_enable) {
+        return true;
+    }
+    auto tmNow = std::chrono::high_resolution_clock::now();
+    if (m_firstTimestamp < 0) {
+        //最初のフレームの時刻を実時間の基準とする
+        m_firstTimestamp = timestamp;
+        m_tmStart = tmNow;
+        m_tmLevelChanged = tmNow;
+        return true;
+    }
+    const double media = mediaMs(timestamp);
+    const double now = elapsedMs(tmNow);
+    if (now + 1.0 < media) {
+        //ファイル入力などで実時間より先行している場合は、そのフレームの時刻まで待つ
+        std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(media - now));
+        return true;
+    }
+    if (m_level >= RGYRealtimeLevel::DropFrame && now > media + m_latencyMs) {
+        //締め切りを過ぎたフレームは間引く
+        m_framesDropped++;
+        return false;
+    }
+    return true;
+}
+
+bool RGYRealtimeScheduler::frameOut(int64_t timestamp) {
+    if (!m_enable || m_firstTimestamp < 0) {
+        return false;
+    }
+    auto tmNow = std::chrono::high_resolution_clock::now();
+    const double latency = (std::max)(elapsedMs(tmNow) - mediaMs(timestamp), 0.0);
+    m_latencyHist[(std::min)((int)latency, HIST_MAX_MS)]++;
+    m_latencyMax = (std::max)(m_latencyMax, latency);
+    m_framesOut++;
+
+    //段階を変えた直後は効果が出るまで待つ
+    const double sinceChange = std::chrono::duration<double, std::milli>(tmNow - m_tmLevelChanged).count();
+    const double holdMs = (std::max)(m_latencyMs, 1000.0);
+    if (latency > m_latencyMs) {
+        m_recovering = false;
+        if (const auto next = stepLevel(1); next != m_level && sinceChange >= holdMs) {
+            setLevel(next, latency);
+            return true;
+        }
+    } else if (latency < m_latencyMs * 0.5) {
+        //十分に余裕がある状態が続いたら1段階戻す
+        if (!m_recovering) {
+            m_recovering = true;
+            m_tmRecoverStart = tmNow;
+        } else if (m_level > RGYRealtimeLevel::None
+            && sinceChange >= holdMs
+            && std::chrono::duration<double, std::milli>(tmNow - m_tmRecoverStart).count() >= holdMs * 5) {
+            m_recovering = false;
+            setLevel(stepLevel(-1), latency);
+            return true;
+        }
+    } else {
+        m_recovering = false;
+    }
+    return false;
+}
+
+RGYRealtimeLevel RGYRealtimeScheduler::stepLevel(int step) const {
+    //使用できない段階は飛ばす
+    for (int level = (int)m_level + step; (int)RGYRealtimeLevel::None <= level && level <= (int)m_maxLevel; level += step) {
+        if (available((RGYRealtimeLevel)level)) {
+            return (RGYRealtimeLevel)level;
+        }
+    }
+    return m_level;
+}
+
+void RGYRealtimeScheduler::levelFailed() {
+    if (m_events.size() == 0) {
+        return;
+    }
+    const auto event = m_events.back();
+    m_events.pop_back();
+    if (event.to > event.from) {
+        m_unavailable |= 1u << (int)event.to;
+    }
+    if (m_log) {
+        m_log->write(RGY_LOG_WARN, RGY_LOGT_CORE, _T("realtime: failed to apply %s, back to %s.\n"),
+            get_chr_from_value(list_realtime_degrade, (int)event.to), get_chr_from_value(list_realtime_degrade, (int)event.from));
+    }
+    m_level = event.from;
+}
+
+void RGYRealtimeScheduler::setLevel(RGYRealtimeLevel level, double latencyMs) {
+    RGYRealtimeEvent event;
+    event.frame = m_framesOut;
+    event.latencyMs = latencyMs;
+    event.from = m_level;
+    event.to = level;
+    m_events.push_back(event);
+    if (m_log) {
+        m_log->write((level > m_level) ? RGY_LOG_WARN : RGY_LOG_INFO, RGY_LOGT_CORE,
+            _T("realtime: frame %lld, latency %.1f ms, %s -> %s.\n"), (long long)event.frame, latencyMs,
+            get_chr_from_value(list_realtime_degrade, (int)m_level), get_chr_from_value(list_realtime_degrade, (int)level));
+    }
+    m_level = level;
+    m_tmLevelChanged = std::chrono::high_resolution_clock::now();
+}
+
+double RGYRealtimeScheduler::latencyPercentile(double percent) const {
+    if (m_framesOut == 0) {
+        return 0.0;
+    }
+    const int64_t target = (std::max<int64_t>)(1, (int64_t)std::ceil(m_framesOut * percent * 0.01));
+    int64_t count = 0;
+    for (int i = 0; i < (int)m_latencyHist.size(); i++) {
+        count += m_latencyHist[i];
+        if (count >= target) {
+            return (i == HIST_MAX_MS) ? m_latencyMax : (double)i;
+        }
+    }
+    return m_latencyMax;
+}
+
+void RGYRealtimeScheduler::printResult() const {
+    if (!m_enable || !m_log) {
+        return;
+    }
+    m_log->write(RGY_LOG_INFO, RGY_LOGT_CORE_RESULT, _T("realtime: latency p50 %.0f ms, p99 %.0f ms, max %.0f ms (limit %.0f ms), dropped %lld frames.\n"),
+        latencyPercentile(50.0), latencyPercentile(99.0), m_latencyMax, m_latencyMs, (long long)m_framesDropped);
+    for (const auto& event : m_events) {
+        m_log->write(RGY_LOG_INFO, RGY_LOGT_CORE_RESULT, _T("realtime:   frame %8lld: %-9s -> %-9s (latency %.1f ms)\n"), (long long)event.frame,
+            get_chr_from_value(list_realtime_degrade, (int)event.from), get_chr_from_value(list_realtime_degrade, (int)event.to), event.latencyMs);
+    }
+}
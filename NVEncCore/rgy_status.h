@@ -42,6 +42,8 @@
 #include <algorithm>
 #include "rgy_err.h"
 #include "rgy_def.h"
+#include "rgy_util.h"
+#include "rgy_log.h"
 
 using std::chrono::duration_cast;
 
@@ -140,4 +142,62 @@ private:
     std::chrono::high_resolution_clock::time_point m_tmLastCheck;
 };
 
+struct RGYRealtimeEvent {
+    int64_t frame;           //出力フレーム番号
+    double latencyMs;        //変更時の遅延
+    RGYRealtimeLevel from;
+    RGYRealtimeLevel to;
+};
+
+//入力のタイムスタンプから各フレームの締め切りを計算し、
+//遅れている場合には段階的に処理を軽くしてリアルタイム性を維持する
+class RGYRealtimeScheduler {
+public:
+    RGYRealtimeScheduler();
+    virtual ~RGYRealtimeScheduler();
+    void init(int latencyMs, RGYRealtimeLevel maxLevel, rgy_rational<int> timebase, std::shared_ptr<RGYLog> log);
+    bool enabled() const { return m_enable; }
+    RGYRealtimeLevel level() const { return m_level; }
+
+    //入力フレームごとに呼ぶ
+    //早すぎる場合はそのフレームの時刻まで待機し、間引くべきならfalseを返す
+    bool frameIn(int64_t timestamp);
+    //エンコーダに送ったフレームごとに呼び、遅延を記録して劣化段階を更新する
+    //段階が変化したらtrueを返す
+    bool frameOut(int64_t timestamp);
+    //直前の段階の変更を適用できなかった場合に呼び、元の段階に戻す
+    //悪化方向で失敗した段階は以降使用しない
+    void levelFailed();
+    bool available(RGYRealtimeLevel level) const { return (m_unavailable & (1u << (int)level)) == 0; }
+
+    double latencyPercentile(double percent) const;
+    const std::vector<RGYRealtimeEvent>& events() const { return m_events; }
+    void printResult() const;
+protected:
+    double elapsedMs(std::chrono::high_resolution_clock::time_point t) const;
+    double mediaMs(int64_t timestamp) const;
+    void setLevel(RGYRealtimeLevel level, double latencyMs);
+    RGYRealtimeLevel stepLevel(int step) const;
+
+    static const int HIST_MAX_MS = 60000;
+
+    bool m_enable;
+    double m_latencyMs;
+    RGYRealtimeLevel m_maxLevel;
+    RGYRealtimeLevel m_level;
+    uint32_t m_unavailable; //適用できなかった段階 (1 << level)
+    rgy_rational<int> m_timebase;
+    int64_t m_firstTimestamp;
+    std::chrono::high_resolution_clock::time_point m_tmStart;
+    std::chrono::high_resolution_clock::time_point m_tmLevelChanged;
+    std::chrono::high_resolution_clock::time_point m_tmRecoverStart; //遅延が小さくなり始めた時刻
+    bool m_recovering;
+    int64_t m_framesOut;
+    int64_t m_framesDropped;
+    double m_latencyMax;
+    std::vector<uint32_t> m_latencyHist; //1ms刻みのヒストグラム
+    std::vector<RGYRealtimeEvent> m_events;
+    std::shared_ptr<RGYLog> m_log;
+};
+
 #endif //__RGY_STATUS_H__
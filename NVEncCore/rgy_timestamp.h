@@ -0,0 +1,172 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2024 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// --------------------------------------------------------------------------------------------
+
+
+#pragma once
+#ifndef __RGY_TIMESTAMP_H__
+#define __RGY_TIMESTAMP_H__
+
+#include <cstdint>
+#include <climits>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#include "rgy_version.h"
+#include "rgy_util.h"
+
+// 無効なtimestamp (ffmpegのAV_NOPTS_VALUEと同じ値)
+// ffmpegなしのビルドではAV_NOPTS_VALUEが-1となり有効な値と区別できないので、こちらを使用する
+static const int64_t RGY_NOPTS_VALUE = INT64_MIN;
+
+// timestampの変換時の丸め方
+enum class RGYRescaleRound {
+    NearInf, // 最も近い値 (0.5は0から遠い方へ), av_rescale_qと同じ
+    Ceil,    // 正の無限大方向
+    Floor,   // 負の無限大方向
+};
+
+// rational_rescaleの丸め方
+// avswを使用しない場合は、従来と同じく切り上げとする
+#if ENABLE_AVSW_READER
+static const RGYRescaleRound RGY_RESCALE_ROUND_DEFAULT = RGYRescaleRound::NearInf;
+#else
+static const RGYRescaleRound RGY_RESCALE_ROUND_DEFAULT = RGYRescaleRound::Ceil;
+#endif
+
+struct RGYUInt128 {
+    uint64_t hi, lo;
+};
+
+static inline RGYUInt128 rgy_umul128(const uint64_t a, const uint64_t b) {
+#if defined(__SIZEOF_INT128__)
+    const unsigned __int128 r = (unsigned __int128)a * b;
+    return { (uint64_t)(r >> 64), (uint64_t)r };
+#elif defined(_M_X64)
+    uint64_t hi = 0;
+    const uint64_t lo = _umul128(a, b, &hi);
+    return { hi, lo };
+#else
+    const uint64_t a0 = a & 0xffffffffu, a1 = a >> 32;
+    const uint64_t b0 = b & 0xffffffffu, b1 = b >> 32;
+    const uint64_t p00 = a0 * b0, p01 = a0 * b1, p10 = a1 * b0, p11 = a1 * b1;
+    const uint64_t mid = (p00 >> 32) + (p01 & 0xffffffffu) + (p10 & 0xffffffffu);
+    return { p11 + (p01 >> 32) + (p10 >> 32) + (mid >> 32), (mid << 32) | (p00 & 0xffffffffu) };
+#endif
+}
+
+// 128bit / 64bit (n.hi < d であること = 商が64bitに収まること)
+static inline uint64_t rgy_udiv128(const RGYUInt128 n, const uint64_t d, uint64_t *rem) {
+#if defined(__SIZEOF_INT128__)
+    const unsigned __int128 nn = ((unsigned __int128)n.hi << 64) | n.lo;
+    const uint64_t q = (uint64_t)(nn / d);
+    *rem = n.lo - q * d;
+    return q;
+#elif defined(_M_X64) && _MSC_VER >= 1920
+    return _udiv128(n.hi, n.lo, d, rem);
+#else
+    uint64_t r = n.hi, q = 0;
+    for (int i = 63; i >= 0; i--) {
+        const bool carry = (r >> 63) != 0;
+        r = (r << 1) | ((n.lo >> i) & 1);
+        q <<= 1;
+        if (carry || r >= d) {
+            r -= d;
+            q |= 1;
+        }
+    }
+    *rem = r;
+    return q;
+#endif
+}
+
+// v * mul / div を厳密に計算する (mul >= 0, div > 0)
+// 中間値は128bitで保持し、結果がint64_tに収まらない場合は飽和させる
+static inline int64_t rgy_muldiv(const int64_t v, const int64_t mul, const int64_t div, const RGYRescaleRound rnd) {
+    if (div <= 0 || mul < 0) {
+        return INT64_MIN;
+    }
+    const bool neg = v < 0;
+    const uint64_t absv = (neg) ? (uint64_t)0 - (uint64_t)v : (uint64_t)v;
+    uint64_t q = 0, r = 0;
+    if (mul == 0 || absv <= UINT64_MAX / (uint64_t)mul) {
+        //64bitで収まる場合 (通常はこちら)
+        const uint64_t p = absv * (uint64_t)mul;
+        q = p / (uint64_t)div;
+        r = p - q * (uint64_t)div;
+    } else {
+        const auto p = rgy_umul128(absv, (uint64_t)mul);
+        if (p.hi >= (uint64_t)div) {
+            return (neg) ? INT64_MIN : INT64_MAX;
+        }
+        q = rgy_udiv128(p, (uint64_t)div, &r);
+    }
+    //絶対値に対して丸めを行う
+    if (r != 0) {
+        switch (rnd) {
+        case RGYRescaleRound::NearInf: q += (r >= (uint64_t)div - (uint64_t)div / 2) ? 1 : 0; break;
+        case RGYRescaleRound::Ceil:    q += (neg) ? 0 : 1; break;
+        case RGYRescaleRound::Floor:   q += (neg) ? 1 : 0; break;
+        default: break;
+        }
+    }
+    if (q > (uint64_t)INT64_MAX) {
+        return (neg) ? INT64_MIN : INT64_MAX;
+    }
+    return (neg) ? -(int64_t)q : (int64_t)q;
+}
+
+// timebaseの組み合わせが決まっている場合に、あらかじめ約分しておいて変換する
+class RGYRescaler {
+public:
+    RGYRescaler() : m_mul(1), m_div(1), m_rnd(RGY_RESCALE_ROUND_DEFAULT) {};
+    RGYRescaler(rgy_rational<int> from, rgy_rational<int> to, RGYRescaleRound rnd = RGY_RESCALE_ROUND_DEFAULT) :
+        m_mul((int64_t)from.n() * (int64_t)to.d()), m_div((int64_t)from.d() * (int64_t)to.n()), m_rnd(rnd) {
+        rgy_reduce(m_mul, m_div);
+        if (m_div < 0) {
+            m_mul = -m_mul;
+            m_div = -m_div;
+        }
+    };
+    //RGY_NOPTS_VALUEはav_rescale_qの呼び出し側と同様にそのまま返す
+    int64_t operator()(const int64_t v) const {
+        if (v == RGY_NOPTS_VALUE || (m_div == 1 && m_mul == 1)) {
+            return v;
+        }
+        return rgy_muldiv(v, m_mul, m_div, m_rnd);
+    }
+    int64_t mul() const { return m_mul; }
+    int64_t div() const { return m_div; }
+protected:
+    int64_t m_mul;
+    int64_t m_div;
+    RGYRescaleRound m_rnd;
+};
+
+// RGY_NOPTS_VALUEはそのまま返す
+int64_t rational_rescale(int64_t v, rgy_rational<int> from, rgy_rational<int> to);
+
+#endif //__RGY_TIMESTAMP_H__
@@ -690,3 +690,39 @@ unsigned short float2half(float value) {
     }
     return fp16;
 }
+
+// convert half precision floating point to float
+float half2float(unsigned short value) {
+    union {
+        unsigned int u;
+        float f;
+    } tmp;
+
+    // 1 : 5 : 10
+    const unsigned int sign = (value & 0x8000) >> 15;
+    const unsigned int exponent = (value & 0x7C00) >> 10;
+    unsigned int significand = value & 0x03FF;
+
+    if (exponent == 0) {
+        if (significand == 0) {
+            // zero
+            tmp.u = sign << 31;
+        } else {
+            // denormal -> normalize
+            int newexp = 1 + (127 - 15);
+            while ((significand & 0x0400) == 0) {
+                significand <<= 1;
+                newexp--;
+            }
+            significand &= 0x03FF;
+            tmp.u = (sign << 31) | ((unsigned int)newexp << 23) | (significand << 13);
+        }
+    } else if (exponent == 0x1F) {
+        // infinity or NaN
+        tmp.u = (sign << 31) | (0xFF << 23) | (significand << 13);
+    } else {
+        // normalized
+        tmp.u = (sign << 31) | ((exponent + (127 - 15)) << 23) | (significand << 13);
+    }
+    return tmp.f;
+}
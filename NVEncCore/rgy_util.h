@@ -1105,5 +1105,6 @@ public:
 };
 
 unsigned short float2half(float value);
+float half2float(unsigned short value);
 
 #endif //__RGY_UTIL_H__
@@ -80,6 +80,7 @@ const char *get_encoder_version();
 #define AV_CHANNEL_LAYOUT_STRUCT_AVAIL 1
 #define AV_FRAME_DURATION_AVAIL 1
 #define AVCODEC_PAR_CODED_SIDE_DATA_AVAIL 1
+#define AV_CODEC_COPY_OPAQUE_AVAIL 1
 #define ENABLE_LIBASS_SUBBURN 1
 
 #ifndef ENABLE_NVOFFRUC_HEADER